@@ -11,6 +11,7 @@
 #include "version.h"
 #include "../../core/GameData.h"
 #include <sstream>
+#include <cstdlib>
 
 /////////////////////////////////////////////////////////////////////////////
 // Custom formatter for better visual spacing in help output
@@ -168,6 +169,13 @@ bool CommandParser::ParseCommandLine(int argc, char** argv)
 	m_commandType = CommandType::None;
 	m_patchCommand = PatchCommand();
 	m_sempqCommand = SEMPQCommand();
+	m_sempqUpdateCommand = SEMPQUpdateCommand();
+	m_mpqOverlayCommand = MPQOverlayCommand();
+	m_mpqMergeCommand = MPQMergeCommand();
+	m_mpqOptimizeHashCommand = MPQOptimizeHashCommand();
+	m_mpqRecompressCommand = MPQRecompressCommand();
+	m_mpqResectorCommand = MPQResectorCommand();
+	m_mpqVerifyCommand = MPQVerifyCommand();
 	m_message.clear();
 	m_helpRequested = false;
 	m_versionRequested = false;
@@ -217,6 +225,10 @@ bool CommandParser::ParseCommandLine(int argc, char** argv)
 		"Do not inject into child processes")
 		->group("Patching Options");
 
+	patch->add_flag("--trace-access", m_patchCommand.traceAccess,
+		"Record the files the game reads to <last MPQ>.trace, for mpq relayout")
+		->group("Patching Options");
+
 	patch->add_option("--shunt-count", m_patchCommand.shuntCount,
 		"Number of times target restarts before patching activates (default: 0)")
 		->default_val(0)
@@ -250,6 +262,10 @@ bool CommandParser::ParseCommandLine(int argc, char** argv)
 		->check(CLI::ExistingFile)
 		->group("Output");
 
+	sempq->add_flag("--thin", m_sempqCommand.thin,
+		"Use the shared MPQDraft runtime instead of embedding the patcher DLL")
+		->group("Output");
+
 	// -------------------------------------------------------------------------
 	// MPQ and Plugins (at least one must be specified - validated after parsing)
 	// -------------------------------------------------------------------------
@@ -321,11 +337,334 @@ bool CommandParser::ParseCommandLine(int argc, char** argv)
 		->check(CLI::NonNegativeNumber)
 		->group("Patching Options");
 
+	// =========================================================================
+	// SEMPQ-update subcommand
+	// =========================================================================
+	auto* sempqUpdate = app.add_subcommand("sempq-update",
+		"Replace, add or remove the plugins in an existing SEMPQ, without rebuilding it");
+
+	auto sempqUpdateFormatter = std::make_shared<GroupedFormatter>();
+	sempqUpdate->formatter(sempqUpdateFormatter);
+
+	sempqUpdate->add_option("-s,--sempq", m_sempqUpdateCommand.sempqPath,
+		"SEMPQ file to update")
+		->required()
+		->check(CLI::ExistingFile)
+		->group("SEMPQ");
+
+	sempqUpdate->add_option("-p,--plugin", m_sempqUpdateCommand.plugins,
+		"Plugin file(s) to embed, replacing the embedded version of the same plugin if there is one (can specify multiple)")
+		->check(CLI::ExistingFile)
+		->group("Plugins");
+
+	sempqUpdate->add_option("--remove", m_sempqUpdateCommand.removePlugins,
+		"ID (in hex, as shown when the plugin is loaded) of an embedded plugin to remove (can specify multiple)")
+		->group("Plugins");
+
+	// =========================================================================
+	// Install-runtime subcommand
+	// =========================================================================
+	auto* installRuntime = app.add_subcommand("install-runtime",
+		"Install this version's patcher DLL as the shared runtime, so that thin SEMPQs made with it can run");
+
 	// =========================================================================
 	// List-games subcommand
 	// =========================================================================
 	auto* listGames = app.add_subcommand("list-games", "List supported games");
 
+	// =========================================================================
+	// MPQ subcommands
+	// =========================================================================
+	auto* mpq = app.add_subcommand("mpq", "Inspect, merge and optimize MPQ archives");
+	mpq->require_subcommand(1);
+
+	auto* mpqOverlay = mpq->add_subcommand("overlay",
+		"Show which MPQ each file is read from when patching with several MPQs");
+
+	auto mpqOverlayFormatter = std::make_shared<GroupedFormatter>();
+	mpqOverlay->formatter(mpqOverlayFormatter);
+
+	mpqOverlay->add_option("-m,--mpq", m_mpqOverlayCommand.mpqs,
+		"MPQ archives, in the order they would be loaded (later MPQs override earlier ones)")
+		->required()
+		->check(CLI::ExistingFile)
+		->group("MPQs");
+
+	mpqOverlay->add_option("-l,--listfile", m_mpqOverlayCommand.listFiles,
+		"Text file(s) listing names of files in the MPQs, in addition to their (listfile)s")
+		->check(CLI::ExistingFile)
+		->group("MPQs");
+
+	mpqOverlay->add_flag("--all", m_mpqOverlayCommand.allFiles,
+		"List every file, not just the ones overridden by a later MPQ")
+		->group("Output");
+
+	auto* mpqMerge = mpq->add_subcommand("merge",
+		"Merge MPQs into one that gives the game the same files, as if they were loaded in order");
+
+	auto mpqMergeFormatter = std::make_shared<GroupedFormatter>();
+	mpqMerge->formatter(mpqMergeFormatter);
+
+	mpqMerge->add_option("-m,--mpq", m_mpqMergeCommand.mpqs,
+		"MPQ archives, in the order they would be loaded (later MPQs override earlier ones)")
+		->required()
+		->check(CLI::ExistingFile)
+		->group("MPQs");
+
+	mpqMerge->add_option("-l,--listfile", m_mpqMergeCommand.listFiles,
+		"Text file(s) listing names of files in the MPQs, in addition to their (listfile)s")
+		->check(CLI::ExistingFile)
+		->group("MPQs");
+
+	mpqMerge->add_option("-t,--trace", m_mpqMergeCommand.traceFiles,
+		"File access trace(s) from patch --trace-access; traced files are laid out first, in the order read")
+		->check(CLI::ExistingFile)
+		->group("MPQs");
+
+	mpqMerge->add_option("-o,--output", m_mpqMergeCommand.outputPath,
+		"Merged MPQ file path")
+		->required()
+		->group("Output");
+
+	mpqMerge->add_option("--sector-size", m_mpqMergeCommand.sectorSize,
+		"Sector size of the merged MPQ (default: the one most of the data already uses)")
+		->group("Output");
+
+	mpqMerge->add_option("--hash-table-size", m_mpqMergeCommand.hashTableSize,
+		"Hash table size of the merged MPQ, a power of 2 (default: a quarter larger than needed)")
+		->group("Output");
+
+	// Relayout is a merge of a single MPQ, in the order of a trace
+	auto* mpqRelayout = mpq->add_subcommand("relayout",
+		"Rewrite an MPQ with its files in the order the game reads them, so loading reads it from start to end");
+
+	auto mpqRelayoutFormatter = std::make_shared<GroupedFormatter>();
+	mpqRelayout->formatter(mpqRelayoutFormatter);
+
+	mpqRelayout->add_option("-m,--mpq", m_mpqMergeCommand.mpqs,
+		"MPQ archive to rewrite")
+		->required()
+		->expected(1)
+		->multi_option_policy(CLI::MultiOptionPolicy::Throw)
+		->check(CLI::ExistingFile)
+		->group("MPQs");
+
+	mpqRelayout->add_option("-t,--trace", m_mpqMergeCommand.traceFiles,
+		"File access trace(s) from patch --trace-access")
+		->required()
+		->check(CLI::ExistingFile)
+		->group("MPQs");
+
+	mpqRelayout->add_option("-l,--listfile", m_mpqMergeCommand.listFiles,
+		"Text file(s) listing names of files in the MPQ, in addition to its (listfile)")
+		->check(CLI::ExistingFile)
+		->group("MPQs");
+
+	mpqRelayout->add_option("-o,--output", m_mpqMergeCommand.outputPath,
+		"Rewritten MPQ file path")
+		->required()
+		->group("Output");
+
+	mpqRelayout->add_option("--sector-size", m_mpqMergeCommand.sectorSize,
+		"Sector size of the rewritten MPQ (default: the one it already uses)")
+		->group("Output");
+
+	mpqRelayout->add_option("--hash-table-size", m_mpqMergeCommand.hashTableSize,
+		"Hash table size of the rewritten MPQ, a power of 2 (default: a quarter larger than needed)")
+		->group("Output");
+
+	// Repack is a merge of a single MPQ, storing the files loaded most often uncompressed
+	auto* mpqRepack = mpq->add_subcommand("repack",
+		"Rewrite an MPQ with the files the game loads most often stored uncompressed, so they aren't decompressed on every load");
+
+	auto mpqRepackFormatter = std::make_shared<GroupedFormatter>();
+	mpqRepack->formatter(mpqRepackFormatter);
+
+	mpqRepack->add_option("-m,--mpq", m_mpqMergeCommand.mpqs,
+		"MPQ archive to rewrite")
+		->required()
+		->expected(1)
+		->multi_option_policy(CLI::MultiOptionPolicy::Throw)
+		->check(CLI::ExistingFile)
+		->group("MPQs");
+
+	mpqRepack->add_option("-p,--profile", m_mpqMergeCommand.profileFiles,
+		"Access profile(s): CSV lines of file name and load count, or traces from patch --trace-access")
+		->required()
+		->check(CLI::ExistingFile)
+		->group("MPQs");
+
+	mpqRepack->add_option("-l,--listfile", m_mpqMergeCommand.listFiles,
+		"Text file(s) listing names of files in the MPQ, in addition to its (listfile)")
+		->check(CLI::ExistingFile)
+		->group("MPQs");
+
+	mpqRepack->add_option("-o,--output", m_mpqMergeCommand.outputPath,
+		"Rewritten MPQ file path")
+		->required()
+		->group("Output");
+
+	mpqRepack->add_option("--budget", m_mpqMergeCommand.hotBudget,
+		"Most the MPQ may grow by, in KB (default: 512)")
+		->group("Output");
+
+	mpqRepack->add_option("--max-file-size", m_mpqMergeCommand.hotMaxFileSize,
+		"Largest file to store uncompressed, in KB, or 0 for no limit (default: 64)")
+		->group("Output");
+
+	mpqRepack->add_option("--sector-size", m_mpqMergeCommand.sectorSize,
+		"Sector size of the rewritten MPQ (default: the one it already uses)")
+		->group("Output");
+
+	auto* mpqOptimizeHash = mpq->add_subcommand("optimize-hash",
+		"Measure how long lookups in an MPQ's hash table are, and rebuild it with room to spare");
+
+	auto mpqOptimizeHashFormatter = std::make_shared<GroupedFormatter>();
+	mpqOptimizeHash->formatter(mpqOptimizeHashFormatter);
+
+	mpqOptimizeHash->add_option("-m,--mpq", m_mpqOptimizeHashCommand.mpq,
+		"MPQ archive to measure")
+		->required()
+		->check(CLI::ExistingFile)
+		->group("MPQs");
+
+	mpqOptimizeHash->add_option("-l,--listfile", m_mpqOptimizeHashCommand.listFiles,
+		"Text file(s) listing names of files in the MPQ, in addition to its (listfile)")
+		->check(CLI::ExistingFile)
+		->group("MPQs");
+
+	mpqOptimizeHash->add_option("-o,--output", m_mpqOptimizeHashCommand.outputPath,
+		"Rebuilt MPQ file path (default: only measure)")
+		->group("Output");
+
+	mpqOptimizeHash->add_option("--load", m_mpqOptimizeHashCommand.loadPercent,
+		"Most of the new hash table to use, in percent (default: 25)")
+		->check(CLI::Range(1, 100))
+		->group("Output");
+
+	mpqOptimizeHash->add_option("--hash-table-size", m_mpqOptimizeHashCommand.hashTableSize,
+		"Size of the new hash table, a power of 2 (default: the smallest within --load)")
+		->group("Output");
+
+	auto* mpqRecompress = mpq->add_subcommand("recompress",
+		"Measure how long each file of an MPQ takes to decompress, and store the costliest uncompressed");
+
+	auto mpqRecompressFormatter = std::make_shared<GroupedFormatter>();
+	mpqRecompress->formatter(mpqRecompressFormatter);
+
+	mpqRecompress->add_option("-m,--mpq", m_mpqRecompressCommand.mpq,
+		"MPQ archive to measure")
+		->required()
+		->check(CLI::ExistingFile)
+		->group("MPQs");
+
+	mpqRecompress->add_option("-l,--listfile", m_mpqRecompressCommand.listFiles,
+		"Text file(s) listing names of files in the MPQ, in addition to its (listfile)")
+		->check(CLI::ExistingFile)
+		->group("MPQs");
+
+	mpqRecompress->add_option("-p,--profile", m_mpqRecompressCommand.profileFiles,
+		"Access profile(s), as for mpq repack (default: every file loaded once)")
+		->check(CLI::ExistingFile)
+		->group("MPQs");
+
+	mpqRecompress->add_flag("--advise", m_mpqRecompressCommand.advise,
+		"Only report the cost and ratio of each compression method and the costliest files")
+		->group("Output");
+
+	mpqRecompress->add_option("-o,--output", m_mpqRecompressCommand.outputPath,
+		"Rewritten MPQ file path (required unless --advise)")
+		->group("Output");
+
+	mpqRecompress->add_option("--size-budget", m_mpqRecompressCommand.sizeBudget,
+		"Most the MPQ may grow by, in KB (default: 512, or no limit with --cpu-budget)")
+		->group("Output");
+
+	mpqRecompress->add_option("--cpu-budget", m_mpqRecompressCommand.cpuBudget,
+		"Stop once reading the files loaded takes no more than this many milliseconds")
+		->check(CLI::NonNegativeNumber)
+		->group("Output");
+
+	mpqRecompress->add_option("--max-file-size", m_mpqRecompressCommand.maxFileSize,
+		"Largest file to store uncompressed, in KB (default: no limit)")
+		->group("Output");
+
+	mpqRecompress->add_option("--threads", m_mpqRecompressCommand.threads,
+		"Threads to measure with (default: one per processor)")
+		->group("Output");
+
+	auto* mpqResector = mpq->add_subcommand("resector",
+		"Estimate which sector size loads an MPQ's files fastest, and rewrite it with that sector size");
+
+	auto mpqResectorFormatter = std::make_shared<GroupedFormatter>();
+	mpqResector->formatter(mpqResectorFormatter);
+
+	mpqResector->add_option("-m,--mpq", m_mpqResectorCommand.mpq,
+		"MPQ archive to rewrite")
+		->required()
+		->check(CLI::ExistingFile)
+		->group("MPQs");
+
+	mpqResector->add_option("-l,--listfile", m_mpqResectorCommand.listFiles,
+		"Text file(s) listing names of files in the MPQ, in addition to its (listfile)")
+		->check(CLI::ExistingFile)
+		->group("MPQs");
+
+	mpqResector->add_option("-p,--profile", m_mpqResectorCommand.profileFiles,
+		"Access profile(s), as for mpq repack, with an optional third column of bytes read per load (default: every file loaded once, whole)")
+		->check(CLI::ExistingFile)
+		->group("MPQs");
+
+	mpqResector->add_flag("--analyze", m_mpqResectorCommand.analyze,
+		"Only report the estimated cost of each sector size")
+		->group("Output");
+
+	mpqResector->add_option("-o,--output", m_mpqResectorCommand.outputPath,
+		"Rewritten MPQ file path (required unless --analyze)")
+		->group("Output");
+
+	mpqResector->add_option("--sector-size", m_mpqResectorCommand.sectorSize,
+		"Sector size to rewrite the MPQ with (default: the one estimated to load fastest)")
+		->group("Output");
+
+	mpqResector->add_option("--max-sector-size", m_mpqResectorCommand.maxSectorSize,
+		"Largest sector size to choose (default: 65536)")
+		->group("Output");
+
+	mpqResector->add_option("--read-cost", m_mpqResectorCommand.readCost,
+		"Time each read Storm makes takes, in microseconds (default: 10)")
+		->check(CLI::NonNegativeNumber)
+		->group("Output");
+
+	mpqResector->add_option("--threads", m_mpqResectorCommand.threads,
+		"Threads to measure decompression and compress with (default: one per processor)")
+		->group("Output");
+
+	auto* mpqVerify = mpq->add_subcommand("verify",
+		"Check the sector checksums, file checksums and tables of MPQs, all at once on several threads");
+
+	auto mpqVerifyFormatter = std::make_shared<GroupedFormatter>();
+	mpqVerify->formatter(mpqVerifyFormatter);
+
+	mpqVerify->add_option("-m,--mpq", m_mpqVerifyCommand.mpqs,
+		"MPQ archives or SEMPQs to check; the plugins embedded in SEMPQs are checked too")
+		->required()
+		->check(CLI::ExistingFile)
+		->group("MPQs");
+
+	mpqVerify->add_option("-l,--listfile", m_mpqVerifyCommand.listFiles,
+		"Text file(s) listing names of files in the MPQs, in addition to their (listfile)s; encrypted files can only be checked if their names are known")
+		->check(CLI::ExistingFile)
+		->group("MPQs");
+
+	mpqVerify->add_option("--report", m_mpqVerifyCommand.reportPath,
+		"Also write the results as JSON to this file")
+		->group("Output");
+
+	mpqVerify->add_option("--threads", m_mpqVerifyCommand.threads,
+		"Threads to check with (default: one per processor)")
+		->group("Output");
+
 	// =========================================================================
 	// Parse
 	// =========================================================================
@@ -433,6 +772,71 @@ bool CommandParser::ParseCommandLine(int argc, char** argv)
 		return true;
 	}
 
+	if (app.got_subcommand(sempqUpdate)) {
+		if (m_sempqUpdateCommand.plugins.empty() && m_sempqUpdateCommand.removePlugins.empty()) {
+			m_message = "Error: Must specify at least one of --plugin or --remove\n\n" + sempqUpdate->help();
+			return false;
+		}
+
+		for (const auto& id : m_sempqUpdateCommand.removePlugins) {
+			char* end = nullptr;
+			unsigned long value = strtoul(id.c_str(), &end, 16);
+			if (id.empty() || *end || value > 0xFFFFFFFFUL) {
+				m_message = "Error: Invalid plugin ID '" + id + "'\n\n" + sempqUpdate->help();
+				return false;
+			}
+			m_sempqUpdateCommand.removePluginIDs.push_back((uint32_t)value);
+		}
+
+		m_commandType = CommandType::SEMPQUpdate;
+		return true;
+	}
+
+	if (mpq->got_subcommand(mpqOverlay)) {
+		m_commandType = CommandType::MPQOverlay;
+		return true;
+	}
+
+	if (mpq->got_subcommand(mpqMerge) || mpq->got_subcommand(mpqRelayout) || mpq->got_subcommand(mpqRepack)) {
+		m_commandType = CommandType::MPQMerge;
+		return true;
+	}
+
+	if (mpq->got_subcommand(mpqOptimizeHash)) {
+		m_commandType = CommandType::MPQOptimizeHash;
+		return true;
+	}
+
+	if (mpq->got_subcommand(mpqRecompress)) {
+		if (!m_mpqRecompressCommand.advise && m_mpqRecompressCommand.outputPath.empty()) {
+			m_message = "Error: --output is required unless --advise is set\n\n" + mpqRecompress->help();
+			return false;
+		}
+
+		m_commandType = CommandType::MPQRecompress;
+		return true;
+	}
+
+	if (mpq->got_subcommand(mpqResector)) {
+		if (!m_mpqResectorCommand.analyze && m_mpqResectorCommand.outputPath.empty()) {
+			m_message = "Error: --output is required unless --analyze is set\n\n" + mpqResector->help();
+			return false;
+		}
+
+		m_commandType = CommandType::MPQResector;
+		return true;
+	}
+
+	if (mpq->got_subcommand(mpqVerify)) {
+		m_commandType = CommandType::MPQVerify;
+		return true;
+	}
+
+	if (app.got_subcommand(installRuntime)) {
+		m_commandType = CommandType::InstallRuntime;
+		return true;
+	}
+
 	if (app.got_subcommand(listGames)) {
 		m_commandType = CommandType::ListGames;
 		m_message = buildGameList();
@@ -9,13 +9,22 @@
 #pragma once
 #include <vector>
 #include <string>
+#include <cstdint>
 
 // Command types
 enum class CommandType {
 	None,           // No command (help/version requested or error)
 	Patch,          // Patch and launch a game
 	SEMPQ,          // Create a Self-Executing MPQ
-	ListGames       // List supported games
+	SEMPQUpdate,    // Replace or remove the plugins in a SEMPQ
+	InstallRuntime, // Install the shared runtime thin SEMPQs use
+	ListGames,      // List supported games
+	MPQOverlay,     // Show which patch MPQ each file is read from
+	MPQMerge,       // Merge patch MPQs into one
+	MPQOptimizeHash, // Measure and rebuild an MPQ's hash table
+	MPQRecompress,  // Measure decompression and store costly files uncompressed
+	MPQResector,    // Choose the best sector size for an MPQ and rewrite it
+	MPQVerify       // Check the integrity of MPQs
 };
 
 // SEMPQ target mode
@@ -33,6 +42,7 @@ struct PatchCommand {
 	std::vector<std::string> plugins;   // Plugin files to load
 	bool extendedRedir = true;          // MPQD_EXTENDED_REDIR flag
 	bool noSpawning = false;            // MPQD_NO_SPAWNING flag
+	bool traceAccess = false;           // MPQD_TRACE_ACCESS flag
 	int shuntCount = 0;                 // Shunt count
 };
 
@@ -65,6 +75,78 @@ struct SEMPQCommand {
 	bool noSpawning = false;            // MPQD_NO_SPAWNING flag
 	int shuntCount = 0;                 // Shunt count
 	std::string iconPath;               // Custom icon path
+	bool thin = false;                  // Use the shared runtime instead of embedding the patcher DLL
+};
+
+// Parsed command line data for sempq-update command
+struct SEMPQUpdateCommand {
+	std::string sempqPath;              // SEMPQ file to update
+	std::vector<std::string> plugins;   // Plugin files to add, or replace the embedded versions of
+	std::vector<std::string> removePlugins; // IDs (in hex) of embedded plugins to remove
+	std::vector<uint32_t> removePluginIDs; // removePlugins, parsed
+};
+
+// Parsed command line data for mpq overlay command
+struct MPQOverlayCommand {
+	std::vector<std::string> mpqs;      // MPQ files, in the order they would be loaded
+	std::vector<std::string> listFiles; // Files listing names of files in the MPQs
+	bool allFiles = false;              // List every file, not just overridden ones
+};
+
+// Parsed command line data for mpq merge, relayout and repack commands
+struct MPQMergeCommand {
+	std::vector<std::string> mpqs;      // MPQ files, in the order they would be loaded
+	std::vector<std::string> listFiles; // Files listing names of files in the MPQs
+	std::vector<std::string> traceFiles; // File access traces giving the order to lay files out in
+	std::vector<std::string> profileFiles; // Access profiles giving how often files are loaded
+	unsigned int hotBudget = 512;       // Most the archive may grow by storing loaded files uncompressed, in KB
+	unsigned int hotMaxFileSize = 64;   // Largest file to store uncompressed, in KB
+	std::string outputPath;             // Merged MPQ file path
+	unsigned int sectorSize = 0;        // Sector size of the merged MPQ (0 = automatic)
+	unsigned int hashTableSize = 0;     // Hash table size of the merged MPQ (0 = automatic)
+};
+
+// Parsed command line data for mpq optimize-hash command
+struct MPQOptimizeHashCommand {
+	std::string mpq;                    // MPQ file to measure
+	std::vector<std::string> listFiles; // Files listing names of files in the MPQ
+	std::string outputPath;             // Rebuilt MPQ file path (empty = only measure)
+	unsigned int loadPercent = 0;       // Most of the new hash table to use, in percent (0 = automatic)
+	unsigned int hashTableSize = 0;     // Size of the new hash table (0 = automatic)
+};
+
+// Parsed command line data for mpq recompress command
+struct MPQRecompressCommand {
+	std::string mpq;                    // MPQ file to measure
+	std::vector<std::string> listFiles; // Files listing names of files in the MPQ
+	std::vector<std::string> profileFiles; // Access profiles giving how often files are loaded
+	std::string outputPath;             // Rewritten MPQ file path
+	bool advise = false;                // Only report the cost of each compression method
+	unsigned int sizeBudget = 0;        // Most the archive may grow by, in KB (0 = automatic)
+	double cpuBudget = 0;               // Read time to get down to, in milliseconds (0 = none)
+	unsigned int maxFileSize = 0;       // Largest file to store uncompressed, in KB (0 = no limit)
+	unsigned int threads = 0;           // Threads to measure with (0 = one per processor)
+};
+
+// Parsed command line data for mpq resector command
+struct MPQResectorCommand {
+	std::string mpq;                    // MPQ file to rewrite
+	std::vector<std::string> listFiles; // Files listing names of files in the MPQ
+	std::vector<std::string> profileFiles; // Access profiles giving how often files are loaded, and how much of them
+	std::string outputPath;             // Rewritten MPQ file path
+	bool analyze = false;               // Only report the cost of each sector size
+	unsigned int sectorSize = 0;        // Sector size to use (0 = the best estimated)
+	unsigned int maxSectorSize = 0;     // Largest sector size to choose (0 = 64 KB)
+	double readCost = 0;                // Time each read takes, in microseconds (0 = default)
+	unsigned int threads = 0;           // Threads to measure and compress with (0 = one per processor)
+};
+
+// Parsed command line data for mpq verify command
+struct MPQVerifyCommand {
+	std::vector<std::string> mpqs;      // MPQ files and SEMPQs to check
+	std::vector<std::string> listFiles; // Files listing names of files in the MPQs
+	std::string reportPath;             // JSON report file path (empty = none)
+	unsigned int threads = 0;           // Threads to check with (0 = one per processor)
 };
 
 class CommandParser
@@ -80,6 +162,13 @@ public:
 	// Get parsed command data
 	const PatchCommand& GetPatchCommand() const { return m_patchCommand; }
 	const SEMPQCommand& GetSEMPQCommand() const { return m_sempqCommand; }
+	const SEMPQUpdateCommand& GetSEMPQUpdateCommand() const { return m_sempqUpdateCommand; }
+	const MPQOverlayCommand& GetMPQOverlayCommand() const { return m_mpqOverlayCommand; }
+	const MPQMergeCommand& GetMPQMergeCommand() const { return m_mpqMergeCommand; }
+	const MPQOptimizeHashCommand& GetMPQOptimizeHashCommand() const { return m_mpqOptimizeHashCommand; }
+	const MPQRecompressCommand& GetMPQRecompressCommand() const { return m_mpqRecompressCommand; }
+	const MPQResectorCommand& GetMPQResectorCommand() const { return m_mpqResectorCommand; }
+	const MPQVerifyCommand& GetMPQVerifyCommand() const { return m_mpqVerifyCommand; }
 
 	// Check status flags
 	bool IsHelpRequested() const { return m_helpRequested; }
@@ -92,6 +181,13 @@ private:
 	CommandType m_commandType = CommandType::None;
 	PatchCommand m_patchCommand;
 	SEMPQCommand m_sempqCommand;
+	SEMPQUpdateCommand m_sempqUpdateCommand;
+	MPQOverlayCommand m_mpqOverlayCommand;
+	MPQMergeCommand m_mpqMergeCommand;
+	MPQOptimizeHashCommand m_mpqOptimizeHashCommand;
+	MPQRecompressCommand m_mpqRecompressCommand;
+	MPQResectorCommand m_mpqResectorCommand;
+	MPQVerifyCommand m_mpqVerifyCommand;
 	std::string m_message;
 	bool m_helpRequested = false;
 	bool m_versionRequested = false;
@@ -22,6 +22,14 @@
 #include "../../core/GameData.h"
 #include "../../core/PatcherFlags.h"
 #include "../../sempq/SEMPQCreator.h"
+#include "../../mpq/MPQArchive.h"
+#include "../../mpq/MPQCompress.h"
+#include "../../mpq/MPQDecodeCost.h"
+#include "../../mpq/MPQSectorSize.h"
+#include "../../mpq/MPQMerge.h"
+#include "../../mpq/MPQOverlay.h"
+#include "../../mpq/MPQRehash.h"
+#include "../../mpq/MPQVerify.h"
 #include "../resource_ids.h"
 #include "version.h"
 
@@ -82,6 +90,8 @@ BOOL CMPQDraftCLI::ExecutePatch(
 		printf("Parameters: %s\n", cmd.parameters.c_str());
 	printf("Extended redirection: %s\n", cmd.extendedRedir ? "enabled" : "disabled");
 	printf("No spawning: %s\n", cmd.noSpawning ? "enabled" : "disabled");
+	if (cmd.traceAccess && !cmd.mpqs.empty())
+		printf("Access trace: %s.trace\n", cmd.mpqs.back().c_str());
 	printf("Shunt count: %d\n", cmd.shuntCount);
 
 	printf("MPQ files (%d):\n", (int)cmd.mpqs.size());
@@ -99,6 +109,25 @@ BOOL CMPQDraftCLI::ExecutePatch(
 	QDebugOut("MPQs = %d", (int)cmd.mpqs.size());
 	QDebugOut("Plugins = %d", (int)cmd.plugins.size());
 
+	// Make sure the game will be able to open the MPQs before launching it
+	for (size_t i = 0; i < cmd.mpqs.size(); i++)
+	{
+		MPQARCHIVEINFO archiveInfo;
+		MPQERROR error = MPQValidateArchive(cmd.mpqs[i].c_str(), &archiveInfo);
+		if (error != MPQ_ERROR_SUCCESS)
+		{
+			printf("Invalid MPQ %s: %s\n", cmd.mpqs[i].c_str(), MPQGetErrorString(error));
+			QDebugOut("Invalid MPQ %s: %s", cmd.mpqs[i].c_str(), MPQGetErrorString(error));
+			return FALSE;
+		}
+
+		for (int iWarning = 0; iWarning < NUM_MPQ_WARNINGS; iWarning++)
+		{
+			if (archiveInfo.grfWarnings & (1U << iWarning))
+				printf("Warning: %s: %s\n", cmd.mpqs[i].c_str(), MPQGetWarningString(1U << iWarning));
+		}
+	}
+
 	// Load plugin modules
 	std::vector<MPQDRAFTPLUGINMODULE> modules;
 	if (!cmd.plugins.empty())
@@ -128,6 +157,8 @@ BOOL CMPQDraftCLI::ExecutePatch(
 		dwFlags |= MPQD_EXTENDED_REDIR;
 	if (cmd.noSpawning)
 		dwFlags |= MPQD_NO_SPAWNING;
+	if (cmd.traceAccess)
+		dwFlags |= MPQD_TRACE_ACCESS;
 
 	// Execute the patcher
 	QDebugOut("About to call ExecutePatcher with %d MPQs and %d modules", (int)mpqPtrs.size(), (int)modules.size());
@@ -356,6 +387,7 @@ BOOL CMPQDraftCLI::ExecuteSEMPQ(IN const SEMPQCommand& cmd)
 	params.iconPath   = cmd.iconPath;
 	params.parameters = cmd.parameters;
 	params.shuntCount = cmd.shuntCount;
+	params.thinSEMPQ  = cmd.thin;
 
 	// Build flags
 	params.flags = 0;
@@ -450,3 +482,1010 @@ BOOL CMPQDraftCLI::ExecuteSEMPQ(IN const SEMPQCommand& cmd)
 	printf("\nSEMPQ created successfully: %s\n", cmd.outputPath.c_str());
 	return TRUE;
 }
+
+/////////////////////////////////////////////////////////////////////////////
+// ExecuteSEMPQUpdate - Replace or remove the plugins in a SEMPQ
+
+BOOL CMPQDraftCLI::ExecuteSEMPQUpdate(IN const SEMPQUpdateCommand& cmd)
+{
+	printf("MPQDraft CLI - SEMPQ Update Mode\n");
+	QDebugOut("MPQDraft CLI - SEMPQ Update Mode");
+
+	printf("SEMPQ: %s\n", cmd.sempqPath.c_str());
+	for (size_t i = 0; i < cmd.plugins.size(); i++)
+		printf("  Embed: %s\n", cmd.plugins[i].c_str());
+	for (size_t i = 0; i < cmd.removePluginIDs.size(); i++)
+		printf("  Remove: 0x%08X\n", cmd.removePluginIDs[i]);
+
+	std::vector<MPQDRAFTPLUGINMODULE> modules;
+	if (!cmd.plugins.empty() && !LoadPluginModules(cmd.plugins, modules))
+	{
+		printf("Failed to load plugin modules\n");
+		QDebugOut("Failed to load plugin modules");
+		return FALSE;
+	}
+
+	auto progressCallback = [](int progress, const std::string& status) {
+		printf("[%3d%%] %s", progress, status.c_str());
+	};
+
+	SEMPQCreator creator;
+	std::string errorMessage;
+
+	printf("\nUpdating SEMPQ...\n");
+	if (!creator.updateSEMPQPlugins(cmd.sempqPath, modules, cmd.removePluginIDs, progressCallback, nullptr, errorMessage))
+	{
+		printf("\nERROR: Failed to update SEMPQ: %s\n", errorMessage.c_str());
+		QDebugOut("Failed to update SEMPQ: %s", errorMessage.c_str());
+		return FALSE;
+	}
+
+	printf("\nSEMPQ updated successfully: %s\n", cmd.sempqPath.c_str());
+	return TRUE;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// ExecuteInstallRuntime - Install the shared runtime thin SEMPQs use
+
+BOOL CMPQDraftCLI::ExecuteInstallRuntime()
+{
+	printf("MPQDraft CLI - Install Runtime Mode\n");
+	QDebugOut("MPQDraft CLI - Install Runtime Mode");
+
+	std::string errorMessage;
+	if (!SEMPQCreator::installSharedRuntime(errorMessage))
+	{
+		printf("\nERROR: Failed to install the shared runtime: %s\n", errorMessage.c_str());
+		QDebugOut("Failed to install the shared runtime: %s", errorMessage.c_str());
+		return FALSE;
+	}
+
+	printf("\nShared runtime installed; thin SEMPQs made with this version of MPQDraft can now run on this machine\n");
+	return TRUE;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// ExecuteMPQOverlay - Show which MPQ each file is read from
+
+// Formats a file's name, or its hashes if the name isn't known
+static std::string GetOverlayFileName(const MPQOVERLAYFILE& file)
+{
+	char szName[64];
+
+	if (file.lpszName)
+		return file.lpszName;
+
+	sprintf(szName, "#%08X%08X", file.dwNameHashA, file.dwNameHashB);
+	return szName;
+}
+
+// Reads a whole text file. Returns false after printing an error on failure.
+static bool ReadTextFile(const std::string& path, std::string& text)
+{
+	FILE *file = fopen(path.c_str(), "rb");
+	if (!file)
+	{
+		printf("ERROR: Unable to open %s\n", path.c_str());
+		return false;
+	}
+
+	char szBuffer[4096];
+	size_t cbRead;
+	while ((cbRead = fread(szBuffer, 1, sizeof(szBuffer), file)) > 0)
+		text.append(szBuffer, cbRead);
+	fclose(file);
+
+	return true;
+}
+
+// Opens MPQs as an overlay and adds the names in the list files given. Returns NULL after printing an error on failure.
+static HMPQOVERLAY OpenOverlay(const std::vector<std::string>& mpqs, const std::vector<std::string>& listFiles)
+{
+	std::vector<const char*> mpqPtrs;
+	for (size_t i = 0; i < mpqs.size(); i++)
+		mpqPtrs.push_back(mpqs[i].c_str());
+
+	HMPQOVERLAY hOverlay;
+	uint32_t iFailedMPQ = 0;
+	MPQERROR error = MPQCreateOverlay(&mpqPtrs[0], (uint32_t)mpqPtrs.size(), MPQ_OVERLAY_READ_LISTFILES, &hOverlay, &iFailedMPQ);
+	if (error != MPQ_ERROR_SUCCESS)
+	{
+		printf("ERROR: Unable to open %s: %s\n", mpqs[iFailedMPQ].c_str(), MPQGetErrorString(error));
+		return NULL;
+	}
+
+	for (size_t i = 0; i < listFiles.size(); i++)
+	{
+		std::string names;
+		if (!ReadTextFile(listFiles[i], names))
+		{
+			MPQCloseOverlay(hOverlay);
+			return NULL;
+		}
+
+		MPQAddOverlayNames(hOverlay, names.data(), names.size());
+	}
+
+	return hOverlay;
+}
+
+BOOL CMPQDraftCLI::ExecuteMPQOverlay(IN const MPQOverlayCommand& cmd)
+{
+	HMPQOVERLAY hOverlay = OpenOverlay(cmd.mpqs, cmd.listFiles);
+	if (!hOverlay)
+		return FALSE;
+
+	const MPQOVERLAYINFO *lpInfo = MPQGetOverlayInfo(hOverlay);
+	const MPQOVERLAYARCHIVE *lpArchives = MPQGetOverlayArchives(hOverlay);
+	uint32_t nFiles;
+	const MPQOVERLAYFILE *lpFiles = MPQGetOverlayFiles(hOverlay, &nFiles);
+	const MPQOVERLAYINSTANCE *lpInstances = MPQGetOverlayInstances(hOverlay);
+
+	printf("MPQs (later MPQs override earlier ones):\n");
+	for (uint32_t i = 0; i < lpInfo->nArchives; i++)
+	{
+		printf("  [%u] %s\n", i, cmd.mpqs[i].c_str());
+		printf("      %u files, %u read from here, %u overridden (%llu bytes never read)\n",
+			lpArchives[i].nFiles, lpArchives[i].nWinningFiles, lpArchives[i].nShadowedFiles,
+			(unsigned long long)lpArchives[i].cbShadowedBytes);
+	}
+
+	printf("\n%s:\n", cmd.allFiles ? "Files" : "Overridden files");
+	for (uint32_t iFile = 0; iFile < nFiles; iFile++)
+	{
+		const MPQOVERLAYFILE& file = lpFiles[iFile];
+		if (!cmd.allFiles && file.nInstances < 2 && !file.bHidden)
+			continue;
+
+		std::string name = GetOverlayFileName(file);
+		if (file.wLocale)
+			printf("  %s (locale %04X)\n", name.c_str(), file.wLocale);
+		else
+			printf("  %s\n", name.c_str());
+
+		if (file.bHidden)
+		{
+			printf("      never read: a later MPQ has a locale neutral copy (%llu bytes)\n", (unsigned long long)file.cbShadowedBytes);
+			continue;
+		}
+
+		printf("      read from [%u]", lpInstances[file.iFirstInstance].iArchive);
+		if (file.nInstances > 1)
+		{
+			printf(", overrides");
+			for (uint32_t iInstance = 1; iInstance < file.nInstances; iInstance++)
+				printf(" [%u]", lpInstances[file.iFirstInstance + iInstance].iArchive);
+			printf(" (%llu bytes)", (unsigned long long)file.cbShadowedBytes);
+		}
+		printf("\n");
+	}
+
+	printf("\n%u files (%u named), %u overridden, %llu bytes never read\n",
+		lpInfo->nFiles, lpInfo->nNamedFiles, lpInfo->nShadowedFiles, (unsigned long long)lpInfo->cbShadowedBytes);
+	if (lpInfo->nHiddenFiles)
+		printf("%u locale-specific files hidden by locale neutral copies in later MPQs\n", lpInfo->nHiddenFiles);
+
+	MPQCloseOverlay(hOverlay);
+	return TRUE;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// ExecuteMPQMerge - Merge patch MPQs into one
+
+/*
+	Reads an access profile into names and loads. Each line is a file name, followed by a comma and the number of times it was loaded, as in a CSV file, and optionally another comma and the number of bytes each load read from the start of the file; any further columns are ignored. Lines without a count are one load each, and loads without a size read the whole file, so a trace from patch --trace-access is a profile too. Lines with something other than a number for the count, such as a CSV header, are skipped.
+*/
+static void ParseProfile(const std::string& profile, std::vector<std::string>& names, std::vector<MPQFILELOADS>& loads)
+{
+	size_t iStart = 0;
+	while (iStart < profile.size())
+	{
+		size_t iEnd = profile.find_first_of("\r\n", iStart);
+		if (iEnd == std::string::npos)
+			iEnd = profile.size();
+
+		std::string line = profile.substr(iStart, iEnd - iStart);
+		iStart = iEnd + 1;
+
+		MPQFILELOADS fileLoads = { NULL, 1, 0 };
+		size_t iComma = line.find(',');
+		if (iComma != std::string::npos)
+		{
+			char *lpszCountEnd;
+			const char *lpszCount = line.c_str() + iComma + 1;
+			fileLoads.nLoads = (uint32_t)strtoul(lpszCount, &lpszCountEnd, 10);
+			if (lpszCountEnd == lpszCount)
+				continue;
+
+			if (*lpszCountEnd == ',')
+				fileLoads.cbLoadSize = (uint32_t)strtoul(lpszCountEnd + 1, NULL, 10);
+
+			line.erase(iComma);
+		}
+
+		// CSV files may quote names
+		if (line.size() >= 2 && line[0] == '"' && line[line.size() - 1] == '"')
+			line = line.substr(1, line.size() - 2);
+
+		if (!line.empty())
+		{
+			names.push_back(line);
+			loads.push_back(fileLoads);
+		}
+	}
+}
+
+// Reads access profiles, and adds the names in them to the overlay, as encrypted files need their names to be stored uncompressed. fileLoads points into names. Returns false after printing an error on failure.
+static bool ReadProfiles(HMPQOVERLAY hOverlay, const std::vector<std::string>& profileFiles, std::vector<std::string>& names, std::vector<MPQFILELOADS>& fileLoads)
+{
+	for (size_t i = 0; i < profileFiles.size(); i++)
+	{
+		std::string profile;
+		if (!ReadTextFile(profileFiles[i], profile))
+			return false;
+
+		ParseProfile(profile, names, fileLoads);
+	}
+
+	// The names can only be pointed to once they're all read, as reading moves them
+	for (size_t i = 0; i < names.size(); i++)
+	{
+		MPQAddOverlayNames(hOverlay, names[i].data(), names[i].size());
+		fileLoads[i].lpszName = names[i].c_str();
+	}
+
+	return true;
+}
+
+// Prints why MPQMergeArchives failed
+static void PrintMergeError(HMPQOVERLAY hOverlay, const std::string& outputPath, MPQERROR error, const MPQMERGERESULT& result)
+{
+	if (result.iFailedFile != 0xFFFFFFFF)
+	{
+		std::string name = GetOverlayFileName(MPQGetOverlayFiles(hOverlay, NULL)[result.iFailedFile]);
+		printf("ERROR: Unable to merge %s: %s\n", name.c_str(), MPQGetErrorString(error));
+		if (error == MPQ_ERROR_UNKNOWN_KEY || error == MPQ_ERROR_UNKNOWN_NAME)
+			printf("Give the names of the files in the MPQs with --listfile.\n");
+	}
+	else
+		printf("ERROR: Unable to create %s: %s\n", outputPath.c_str(), MPQGetErrorString(error));
+}
+
+BOOL CMPQDraftCLI::ExecuteMPQMerge(IN const MPQMergeCommand& cmd)
+{
+	HMPQOVERLAY hOverlay = OpenOverlay(cmd.mpqs, cmd.listFiles);
+	if (!hOverlay)
+		return FALSE;
+
+	// The traces list the names of the files in the order the game read them, one per line
+	std::vector<std::string> traceNames;
+	for (size_t i = 0; i < cmd.traceFiles.size(); i++)
+	{
+		std::string trace;
+		if (!ReadTextFile(cmd.traceFiles[i], trace))
+		{
+			MPQCloseOverlay(hOverlay);
+			return FALSE;
+		}
+
+		// Traced names are names of files in the MPQs, too
+		MPQAddOverlayNames(hOverlay, trace.data(), trace.size());
+
+		size_t iStart = 0;
+		while (iStart < trace.size())
+		{
+			size_t iEnd = trace.find_first_of("\r\n", iStart);
+			if (iEnd == std::string::npos)
+				iEnd = trace.size();
+
+			if (iEnd > iStart)
+				traceNames.push_back(trace.substr(iStart, iEnd - iStart));
+			iStart = iEnd + 1;
+		}
+	}
+
+	std::vector<const char*> traceNamePtrs;
+	for (size_t i = 0; i < traceNames.size(); i++)
+		traceNamePtrs.push_back(traceNames[i].c_str());
+
+	std::vector<std::string> profileNames;
+	std::vector<MPQFILELOADS> fileLoads;
+	if (!ReadProfiles(hOverlay, cmd.profileFiles, profileNames, fileLoads))
+	{
+		MPQCloseOverlay(hOverlay);
+		return FALSE;
+	}
+
+	MPQMERGEOPTIONS options;
+	options.cbSectorSize = cmd.sectorSize;
+	options.nThreads = 0;
+	options.nHashTableEntries = cmd.hashTableSize;
+	options.lplpszFileOrder = traceNamePtrs.empty() ? NULL : &traceNamePtrs[0];
+	options.nFileOrderNames = (uint32_t)traceNamePtrs.size();
+	options.lpFileLoads = fileLoads.empty() ? NULL : &fileLoads[0];
+	options.nFileLoads = (uint32_t)fileLoads.size();
+	options.cbHotFileBudget = (uint64_t)cmd.hotBudget * 1024;
+	options.cbMaxHotFileSize = cmd.hotMaxFileSize * 1024;
+	options.lpfReadSeconds = NULL;
+	options.fReadSecondsBudget = 0;
+
+	MPQMERGERESULT result;
+	MPQERROR error = MPQMergeArchives(hOverlay, cmd.outputPath.c_str(), &options, &result);
+	if (error != MPQ_ERROR_SUCCESS)
+	{
+		PrintMergeError(hOverlay, cmd.outputPath, error, result);
+		MPQCloseOverlay(hOverlay);
+		return FALSE;
+	}
+
+	const MPQOVERLAYINFO *lpInfo = MPQGetOverlayInfo(hOverlay);
+
+	printf("Merged %u MPQ%s into %s\n", lpInfo->nArchives, lpInfo->nArchives == 1 ? "" : "s", cmd.outputPath.c_str());
+	printf("  %u files: %u copied, %u re-encrypted, %u compressed again for the new sector size\n",
+		result.nFiles, result.nCopiedFiles, result.nRekeyedFiles, result.nRecompressedFiles);
+	if (!cmd.traceFiles.empty())
+		printf("  %u files laid out in the order of %u traced reads\n", result.nOrderedFiles, (unsigned)traceNames.size());
+	if (!cmd.profileFiles.empty())
+		printf("  %u frequently loaded files stored uncompressed, adding %llu bytes\n", result.nHotFiles, (unsigned long long)result.cbHotFileGrowth);
+	if (result.nDroppedFiles)
+		printf("  %u files left out: (attributes) and (signature) no longer apply\n", result.nDroppedFiles);
+	printf("  %llu bytes never read left out\n", (unsigned long long)lpInfo->cbShadowedBytes);
+	printf("  Sector size %u, hash table size %u, %llu bytes\n",
+		result.cbSectorSize, result.nHashTableEntries, (unsigned long long)result.cbArchiveSize);
+
+	MPQCloseOverlay(hOverlay);
+	return TRUE;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// ExecuteMPQOptimizeHash - Measure and rebuild an MPQ's hash table
+
+// Prints how long searches of an archive's hash table are, and how long lookups take
+static void PrintHashTableStats(HMPQOVERLAY hOverlay)
+{
+	MPQHASHSTATS stats;
+	MPQGetHashTableStats(hOverlay, 0, &stats);
+
+	printf("  Hash table: %u entries, %u files (%u%% full), %u deleted\n", stats.nHashTableEntries, stats.nFiles,
+		(unsigned)((uint64_t)stats.nFiles * 100 / stats.nHashTableEntries), stats.nDeletedEntries);
+
+	if (stats.nMeasuredFiles)
+		printf("  Finding a file: %.2f entries on average, %u at most (%u of %u files measured)\n",
+			(double)stats.nTotalHitProbes / stats.nMeasuredFiles, stats.nMaxHitProbes, stats.nMeasuredFiles, stats.nFiles);
+	printf("  Finding a file isn't there: %.2f entries on average, %u at most\n",
+		(double)stats.nTotalMissProbes / stats.nHashTableEntries, stats.nMaxMissProbes);
+
+	printf("  Entries searched:");
+	for (uint32_t i = 0; i < MPQ_PROBE_HISTOGRAM_SIZE; i++)
+		printf(i + 1 < MPQ_PROBE_HISTOGRAM_SIZE ? " %7u" : " %6u+", i + 1);
+	printf("\n  Files found:     ");
+	for (uint32_t i = 0; i < MPQ_PROBE_HISTOGRAM_SIZE; i++)
+		printf(" %7u", stats.anHitProbes[i]);
+	printf("\n  Misses:          ");
+	for (uint32_t i = 0; i < MPQ_PROBE_HISTOGRAM_SIZE; i++)
+		printf(" %7u", stats.anMissProbes[i]);
+	printf("\n");
+
+	MPQLOOKUPTIMES times;
+	MPQMeasureLookups(hOverlay, 0, &times);
+	if (!times.nNames)
+		return;
+
+	printf("  Time to look up %u named files, per file:\n", times.nNames);
+	printf("    Hash table: %.0f ns found, %.0f ns missing\n", times.fHashTableHitSeconds * 1e9, times.fHashTableMissSeconds * 1e9);
+	if (times.fHETTableHitSeconds)
+		printf("    HET table:  %.0f ns found, %.0f ns missing\n", times.fHETTableHitSeconds * 1e9, times.fHETTableMissSeconds * 1e9);
+}
+
+BOOL CMPQDraftCLI::ExecuteMPQOptimizeHash(IN const MPQOptimizeHashCommand& cmd)
+{
+	std::vector<std::string> mpqs(1, cmd.mpq);
+	HMPQOVERLAY hOverlay = OpenOverlay(mpqs, cmd.listFiles);
+	if (!hOverlay)
+		return FALSE;
+
+	printf("%s:\n", cmd.mpq.c_str());
+	PrintHashTableStats(hOverlay);
+
+	if (cmd.outputPath.empty())
+	{
+		MPQCloseOverlay(hOverlay);
+		return TRUE;
+	}
+
+	MPQREHASHOPTIONS options;
+	options.nHashTableEntries = cmd.hashTableSize;
+	options.nMaxLoadPercent = cmd.loadPercent;
+
+	MPQREHASHRESULT result;
+	MPQERROR error = MPQRehashArchive(hOverlay, 0, cmd.outputPath.c_str(), &options, &result);
+	MPQCloseOverlay(hOverlay);
+
+	if (error != MPQ_ERROR_SUCCESS)
+	{
+		if (result.iFailedHashEntry != 0xFFFFFFFF)
+		{
+			printf("ERROR: Unable to place the file in hash table entry %u: %s\n", result.iFailedHashEntry, MPQGetErrorString(error));
+			printf("Give the names of the files in the MPQ with --listfile.\n");
+		}
+		else
+			printf("ERROR: Unable to create %s: %s\n", cmd.outputPath.c_str(), MPQGetErrorString(error));
+
+		return FALSE;
+	}
+
+	printf("\nRebuilt the hash table into %s\n", cmd.outputPath.c_str());
+	if (result.nDroppedEntries)
+		printf("  %u deleted or invalid entries left out\n", result.nDroppedEntries);
+	printf("  The new table was %s\n", result.bTableAppended ? "added at the end of the archive" : "written over the old one");
+
+	mpqs[0] = cmd.outputPath;
+	hOverlay = OpenOverlay(mpqs, cmd.listFiles);
+	if (!hOverlay)
+		return FALSE;
+
+	PrintHashTableStats(hOverlay);
+
+	MPQCloseOverlay(hOverlay);
+	return TRUE;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// ExecuteMPQRecompress - Measure decompression and store costly files uncompressed
+
+// Names a combination of compression methods
+static std::string GetCompressionName(uint32_t grfCompression)
+{
+	static const struct { uint32_t dwMethod; const char *lpszName; } s_methods[] = {
+		{ MPQ_COMPRESSION_PKWARE, "PKWare" },
+		{ MPQ_COMPRESSION_ZLIB, "zlib" },
+		{ MPQ_COMPRESSION_BZIP2, "bzip2" },
+		{ MPQ_COMPRESSION_HUFFMAN, "Huffman" },
+		{ MPQ_COMPRESSION_SPARSE, "sparse" },
+		{ MPQ_COMPRESSION_ADPCM_MONO, "ADPCM mono" },
+		{ MPQ_COMPRESSION_ADPCM_STEREO, "ADPCM stereo" }
+	};
+
+	if (!grfCompression)
+		return "none";
+
+	std::string name;
+	for (size_t i = 0; i < sizeof(s_methods) / sizeof(s_methods[0]); i++)
+	{
+		if (grfCompression & s_methods[i].dwMethod)
+			name += (name.empty() ? "" : "+") + std::string(s_methods[i].lpszName);
+	}
+
+	return name;
+}
+
+// The totals for one combination of compression methods
+struct COMPRESSIONTOTALS
+{
+	uint32_t grfCompression;
+	uint32_t nFiles;
+	uint64_t cbFileSize;
+	uint64_t cbCompressedSize;
+	double fSeconds;
+};
+
+// Prints the cost and ratio of each compression method, and the files which take longest to read
+static void PrintDecodeAdvice(HMPQOVERLAY hOverlay, const std::vector<MPQDECODECOST>& costs)
+{
+	const MPQOVERLAYFILE *lpFiles = MPQGetOverlayFiles(hOverlay, NULL);
+
+	std::vector<COMPRESSIONTOTALS> totals;
+	std::vector<uint32_t> errorCounts(NUM_MPQ_ERRORS, 0);
+	std::vector<uint32_t> measuredFiles;
+
+	for (uint32_t iFile = 0; iFile < costs.size(); iFile++)
+	{
+		const MPQDECODECOST& cost = costs[iFile];
+		if (cost.error != MPQ_ERROR_SUCCESS)
+		{
+			errorCounts[cost.error]++;
+			continue;
+		}
+
+		size_t iTotals = 0;
+		while (iTotals < totals.size() && totals[iTotals].grfCompression != cost.grfCompression)
+			iTotals++;
+		if (iTotals == totals.size())
+		{
+			COMPRESSIONTOTALS newTotals = { cost.grfCompression, 0, 0, 0, 0 };
+			totals.push_back(newTotals);
+		}
+
+		totals[iTotals].nFiles++;
+		totals[iTotals].cbFileSize += cost.cbFileSize;
+		totals[iTotals].cbCompressedSize += cost.cbCompressedSize;
+		totals[iTotals].fSeconds += cost.fSeconds;
+		measuredFiles.push_back(iFile);
+	}
+
+	printf("  %-20s %7s %12s %12s %6s %10s %9s\n", "Compression", "Files", "Size", "Stored", "Ratio", "Read (ms)", "MB/s");
+	for (const COMPRESSIONTOTALS& methodTotals : totals)
+	{
+		printf("  %-20s %7u %12llu %12llu %5.1f%% %10.3f %9.1f\n", GetCompressionName(methodTotals.grfCompression).c_str(), methodTotals.nFiles,
+			(unsigned long long)methodTotals.cbFileSize, (unsigned long long)methodTotals.cbCompressedSize,
+			methodTotals.cbFileSize ? methodTotals.cbCompressedSize * 100.0 / methodTotals.cbFileSize : 100.0,
+			methodTotals.fSeconds * 1000, methodTotals.fSeconds > 0 ? methodTotals.cbFileSize / methodTotals.fSeconds / 1e6 : 0.0);
+	}
+
+	for (uint32_t iError = 0; iError < NUM_MPQ_ERRORS; iError++)
+	{
+		if (errorCounts[iError])
+			printf("  %u files not measured: %s\n", errorCounts[iError], MPQGetErrorString((MPQERROR)iError));
+	}
+	if (errorCounts[MPQ_ERROR_UNSUPPORTED_COMPRESSION])
+		printf("  Storm decompresses those files, but they can only be rewritten once they use zlib or PKWare, or no compression.\n");
+	if (errorCounts[MPQ_ERROR_UNKNOWN_KEY])
+		printf("  Give the names of the encrypted files with --listfile to measure them.\n");
+
+	// The files which take longest to read
+	std::sort(measuredFiles.begin(), measuredFiles.end(), [&](uint32_t iFile1, uint32_t iFile2) { return costs[iFile1].fSeconds > costs[iFile2].fSeconds; });
+
+	printf("\n  Slowest files to read:\n");
+	for (size_t i = 0; i < measuredFiles.size() && i < 10; i++)
+	{
+		const MPQDECODECOST& cost = costs[measuredFiles[i]];
+		printf("    %-40s %-10s %10u bytes %6.1f%% %9.3f ms", GetOverlayFileName(lpFiles[measuredFiles[i]]).c_str(),
+			GetCompressionName(cost.grfCompression).c_str(), cost.cbFileSize,
+			cost.cbFileSize ? cost.cbCompressedSize * 100.0 / cost.cbFileSize : 100.0, cost.fSeconds * 1000);
+		if (cost.grfCompression && cost.cbFileSize > cost.cbCompressedSize)
+			printf(", +%u bytes uncompressed", cost.cbFileSize - cost.cbCompressedSize);
+		printf("\n");
+	}
+}
+
+BOOL CMPQDraftCLI::ExecuteMPQRecompress(IN const MPQRecompressCommand& cmd)
+{
+	std::vector<std::string> mpqs(1, cmd.mpq);
+	HMPQOVERLAY hOverlay = OpenOverlay(mpqs, cmd.listFiles);
+	if (!hOverlay)
+		return FALSE;
+
+	std::vector<std::string> profileNames;
+	std::vector<MPQFILELOADS> fileLoads;
+	if (!ReadProfiles(hOverlay, cmd.profileFiles, profileNames, fileLoads))
+	{
+		MPQCloseOverlay(hOverlay);
+		return FALSE;
+	}
+
+	uint32_t nFiles;
+	MPQGetOverlayFiles(hOverlay, &nFiles);
+
+	std::vector<MPQDECODECOST> costs(nFiles);
+	if (nFiles)
+		MPQMeasureDecoding(hOverlay, cmd.threads, &costs[0]);
+
+	printf("%s:\n", cmd.mpq.c_str());
+	PrintDecodeAdvice(hOverlay, costs);
+
+	if (cmd.outputPath.empty())
+	{
+		MPQCloseOverlay(hOverlay);
+		return TRUE;
+	}
+
+	// Files which couldn't be measured are left as they are
+	std::vector<double> readSeconds(nFiles);
+	for (uint32_t iFile = 0; iFile < nFiles; iFile++)
+		readSeconds[iFile] = costs[iFile].error == MPQ_ERROR_SUCCESS ? costs[iFile].fSeconds : -1;
+
+	MPQMERGEOPTIONS options;
+	options.cbSectorSize = 0;
+	options.nThreads = cmd.threads;
+	options.nHashTableEntries = 0;
+	options.lplpszFileOrder = NULL;
+	options.nFileOrderNames = 0;
+	options.lpFileLoads = fileLoads.empty() ? NULL : &fileLoads[0];
+	options.nFileLoads = (uint32_t)fileLoads.size();
+	options.cbHotFileBudget = cmd.sizeBudget ? (uint64_t)cmd.sizeBudget * 1024 : (cmd.cpuBudget > 0 ? ~0ULL : 512 * 1024);
+	options.cbMaxHotFileSize = cmd.maxFileSize * 1024;
+	options.lpfReadSeconds = readSeconds.empty() ? NULL : &readSeconds[0];
+	options.fReadSecondsBudget = cmd.cpuBudget / 1000;
+
+	MPQMERGERESULT result;
+	MPQERROR error = MPQMergeArchives(hOverlay, cmd.outputPath.c_str(), &options, &result);
+	if (error != MPQ_ERROR_SUCCESS)
+	{
+		PrintMergeError(hOverlay, cmd.outputPath, error, result);
+		MPQCloseOverlay(hOverlay);
+		return FALSE;
+	}
+
+	printf("\nRewrote %s into %s\n", cmd.mpq.c_str(), cmd.outputPath.c_str());
+	printf("  %u files stored uncompressed, adding %llu bytes (%llu bytes in all)\n",
+		result.nHotFiles, (unsigned long long)result.cbHotFileGrowth, (unsigned long long)result.cbArchiveSize);
+	printf("  Estimated time reading the files %s: %.3f ms before, %.3f ms after\n", fileLoads.empty() ? "once each" : "as profiled",
+		result.fReadSeconds * 1000, (result.fReadSeconds - result.fSavedReadSeconds) * 1000);
+
+	MPQCloseOverlay(hOverlay);
+	return TRUE;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// ExecuteMPQResector - Choose the best sector size for an MPQ and rewrite it
+
+BOOL CMPQDraftCLI::ExecuteMPQResector(IN const MPQResectorCommand& cmd)
+{
+	std::vector<std::string> mpqs(1, cmd.mpq);
+	HMPQOVERLAY hOverlay = OpenOverlay(mpqs, cmd.listFiles);
+	if (!hOverlay)
+		return FALSE;
+
+	std::vector<std::string> profileNames;
+	std::vector<MPQFILELOADS> fileLoads;
+	if (!ReadProfiles(hOverlay, cmd.profileFiles, profileNames, fileLoads))
+	{
+		MPQCloseOverlay(hOverlay);
+		return FALSE;
+	}
+
+	// Decompression is timed on this archive, as its speed depends on what's in it
+	uint32_t nFiles;
+	MPQGetOverlayFiles(hOverlay, &nFiles);
+
+	std::vector<MPQDECODECOST> decodeCosts(nFiles);
+	if (nFiles)
+		MPQMeasureDecoding(hOverlay, cmd.threads, &decodeCosts[0]);
+
+	double fDecodeSeconds = 0;
+	uint64_t cbDecoded = 0;
+	for (const MPQDECODECOST& decodeCost : decodeCosts)
+	{
+		if (decodeCost.error == MPQ_ERROR_SUCCESS && decodeCost.grfCompression)
+		{
+			fDecodeSeconds += decodeCost.fSeconds;
+			cbDecoded += decodeCost.cbFileSize;
+		}
+	}
+
+	MPQSECTORSIZEOPTIONS options;
+	options.lpFileLoads = fileLoads.empty() ? NULL : &fileLoads[0];
+	options.nFileLoads = (uint32_t)fileLoads.size();
+	options.cbMaxSectorSize = cmd.maxSectorSize;
+	options.fSecondsPerRead = cmd.readCost / 1000000;
+	options.fSecondsPerByte = cbDecoded ? fDecodeSeconds / cbDecoded : 0;
+
+	MPQSECTORSIZECOST costs[MPQ_MAX_SECTOR_SIZE_SHIFT + 1];
+	uint32_t iBestShift = MPQEstimateSectorSizes(hOverlay, &options, costs);
+
+	uint32_t iCurrentShift = 0;
+	uint32_t cbCurrentSectorSize = MPQGetArchiveInfo(MPQGetOverlayArchives(hOverlay)[0].hArchive)->cbSectorSize;
+	while (costs[iCurrentShift].cbSectorSize != cbCurrentSectorSize)
+		iCurrentShift++;
+
+	uint32_t iChosenShift = iBestShift;
+	if (cmd.sectorSize)
+	{
+		for (iChosenShift = 0; iChosenShift <= MPQ_MAX_SECTOR_SIZE_SHIFT && costs[iChosenShift].cbSectorSize != cmd.sectorSize; iChosenShift++);
+		if (iChosenShift > MPQ_MAX_SECTOR_SIZE_SHIFT)
+		{
+			printf("ERROR: The sector size must be a power of 2 from %u to %u\n", MPQ_BASE_SECTOR_SIZE, costs[MPQ_MAX_SECTOR_SIZE_SHIFT].cbSectorSize);
+			MPQCloseOverlay(hOverlay);
+			return FALSE;
+		}
+	}
+
+	uint32_t cbMaxSectorSize = cmd.maxSectorSize ? cmd.maxSectorSize : MPQ_DEFAULT_MAX_SECTOR_SIZE;
+
+	printf("%s: sector size %u\n", cmd.mpq.c_str(), cbCurrentSectorSize);
+	if (cbDecoded)
+		printf("  Loading the files %s, decompressing at %.1f MB/s:\n", fileLoads.empty() ? "once each" : "as profiled", cbDecoded / fDecodeSeconds / 1e6);
+	else
+		printf("  Loading the files %s (no compressed files could be timed):\n", fileLoads.empty() ? "once each" : "as profiled");
+	printf("  %11s %12s %14s %14s %10s\n", "Sector size", "Reads", "Decompressed", "Offset tables", "Time (ms)");
+	for (uint32_t iShift = 0; iShift <= MPQ_MAX_SECTOR_SIZE_SHIFT; iShift++)
+	{
+		const MPQSECTORSIZECOST& cost = costs[iShift];
+		if (cost.cbSectorSize > cbMaxSectorSize && iShift != iCurrentShift && iShift != iChosenShift)
+			continue;
+
+		printf("  %11u %12llu %14llu %14llu %10.3f%s%s\n", cost.cbSectorSize, (unsigned long long)cost.nReads, (unsigned long long)cost.cbDecompressed,
+			(unsigned long long)cost.cbOffsetTables, cost.fSeconds * 1000, iShift == iCurrentShift ? " current" : "", iShift == iChosenShift ? " chosen" : "");
+	}
+
+	if (cmd.outputPath.empty())
+	{
+		MPQCloseOverlay(hOverlay);
+		return TRUE;
+	}
+
+	if (iChosenShift == iCurrentShift)
+	{
+		printf("\n%s already has the chosen sector size; it was not rewritten\n", cmd.mpq.c_str());
+		MPQCloseOverlay(hOverlay);
+		return TRUE;
+	}
+
+	MPQMERGEOPTIONS mergeOptions;
+	mergeOptions.cbSectorSize = costs[iChosenShift].cbSectorSize;
+	mergeOptions.nThreads = cmd.threads;
+	mergeOptions.nHashTableEntries = 0;
+	mergeOptions.lplpszFileOrder = NULL;
+	mergeOptions.nFileOrderNames = 0;
+	mergeOptions.lpFileLoads = NULL;
+	mergeOptions.nFileLoads = 0;
+	mergeOptions.cbHotFileBudget = 0;
+	mergeOptions.cbMaxHotFileSize = 0;
+	mergeOptions.lpfReadSeconds = NULL;
+	mergeOptions.fReadSecondsBudget = 0;
+
+	MPQMERGERESULT result;
+	MPQERROR error = MPQMergeArchives(hOverlay, cmd.outputPath.c_str(), &mergeOptions, &result);
+	if (error != MPQ_ERROR_SUCCESS)
+	{
+		PrintMergeError(hOverlay, cmd.outputPath, error, result);
+		MPQCloseOverlay(hOverlay);
+		return FALSE;
+	}
+
+	const MPQSECTORSIZECOST& before = costs[iCurrentShift];
+	const MPQSECTORSIZECOST& after = costs[iChosenShift];
+
+	printf("\nRewrote %s into %s with sector size %u\n", cmd.mpq.c_str(), cmd.outputPath.c_str(), result.cbSectorSize);
+	printf("  %u files compressed again; %llu bytes, was %llu\n", result.nRecompressedFiles,
+		(unsigned long long)result.cbArchiveSize, (unsigned long long)MPQGetArchiveInfo(MPQGetOverlayArchives(hOverlay)[0].hArchive)->qwArchiveSize);
+	printf("  Loading the files %s saves %lld reads (%llu, was %llu) and %lld bytes decompressed (%llu, was %llu)\n",
+		fileLoads.empty() ? "once each" : "as profiled",
+		(long long)before.nReads - (long long)after.nReads, (unsigned long long)after.nReads, (unsigned long long)before.nReads,
+		(long long)before.cbDecompressed - (long long)after.cbDecompressed, (unsigned long long)after.cbDecompressed, (unsigned long long)before.cbDecompressed);
+	printf("  Estimated time: %.3f ms, was %.3f ms\n", after.fSeconds * 1000, before.fSeconds * 1000);
+
+	MPQCloseOverlay(hOverlay);
+	return TRUE;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// ExecuteMPQVerify - Check the integrity of MPQs
+
+// Short names for the checks, used in the report
+static const char* s_lpszArchiveCheckNames[NUM_MPQ_VERIFY_ARCHIVE_CHECKS] = {
+	"header-md5", "table-md5", "file-overlap", "attributes"
+};
+
+static const char* s_lpszFileCheckNames[NUM_MPQ_VERIFY_FILE_CHECKS] = {
+	"sector-crc", "crc32", "md5"
+};
+
+// Warnings which mean the archive is damaged, rather than only unusual
+#define VERIFY_FAILING_WARNINGS (MPQ_WARNING_TRUNCATED | MPQ_WARNING_BAD_BLOCK_INDEX | MPQ_WARNING_BAD_BLOCK | MPQ_WARNING_FILE_BOUNDS)
+
+// Whether a file is corrupt, as opposed to fine or impossible to check
+static bool IsBadVerifyFile(const MPQVERIFYFILE& file)
+{
+	return file.grfProblems || (file.error != MPQ_ERROR_SUCCESS && file.error != MPQ_ERROR_UNKNOWN_KEY
+		&& file.error != MPQ_ERROR_UNSUPPORTED_COMPRESSION);
+}
+
+// Formats a file's name, or its block if the name isn't known
+static std::string GetVerifyFileName(const MPQVERIFYFILE& file)
+{
+	char szName[32];
+
+	if (file.lpszName)
+		return file.lpszName;
+
+	sprintf(szName, "<block %u>", file.iBlock);
+	return szName;
+}
+
+// Quotes a string for JSON
+static std::string JsonString(const char* lpszString)
+{
+	std::string json = "\"";
+	for (const char* lpszChar = lpszString; *lpszChar; lpszChar++)
+	{
+		unsigned char ch = (unsigned char)*lpszChar;
+		if (ch == '"' || ch == '\\')
+		{
+			json += '\\';
+			json += (char)ch;
+		}
+		else if (ch < 0x20)
+		{
+			char szEscape[8];
+			sprintf(szEscape, "\\u%04x", ch);
+			json += szEscape;
+		}
+		else
+			json += (char)ch;
+	}
+
+	return json + "\"";
+}
+
+// Formats a set of check flags as a JSON array of their names
+static std::string JsonCheckNames(uint32_t grfChecks, const char* const* lplpszNames, unsigned nChecks)
+{
+	std::string json = "[";
+	for (unsigned iCheck = 0; iCheck < nChecks; iCheck++)
+	{
+		if (!(grfChecks & (1U << iCheck)))
+			continue;
+
+		if (json.size() > 1)
+			json += ", ";
+		json += JsonString(lplpszNames[iCheck]);
+	}
+
+	return json + "]";
+}
+
+// Writes the results as JSON: every archive, and every file that is corrupt or couldn't be checked
+static bool WriteVerifyReport(HMPQVERIFY hVerify, const MPQVerifyCommand& cmd)
+{
+	FILE* file = fopen(cmd.reportPath.c_str(), "wb");
+	if (!file)
+	{
+		printf("ERROR: Unable to create %s\n", cmd.reportPath.c_str());
+		return false;
+	}
+
+	const MPQVERIFYARCHIVE* lpArchives = MPQGetVerifyArchives(hVerify);
+	const MPQVERIFYFILE* lpFiles = MPQGetVerifyFiles(hVerify, NULL);
+
+	fprintf(file, "{\n  \"archives\": [");
+	for (size_t iArchive = 0; iArchive < cmd.mpqs.size(); iArchive++)
+	{
+		const MPQVERIFYARCHIVE& archive = lpArchives[iArchive];
+
+		fprintf(file, "%s\n    {\n      \"path\": %s,\n", iArchive ? "," : "", JsonString(cmd.mpqs[iArchive].c_str()).c_str());
+		if (archive.error != MPQ_ERROR_SUCCESS)
+		{
+			fprintf(file, "      \"error\": %s\n    }", JsonString(MPQGetErrorString(archive.error)).c_str());
+			continue;
+		}
+
+		fprintf(file, "      \"error\": null,\n      \"warnings\": [");
+		bool bFirst = true;
+		for (unsigned iWarning = 0; iWarning < NUM_MPQ_WARNINGS; iWarning++)
+		{
+			if (archive.info.grfWarnings & (1U << iWarning))
+			{
+				fprintf(file, "%s%s", bFirst ? "" : ", ", JsonString(MPQGetWarningString(1U << iWarning)).c_str());
+				bFirst = false;
+			}
+		}
+
+		fprintf(file, "],\n      \"checked\": %s,\n      \"problems\": %s,\n",
+			JsonCheckNames(archive.grfChecked, s_lpszArchiveCheckNames, NUM_MPQ_VERIFY_ARCHIVE_CHECKS).c_str(),
+			JsonCheckNames(archive.grfProblems, s_lpszArchiveCheckNames, NUM_MPQ_VERIFY_ARCHIVE_CHECKS).c_str());
+		fprintf(file, "      \"files\": %u,\n      \"badFiles\": %u,\n      \"uncheckedFiles\": %u,\n      \"fileResults\": [",
+			archive.nFiles, archive.nBadFiles, archive.nUncheckedFiles);
+
+		bFirst = true;
+		for (uint32_t iFile = archive.iFirstFile; iFile < archive.iFirstFile + archive.nFiles; iFile++)
+		{
+			const MPQVERIFYFILE& verifyFile = lpFiles[iFile];
+			if (!verifyFile.grfProblems && verifyFile.error == MPQ_ERROR_SUCCESS)
+				continue;
+
+			fprintf(file, "%s\n        { \"name\": %s, \"block\": %u, \"hashEntry\": %u, \"bad\": %s, \"error\": %s, \"checked\": %s, \"problems\": %s }",
+				bFirst ? "" : ",",
+				verifyFile.lpszName ? JsonString(verifyFile.lpszName).c_str() : "null",
+				verifyFile.iBlock, verifyFile.iHashEntry,
+				IsBadVerifyFile(verifyFile) ? "true" : "false",
+				verifyFile.error != MPQ_ERROR_SUCCESS ? JsonString(MPQGetErrorString(verifyFile.error)).c_str() : "null",
+				JsonCheckNames(verifyFile.grfChecked, s_lpszFileCheckNames, NUM_MPQ_VERIFY_FILE_CHECKS).c_str(),
+				JsonCheckNames(verifyFile.grfProblems, s_lpszFileCheckNames, NUM_MPQ_VERIFY_FILE_CHECKS).c_str());
+			bFirst = false;
+		}
+
+		fprintf(file, "%s]\n    }", bFirst ? "" : "\n      ");
+	}
+	fprintf(file, "\n  ]\n}\n");
+
+	bool bSuccess = !ferror(file);
+	if (fclose(file) != 0 || !bSuccess)
+	{
+		printf("ERROR: Unable to write %s\n", cmd.reportPath.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+BOOL CMPQDraftCLI::ExecuteMPQVerify(IN const MPQVerifyCommand& cmd)
+{
+	std::string names;
+	for (size_t i = 0; i < cmd.listFiles.size(); i++)
+	{
+		if (!ReadTextFile(cmd.listFiles[i], names))
+			return FALSE;
+
+		names += '\n';
+	}
+
+	std::vector<const char*> mpqPtrs;
+	for (size_t i = 0; i < cmd.mpqs.size(); i++)
+		mpqPtrs.push_back(cmd.mpqs[i].c_str());
+
+	HMPQVERIFY hVerify;
+	MPQERROR error = MPQVerifyArchives(&mpqPtrs[0], (uint32_t)mpqPtrs.size(), names.data(), names.size(), cmd.threads, &hVerify);
+	if (error != MPQ_ERROR_SUCCESS)
+	{
+		printf("ERROR: Unable to verify the MPQs: %s\n", MPQGetErrorString(error));
+		return FALSE;
+	}
+
+	const MPQVERIFYARCHIVE* lpArchives = MPQGetVerifyArchives(hVerify);
+	const MPQVERIFYFILE* lpFiles = MPQGetVerifyFiles(hVerify, NULL);
+
+	uint32_t nBadArchives = 0, nFiles = 0, nBadFiles = 0, nUncheckedFiles = 0;
+	for (size_t iArchive = 0; iArchive < cmd.mpqs.size(); iArchive++)
+	{
+		const MPQVERIFYARCHIVE& archive = lpArchives[iArchive];
+		if (archive.error != MPQ_ERROR_SUCCESS)
+		{
+			printf("%s: BAD: %s\n", cmd.mpqs[iArchive].c_str(), MPQGetErrorString(archive.error));
+			nBadArchives++;
+			continue;
+		}
+
+		// SEMPQs also carry plugins, between the stub and the MPQ. An archive
+		// at the start of the file has nothing before it to check.
+		std::string pluginError;
+		bool bPluginsBad = false;
+		if (archive.info.qwArchiveOffset)
+		{
+			SEMPQCreator creator;
+			bPluginsBad = !creator.verifySEMPQPlugins(cmd.mpqs[iArchive], archive.info.qwArchiveOffset, pluginError);
+		}
+
+		bool bBad = archive.grfProblems || archive.nBadFiles || (archive.info.grfWarnings & VERIFY_FAILING_WARNINGS) || bPluginsBad;
+		if (bBad)
+			nBadArchives++;
+
+		printf("%s: %s: %u files, %u bad, %u not checked\n", cmd.mpqs[iArchive].c_str(), bBad ? "BAD" : "OK",
+			archive.nFiles, archive.nBadFiles, archive.nUncheckedFiles);
+
+		if (bPluginsBad)
+			printf("  %s\n", pluginError.c_str());
+
+		for (unsigned iWarning = 0; iWarning < NUM_MPQ_WARNINGS; iWarning++)
+		{
+			if (archive.info.grfWarnings & (1U << iWarning))
+				printf("  Warning: %s\n", MPQGetWarningString(1U << iWarning));
+		}
+
+		for (unsigned iCheck = 0; iCheck < NUM_MPQ_VERIFY_ARCHIVE_CHECKS; iCheck++)
+		{
+			if (archive.grfProblems & (1U << iCheck))
+				printf("  %s\n", MPQGetVerifyCheckString(1U << iCheck, true));
+		}
+
+		for (uint32_t iFile = archive.iFirstFile; iFile < archive.iFirstFile + archive.nFiles; iFile++)
+		{
+			const MPQVERIFYFILE& file = lpFiles[iFile];
+			if (!IsBadVerifyFile(file))
+				continue;
+
+			std::string name = GetVerifyFileName(file);
+			for (unsigned iCheck = 0; iCheck < NUM_MPQ_VERIFY_FILE_CHECKS; iCheck++)
+			{
+				if (file.grfProblems & (1U << iCheck))
+					printf("  %s: %s\n", name.c_str(), MPQGetVerifyCheckString(1U << iCheck, false));
+			}
+
+			if (file.error != MPQ_ERROR_SUCCESS)
+				printf("  %s: %s\n", name.c_str(), MPQGetErrorString(file.error));
+		}
+
+		nFiles += archive.nFiles;
+		nBadFiles += archive.nBadFiles;
+		nUncheckedFiles += archive.nUncheckedFiles;
+	}
+
+	printf("\n%u of %u MPQs bad; %u files checked, %u bad, %u could not be checked (encrypted with unknown names, or unsupported compression)\n",
+		nBadArchives, (uint32_t)cmd.mpqs.size(), nFiles - nUncheckedFiles, nBadFiles, nUncheckedFiles);
+
+	bool bReportWritten = cmd.reportPath.empty() || WriteVerifyReport(hVerify, cmd);
+
+	MPQCloseVerify(hVerify);
+	return bReportWritten && !nBadArchives;
+}
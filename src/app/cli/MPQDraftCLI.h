@@ -40,6 +40,44 @@ public:
 		IN const SEMPQCommand& cmd
 	);
 
+	// Execute sempq-update command - replace or remove the plugins in a SEMPQ
+	BOOL ExecuteSEMPQUpdate(
+		IN const SEMPQUpdateCommand& cmd
+	);
+
+	// Execute install-runtime command - install the shared runtime thin SEMPQs use
+	BOOL ExecuteInstallRuntime();
+
+	// Execute mpq overlay command - show which MPQ each file is read from
+	BOOL ExecuteMPQOverlay(
+		IN const MPQOverlayCommand& cmd
+	);
+
+	// Execute mpq merge command - merge patch MPQs into one
+	BOOL ExecuteMPQMerge(
+		IN const MPQMergeCommand& cmd
+	);
+
+	// Execute mpq optimize-hash command - measure and rebuild an MPQ's hash table
+	BOOL ExecuteMPQOptimizeHash(
+		IN const MPQOptimizeHashCommand& cmd
+	);
+
+	// Execute mpq recompress command - measure decompression and store costly files uncompressed
+	BOOL ExecuteMPQRecompress(
+		IN const MPQRecompressCommand& cmd
+	);
+
+	// Execute mpq resector command - choose the best sector size for an MPQ and rewrite it
+	BOOL ExecuteMPQResector(
+		IN const MPQResectorCommand& cmd
+	);
+
+	// Execute mpq verify command - check the integrity of MPQs
+	BOOL ExecuteMPQVerify(
+		IN const MPQVerifyCommand& cmd
+	);
+
 private:
 	// Load plugin modules from file paths
 	BOOL LoadPluginModules(
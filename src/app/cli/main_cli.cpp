@@ -93,6 +93,76 @@ int runCli(int argc, char** argv)
 			return bSuccess ? 0 : 1;
 		}
 
+		case CommandType::SEMPQUpdate:
+		{
+			const SEMPQUpdateCommand& cmd = cmdParser.GetSEMPQUpdateCommand();
+
+			CMPQDraftCLI cli;
+			BOOL bSuccess = cli.ExecuteSEMPQUpdate(cmd);
+			return bSuccess ? 0 : 1;
+		}
+
+		case CommandType::InstallRuntime:
+		{
+			CMPQDraftCLI cli;
+			BOOL bSuccess = cli.ExecuteInstallRuntime();
+			return bSuccess ? 0 : 1;
+		}
+
+		case CommandType::MPQOverlay:
+		{
+			const MPQOverlayCommand& cmd = cmdParser.GetMPQOverlayCommand();
+
+			CMPQDraftCLI cli;
+			BOOL bSuccess = cli.ExecuteMPQOverlay(cmd);
+			return bSuccess ? 0 : 1;
+		}
+
+		case CommandType::MPQMerge:
+		{
+			const MPQMergeCommand& cmd = cmdParser.GetMPQMergeCommand();
+
+			CMPQDraftCLI cli;
+			BOOL bSuccess = cli.ExecuteMPQMerge(cmd);
+			return bSuccess ? 0 : 1;
+		}
+
+		case CommandType::MPQOptimizeHash:
+		{
+			const MPQOptimizeHashCommand& cmd = cmdParser.GetMPQOptimizeHashCommand();
+
+			CMPQDraftCLI cli;
+			BOOL bSuccess = cli.ExecuteMPQOptimizeHash(cmd);
+			return bSuccess ? 0 : 1;
+		}
+
+		case CommandType::MPQRecompress:
+		{
+			const MPQRecompressCommand& cmd = cmdParser.GetMPQRecompressCommand();
+
+			CMPQDraftCLI cli;
+			BOOL bSuccess = cli.ExecuteMPQRecompress(cmd);
+			return bSuccess ? 0 : 1;
+		}
+
+		case CommandType::MPQResector:
+		{
+			const MPQResectorCommand& cmd = cmdParser.GetMPQResectorCommand();
+
+			CMPQDraftCLI cli;
+			BOOL bSuccess = cli.ExecuteMPQResector(cmd);
+			return bSuccess ? 0 : 1;
+		}
+
+		case CommandType::MPQVerify:
+		{
+			const MPQVerifyCommand& cmd = cmdParser.GetMPQVerifyCommand();
+
+			CMPQDraftCLI cli;
+			BOOL bSuccess = cli.ExecuteMPQVerify(cmd);
+			return bSuccess ? 0 : 1;
+		}
+
 		case CommandType::None:
 		case CommandType::ListGames:
 		default:
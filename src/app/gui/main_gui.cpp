@@ -11,6 +11,9 @@
 #include <QMessageBox>
 #include <QIcon>
 #include "mainwindow.h"
+#ifdef _WIN32
+#include "SEMPQCreator.h"
+#endif
 
 // Core Qt GUI initialization - used by both standalone and integrated builds
 static int runQtGuiCore(int argc, char *argv[])
@@ -27,6 +30,14 @@ static int runQtGuiCore(int argc, char *argv[])
     QIcon appIcon(":/icons/mpqdraft.ico");
     app.setWindowIcon(appIcon);
 
+#ifdef _WIN32
+    // Install this version's patcher DLL as the shared runtime, so that thin
+    // SEMPQs made with it run here even if this user never creates one.
+    // Failure only means thin SEMPQs will say the runtime is missing.
+    std::string runtimeError;
+    SEMPQCreator::installSharedRuntime(runtimeError);
+#endif
+
     // Create and show the main window
     MainWindow mainWindow;
     mainWindow.show();
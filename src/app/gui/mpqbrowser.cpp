@@ -0,0 +1,429 @@
+/*
+    MPQBrowser - Pane listing the files in one of the patch wizard's MPQs
+
+    The archive is read on a background thread through the native MPQ reader,
+    together with the other checked MPQs, so that each file can be marked with
+    whether it overrides a copy in an MPQ that is loaded before it, or is itself
+    overridden by one loaded after it. Files are added to the list in batches as
+    they're read, and the list only ever asks for the rows that are on screen,
+    so archives with 100,000+ files don't hold up the wizard.
+*/
+
+#include "mpqbrowser.h"
+#include "../../mpq/MPQArchive.h"
+#include "../../mpq/MPQOverlay.h"
+#include <QVBoxLayout>
+#include <QHBoxLayout>
+#include <QLabel>
+#include <QLineEdit>
+#include <QTableView>
+#include <QHeaderView>
+#include <QSortFilterProxyModel>
+#include <QFileInfo>
+#include <QLocale>
+#include <QColor>
+#include <string>
+#include <vector>
+
+// Files are sent to the list this many at a time, so that the list fills in as the archive is read without a signal
+// for every file
+static const int LoaderBatchSize = 4096;
+
+//=============================================================================
+// MPQContentModel
+//=============================================================================
+MPQContentModel::MPQContentModel(QObject *parent)
+    : QAbstractTableModel(parent)
+    , numOverriding(0)
+    , numOverridden(0)
+{
+}
+
+void MPQContentModel::reset(const QStringList &names)
+{
+    beginResetModel();
+    entries.clear();
+    archiveNames = names;
+    numOverriding = 0;
+    numOverridden = 0;
+    endResetModel();
+}
+
+void MPQContentModel::appendEntries(const QVector<MPQContentEntry> &newEntries)
+{
+    if (newEntries.isEmpty()) {
+        return;
+    }
+
+    beginInsertRows(QModelIndex(), entries.count(), entries.count() + newEntries.count() - 1);
+    for (const MPQContentEntry &entry : newEntries) {
+        if (entry.overriddenBy >= 0) {
+            numOverridden++;
+        } else if (entry.overrides >= 0) {
+            numOverriding++;
+        }
+    }
+    entries += newEntries;
+    endInsertRows();
+}
+
+int MPQContentModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : entries.count();
+}
+
+int MPQContentModel::columnCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : ColumnCount;
+}
+
+QString MPQContentModel::displayName(const MPQContentEntry &entry) const
+{
+    if (!entry.name.isEmpty()) {
+        return entry.name;
+    }
+
+    // Files without names in any list file can still be told apart by their name hashes
+    QString hashes = QString("%1%2").arg(entry.nameHashA, 8, 16, QChar('0')).arg(entry.nameHashB, 8, 16, QChar('0'));
+    return tr("<unknown %1>").arg(hashes.toUpper());
+}
+
+QString MPQContentModel::overlayText(const MPQContentEntry &entry) const
+{
+    if (entry.overriddenBy >= 0) {
+        return tr("Overridden by %1").arg(archiveNames.value(entry.overriddenBy));
+    }
+
+    if (entry.overrides >= 0) {
+        if (entry.overridesCount > 1) {
+            return tr("Overrides %1 and %2 more").arg(archiveNames.value(entry.overrides)).arg(entry.overridesCount - 1);
+        }
+        return tr("Overrides %1").arg(archiveNames.value(entry.overrides));
+    }
+
+    return QString();
+}
+
+QVariant MPQContentModel::data(const QModelIndex &index, int role) const
+{
+    // Only the rows on screen are ever asked for, so everything is worked out here rather than stored
+    if (!index.isValid() || index.row() >= entries.count()) {
+        return QVariant();
+    }
+
+    const MPQContentEntry &entry = entries.at(index.row());
+
+    switch (role) {
+    case Qt::DisplayRole:
+        switch (index.column()) {
+        case NameColumn:
+            return displayName(entry);
+        case SizeColumn:
+            return QLocale().formattedDataSize(entry.fileSize);
+        case CompressedSizeColumn:
+            return QLocale().formattedDataSize(entry.compressedSize);
+        case LocaleColumn:
+            return entry.locale ? QString("0x%1").arg(entry.locale, 4, 16, QChar('0')) : tr("Neutral");
+        case OverlayColumn:
+            return overlayText(entry);
+        }
+        break;
+
+    case Qt::ToolTipRole:
+        if (index.column() == OverlayColumn && entry.overriddenBy >= 0) {
+            return tr("The game reads this file from %1, so this copy is never used")
+                .arg(archiveNames.value(entry.overriddenBy));
+        }
+        if (index.column() == OverlayColumn && entry.overrides >= 0) {
+            return tr("The game reads this copy instead of the one in %1").arg(archiveNames.value(entry.overrides));
+        }
+        break;
+
+    case Qt::ForegroundRole:
+        // Copies that are never read are greyed out, and copies that replace others stand out
+        if (entry.overriddenBy >= 0) {
+            return QColor(Qt::gray);
+        }
+        if (entry.overrides >= 0 && index.column() == OverlayColumn) {
+            return QColor(21, 101, 192);
+        }
+        break;
+
+    case Qt::TextAlignmentRole:
+        if (index.column() == SizeColumn || index.column() == CompressedSizeColumn) {
+            return int(Qt::AlignRight | Qt::AlignVCenter);
+        }
+        break;
+    }
+
+    return QVariant();
+}
+
+QVariant MPQContentModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if (orientation != Qt::Horizontal || role != Qt::DisplayRole) {
+        return QAbstractTableModel::headerData(section, orientation, role);
+    }
+
+    switch (section) {
+    case NameColumn:           return tr("Name");
+    case SizeColumn:           return tr("Size");
+    case CompressedSizeColumn: return tr("Packed");
+    case LocaleColumn:         return tr("Locale");
+    case OverlayColumn:        return tr("Other MPQs");
+    }
+
+    return QVariant();
+}
+
+//=============================================================================
+// MPQContentLoader
+//=============================================================================
+MPQContentLoader::MPQContentLoader(const QStringList &order, int index, int gen, QObject *parent)
+    : QThread(parent)
+    , loadOrder(order)
+    , archiveIndex(index)
+    , generation(gen)
+    , cancelRequested(false)
+{
+}
+
+void MPQContentLoader::requestCancellation()
+{
+    cancelRequested = true;
+}
+
+void MPQContentLoader::run()
+{
+    std::vector<std::string> mpqPaths;
+    std::vector<const char *> mpqPtrs;
+    for (const QString &path : loadOrder) {
+        mpqPaths.push_back(path.toStdString());
+    }
+    for (const std::string &mpqPath : mpqPaths) {
+        mpqPtrs.push_back(mpqPath.c_str());
+    }
+
+    // Reading the hash tables and list files is the slow part, and can't be interrupted
+    HMPQOVERLAY hOverlay;
+    uint32_t failedArchive = 0;
+    MPQERROR error = MPQCreateOverlay(&mpqPtrs[0], (uint32_t)mpqPtrs.size(), MPQ_OVERLAY_READ_LISTFILES, &hOverlay, &failedArchive);
+    if (error != MPQ_ERROR_SUCCESS) {
+        emit loadComplete(generation, tr("%1: %2").arg(QFileInfo(loadOrder.value(failedArchive)).fileName(),
+                                                      QString::fromLocal8Bit(MPQGetErrorString(error))));
+        return;
+    }
+
+    const MPQOVERLAYARCHIVE *archives = MPQGetOverlayArchives(hOverlay);
+    const MPQOVERLAYINSTANCE *instances = MPQGetOverlayInstances(hOverlay);
+    const MPQBLOCKENTRY *blockTable = MPQGetBlockTable(archives[archiveIndex].hArchive, NULL);
+
+    uint32_t numFiles;
+    const MPQOVERLAYFILE *files = MPQGetOverlayFiles(hOverlay, &numFiles);
+
+    QVector<MPQContentEntry> batch;
+    batch.reserve(LoaderBatchSize);
+
+    for (uint32_t iFile = 0; iFile < numFiles && !cancelRequested; ++iFile) {
+        const MPQOVERLAYFILE &file = files[iFile];
+
+        // Copies go from the one the game reads down in priority
+        uint32_t position = 0;
+        while (position < file.nInstances && instances[file.iFirstInstance + position].iArchive != (uint32_t)archiveIndex) {
+            ++position;
+        }
+        if (position == file.nInstances) {
+            continue;
+        }
+
+        const MPQOVERLAYINSTANCE &instance = instances[file.iFirstInstance + position];
+        const MPQBLOCKENTRY &block = blockTable[instance.iBlock];
+
+        MPQContentEntry entry;
+        entry.name = file.lpszName ? QString::fromLocal8Bit(file.lpszName) : QString();
+        entry.nameHashA = file.dwNameHashA;
+        entry.nameHashB = file.dwNameHashB;
+        entry.locale = file.wLocale;
+        entry.fileSize = block.cbFileSize;
+        entry.compressedSize = instance.cbCompressedSize;
+        entry.overriddenBy = position ? (int)instances[file.iFirstInstance].iArchive : -1;
+        entry.overrides = position + 1 < file.nInstances ? (int)instances[file.iFirstInstance + position + 1].iArchive : -1;
+        entry.overridesCount = (int)(file.nInstances - position - 1);
+        batch.append(entry);
+
+        if (batch.count() == LoaderBatchSize) {
+            emit entriesLoaded(generation, batch);
+            batch.clear();
+        }
+    }
+
+    MPQCloseOverlay(hOverlay);
+
+    if (!cancelRequested) {
+        emit entriesLoaded(generation, batch);
+        emit loadComplete(generation, QString());
+    }
+}
+
+//=============================================================================
+// MPQBrowserPane
+//=============================================================================
+MPQBrowserPane::MPQBrowserPane(QWidget *parent)
+    : QWidget(parent)
+    , currentGeneration(0)
+{
+    qRegisterMetaType<MPQContentEntry>();
+    qRegisterMetaType<QVector<MPQContentEntry>>();
+
+    QVBoxLayout *mainLayout = new QVBoxLayout(this);
+    mainLayout->setContentsMargins(0, 0, 0, 0);
+
+    // Status and filter
+    QHBoxLayout *topLayout = new QHBoxLayout();
+    statusLabel = new QLabel(this);
+    filterEdit = new QLineEdit(this);
+    filterEdit->setPlaceholderText(tr("Filter by name"));
+    filterEdit->setClearButtonEnabled(true);
+    filterEdit->setMaximumWidth(250);
+    connect(filterEdit, &QLineEdit::textChanged, this, &MPQBrowserPane::onFilterChanged);
+    topLayout->addWidget(statusLabel, 1);
+    topLayout->addWidget(filterEdit);
+    mainLayout->addLayout(topLayout);
+
+    model = new MPQContentModel(this);
+    filterModel = new QSortFilterProxyModel(this);
+    filterModel->setSourceModel(model);
+    filterModel->setFilterKeyColumn(MPQContentModel::NameColumn);
+    filterModel->setFilterCaseSensitivity(Qt::CaseInsensitive);
+
+    // Fixed row heights and column widths let the view work out what's on screen without asking about every row
+    tableView = new QTableView(this);
+    tableView->setModel(filterModel);
+    tableView->setSelectionBehavior(QAbstractItemView::SelectRows);
+    tableView->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    tableView->setWordWrap(false);
+    tableView->setShowGrid(false);
+    tableView->setAlternatingRowColors(true);
+    tableView->verticalHeader()->hide();
+    tableView->verticalHeader()->setSectionResizeMode(QHeaderView::Fixed);
+    tableView->verticalHeader()->setDefaultSectionSize(tableView->fontMetrics().height() + 4);
+    tableView->horizontalHeader()->setSectionResizeMode(QHeaderView::Interactive);
+    tableView->horizontalHeader()->setSectionResizeMode(MPQContentModel::NameColumn, QHeaderView::Stretch);
+    tableView->horizontalHeader()->resizeSection(MPQContentModel::SizeColumn, 80);
+    tableView->horizontalHeader()->resizeSection(MPQContentModel::CompressedSizeColumn, 80);
+    tableView->horizontalHeader()->resizeSection(MPQContentModel::LocaleColumn, 60);
+    tableView->horizontalHeader()->resizeSection(MPQContentModel::OverlayColumn, 180);
+    mainLayout->addWidget(tableView);
+
+    showMessage(tr("Select an MPQ to see its files."));
+}
+
+MPQBrowserPane::~MPQBrowserPane()
+{
+    // The loaders can't be destroyed while they're running
+    for (MPQContentLoader *loader : loaders) {
+        loader->requestCancellation();
+        loader->wait();
+    }
+}
+
+void MPQBrowserPane::stopLoading()
+{
+    // Loaders clean themselves up when they finish, so they're just told to stop
+    for (MPQContentLoader *loader : loaders) {
+        loader->requestCancellation();
+    }
+    ++currentGeneration;
+}
+
+void MPQBrowserPane::showMessage(const QString &message)
+{
+    stopLoading();
+    shownSignature.clear();
+    shownArchiveName.clear();
+    model->reset(QStringList());
+    statusLabel->setText(message);
+}
+
+void MPQBrowserPane::showArchive(const QString &mpqPath, const QStringList &loadOrder)
+{
+    QStringList order = loadOrder;
+    int archiveIndex = order.indexOf(mpqPath);
+    if (archiveIndex < 0) {
+        order = QStringList(mpqPath);
+        archiveIndex = 0;
+    }
+
+    // The marks depend on the whole load order, not just the archive
+    QString signature = QString::number(archiveIndex) + "\n" + order.join("\n");
+    if (signature == shownSignature) {
+        return;
+    }
+
+    stopLoading();
+    shownSignature = signature;
+    shownArchiveName = QFileInfo(mpqPath).fileName();
+
+    QStringList archiveNames;
+    for (const QString &path : order) {
+        archiveNames.append(QFileInfo(path).fileName());
+    }
+    model->reset(archiveNames);
+    updateStatus(true);
+
+    MPQContentLoader *loader = new MPQContentLoader(order, archiveIndex, currentGeneration, this);
+    connect(loader, &MPQContentLoader::entriesLoaded, this, &MPQBrowserPane::onEntriesLoaded);
+    connect(loader, &MPQContentLoader::loadComplete, this, &MPQBrowserPane::onLoadComplete);
+    connect(loader, &QThread::finished, this, [this, loader]() {
+        loaders.removeOne(loader);
+        loader->deleteLater();
+    });
+    loaders.append(loader);
+    loader->start(QThread::LowPriority);
+}
+
+void MPQBrowserPane::onEntriesLoaded(int generation, const QVector<MPQContentEntry> &entries)
+{
+    if (generation != currentGeneration) {
+        return;
+    }
+
+    model->appendEntries(entries);
+    updateStatus(true);
+}
+
+void MPQBrowserPane::onLoadComplete(int generation, const QString &error)
+{
+    if (generation != currentGeneration) {
+        return;
+    }
+
+    if (!error.isEmpty()) {
+        model->reset(QStringList());
+        statusLabel->setText(tr("<font color='#d32f2f'>Could not read %1</font>").arg(error.toHtmlEscaped()));
+        return;
+    }
+
+    updateStatus(false);
+}
+
+void MPQBrowserPane::onFilterChanged(const QString &text)
+{
+    filterModel->setFilterFixedString(text);
+}
+
+void MPQBrowserPane::updateStatus(bool loading)
+{
+    QString status = tr("<b>%1</b>: %2 files").arg(shownArchiveName.toHtmlEscaped()).arg(model->rowCount());
+    if (model->overridingCount()) {
+        status += tr(", %1 override earlier MPQs").arg(model->overridingCount());
+    }
+    if (model->overriddenCount()) {
+        status += tr(", %1 overridden by later MPQs").arg(model->overriddenCount());
+    }
+    if (loading) {
+        status += tr(" (reading...)");
+    }
+
+    statusLabel->setText(status);
+}
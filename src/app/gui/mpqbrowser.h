@@ -0,0 +1,160 @@
+/*
+    MPQBrowser - Pane listing the files in one of the patch wizard's MPQs
+
+    The archive is read on a background thread through the native MPQ reader,
+    together with the other checked MPQs, so that each file can be marked with
+    whether it overrides a copy in an MPQ that is loaded before it, or is itself
+    overridden by one loaded after it. Files are added to the list in batches as
+    they're read, and the list only ever asks for the rows that are on screen,
+    so archives with 100,000+ files don't hold up the wizard.
+*/
+
+#ifndef MPQBROWSER_H
+#define MPQBROWSER_H
+
+#include <QAbstractTableModel>
+#include <QList>
+#include <QMetaType>
+#include <QStringList>
+#include <QThread>
+#include <QVector>
+#include <QWidget>
+#include <atomic>
+
+class QLabel;
+class QLineEdit;
+class QSortFilterProxyModel;
+class QTableView;
+
+// One file in the browsed archive
+struct MPQContentEntry
+{
+    QString name;                   // Empty if the name isn't known
+    quint32 nameHashA;
+    quint32 nameHashB;
+    quint16 locale;
+    quint32 fileSize;
+    quint32 compressedSize;
+
+    // Index in the load order of the MPQ the game reads the file from instead of this one, or -1 if it reads this one
+    int overriddenBy;
+    // Index in the load order of the highest-priority MPQ loaded before this one that has the file, or -1 if there's none,
+    // and how many MPQs loaded before this one have it
+    int overrides;
+    int overridesCount;
+};
+
+// Entries are passed from the loader thread in queued signals
+Q_DECLARE_METATYPE(MPQContentEntry)
+
+//=============================================================================
+// Model of the files in one archive
+//=============================================================================
+class MPQContentModel : public QAbstractTableModel
+{
+    Q_OBJECT
+
+public:
+    enum Column {
+        NameColumn,
+        SizeColumn,
+        CompressedSizeColumn,
+        LocaleColumn,
+        OverlayColumn,
+        ColumnCount
+    };
+
+    explicit MPQContentModel(QObject *parent = nullptr);
+
+    // Starts over with a new archive; archiveNames are the file names of the MPQs in load order
+    void reset(const QStringList &archiveNames);
+    void appendEntries(const QVector<MPQContentEntry> &entries);
+
+    int overridingCount() const { return numOverriding; }
+    int overriddenCount() const { return numOverridden; }
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+
+private:
+    QString displayName(const MPQContentEntry &entry) const;
+    QString overlayText(const MPQContentEntry &entry) const;
+
+    QVector<MPQContentEntry> entries;
+    QStringList archiveNames;
+    int numOverriding;
+    int numOverridden;
+};
+
+//=============================================================================
+// Worker thread reading an archive's files
+//=============================================================================
+class MPQContentLoader : public QThread
+{
+    Q_OBJECT
+
+public:
+    // loadOrder is the MPQs to overlay, lowest priority first; archiveIndex is the one to list
+    MPQContentLoader(const QStringList &loadOrder, int archiveIndex, int generation, QObject *parent = nullptr);
+
+    void requestCancellation();
+
+signals:
+    void entriesLoaded(int generation, const QVector<MPQContentEntry> &entries);
+    void loadComplete(int generation, const QString &error);
+
+protected:
+    void run() override;
+
+private:
+    QStringList loadOrder;
+    int archiveIndex;
+    int generation;
+    std::atomic<bool> cancelRequested;
+};
+
+//=============================================================================
+// The browser pane
+//=============================================================================
+class MPQBrowserPane : public QWidget
+{
+    Q_OBJECT
+
+public:
+    explicit MPQBrowserPane(QWidget *parent = nullptr);
+    ~MPQBrowserPane();
+
+    // Lists the files of mpqPath, marked against the other MPQs in loadOrder (lowest priority first). If mpqPath isn't
+    // in loadOrder, it's listed on its own. Does nothing if it's already showing the same thing.
+    void showArchive(const QString &mpqPath, const QStringList &loadOrder);
+    // Shows a message instead of a list of files
+    void showMessage(const QString &message);
+
+private slots:
+    void onEntriesLoaded(int generation, const QVector<MPQContentEntry> &entries);
+    void onLoadComplete(int generation, const QString &error);
+    void onFilterChanged(const QString &text);
+
+private:
+    void stopLoading();
+    void updateStatus(bool loading);
+
+    MPQContentModel *model;
+    QSortFilterProxyModel *filterModel;
+    QTableView *tableView;
+    QLineEdit *filterEdit;
+    QLabel *statusLabel;
+
+    // What's being shown, so that the same archive isn't read again
+    QString shownSignature;
+    QString shownArchiveName;
+
+    // Loaders that were replaced before they finished are cancelled and left to finish on their own, and only the
+    // current generation's results are used
+    int currentGeneration;
+    QList<MPQContentLoader *> loaders;
+};
+
+#endif // MPQBROWSER_H
@@ -10,7 +10,10 @@
 
 #include "patchwizard.h"
 #include "pluginpage.h"
+#include "mpqbrowser.h"
 #include "../../dll/PatcherLimits.h"
+#include "../../mpq/MPQArchive.h"
+#include "../../mpq/MPQOverlay.h"
 #include "../../core/GameData.h"
 #include "../../core/GameDetection.h"
 #include "helpers/gamedata_qt.h"
@@ -22,6 +25,7 @@
 #include <QPixmap>
 #include <QPainter>
 #include <QFileInfo>
+#include <QDateTime>
 #include <QDir>
 #include <QIcon>
 #include <QScrollArea>
@@ -32,6 +36,7 @@
 #include <QComboBox>
 #include <QScrollBar>
 #include <QMenu>
+#include <QSplitter>
 
 #ifdef _WIN32
 #include "../../core/PatcherApi.h"
@@ -56,6 +61,14 @@ enum GameListDataRole {
     IsSupportedGameRole                     // bool: is a supported game (vs custom executable)
 };
 
+// Data roles for MPQ list items, caching the result of validating the archive
+enum MPQListDataRole {
+    ValidatedFileRole = Qt::UserRole,       // QString: size and modification time of the file when it was validated
+    ValidationErrorRole,                    // QString: why the archive is invalid, or empty if it's valid
+    ValidationProblemsRole,                 // QString: errors and warnings from validating the archive
+    OverlayRole                             // QString: how much of the archive is overridden by later archives
+};
+
 //=============================================================================
 // Page 0: Introduction
 //=============================================================================
@@ -1168,7 +1181,21 @@ MPQSelectionPage::MPQSelectionPage(QWidget *parent)
     buttonLayout->addStretch();
 
     contentLayout->addLayout(buttonLayout);
-    mainLayout->addLayout(contentLayout);
+
+    // The files of the selected MPQ go below the list, which can be resized against it
+    QWidget *listWidget = new QWidget(this);
+    contentLayout->setContentsMargins(0, 0, 0, 0);
+    listWidget->setLayout(contentLayout);
+
+    browserPane = new MPQBrowserPane(this);
+
+    QSplitter *splitter = new QSplitter(Qt::Vertical, this);
+    splitter->addWidget(listWidget);
+    splitter->addWidget(browserPane);
+    splitter->setChildrenCollapsible(false);
+    splitter->setStretchFactor(0, 1);
+    splitter->setStretchFactor(1, 2);
+    mainLayout->addWidget(splitter);
 }
 
 QStringList MPQSelectionPage::getSelectedMPQs() const
@@ -1289,8 +1316,8 @@ void MPQSelectionPage::validateMPQList()
     int mpqCount = mpqListWidget->count();
     int checkedCount = 0;
 
-    // Count checked MPQs and check for missing files
-    QStringList missingFiles;
+    // Count checked MPQs and check for missing and invalid files
+    QStringList missingFiles, invalidFiles;
     for (int i = 0; i < mpqCount; ++i) {
         QListWidgetItem *item = mpqListWidget->item(i);
         QString mpqPath = item->text();
@@ -1304,16 +1331,48 @@ void MPQSelectionPage::validateMPQList()
             missingFiles.append(QFileInfo(mpqPath).fileName());
             item->setForeground(Qt::red);
             item->setToolTip(tr("File does not exist"));
+            item->setData(ValidatedFileRole, QVariant());
+            continue;
+        }
+
+        // This runs whenever anything in the list changes, so only validate archives that are new or changed
+        QString validatedFile = QString("%1:%2").arg(fileInfo.size()).arg(fileInfo.lastModified().toMSecsSinceEpoch());
+        if (item->data(ValidatedFileRole).toString() != validatedFile) {
+            MPQARCHIVEINFO archiveInfo;
+            MPQERROR error = MPQValidateArchive(mpqPath.toStdString().c_str(), &archiveInfo);
+
+            QStringList problems;
+            if (error != MPQ_ERROR_SUCCESS) {
+                problems.append(MPQGetErrorString(error));
+            } else {
+                for (int iWarning = 0; iWarning < NUM_MPQ_WARNINGS; ++iWarning) {
+                    if (archiveInfo.grfWarnings & (1U << iWarning)) {
+                        problems.append(MPQGetWarningString(1U << iWarning));
+                    }
+                }
+            }
+
+            item->setData(ValidatedFileRole, validatedFile);
+            item->setData(ValidationErrorRole, error != MPQ_ERROR_SUCCESS ? problems.join("\n") : QString());
+            item->setData(ValidationProblemsRole, problems.join("\n"));
+        }
+
+        QString validationError = item->data(ValidationErrorRole).toString();
+        if (!validationError.isEmpty()) {
+            invalidFiles.append(fileInfo.fileName());
+            item->setForeground(Qt::red);
         } else {
             item->setForeground(QColor());
-            item->setToolTip("");
         }
     }
 
+    analyzeOverlay();
+
     // Check if too many checked MPQs
     if (checkedCount > MAX_PATCH_MPQS) {
         warningLabel->setText(tr("<font color='#d32f2f'><b>Warning:</b> Too many MPQ files selected (%1/%2). "
-                                     "Please uncheck some files.</font>")
+                                     "Please uncheck some files, or merge them into one with "
+                                     "<i>MPQDraft mpq merge</i>.</font>")
                             .arg(checkedCount).arg(MAX_PATCH_MPQS));
         warningLabel->show();
         return;
@@ -1323,11 +1382,121 @@ void MPQSelectionPage::validateMPQList()
         warningLabel->setText(tr("<font color='#d32f2f'><b>Warning:</b> Some MPQ files do not exist: %1</font>")
                             .arg(missingFiles.join(", ")));
         warningLabel->show();
+    } else if (!invalidFiles.isEmpty()) {
+        warningLabel->setText(tr("<font color='#d32f2f'><b>Warning:</b> Some MPQ files are not valid archives: %1</font>")
+                            .arg(invalidFiles.join(", ")));
+        warningLabel->show();
     } else {
         warningLabel->hide();
     }
 }
 
+void MPQSelectionPage::analyzeOverlay()
+{
+    // Overlay the checked archives that are valid, in the order they'll be loaded
+    QList<QListWidgetItem *> overlayItems;
+    QString overlaySignature;
+    for (int i = 0; i < mpqListWidget->count(); ++i) {
+        QListWidgetItem *item = mpqListWidget->item(i);
+        bool isValid = !item->data(ValidatedFileRole).isNull() && item->data(ValidationErrorRole).toString().isEmpty();
+
+        if (item->checkState() == Qt::Checked && isValid) {
+            overlayItems.append(item);
+            overlaySignature += item->text() + "|" + item->data(ValidatedFileRole).toString() + "\n";
+        }
+    }
+
+    // Only the hash tables are read, but there's no need to do even that if nothing changed
+    if (overlaySignature != lastOverlaySignature) {
+        lastOverlaySignature = overlaySignature;
+
+        for (int i = 0; i < mpqListWidget->count(); ++i) {
+            mpqListWidget->item(i)->setData(OverlayRole, QString());
+        }
+
+        if (overlayItems.count() > 1) {
+            std::vector<std::string> mpqPaths;
+            std::vector<const char *> mpqPtrs;
+            for (QListWidgetItem *item : overlayItems) {
+                mpqPaths.push_back(item->text().toStdString());
+            }
+            for (const std::string &mpqPath : mpqPaths) {
+                mpqPtrs.push_back(mpqPath.c_str());
+            }
+
+            HMPQOVERLAY hOverlay;
+            if (MPQCreateOverlay(&mpqPtrs[0], (uint32_t)mpqPtrs.size(), 0, &hOverlay, NULL) == MPQ_ERROR_SUCCESS) {
+                const MPQOVERLAYARCHIVE *archives = MPQGetOverlayArchives(hOverlay);
+
+                for (int i = 0; i < overlayItems.count(); ++i) {
+                    if (archives[i].nShadowedFiles) {
+                        overlayItems[i]->setData(OverlayRole,
+                            tr("%1 of %2 files are overridden by MPQs further down the list (%3 KB never read)")
+                                .arg(archives[i].nShadowedFiles).arg(archives[i].nFiles)
+                                .arg((archives[i].cbShadowedBytes + 1023) / 1024));
+                    }
+                }
+
+                MPQCloseOverlay(hOverlay);
+            }
+        }
+    }
+
+    // Tooltips show both what's wrong with the archive and how it's overridden
+    for (int i = 0; i < mpqListWidget->count(); ++i) {
+        QListWidgetItem *item = mpqListWidget->item(i);
+        if (item->data(ValidatedFileRole).isNull()) {
+            continue;
+        }
+
+        QStringList toolTip;
+        if (!item->data(ValidationProblemsRole).toString().isEmpty()) {
+            toolTip.append(item->data(ValidationProblemsRole).toString());
+        }
+        if (!item->data(OverlayRole).toString().isEmpty()) {
+            toolTip.append(item->data(OverlayRole).toString());
+        }
+
+        item->setToolTip(toolTip.join("\n"));
+    }
+
+    // The browser's marks depend on the same archives
+    updateBrowser();
+}
+
+void MPQSelectionPage::updateBrowser()
+{
+    QList<QListWidgetItem *> selected = mpqListWidget->selectedItems();
+    if (selected.count() != 1) {
+        browserPane->showMessage(tr("Select an MPQ to see its files."));
+        return;
+    }
+
+    QListWidgetItem *selectedItem = selected.first();
+    if (!QFileInfo::exists(selectedItem->text())) {
+        browserPane->showMessage(tr("%1 does not exist.").arg(QFileInfo(selectedItem->text()).fileName()));
+        return;
+    }
+    if (!selectedItem->data(ValidationErrorRole).toString().isEmpty()) {
+        browserPane->showMessage(tr("%1 is not a valid MPQ: %2").arg(QFileInfo(selectedItem->text()).fileName(),
+                                                                      selectedItem->data(ValidationErrorRole).toString()));
+        return;
+    }
+
+    // Files are marked against the checked archives, in the order they'll be loaded
+    QStringList loadOrder;
+    for (int i = 0; i < mpqListWidget->count(); ++i) {
+        QListWidgetItem *item = mpqListWidget->item(i);
+        bool isValid = !item->data(ValidatedFileRole).isNull() && item->data(ValidationErrorRole).toString().isEmpty();
+
+        if (item->checkState() == Qt::Checked && isValid) {
+            loadOrder.append(item->text());
+        }
+    }
+
+    browserPane->showArchive(selectedItem->text(), loadOrder);
+}
+
 void MPQSelectionPage::onItemChanged()
 {
     validateMPQList();
@@ -1472,6 +1641,8 @@ void MPQSelectionPage::onSelectionChanged()
     // Move Up/Down buttons: enabled only if exactly 1 item selected
     moveUpButton  ->setEnabled(selectedCount == 1);
     moveDownButton->setEnabled(selectedCount == 1);
+
+    updateBrowser();
 }
 
 //=============================================================================
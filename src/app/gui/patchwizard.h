@@ -24,6 +24,7 @@
 
 // Forward declarations
 class PluginPage;
+class MPQBrowserPane;
 
 //=============================================================================
 // Page 0: Introduction
@@ -111,11 +112,15 @@ private slots:
 
 private:
     void validateMPQList();
+    void analyzeOverlay();
+    void updateBrowser();
     void addMPQFile(const QString &fileName, bool checked);
     void saveSettings();
     void loadSettings();
 
     QString lastMPQDirectory;
+    // The checked archives the overlay tooltips were last worked out for
+    QString lastOverlaySignature;
 
     QListWidget *mpqListWidget;
     QPushButton *addButton;
@@ -124,6 +129,7 @@ private:
     QPushButton *moveUpButton;
     QPushButton *moveDownButton;
     QLabel *warningLabel;
+    MPQBrowserPane *browserPane;
 };
 
 //=============================================================================
@@ -2043,7 +2043,7 @@ void SEMPQProgressPage::rebuildProgressLog(int progress)
     }
 
     // Step 3: Writing MPQ Data
-    if (progress >= SEMPQCreator::WRITE_FINISHED) { // Done
+    if (progress >= SEMPQCreator::VERIFY_INITIAL_PROGRESS) { // Done
         html += QString("<span style='font-weight: bold; color: green;'>%1 %2</span><br>").arg(doneIcon, tr("Writing MPQ Data"));
     } else if (progress >= SEMPQCreator::WRITE_MPQ_INITIAL_PROGRESS) { // In progress
         html += QString("<span style='font-style: italic; color: blue;'>%1 %2</span><br>").arg(activeIcon, tr("Writing MPQ Data"));
@@ -2051,6 +2051,15 @@ void SEMPQProgressPage::rebuildProgressLog(int progress)
         html += QString("<span style='color: gray;'>%1 %2</span><br>").arg(pendingIcon, tr("Writing MPQ Data"));
     }
 
+    // Step 4: Verifying Plugins
+    if (progress >= SEMPQCreator::WRITE_FINISHED) { // Done
+        html += QString("<span style='font-weight: bold; color: green;'>%1 %2</span><br>").arg(doneIcon, tr("Verifying Plugins"));
+    } else if (progress >= SEMPQCreator::VERIFY_INITIAL_PROGRESS) { // In progress
+        html += QString("<span style='font-style: italic; color: blue;'>%1 %2</span><br>").arg(activeIcon, tr("Verifying Plugins"));
+    } else { // Not started
+        html += QString("<span style='color: gray;'>%1 %2</span><br>").arg(pendingIcon, tr("Verifying Plugins"));
+    }
+
     progressLog->setHtml(html);
 }
 
@@ -0,0 +1,325 @@
+/*
+	The contents of this file are subject to the Common Development and Distribution License Version 1.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at http://www.sun.com/cddl/cddl.html.
+
+	Software distributed under the License is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for the specific language governing rights and limitations under the License.
+
+	The Initial Developer of the Original Code is Justin Olbrantz. The Original Code Copyright (C) 2007 Justin Olbrantz. All Rights Reserved.
+*/
+
+#include "QChecksum.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+// The CRC32 instruction is part of SSE 4.2, and only exists on x86 processors. MSVC makes the intrinsics available unconditionally; GCC requires the functions using them to be compiled for SSE 4.2, which we do with the target attribute so that the rest of the program still runs on older processors.
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <intrin.h>
+#include <nmmintrin.h>
+#define QCHECKSUM_HAVE_SSE42
+#define QCHECKSUM_SSE42_FUNCTION
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#include <cpuid.h>
+#include <nmmintrin.h>
+#define QCHECKSUM_HAVE_SSE42
+#define QCHECKSUM_SSE42_FUNCTION __attribute__((target("sse4.2")))
+#endif
+
+// The CRC-32C polynomial, in reversed bit order
+#define CRC32C_POLYNOMIAL 0x82F63B78
+
+// Table for the software implementation, built on first use
+static DWORD dwCRC32CTable[256];
+static volatile LONG bCRC32CTableBuilt = FALSE;
+
+// Whether the processor supports the CRC32 instruction. -1 if we haven't checked yet.
+static volatile LONG nHardwareCRC32C = -1;
+
+static void BuildCRC32CTable()
+{
+	// Building the table twice in a race is harmless, as both threads will write identical values
+	for (DWORD iCurEntry = 0; iCurEntry < 256; iCurEntry++)
+	{
+		DWORD dwValue = iCurEntry;
+		for (int iCurBit = 0; iCurBit < 8; iCurBit++)
+			dwValue = (dwValue >> 1) ^ ((dwValue & 1) ? CRC32C_POLYNOMIAL : 0);
+
+		dwCRC32CTable[iCurEntry] = dwValue;
+	}
+
+	InterlockedExchange(&bCRC32CTableBuilt, TRUE);
+}
+
+// Table-driven CRC-32C, one byte at a time. Works everywhere, but is an order of magnitude slower than the hardware version.
+static DWORD SoftwareCRC32C(IN DWORD dwCRC, IN const BYTE *lpbyData, IN DWORD nDataSize)
+{
+	if (!bCRC32CTableBuilt)
+		BuildCRC32CTable();
+
+	while (nDataSize--)
+		dwCRC = dwCRC32CTable[(dwCRC ^ *lpbyData++) & 0xFF] ^ (dwCRC >> 8);
+
+	return dwCRC;
+}
+
+#ifdef QCHECKSUM_HAVE_SSE42
+// Hardware CRC-32C. Does single bytes until the pointer is aligned, then the widest words the processor has, then any bytes left over.
+QCHECKSUM_SSE42_FUNCTION static DWORD HardwareCRC32C(IN DWORD dwCRC, IN const BYTE *lpbyData, IN DWORD nDataSize)
+{
+	while (nDataSize && ((UINT_PTR)lpbyData & (sizeof(UINT_PTR) - 1)))
+	{
+		dwCRC = _mm_crc32_u8(dwCRC, *lpbyData++);
+		nDataSize--;
+	}
+
+#if defined(_M_X64) || defined(__x86_64__)
+	unsigned long long qwCRC = dwCRC;
+	while (nDataSize >= 8)
+	{
+		qwCRC = _mm_crc32_u64(qwCRC, *(const unsigned long long *)lpbyData);
+		lpbyData += 8;
+		nDataSize -= 8;
+	}
+	dwCRC = (DWORD)qwCRC;
+#endif
+
+	while (nDataSize >= 4)
+	{
+		dwCRC = _mm_crc32_u32(dwCRC, *(const DWORD *)lpbyData);
+		lpbyData += 4;
+		nDataSize -= 4;
+	}
+
+	while (nDataSize--)
+		dwCRC = _mm_crc32_u8(dwCRC, *lpbyData++);
+
+	return dwCRC;
+}
+
+// Asks the processor whether it supports SSE 4.2 (CPUID function 1, ECX bit 20)
+static BOOL DetectHardwareCRC32C()
+{
+#ifdef _MSC_VER
+	int cpuInfo[4];
+	__cpuid(cpuInfo, 1);
+
+	return (cpuInfo[2] & (1 << 20)) ? TRUE : FALSE;
+#else
+	unsigned int eax, ebx, ecx, edx;
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return FALSE;
+
+	return (ecx & (1 << 20)) ? TRUE : FALSE;
+#endif
+}
+#endif // #ifdef QCHECKSUM_HAVE_SSE42
+
+BOOL WINAPI QChecksumHasHardwareCRC32C()
+{
+#ifdef QCHECKSUM_HAVE_SSE42
+	if (nHardwareCRC32C < 0)
+		InterlockedExchange(&nHardwareCRC32C, DetectHardwareCRC32C());
+
+	return nHardwareCRC32C ? TRUE : FALSE;
+#else
+	return FALSE;
+#endif
+}
+
+DWORD WINAPI QChecksumCRC32C(
+	IN DWORD dwCRC,
+	IN LPCVOID lpvData,
+	IN DWORD nDataSize
+)
+{
+	assert(lpvData || !nDataSize);
+
+	// The CRC is kept inverted while it's being computed, so that leading zero bytes affect the result
+	dwCRC = ~dwCRC;
+
+#ifdef QCHECKSUM_HAVE_SSE42
+	if (QChecksumHasHardwareCRC32C())
+		return ~HardwareCRC32C(dwCRC, (const BYTE *)lpvData, nDataSize);
+#endif
+
+	return ~SoftwareCRC32C(dwCRC, (const BYTE *)lpvData, nDataSize);
+}
+
+// The SHA-256 round constants: the first 32 bits of the fractional parts of the cube roots of the first 64 primes
+static const DWORD dwSHA256Constants[64] = {
+	0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+	0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+	0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+	0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+	0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+	0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+	0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+	0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
+};
+
+static inline DWORD RotateRight(IN DWORD dwValue, IN int nBits)
+{
+	return (dwValue >> nBits) | (dwValue << (32 - nBits));
+}
+
+// Hashes one 64-byte block into the state
+static void SHA256Block(IN OUT DWORD *lpdwState, IN const BYTE *lpbyBlock)
+{
+	// The message schedule. The words are big-endian.
+	DWORD dwWords[64];
+	for (int iWord = 0; iWord < 16; iWord++)
+	{
+		const BYTE *lpbyWord = lpbyBlock + iWord * 4;
+		dwWords[iWord] = ((DWORD)lpbyWord[0] << 24) | ((DWORD)lpbyWord[1] << 16) | ((DWORD)lpbyWord[2] << 8) | lpbyWord[3];
+	}
+
+	for (int iWord = 16; iWord < 64; iWord++)
+	{
+		DWORD dwS0 = RotateRight(dwWords[iWord - 15], 7) ^ RotateRight(dwWords[iWord - 15], 18) ^ (dwWords[iWord - 15] >> 3);
+		DWORD dwS1 = RotateRight(dwWords[iWord - 2], 17) ^ RotateRight(dwWords[iWord - 2], 19) ^ (dwWords[iWord - 2] >> 10);
+
+		dwWords[iWord] = dwWords[iWord - 16] + dwS0 + dwWords[iWord - 7] + dwS1;
+	}
+
+	DWORD dwA = lpdwState[0], dwB = lpdwState[1], dwC = lpdwState[2], dwD = lpdwState[3], 
+		dwE = lpdwState[4], dwF = lpdwState[5], dwG = lpdwState[6], dwH = lpdwState[7];
+
+	for (int iRound = 0; iRound < 64; iRound++)
+	{
+		DWORD dwS1 = RotateRight(dwE, 6) ^ RotateRight(dwE, 11) ^ RotateRight(dwE, 25);
+		DWORD dwChoose = (dwE & dwF) ^ (~dwE & dwG);
+		DWORD dwTemp1 = dwH + dwS1 + dwChoose + dwSHA256Constants[iRound] + dwWords[iRound];
+
+		DWORD dwS0 = RotateRight(dwA, 2) ^ RotateRight(dwA, 13) ^ RotateRight(dwA, 22);
+		DWORD dwMajority = (dwA & dwB) ^ (dwA & dwC) ^ (dwB & dwC);
+		DWORD dwTemp2 = dwS0 + dwMajority;
+
+		dwH = dwG;
+		dwG = dwF;
+		dwF = dwE;
+		dwE = dwD + dwTemp1;
+		dwD = dwC;
+		dwC = dwB;
+		dwB = dwA;
+		dwA = dwTemp1 + dwTemp2;
+	}
+
+	lpdwState[0] += dwA;
+	lpdwState[1] += dwB;
+	lpdwState[2] += dwC;
+	lpdwState[3] += dwD;
+	lpdwState[4] += dwE;
+	lpdwState[5] += dwF;
+	lpdwState[6] += dwG;
+	lpdwState[7] += dwH;
+}
+
+void WINAPI QChecksumSHA256Init(
+	OUT QCHECKSUMSHA256 *lpContext
+)
+{
+	assert(lpContext);
+
+	// The first 32 bits of the fractional parts of the square roots of the first 8 primes
+	lpContext->dwState[0] = 0x6A09E667;
+	lpContext->dwState[1] = 0xBB67AE85;
+	lpContext->dwState[2] = 0x3C6EF372;
+	lpContext->dwState[3] = 0xA54FF53A;
+	lpContext->dwState[4] = 0x510E527F;
+	lpContext->dwState[5] = 0x9B05688C;
+	lpContext->dwState[6] = 0x1F83D9AB;
+	lpContext->dwState[7] = 0x5BE0CD19;
+
+	lpContext->qwDataSize = 0;
+}
+
+void WINAPI QChecksumSHA256Update(
+	IN OUT QCHECKSUMSHA256 *lpContext,
+	IN LPCVOID lpvData,
+	IN DWORD nDataSize
+)
+{
+	assert(lpContext);
+	assert(lpvData || !nDataSize);
+
+	const BYTE *lpbyData = (const BYTE *)lpvData;
+	DWORD nBlockUsed = (DWORD)(lpContext->qwDataSize % sizeof(lpContext->byBlock));
+
+	lpContext->qwDataSize += nDataSize;
+
+	// Finish the partial block left from last time, if any
+	if (nBlockUsed)
+	{
+		DWORD nCopySize = sizeof(lpContext->byBlock) - nBlockUsed;
+		if (nCopySize > nDataSize)
+			nCopySize = nDataSize;
+
+		memcpy(lpContext->byBlock + nBlockUsed, lpbyData, nCopySize);
+		lpbyData += nCopySize;
+		nDataSize -= nCopySize;
+
+		if (nBlockUsed + nCopySize < sizeof(lpContext->byBlock))
+			return;
+
+		SHA256Block(lpContext->dwState, lpContext->byBlock);
+	}
+
+	// Hash whole blocks directly from the data
+	while (nDataSize >= sizeof(lpContext->byBlock))
+	{
+		SHA256Block(lpContext->dwState, lpbyData);
+		lpbyData += sizeof(lpContext->byBlock);
+		nDataSize -= sizeof(lpContext->byBlock);
+	}
+
+	// Keep the rest for next time
+	memcpy(lpContext->byBlock, lpbyData, nDataSize);
+}
+
+void WINAPI QChecksumSHA256Final(
+	IN OUT QCHECKSUMSHA256 *lpContext,
+	OUT LPBYTE lpbyHash
+)
+{
+	assert(lpContext);
+	assert(lpbyHash);
+
+	// Pad with a 1 bit, then 0s up to 8 bytes short of a block boundary, then the size in bits, big-endian
+	ULONGLONG qwDataBits = lpContext->qwDataSize * 8;
+	DWORD nBlockUsed = (DWORD)(lpContext->qwDataSize % sizeof(lpContext->byBlock));
+
+	BYTE byPadding[sizeof(lpContext->byBlock) + 8] = { 0x80 };
+	DWORD nPaddingSize = (nBlockUsed < sizeof(lpContext->byBlock) - 8 ? sizeof(lpContext->byBlock) - 8 : sizeof(lpContext->byBlock) * 2 - 8) - nBlockUsed;
+
+	for (int iByte = 0; iByte < 8; iByte++)
+		byPadding[nPaddingSize + iByte] = (BYTE)(qwDataBits >> ((7 - iByte) * 8));
+
+	QChecksumSHA256Update(lpContext, byPadding, nPaddingSize + 8);
+
+	for (int iByte = 0; iByte < QCHECKSUM_SHA256_SIZE; iByte++)
+		lpbyHash[iByte] = (BYTE)(lpContext->dwState[iByte / 4] >> ((3 - iByte % 4) * 8));
+}
+
+void WINAPI QChecksumSHA256(
+	IN LPCVOID lpvData,
+	IN DWORD nDataSize,
+	OUT LPBYTE lpbyHash
+)
+{
+	QCHECKSUMSHA256 context;
+
+	QChecksumSHA256Init(&context);
+	QChecksumSHA256Update(&context, lpvData, nDataSize);
+	QChecksumSHA256Final(&context, lpbyHash);
+}
+
+void WINAPI QChecksumFormatSHA256(
+	IN const BYTE *lpbyHash,
+	OUT LPSTR lpszHash
+)
+{
+	assert(lpbyHash);
+	assert(lpszHash);
+
+	for (int iByte = 0; iByte < QCHECKSUM_SHA256_SIZE; iByte++)
+		sprintf(lpszHash + iByte * 2, "%02X", lpbyHash[iByte]);
+}
@@ -0,0 +1,106 @@
+/*
+	The contents of this file are subject to the Common Development and Distribution License Version 1.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at http://www.sun.com/cddl/cddl.html.
+
+	Software distributed under the License is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for the specific language governing rights and limitations under the License.
+
+	The Initial Developer of the Original Code is Justin Olbrantz. The Original Code Copyright (C) 2007 Justin Olbrantz. All Rights Reserved.
+*/
+
+// Prevent this header from being included multiple times
+#ifndef QCHECKSUM_H
+#define QCHECKSUM_H
+
+#include <windows.h>
+
+// The initial value to pass to QChecksumCRC32C when starting a new checksum
+#define QCHECKSUM_CRC32C_INIT 0
+
+/*
+	* QChecksumCRC32C *
+	Computes the CRC-32C (Castagnoli) checksum of a block of data. Large data may be checksummed in pieces by passing the return value of the previous call as dwCRC; the first call should pass QCHECKSUM_CRC32C_INIT. If the processor supports SSE 4.2, the CRC32 instruction will be used, which is fast enough that checksumming is limited only by memory bandwidth; otherwise a table-driven implementation is used, which gives identical results.
+*/
+DWORD WINAPI QChecksumCRC32C(
+	// The checksum of all data preceding this block, or QCHECKSUM_CRC32C_INIT
+	IN DWORD dwCRC,
+	// The data to checksum
+	IN LPCVOID lpvData,
+	// The size of the data to checksum
+	IN DWORD nDataSize
+);
+
+/*
+	* QChecksumHasHardwareCRC32C *
+	Returns TRUE if QChecksumCRC32C is able to use the processor's CRC32 instruction. This is purely informational; QChecksumCRC32C works regardless.
+*/
+BOOL WINAPI QChecksumHasHardwareCRC32C();
+
+// The size of a SHA-256 hash, and of the string QChecksumFormatSHA256 produces, terminating null included
+#define QCHECKSUM_SHA256_SIZE 32
+#define QCHECKSUM_SHA256_STRING_SIZE (QCHECKSUM_SHA256_SIZE * 2 + 1)
+
+// The state of a SHA-256 hash being computed. CRC-32C only detects accidental corruption; SHA-256 is for when the data must be exactly what was expected, even if someone has deliberately made other data with the same CRC.
+struct QCHECKSUMSHA256
+{
+	DWORD dwState[8];
+	ULONGLONG qwDataSize;	// The number of bytes hashed so far
+	BYTE byBlock[64];	// Data not yet hashed, until there's a full block of it
+};
+
+/*
+	* QChecksumSHA256Init *
+	Begins computing a SHA-256 hash (FIPS 180-4). Data is added with QChecksumSHA256Update, in as many pieces as convenient, and the hash obtained with QChecksumSHA256Final.
+*/
+void WINAPI QChecksumSHA256Init(
+	// The hash state to initialize
+	OUT QCHECKSUMSHA256 *lpContext
+);
+
+/*
+	* QChecksumSHA256Update *
+	Adds data to a SHA-256 hash.
+*/
+void WINAPI QChecksumSHA256Update(
+	// The hash state
+	IN OUT QCHECKSUMSHA256 *lpContext,
+	// The data to hash
+	IN LPCVOID lpvData,
+	// The size of the data to hash
+	IN DWORD nDataSize
+);
+
+/*
+	* QChecksumSHA256Final *
+	Finishes a SHA-256 hash. The hash state can't be used again until it's reinitialized.
+*/
+void WINAPI QChecksumSHA256Final(
+	// The hash state
+	IN OUT QCHECKSUMSHA256 *lpContext,
+	// Receives the hash. Must be QCHECKSUM_SHA256_SIZE bytes.
+	OUT LPBYTE lpbyHash
+);
+
+/*
+	* QChecksumSHA256 *
+	Computes the SHA-256 hash of a block of data in one call.
+*/
+void WINAPI QChecksumSHA256(
+	// The data to hash
+	IN LPCVOID lpvData,
+	// The size of the data to hash
+	IN DWORD nDataSize,
+	// Receives the hash. Must be QCHECKSUM_SHA256_SIZE bytes.
+	OUT LPBYTE lpbyHash
+);
+
+/*
+	* QChecksumFormatSHA256 *
+	Formats a SHA-256 hash as 64 uppercase hexadecimal digits, for use in file names and messages.
+*/
+void WINAPI QChecksumFormatSHA256(
+	// The hash. Must be QCHECKSUM_SHA256_SIZE bytes.
+	IN const BYTE *lpbyHash,
+	// Receives the string. Must be QCHECKSUM_SHA256_STRING_SIZE bytes.
+	OUT LPSTR lpszHash
+);
+
+#endif // #ifndef QCHECKSUM_H
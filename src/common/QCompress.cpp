@@ -0,0 +1,334 @@
+/*
+	The contents of this file are subject to the Common Development and Distribution License Version 1.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at http://www.sun.com/cddl/cddl.html.
+
+	Software distributed under the License is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for the specific language governing rights and limitations under the License.
+
+	The Initial Developer of the Original Code is Justin Olbrantz. The Original Code Copyright (C) 2007 Justin Olbrantz. All Rights Reserved.
+*/
+
+#include "QCompress.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The shortest match the format can express
+#define MIN_MATCH 4
+// The last 5 bytes of a block must be literals, and the last match must start at least 12 bytes before the end of the block. These rules are part of the format, and let decompressors copy in large chunks near the end of the buffer.
+#define LAST_LITERALS 5
+#define MATCH_FIND_LIMIT 12
+// The farthest back a match can refer to, as offsets are 16 bits
+#define MAX_DISTANCE 65535
+
+// Number of bits in the match finder's hash
+#define HASH_BITS 16
+// How many earlier positions QCOMPRESS_LEVEL_HIGH examines for each match
+#define HIGH_MAX_ATTEMPTS 64
+
+// Reads 4 bytes that may not be aligned
+static inline DWORD ReadDWORD(IN const BYTE *lpbyData)
+{
+	DWORD dwValue;
+	memcpy(&dwValue, lpbyData, sizeof(DWORD));
+
+	return dwValue;
+}
+
+// Hashes the 4 bytes at a position, for finding earlier positions that start with the same bytes
+static inline DWORD HashPosition(IN const BYTE *lpbyData)
+{
+	return (ReadDWORD(lpbyData) * 2654435761U) >> (32 - HASH_BITS);
+}
+
+// Writes the continuation of a length which didn't fit in the token: as many 255s as necessary, followed by the remainder
+static BOOL WriteLength(IN DWORD nLength, IN OUT LPBYTE &lpbyOutput, IN const BYTE *lpbyOutputEnd)
+{
+	while (nLength >= 255)
+	{
+		if (lpbyOutput >= lpbyOutputEnd)
+			return FALSE;
+
+		*lpbyOutput++ = 255;
+		nLength -= 255;
+	}
+
+	if (lpbyOutput >= lpbyOutputEnd)
+		return FALSE;
+
+	*lpbyOutput++ = (BYTE)nLength;
+
+	return TRUE;
+}
+
+// Writes one sequence: a run of literals followed by a match. The final sequence in a block has literals only, indicated by a match length of 0.
+static BOOL WriteSequence(
+	IN const BYTE *lpbyLiterals,
+	IN DWORD nNumLiterals,
+	IN DWORD dwMatchOffset,
+	IN DWORD nMatchLength,
+	IN OUT LPBYTE &lpbyOutput,
+	IN const BYTE *lpbyOutputEnd
+)
+{
+	if (lpbyOutput >= lpbyOutputEnd)
+		return FALSE;
+
+	// The token holds the literal count in the high 4 bits and the match length in the low 4 bits. 15 in either means the length continues after it.
+	LPBYTE lpbyToken = lpbyOutput++;
+	BYTE byToken;
+
+	if (nNumLiterals >= 15)
+	{
+		byToken = 15 << 4;
+		if (!WriteLength(nNumLiterals - 15, lpbyOutput, lpbyOutputEnd))
+			return FALSE;
+	}
+	else
+		byToken = (BYTE)(nNumLiterals << 4);
+
+	if ((DWORD)(lpbyOutputEnd - lpbyOutput) < nNumLiterals)
+		return FALSE;
+
+	if (nNumLiterals)
+		memcpy(lpbyOutput, lpbyLiterals, nNumLiterals);
+	lpbyOutput += nNumLiterals;
+
+	if (nMatchLength)
+	{
+		assert(nMatchLength >= MIN_MATCH);
+		assert(dwMatchOffset && dwMatchOffset <= MAX_DISTANCE);
+
+		if (lpbyOutputEnd - lpbyOutput < 2)
+			return FALSE;
+
+		*lpbyOutput++ = (BYTE)dwMatchOffset;
+		*lpbyOutput++ = (BYTE)(dwMatchOffset >> 8);
+
+		DWORD nLengthCode = nMatchLength - MIN_MATCH;
+		if (nLengthCode >= 15)
+		{
+			byToken |= 15;
+			if (!WriteLength(nLengthCode - 15, lpbyOutput, lpbyOutputEnd))
+				return FALSE;
+		}
+		else
+			byToken |= (BYTE)nLengthCode;
+	}
+
+	*lpbyToken = byToken;
+
+	return TRUE;
+}
+
+DWORD WINAPI QCompressLZ4(
+	IN LPCVOID lpvInput,
+	IN DWORD nInputSize,
+	OUT LPVOID lpvOutput,
+	IN DWORD nOutputSize,
+	IN DWORD dwLevel
+)
+{
+	assert(lpvInput || !nInputSize);
+	assert(lpvOutput);
+
+	const BYTE *lpbyInput = (const BYTE *)lpvInput;
+	LPBYTE lpbyOutput = (LPBYTE)lpvOutput,
+		lpbyOutputEnd = lpbyOutput + nOutputSize;
+	DWORD nAnchor = 0;	// The start of the literals not yet written
+
+	// Blocks too small to hold a match are written as literals only
+	if (nInputSize > MATCH_FIND_LIMIT)
+	{
+		// The hash table holds the most recent position with each hash, plus 1 so that 0 can mean empty. At the high level, the chain table holds the distance from each position to the previous one with the same hash, so that we can look further back; positions older than MAX_DISTANCE are useless, so it only needs to cover a 64 KB window.
+		LPDWORD lpdwHashTable = (LPDWORD)calloc(1 << HASH_BITS, sizeof(DWORD));
+		LPWORD lpwChainTable = NULL;
+		DWORD nMaxAttempts = 1;
+
+		if (dwLevel == QCOMPRESS_LEVEL_HIGH)
+		{
+			lpwChainTable = (LPWORD)malloc((MAX_DISTANCE + 1) * sizeof(WORD));
+			nMaxAttempts = HIGH_MAX_ATTEMPTS;
+		}
+
+		if (!lpdwHashTable || (dwLevel == QCOMPRESS_LEVEL_HIGH && !lpwChainTable))
+		{
+			free(lpdwHashTable);
+			free(lpwChainTable);
+
+			return 0;
+		}
+
+		DWORD nMatchEndLimit = nInputSize - LAST_LITERALS, nPos = 0;
+		BOOL bOverflow = FALSE;
+
+		while (nPos + MATCH_FIND_LIMIT <= nInputSize)
+		{
+			// Look for the longest match among the earlier positions with the same hash
+			DWORD dwHash = HashPosition(lpbyInput + nPos),
+				nBestLength = 0, dwBestOffset = 0,
+				nCandidate = lpdwHashTable[dwHash],
+				nAttemptsLeft = nMaxAttempts;
+
+			while (nCandidate && nAttemptsLeft--)
+			{
+				DWORD nCandidatePos = nCandidate - 1,
+					dwOffset = nPos - nCandidatePos;
+				if (dwOffset > MAX_DISTANCE)
+					break;
+
+				if (ReadDWORD(lpbyInput + nCandidatePos) == ReadDWORD(lpbyInput + nPos))
+				{
+					DWORD nLength = MIN_MATCH;
+					while ((nPos + nLength < nMatchEndLimit) &&
+						(lpbyInput[nCandidatePos + nLength] == lpbyInput[nPos + nLength]))
+						nLength++;
+
+					if (nLength > nBestLength)
+					{
+						nBestLength = nLength;
+						dwBestOffset = dwOffset;
+					}
+				}
+
+				if (!lpwChainTable || !lpwChainTable[nCandidatePos & MAX_DISTANCE])
+					break;
+
+				nCandidate -= lpwChainTable[nCandidatePos & MAX_DISTANCE];
+			}
+
+			// Record the positions we're about to pass over, so that later matches can refer to them
+			DWORD nNextPos = nPos + ((nBestLength >= MIN_MATCH) ? nBestLength : 1);
+			for (DWORD nInsertPos = nPos; nInsertPos < nNextPos && nInsertPos + MIN_MATCH <= nInputSize; nInsertPos++)
+			{
+				DWORD dwInsertHash = HashPosition(lpbyInput + nInsertPos);
+
+				if (lpwChainTable)
+				{
+					DWORD nPrevious = lpdwHashTable[dwInsertHash],
+						dwDistance = nPrevious ? nInsertPos - (nPrevious - 1) : 0;
+
+					lpwChainTable[nInsertPos & MAX_DISTANCE] = (dwDistance <= MAX_DISTANCE) ? (WORD)dwDistance : 0;
+				}
+
+				lpdwHashTable[dwInsertHash] = nInsertPos + 1;
+			}
+
+			if (nBestLength >= MIN_MATCH)
+			{
+				if (!WriteSequence(lpbyInput + nAnchor, nPos - nAnchor, dwBestOffset, nBestLength, lpbyOutput, lpbyOutputEnd))
+				{
+					bOverflow = TRUE;
+					break;
+				}
+
+				nAnchor = nNextPos;
+			}
+
+			nPos = nNextPos;
+		}
+
+		free(lpdwHashTable);
+		free(lpwChainTable);
+
+		if (bOverflow)
+			return 0;
+	}
+
+	// Everything after the last match is written as literals
+	if (!WriteSequence(lpbyInput + nAnchor, nInputSize - nAnchor, 0, 0, lpbyOutput, lpbyOutputEnd))
+		return 0;
+
+	return (DWORD)(lpbyOutput - (LPBYTE)lpvOutput);
+}
+
+// Reads the continuation of a length from compressed data, and adds it to the length. Fails if the data runs out, or the length exceeds nMaxLength (which also keeps it from overflowing).
+static BOOL ReadLength(IN OUT const BYTE *&lpbyInput, IN const BYTE *lpbyInputEnd, IN OUT DWORD &nLength, IN DWORD nMaxLength)
+{
+	BYTE byNext;
+	do
+	{
+		if (lpbyInput >= lpbyInputEnd)
+			return FALSE;
+
+		byNext = *lpbyInput++;
+		nLength += byNext;
+
+		if (nLength > nMaxLength)
+			return FALSE;
+	} while (byNext == 255);
+
+	return TRUE;
+}
+
+BOOL WINAPI QDecompressLZ4(
+	IN LPCVOID lpvInput,
+	IN DWORD nInputSize,
+	OUT LPVOID lpvOutput,
+	IN DWORD nOutputSize
+)
+{
+	assert(lpvInput || !nInputSize);
+	assert(lpvOutput || !nOutputSize);
+
+	const BYTE *lpbyInput = (const BYTE *)lpvInput,
+		*lpbyInputEnd = lpbyInput + nInputSize;
+	LPBYTE lpbyOutputStart = (LPBYTE)lpvOutput,
+		lpbyOutput = lpbyOutputStart,
+		lpbyOutputEnd = lpbyOutput + nOutputSize;
+
+	for (;;)
+	{
+		if (lpbyInput >= lpbyInputEnd)
+			return FALSE;
+
+		BYTE byToken = *lpbyInput++;
+
+		// Copy the literals
+		DWORD nNumLiterals = byToken >> 4;
+		if ((nNumLiterals == 15) && !ReadLength(lpbyInput, lpbyInputEnd, nNumLiterals, nOutputSize))
+			return FALSE;
+
+		if ((nNumLiterals > (DWORD)(lpbyInputEnd - lpbyInput)) ||
+			(nNumLiterals > (DWORD)(lpbyOutputEnd - lpbyOutput)))
+			return FALSE;
+
+		memcpy(lpbyOutput, lpbyInput, nNumLiterals);
+		lpbyInput += nNumLiterals;
+		lpbyOutput += nNumLiterals;
+
+		// The last sequence is the only one without a match
+		if (lpbyInput == lpbyInputEnd)
+			break;
+
+		// Copy the match
+		if (lpbyInputEnd - lpbyInput < 2)
+			return FALSE;
+
+		DWORD dwOffset = lpbyInput[0] | (lpbyInput[1] << 8);
+		lpbyInput += 2;
+
+		if (!dwOffset || (dwOffset > (DWORD)(lpbyOutput - lpbyOutputStart)))
+			return FALSE;
+
+		DWORD nMatchLength = byToken & 15;
+		if ((nMatchLength == 15) && !ReadLength(lpbyInput, lpbyInputEnd, nMatchLength, nOutputSize))
+			return FALSE;
+
+		nMatchLength += MIN_MATCH;
+		if (nMatchLength > (DWORD)(lpbyOutputEnd - lpbyOutput))
+			return FALSE;
+
+		// A match may overlap the data it's creating (that's how runs are encoded), in which case it has to be copied a byte at a time
+		const BYTE *lpbyMatch = lpbyOutput - dwOffset;
+		if (dwOffset >= nMatchLength)
+			memcpy(lpbyOutput, lpbyMatch, nMatchLength);
+		else
+		{
+			for (DWORD iCurByte = 0; iCurByte < nMatchLength; iCurByte++)
+				lpbyOutput[iCurByte] = lpbyMatch[iCurByte];
+		}
+
+		lpbyOutput += nMatchLength;
+	}
+
+	return (lpbyOutput == lpbyOutputEnd);
+}
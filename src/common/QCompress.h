@@ -0,0 +1,77 @@
+/*
+	The contents of this file are subject to the Common Development and Distribution License Version 1.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at http://www.sun.com/cddl/cddl.html.
+
+	Software distributed under the License is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for the specific language governing rights and limitations under the License.
+
+	The Initial Developer of the Original Code is Justin Olbrantz. The Original Code Copyright (C) 2007 Justin Olbrantz. All Rights Reserved.
+*/
+
+// Prevent this header from being included multiple times
+#ifndef QCOMPRESS_H
+#define QCOMPRESS_H
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+// The Windows types used here, for non-Windows builds, which only the tests are. DWORD has to be 32 bits, as it is on Windows, as the compressor reads 4 bytes at a time into one.
+#include <stdint.h>
+typedef int BOOL;
+typedef uint8_t BYTE;
+typedef uint16_t WORD;
+typedef uint32_t DWORD;
+typedef BYTE *LPBYTE;
+typedef WORD *LPWORD;
+typedef DWORD *LPDWORD;
+typedef void *LPVOID;
+typedef const void *LPCVOID;
+#define TRUE 1
+#define FALSE 0
+#define WINAPI
+#define IN
+#define OUT
+#endif
+
+/*
+	QCompress implements compression in the LZ4 block format. LZ4 was chosen because decompression is little more than a series of memory copies, so it's faster than reading the uncompressed data from disk would have been. The format is the standard one, so data can be inspected with other LZ4 tools, but the frame format (headers, checksums, etc.) is not used; callers are expected to store the sizes themselves.
+*/
+
+// Compression levels. The fast level only considers the most recent match candidate; the high level searches further back for longer matches, which compresses better but takes several times as long. Both produce data decompressed by the same function at the same speed.
+#define QCOMPRESS_LEVEL_FAST 0
+#define QCOMPRESS_LEVEL_HIGH 1
+
+// The largest possible size of nInputSize bytes of data after compression. Incompressible data grows slightly.
+#define QCOMPRESS_BOUND(nInputSize) ((nInputSize) + ((nInputSize) / 255) + 16)
+
+/*
+	* QCompressLZ4 *
+	Compresses a block of data in LZ4 block format. Returns the size of the compressed data, or 0 if it would not fit in the output buffer; an output buffer of QCOMPRESS_BOUND(nInputSize) bytes is always large enough. Matches can only reach back 64 KB, so splitting data into blocks of that size costs very little compression.
+*/
+DWORD WINAPI QCompressLZ4(
+	// The data to compress
+	IN LPCVOID lpvInput,
+	// The size of the data to compress
+	IN DWORD nInputSize,
+	// The buffer to receive the compressed data
+	OUT LPVOID lpvOutput,
+	// The size of the output buffer
+	IN DWORD nOutputSize,
+	// The compression level to use (QCOMPRESS_LEVEL_*)
+	IN DWORD dwLevel
+);
+
+/*
+	* QDecompressLZ4 *
+	Decompresses a block of data compressed by QCompressLZ4 or any other LZ4 block compressor. The compressed data is fully bounds checked, so corrupt data will cause failure rather than a crash. Returns FALSE if the data is corrupt, or if it does not decompress to exactly nOutputSize bytes.
+*/
+BOOL WINAPI QDecompressLZ4(
+	// The compressed data
+	IN LPCVOID lpvInput,
+	// The size of the compressed data
+	IN DWORD nInputSize,
+	// The buffer to receive the decompressed data
+	OUT LPVOID lpvOutput,
+	// The size the data must decompress to
+	IN DWORD nOutputSize
+);
+
+#endif // #ifndef QCOMPRESS_H
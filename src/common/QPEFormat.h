@@ -0,0 +1,193 @@
+/*
+	The contents of this file are subject to the Common Development and Distribution License Version 1.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at http://www.sun.com/cddl/cddl.html.
+
+	Software distributed under the License is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for the specific language governing rights and limitations under the License.
+
+	The Initial Developer of the Original Code is Justin Olbrantz. The Original Code Copyright (C) 2007 Justin Olbrantz. All Rights Reserved.
+*/
+
+// Prevent this header from being included multiple times
+#ifndef QPEFORMAT_H
+#define QPEFORMAT_H
+
+#include <stdint.h>
+
+/*
+	The on-disk structures of PE images (EXEs and DLLs), as far as QPEImage needs them. These are the same as the IMAGE_* structures in windows.h, but use fixed-size types, so that images can be read and built on any machine; all values are little-endian.
+	An image begins with a DOS header, which gives the offset of the NT signature. That is followed by the file header, the optional header (which, despite its name, is required, and comes in 32-bit and 64-bit forms), and the section table. The optional header ends with the data directories, which give the RVAs (offsets from the start of the image once loaded) of the import, export, relocation, and other tables.
+*/
+
+// Signatures ("MZ" and "PE\0\0")
+#define PE_DOS_SIGNATURE 0x5A4D
+#define PE_NT_SIGNATURE 0x00004550
+
+// Optional header magic numbers (PEOPTIONALHEADER32::wMagic)
+#define PE_OPTIONAL_HEADER32_MAGIC 0x10B
+#define PE_OPTIONAL_HEADER64_MAGIC 0x20B
+
+// Machine types (PEFILEHEADER::wMachine)
+#define PE_MACHINE_I386 0x014C
+#define PE_MACHINE_AMD64 0x8664
+
+// Image characteristics (PEFILEHEADER::wCharacteristics)
+#define PE_FILE_RELOCS_STRIPPED 0x0001
+#define PE_FILE_EXECUTABLE_IMAGE 0x0002
+#define PE_FILE_DLL 0x2000
+
+// Section characteristics (PESECTIONHEADER::dwCharacteristics)
+#define PE_SCN_MEM_EXECUTE 0x20000000
+#define PE_SCN_MEM_READ 0x40000000
+#define PE_SCN_MEM_WRITE 0x80000000
+
+// Data directory indices
+#define PE_DIRECTORY_EXPORT 0
+#define PE_DIRECTORY_IMPORT 1
+#define PE_DIRECTORY_EXCEPTION 3
+#define PE_DIRECTORY_BASERELOC 5
+#define PE_DIRECTORY_TLS 9
+
+#define PE_NUM_DIRECTORIES 16
+
+// Base relocation types (the high 4 bits of each relocation entry)
+#define PE_REL_BASED_ABSOLUTE 0
+#define PE_REL_BASED_HIGH 1
+#define PE_REL_BASED_LOW 2
+#define PE_REL_BASED_HIGHLOW 3
+#define PE_REL_BASED_DIR64 10
+
+// Set in an import thunk if the function is imported by ordinal
+#define PE_ORDINAL_FLAG32 0x80000000UL
+#define PE_ORDINAL_FLAG64 0x8000000000000000ULL
+
+#pragma pack(push, 1)
+
+struct PEDOSHEADER
+{
+	uint16_t wMagic;	// PE_DOS_SIGNATURE
+	uint16_t wDOSFields[29];	// Only used by DOS
+	int32_t lNewHeaderOffset;	// The offset of the NT signature, which is followed by the file header
+};
+
+struct PEFILEHEADER
+{
+	uint16_t wMachine;	// PE_MACHINE_*
+	uint16_t nSections;
+	uint32_t dwTimeDateStamp;
+	uint32_t dwSymbolTableOffset;
+	uint32_t nSymbols;
+	uint16_t cbOptionalHeader;	// The size of the optional header, which the section table follows
+	uint16_t wCharacteristics;	// PE_FILE_*
+};
+
+struct PEDATADIRECTORY
+{
+	uint32_t dwRVA;
+	uint32_t cbSize;
+};
+
+struct PEOPTIONALHEADER32
+{
+	uint16_t wMagic;	// PE_OPTIONAL_HEADER32_MAGIC
+	uint8_t byLinkerVersion[2];
+	uint32_t cbCode;
+	uint32_t cbInitializedData;
+	uint32_t cbUninitializedData;
+	uint32_t dwEntryPointRVA;
+	uint32_t dwCodeBaseRVA;
+	uint32_t dwDataBaseRVA;
+	uint32_t dwImageBase;	// The address the image would prefer to be loaded at
+	uint32_t cbSectionAlignment;
+	uint32_t cbFileAlignment;
+	uint16_t wVersions[6];
+	uint32_t dwWin32Version;
+	uint32_t cbImage;	// The size of the image once loaded
+	uint32_t cbHeaders;	// The size of the headers, section table included
+	uint32_t dwChecksum;
+	uint16_t wSubsystem;
+	uint16_t wDLLCharacteristics;
+	uint32_t cbStackReserve;
+	uint32_t cbStackCommit;
+	uint32_t cbHeapReserve;
+	uint32_t cbHeapCommit;
+	uint32_t dwLoaderFlags;
+	uint32_t nDataDirectories;	// The number of entries in dataDirectories actually present
+	PEDATADIRECTORY dataDirectories[PE_NUM_DIRECTORIES];
+};
+
+struct PEOPTIONALHEADER64
+{
+	uint16_t wMagic;	// PE_OPTIONAL_HEADER64_MAGIC
+	uint8_t byLinkerVersion[2];
+	uint32_t cbCode;
+	uint32_t cbInitializedData;
+	uint32_t cbUninitializedData;
+	uint32_t dwEntryPointRVA;
+	uint32_t dwCodeBaseRVA;
+	uint64_t qwImageBase;	// The address the image would prefer to be loaded at
+	uint32_t cbSectionAlignment;
+	uint32_t cbFileAlignment;
+	uint16_t wVersions[6];
+	uint32_t dwWin32Version;
+	uint32_t cbImage;	// The size of the image once loaded
+	uint32_t cbHeaders;	// The size of the headers, section table included
+	uint32_t dwChecksum;
+	uint16_t wSubsystem;
+	uint16_t wDLLCharacteristics;
+	uint64_t cbStackReserve;
+	uint64_t cbStackCommit;
+	uint64_t cbHeapReserve;
+	uint64_t cbHeapCommit;
+	uint32_t dwLoaderFlags;
+	uint32_t nDataDirectories;	// The number of entries in dataDirectories actually present
+	PEDATADIRECTORY dataDirectories[PE_NUM_DIRECTORIES];
+};
+
+struct PESECTIONHEADER
+{
+	char szName[8];	// Not necessarily NUL-terminated
+	uint32_t cbVirtualSize;	// The size of the section once loaded. 0 means cbRawData.
+	uint32_t dwRVA;
+	uint32_t cbRawData;	// The size of the section's data in the file. Data past cbVirtualSize is ignored.
+	uint32_t dwRawDataOffset;
+	uint32_t dwRelocationsOffset;
+	uint32_t dwLineNumbersOffset;
+	uint16_t nRelocations;
+	uint16_t nLineNumbers;
+	uint32_t dwCharacteristics;	// PE_SCN_*
+};
+
+// Each block of base relocations covers one 4 KB page, and is followed by 16-bit entries, each a relocation type in the high 4 bits and an offset in the page in the low 12
+struct PEBASERELOCATION
+{
+	uint32_t dwPageRVA;
+	uint32_t cbBlock;	// The size of the block, entries included
+};
+
+// One for each module imported from, ending with an empty one
+struct PEIMPORTDESCRIPTOR
+{
+	uint32_t dwLookupTableRVA;	// The functions to import, as thunks. 0 in images from old linkers, which only have the address table.
+	uint32_t dwTimeDateStamp;
+	uint32_t dwForwarderChain;
+	uint32_t dwNameRVA;	// The name of the module
+	uint32_t dwAddressTableRVA;	// Where to put the addresses of the functions. Holds the same thunks as the lookup table until bound.
+};
+
+struct PEEXPORTDIRECTORY
+{
+	uint32_t dwCharacteristics;
+	uint32_t dwTimeDateStamp;
+	uint16_t wMajorVersion;
+	uint16_t wMinorVersion;
+	uint32_t dwNameRVA;
+	uint32_t dwOrdinalBase;	// The ordinal of the first function in the address table
+	uint32_t nFunctions;
+	uint32_t nNames;
+	uint32_t dwFunctionsRVA;	// The RVAs of the functions, indexed by ordinal - dwOrdinalBase
+	uint32_t dwNamesRVA;	// The RVAs of the names of the functions exported by name, in sorted order
+	uint32_t dwNameOrdinalsRVA;	// For each name, the index of its function in the address table
+};
+
+#pragma pack(pop)
+
+#endif // #ifndef QPEFORMAT_H
@@ -0,0 +1,598 @@
+/*
+	The contents of this file are subject to the Common Development and Distribution License Version 1.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at http://www.sun.com/cddl/cddl.html.
+
+	Software distributed under the License is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for the specific language governing rights and limitations under the License.
+
+	The Initial Developer of the Original Code is Justin Olbrantz. The Original Code Copyright (C) 2007 Justin Olbrantz. All Rights Reserved.
+*/
+
+#include "QPEImage.h"
+#include <assert.h>
+#include <stddef.h>
+#include <string.h>
+
+// The structures must match the format exactly
+static_assert(sizeof(PEDOSHEADER) == 64, "PEDOSHEADER is the wrong size");
+static_assert(sizeof(PEFILEHEADER) == 20, "PEFILEHEADER is the wrong size");
+static_assert(sizeof(PEOPTIONALHEADER32) == 224, "PEOPTIONALHEADER32 is the wrong size");
+static_assert(sizeof(PEOPTIONALHEADER64) == 240, "PEOPTIONALHEADER64 is the wrong size");
+static_assert(sizeof(PESECTIONHEADER) == 40, "PESECTIONHEADER is the wrong size");
+static_assert(sizeof(PEIMPORTDESCRIPTOR) == 20, "PEIMPORTDESCRIPTOR is the wrong size");
+static_assert(sizeof(PEEXPORTDIRECTORY) == 40, "PEEXPORTDIRECTORY is the wrong size");
+
+// The headers of an image, along with where to find the parts of them that are needed later. Only the offsets of the structures are kept, as the image itself may not be aligned.
+struct PEHEADERS
+{
+	PEIMAGEINFO info;
+
+	// The offset of the image base field of the optional header, so that it can be updated when the image is relocated
+	uint32_t dwImageBaseOffset;
+
+	// The offset of the section table
+	uint32_t dwSectionsOffset;
+};
+
+// Checks that a range lies within something of the specified size
+static inline bool IsValidRange(uint32_t dwOffset, uint64_t cbSize, uint32_t cbTotalSize)
+{
+	return ((uint64_t)dwOffset + cbSize) <= cbTotalSize;
+}
+
+// Checks that a NUL-terminated string lies entirely within an image
+static inline bool IsValidString(const uint8_t *lpbyImage, uint32_t cbImage, uint32_t dwRVA)
+{
+	return (dwRVA < cbImage) && memchr(lpbyImage + dwRVA, 0, cbImage - dwRVA);
+}
+
+// Reads and writes values that may not be aligned
+static inline uint16_t ReadWORD(const uint8_t *lpbyData)
+{
+	uint16_t wValue;
+	memcpy(&wValue, lpbyData, sizeof(uint16_t));
+
+	return wValue;
+}
+
+static inline uint32_t ReadDWORD(const uint8_t *lpbyData)
+{
+	uint32_t dwValue;
+	memcpy(&dwValue, lpbyData, sizeof(uint32_t));
+
+	return dwValue;
+}
+
+static inline uint64_t ReadQWORD(const uint8_t *lpbyData)
+{
+	uint64_t qwValue;
+	memcpy(&qwValue, lpbyData, sizeof(uint64_t));
+
+	return qwValue;
+}
+
+static inline void WriteDWORD(uint8_t *lpbyData, uint32_t dwValue)
+{
+	memcpy(lpbyData, &dwValue, sizeof(uint32_t));
+}
+
+static inline void WriteQWORD(uint8_t *lpbyData, uint64_t qwValue)
+{
+	memcpy(lpbyData, &qwValue, sizeof(uint64_t));
+}
+
+// Copies the fields of an optional header that are common to both kinds
+template<typename OPTIONALHEADER> static void ReadOptionalHeader(const OPTIONALHEADER &optionalHeader, PEHEADERS *pHeaders)
+{
+	pHeaders->info.cbImage = optionalHeader.cbImage;
+	pHeaders->info.cbHeaders = optionalHeader.cbHeaders;
+	pHeaders->info.dwEntryPointRVA = optionalHeader.dwEntryPointRVA;
+	pHeaders->info.cbSectionAlignment = optionalHeader.cbSectionAlignment;
+}
+
+// Reads and checks the headers of an image, either as a file or laid out in memory. Only the headers themselves are checked here; what they point to is checked by whatever uses it.
+static PEERROR ReadPEHeaders(
+	// The image
+	const uint8_t *lpbyData,
+	// The size of the image
+	uint32_t cbData,
+	// The headers of the image
+	PEHEADERS *pHeaders
+)
+{
+	assert(lpbyData);
+	assert(pHeaders);
+
+	memset(pHeaders, 0, sizeof(PEHEADERS));
+
+	// The DOS header points to the NT headers
+	PEDOSHEADER dosHeader;
+	if (cbData < sizeof(PEDOSHEADER))
+		return PE_ERROR_BAD_FORMAT;
+
+	memcpy(&dosHeader, lpbyData, sizeof(PEDOSHEADER));
+	if ((dosHeader.wMagic != PE_DOS_SIGNATURE) || (dosHeader.lNewHeaderOffset < 0))
+		return PE_ERROR_BAD_FORMAT;
+
+	uint32_t dwFileHeaderOffset = (uint32_t)dosHeader.lNewHeaderOffset + sizeof(uint32_t),
+		dwOptionalHeaderOffset = dwFileHeaderOffset + sizeof(PEFILEHEADER);
+	if (!IsValidRange((uint32_t)dosHeader.lNewHeaderOffset, sizeof(uint32_t) + sizeof(PEFILEHEADER) + sizeof(uint16_t), cbData) ||
+		(ReadDWORD(lpbyData + dosHeader.lNewHeaderOffset) != PE_NT_SIGNATURE))
+		return PE_ERROR_BAD_FORMAT;
+
+	PEFILEHEADER fileHeader;
+	memcpy(&fileHeader, lpbyData + dwFileHeaderOffset, sizeof(PEFILEHEADER));
+
+	if (!IsValidRange(dwOptionalHeaderOffset, fileHeader.cbOptionalHeader, cbData))
+		return PE_ERROR_BAD_FORMAT;
+
+	// The two kinds of optional header only differ in the size of a few fields. Copy whichever this is, making sure the fields that are there are all there.
+	uint16_t wMagic = ReadWORD(lpbyData + dwOptionalHeaderOffset);
+	uint32_t nDataDirectories, dwDataDirectoriesOffset;
+
+	if (wMagic == PE_OPTIONAL_HEADER32_MAGIC)
+	{
+		PEOPTIONALHEADER32 optionalHeader;
+		dwDataDirectoriesOffset = offsetof(PEOPTIONALHEADER32, dataDirectories);
+
+		if (fileHeader.cbOptionalHeader < dwDataDirectoriesOffset)
+			return PE_ERROR_BAD_FORMAT;
+
+		memcpy(&optionalHeader, lpbyData + dwOptionalHeaderOffset, dwDataDirectoriesOffset);
+
+		ReadOptionalHeader(optionalHeader, pHeaders);
+		pHeaders->info.b64Bit = false;
+		pHeaders->info.qwImageBase = optionalHeader.dwImageBase;
+		pHeaders->dwImageBaseOffset = dwOptionalHeaderOffset + offsetof(PEOPTIONALHEADER32, dwImageBase);
+
+		nDataDirectories = optionalHeader.nDataDirectories;
+	}
+	else if (wMagic == PE_OPTIONAL_HEADER64_MAGIC)
+	{
+		PEOPTIONALHEADER64 optionalHeader;
+		dwDataDirectoriesOffset = offsetof(PEOPTIONALHEADER64, dataDirectories);
+
+		if (fileHeader.cbOptionalHeader < dwDataDirectoriesOffset)
+			return PE_ERROR_BAD_FORMAT;
+
+		memcpy(&optionalHeader, lpbyData + dwOptionalHeaderOffset, dwDataDirectoriesOffset);
+
+		ReadOptionalHeader(optionalHeader, pHeaders);
+		pHeaders->info.b64Bit = true;
+		pHeaders->info.qwImageBase = optionalHeader.qwImageBase;
+		pHeaders->dwImageBaseOffset = dwOptionalHeaderOffset + offsetof(PEOPTIONALHEADER64, qwImageBase);
+
+		nDataDirectories = optionalHeader.nDataDirectories;
+	}
+	else
+		return PE_ERROR_BAD_FORMAT;
+
+	pHeaders->info.wMachine = fileHeader.wMachine;
+	pHeaders->info.wCharacteristics = fileHeader.wCharacteristics;
+	pHeaders->info.bRelocatable = !(fileHeader.wCharacteristics & PE_FILE_RELOCS_STRIPPED);
+
+	// Windows ignores data directories past the 16 it knows about, so we do too. The rest must fit in the optional header.
+	if (nDataDirectories > PE_NUM_DIRECTORIES)
+		nDataDirectories = PE_NUM_DIRECTORIES;
+
+	if (!IsValidRange(dwDataDirectoriesOffset, (uint64_t)nDataDirectories * sizeof(PEDATADIRECTORY), fileHeader.cbOptionalHeader))
+		return PE_ERROR_BAD_FORMAT;
+
+	memcpy(pHeaders->info.dataDirectories, lpbyData + dwOptionalHeaderOffset + dwDataDirectoriesOffset, nDataDirectories * sizeof(PEDATADIRECTORY));
+
+	// The headers, including the section table, must be loaded as part of the image, and must fit in it
+	pHeaders->dwSectionsOffset = dwOptionalHeaderOffset + fileHeader.cbOptionalHeader;
+	pHeaders->info.nSections = fileHeader.nSections;
+
+	uint64_t cbSectionTable = (uint64_t)fileHeader.nSections * sizeof(PESECTIONHEADER);
+	if (!IsValidRange(pHeaders->dwSectionsOffset, cbSectionTable, cbData) ||
+		!IsValidRange(pHeaders->dwSectionsOffset, cbSectionTable, pHeaders->info.cbHeaders) ||
+		(pHeaders->info.cbHeaders > pHeaders->info.cbImage))
+		return PE_ERROR_BAD_FORMAT;
+
+	return PE_ERROR_SUCCESS;
+}
+
+// Gets a section header from the section table, which ReadPEHeaders has checked is there
+static inline void ReadPESection(const uint8_t *lpbyData, const PEHEADERS *pHeaders, uint16_t iSection, PESECTIONHEADER *pSection)
+{
+	assert(iSection < pHeaders->info.nSections);
+
+	memcpy(pSection, lpbyData + pHeaders->dwSectionsOffset + (iSection * sizeof(PESECTIONHEADER)), sizeof(PESECTIONHEADER));
+}
+
+// Gets the amount of a section's data that is stored in the file. As Windows does, raw data past the section's virtual size is ignored, and a virtual size of 0 means the raw size.
+static inline uint32_t GetPESectionDataSize(const PESECTIONHEADER *pSection)
+{
+	if (pSection->cbVirtualSize && (pSection->cbVirtualSize < pSection->cbRawData))
+		return pSection->cbVirtualSize;
+
+	return pSection->cbRawData;
+}
+
+// Gets the amount of the image a section occupies
+static inline uint32_t GetPESectionSize(const PESECTIONHEADER *pSection)
+{
+	return pSection->cbVirtualSize ? pSection->cbVirtualSize : pSection->cbRawData;
+}
+
+PEERROR GetPEImageInfo(
+	const void *lpvFileData,
+	uint32_t cbFileData,
+	PEIMAGEINFO *lpImageInfo
+)
+{
+	assert(lpvFileData);
+	assert(lpImageInfo);
+
+	const uint8_t *lpbyFileData = (const uint8_t *)lpvFileData;
+
+	PEHEADERS headers;
+	PEERROR nError = ReadPEHeaders(lpbyFileData, cbFileData, &headers);
+	if (nError != PE_ERROR_SUCCESS)
+		return nError;
+
+	// The headers are copied from the file as they are
+	if (headers.info.cbHeaders > cbFileData)
+		return PE_ERROR_BAD_FORMAT;
+
+	// Each section must come from within the file, and go within the image
+	for (uint16_t iCurSection = 0; iCurSection < headers.info.nSections; iCurSection++)
+	{
+		PESECTIONHEADER section;
+		ReadPESection(lpbyFileData, &headers, iCurSection, &section);
+
+		if (!IsValidRange(section.dwRVA, GetPESectionSize(&section), headers.info.cbImage) ||
+			!IsValidRange(section.dwRawDataOffset, GetPESectionDataSize(&section), cbFileData))
+			return PE_ERROR_BAD_FORMAT;
+	}
+
+	*lpImageInfo = headers.info;
+
+	return PE_ERROR_SUCCESS;
+}
+
+PEERROR GetPESection(
+	const void *lpvImage,
+	uint32_t cbImage,
+	uint16_t iSection,
+	PESECTIONHEADER *lpSection
+)
+{
+	assert(lpvImage);
+	assert(lpSection);
+
+	PEHEADERS headers;
+	PEERROR nError = ReadPEHeaders((const uint8_t *)lpvImage, cbImage, &headers);
+	if (nError != PE_ERROR_SUCCESS)
+		return nError;
+
+	if (iSection >= headers.info.nSections)
+		return PE_ERROR_NOT_FOUND;
+
+	ReadPESection((const uint8_t *)lpvImage, &headers, iSection, lpSection);
+
+	return PE_ERROR_SUCCESS;
+}
+
+PEERROR MapPEImage(
+	const void *lpvFileData,
+	uint32_t cbFileData,
+	void *lpvImage,
+	uint32_t cbImage
+)
+{
+	assert(lpvFileData);
+	assert(lpvImage);
+
+	const uint8_t *lpbyFileData = (const uint8_t *)lpvFileData;
+	uint8_t *lpbyImage = (uint8_t *)lpvImage;
+
+	PEIMAGEINFO imageInfo;
+	PEHEADERS headers;
+	PEERROR nError = GetPEImageInfo(lpbyFileData, cbFileData, &imageInfo);
+	if (nError == PE_ERROR_SUCCESS)
+		nError = ReadPEHeaders(lpbyFileData, cbFileData, &headers);
+	if (nError != PE_ERROR_SUCCESS)
+		return nError;
+
+	if (cbImage < imageInfo.cbImage)
+		return PE_ERROR_BUFFER_TOO_SMALL;
+
+	// Anything not filled in by the headers or sections is zero, including the uninitialized part of each section
+	memset(lpbyImage, 0, imageInfo.cbImage);
+	memcpy(lpbyImage, lpbyFileData, imageInfo.cbHeaders);
+
+	for (uint16_t iCurSection = 0; iCurSection < headers.info.nSections; iCurSection++)
+	{
+		PESECTIONHEADER section;
+		ReadPESection(lpbyFileData, &headers, iCurSection, &section);
+
+		uint32_t cbSectionData = GetPESectionDataSize(&section);
+		if (cbSectionData)
+			memcpy(lpbyImage + section.dwRVA, lpbyFileData + section.dwRawDataOffset, cbSectionData);
+	}
+
+	return PE_ERROR_SUCCESS;
+}
+
+PEERROR RelocatePEImage(
+	void *lpvImage,
+	uint32_t cbImage,
+	uint64_t qwNewBase
+)
+{
+	assert(lpvImage);
+
+	uint8_t *lpbyImage = (uint8_t *)lpvImage;
+
+	PEHEADERS headers;
+	PEERROR nError = ReadPEHeaders(lpbyImage, cbImage, &headers);
+	if (nError != PE_ERROR_SUCCESS)
+		return nError;
+
+	// Nothing to do if the image is already where it wants to be. Otherwise the image must have relocations, and a 32-bit image must stay in the first 4 GB.
+	uint64_t qwDelta = qwNewBase - headers.info.qwImageBase;
+	if (!qwDelta)
+		return PE_ERROR_SUCCESS;
+
+	if (!headers.info.bRelocatable || (!headers.info.b64Bit && (qwNewBase > 0xFFFFFFFF)))
+		return PE_ERROR_NOT_RELOCATABLE;
+
+	const PEDATADIRECTORY *pRelocDir = &headers.info.dataDirectories[PE_DIRECTORY_BASERELOC];
+	if (!IsValidRange(pRelocDir->dwRVA, pRelocDir->cbSize, cbImage))
+		return PE_ERROR_BAD_FORMAT;
+
+	// The relocations are a series of blocks, each covering one 4 KB page of the image. Each block has a list of 16-bit entries, of which the high 4 bits are the type of relocation, and the low 12 bits the offset in the page.
+	uint32_t dwBlockOffset = pRelocDir->dwRVA,
+		dwRelocEnd = pRelocDir->dwRVA + pRelocDir->cbSize;
+	while ((dwBlockOffset + sizeof(PEBASERELOCATION)) <= dwRelocEnd)
+	{
+		PEBASERELOCATION block;
+		memcpy(&block, lpbyImage + dwBlockOffset, sizeof(PEBASERELOCATION));
+
+		if ((block.cbBlock < sizeof(PEBASERELOCATION)) || (block.cbBlock > dwRelocEnd - dwBlockOffset))
+			return PE_ERROR_BAD_FORMAT;
+
+		uint32_t nNumEntries = (block.cbBlock - sizeof(PEBASERELOCATION)) / sizeof(uint16_t);
+		const uint8_t *lpbyEntries = lpbyImage + dwBlockOffset + sizeof(PEBASERELOCATION);
+
+		for (uint32_t iCurEntry = 0; iCurEntry < nNumEntries; iCurEntry++)
+		{
+			uint16_t wEntry = ReadWORD(lpbyEntries + (iCurEntry * sizeof(uint16_t)));
+			uint32_t dwTarget = block.dwPageRVA + (wEntry & 0xFFF);
+			uint8_t *lpbyTarget = lpbyImage + dwTarget;
+
+			switch (wEntry >> 12)
+			{
+			case PE_REL_BASED_ABSOLUTE:
+				// Padding to keep the blocks aligned
+				break;
+
+			case PE_REL_BASED_HIGHLOW:
+				if (!IsValidRange(dwTarget, sizeof(uint32_t), cbImage))
+					return PE_ERROR_BAD_FORMAT;
+
+				WriteDWORD(lpbyTarget, ReadDWORD(lpbyTarget) + (uint32_t)qwDelta);
+
+				break;
+
+			case PE_REL_BASED_DIR64:
+				if (!IsValidRange(dwTarget, sizeof(uint64_t), cbImage))
+					return PE_ERROR_BAD_FORMAT;
+
+				WriteQWORD(lpbyTarget, ReadQWORD(lpbyTarget) + qwDelta);
+
+				break;
+
+			case PE_REL_BASED_HIGH:
+			case PE_REL_BASED_LOW:
+			{
+				if (!IsValidRange(dwTarget, sizeof(uint16_t), cbImage))
+					return PE_ERROR_BAD_FORMAT;
+
+				uint16_t wValue = ReadWORD(lpbyTarget) + (uint16_t)(((wEntry >> 12) == PE_REL_BASED_HIGH) ? (qwDelta >> 16) : qwDelta);
+				memcpy(lpbyTarget, &wValue, sizeof(uint16_t));
+
+				break;
+			}
+
+			default:
+				// Other types are only used on other processors
+				return PE_ERROR_UNSUPPORTED;
+			}
+		}
+
+		dwBlockOffset += block.cbBlock;
+	}
+
+	// Record where the image now is, so that anything reading the headers (including a second relocation) sees the right base
+	if (headers.info.b64Bit)
+		WriteQWORD(lpbyImage + headers.dwImageBaseOffset, qwNewBase);
+	else
+		WriteDWORD(lpbyImage + headers.dwImageBaseOffset, (uint32_t)qwNewBase);
+
+	return PE_ERROR_SUCCESS;
+}
+
+PEERROR BindPEImports(
+	void *lpvImage,
+	uint32_t cbImage,
+	PEIMPORTRESOLVER pfnResolver,
+	void *lpvContext
+)
+{
+	assert(lpvImage);
+	assert(pfnResolver);
+
+	uint8_t *lpbyImage = (uint8_t *)lpvImage;
+
+	PEHEADERS headers;
+	PEERROR nError = ReadPEHeaders(lpbyImage, cbImage, &headers);
+	if (nError != PE_ERROR_SUCCESS)
+		return nError;
+
+	const PEDATADIRECTORY *pImportDir = &headers.info.dataDirectories[PE_DIRECTORY_IMPORT];
+	if (!pImportDir->dwRVA)
+		return PE_ERROR_SUCCESS;
+
+	// Thunks are pointer sized, and the high bit of one marks an import by ordinal
+	uint32_t cbThunk = headers.info.b64Bit ? sizeof(uint64_t) : sizeof(uint32_t);
+	uint64_t qwOrdinalFlag = headers.info.b64Bit ? PE_ORDINAL_FLAG64 : PE_ORDINAL_FLAG32;
+
+	// The descriptor list ends with an empty descriptor. As Windows does, go by that rather than by the size of the directory, which some linkers get wrong.
+	for (uint32_t dwDescriptorOffset = pImportDir->dwRVA; ; dwDescriptorOffset += sizeof(PEIMPORTDESCRIPTOR))
+	{
+		PEIMPORTDESCRIPTOR descriptor;
+		if (!IsValidRange(dwDescriptorOffset, sizeof(PEIMPORTDESCRIPTOR), cbImage))
+			return PE_ERROR_BAD_FORMAT;
+
+		memcpy(&descriptor, lpbyImage + dwDescriptorOffset, sizeof(PEIMPORTDESCRIPTOR));
+		if (!descriptor.dwNameRVA && !descriptor.dwAddressTableRVA)
+			break;
+
+		if (!IsValidString(lpbyImage, cbImage, descriptor.dwNameRVA))
+			return PE_ERROR_BAD_FORMAT;
+
+		const char *lpszModuleName = (const char *)(lpbyImage + descriptor.dwNameRVA);
+
+		// The lookup table says what to import; the address table is where to put it. Old linkers only have the latter, which initially holds the same thing as the former.
+		uint32_t dwLookupOffset = descriptor.dwLookupTableRVA ? descriptor.dwLookupTableRVA : descriptor.dwAddressTableRVA,
+			dwAddressOffset = descriptor.dwAddressTableRVA;
+
+		for (;; dwLookupOffset += cbThunk, dwAddressOffset += cbThunk)
+		{
+			if (!IsValidRange(dwLookupOffset, cbThunk, cbImage) ||
+				!IsValidRange(dwAddressOffset, cbThunk, cbImage))
+				return PE_ERROR_BAD_FORMAT;
+
+			uint64_t qwThunk = headers.info.b64Bit ? ReadQWORD(lpbyImage + dwLookupOffset) : ReadDWORD(lpbyImage + dwLookupOffset);
+			if (!qwThunk)
+				break;
+
+			const char *lpszFunctionName = NULL;
+			uint16_t wOrdinal;
+
+			if (qwThunk & qwOrdinalFlag)
+				wOrdinal = (uint16_t)qwThunk;
+			else
+			{
+				// Imports by name point to a hint, followed by the name
+				if ((qwThunk > 0xFFFFFFFF) ||
+					!IsValidRange((uint32_t)qwThunk, sizeof(uint16_t), cbImage) ||
+					!IsValidString(lpbyImage, cbImage, (uint32_t)qwThunk + sizeof(uint16_t)))
+					return PE_ERROR_BAD_FORMAT;
+
+				wOrdinal = ReadWORD(lpbyImage + (uint32_t)qwThunk);
+				lpszFunctionName = (const char *)(lpbyImage + (uint32_t)qwThunk + sizeof(uint16_t));
+			}
+
+			uint64_t qwAddress;
+			if (!pfnResolver(lpvContext, lpszModuleName, lpszFunctionName, wOrdinal, &qwAddress))
+				return PE_ERROR_RESOLVER_FAILED;
+
+			if (headers.info.b64Bit)
+				WriteQWORD(lpbyImage + dwAddressOffset, qwAddress);
+			else
+			{
+				if (qwAddress > 0xFFFFFFFF)
+					return PE_ERROR_BAD_FORMAT;
+
+				WriteDWORD(lpbyImage + dwAddressOffset, (uint32_t)qwAddress);
+			}
+		}
+	}
+
+	return PE_ERROR_SUCCESS;
+}
+
+PEERROR FindPEExport(
+	const void *lpvImage,
+	uint32_t cbImage,
+	const char *lpszFunctionName,
+	uint16_t wOrdinal,
+	uint32_t *lpdwFunctionRVA,
+	const char **lplpszForwarder
+)
+{
+	assert(lpvImage);
+	assert(lpdwFunctionRVA);
+
+	const uint8_t *lpbyImage = (const uint8_t *)lpvImage;
+
+	PEHEADERS headers;
+	PEERROR nError = ReadPEHeaders(lpbyImage, cbImage, &headers);
+	if (nError != PE_ERROR_SUCCESS)
+		return nError;
+
+	const PEDATADIRECTORY *pExportDir = &headers.info.dataDirectories[PE_DIRECTORY_EXPORT];
+	if (!pExportDir->dwRVA || (pExportDir->cbSize < sizeof(PEEXPORTDIRECTORY)))
+		return PE_ERROR_NOT_FOUND;
+
+	if (!IsValidRange(pExportDir->dwRVA, pExportDir->cbSize, cbImage))
+		return PE_ERROR_BAD_FORMAT;
+
+	PEEXPORTDIRECTORY exportDir;
+	memcpy(&exportDir, lpbyImage + pExportDir->dwRVA, sizeof(PEEXPORTDIRECTORY));
+
+	if (!IsValidRange(exportDir.dwFunctionsRVA, (uint64_t)exportDir.nFunctions * sizeof(uint32_t), cbImage) ||
+		!IsValidRange(exportDir.dwNamesRVA, (uint64_t)exportDir.nNames * sizeof(uint32_t), cbImage) ||
+		!IsValidRange(exportDir.dwNameOrdinalsRVA, (uint64_t)exportDir.nNames * sizeof(uint16_t), cbImage))
+		return PE_ERROR_BAD_FORMAT;
+
+	// Find the index of the function in the address table, either directly from the ordinal, or from the name table
+	uint32_t iFunction = (uint32_t)-1;
+	if (!lpszFunctionName)
+		iFunction = (uint32_t)wOrdinal - exportDir.dwOrdinalBase;
+	else
+	{
+		// The names are sorted, so they can be binary searched
+		uint32_t iLow = 0, iHigh = exportDir.nNames;
+		while (iLow < iHigh)
+		{
+			uint32_t iMid = iLow + ((iHigh - iLow) / 2),
+				dwNameRVA = ReadDWORD(lpbyImage + exportDir.dwNamesRVA + (iMid * sizeof(uint32_t)));
+
+			if (!IsValidString(lpbyImage, cbImage, dwNameRVA))
+				return PE_ERROR_BAD_FORMAT;
+
+			int nCompare = strcmp(lpszFunctionName, (const char *)(lpbyImage + dwNameRVA));
+			if (!nCompare)
+			{
+				iFunction = ReadWORD(lpbyImage + exportDir.dwNameOrdinalsRVA + (iMid * sizeof(uint16_t)));
+				break;
+			}
+			else if (nCompare < 0)
+				iHigh = iMid;
+			else
+				iLow = iMid + 1;
+		}
+	}
+
+	uint32_t dwFunctionRVA = (iFunction < exportDir.nFunctions) ?
+		ReadDWORD(lpbyImage + exportDir.dwFunctionsRVA + (iFunction * sizeof(uint32_t))) : 0;
+	if (!dwFunctionRVA)
+		return PE_ERROR_NOT_FOUND;
+
+	// An address inside the export directory is really the name of a function in some other module
+	if ((dwFunctionRVA >= pExportDir->dwRVA) && (dwFunctionRVA - pExportDir->dwRVA < pExportDir->cbSize))
+	{
+		if (!IsValidString(lpbyImage, cbImage, dwFunctionRVA))
+			return PE_ERROR_BAD_FORMAT;
+
+		if (!lplpszForwarder)
+			return PE_ERROR_NOT_FOUND;
+
+		*lpdwFunctionRVA = 0;
+		*lplpszForwarder = (const char *)(lpbyImage + dwFunctionRVA);
+
+		return PE_ERROR_SUCCESS;
+	}
+
+	if (dwFunctionRVA >= cbImage)
+		return PE_ERROR_BAD_FORMAT;
+
+	*lpdwFunctionRVA = dwFunctionRVA;
+	if (lplpszForwarder)
+		*lplpszForwarder = NULL;
+
+	return PE_ERROR_SUCCESS;
+}
@@ -0,0 +1,171 @@
+/*
+	The contents of this file are subject to the Common Development and Distribution License Version 1.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at http://www.sun.com/cddl/cddl.html.
+
+	Software distributed under the License is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for the specific language governing rights and limitations under the License.
+
+	The Initial Developer of the Original Code is Justin Olbrantz. The Original Code Copyright (C) 2007 Justin Olbrantz. All Rights Reserved.
+*/
+
+// Prevent this header from being included multiple times
+#ifndef QPEIMAGE_H
+#define QPEIMAGE_H
+
+#include <stdint.h>
+#include "QPEFormat.h"
+
+/*
+	QPEImage does the parts of loading a PE image that only involve the image itself: checking the headers, laying the image out as it will be in memory, applying base relocations, filling in the import address table, and looking up exports. It works only on memory given to it, for images of either bitness, and doesn't depend on windows.h, so it can be built and tested anywhere. QPELoader uses it to load DLLs from memory on Windows.
+	Every offset, size, and string in the image is checked against the bounds of the image, so a corrupt image causes failure with PE_ERROR_BAD_FORMAT rather than a crash. Errors are returned rather than set with SetLastError.
+*/
+
+enum PEERROR
+{
+	PE_ERROR_SUCCESS = 0,
+	PE_ERROR_BAD_FORMAT,	// The image is invalid or corrupt
+	PE_ERROR_BUFFER_TOO_SMALL,	// The memory given to lay the image out in is smaller than the image
+	PE_ERROR_NOT_RELOCATABLE,	// The image has to be relocated, and has no relocations, or can't be moved to the requested address
+	PE_ERROR_UNSUPPORTED,	// The image uses relocation types only used on other processors
+	PE_ERROR_NOT_FOUND,	// There is no such export
+	PE_ERROR_RESOLVER_FAILED,	// The import resolver failed
+
+	NUM_PE_ERRORS
+};
+
+// The information about an image obtained from its headers
+struct PEIMAGEINFO
+{
+	// Whether the image is a 64-bit (PE32+) image
+	bool b64Bit;
+	// The machine type of the image (PE_MACHINE_*)
+	uint16_t wMachine;
+	// The image characteristics (PE_FILE_*)
+	uint16_t wCharacteristics;
+
+	// The address the image would prefer to be loaded at
+	uint64_t qwImageBase;
+	// The size of the image once loaded
+	uint32_t cbImage;
+	// The size of the headers, which are loaded at the start of the image
+	uint32_t cbHeaders;
+	// The RVA of the entry point, or 0 if there is none
+	uint32_t dwEntryPointRVA;
+	// The alignment of the sections in the image
+	uint32_t cbSectionAlignment;
+	// The number of sections
+	uint16_t nSections;
+
+	// Whether the image can be loaded at an address other than qwImageBase
+	bool bRelocatable;
+
+	// The data directories (PE_DIRECTORY_*). Directories the image doesn't have are zeroed.
+	PEDATADIRECTORY dataDirectories[PE_NUM_DIRECTORIES];
+};
+
+/*
+	* PEIMPORTRESOLVER *
+	The type of the function BindPEImports calls to find the address of each imported function. Returns false if the function can't be found.
+*/
+typedef bool (*PEIMPORTRESOLVER)(
+	// The context passed to BindPEImports
+	void *lpvContext,
+	// The name of the module the function is imported from. The same pointer is passed for all the functions imported from one import descriptor, and a different one for each descriptor.
+	const char *lpszModuleName,
+	// The name of the function, or NULL if it is imported by ordinal
+	const char *lpszFunctionName,
+	// The ordinal of the function if it is imported by ordinal, or the hint if imported by name
+	uint16_t wOrdinal,
+	// The address of the function
+	uint64_t *lpqwAddress
+);
+
+/*
+	* GetPEImageInfo *
+	Checks the headers of an image as it is stored on disk, and returns the information needed to load it. Fails if the image isn't valid, or if any of its sections lie outside the image or the file.
+*/
+PEERROR GetPEImageInfo(
+	// The image file in memory
+	const void *lpvFileData,
+	// The size of the image file
+	uint32_t cbFileData,
+	// The information about the image
+	PEIMAGEINFO *lpImageInfo
+);
+
+/*
+	* GetPESection *
+	Gets one of the section headers of an image, either as a file or laid out by MapPEImage. The image must have been checked with GetPEImageInfo.
+*/
+PEERROR GetPESection(
+	// The image
+	const void *lpvImage,
+	// The size of the image
+	uint32_t cbImage,
+	// The index of the section
+	uint16_t iSection,
+	// The section header
+	PESECTIONHEADER *lpSection
+);
+
+/*
+	* MapPEImage *
+	Lays out an image as it will be in memory: the headers at the start, and each section at its RVA, with the rest of the image zero filled.
+*/
+PEERROR MapPEImage(
+	// The image file in memory
+	const void *lpvFileData,
+	// The size of the image file
+	uint32_t cbFileData,
+	// The memory to lay the image out in
+	void *lpvImage,
+	// The size of the memory at lpvImage. Must be at least PEIMAGEINFO::cbImage.
+	uint32_t cbImage
+);
+
+/*
+	* RelocatePEImage *
+	Applies the base relocations of an image laid out by MapPEImage, so that it will run at a different address than the one it was linked for, and updates the image base in the headers to match. Does nothing if the image is already based at qwNewBase.
+*/
+PEERROR RelocatePEImage(
+	// The image laid out by MapPEImage
+	void *lpvImage,
+	// The size of the memory at lpvImage
+	uint32_t cbImage,
+	// The address the image will run at
+	uint64_t qwNewBase
+);
+
+/*
+	* BindPEImports *
+	Fills in the import address table of an image laid out by MapPEImage, calling pfnResolver for each imported function. Delay-loaded imports are left for the image's own delay-load helper. If pfnResolver fails, BindPEImports stops immediately and returns PE_ERROR_RESOLVER_FAILED.
+*/
+PEERROR BindPEImports(
+	// The image laid out by MapPEImage
+	void *lpvImage,
+	// The size of the memory at lpvImage
+	uint32_t cbImage,
+	// The function that finds the address of each import
+	PEIMPORTRESOLVER pfnResolver,
+	// Passed to pfnResolver
+	void *lpvContext
+);
+
+/*
+	* FindPEExport *
+	Looks up a function exported by an image laid out by MapPEImage, by name, or by ordinal if lpszFunctionName is NULL. If the export is forwarded to another module, the RVA is 0, and lplpszForwarder receives the forwarder string ("Module.Function" or "Module.#Ordinal").
+*/
+PEERROR FindPEExport(
+	// The image laid out by MapPEImage
+	const void *lpvImage,
+	// The size of the memory at lpvImage
+	uint32_t cbImage,
+	// The name of the function, or NULL to look it up by wOrdinal
+	const char *lpszFunctionName,
+	// The ordinal of the function, if lpszFunctionName is NULL
+	uint16_t wOrdinal,
+	// The RVA of the function, or 0 if it is forwarded
+	uint32_t *lpdwFunctionRVA,
+	// The forwarder string, or NULL if the function isn't forwarded. If this parameter is NULL, forwarded exports cause failure with PE_ERROR_NOT_FOUND.
+	const char **lplpszForwarder
+);
+
+#endif // #ifndef QPEIMAGE_H
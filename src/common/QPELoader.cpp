@@ -0,0 +1,432 @@
+/*
+	The contents of this file are subject to the Common Development and Distribution License Version 1.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at http://www.sun.com/cddl/cddl.html.
+
+	Software distributed under the License is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for the specific language governing rights and limitations under the License.
+
+	The Initial Developer of the Original Code is Justin Olbrantz. The Original Code Copyright (C) 2007 Justin Olbrantz. All Rights Reserved.
+*/
+
+#include "QPELoader.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The machine type of the images LoadPEImage can load
+#ifdef _WIN64
+#define PE_HOST_MACHINE PE_MACHINE_AMD64
+#else
+#define PE_HOST_MACHINE PE_MACHINE_I386
+#endif
+
+// What LoadPEImage needs to remember about an image to unload it. These are kept in a list, which is searched for the image's base address (its handle), so that handles LoadPEImage didn't return are told apart without touching their memory.
+struct LOADEDPEIMAGE
+{
+	LOADEDPEIMAGE *pNext;
+
+	// The image's base address
+	HMODULE hModule;
+
+	// The information about the image, from its headers
+	PEIMAGEINFO imageInfo;
+
+	// The modules loaded to bind the imports, one for each import descriptor, which must be freed when the image is
+	HMODULE *phImportedModules;
+	DWORD nImportedModules;
+	DWORD nMaxImportedModules;
+
+	// The module name of the import descriptor being bound, so that each descriptor only loads its module once
+	LPCSTR lpszCurrentModuleName;
+	// The error ResolvePEImport failed with, as BindPEImports doesn't keep it
+	DWORD dwResolveError;
+
+	// Whether the entry point has been called with DLL_PROCESS_ATTACH
+	BOOL bAttached;
+
+#ifdef _WIN64
+	// Whether the image's exception handling table has been registered
+	BOOL bFunctionTableAdded;
+#endif
+};
+
+// The images loaded by LoadPEImage. Protected by csLoadedImagesLock
+static LOADEDPEIMAGE *pFirstLoadedImage = NULL;
+
+static CRITICAL_SECTION csLoadedImagesLock;
+
+typedef BOOL (WINAPI *PEENTRYPOINT)(HINSTANCE hInstance, DWORD dwReason, LPVOID lpvReserved);
+
+// Sets the last error for a QPEImage error, and returns FALSE
+static BOOL SetPEError(IN PEERROR nError)
+{
+	switch (nError)
+	{
+	case PE_ERROR_SUCCESS:
+		return TRUE;
+
+	case PE_ERROR_BUFFER_TOO_SMALL:
+		SetLastError(ERROR_INSUFFICIENT_BUFFER);
+		break;
+
+	case PE_ERROR_NOT_FOUND:
+		SetLastError(ERROR_PROC_NOT_FOUND);
+		break;
+
+	default:
+		SetLastError(ERROR_BAD_EXE_FORMAT);
+		break;
+	}
+
+	return FALSE;
+}
+
+void WINAPI QPELoaderInitialize()
+{
+	InitializeCriticalSection(&csLoadedImagesLock);
+}
+
+void WINAPI QPELoaderDestroy()
+{
+	DeleteCriticalSection(&csLoadedImagesLock);
+}
+
+// Adds an image to the list of loaded images
+static void AddLoadedPEImage(IN LOADEDPEIMAGE *pLoadedImage)
+{
+	EnterCriticalSection(&csLoadedImagesLock);
+
+	pLoadedImage->pNext = pFirstLoadedImage;
+	pFirstLoadedImage = pLoadedImage;
+
+	LeaveCriticalSection(&csLoadedImagesLock);
+}
+
+// Finds the bookkeeping for an image loaded by LoadPEImage, and optionally takes it out of the list. Returns NULL if hModule isn't an image LoadPEImage loaded (or one that has already been freed).
+static LOADEDPEIMAGE *GetLoadedPEImage(IN HMODULE hModule, IN BOOL bRemove)
+{
+	EnterCriticalSection(&csLoadedImagesLock);
+
+	LOADEDPEIMAGE **ppLoadedImage = &pFirstLoadedImage;
+	while (*ppLoadedImage && ((*ppLoadedImage)->hModule != hModule))
+		ppLoadedImage = &(*ppLoadedImage)->pNext;
+
+	LOADEDPEIMAGE *pLoadedImage = *ppLoadedImage;
+	if (pLoadedImage && bRemove)
+		*ppLoadedImage = pLoadedImage->pNext;
+
+	LeaveCriticalSection(&csLoadedImagesLock);
+
+	return pLoadedImage;
+}
+
+// Resolves imports for LoadPEImage, by loading each imported module with LoadLibrary
+static bool ResolvePEImport(
+	void *lpvContext,
+	const char *lpszModuleName,
+	const char *lpszFunctionName,
+	uint16_t wOrdinal,
+	uint64_t *lpqwAddress
+)
+{
+	LOADEDPEIMAGE *pLoadedImage = (LOADEDPEIMAGE *)lpvContext;
+
+	// BindPEImports passes the same module name pointer for every function in a descriptor, so a new pointer means a new descriptor
+	if (lpszModuleName != pLoadedImage->lpszCurrentModuleName)
+	{
+		if (pLoadedImage->nImportedModules == pLoadedImage->nMaxImportedModules)
+		{
+			DWORD nNewMaxModules = pLoadedImage->nMaxImportedModules ? pLoadedImage->nMaxImportedModules * 2 : 16;
+			HMODULE *phNewModules = (HMODULE *)realloc(pLoadedImage->phImportedModules, nNewMaxModules * sizeof(HMODULE));
+			if (!phNewModules)
+			{
+				pLoadedImage->dwResolveError = ERROR_NOT_ENOUGH_MEMORY;
+
+				return false;
+			}
+
+			pLoadedImage->phImportedModules = phNewModules;
+			pLoadedImage->nMaxImportedModules = nNewMaxModules;
+		}
+
+		HMODULE hImportedModule = LoadLibrary(lpszModuleName);
+		if (!hImportedModule)
+		{
+			pLoadedImage->dwResolveError = GetLastError();
+
+			return false;
+		}
+
+		pLoadedImage->phImportedModules[pLoadedImage->nImportedModules++] = hImportedModule;
+		pLoadedImage->lpszCurrentModuleName = lpszModuleName;
+	}
+
+	FARPROC pfnFunction = GetProcAddress(pLoadedImage->phImportedModules[pLoadedImage->nImportedModules - 1],
+		lpszFunctionName ? lpszFunctionName : (LPCSTR)(UINT_PTR)wOrdinal);
+	if (!pfnFunction)
+	{
+		pLoadedImage->dwResolveError = GetLastError();
+
+		return false;
+	}
+
+	*lpqwAddress = (uint64_t)(UINT_PTR)pfnFunction;
+
+	return true;
+}
+
+// Calls the TLS callbacks of a loaded image, if it has any
+static void CallPETLSCallbacks(IN HMODULE hModule, IN const PEIMAGEINFO *pImageInfo, IN DWORD dwReason)
+{
+	const PEDATADIRECTORY *pTLSDir = &pImageInfo->dataDirectories[PE_DIRECTORY_TLS];
+	if (!pTLSDir->dwRVA)
+		return;
+
+	// LoadPEImage made sure the directory is in the image. The callback list was relocated with everything else, so it holds real addresses.
+	const IMAGE_TLS_DIRECTORY *pTLSDirectory = (const IMAGE_TLS_DIRECTORY *)((LPBYTE)hModule + pTLSDir->dwRVA);
+	PIMAGE_TLS_CALLBACK *ppfnCallbacks = (PIMAGE_TLS_CALLBACK *)pTLSDirectory->AddressOfCallBacks;
+
+	for (; ppfnCallbacks && *ppfnCallbacks; ppfnCallbacks++)
+		(*ppfnCallbacks)((LPVOID)hModule, dwReason, NULL);
+}
+
+// Undoes whatever LoadPEImage got done for an image, and frees it
+static void UnloadPEImage(IN HMODULE hModule, IN LOADEDPEIMAGE *pLoadedImage)
+{
+	const PEIMAGEINFO *pImageInfo = &pLoadedImage->imageInfo;
+
+	if (pLoadedImage->bAttached)
+	{
+		if (pImageInfo->dwEntryPointRVA)
+			((PEENTRYPOINT)((LPBYTE)hModule + pImageInfo->dwEntryPointRVA))((HINSTANCE)hModule, DLL_PROCESS_DETACH, NULL);
+
+		CallPETLSCallbacks(hModule, pImageInfo, DLL_PROCESS_DETACH);
+	}
+
+#ifdef _WIN64
+	if (pLoadedImage->bFunctionTableAdded)
+		RtlDeleteFunctionTable((PRUNTIME_FUNCTION)((LPBYTE)hModule + pImageInfo->dataDirectories[PE_DIRECTORY_EXCEPTION].dwRVA));
+#endif
+
+	// Release the imported modules in the opposite order they were loaded in
+	while (pLoadedImage->nImportedModules)
+		FreeLibrary(pLoadedImage->phImportedModules[--pLoadedImage->nImportedModules]);
+
+	free(pLoadedImage->phImportedModules);
+	free(pLoadedImage);
+
+	VirtualFree((LPVOID)hModule, 0, MEM_RELEASE);
+}
+
+// Gets the page protection for a section with the specified characteristics
+static DWORD GetPESectionProtection(IN DWORD dwCharacteristics)
+{
+	// Indexed by execute, read, and write
+	static const DWORD dwProtections[2][2][2] =
+	{
+		{ { PAGE_NOACCESS, PAGE_READWRITE }, { PAGE_READONLY, PAGE_READWRITE } },
+		{ { PAGE_EXECUTE, PAGE_EXECUTE_READWRITE }, { PAGE_EXECUTE_READ, PAGE_EXECUTE_READWRITE } }
+	};
+
+	return dwProtections[(dwCharacteristics & PE_SCN_MEM_EXECUTE) ? 1 : 0]
+		[(dwCharacteristics & PE_SCN_MEM_READ) ? 1 : 0]
+		[(dwCharacteristics & PE_SCN_MEM_WRITE) ? 1 : 0];
+}
+
+HMODULE WINAPI LoadPEImage(
+	IN LPCVOID lpvFileData,
+	IN DWORD dwFileSize
+)
+{
+	assert(lpvFileData);
+
+	PEIMAGEINFO imageInfo;
+	if (!SetPEError(GetPEImageInfo(lpvFileData, dwFileSize, &imageInfo)))
+		return NULL;
+
+	if ((imageInfo.wMachine != PE_HOST_MACHINE) || !(imageInfo.wCharacteristics & PE_FILE_DLL))
+	{
+		SetLastError(ERROR_BAD_EXE_FORMAT);
+
+		return NULL;
+	}
+
+	LOADEDPEIMAGE *pLoadedImage = (LOADEDPEIMAGE *)malloc(sizeof(LOADEDPEIMAGE));
+	if (!pLoadedImage)
+	{
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+
+		return NULL;
+	}
+
+	// Try to put the image where it wants to be, as that saves relocating it, but anywhere will do if it can be relocated
+	LPBYTE lpbyImage = (LPBYTE)VirtualAlloc((LPVOID)(UINT_PTR)imageInfo.qwImageBase, imageInfo.cbImage, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	if (!lpbyImage && imageInfo.bRelocatable)
+		lpbyImage = (LPBYTE)VirtualAlloc(NULL, imageInfo.cbImage, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+
+	if (!lpbyImage)
+	{
+		free(pLoadedImage);
+
+		return NULL;
+	}
+
+	HMODULE hModule = (HMODULE)lpbyImage;
+
+	ZeroMemory(pLoadedImage, sizeof(LOADEDPEIMAGE));
+	pLoadedImage->hModule = hModule;
+	pLoadedImage->imageInfo = imageInfo;
+
+	PEERROR nError = MapPEImage(lpvFileData, dwFileSize, lpbyImage, imageInfo.cbImage);
+	if (nError == PE_ERROR_SUCCESS)
+		nError = RelocatePEImage(lpbyImage, imageInfo.cbImage, (uint64_t)(UINT_PTR)lpbyImage);
+	if (nError == PE_ERROR_SUCCESS)
+		nError = BindPEImports(lpbyImage, imageInfo.cbImage, ResolvePEImport, pLoadedImage);
+
+	if (nError != PE_ERROR_SUCCESS)
+	{
+		DWORD dwError = (nError == PE_ERROR_RESOLVER_FAILED) ? pLoadedImage->dwResolveError : ERROR_BAD_EXE_FORMAT;
+		UnloadPEImage(hModule, pLoadedImage);
+		SetLastError(dwError);
+
+		return NULL;
+	}
+
+	// Thread local storage variables would need the image to be registered with Windows' own loader; only callbacks can be supported
+	const PEDATADIRECTORY *pTLSDir = &imageInfo.dataDirectories[PE_DIRECTORY_TLS];
+	if (pTLSDir->dwRVA)
+	{
+		const IMAGE_TLS_DIRECTORY *pTLSDirectory = (const IMAGE_TLS_DIRECTORY *)(lpbyImage + pTLSDir->dwRVA);
+
+		if (((ULONGLONG)pTLSDir->dwRVA + sizeof(IMAGE_TLS_DIRECTORY) > imageInfo.cbImage) ||
+			(pTLSDirectory->StartAddressOfRawData != pTLSDirectory->EndAddressOfRawData) ||
+			pTLSDirectory->SizeOfZeroFill)
+		{
+			UnloadPEImage(hModule, pLoadedImage);
+			SetLastError(ERROR_NOT_SUPPORTED);
+
+			return NULL;
+		}
+	}
+
+	// Protect each section the way its characteristics say. If sections are smaller than pages, they'd share pages, so leave the whole image writable and executable, as Windows does.
+	SYSTEM_INFO systemInfo;
+	GetSystemInfo(&systemInfo);
+
+	DWORD dwOldProtection;
+	if (imageInfo.cbSectionAlignment >= systemInfo.dwPageSize)
+	{
+		VirtualProtect(lpbyImage, imageInfo.cbHeaders, PAGE_READONLY, &dwOldProtection);
+
+		for (WORD iCurSection = 0; iCurSection < imageInfo.nSections; iCurSection++)
+		{
+			PESECTIONHEADER section;
+			if (GetPESection(lpbyImage, imageInfo.cbImage, iCurSection, &section) != PE_ERROR_SUCCESS)
+				continue;
+
+			DWORD dwSectionSize = section.cbVirtualSize ? section.cbVirtualSize : section.cbRawData;
+			if (dwSectionSize)
+				VirtualProtect(lpbyImage + section.dwRVA, dwSectionSize,
+					GetPESectionProtection(section.dwCharacteristics), &dwOldProtection);
+		}
+	}
+	else
+		VirtualProtect(lpbyImage, imageInfo.cbImage, PAGE_EXECUTE_READWRITE, &dwOldProtection);
+
+	FlushInstructionCache(GetCurrentProcess(), lpbyImage, imageInfo.cbImage);
+
+#ifdef _WIN64
+	// 64-bit exception handling goes by tables registered for each module
+	const PEDATADIRECTORY *pExceptionDir = &imageInfo.dataDirectories[PE_DIRECTORY_EXCEPTION];
+	if (pExceptionDir->dwRVA && ((ULONGLONG)pExceptionDir->dwRVA + pExceptionDir->cbSize <= imageInfo.cbImage))
+		pLoadedImage->bFunctionTableAdded = RtlAddFunctionTable((PRUNTIME_FUNCTION)(lpbyImage + pExceptionDir->dwRVA),
+			pExceptionDir->cbSize / sizeof(RUNTIME_FUNCTION), (DWORD64)lpbyImage);
+#endif
+
+	// Finally, let the DLL initialize itself. Like Windows' loader, we count it as loaded while it does, so that it can look up its own exports.
+	AddLoadedPEImage(pLoadedImage);
+	pLoadedImage->bAttached = TRUE;
+	CallPETLSCallbacks(hModule, &imageInfo, DLL_PROCESS_ATTACH);
+
+	if (imageInfo.dwEntryPointRVA &&
+		!((PEENTRYPOINT)(lpbyImage + imageInfo.dwEntryPointRVA))((HINSTANCE)hModule, DLL_PROCESS_ATTACH, NULL))
+	{
+		// A DLL that fails to initialize doesn't get DLL_PROCESS_DETACH
+		GetLoadedPEImage(hModule, TRUE);
+		pLoadedImage->bAttached = FALSE;
+		UnloadPEImage(hModule, pLoadedImage);
+		SetLastError(ERROR_DLL_INIT_FAILED);
+
+		return NULL;
+	}
+
+	return hModule;
+}
+
+FARPROC WINAPI GetPEImageProcAddress(
+	IN HMODULE hModule,
+	IN LPCSTR lpszFunctionName
+)
+{
+	assert(lpszFunctionName);
+
+	LOADEDPEIMAGE *pLoadedImage = GetLoadedPEImage(hModule, FALSE);
+	if (!pLoadedImage)
+	{
+		SetLastError(ERROR_INVALID_HANDLE);
+
+		return NULL;
+	}
+
+	// Names with a high word of 0 are really ordinals, as with GetProcAddress
+	BOOL bByOrdinal = !((UINT_PTR)lpszFunctionName >> 16);
+
+	uint32_t dwFunctionRVA;
+	const char *lpszForwarder;
+	if (!SetPEError(FindPEExport((const void *)hModule, pLoadedImage->imageInfo.cbImage,
+		bByOrdinal ? NULL : lpszFunctionName, bByOrdinal ? (uint16_t)(UINT_PTR)lpszFunctionName : 0,
+		&dwFunctionRVA, &lpszForwarder)))
+		return NULL;
+
+	if (!lpszForwarder)
+		return (FARPROC)((LPBYTE)hModule + dwFunctionRVA);
+
+	// Forwarders are "Module.Function" or "Module.#Ordinal", and the module name has no extension
+	LPCSTR lpszDot = strrchr(lpszForwarder, '.');
+	if (!lpszDot || ((lpszDot - lpszForwarder) >= MAX_PATH))
+	{
+		SetLastError(ERROR_BAD_EXE_FORMAT);
+
+		return NULL;
+	}
+
+	char szModuleName[MAX_PATH];
+	memcpy(szModuleName, lpszForwarder, lpszDot - lpszForwarder);
+	szModuleName[lpszDot - lpszForwarder] = '\0';
+
+	// The module stays loaded for as long as the process does, the same as Windows' loader does with forwarders
+	HMODULE hForwardModule = LoadLibrary(szModuleName);
+	if (!hForwardModule)
+		return NULL;
+
+	if (lpszDot[1] == '#')
+		return GetProcAddress(hForwardModule, (LPCSTR)(UINT_PTR)(WORD)atoi(lpszDot + 2));
+
+	return GetProcAddress(hForwardModule, lpszDot + 1);
+}
+
+BOOL WINAPI FreePEImage(
+	IN HMODULE hModule
+)
+{
+	// Taking it out of the list first means that if two threads free the same image, only one of them gets to
+	LOADEDPEIMAGE *pLoadedImage = GetLoadedPEImage(hModule, TRUE);
+	if (!pLoadedImage)
+	{
+		SetLastError(ERROR_INVALID_HANDLE);
+
+		return FALSE;
+	}
+
+	UnloadPEImage(hModule, pLoadedImage);
+
+	return TRUE;
+}
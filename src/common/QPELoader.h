@@ -0,0 +1,65 @@
+/*
+	The contents of this file are subject to the Common Development and Distribution License Version 1.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at http://www.sun.com/cddl/cddl.html.
+
+	Software distributed under the License is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for the specific language governing rights and limitations under the License.
+
+	The Initial Developer of the Original Code is Justin Olbrantz. The Original Code Copyright (C) 2007 Justin Olbrantz. All Rights Reserved.
+*/
+
+// Prevent this header from being included multiple times
+#ifndef QPELOADER_H
+#define QPELOADER_H
+
+#include <windows.h>
+#include "QPEImage.h"
+
+/*
+	QPELoader loads DLLs from memory, without writing them to disk and going through LoadLibrary. This is done the same way Windows does it: QPEImage lays the image out, relocates it if it couldn't be put at its preferred address, and binds its imports, and then the pages are protected and the entry point is called.
+	Images loaded by LoadPEImage are not known to Windows, so GetModuleHandle, GetModuleFileName and GetProcAddress don't work on them, and neither do FreeLibrary or DisableThreadLibraryCalls. Images which use thread local storage variables (__declspec(thread)) can't be loaded; TLS callbacks are supported.
+*/
+
+/*
+	* QPELoaderInitialize *
+	Initializes the list of loaded images. Must be called before any other QPELoader function.
+*/
+void WINAPI QPELoaderInitialize();
+
+/*
+	* QPELoaderDestroy *
+	Frees what QPELoaderInitialize allocated. Images still loaded are left as they are.
+*/
+void WINAPI QPELoaderDestroy();
+
+/*
+	* LoadPEImage *
+	Loads a DLL from memory into the current process, the same as LoadLibrary would if the DLL were on disk: the DLL is laid out, relocated, and has its imports loaded with LoadLibrary, its pages protected according to its sections, and its TLS callbacks and entry point called with DLL_PROCESS_ATTACH. The memory holding the DLL file may be freed as soon as LoadPEImage returns.
+	Returns the base address of the DLL, which may be used as an HMODULE with functions which only read the headers (such as PatchImportEntry or FindResource), or NULL on failure. Fails with ERROR_BAD_EXE_FORMAT if the DLL is corrupt or not for this machine, and ERROR_DLL_INIT_FAILED if the entry point returns FALSE.
+*/
+HMODULE WINAPI LoadPEImage(
+	// The DLL file in memory
+	IN LPCVOID lpvFileData,
+	// The size of the DLL file
+	IN DWORD dwFileSize
+);
+
+/*
+	* GetPEImageProcAddress *
+	The equivalent of GetProcAddress for a DLL loaded with LoadPEImage. Fails with ERROR_INVALID_HANDLE if hModule wasn't returned by LoadPEImage, or has been freed. Forwarded exports are resolved with LoadLibrary and GetProcAddress.
+*/
+FARPROC WINAPI GetPEImageProcAddress(
+	// The DLL, as returned by LoadPEImage
+	IN HMODULE hModule,
+	// The name or ordinal of the function
+	IN LPCSTR lpszFunctionName
+);
+
+/*
+	* FreePEImage *
+	The equivalent of FreeLibrary for a DLL loaded with LoadPEImage. Fails with ERROR_INVALID_HANDLE if hModule wasn't returned by LoadPEImage, or has been freed. Calls the entry point and TLS callbacks with DLL_PROCESS_DETACH, releases the modules the DLL imports from, and frees the DLL's memory. There is no reference count; the DLL is always unloaded.
+*/
+BOOL WINAPI FreePEImage(
+	// The DLL, as returned by LoadPEImage
+	IN HMODULE hModule
+);
+
+#endif // #ifndef QPELOADER_H
@@ -7,13 +7,18 @@
 */
 
 #include "QResource.h"
+#include "QChecksum.h"
+#include "QCompress.h"
 #include <algorithm>
 #include <assert.h>
+#include <stdio.h>
 
 BOOL AddTempFileToList(LPCSTR lpszFileName);
 
 // The stride of the loader's attempts to locate an EFS file inside another file
 #define SECTOR_SIZE 512
+// The size of the pieces a file is read in while searching it for an EFS file
+#define EFS_SEARCH_CHUNK_SIZE 0x10000
 // The size we should pad the file out to at the end of the EFS file
 #define FILE_GRANULARITY 4096
 
@@ -22,15 +27,39 @@ BOOL AddTempFileToList(LPCSTR lpszFileName);
 // The magic number of an EFS file header
 #define EFS_SIGNATURE 0x20534645
 
+// The versions of the EFS format. Version 2 added the directory entry size to the header and the checksum to the directory entries.
+#define EFS_VERSION_1 0x00000001
+#define EFS_VERSION_2 0x00000002
+
+// Directory entry flags
+// dwChecksum holds the CRC-32C of the file's data
+#define EFS_FILE_CHECKSUM 0x00000001
+// The file is stored compressed, in blocks of EFS_COMPRESSION_BLOCK_SIZE bytes. The stored data begins with a table of the offsets of the blocks relative to the start of the file's data, with one extra entry at the end holding dwStoredSize. A block whose stored size is the same as its uncompressed size is stored as it is.
+#define EFS_FILE_COMPRESSED 0x00000002
+// All the flags we know the meaning of. Entries with any other flags are treated as corrupt, as there's no way to know how to read them.
+#define EFS_FILE_KNOWN_FLAGS (EFS_FILE_CHECKSUM | EFS_FILE_COMPRESSED)
+
+// The amount of uncompressed data in each block of a compressed file. This is the same as the LZ4 match window, so nothing is lost by splitting files into blocks.
+#define EFS_COMPRESSION_BLOCK_SIZE 0x10000
+// The size of the pieces of a file's stored data which have their own checksums, so that a read of part of a file only has to check the pieces it reads (see EFSDIRECTORYENTRY::dwBlockChecksumsSize)
+#define EFS_CHECKSUM_BLOCK_SIZE EFS_COMPRESSION_BLOCK_SIZE
+// Compressed files must be at least this fraction (1/n) smaller than the original, or they'll be stored uncompressed. A few percent isn't worth the time it takes to decompress.
+#define EFS_MIN_COMPRESSION_SAVINGS 16
+
+// When the data following an EFS file has to be moved to make room, this much extra space is left, so that adding another small file or two won't require moving it again
+#define EFS_TAIL_SLACK 0x10000
+// The size of the pieces data is moved around the file in
+#define EFS_MOVE_CHUNK_SIZE (1 << 20)
+
 #include <pshpack1.h>
 struct EFSFILEHEADER
 {
 	DWORD dwSignature; // Must be "EFS ": 0x20534645
 	union
 	{
-		// The version of the EFS format. So far there is only one.
+		// The version of the EFS format
 		DWORD dwVersion;
-		BYTE byVersion[4]; // Should be 1, 0, 0, 0
+		BYTE byVersion[4]; // Should be 2, 0, 0, 0 (or 1, 0, 0, 0 for old files)
 	};
 	// Total size of the EFS file
 	DWORD dwFileSize;
@@ -38,9 +67,11 @@ struct EFSFILEHEADER
 	DWORD dwDirectoryOffset;
 	// The number of files in the EFS file
 	DWORD dwNumDirectoryEntries;
+	// The size of each entry in the file list. Unused (0) in version 1, where entries are always EFS_V1_DIRECTORY_ENTRY_SIZE bytes.
+	DWORD dwDirectoryEntrySize;
+	// The space set aside for the EFS file, from the header to whatever follows it in the file on disk (e.g. the MPQ of a SEMPQ). 0 if nothing follows it, or if the file was written before this was recorded, in which case anything following it begins at the next FILE_GRANULARITY boundary after the EFS file.
+	DWORD dwAllocatedSize;
 	// Unused, for now
-	DWORD dwUnused14;
-	DWORD dwUnused18;
 	DWORD dwUnused1C;
 };
 
@@ -57,11 +88,61 @@ struct EFSDIRECTORYENTRY
 	DWORD dwOffset;
 	// The file's size
 	DWORD dwSize;
-	// File flags. Unused, for now.
+	// File flags (EFS_FILE_*)
 	DWORD dwFlags;
+	// The CRC-32C of the file's data as it is stored, if EFS_FILE_CHECKSUM is set. Not present in version 1.
+	DWORD dwChecksum;
+	// The size of the file's data as it is stored. Only differs from dwSize if EFS_FILE_COMPRESSED is set. Not present in version 1 or early version 2 files, which can't have compressed files.
+	DWORD dwStoredSize;
+	// The SHA-256 of the file's data, uncompressed. All 0 in entries written before this was added (see HasEFSContentHash); no data actually has that hash. Identifies files in extraction caches, where a CRC-32C is too easily matched by another file.
+	BYTE byContentHash[QCHECKSUM_SHA256_SIZE];
+	// The size of the table of block checksums which follows the file's stored data: the CRC-32C of each EFS_CHECKSUM_BLOCK_SIZE piece of the stored data. 0 if the file has none, as in entries written before this was added; otherwise always GetEFSBlockChecksumsSize(dwStoredSize). The table isn't covered by dwChecksum.
+	DWORD dwBlockChecksumsSize;
 };
 #include <poppack.h>
 
+// Version 1 directory entries end after dwFlags; version 2 entries are at least large enough to hold dwChecksum
+#define EFS_V1_DIRECTORY_ENTRY_SIZE 24
+#define EFS_V2_MIN_DIRECTORY_ENTRY_SIZE 28
+
+// Gets the size of the table of block checksums of a file with the specified amount of stored data
+DWORD GetEFSBlockChecksumsSize(IN DWORD dwStoredSize)
+{
+	return ((dwStoredSize / EFS_CHECKSUM_BLOCK_SIZE) + ((dwStoredSize % EFS_CHECKSUM_BLOCK_SIZE) ? 1 : 0)) * sizeof(DWORD);
+}
+
+// Gets the size of the space a file takes up in an EFS file: its stored data, and the block checksums after it
+DWORD GetEFSFileExtent(IN const EFSDIRECTORYENTRY *pDirEntry)
+{
+	return pDirEntry->dwStoredSize + pDirEntry->dwBlockChecksumsSize;
+}
+
+// Computes the block checksums of a piece of a file's stored data, which must begin on an EFS_CHECKSUM_BLOCK_SIZE boundary
+void ChecksumEFSBlocks(
+	// The stored data
+	IN const BYTE *lpbyData,
+	// The size of the data
+	IN DWORD dwSize,
+	// Receives one checksum for each block
+	OUT LPDWORD lpdwChecksums
+)
+{
+	for (DWORD dwDone = 0; dwDone < dwSize; dwDone += EFS_CHECKSUM_BLOCK_SIZE)
+		*lpdwChecksums++ = QChecksumCRC32C(QCHECKSUM_CRC32C_INIT, lpbyData + dwDone, (std::min)(dwSize - dwDone, (DWORD)EFS_CHECKSUM_BLOCK_SIZE));
+}
+
+// Checks whether a directory entry has the SHA-256 of its file's data
+BOOL HasEFSContentHash(IN const EFSDIRECTORYENTRY *pDirEntry)
+{
+	for (DWORD iByte = 0; iByte < QCHECKSUM_SHA256_SIZE; iByte++)
+	{
+		if (pDirEntry->byContentHash[iByte])
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
 // All the data required to modify an EFS file
 struct EFSFILEHANDLEFORWRITE
 {
@@ -79,6 +160,10 @@ struct EFSFILEHANDLEFORWRITE
 	DWORD nMaxDirectoryEntries;
 	// The offset in the EFS file where new files will be added
 	DWORD dwInsertPoint;
+	// The offset of the data following the EFS file in the file on disk (the tail), relative to the EFS header, or 0 if the EFS file is at the end of the file. The tail is never modified, only moved when the EFS file outgrows the space before it; it is always kept on a SECTOR_SIZE boundary, as Storm requires of MPQs.
+	DWORD dwTailOffset;
+	// The end of the part of the space before the tail that may have been written to, relative to the EFS header. Everything between the end of the EFS file and the tail is zeroed up to here when the EFS file is saved, so that nothing left behind could be mistaken for an MPQ header.
+	DWORD dwWrittenEnd;
 };
 
 // An entry in the extracted file list. This list stores all the temporary files that have been extracted, so that they can be freed by DeleteTemporaryFiles.
@@ -86,6 +171,8 @@ struct EXTRACTEDFILE
 {
 	EXTRACTEDFILE *pNext;
 	char szFileName[MAX_PATH + 1];
+	// For files in an extraction cache (see ExtractCachedEFSFile), an open handle to the file, which keeps it from being deleted while it's in use; such files are not deleted by DeleteTemporaryFiles. INVALID_HANDLE_VALUE for temporary files.
+	HANDLE hCachedFile;
 };
 
 // The temporary file list. Protected by csExtrListLock
@@ -93,8 +180,8 @@ EXTRACTEDFILE *pFirstExtractedFile = NULL, *pLastExtractedFile = NULL;
 
 CRITICAL_SECTION csExtrListLock;
 
-// Adds a file to the temporary file list
-BOOL AddTempFileToList(IN LPCSTR lpszFileName)
+// Adds a file to the temporary file list. hCachedFile is INVALID_HANDLE_VALUE for temporary files, or the handle of a file in an extraction cache.
+BOOL AddExtractedFileToList(IN LPCSTR lpszFileName, IN HANDLE hCachedFile)
 {
 	assert(lpszFileName);
 
@@ -104,6 +191,7 @@ BOOL AddTempFileToList(IN LPCSTR lpszFileName)
 		return FALSE;
 
 	pExtrFile->pNext = NULL;
+	pExtrFile->hCachedFile = hCachedFile;
 
 	strncpy(pExtrFile->szFileName, lpszFileName, sizeof(pExtrFile->szFileName));
 	pExtrFile->szFileName[sizeof(pExtrFile->szFileName) - 1] = '\0';
@@ -122,6 +210,12 @@ BOOL AddTempFileToList(IN LPCSTR lpszFileName)
 	return TRUE;
 }
 
+// Adds a temporary file to the temporary file list
+BOOL AddTempFileToList(IN LPCSTR lpszFileName)
+{
+	return AddExtractedFileToList(lpszFileName, INVALID_HANDLE_VALUE);
+}
+
 // Initialize whatever is necessary
 void WINAPI QResourceInitialize()
 {
@@ -138,6 +232,8 @@ void WINAPI QResourceDestroy()
 	{
 		EXTRACTEDFILE *pNextExtrFile = pExtrFile->pNext;
 
+		if (pExtrFile->hCachedFile != INVALID_HANDLE_VALUE)
+			CloseHandle(pExtrFile->hCachedFile);
 		free(pExtrFile);
 
 		pExtrFile = pNextExtrFile;
@@ -158,7 +254,11 @@ BOOL WINAPI DeleteTemporaryFiles()
 	{
 		EXTRACTEDFILE *pNextExtrFile = pExtrFile->pNext;
 
-		DeleteFile(pExtrFile->szFileName);
+		// Cached files are kept for next time, and only released
+		if (pExtrFile->hCachedFile != INVALID_HANDLE_VALUE)
+			CloseHandle(pExtrFile->hCachedFile);
+		else
+			DeleteFile(pExtrFile->szFileName);
 		free(pExtrFile);
 
 		pExtrFile = pNextExtrFile;
@@ -261,10 +361,84 @@ BOOL WINAPI ExtractTempResource(IN HMODULE hModule, IN LPCSTR lpszResName, IN LP
 	return TRUE;
 }
 
+// Returns the size of each directory entry in an EFS file, based on its header. Returns 0 if the header is from a version of the format we don't understand.
+DWORD GetEFSDirectoryEntrySize(IN const EFSFILEHEADER *pHeader)
+{
+	assert(pHeader);
+
+	if (pHeader->dwVersion == EFS_VERSION_1)
+		return EFS_V1_DIRECTORY_ENTRY_SIZE;
+
+	// Entries may have grown since this code was written; any fields past the ones we know about are ignored
+	if ((pHeader->dwVersion == EFS_VERSION_2) &&
+		(pHeader->dwDirectoryEntrySize >= EFS_V2_MIN_DIRECTORY_ENTRY_SIZE))
+		return pHeader->dwDirectoryEntrySize;
+
+	return 0;
+}
+
+// Checks whether a header found at the specified offset in a file looks like a valid EFS header. It must have the magic number and a version we understand, and it must have a valid file size, directory offset, and directory size.
+BOOL IsValidEFSHeader(
+	// The header to check
+	IN const EFSFILEHEADER *pHeader,
+	// The offset of the header in the file
+	IN DWORD dwHeaderOffset,
+	// The size of the file
+	IN DWORD dwFileSize
+)
+{
+	assert(pHeader);
+
+	if (pHeader->dwSignature != EFS_SIGNATURE)
+		return FALSE;
+
+	DWORD dwDirEntrySize = GetEFSDirectoryEntrySize(pHeader);
+	if (!dwDirEntrySize)
+		return FALSE;
+
+	// Do the math in 64 bits, so that garbage in the header can't wrap around and pass the checks
+	ULONGLONG qwEFSEnd = (ULONGLONG)dwHeaderOffset + pHeader->dwFileSize,
+		qwDirectoryEnd = (ULONGLONG)dwHeaderOffset + pHeader->dwDirectoryOffset 
+		+ (ULONGLONG)pHeader->dwNumDirectoryEntries * dwDirEntrySize;
+
+	return (qwEFSEnd <= dwFileSize) && (qwDirectoryEnd <= dwFileSize);
+}
+
+// Copies directory entries as they are stored in an EFS file into an array of EFSDIRECTORYENTRY. Fields the stored entries don't have are set to 0, except dwStoredSize, which is the same as dwSize for uncompressed files.
+void NormalizeEFSDirectory(
+	// The directory as stored in the file
+	IN const BYTE *lpbyStoredDirectory,
+	// The size of each entry in the stored directory
+	IN DWORD dwStoredEntrySize,
+	// The number of entries in the directory
+	IN DWORD nNumDirEntries,
+	// The converted directory. This is allocated by the caller.
+	OUT EFSDIRECTORYENTRY *pDirectory
+)
+{
+	assert(lpbyStoredDirectory || !nNumDirEntries);
+	assert(pDirectory || !nNumDirEntries);
+
+	DWORD dwBytesToCopy = (std::min)(dwStoredEntrySize, (DWORD)sizeof(EFSDIRECTORYENTRY));
+
+	for (DWORD iCurDirEntry = 0; iCurDirEntry < nNumDirEntries; iCurDirEntry++)
+	{
+		ZeroMemory(&pDirectory[iCurDirEntry], sizeof(EFSDIRECTORYENTRY));
+		memcpy(&pDirectory[iCurDirEntry], lpbyStoredDirectory + (iCurDirEntry * dwStoredEntrySize), dwBytesToCopy);
+
+		if (!(pDirectory[iCurDirEntry].dwFlags & EFS_FILE_COMPRESSED))
+			pDirectory[iCurDirEntry].dwStoredSize = pDirectory[iCurDirEntry].dwSize;
+	}
+}
+
 // Locates (if possible) an EFS file header in the specified file on disk
 BOOL FindEFSHeader(
 	// Handle of the file on disk to be searched
 	IN HANDLE hEFSFile,
+	// The offset to start searching at. Should be a multiple of SECTOR_SIZE.
+	IN DWORD dwStartOffset,
+	// The offset to stop searching at, or 0 to search to the end of the file. Headers at or after it are not found.
+	IN DWORD dwEndOffset,
 	// The offset of the header in the EFS file
 	OUT LPDWORD lpdwHeaderOffset
 )
@@ -272,35 +446,143 @@ BOOL FindEFSHeader(
 	assert(hEFSFile != INVALID_HANDLE_VALUE);
 	assert(lpdwHeaderOffset);
 
-	EFSFILEHEADER header;
-	DWORD dwFileOffset = 0, dwFileSize = GetFileSize(hEFSFile, NULL),
+	DWORD dwFileOffset = dwStartOffset, dwFileSize = GetFileSize(hEFSFile, NULL),
 		dwBytesRead;
+	DWORD dwSearchEnd = dwEndOffset ? (std::min)(dwEndOffset, dwFileSize) : dwFileSize;
+
+	// Scan the file from beginning to end, checking for an EFS header every SECTOR_SIZE bytes. Reading a sector at a time would mean a system call for every sector, so read a chunk at a time, and check all the sectors in each chunk.
+	LPBYTE lpbyChunk = (LPBYTE)malloc(EFS_SEARCH_CHUNK_SIZE);
+	if (!lpbyChunk)
+		return FALSE;
 
-	// Scan the file from beginning to end, checking for an EFS header every SECTOR_SIZE bytes
-	while ((dwFileOffset + sizeof(EFSFILEHEADER)) <= dwFileSize)
+	BOOL bFound = FALSE;
+	while (!bFound && (dwFileOffset < dwSearchEnd) && ((dwFileOffset + sizeof(EFSFILEHEADER)) <= dwFileSize))
 	{
 		SetFilePointer(hEFSFile, dwFileOffset, NULL, FILE_BEGIN);
-		if (!ReadFile(hEFSFile, &header, sizeof(EFSFILEHEADER), &dwBytesRead, NULL) ||
+		// A header starting just before the end of the search may still run past it
+		DWORD dwBytesToRead = (std::min)(dwFileSize - dwFileOffset, (DWORD)EFS_SEARCH_CHUNK_SIZE);
+		dwBytesToRead = (std::min)(dwBytesToRead, (DWORD)(dwSearchEnd - dwFileOffset - 1 + sizeof(EFSFILEHEADER)));
+		if (!ReadFile(hEFSFile, lpbyChunk, dwBytesToRead, &dwBytesRead, NULL) ||
 			(dwBytesRead < sizeof(EFSFILEHEADER)))
-			return FALSE;
-
-		// Must have the magic number and correct version to be recognized as an EFS file. It must also have a valid file size, directory offset, and directory size.
-		if ((header.dwSignature == EFS_SIGNATURE) &&
-
-			(header.dwVersion == 0x00000001) &&
+			break;
 
-			((dwFileOffset + header.dwFileSize) <= dwFileSize) &&
-			((dwFileOffset + header.dwDirectoryOffset + (header.dwNumDirectoryEntries * sizeof(EFSDIRECTORYENTRY))) <= dwFileSize))
+		DWORD dwChunkOffset;
+		for (dwChunkOffset = 0; ((dwChunkOffset + sizeof(EFSFILEHEADER)) <= dwBytesRead) && (dwFileOffset + dwChunkOffset < dwSearchEnd); dwChunkOffset += SECTOR_SIZE)
 		{
-			*lpdwHeaderOffset = dwFileOffset;
+			if (IsValidEFSHeader((const EFSFILEHEADER *)(lpbyChunk + dwChunkOffset), dwFileOffset + dwChunkOffset, dwFileSize))
+			{
+				*lpdwHeaderOffset = dwFileOffset + dwChunkOffset;
+				bFound = TRUE;
 
-			return TRUE;
+				break;
+			}
 		}
 
-		dwFileOffset += SECTOR_SIZE;
+		dwFileOffset += dwChunkOffset;
 	}
 
-	return FALSE;
+	free(lpbyChunk);
+
+	return bFound;
+}
+
+// Moves a block of data within a file on disk. The source and destination may overlap.
+BOOL MoveFileData(
+	// The file
+	IN HANDLE hFile,
+	// The offset of the data to move
+	IN DWORD dwSourceOffset,
+	// The offset to move it to
+	IN DWORD dwDestOffset,
+	// The size of the data
+	IN DWORD dwSize
+)
+{
+	assert(hFile != INVALID_HANDLE_VALUE);
+
+	if ((dwSourceOffset == dwDestOffset) || !dwSize)
+		return TRUE;
+
+	DWORD dwBufferSize = (std::min)(dwSize, (DWORD)EFS_MOVE_CHUNK_SIZE);
+	LPBYTE lpbyBuffer = (LPBYTE)malloc(dwBufferSize);
+	if (!lpbyBuffer)
+		return FALSE;
+
+	// When moving data up, go from the end back, so that nothing is overwritten before it's been moved
+	BOOL bBackward = (dwDestOffset > dwSourceOffset);
+	DWORD dwRemaining = dwSize;
+
+	while (dwRemaining)
+	{
+		DWORD dwBlockSize = (std::min)(dwRemaining, dwBufferSize), dwBytesRead,
+			dwBlockOffset = bBackward ? (dwRemaining - dwBlockSize) : (dwSize - dwRemaining);
+
+		SetFilePointer(hFile, dwSourceOffset + dwBlockOffset, NULL, FILE_BEGIN);
+		if (!ReadFile(hFile, lpbyBuffer, dwBlockSize, &dwBytesRead, NULL)
+			|| (dwBytesRead != dwBlockSize))
+			break;
+
+		SetFilePointer(hFile, dwDestOffset + dwBlockOffset, NULL, FILE_BEGIN);
+		if (!WriteFile(hFile, lpbyBuffer, dwBlockSize, &dwBytesRead, NULL)
+			|| (dwBytesRead != dwBlockSize))
+			break;
+
+		dwRemaining -= dwBlockSize;
+	}
+
+	free(lpbyBuffer);
+
+	return (dwRemaining == 0);
+}
+
+// Makes sure that data can be written to an EFS file up to the specified offset without overwriting the tail, by moving the tail further into the file if necessary. Must be called before writing anything to the EFS file.
+BOOL ReserveEFSSpace(
+	// The EFS archive
+	IN EFSFILEHANDLEFORWRITE *pEFSFile,
+	// The end of the data to be written, relative to the EFS header
+	IN DWORD dwEnd
+)
+{
+	assert(pEFSFile);
+
+	if (pEFSFile->dwTailOffset && (dwEnd > pEFSFile->dwTailOffset))
+	{
+		// Moving the tail is expensive (it's usually most of the file), so leave some room to spare. FILE_GRANULARITY is a multiple of SECTOR_SIZE, so the tail stays sector-aligned.
+		DWORD dwOldTail = pEFSFile->dwHeaderOffset + pEFSFile->dwTailOffset,
+			dwNewTail = (pEFSFile->dwHeaderOffset + dwEnd + EFS_TAIL_SLACK + FILE_GRANULARITY - 1) & ~(FILE_GRANULARITY - 1),
+			dwFileSize = GetFileSize(pEFSFile->hFile, NULL);
+
+		// Files on disk are limited to 4 GB here
+		if ((dwNewTail < dwOldTail) || (dwFileSize - dwOldTail > ~dwNewTail))
+			return FALSE;
+
+		if (!MoveFileData(pEFSFile->hFile, dwOldTail, dwNewTail, dwFileSize - dwOldTail))
+			return FALSE;
+
+		pEFSFile->dwTailOffset = dwNewTail - pEFSFile->dwHeaderOffset;
+
+		// What was left where the tail used to be has to be cleared
+		pEFSFile->dwWrittenEnd = pEFSFile->dwTailOffset;
+	}
+
+	pEFSFile->dwWrittenEnd = (std::max)(pEFSFile->dwWrittenEnd, dwEnd);
+
+	return TRUE;
+}
+
+// Undoes a failed write to the end of an EFS file. If the EFS file is at the end of the file on disk, the file is cut back to the insert point; otherwise the data is simply abandoned, to be overwritten later.
+void DiscardEFSWrite(
+	// The EFS archive
+	IN const EFSFILEHANDLEFORWRITE *pEFSFile
+)
+{
+	assert(pEFSFile);
+
+	if (pEFSFile->dwTailOffset)
+		return;
+
+	SetFilePointer(pEFSFile->hFile, pEFSFile->dwInsertPoint + pEFSFile->dwHeaderOffset, NULL, FILE_BEGIN);
+	SetEndOfFile(pEFSFile->hFile);
 }
 
 // Create an EFS file from an existing file on disk by appending an EFS header to it, and returns an EFS write handle. On success, ownership of the handle to the file on disk is transferred to the EFS file handle. If CreateEFSFile fails, the file should be considered corrupt, and should be deleted.
@@ -320,10 +602,11 @@ BOOL CreateEFSFile(
 	ZeroMemory(&header, sizeof(EFSFILEHEADER));
 
 	header.dwSignature = EFS_SIGNATURE;
-	header.dwVersion = 0x00000001;
+	header.dwVersion = EFS_VERSION_2;
 	header.dwFileSize = sizeof(EFSFILEHEADER);
 	header.dwDirectoryOffset = 0;
 	header.dwNumDirectoryEntries = 0;
+	header.dwDirectoryEntrySize = sizeof(EFSDIRECTORYENTRY);
 
 	// Place the header at the end of the file, aligned to a SECTOR_SIZE boundary
 	DWORD dwHeaderOffset, dwBytesWritten;
@@ -354,6 +637,9 @@ BOOL CreateEFSFile(
 	pEFSFile->dwHeaderOffset = dwHeaderOffset;
 	pEFSFile->dwInsertPoint = sizeof(EFSFILEHEADER);
 
+	pEFSFile->dwTailOffset = 0;
+	pEFSFile->dwWrittenEnd = sizeof(EFSFILEHEADER);
+
 	pEFSFile->pDirectory = pDirEntries;
 	pEFSFile->nNumDirectoryEntries = 0;
 	pEFSFile->nMaxDirectoryEntries = 32;
@@ -373,7 +659,7 @@ BOOL CheckEFSDirectoryAndFindInsertPoint(
 	OUT LPDWORD lpnInsertPoint
 )
 {
-	assert(pDirectory);
+	assert(pDirectory || !nNumDirEntries);
 	assert(nFileSize);
 	assert(lpnInsertPoint);
 
@@ -382,14 +668,32 @@ BOOL CheckEFSDirectoryAndFindInsertPoint(
 	// Loop through the list to do two things
 	for (DWORD iCurDirEntry = 0; iCurDirEntry < nNumDirEntries; iCurDirEntry++)
 	{
+		const EFSDIRECTORYENTRY *pDirEntry = &pDirectory[iCurDirEntry];
+
+		// We can't read files stored in ways we don't know about
+		if (pDirEntry->dwFlags & ~EFS_FILE_KNOWN_FLAGS)
+			return FALSE;
+
+		// Compressed files must have at least a block table. Detailed checks of the table are left for when the file is read.
+		if ((pDirEntry->dwFlags & EFS_FILE_COMPRESSED) && (pDirEntry->dwStoredSize < sizeof(DWORD)))
+			return FALSE;
+
 		// Skip files that are 0 bytes, since the file offset isn't used, and shouldn't be checked
-		if (pDirectory[iCurDirEntry].dwSize == 0)
+		if (pDirEntry->dwStoredSize == 0)
 			continue;
 
+		// The block checksums, if any, must cover exactly the stored data
+		if (pDirEntry->dwBlockChecksumsSize && (pDirEntry->dwBlockChecksumsSize != GetEFSBlockChecksumsSize(pDirEntry->dwStoredSize)))
+			return FALSE;
+
+		// A file that wraps around the end of the address space is certainly corrupt, and would fool the check below
+		DWORD dwExtent = GetEFSFileExtent(pDirEntry);
+		if ((dwExtent < pDirEntry->dwStoredSize) || (pDirEntry->dwOffset + dwExtent < pDirEntry->dwOffset))
+			return FALSE;
+
 		// Find the insert point for the EFS file by finding the largest offset after all files in the EFS file
 		*lpnInsertPoint = (std::max)(*lpnInsertPoint,
-			pDirectory[iCurDirEntry].dwOffset +
-			pDirectory[iCurDirEntry].dwSize);
+			pDirEntry->dwOffset + dwExtent);
 	}
 
 	// Trivial integrity check: check to make sure the insert point is within the file on disk. If this is not the case, it means at least one of the directory entries is corrupted, and crashes will likely ensue.
@@ -419,7 +723,12 @@ BOOL LoadEFSFile(
 
 	SetFilePointer(hEFSFile, dwHeaderOffset, NULL, FILE_BEGIN);
 	if (!ReadFile(hEFSFile, &header, sizeof(EFSFILEHEADER), &dwBytesRead, NULL)
-		|| (dwBytesRead == sizeof(EFSFILEHEADER)))
+		|| (dwBytesRead != sizeof(EFSFILEHEADER)))
+		return FALSE;
+
+	// FindEFSHeader already checked this, so it should never fail
+	DWORD dwStoredEntrySize = GetEFSDirectoryEntrySize(&header);
+	if (!dwStoredEntrySize)
 		return FALSE;
 
 	// Allocate the directory for the EFS file
@@ -440,6 +749,18 @@ BOOL LoadEFSFile(
 	pEFSFile->dwHeaderOffset = dwHeaderOffset;
 	pEFSFile->dwInsertPoint = sizeof(EFSFILEHEADER);
 
+	// Find out whether anything follows the EFS file, and where it starts. The recorded allocation is only used if it makes sense.
+	DWORD dwFileSize = GetFileSize(hEFSFile, NULL),
+		dwTailOffset = ((dwHeaderOffset + header.dwFileSize + FILE_GRANULARITY - 1) & ~(FILE_GRANULARITY - 1)) - dwHeaderOffset;
+
+	if ((header.dwAllocatedSize >= header.dwFileSize) &&
+		(header.dwAllocatedSize <= dwFileSize - dwHeaderOffset) &&
+		!((dwHeaderOffset + header.dwAllocatedSize) % SECTOR_SIZE))
+		dwTailOffset = header.dwAllocatedSize;
+
+	pEFSFile->dwTailOffset = (dwHeaderOffset + dwTailOffset < dwFileSize) ? dwTailOffset : 0;
+	pEFSFile->dwWrittenEnd = header.dwFileSize;
+
 	pEFSFile->nNumDirectoryEntries = header.dwNumDirectoryEntries;
 	pEFSFile->nMaxDirectoryEntries = nNumDirEntriesToAlloc;
 
@@ -449,14 +770,26 @@ BOOL LoadEFSFile(
 	if (!header.dwNumDirectoryEntries)
 		return TRUE;
 
-	// Read the directory entries from the file
-	DWORD nNumBytesToRead = header.dwNumDirectoryEntries * sizeof(EFSDIRECTORYENTRY);
-	SetFilePointer(hEFSFile, dwHeaderOffset + header.dwDirectoryOffset, NULL, FILE_BEGIN);
-	if (ReadFile(hEFSFile, pDirEntry, nNumBytesToRead, &dwBytesRead, NULL)
-		&& (dwBytesRead == nNumBytesToRead))
+	// Read the directory entries from the file. They may be a different size than ours, so read them into a separate buffer and convert them.
+	DWORD nNumBytesToRead = header.dwNumDirectoryEntries * dwStoredEntrySize;
+	LPBYTE lpbyStoredDirectory = (LPBYTE)malloc(nNumBytesToRead);
+	if (lpbyStoredDirectory)
 	{
-		if (CheckEFSDirectoryAndFindInsertPoint(pDirEntry, header.dwNumDirectoryEntries, GetFileSize(hEFSFile, NULL) - dwHeaderOffset, &pEFSFile->dwInsertPoint))
-			return TRUE;
+		SetFilePointer(hEFSFile, dwHeaderOffset + header.dwDirectoryOffset, NULL, FILE_BEGIN);
+		if (ReadFile(hEFSFile, lpbyStoredDirectory, nNumBytesToRead, &dwBytesRead, NULL)
+			&& (dwBytesRead == nNumBytesToRead))
+		{
+			NormalizeEFSDirectory(lpbyStoredDirectory, dwStoredEntrySize, header.dwNumDirectoryEntries, pDirEntry);
+
+			if (CheckEFSDirectoryAndFindInsertPoint(pDirEntry, header.dwNumDirectoryEntries, GetFileSize(hEFSFile, NULL) - dwHeaderOffset, &pEFSFile->dwInsertPoint))
+			{
+				free(lpbyStoredDirectory);
+
+				return TRUE;
+			}
+		}
+
+		free(lpbyStoredDirectory);
 	}
 
 	// Failed. Clean up.
@@ -522,7 +855,7 @@ EFSHANDLEFORWRITE WINAPI OpenEFSFileForWrite(
 
 		// Find out if there's already an EFS archive in the file
 		DWORD dwHeaderOffset;
-		if (FindEFSHeader(hEFSFile, &dwHeaderOffset))
+		if (FindEFSHeader(hEFSFile, 0, 0, &dwHeaderOffset))
 		{
 			// There is. Try to load it.
 			if (LoadEFSFile(hEFSFile, dwHeaderOffset, pFile))
@@ -546,7 +879,7 @@ EFSHANDLEFORWRITE WINAPI OpenEFSFileForWrite(
 // Saves the EFS header and directory table to the file, in preparation for close. If there are no modifications, does nothing and returns success.
 BOOL SaveEFSFile(
 	// The EFS archive to save
-	IN const EFSFILEHANDLEFORWRITE *pEFSFile
+	IN EFSFILEHANDLEFORWRITE *pEFSFile
 )
 {
 	assert(pEFSFile);
@@ -556,18 +889,24 @@ BOOL SaveEFSFile(
 	if (!pEFSFile->bModified)
 		return TRUE;	// Nothing to save
 
-	// The EFS archive has been modified, so we need to save it
-	// Create the EFS header
-	EFSFILEHEADER header;
+	// The EFS archive has been modified, so we need to save it. First make sure the directory will fit.
 	DWORD dwDirectorySize = 
 		pEFSFile->nNumDirectoryEntries * sizeof(EFSDIRECTORYENTRY), dwBytesWritten;
 
-	ZeroMemory(&header, sizeof(EFSDIRECTORYENTRY));
+	if (!ReserveEFSSpace(pEFSFile, pEFSFile->dwInsertPoint + dwDirectorySize))
+		return FALSE;
+
+	// Create the EFS header
+	EFSFILEHEADER header;
+
+	ZeroMemory(&header, sizeof(EFSFILEHEADER));
 
 	header.dwSignature = EFS_SIGNATURE;
-	header.dwVersion = 0x00000001;
+	header.dwVersion = EFS_VERSION_2;
+	header.dwDirectoryEntrySize = sizeof(EFSDIRECTORYENTRY);
 
 	header.dwFileSize = pEFSFile->dwInsertPoint + dwDirectorySize;
+	header.dwAllocatedSize = pEFSFile->dwTailOffset;
 
 	header.dwDirectoryOffset = pEFSFile->dwInsertPoint;
 	header.dwNumDirectoryEntries = pEFSFile->nNumDirectoryEntries;
@@ -595,11 +934,39 @@ BOOL SaveEFSFile(
 		dwEndOfArchive = pEFSFile->dwInsertPoint + 
 			pEFSFile->dwHeaderOffset;
 
-	// Set the file size, padded out to the nearest FILE_GRANULARITY
-	SetFilePointer(pEFSFile->hFile, (dwEndOfArchive + FILE_GRANULARITY - 1) & ~(FILE_GRANULARITY - 1), NULL, FILE_BEGIN);
-	SetEndOfFile(pEFSFile->hFile);
+	if (!pEFSFile->dwTailOffset)
+	{
+		// Set the file size, padded out to the nearest FILE_GRANULARITY
+		SetFilePointer(pEFSFile->hFile, (dwEndOfArchive + FILE_GRANULARITY - 1) & ~(FILE_GRANULARITY - 1), NULL, FILE_BEGIN);
+		SetEndOfFile(pEFSFile->hFile);
 
-	return TRUE;
+		return TRUE;
+	}
+
+	// Something follows the EFS file, so the file size stays as it is. Clear out anything left between the two by files that were deleted or moved.
+	DWORD dwWrittenEnd = pEFSFile->dwHeaderOffset + (std::min)(pEFSFile->dwWrittenEnd, pEFSFile->dwTailOffset);
+	if (dwWrittenEnd <= dwEndOfArchive)
+		return TRUE;
+
+	DWORD dwBufferSize = (std::min)(dwWrittenEnd - dwEndOfArchive, (DWORD)EFS_MOVE_CHUNK_SIZE);
+	LPBYTE lpbyZeros = (LPBYTE)calloc(dwBufferSize, 1);
+	if (!lpbyZeros)
+		return FALSE;
+
+	SetFilePointer(pEFSFile->hFile, dwEndOfArchive, NULL, FILE_BEGIN);
+	while (dwEndOfArchive < dwWrittenEnd)
+	{
+		DWORD dwBlockSize = (std::min)(dwWrittenEnd - dwEndOfArchive, dwBufferSize);
+		if (!WriteFile(pEFSFile->hFile, lpbyZeros, dwBlockSize, &dwBytesWritten, NULL)
+			|| (dwBytesWritten != dwBlockSize))
+			break;
+
+		dwEndOfArchive += dwBlockSize;
+	}
+
+	free(lpbyZeros);
+
+	return (dwEndOfArchive == dwWrittenEnd);
 }
 
 BOOL WINAPI CloseEFSFileForWrite(
@@ -651,7 +1018,7 @@ DWORD FindFileInEFSFile(
 	return (DWORD)-1;	// Doesn't exist
 }
 
-// Adds a new file to an EFS archive, in standard uncompressed, undecorated form. The file is read from disk, and written to the file containing the EFS archive, and the slot provided in the EFS directory is filled with the file's size and offset.
+// Adds a new file to an EFS archive, in standard uncompressed, undecorated form. The file is read from disk, and written to the file containing the EFS archive, and the slot provided in the EFS directory is filled with the file's size, offset, checksum, and flags.
 BOOL AddUncompressedToEFSFile(
 	// The EFS archive structure to add to
 	EFSFILEHANDLEFORWRITE *pEFSFile,
@@ -672,22 +1039,44 @@ BOOL AddUncompressedToEFSFile(
 	{
 		pDirEntry->dwOffset = 0;
 		pDirEntry->dwSize = 0;
+		pDirEntry->dwStoredSize = 0;
+		pDirEntry->dwChecksum = QChecksumCRC32C(QCHECKSUM_CRC32C_INIT, NULL, 0);
+		pDirEntry->dwFlags = EFS_FILE_CHECKSUM;
+		QChecksumSHA256(NULL, 0, pDirEntry->byContentHash);
+		pDirEntry->dwBlockChecksumsSize = 0;
 
 		return TRUE;
 	}
 
-	// The file size isn't 0, so we have to add it
-	// Allocate a read buffer
+	// The file size isn't 0, so we have to add it, followed by its block checksums. Make room for it first.
+	DWORD dwBlockChecksumsSize = GetEFSBlockChecksumsSize(dwFileSize),
+		dwExtent = dwFileSize + dwBlockChecksumsSize;
+	if ((dwExtent < dwFileSize) || (pEFSFile->dwInsertPoint + dwExtent < pEFSFile->dwInsertPoint))
+		return FALSE;	// Too big to fit
+
+	if (!ReserveEFSSpace(pEFSFile, pEFSFile->dwInsertPoint + dwExtent))
+		return FALSE;
+
+	// Allocate a read buffer, and the block checksums. The buffer size is a multiple of EFS_CHECKSUM_BLOCK_SIZE unless the whole file fits in it, so each read begins a new block.
 	DWORD dwBufferSize = (std::min)(dwFileSize, (DWORD)(128 << 10));
 	LPBYTE lpbyReadBuffer = (LPBYTE)malloc(dwBufferSize);
+	LPDWORD lpdwBlockChecksums = (LPDWORD)malloc(dwBlockChecksumsSize);
+
+	if (!lpbyReadBuffer || !lpdwBlockChecksums)
+	{
+		free(lpbyReadBuffer);
+		free(lpdwBlockChecksums);
 
-	if (!lpbyReadBuffer)
 		return FALSE;
+	}
 
-	// Simple read and write loop
+	// Simple read and write loop. The checksums and hash are computed along the way, while the data is still in the cache.
 	BOOL bRetVal = FALSE;
 	DWORD dwReadPtr = 0, dwWritePtr = pEFSFile->dwInsertPoint + pEFSFile->dwHeaderOffset, 
-		dwRemaining = dwFileSize, dwBlockSize, dwBytesRead;
+		dwRemaining = dwFileSize, dwBlockSize, dwBytesRead, 
+		dwChecksum = QCHECKSUM_CRC32C_INIT;
+	QCHECKSUMSHA256 hashContext;
+	QChecksumSHA256Init(&hashContext);
 
 	while (dwRemaining)
 	{
@@ -700,6 +1089,10 @@ BOOL AddUncompressedToEFSFile(
 			|| (dwBytesRead < dwBlockSize))
 			break;
 
+		dwChecksum = QChecksumCRC32C(dwChecksum, lpbyReadBuffer, dwBlockSize);
+		ChecksumEFSBlocks(lpbyReadBuffer, dwBlockSize, lpdwBlockChecksums + (dwReadPtr / EFS_CHECKSUM_BLOCK_SIZE));
+		QChecksumSHA256Update(&hashContext, lpbyReadBuffer, dwBlockSize);
+
 		// And write it
 		SetFilePointer(pEFSFile->hFile, dwWritePtr, NULL, FILE_BEGIN);
 		if (!WriteFile(pEFSFile->hFile, lpbyReadBuffer, dwBlockSize, &dwBytesRead, NULL)
@@ -712,31 +1105,239 @@ BOOL AddUncompressedToEFSFile(
 		dwRemaining -= dwBlockSize;
 	}
 
-	// If we've reached the end of the file, addition was successful. Otherwise, a read or write failed.
-	if (!dwRemaining)
+	// If we've reached the end of the file, and the block checksums could be written after it, addition was successful. Otherwise, a read or write failed.
+	DWORD dwBytesWritten;
+	if (!dwRemaining && WriteFile(pEFSFile->hFile, lpdwBlockChecksums, dwBlockChecksumsSize, &dwBytesWritten, NULL)
+		&& (dwBytesWritten == dwBlockChecksumsSize))
 	{
 		// Success. Update the directory entry.
 		pDirEntry->dwOffset = pEFSFile->dwInsertPoint;
 		pDirEntry->dwSize = dwFileSize;
+		pDirEntry->dwStoredSize = dwFileSize;
+		pDirEntry->dwChecksum = dwChecksum;
+		pDirEntry->dwFlags = EFS_FILE_CHECKSUM;
+		QChecksumSHA256Final(&hashContext, pDirEntry->byContentHash);
+		pDirEntry->dwBlockChecksumsSize = dwBlockChecksumsSize;
 
 		bRetVal = TRUE;
 	}
 	else
 	{
 		// Addition failed. Roll back the changes by reverting the insert point to what it was before we started writing.
-		SetFilePointer(pEFSFile->hFile, pEFSFile->dwInsertPoint, NULL, FILE_BEGIN);
-		SetEndOfFile(pEFSFile->hFile);
+		DiscardEFSWrite(pEFSFile);
 
 		bRetVal = FALSE;
 	}
 
 	free(lpbyReadBuffer);
+	free(lpdwBlockChecksums);
 
 	return bRetVal;
 }
 
-BOOL WINAPI AddToEFSFile(
-	IN EFSHANDLEFORWRITE hEFSFile,
+// Adds a new file to an EFS archive in compressed form (see EFS_FILE_COMPRESSED). The whole file is compressed in memory before anything is written. If compression doesn't save at least 1/EFS_MIN_COMPRESSION_SAVINGS of the file's size, or the memory to do it can't be had, nothing is written and lpbCompressed is set to FALSE, so that the file can be added uncompressed instead; this is not considered a failure.
+BOOL AddCompressedToEFSFile(
+	// The EFS archive structure to add to
+	EFSFILEHANDLEFORWRITE *pEFSFile,
+	// Handle of the file to be added
+	HANDLE hFile,
+	// The directory entry the new file will go in
+	EFSDIRECTORYENTRY *pDirEntry,
+	// Whether the file was compressed and added
+	OUT LPBOOL lpbCompressed
+)
+{
+	assert(pEFSFile);
+	assert(hFile != INVALID_HANDLE_VALUE);
+	assert(pDirEntry);
+	assert(lpbCompressed);
+
+	*lpbCompressed = FALSE;
+
+	// Work out how big the compressed data may be. Empty and tiny files can never get there.
+	DWORD dwFileSize = GetFileSize(hFile, NULL),
+		nNumBlocks = (dwFileSize + EFS_COMPRESSION_BLOCK_SIZE - 1) / EFS_COMPRESSION_BLOCK_SIZE,
+		dwBlockTableSize = (nNumBlocks + 1) * sizeof(DWORD),
+		dwMaxStoredSize = dwFileSize - (dwFileSize / EFS_MIN_COMPRESSION_SAVINGS);
+
+	if (!dwFileSize || (dwBlockTableSize >= dwMaxStoredSize))
+		return TRUE;
+
+	// Allocate buffers for the file, the stored data, and the compressed versions of one block (one at each level)
+	DWORD dwScratchSize = QCOMPRESS_BOUND(EFS_COMPRESSION_BLOCK_SIZE);
+	LPBYTE lpbyFileData = (LPBYTE)malloc(dwFileSize),
+		lpbyStoredData = (LPBYTE)malloc(dwMaxStoredSize),
+		lpbyScratch = (LPBYTE)malloc(dwScratchSize * 2);
+	BOOL bRetVal = TRUE;
+
+	if (lpbyFileData && lpbyStoredData && lpbyScratch)
+	{
+		DWORD dwBytesRead;
+		SetFilePointer(hFile, 0, NULL, FILE_BEGIN);
+		if (!ReadFile(hFile, lpbyFileData, dwFileSize, &dwBytesRead, NULL)
+			|| (dwBytesRead != dwFileSize))
+			bRetVal = FALSE;
+	}
+	else
+		nNumBlocks = 0;	// Not enough memory; store it uncompressed
+
+	// Compress each block at both levels and keep whichever is smaller, or the original if neither helps. Give up as soon as the total gets too big.
+	LPDWORD lpdwBlockTable = (LPDWORD)lpbyStoredData;
+	DWORD dwStoredSize = dwBlockTableSize, iCurBlock;
+
+	for (iCurBlock = 0; bRetVal && (iCurBlock < nNumBlocks); iCurBlock++)
+	{
+		const BYTE *lpbyBlockData = lpbyFileData + (iCurBlock * EFS_COMPRESSION_BLOCK_SIZE);
+		DWORD dwBlockSize = (std::min)(dwFileSize - (iCurBlock * EFS_COMPRESSION_BLOCK_SIZE), (DWORD)EFS_COMPRESSION_BLOCK_SIZE),
+			dwFastSize = QCompressLZ4(lpbyBlockData, dwBlockSize, lpbyScratch, dwScratchSize, QCOMPRESS_LEVEL_FAST),
+			dwHighSize = QCompressLZ4(lpbyBlockData, dwBlockSize, lpbyScratch + dwScratchSize, dwScratchSize, QCOMPRESS_LEVEL_HIGH);
+
+		const BYTE *lpbyStoredBlock = lpbyBlockData;
+		DWORD dwStoredBlockSize = dwBlockSize;
+
+		if (dwFastSize && (dwFastSize < dwStoredBlockSize))
+		{
+			lpbyStoredBlock = lpbyScratch;
+			dwStoredBlockSize = dwFastSize;
+		}
+		if (dwHighSize && (dwHighSize < dwStoredBlockSize))
+		{
+			lpbyStoredBlock = lpbyScratch + dwScratchSize;
+			dwStoredBlockSize = dwHighSize;
+		}
+
+		if (dwStoredSize + dwStoredBlockSize > dwMaxStoredSize)
+			break;
+
+		lpdwBlockTable[iCurBlock] = dwStoredSize;
+		memcpy(lpbyStoredData + dwStoredSize, lpbyStoredBlock, dwStoredBlockSize);
+
+		dwStoredSize += dwStoredBlockSize;
+	}
+
+	// If every block made it, write the compressed file out
+	if (bRetVal && nNumBlocks && (iCurBlock == nNumBlocks))
+	{
+		lpdwBlockTable[nNumBlocks] = dwStoredSize;
+
+		// Checksum the stored data a block at a time
+		DWORD dwBlockChecksumsSize = GetEFSBlockChecksumsSize(dwStoredSize),
+			dwExtent = dwStoredSize + dwBlockChecksumsSize;
+		LPDWORD lpdwBlockChecksums = (LPDWORD)malloc(dwBlockChecksumsSize);
+		if (lpdwBlockChecksums)
+			ChecksumEFSBlocks(lpbyStoredData, dwStoredSize, lpdwBlockChecksums);
+
+		// Make room for it, then write it, followed by the block checksums
+		DWORD dwBytesWritten;
+		if (lpdwBlockChecksums
+			&& (pEFSFile->dwInsertPoint + dwExtent > pEFSFile->dwInsertPoint)
+			&& ReserveEFSSpace(pEFSFile, pEFSFile->dwInsertPoint + dwExtent)
+			&& (SetFilePointer(pEFSFile->hFile, pEFSFile->dwInsertPoint + pEFSFile->dwHeaderOffset, NULL, FILE_BEGIN) != INVALID_SET_FILE_POINTER)
+			&& WriteFile(pEFSFile->hFile, lpbyStoredData, dwStoredSize, &dwBytesWritten, NULL)
+			&& (dwBytesWritten == dwStoredSize)
+			&& WriteFile(pEFSFile->hFile, lpdwBlockChecksums, dwBlockChecksumsSize, &dwBytesWritten, NULL)
+			&& (dwBytesWritten == dwBlockChecksumsSize))
+		{
+			pDirEntry->dwOffset = pEFSFile->dwInsertPoint;
+			pDirEntry->dwSize = dwFileSize;
+			pDirEntry->dwStoredSize = dwStoredSize;
+			pDirEntry->dwChecksum = QChecksumCRC32C(QCHECKSUM_CRC32C_INIT, lpbyStoredData, dwStoredSize);
+			pDirEntry->dwFlags = EFS_FILE_CHECKSUM | EFS_FILE_COMPRESSED;
+			QChecksumSHA256(lpbyFileData, dwFileSize, pDirEntry->byContentHash);
+			pDirEntry->dwBlockChecksumsSize = dwBlockChecksumsSize;
+
+			*lpbCompressed = TRUE;
+		}
+		else
+		{
+			// Roll back, as in AddUncompressedToEFSFile
+			DiscardEFSWrite(pEFSFile);
+
+			bRetVal = FALSE;
+		}
+
+		free(lpdwBlockChecksums);
+	}
+
+	free(lpbyFileData);
+	free(lpbyStoredData);
+	free(lpbyScratch);
+
+	return bRetVal;
+}
+
+// Compares two regions of the file containing an EFS archive. Returns TRUE if they are identical.
+BOOL CompareEFSFileData(
+	// The EFS archive
+	IN const EFSFILEHANDLEFORWRITE *pEFSFile,
+	// The offsets of the two regions, relative to the EFS header
+	IN DWORD dwOffset1,
+	IN DWORD dwOffset2,
+	// The size of the regions
+	IN DWORD dwSize
+)
+{
+	assert(pEFSFile);
+
+	DWORD dwBufferSize = (std::min)(dwSize, (DWORD)(64 << 10));
+	LPBYTE lpbyBuffer1 = (LPBYTE)malloc(dwBufferSize), lpbyBuffer2 = (LPBYTE)malloc(dwBufferSize);
+	BOOL bIdentical = (lpbyBuffer1 && lpbyBuffer2);
+
+	for (DWORD dwDone = 0; bIdentical && (dwDone < dwSize); dwDone += dwBufferSize)
+	{
+		DWORD dwBlockSize = (std::min)(dwSize - dwDone, dwBufferSize), dwBytesRead1, dwBytesRead2;
+
+		SetFilePointer(pEFSFile->hFile, pEFSFile->dwHeaderOffset + dwOffset1 + dwDone, NULL, FILE_BEGIN);
+		BOOL bRead1 = ReadFile(pEFSFile->hFile, lpbyBuffer1, dwBlockSize, &dwBytesRead1, NULL);
+		SetFilePointer(pEFSFile->hFile, pEFSFile->dwHeaderOffset + dwOffset2 + dwDone, NULL, FILE_BEGIN);
+		BOOL bRead2 = ReadFile(pEFSFile->hFile, lpbyBuffer2, dwBlockSize, &dwBytesRead2, NULL);
+
+		bIdentical = bRead1 && bRead2 && (dwBytesRead1 == dwBlockSize) && (dwBytesRead2 == dwBlockSize)
+			&& !memcmp(lpbyBuffer1, lpbyBuffer2, dwBlockSize);
+	}
+
+	free(lpbyBuffer1);
+	free(lpbyBuffer2);
+
+	return bIdentical;
+}
+
+// Checks whether the data of a newly added file is already stored in the EFS archive for another file. The checksum serves as the hash of the data; files whose checksums, sizes, and flags match are then compared byte for byte, so that a checksum collision can't cause the wrong data to be used. Returns the index of the file with the same data, or (DWORD)-1 if there is none.
+DWORD FindDuplicateInEFSFile(
+	// The EFS archive
+	IN const EFSFILEHANDLEFORWRITE *pEFSFile,
+	// The directory entry of the new file, which has not been counted in the directory yet
+	IN const EFSDIRECTORYENTRY *pNewDirEntry
+)
+{
+	assert(pEFSFile);
+	assert(pNewDirEntry);
+
+	// Empty files don't take up any space anyway, and files without checksums can't be found quickly
+	if (!pNewDirEntry->dwStoredSize || !(pNewDirEntry->dwFlags & EFS_FILE_CHECKSUM))
+		return (DWORD)-1;
+
+	for (DWORD iCurDirEntry = 0; iCurDirEntry < pEFSFile->nNumDirectoryEntries; iCurDirEntry++)
+	{
+		const EFSDIRECTORYENTRY *pDirEntry = &pEFSFile->pDirectory[iCurDirEntry];
+
+		if ((pDirEntry->dwChecksum == pNewDirEntry->dwChecksum) &&
+			(pDirEntry->dwFlags == pNewDirEntry->dwFlags) &&
+			(pDirEntry->dwSize == pNewDirEntry->dwSize) &&
+			(pDirEntry->dwStoredSize == pNewDirEntry->dwStoredSize) &&
+			(pDirEntry->dwBlockChecksumsSize == pNewDirEntry->dwBlockChecksumsSize) &&
+			CompareEFSFileData(pEFSFile, pDirEntry->dwOffset, pNewDirEntry->dwOffset, GetEFSFileExtent(pDirEntry)))
+			return iCurDirEntry;
+	}
+
+	return (DWORD)-1;
+}
+
+// Adds a file to the end of the directory of an EFS archive, without checking whether a file with the same ID already exists. AddToEFSFile and ReplaceInEFSFile do the rest.
+BOOL AddFileToEFSFile(
+	// The EFS archive to add to
+	IN EFSFILEHANDLEFORWRITE *pEFSFile,
+	// The parameters passed to AddToEFSFile
 	IN LPCSTR lpszFileName,
 	IN DWORD dwComponentID,
 	IN DWORD dwFileID,
@@ -744,15 +1345,9 @@ BOOL WINAPI AddToEFSFile(
 	IN DWORD dwFlags
 )
 {
-	assert(hEFSFile);
+	assert(pEFSFile);
 	assert(lpszFileName);
-
-	// Check for unsupported flags. Right now all flags are unsupported.
-	if (dwFlags)
-		return FALSE;
-
-	// Extract the EFS archive structure
-	EFSFILEHANDLEFORWRITE *pEFSFile = (EFSFILEHANDLEFORWRITE *)hEFSFile;
+	assert(!(dwFlags & ~EFS_ADD_COMPRESS));
 
 	assert(pEFSFile->hFile != INVALID_HANDLE_VALUE);
 	assert(pEFSFile->pDirectory);
@@ -784,22 +1379,34 @@ BOOL WINAPI AddToEFSFile(
 	if (hFile == INVALID_HANDLE_VALUE)
 		return FALSE;
 
-	// Add the file using AddUncompressedToEFSFile
-	BOOL bRetVal = FALSE;
-	// AddUncompressedToEFSFile may trash the directory even if the addition fails, so we need to make sure we always write it again (mark the archive as modified)
+	// Add the file using AddCompressedToEFSFile or AddUncompressedToEFSFile
+	BOOL bRetVal = FALSE, bAdded = TRUE, bCompressed = FALSE;
+	// Either may trash the directory even if the addition fails, so we need to make sure we always write it again (mark the archive as modified)
 	pEFSFile->bModified = TRUE;
 
 	EFSDIRECTORYENTRY *pDirEntry = &pEFSFile->pDirectory[pEFSFile->nNumDirectoryEntries];
-	if (AddUncompressedToEFSFile(pEFSFile, hFile, pDirEntry))
+	if (dwFlags & EFS_ADD_COMPRESS)
+		bAdded = AddCompressedToEFSFile(pEFSFile, hFile, pDirEntry, &bCompressed);
+
+	// Files that weren't worth compressing (or weren't supposed to be) are stored as they are
+	if (bAdded && !bCompressed)
+		bAdded = AddUncompressedToEFSFile(pEFSFile, hFile, pDirEntry);
+
+	if (bAdded)
 	{
-		// Success. Fill in the file data not filled in by AddUncompressedToEFSFile.
+		// Success. Fill in the file data not filled in by the add functions.
 		pDirEntry->dwComponentID = dwComponentID;
 		pDirEntry->dwFileID = dwFileID;
 		pDirEntry->dwData = dwData;
-		pDirEntry->dwFlags = 0;
+
+		// If the same data is already in the archive, point the new file at it. The copy we just wrote will be overwritten by whatever comes next.
+		DWORD iDuplicate = FindDuplicateInEFSFile(pEFSFile, pDirEntry);
+		if (iDuplicate != (DWORD)-1)
+			pDirEntry->dwOffset = pEFSFile->pDirectory[iDuplicate].dwOffset;
+		else
+			pEFSFile->dwInsertPoint += GetEFSFileExtent(pDirEntry);
 
 		// Update the archive state
-		pEFSFile->dwInsertPoint += pDirEntry->dwSize;
 		pEFSFile->nNumDirectoryEntries++;
 
 		bRetVal = TRUE;
@@ -810,11 +1417,730 @@ BOOL WINAPI AddToEFSFile(
 	return bRetVal;
 }
 
-/*BOOL WINAPI DeleteFromEFSFile(
-	IN EFSHANDLEFORWRITE hEFSFile
+BOOL WINAPI AddToEFSFile(
+	IN EFSHANDLEFORWRITE hEFSFile,
+	IN LPCSTR lpszFileName,
+	IN DWORD dwComponentID,
+	IN DWORD dwFileID,
+	IN DWORD dwData,
+	IN DWORD dwFlags
+)
+{
+	assert(hEFSFile);
+	assert(lpszFileName);
+
+	// Check for unsupported flags
+	if (dwFlags & ~EFS_ADD_COMPRESS)
+		return FALSE;
+
+	// Extract the EFS archive structure
+	EFSFILEHANDLEFORWRITE *pEFSFile = (EFSFILEHANDLEFORWRITE *)hEFSFile;
+
+	// Only one file may have each ID
+	if (FindFileInEFSFile(pEFSFile->pDirectory, pEFSFile->nNumDirectoryEntries, dwComponentID, dwFileID) != (DWORD)-1)
+		return FALSE;
+
+	return AddFileToEFSFile(pEFSFile, lpszFileName, dwComponentID, dwFileID, dwData, dwFlags);
+}
+
+// Recomputes the insert point of an EFS archive after files have been removed from it. If the files at the end of the data were removed, this reclaims their space without having to compact the archive.
+void UpdateEFSInsertPoint(
+	// The EFS archive
+	IN EFSFILEHANDLEFORWRITE *pEFSFile
+)
+{
+	assert(pEFSFile);
+
+	pEFSFile->dwInsertPoint = sizeof(EFSFILEHEADER);
+
+	for (DWORD iCurDirEntry = 0; iCurDirEntry < pEFSFile->nNumDirectoryEntries; iCurDirEntry++)
+	{
+		const EFSDIRECTORYENTRY *pDirEntry = &pEFSFile->pDirectory[iCurDirEntry];
+
+		if (pDirEntry->dwStoredSize)
+			pEFSFile->dwInsertPoint = (std::max)(pEFSFile->dwInsertPoint, pDirEntry->dwOffset + GetEFSFileExtent(pDirEntry));
+	}
+}
+
+BOOL WINAPI DeleteFromEFSFile(
+	IN EFSHANDLEFORWRITE hEFSFile,
 	IN DWORD dwComponentID,
 	IN DWORD dwFileID
-);*/
+)
+{
+	assert(hEFSFile);
+
+	EFSFILEHANDLEFORWRITE *pEFSFile = (EFSFILEHANDLEFORWRITE *)hEFSFile;
+
+	DWORD iDirEntry = FindFileInEFSFile(pEFSFile->pDirectory, pEFSFile->nNumDirectoryEntries, dwComponentID, dwFileID);
+	if (iDirEntry == (DWORD)-1)
+		return FALSE;
+
+	// Remove the entry from the directory, keeping the others in order. The data stays where it is until the archive is compacted, as other files may share it.
+	memmove(&pEFSFile->pDirectory[iDirEntry], &pEFSFile->pDirectory[iDirEntry + 1],
+		(pEFSFile->nNumDirectoryEntries - iDirEntry - 1) * sizeof(EFSDIRECTORYENTRY));
+	pEFSFile->nNumDirectoryEntries--;
+
+	UpdateEFSInsertPoint(pEFSFile);
+
+	pEFSFile->bModified = TRUE;
+
+	return TRUE;
+}
+
+BOOL WINAPI ReplaceInEFSFile(
+	IN EFSHANDLEFORWRITE hEFSFile,
+	IN LPCSTR lpszFileName,
+	IN DWORD dwComponentID,
+	IN DWORD dwFileID,
+	IN DWORD dwData,
+	IN DWORD dwFlags
+)
+{
+	assert(hEFSFile);
+	assert(lpszFileName);
+
+	if (dwFlags & ~EFS_ADD_COMPRESS)
+		return FALSE;
+
+	EFSFILEHANDLEFORWRITE *pEFSFile = (EFSFILEHANDLEFORWRITE *)hEFSFile;
+
+	// Add the new file before getting rid of the old one, so that the old one is still there if it fails
+	DWORD iOldDirEntry = FindFileInEFSFile(pEFSFile->pDirectory, pEFSFile->nNumDirectoryEntries, dwComponentID, dwFileID);
+	if (!AddFileToEFSFile(pEFSFile, lpszFileName, dwComponentID, dwFileID, dwData, dwFlags))
+		return FALSE;
+
+	if (iOldDirEntry == (DWORD)-1)
+		return TRUE;
+
+	// Put the new entry where the old one was, so the order of the directory doesn't change
+	pEFSFile->nNumDirectoryEntries--;
+	pEFSFile->pDirectory[iOldDirEntry] = pEFSFile->pDirectory[pEFSFile->nNumDirectoryEntries];
+
+	UpdateEFSInsertPoint(pEFSFile);
+
+	return TRUE;
+}
+
+BOOL WINAPI CompactEFSFile(
+	IN EFSHANDLEFORWRITE hEFSFile
+)
+{
+	assert(hEFSFile);
+
+	EFSFILEHANDLEFORWRITE *pEFSFile = (EFSFILEHANDLEFORWRITE *)hEFSFile;
+
+	assert(pEFSFile->hFile != INVALID_HANDLE_VALUE);
+	assert(pEFSFile->pDirectory);
+
+	// Sort the files with data by where their data is
+	DWORD nNumFiles = 0;
+	LPDWORD lpdwOrder = (LPDWORD)malloc((std::max)(pEFSFile->nNumDirectoryEntries, (DWORD)1) * sizeof(DWORD));
+	if (!lpdwOrder)
+		return FALSE;
+
+	for (DWORD iCurDirEntry = 0; iCurDirEntry < pEFSFile->nNumDirectoryEntries; iCurDirEntry++)
+	{
+		if (pEFSFile->pDirectory[iCurDirEntry].dwStoredSize)
+			lpdwOrder[nNumFiles++] = iCurDirEntry;
+	}
+
+	const EFSDIRECTORYENTRY *pDirectory = pEFSFile->pDirectory;
+	std::sort(lpdwOrder, lpdwOrder + nNumFiles, 
+		[pDirectory](DWORD iLeft, DWORD iRight) { return pDirectory[iLeft].dwOffset < pDirectory[iRight].dwOffset; });
+
+	// Slide the data down to fill the gaps, one run of contiguous data at a time. Files whose data overlaps (files sharing the same data, in particular) are part of the same run, and keep their positions relative to each other. Runs already in the right place aren't touched.
+	DWORD dwRunStart = 0, dwRunEnd = 0, dwRunDest = sizeof(EFSFILEHEADER), iRunFirstFile = 0;
+	BOOL bRetVal = TRUE;
+
+	for (DWORD iCurFile = 0; iCurFile <= nNumFiles; iCurFile++)
+	{
+		EFSDIRECTORYENTRY *pDirEntry = (iCurFile < nNumFiles) ? &pEFSFile->pDirectory[lpdwOrder[iCurFile]] : NULL;
+
+		// Does this file start a new run (or are we done)? If so, move the last one, and point its files at the new location.
+		if (!pDirEntry || (pDirEntry->dwOffset >= dwRunEnd))
+		{
+			if (iCurFile)
+			{
+				if (!MoveFileData(pEFSFile->hFile, pEFSFile->dwHeaderOffset + dwRunStart,
+					pEFSFile->dwHeaderOffset + dwRunDest, dwRunEnd - dwRunStart))
+				{
+					bRetVal = FALSE;
+					break;
+				}
+
+				for (DWORD iRunFile = iRunFirstFile; iRunFile < iCurFile; iRunFile++)
+					pEFSFile->pDirectory[lpdwOrder[iRunFile]].dwOffset -= dwRunStart - dwRunDest;
+
+				dwRunDest += dwRunEnd - dwRunStart;
+			}
+
+			if (!pDirEntry)
+				break;
+
+			dwRunStart = dwRunEnd = pDirEntry->dwOffset;
+			iRunFirstFile = iCurFile;
+		}
+
+		dwRunEnd = (std::max)(dwRunEnd, pDirEntry->dwOffset + GetEFSFileExtent(pDirEntry));
+	}
+
+	free(lpdwOrder);
+
+	UpdateEFSInsertPoint(pEFSFile);
+
+	// Even if something went wrong, files have probably moved, so the directory must be written
+	pEFSFile->bModified = TRUE;
+
+	return bRetVal;
+}
+
+// The verification states of the files in an EFS file opened for reading
+#define EFS_FILE_UNVERIFIED 0
+#define EFS_FILE_VERIFIED 1
+#define EFS_FILE_CORRUPT 2
+
+// The size of the pieces files are read in when the EFS file isn't in memory. The same as the compression block size, so that the same buffers serve for both.
+#define EFS_READ_CHUNK_SIZE EFS_COMPRESSION_BLOCK_SIZE
+
+// All the data required to read from an EFS file. EFSHANDLEFORREAD is a pointer to one of these. The EFS file is either entirely in memory, or read from a file on disk as needed.
+struct EFSFILEHANDLEFORREAD
+{
+	// The EFS header in memory, if the EFS file is in memory; otherwise NULL. File offsets are relative to this.
+	const BYTE *lpbyEFSData;
+	// The file containing the EFS file, if it isn't in memory, and the offset of the EFS header in that file. All reads are positional, so that several threads may read at once.
+	HANDLE hFile;
+	DWORD dwHeaderOffset;
+	// The EFS file list, converted to the current EFSDIRECTORYENTRY format
+	EFSDIRECTORYENTRY *pDirectory;
+	// The number of files in the EFS file
+	DWORD nNumDirectoryEntries;
+	// The verification state of each file (EFS_FILE_UNVERIFIED, etc.). Files may be verified from several threads at once, so these are only modified with the interlocked functions.
+	volatile LONG *lpnVerifyStates;
+	// The data of each file that has been looked up and couldn't be returned directly from memory - compressed files, and all files if the EFS file isn't in memory - or NULL. Installed with InterlockedCompareExchangePointer, for the same reason.
+	LPVOID volatile *lplpvLoadedFiles;
+	// The temporary file each file has been extracted to by ExtractTempEFSFile, or NULL. Files that share their data with another file can be hard linked to its temporary file instead of being extracted again.
+	LPSTR volatile *lplpszTempFiles;
+};
+
+// Creates a read handle from an EFS header and its directory as stored, whose validity has already been checked. The caller must fill in where the data comes from. Returns NULL if the directory is corrupt or memory couldn't be allocated.
+EFSFILEHANDLEFORREAD *CreateEFSReadHandle(
+	// The EFS header
+	IN const EFSFILEHEADER *pHeader,
+	// The EFS directory, as it is stored in the EFS file
+	IN const BYTE *lpbyStoredDirectory,
+	// The size of the data from the EFS header to the end of the file containing it
+	IN DWORD nEFSDataSize
+)
+{
+	assert(pHeader);
+	assert(lpbyStoredDirectory || !pHeader->dwNumDirectoryEntries);
+
+	DWORD nNumDirEntries = pHeader->dwNumDirectoryEntries;
+
+	EFSFILEHANDLEFORREAD *pEFSFile = (EFSFILEHANDLEFORREAD *)malloc(sizeof(EFSFILEHANDLEFORREAD));
+	if (!pEFSFile)
+		return NULL;
+
+	ZeroMemory(pEFSFile, sizeof(EFSFILEHANDLEFORREAD));
+	pEFSFile->hFile = INVALID_HANDLE_VALUE;
+	pEFSFile->nNumDirectoryEntries = nNumDirEntries;
+
+	// Allocate at least one entry of each, so that an empty EFS file doesn't look like a failed allocation
+	pEFSFile->pDirectory = (EFSDIRECTORYENTRY *)malloc((std::max)(nNumDirEntries, (DWORD)1) * sizeof(EFSDIRECTORYENTRY));
+	pEFSFile->lpnVerifyStates = (volatile LONG *)malloc((std::max)(nNumDirEntries, (DWORD)1) * sizeof(LONG));
+	pEFSFile->lplpvLoadedFiles = (LPVOID volatile *)calloc((std::max)(nNumDirEntries, (DWORD)1), sizeof(LPVOID));
+	pEFSFile->lplpszTempFiles = (LPSTR volatile *)calloc((std::max)(nNumDirEntries, (DWORD)1), sizeof(LPSTR));
+
+	if (pEFSFile->pDirectory && pEFSFile->lpnVerifyStates && pEFSFile->lplpvLoadedFiles && pEFSFile->lplpszTempFiles)
+	{
+		NormalizeEFSDirectory(lpbyStoredDirectory, GetEFSDirectoryEntrySize(pHeader), nNumDirEntries, pEFSFile->pDirectory);
+
+		DWORD dwInsertPoint;
+		if (CheckEFSDirectoryAndFindInsertPoint(pEFSFile->pDirectory, nNumDirEntries, nEFSDataSize, &dwInsertPoint))
+		{
+			// Files without checksums have nothing to verify
+			for (DWORD iCurDirEntry = 0; iCurDirEntry < nNumDirEntries; iCurDirEntry++)
+				pEFSFile->lpnVerifyStates[iCurDirEntry] = (pEFSFile->pDirectory[iCurDirEntry].dwFlags & EFS_FILE_CHECKSUM) ? EFS_FILE_UNVERIFIED : EFS_FILE_VERIFIED;
+
+			return pEFSFile;
+		}
+	}
+
+	// Failed. Clean up.
+	free(pEFSFile->pDirectory);
+	free((LPVOID)pEFSFile->lpnVerifyStates);
+	free((LPVOID)pEFSFile->lplpvLoadedFiles);
+	free((LPVOID)pEFSFile->lplpszTempFiles);
+	free(pEFSFile);
+
+	return NULL;
+}
+
+// Reads data from an EFS file. If the EFS file is in memory, returns a pointer directly into it, and lpbyBuffer is not used; otherwise reads the data into lpbyBuffer, and returns that. Returns NULL if the read fails.
+const BYTE *ReadEFSData(
+	// The EFS file to read from
+	IN const EFSFILEHANDLEFORREAD *pEFSFile,
+	// The offset of the data from the EFS header
+	IN DWORD dwOffset,
+	// The size of the data
+	IN DWORD dwSize,
+	// A buffer of at least dwSize bytes
+	OUT LPBYTE lpbyBuffer
+)
+{
+	assert(pEFSFile);
+
+	if (pEFSFile->lpbyEFSData)
+		return pEFSFile->lpbyEFSData + dwOffset;
+
+	assert(pEFSFile->hFile != INVALID_HANDLE_VALUE);
+	assert(lpbyBuffer || !dwSize);
+
+	// Read from the specified position without touching the file pointer, which would be a race between threads
+	OVERLAPPED overlapped;
+	ZeroMemory(&overlapped, sizeof(OVERLAPPED));
+	overlapped.Offset = pEFSFile->dwHeaderOffset + dwOffset;
+
+	DWORD dwBytesRead;
+	if (!ReadFile(pEFSFile->hFile, lpbyBuffer, dwSize, &dwBytesRead, &overlapped)
+		|| (dwBytesRead != dwSize))
+		return NULL;
+
+	return lpbyBuffer;
+}
+
+// Computes the checksum of a file's stored data. Returns FALSE if the data couldn't be read.
+BOOL ChecksumEFSFile(
+	// The EFS file containing the file
+	IN const EFSFILEHANDLEFORREAD *pEFSFile,
+	// The directory entry of the file
+	IN const EFSDIRECTORYENTRY *pDirEntry,
+	// The checksum of the file
+	OUT LPDWORD lpdwChecksum
+)
+{
+	assert(pEFSFile);
+	assert(pDirEntry);
+	assert(lpdwChecksum);
+
+	// If it's in memory, do it all at once
+	if (pEFSFile->lpbyEFSData)
+	{
+		*lpdwChecksum = QChecksumCRC32C(QCHECKSUM_CRC32C_INIT, pEFSFile->lpbyEFSData + pDirEntry->dwOffset, pDirEntry->dwStoredSize);
+
+		return TRUE;
+	}
+
+	// Otherwise read it a piece at a time
+	LPBYTE lpbyBuffer = (LPBYTE)malloc(EFS_READ_CHUNK_SIZE);
+	if (!lpbyBuffer)
+		return FALSE;
+
+	DWORD dwChecksum = QCHECKSUM_CRC32C_INIT, dwDone = 0;
+	while (dwDone < pDirEntry->dwStoredSize)
+	{
+		DWORD dwChunkSize = (std::min)(pDirEntry->dwStoredSize - dwDone, (DWORD)EFS_READ_CHUNK_SIZE);
+		const BYTE *lpbyChunk = ReadEFSData(pEFSFile, pDirEntry->dwOffset + dwDone, dwChunkSize, lpbyBuffer);
+		if (!lpbyChunk)
+			break;
+
+		dwChecksum = QChecksumCRC32C(dwChecksum, lpbyChunk, dwChunkSize);
+		dwDone += dwChunkSize;
+	}
+
+	free(lpbyBuffer);
+
+	*lpdwChecksum = dwChecksum;
+
+	return (dwDone == pDirEntry->dwStoredSize);
+}
+
+// Verifies the checksum of a file in an EFS file, if that hasn't been done already. Returns FALSE and sets the last error to ERROR_CRC if the file is corrupt.
+BOOL VerifyEFSFile(
+	// The EFS file containing the file
+	IN EFSFILEHANDLEFORREAD *pEFSFile,
+	// The index of the file in the directory
+	IN DWORD iDirEntry
+)
+{
+	assert(pEFSFile);
+	assert(iDirEntry < pEFSFile->nNumDirectoryEntries);
+
+	volatile LONG *lpnVerifyState = &pEFSFile->lpnVerifyStates[iDirEntry];
+
+	if (*lpnVerifyState == EFS_FILE_UNVERIFIED)
+	{
+		const EFSDIRECTORYENTRY *pDirEntry = &pEFSFile->pDirectory[iDirEntry];
+
+		// If the data can't be read, leave the file unverified, as the problem may not be the file's fault
+		DWORD dwChecksum;
+		if (!ChecksumEFSFile(pEFSFile, pDirEntry, &dwChecksum))
+			return FALSE;
+
+		// If two threads verify the same file at once, they'll both come to the same conclusion, so it doesn't matter which one wins
+		InterlockedCompareExchange(lpnVerifyState, 
+			(dwChecksum == pDirEntry->dwChecksum) ? EFS_FILE_VERIFIED : EFS_FILE_CORRUPT, 
+			EFS_FILE_UNVERIFIED);
+	}
+
+	if (*lpnVerifyState == EFS_FILE_CORRUPT)
+	{
+		SetLastError(ERROR_CRC);
+
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+// Checks the block checksums of part of a file's stored data, without changing the file's verification state unless a block is corrupt. The file must have block checksums. Returns FALSE and sets the last error to ERROR_CRC if the data is corrupt.
+BOOL VerifyEFSStoredData(
+	// The EFS file containing the file
+	IN EFSFILEHANDLEFORREAD *pEFSFile,
+	// The index of the file in the directory
+	IN DWORD iDirEntry,
+	// The part of the stored data to check, relative to the start of the file's data
+	IN DWORD dwStoredOffset,
+	IN DWORD dwSize
+)
+{
+	assert(pEFSFile);
+	assert(iDirEntry < pEFSFile->nNumDirectoryEntries);
+
+	const EFSDIRECTORYENTRY *pDirEntry = &pEFSFile->pDirectory[iDirEntry];
+
+	assert(pDirEntry->dwBlockChecksumsSize);
+	assert(dwStoredOffset + dwSize <= pDirEntry->dwStoredSize);
+
+	if (!dwSize)
+		return TRUE;
+
+	// Every block the range touches is checked whole
+	DWORD iFirstBlock = dwStoredOffset / EFS_CHECKSUM_BLOCK_SIZE,
+		iLastBlock = (dwStoredOffset + dwSize - 1) / EFS_CHECKSUM_BLOCK_SIZE,
+		nNumBlocks = iLastBlock - iFirstBlock + 1;
+
+	// The checksums go at the start of the buffer; blocks read from disk go after them
+	LPBYTE lpbyBuffer = (LPBYTE)malloc((nNumBlocks * sizeof(DWORD)) + (pEFSFile->lpbyEFSData ? 0 : EFS_CHECKSUM_BLOCK_SIZE));
+	if (!lpbyBuffer)
+		return FALSE;
+
+	LPDWORD lpdwChecksums = (LPDWORD)lpbyBuffer;
+	const BYTE *lpbyChecksums = ReadEFSData(pEFSFile, pDirEntry->dwOffset + pDirEntry->dwStoredSize + (iFirstBlock * sizeof(DWORD)), 
+		nNumBlocks * sizeof(DWORD), lpbyBuffer);
+	BOOL bRead = (lpbyChecksums != NULL), bIntact = TRUE;
+
+	// The table may not be aligned
+	if (lpbyChecksums && (lpbyChecksums != lpbyBuffer))
+		memcpy(lpdwChecksums, lpbyChecksums, nNumBlocks * sizeof(DWORD));
+
+	for (DWORD iCurBlock = iFirstBlock; bRead && bIntact && (iCurBlock <= iLastBlock); iCurBlock++)
+	{
+		DWORD dwBlockOffset = iCurBlock * EFS_CHECKSUM_BLOCK_SIZE,
+			dwBlockSize = (std::min)(pDirEntry->dwStoredSize - dwBlockOffset, (DWORD)EFS_CHECKSUM_BLOCK_SIZE);
+		const BYTE *lpbyBlock = ReadEFSData(pEFSFile, pDirEntry->dwOffset + dwBlockOffset, dwBlockSize, lpbyBuffer + (nNumBlocks * sizeof(DWORD)));
+
+		bRead = (lpbyBlock != NULL);
+		bIntact = !bRead || (QChecksumCRC32C(QCHECKSUM_CRC32C_INIT, lpbyBlock, dwBlockSize) == lpdwChecksums[iCurBlock - iFirstBlock]);
+	}
+
+	free(lpbyBuffer);
+
+	// As in VerifyEFSFile, a failed read doesn't make the file corrupt, but a bad block does
+	if (!bIntact)
+	{
+		InterlockedCompareExchange(&pEFSFile->lpnVerifyStates[iDirEntry], EFS_FILE_CORRUPT, EFS_FILE_UNVERIFIED);
+		SetLastError(ERROR_CRC);
+	}
+
+	return bRead && bIntact;
+}
+
+// Checks the part of a file that a read of part of it will use, before it is read. Files with block checksums that haven't been verified whole have only the blocks of stored data holding that part checked - for compressed files, the entries of the block table and the compressed blocks - and the file's verification state is left alone, so that another read checks its own part; other files are verified whole, with VerifyEFSFile. Returns FALSE if the file is corrupt or couldn't be read.
+BOOL VerifyEFSFileRange(
+	// The EFS file containing the file
+	IN EFSFILEHANDLEFORREAD *pEFSFile,
+	// The index of the file in the directory
+	IN DWORD iDirEntry,
+	// The part of the file's data to be read, which must lie within the file
+	IN DWORD dwOffset,
+	IN DWORD dwSize
+)
+{
+	assert(pEFSFile);
+	assert(iDirEntry < pEFSFile->nNumDirectoryEntries);
+
+	const EFSDIRECTORYENTRY *pDirEntry = &pEFSFile->pDirectory[iDirEntry];
+
+	assert(dwOffset + dwSize <= pDirEntry->dwSize);
+
+	if (!pDirEntry->dwBlockChecksumsSize || (pEFSFile->lpnVerifyStates[iDirEntry] != EFS_FILE_UNVERIFIED))
+		return VerifyEFSFile(pEFSFile, iDirEntry);
+
+	if (!dwSize)
+		return TRUE;
+
+	if (!(pDirEntry->dwFlags & EFS_FILE_COMPRESSED))
+		return VerifyEFSStoredData(pEFSFile, iDirEntry, dwOffset, dwSize);
+
+	// The entries of the block table for the blocks read, and the one after the last, which marks its end
+	DWORD iFirstBlock = dwOffset / EFS_COMPRESSION_BLOCK_SIZE,
+		iLastBlock = (dwOffset + dwSize - 1) / EFS_COMPRESSION_BLOCK_SIZE,
+		nNumBlocks = (pDirEntry->dwSize + EFS_COMPRESSION_BLOCK_SIZE - 1) / EFS_COMPRESSION_BLOCK_SIZE;
+
+	if ((nNumBlocks + 1) * sizeof(DWORD) > pDirEntry->dwStoredSize)
+	{
+		SetLastError(ERROR_INVALID_DATA);
+
+		return FALSE;
+	}
+
+	if (!VerifyEFSStoredData(pEFSFile, iDirEntry, iFirstBlock * sizeof(DWORD), (iLastBlock - iFirstBlock + 2) * sizeof(DWORD)))
+		return FALSE;
+
+	// Then the compressed blocks themselves. ReadEFSFileBlock checks each block's entries more closely.
+	DWORD dwStart, dwEnd;
+	const BYTE *lpbyStart = ReadEFSData(pEFSFile, pDirEntry->dwOffset + (iFirstBlock * sizeof(DWORD)), sizeof(DWORD), (LPBYTE)&dwStart),
+		*lpbyEnd = ReadEFSData(pEFSFile, pDirEntry->dwOffset + ((iLastBlock + 1) * sizeof(DWORD)), sizeof(DWORD), (LPBYTE)&dwEnd);
+	if (!lpbyStart || !lpbyEnd)
+		return FALSE;
+
+	// The table may not be aligned
+	if (lpbyStart != (LPBYTE)&dwStart)
+		memcpy(&dwStart, lpbyStart, sizeof(DWORD));
+	if (lpbyEnd != (LPBYTE)&dwEnd)
+		memcpy(&dwEnd, lpbyEnd, sizeof(DWORD));
+
+	if ((dwEnd < dwStart) || (dwEnd > pDirEntry->dwStoredSize))
+	{
+		SetLastError(ERROR_INVALID_DATA);
+
+		return FALSE;
+	}
+
+	return VerifyEFSStoredData(pEFSFile, iDirEntry, dwStart, dwEnd - dwStart);
+}
+
+// Gets the uncompressed data of one block of a compressed file. Blocks that are stored uncompressed in memory are returned directly from the EFS file; others are read or decompressed into lpbyBuffer. Returns FALSE, and sets the last error to ERROR_INVALID_DATA if the block table or the block is corrupt.
+BOOL ReadEFSFileBlock(
+	// The EFS file containing the file
+	IN const EFSFILEHANDLEFORREAD *pEFSFile,
+	// The directory entry of the compressed file
+	IN const EFSDIRECTORYENTRY *pDirEntry,
+	// The index of the block to read
+	IN DWORD iBlock,
+	// A buffer of at least EFS_COMPRESSION_BLOCK_SIZE bytes to put the block's data in
+	OUT LPBYTE lpbyBuffer,
+	// A buffer of at least EFS_COMPRESSION_BLOCK_SIZE bytes to read compressed data into. Not used if the EFS file is in memory.
+	OUT LPBYTE lpbyStoredBuffer,
+	// The uncompressed data of the block
+	OUT const BYTE **lplpbyBlockData,
+	// The uncompressed size of the block
+	OUT LPDWORD lpdwBlockSize
+)
+{
+	assert(pEFSFile);
+	assert(pDirEntry);
+	assert(pDirEntry->dwFlags & EFS_FILE_COMPRESSED);
+	assert(lpbyBuffer);
+	assert(lplpbyBlockData);
+	assert(lpdwBlockSize);
+
+	DWORD nNumBlocks = (pDirEntry->dwSize + EFS_COMPRESSION_BLOCK_SIZE - 1) / EFS_COMPRESSION_BLOCK_SIZE,
+		dwBlockTableSize = (nNumBlocks + 1) * sizeof(DWORD);
+
+	assert(iBlock < nNumBlocks);
+
+	// The block table must fit in the stored data
+	if (dwBlockTableSize > pDirEntry->dwStoredSize)
+	{
+		SetLastError(ERROR_INVALID_DATA);
+
+		return FALSE;
+	}
+
+	// Files are packed end-to-end, so the table may not be aligned
+	DWORD dwBlockOffsets[2];
+	const BYTE *lpbyBlockOffsets = ReadEFSData(pEFSFile, pDirEntry->dwOffset + (iBlock * sizeof(DWORD)), sizeof(dwBlockOffsets), (LPBYTE)dwBlockOffsets);
+	if (!lpbyBlockOffsets)
+		return FALSE;
+
+	if (lpbyBlockOffsets != (LPBYTE)dwBlockOffsets)
+		memcpy(dwBlockOffsets, lpbyBlockOffsets, sizeof(dwBlockOffsets));
+
+	// The block must lie between the table and the end of the stored data, and can't be bigger compressed than uncompressed
+	DWORD dwBlockSize = (std::min)(pDirEntry->dwSize - (iBlock * EFS_COMPRESSION_BLOCK_SIZE), (DWORD)EFS_COMPRESSION_BLOCK_SIZE);
+	if ((dwBlockOffsets[0] < dwBlockTableSize) ||
+		(dwBlockOffsets[1] < dwBlockOffsets[0]) ||
+		(dwBlockOffsets[1] > pDirEntry->dwStoredSize) ||
+		(dwBlockOffsets[1] - dwBlockOffsets[0] > dwBlockSize))
+	{
+		SetLastError(ERROR_INVALID_DATA);
+
+		return FALSE;
+	}
+
+	DWORD dwStoredBlockSize = dwBlockOffsets[1] - dwBlockOffsets[0];
+
+	*lpdwBlockSize = dwBlockSize;
+
+	// Blocks that didn't compress are stored as they are
+	if (dwStoredBlockSize == dwBlockSize)
+	{
+		*lplpbyBlockData = ReadEFSData(pEFSFile, pDirEntry->dwOffset + dwBlockOffsets[0], dwBlockSize, lpbyBuffer);
+
+		return (*lplpbyBlockData != NULL);
+	}
+
+	const BYTE *lpbyStoredBlock = ReadEFSData(pEFSFile, pDirEntry->dwOffset + dwBlockOffsets[0], dwStoredBlockSize, lpbyStoredBuffer);
+	if (!lpbyStoredBlock)
+		return FALSE;
+
+	if (!QDecompressLZ4(lpbyStoredBlock, dwStoredBlockSize, lpbyBuffer, dwBlockSize))
+	{
+		SetLastError(ERROR_INVALID_DATA);
+
+		return FALSE;
+	}
+
+	*lplpbyBlockData = lpbyBuffer;
+
+	return TRUE;
+}
+
+// Reads a whole file into memory, decompressing it if necessary. The memory is owned by the handle, and is kept for future lookups. Returns NULL if the file is corrupt, can't be read, or memory couldn't be allocated.
+LPCVOID LoadEFSFileIntoMemory(
+	// The EFS file containing the file
+	IN EFSFILEHANDLEFORREAD *pEFSFile,
+	// The index of the file in the directory
+	IN DWORD iDirEntry
+)
+{
+	assert(pEFSFile);
+	assert(iDirEntry < pEFSFile->nNumDirectoryEntries);
+
+	LPVOID lpvFileData = pEFSFile->lplpvLoadedFiles[iDirEntry];
+	if (lpvFileData)
+		return lpvFileData;
+
+	const EFSDIRECTORYENTRY *pDirEntry = &pEFSFile->pDirectory[iDirEntry];
+
+	LPBYTE lpbyFileData = (LPBYTE)malloc((std::max)(pDirEntry->dwSize, (DWORD)1));
+	if (!lpbyFileData)
+		return NULL;
+
+	BOOL bLoaded = FALSE;
+	if (pDirEntry->dwFlags & EFS_FILE_COMPRESSED)
+	{
+		// Decompress each block straight into place. Compressed data read from disk needs a place to go first.
+		LPBYTE lpbyStoredBuffer = pEFSFile->lpbyEFSData ? NULL : (LPBYTE)malloc(EFS_COMPRESSION_BLOCK_SIZE);
+		DWORD nNumBlocks = (pDirEntry->dwSize + EFS_COMPRESSION_BLOCK_SIZE - 1) / EFS_COMPRESSION_BLOCK_SIZE,
+			iCurBlock = 0;
+
+		if (pEFSFile->lpbyEFSData || lpbyStoredBuffer)
+		{
+			for (iCurBlock = 0; iCurBlock < nNumBlocks; iCurBlock++)
+			{
+				LPBYTE lpbyBlockDest = lpbyFileData + (iCurBlock * EFS_COMPRESSION_BLOCK_SIZE);
+				const BYTE *lpbyBlockData;
+				DWORD dwBlockSize;
+
+				if (!ReadEFSFileBlock(pEFSFile, pDirEntry, iCurBlock, lpbyBlockDest, lpbyStoredBuffer, &lpbyBlockData, &dwBlockSize))
+					break;
+
+				if (lpbyBlockData != lpbyBlockDest)
+					memcpy(lpbyBlockDest, lpbyBlockData, dwBlockSize);
+			}
+
+			bLoaded = (iCurBlock == nNumBlocks);
+		}
+
+		free(lpbyStoredBuffer);
+	}
+	else
+	{
+		// Only happens when the EFS file isn't in memory, as otherwise there's nothing to load
+		assert(!pEFSFile->lpbyEFSData);
+
+		bLoaded = (ReadEFSData(pEFSFile, pDirEntry->dwOffset, pDirEntry->dwSize, lpbyFileData) != NULL);
+	}
+
+	if (!bLoaded)
+	{
+		free(lpbyFileData);
+
+		return NULL;
+	}
+
+	// Another thread may have loaded the same file at the same time. If so, use theirs, so that everyone gets the same pointer.
+	lpvFileData = InterlockedCompareExchangePointer(&pEFSFile->lplpvLoadedFiles[iDirEntry], lpbyFileData, NULL);
+	if (lpvFileData)
+	{
+		free(lpbyFileData);
+
+		return lpvFileData;
+	}
+
+	return lpbyFileData;
+}
+
+// Writes the data of a file to a file on disk, a piece at a time. Compressed files are decompressed one block at a time.
+BOOL WriteEFSFileToDisk(
+	// The EFS file containing the file
+	IN const EFSFILEHANDLEFORREAD *pEFSFile,
+	// The directory entry of the file
+	IN const EFSDIRECTORYENTRY *pDirEntry,
+	// The file to write to
+	IN HANDLE hOutFile
+)
+{
+	assert(pEFSFile);
+	assert(pDirEntry);
+	assert(hOutFile != INVALID_HANDLE_VALUE);
+
+	DWORD dwBytesWritten;
+
+	// Uncompressed files in memory can be written in one shot
+	if (!(pDirEntry->dwFlags & EFS_FILE_COMPRESSED) && pEFSFile->lpbyEFSData)
+		return WriteFile(hOutFile, pEFSFile->lpbyEFSData + pDirEntry->dwOffset, pDirEntry->dwSize, &dwBytesWritten, NULL)
+			&& (dwBytesWritten == pDirEntry->dwSize);
+
+	// Everything else goes through a buffer. Compressed files read from disk need a second one for the compressed data.
+	LPBYTE lpbyBuffer = (LPBYTE)malloc(EFS_READ_CHUNK_SIZE * 2);
+	if (!lpbyBuffer)
+		return FALSE;
+
+	DWORD dwDone = 0, iCurBlock = 0;
+	while (dwDone < pDirEntry->dwSize)
+	{
+		const BYTE *lpbyChunk;
+		DWORD dwChunkSize;
+
+		if (pDirEntry->dwFlags & EFS_FILE_COMPRESSED)
+		{
+			if (!ReadEFSFileBlock(pEFSFile, pDirEntry, iCurBlock++, lpbyBuffer, lpbyBuffer + EFS_READ_CHUNK_SIZE, &lpbyChunk, &dwChunkSize))
+				break;
+		}
+		else
+		{
+			dwChunkSize = (std::min)(pDirEntry->dwSize - dwDone, (DWORD)EFS_READ_CHUNK_SIZE);
+			lpbyChunk = ReadEFSData(pEFSFile, pDirEntry->dwOffset + dwDone, dwChunkSize, lpbyBuffer);
+			if (!lpbyChunk)
+				break;
+		}
+
+		if (!WriteFile(hOutFile, lpbyChunk, dwChunkSize, &dwBytesWritten, NULL)
+			|| (dwBytesWritten != dwChunkSize))
+			break;
+
+		dwDone += dwChunkSize;
+	}
+
+	free(lpbyBuffer);
+
+	return (dwDone == pDirEntry->dwSize);
+}
 
 EFSHANDLEFORREAD WINAPI GetEFSHandleFromMappedFile(
 	IN const BYTE *lpbyFileData, 
@@ -828,33 +2154,101 @@ EFSHANDLEFORREAD WINAPI GetEFSHandleFromMappedFile(
 
 	// Basically the exact same thing we did in FindEFSHeader: scan the file every SECTOR_SIZE bytes for an EFS header. If we can't find one, fail.
 	DWORD dwFileOffset = 0;
-	EFSFILEHEADER *pHeader;
 	while (dwFileOffset + sizeof(EFSFILEHEADER) < dwFileSize)
 	{
-		pHeader = (EFSFILEHEADER *)(lpbyFileData + dwFileOffset);
-
 		// Does it look like an EFS header?
-		if ((pHeader->dwSignature == EFS_SIGNATURE) &&
+		const EFSFILEHEADER *pHeader = (const EFSFILEHEADER *)(lpbyFileData + dwFileOffset);
+		if (IsValidEFSHeader(pHeader, dwFileOffset, dwFileSize))
+		{
+			// Yes. Check its directory for validity, and build the handle if it's good.
+			EFSFILEHANDLEFORREAD *pEFSFile = CreateEFSReadHandle(pHeader, lpbyFileData + dwFileOffset + pHeader->dwDirectoryOffset, dwFileSize - dwFileOffset);
+			if (pEFSFile)
+			{
+				pEFSFile->lpbyEFSData = lpbyFileData + dwFileOffset;
+
+				return (EFSHANDLEFORREAD)pEFSFile;
+			}
+		}
 
-			(pHeader->dwVersion == 0x00000001) &&
+		dwFileOffset += SECTOR_SIZE;
+	}
+
+	return NULL;
+}
+
+EFSHANDLEFORREAD WINAPI OpenEFSFileForRead(
+	IN HANDLE hFile,
+	IN DWORD dwSearchOffset,
+	IN DWORD dwSearchLimit
+)
+{
+	assert(hFile != INVALID_HANDLE_VALUE);
+	assert(!dwSearchLimit || (dwSearchLimit >= dwSearchOffset));
+
+	// Same as GetEFSHandleFromMappedFile, but the header and directory have to be read in
+	DWORD dwFileSize = GetFileSize(hFile, NULL), dwHeaderOffset;
+	while (FindEFSHeader(hFile, dwSearchOffset, dwSearchLimit, &dwHeaderOffset))
+	{
+		EFSFILEHEADER header;
+		DWORD dwBytesRead;
+
+		SetFilePointer(hFile, dwHeaderOffset, NULL, FILE_BEGIN);
+		if (!ReadFile(hFile, &header, sizeof(EFSFILEHEADER), &dwBytesRead, NULL)
+			|| (dwBytesRead != sizeof(EFSFILEHEADER)))
+			return NULL;
+
+		// FindEFSHeader made sure the directory is within the file
+		DWORD nDirectorySize = header.dwNumDirectoryEntries * GetEFSDirectoryEntrySize(&header);
+		LPBYTE lpbyStoredDirectory = (LPBYTE)malloc((std::max)(nDirectorySize, (DWORD)1));
+		if (!lpbyStoredDirectory)
+			return NULL;
+
+		EFSFILEHANDLEFORREAD *pEFSFile = NULL;
 
-			((dwFileOffset + pHeader->dwFileSize) <= dwFileSize) &&
-			((dwFileOffset + pHeader->dwDirectoryOffset + (pHeader->dwNumDirectoryEntries * sizeof(EFSDIRECTORYENTRY))) <= dwFileSize))
+		SetFilePointer(hFile, dwHeaderOffset + header.dwDirectoryOffset, NULL, FILE_BEGIN);
+		if (ReadFile(hFile, lpbyStoredDirectory, nDirectorySize, &dwBytesRead, NULL)
+			&& (dwBytesRead == nDirectorySize))
+			pEFSFile = CreateEFSReadHandle(&header, lpbyStoredDirectory, dwFileSize - dwHeaderOffset);
+
+		free(lpbyStoredDirectory);
+
+		if (pEFSFile)
 		{
-			// Yes. Check its directory for validity.
-			EFSDIRECTORYENTRY *pDirectory = (EFSDIRECTORYENTRY *)(lpbyFileData + dwFileOffset + pHeader->dwDirectoryOffset);
-			DWORD dwInsertPoint;
+			pEFSFile->hFile = hFile;
+			pEFSFile->dwHeaderOffset = dwHeaderOffset;
 
-			if (CheckEFSDirectoryAndFindInsertPoint(pDirectory, pHeader->dwNumDirectoryEntries, dwFileSize, &dwInsertPoint))
-				return (EFSHANDLEFORREAD)(pHeader);	// Directory looks good
+			return (EFSHANDLEFORREAD)pEFSFile;
 		}
 
-		dwFileOffset += SECTOR_SIZE;
+		// Keep looking past this one
+		dwSearchOffset = dwHeaderOffset + SECTOR_SIZE;
 	}
 
 	return NULL;
 }
 
+void WINAPI CloseEFSFileForRead(
+	IN EFSHANDLEFORREAD hEFSFile
+)
+{
+	if (!hEFSFile)
+		return;
+
+	EFSFILEHANDLEFORREAD *pEFSFile = (EFSFILEHANDLEFORREAD *)hEFSFile;
+
+	for (DWORD iCurDirEntry = 0; iCurDirEntry < pEFSFile->nNumDirectoryEntries; iCurDirEntry++)
+	{
+		free(pEFSFile->lplpvLoadedFiles[iCurDirEntry]);
+		free(pEFSFile->lplpszTempFiles[iCurDirEntry]);
+	}
+
+	free(pEFSFile->pDirectory);
+	free((LPVOID)pEFSFile->lpnVerifyStates);
+	free((LPVOID)pEFSFile->lplpvLoadedFiles);
+	free((LPVOID)pEFSFile->lplpszTempFiles);
+	free(pEFSFile);
+}
+
 BOOL WINAPI LookupEFSFile(
 	IN EFSHANDLEFORREAD hEFSFile,
 	IN DWORD dwComponentID,
@@ -868,26 +2262,141 @@ BOOL WINAPI LookupEFSFile(
 	assert(lplpvFileData);
 	assert(lpdwFileSize);
 
-	// Convert the read handle to the header pointer
-	EFSFILEHEADER *pEFSHeader = (EFSFILEHEADER *)hEFSFile;
+	// Dereference the handle
+	EFSFILEHANDLEFORREAD *pEFSFile = (EFSFILEHANDLEFORREAD *)hEFSFile;
+
+	// If there are no files in the archive, obviously the file doesn't exist
+	if (!pEFSFile->nNumDirectoryEntries)
+		return FALSE;
+
+	// See if the file exists in the EFS archive
+	DWORD iDirEntry = FindFileInEFSFile(pEFSFile->pDirectory, pEFSFile->nNumDirectoryEntries, dwComponentID, dwFileID);
+	if (iDirEntry == (DWORD)-1)
+		return FALSE;	// It doesn't
+
+	// It does. Make sure it's intact before handing it out.
+	if (!VerifyEFSFile(pEFSFile, iDirEntry))
+		return FALSE;
+
+	// Get the requested info. Uncompressed files in memory can be returned as they are; anything else has to be loaded first.
+	const EFSDIRECTORYENTRY *pDirEntry = &pEFSFile->pDirectory[iDirEntry];
+
+	if ((pDirEntry->dwFlags & EFS_FILE_COMPRESSED) || !pEFSFile->lpbyEFSData)
+	{
+		LPCVOID lpvFileData = LoadEFSFileIntoMemory(pEFSFile, iDirEntry);
+		if (!lpvFileData)
+			return FALSE;
+
+		*lplpvFileData = lpvFileData;
+	}
+	else
+		*lplpvFileData = (LPCVOID)(pEFSFile->lpbyEFSData + pDirEntry->dwOffset);
+
+	*lpdwFileSize = pDirEntry->dwSize;
+
+	if (lpdwFileData)
+		*lpdwFileData = pDirEntry->dwData;
+
+	return TRUE;
+}
+
+BOOL WINAPI ReadEFSFile(
+	IN EFSHANDLEFORREAD hEFSFile,
+	IN DWORD dwComponentID,
+	IN DWORD dwFileID,
+	IN DWORD dwOffset,
+	OUT LPVOID lpvBuffer,
+	IN DWORD nBytesToRead,
+	OUT LPDWORD lpnBytesRead
+)
+{
+	assert(hEFSFile);
+	assert(lpvBuffer || !nBytesToRead);
+	assert(lpnBytesRead);
+
+	// Dereference the handle
+	EFSFILEHANDLEFORREAD *pEFSFile = (EFSFILEHANDLEFORREAD *)hEFSFile;
+
+	*lpnBytesRead = 0;
+
+	// Find the file in the EFS archive (if it exists)
+	DWORD iDirEntry = FindFileInEFSFile(pEFSFile->pDirectory, pEFSFile->nNumDirectoryEntries, dwComponentID, dwFileID);
+	if (iDirEntry == (DWORD)-1)
+		return FALSE;
+
+	const EFSDIRECTORYENTRY *pDirEntry = &pEFSFile->pDirectory[iDirEntry];
+
+	// Cut the read short at the end of the file, then make sure the part to be read is intact
+	DWORD dwReadSize = (dwOffset < pDirEntry->dwSize) ? (std::min)(nBytesToRead, pDirEntry->dwSize - dwOffset) : 0;
+	if (!VerifyEFSFileRange(pEFSFile, iDirEntry, (std::min)(dwOffset, pDirEntry->dwSize), dwReadSize))
+		return FALSE;
+
+	if (!dwReadSize)
+		return TRUE;
+
+	LPBYTE lpbyBuffer = (LPBYTE)lpvBuffer;
+
+	// If the whole file is already in memory, there's nothing to read
+	const BYTE *lpbyFileData = (const BYTE *)pEFSFile->lplpvLoadedFiles[iDirEntry];
+	if (!lpbyFileData && !(pDirEntry->dwFlags & EFS_FILE_COMPRESSED) && pEFSFile->lpbyEFSData)
+		lpbyFileData = pEFSFile->lpbyEFSData + pDirEntry->dwOffset;
+
+	if (lpbyFileData)
+	{
+		memcpy(lpbyBuffer, lpbyFileData + dwOffset, dwReadSize);
+		*lpnBytesRead = dwReadSize;
+
+		return TRUE;
+	}
+
+	// Uncompressed files on disk can be read straight into the caller's buffer
+	if (!(pDirEntry->dwFlags & EFS_FILE_COMPRESSED))
+	{
+		if (!ReadEFSData(pEFSFile, pDirEntry->dwOffset + dwOffset, dwReadSize, lpbyBuffer))
+			return FALSE;
+
+		*lpnBytesRead = dwReadSize;
 
-	// If there are no files in the archive, obviously the file doesn't exist
-	if (!pEFSHeader->dwNumDirectoryEntries)
+		return TRUE;
+	}
+
+	// Compressed files have to be decompressed a block at a time. Blocks that lie entirely within the range are decompressed straight into place; the blocks at either end go through a buffer, and only the part that was asked for gets copied. Compressed data read from disk needs a place to go first.
+	LPBYTE lpbyBlockBuffer = (LPBYTE)malloc(EFS_COMPRESSION_BLOCK_SIZE * 2);
+	if (!lpbyBlockBuffer)
 		return FALSE;
 
-	// See if the file exists in the EFS archive
-	EFSDIRECTORYENTRY *pDirectory = (EFSDIRECTORYENTRY *)((LPBYTE)pEFSHeader + pEFSHeader->dwDirectoryOffset);
+	LPBYTE lpbyStoredBuffer = lpbyBlockBuffer + EFS_COMPRESSION_BLOCK_SIZE;
+	DWORD dwDone = 0;
 
-	DWORD iDirEntry = FindFileInEFSFile(pDirectory, pEFSHeader->dwNumDirectoryEntries, dwComponentID, dwFileID);
-	if (iDirEntry == (DWORD)-1)
-		return FALSE;	// It doesn't
+	while (dwDone < dwReadSize)
+	{
+		DWORD dwFileOffset = dwOffset + dwDone,
+			iCurBlock = dwFileOffset / EFS_COMPRESSION_BLOCK_SIZE,
+			dwBlockOffset = dwFileOffset % EFS_COMPRESSION_BLOCK_SIZE,
+			dwCopySize = (std::min)(dwReadSize - dwDone, (DWORD)EFS_COMPRESSION_BLOCK_SIZE - dwBlockOffset);
+
+		// Whole blocks can go straight into the caller's buffer. The last block of the file may be shorter than the rest, which is fine, as the read was already cut short at the end of the file.
+		BOOL bWholeBlock = !dwBlockOffset &&
+			((dwCopySize == EFS_COMPRESSION_BLOCK_SIZE) || (dwFileOffset + dwCopySize == pDirEntry->dwSize));
+		LPBYTE lpbyBlockDest = bWholeBlock ? lpbyBuffer + dwDone : lpbyBlockBuffer;
+		const BYTE *lpbyBlockData;
+		DWORD dwBlockSize;
+
+		if (!ReadEFSFileBlock(pEFSFile, pDirEntry, iCurBlock, lpbyBlockDest, lpbyStoredBuffer, &lpbyBlockData, &dwBlockSize))
+			break;
 
-	// It does. Get the requested info.
-	*lplpvFileData = (LPVOID)((LPBYTE)pEFSHeader + pDirectory[iDirEntry].dwOffset);
-	*lpdwFileSize = pDirectory[iDirEntry].dwSize;
+		if (lpbyBlockData + dwBlockOffset != lpbyBuffer + dwDone)
+			memcpy(lpbyBuffer + dwDone, lpbyBlockData + dwBlockOffset, dwCopySize);
 
-	if (lpdwFileData)
-		*lpdwFileData = pDirectory[iDirEntry].dwData;
+		dwDone += dwCopySize;
+	}
+
+	free(lpbyBlockBuffer);
+
+	if (dwDone != dwReadSize)
+		return FALSE;
+
+	*lpnBytesRead = dwReadSize;
 
 	return TRUE;
 }
@@ -899,13 +2408,16 @@ BOOL WINAPI ExtractEFSFile(
 	IN LPCSTR lpszFileName
 )
 {
+	assert(hEFSFile);
 	assert(lpszFileName);
 
-	// This is exactly the same procedure for ExtractResource
-	// Find the file in the EFS archive (if it exists)
-	LPCVOID lpvFileData;
-	DWORD dwFileSize;
-	if (!LookupEFSFile(hEFSFile, dwComponentID, dwFileID, &lpvFileData, &dwFileSize, NULL))
+	// Dereference the handle
+	EFSFILEHANDLEFORREAD *pEFSFile = (EFSFILEHANDLEFORREAD *)hEFSFile;
+
+	// This is mostly the same procedure as ExtractResource
+	// Find the file in the EFS archive (if it exists), and make sure it's intact
+	DWORD iDirEntry = FindFileInEFSFile(pEFSFile->pDirectory, pEFSFile->nNumDirectoryEntries, dwComponentID, dwFileID);
+	if ((iDirEntry == (DWORD)-1) || !VerifyEFSFile(pEFSFile, iDirEntry))
 		return FALSE;
 
 	// Open the output file
@@ -913,18 +2425,19 @@ BOOL WINAPI ExtractEFSFile(
 	if (hOutFile == INVALID_HANDLE_VALUE)
 		return FALSE;
 
-	BOOL bRetVal = FALSE;
-
-	// Write the file in one shot, as it's all mapped into memory
-	DWORD dwBytesRead;
-	if (WriteFile(hOutFile, lpvFileData, dwFileSize, &dwBytesRead, NULL)
-		&& (dwBytesRead == dwFileSize))
+	// Set the size of the file before writing it, so that the file system can allocate all the space at once, rather than extending the file with every write. This matters when several files are extracted at once.
+	DWORD dwFileSize = pEFSFile->pDirectory[iDirEntry].dwSize;
+	if (dwFileSize)
 	{
+		SetFilePointer(hOutFile, dwFileSize, NULL, FILE_BEGIN);
 		SetEndOfFile(hOutFile);
-
-		bRetVal = TRUE;
+		SetFilePointer(hOutFile, 0, NULL, FILE_BEGIN);
 	}
 
+	BOOL bRetVal = WriteEFSFileToDisk(pEFSFile, &pEFSFile->pDirectory[iDirEntry], hOutFile);
+	if (bRetVal)
+		SetEndOfFile(hOutFile);
+
 	CloseHandle(hOutFile);
 
 	// Delete the file if extraction failed
@@ -934,6 +2447,50 @@ BOOL WINAPI ExtractEFSFile(
 	return bRetVal;
 }
 
+// Tries to create a temporary file for a file by hard linking to the temporary file of another file with the same data, which saves writing the data again. Returns FALSE if there is no such file, or the link couldn't be made (e.g. the file system doesn't support hard links).
+BOOL LinkToExtractedDuplicate(
+	// The EFS file containing the file
+	IN EFSFILEHANDLEFORREAD *pEFSFile,
+	// The index of the file in the directory
+	IN DWORD iDirEntry,
+	// The name of the link to create. Any existing file by that name is deleted.
+	IN LPCSTR lpszFileName
+)
+{
+	assert(pEFSFile);
+	assert(iDirEntry < pEFSFile->nNumDirectoryEntries);
+	assert(lpszFileName);
+
+	const EFSDIRECTORYENTRY *pDirEntry = &pEFSFile->pDirectory[iDirEntry];
+	if (!pDirEntry->dwStoredSize)
+		return FALSE;
+
+	// Files share data if they're stored in the same place
+	for (DWORD iCurDirEntry = 0; iCurDirEntry < pEFSFile->nNumDirectoryEntries; iCurDirEntry++)
+	{
+		const EFSDIRECTORYENTRY *pCurDirEntry = &pEFSFile->pDirectory[iCurDirEntry];
+		LPCSTR lpszExtractedFile = pEFSFile->lplpszTempFiles[iCurDirEntry];
+
+		if ((iCurDirEntry == iDirEntry) || !lpszExtractedFile ||
+			(pCurDirEntry->dwOffset != pDirEntry->dwOffset) ||
+			(pCurDirEntry->dwStoredSize != pDirEntry->dwStoredSize) ||
+			(pCurDirEntry->dwFlags != pDirEntry->dwFlags))
+			continue;
+
+		// GetTempFileName created the file to reserve the name, and the link can't replace it. If the link fails, the extraction will create the file again.
+		DeleteFile(lpszFileName);
+		if (!CreateHardLink(lpszFileName, lpszExtractedFile, NULL))
+			return FALSE;
+
+		// The data was verified when the other file was extracted
+		InterlockedCompareExchange(&pEFSFile->lpnVerifyStates[iDirEntry], EFS_FILE_VERIFIED, EFS_FILE_UNVERIFIED);
+
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
 BOOL WINAPI ExtractTempEFSFile(
 	IN EFSHANDLEFORREAD hEFSFile,
 	IN DWORD dwComponentID,
@@ -944,6 +2501,12 @@ BOOL WINAPI ExtractTempEFSFile(
 	assert(hEFSFile);
 	assert(lpszOutFileName);
 
+	EFSFILEHANDLEFORREAD *pEFSFile = (EFSFILEHANDLEFORREAD *)hEFSFile;
+
+	DWORD iDirEntry = FindFileInEFSFile(pEFSFile->pDirectory, pEFSFile->nNumDirectoryEntries, dwComponentID, dwFileID);
+	if (iDirEntry == (DWORD)-1)
+		return FALSE;
+
 	// Once more, as before
 	// Get a unique file name in the Windows temporary file path
 	char szTempDir[MAX_PATH + 1], szTempFileName[MAX_PATH + 1];
@@ -951,9 +2514,13 @@ BOOL WINAPI ExtractTempEFSFile(
 		!GetTempFileName(szTempDir, "Embedded", 0, szTempFileName))
 		return FALSE;
 
-	// Do the extraction
-	if (!ExtractEFSFile(hEFSFile, dwComponentID, dwFileID, szTempFileName))
-		return FALSE;
+	// If a file with the same data has already been extracted, link to it
+	if (!LinkToExtractedDuplicate(pEFSFile, iDirEntry, szTempFileName))
+	{
+		// Otherwise do the extraction
+		if (!ExtractEFSFile(hEFSFile, dwComponentID, dwFileID, szTempFileName))
+			return FALSE;
+	}
 
 	// Add the extracted file to the temporary file list
 	if (!AddTempFileToList(szTempFileName))
@@ -963,11 +2530,385 @@ BOOL WINAPI ExtractTempEFSFile(
 		return FALSE;
 	}
 
+	// Remember where it went, for any duplicates extracted later. If this fails, duplicates will just be extracted normally.
+	LPSTR lpszSavedFileName = (LPSTR)malloc(strlen(szTempFileName) + 1);
+	if (lpszSavedFileName)
+	{
+		strcpy(lpszSavedFileName, szTempFileName);
+
+		if (InterlockedCompareExchangePointer((PVOID volatile *)&pEFSFile->lplpszTempFiles[iDirEntry], lpszSavedFileName, NULL))
+			free(lpszSavedFileName);	// The file was extracted twice; keep the first name
+	}
+
 	strcpy(lpszOutFileName, szTempFileName);
 
 	return TRUE;
 }
 
+// The name of the lock file in an extraction cache directory, and the extension of the cached files. Cached files are named after the SHA-256 of their data, in hex.
+#define EFS_CACHE_LOCK_FILE_NAME "Cache.lck"
+#define EFS_CACHE_FILE_EXTENSION ".dat"
+
+// Builds the path of a file in an extraction cache directory. Returns FALSE if the path would be too long.
+BOOL GetEFSCachePath(
+	// The cache directory
+	IN LPCSTR lpszCacheDir,
+	// The name of the file in the directory
+	IN LPCSTR lpszFileName,
+	// The full path of the file. Must be at least MAX_PATH + 1 characters.
+	OUT LPSTR lpszPath
+)
+{
+	assert(lpszCacheDir);
+	assert(lpszFileName);
+	assert(lpszPath);
+
+	size_t nDirLength = strlen(lpszCacheDir);
+	BOOL bNeedSeparator = nDirLength && (lpszCacheDir[nDirLength - 1] != '\\') && (lpszCacheDir[nDirLength - 1] != '/');
+
+	if (nDirLength + bNeedSeparator + strlen(lpszFileName) > MAX_PATH)
+		return FALSE;
+
+	sprintf(lpszPath, bNeedSeparator ? "%s\\%s" : "%s%s", lpszCacheDir, lpszFileName);
+
+	return TRUE;
+}
+
+// Locks an extraction cache directory, creating it if necessary, or one file in it. Only one process at a time may add a given file to the cache, but different files may be added at the same time; locking the whole cache (as TrimEFSCache does) excludes everyone else. The locks are byte ranges of one lock file: each file locks the byte at an offset taken from its SHA-256, and the whole cache locks all of them. Returns the handle of the lock file, which must be passed to UnlockEFSCache, or INVALID_HANDLE_VALUE on failure. If a process dies while holding a lock, Windows releases it.
+HANDLE LockEFSCache(
+	// The cache directory
+	IN LPCSTR lpszCacheDir,
+	// Whether to lock the whole cache, rather than one file
+	IN BOOL bWholeCache,
+	// Identifies the file to lock. Ignored if bWholeCache is TRUE.
+	IN DWORD dwChecksum
+)
+{
+	assert(lpszCacheDir);
+
+	char szLockFileName[MAX_PATH + 1];
+	if (!GetEFSCachePath(lpszCacheDir, EFS_CACHE_LOCK_FILE_NAME, szLockFileName))
+		return INVALID_HANDLE_VALUE;
+
+	// This fails if the directory already exists, which is fine
+	CreateDirectory(lpszCacheDir, NULL);
+
+	HANDLE hLockFile = CreateFile(szLockFileName, GENERIC_READ | GENERIC_WRITE, 
+		FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_ALWAYS, 0, NULL);
+	if (hLockFile == INVALID_HANDLE_VALUE)
+		return INVALID_HANDLE_VALUE;
+
+	// Wait for any other process using the same part of the cache to finish. Ranges may extend past the end of the file, so the lock file stays empty.
+	OVERLAPPED overlapped;
+	ZeroMemory(&overlapped, sizeof(overlapped));
+	overlapped.Offset = bWholeCache ? 0 : dwChecksum;
+
+	if (!LockFileEx(hLockFile, LOCKFILE_EXCLUSIVE_LOCK, 0, bWholeCache ? 0 : 1, bWholeCache ? 1 : 0, &overlapped))
+	{
+		CloseHandle(hLockFile);
+
+		return INVALID_HANDLE_VALUE;
+	}
+
+	return hLockFile;
+}
+
+// Unlocks an extraction cache directory or file locked with LockEFSCache
+void UnlockEFSCache(
+	// The handle returned by LockEFSCache
+	IN HANDLE hLockFile,
+	// The same as was passed to LockEFSCache
+	IN BOOL bWholeCache,
+	// The same as was passed to LockEFSCache
+	IN DWORD dwChecksum
+)
+{
+	assert(hLockFile != INVALID_HANDLE_VALUE);
+
+	OVERLAPPED overlapped;
+	ZeroMemory(&overlapped, sizeof(overlapped));
+	overlapped.Offset = bWholeCache ? 0 : dwChecksum;
+
+	UnlockFileEx(hLockFile, 0, bWholeCache ? 0 : 1, bWholeCache ? 1 : 0, &overlapped);
+	CloseHandle(hLockFile);
+}
+
+// Checks that an open file has the expected SHA-256, reading it from the beginning
+BOOL IsCachedEFSFileIntact(
+	// The file
+	IN HANDLE hFile,
+	// The SHA-256 the file should have
+	IN const BYTE *lpbyContentHash
+)
+{
+	assert(hFile != INVALID_HANDLE_VALUE);
+	assert(lpbyContentHash);
+
+	LPBYTE lpbyChunk = (LPBYTE)malloc(EFS_READ_CHUNK_SIZE);
+	if (!lpbyChunk)
+		return FALSE;
+
+	QCHECKSUMSHA256 hashContext;
+	QChecksumSHA256Init(&hashContext);
+
+	DWORD dwBytesRead;
+	BOOL bRead = (SetFilePointer(hFile, 0, NULL, FILE_BEGIN) != INVALID_SET_FILE_POINTER);
+	while (bRead && (bRead = ReadFile(hFile, lpbyChunk, EFS_READ_CHUNK_SIZE, &dwBytesRead, NULL)) && dwBytesRead)
+		QChecksumSHA256Update(&hashContext, lpbyChunk, dwBytesRead);
+
+	free(lpbyChunk);
+
+	BYTE byHash[QCHECKSUM_SHA256_SIZE];
+	QChecksumSHA256Final(&hashContext, byHash);
+
+	return bRead && !memcmp(byHash, lpbyContentHash, QCHECKSUM_SHA256_SIZE);
+}
+
+// Opens a file in an extraction cache, if it has the expected size and contents. The cache directory is shared by every SEMPQ, and anyone may put files in it, so the name isn't trusted: the contents are hashed before the file is used. The file is opened such that it can't be modified or deleted while the handle is open, so what was hashed is what gets loaded. Returns the handle of the file, or INVALID_HANDLE_VALUE if it doesn't exist or isn't the right file.
+HANDLE OpenCachedEFSFile(
+	// The path of the cached file
+	IN LPCSTR lpszFileName,
+	// The size the file should have
+	IN DWORD dwSize,
+	// The SHA-256 the file should have
+	IN const BYTE *lpbyContentHash
+)
+{
+	assert(lpszFileName);
+	assert(lpbyContentHash);
+
+	// FILE_WRITE_ATTRIBUTES is needed to update the access time. It doesn't count as writing for the purposes of sharing, so other processes may still load the file.
+	HANDLE hFile = CreateFile(lpszFileName, GENERIC_READ | FILE_WRITE_ATTRIBUTES, 
+		FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return INVALID_HANDLE_VALUE;
+
+	DWORD dwFileSizeHigh, dwFileSize = GetFileSize(hFile, &dwFileSizeHigh);
+	if ((dwFileSize == dwSize) && !dwFileSizeHigh && IsCachedEFSFileIntact(hFile, lpbyContentHash))
+	{
+		// Mark the file as recently used, for TrimEFSCache. Windows doesn't reliably do this itself.
+		FILETIME ftNow;
+		GetSystemTimeAsFileTime(&ftNow);
+		SetFileTime(hFile, NULL, &ftNow, NULL);
+
+		return hFile;
+	}
+
+	CloseHandle(hFile);
+
+	return INVALID_HANDLE_VALUE;
+}
+
+// Writes a file in an EFS file to a file in an extraction cache, after verifying it. The data is streamed to a temporary file in the cache directory first and then renamed, so that no other process can ever see a partially written file. Returns FALSE if the file is corrupt or could not be written, or if a file with that name already exists.
+BOOL WriteCachedEFSFile(
+	// The EFS file containing the file
+	IN EFSFILEHANDLEFORREAD *pEFSFile,
+	// The index of the file in the directory
+	IN DWORD iDirEntry,
+	// The cache directory
+	IN LPCSTR lpszCacheDir,
+	// The path of the cached file
+	IN LPCSTR lpszFileName
+)
+{
+	assert(pEFSFile);
+	assert(lpszCacheDir);
+	assert(lpszFileName);
+
+	if (!VerifyEFSFile(pEFSFile, iDirEntry))
+		return FALSE;
+
+	char szTempFileName[MAX_PATH + 1];
+	if (!GetTempFileName(lpszCacheDir, "EFS", 0, szTempFileName))
+		return FALSE;
+
+	HANDLE hFile = CreateFile(szTempFileName, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 0, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		DeleteFile(szTempFileName);
+
+		return FALSE;
+	}
+
+	BOOL bWritten = WriteEFSFileToDisk(pEFSFile, &pEFSFile->pDirectory[iDirEntry], hFile);
+
+	CloseHandle(hFile);
+
+	if (bWritten && MoveFileEx(szTempFileName, lpszFileName, 0))
+		return TRUE;
+
+	DeleteFile(szTempFileName);
+
+	return FALSE;
+}
+
+BOOL WINAPI ExtractCachedEFSFile(
+	IN EFSHANDLEFORREAD hEFSFile,
+	IN DWORD dwComponentID,
+	IN DWORD dwFileID,
+	IN LPCSTR lpszCacheDir,
+	OUT LPSTR lpszOutFileName
+)
+{
+	assert(hEFSFile);
+	assert(lpszCacheDir);
+	assert(lpszOutFileName);
+
+	EFSFILEHANDLEFORREAD *pEFSFile = (EFSFILEHANDLEFORREAD *)hEFSFile;
+
+	DWORD iDirEntry = FindFileInEFSFile(pEFSFile->pDirectory, pEFSFile->nNumDirectoryEntries, dwComponentID, dwFileID);
+	if (iDirEntry == (DWORD)-1)
+		return FALSE;
+
+	// The file's SHA-256 identifies it in the cache. Files without one (from older EFS files) can't be cached, as a CRC-32C can't tell them apart reliably enough to load them as code.
+	const EFSDIRECTORYENTRY *pDirEntry = &pEFSFile->pDirectory[iDirEntry];
+	if (!HasEFSContentHash(pDirEntry))
+		return FALSE;
+
+	char szCachedName[QCHECKSUM_SHA256_STRING_SIZE + sizeof(EFS_CACHE_FILE_EXTENSION)], szCachedFileName[MAX_PATH + 1];
+	QChecksumFormatSHA256(pDirEntry->byContentHash, szCachedName);
+	strcat(szCachedName, EFS_CACHE_FILE_EXTENSION);
+	if (!GetEFSCachePath(lpszCacheDir, szCachedName, szCachedFileName))
+		return FALSE;
+
+	// The lock is chosen by the first bytes of the hash, which are as good as any
+	DWORD dwLockID;
+	memcpy(&dwLockID, pDirEntry->byContentHash, sizeof(dwLockID));
+
+	// If the file is already in the cache, that's all there is to it; the EFS file isn't read at all, only the cached file, to check that it's the right one
+	HANDLE hCachedFile = OpenCachedEFSFile(szCachedFileName, pDirEntry->dwSize, pDirEntry->byContentHash);
+	if (hCachedFile == INVALID_HANDLE_VALUE)
+	{
+		HANDLE hLockFile = LockEFSCache(lpszCacheDir, FALSE, dwLockID);
+		if (hLockFile == INVALID_HANDLE_VALUE)
+			return FALSE;
+
+		// Another process may have put it there while we waited. If not, or the file there is damaged or not what its name says, put it there. A bad file can't be replaced if it's in use by another process, in which case we fail and the caller can fall back to ExtractTempEFSFile.
+		hCachedFile = OpenCachedEFSFile(szCachedFileName, pDirEntry->dwSize, pDirEntry->byContentHash);
+		if (hCachedFile == INVALID_HANDLE_VALUE)
+		{
+			DeleteFile(szCachedFileName);
+
+			if (WriteCachedEFSFile(pEFSFile, iDirEntry, lpszCacheDir, szCachedFileName))
+				hCachedFile = OpenCachedEFSFile(szCachedFileName, pDirEntry->dwSize, pDirEntry->byContentHash);
+		}
+
+		UnlockEFSCache(hLockFile, FALSE, dwLockID);
+	}
+
+	if (hCachedFile == INVALID_HANDLE_VALUE)
+		return FALSE;
+
+	// Keep the file open until DeleteTemporaryFiles is called, so that TrimEFSCache in another process can't delete it out from under us
+	if (!AddExtractedFileToList(szCachedFileName, hCachedFile))
+	{
+		CloseHandle(hCachedFile);
+
+		return FALSE;
+	}
+
+	strcpy(lpszOutFileName, szCachedFileName);
+
+	return TRUE;
+}
+
+// A file found in an extraction cache by TrimEFSCache
+struct EFSCACHEDFILE
+{
+	char szFileName[MAX_PATH + 1];
+	ULONGLONG qwLastUsed;
+	DWORD dwSize;
+};
+
+BOOL WINAPI TrimEFSCache(
+	IN LPCSTR lpszCacheDir,
+	IN ULONGLONG qwMaxCacheSize
+)
+{
+	assert(lpszCacheDir);
+
+	char szSearchPath[MAX_PATH + 1];
+	if (!GetEFSCachePath(lpszCacheDir, "*", szSearchPath))
+		return FALSE;
+
+	HANDLE hLockFile = LockEFSCache(lpszCacheDir, TRUE, 0);
+	if (hLockFile == INVALID_HANDLE_VALUE)
+		return FALSE;
+
+	// List the files in the cache. Nobody else can be writing to the cache, so any temporary files left over are from processes that died while writing, and can go.
+	EFSCACHEDFILE *pFiles = NULL;
+	DWORD nNumFiles = 0, nMaxFiles = 0;
+	ULONGLONG qwCacheSize = 0;
+	BOOL bRetVal = TRUE;
+
+	WIN32_FIND_DATA findData;
+	HANDLE hFind = FindFirstFile(szSearchPath, &findData);
+	if (hFind != INVALID_HANDLE_VALUE)
+	{
+		do
+		{
+			if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+				continue;
+
+			size_t nNameLength = strlen(findData.cFileName);
+			char szFileName[MAX_PATH + 1];
+			if (!GetEFSCachePath(lpszCacheDir, findData.cFileName, szFileName))
+				continue;
+
+			if ((nNameLength > 4) && !lstrcmpi(findData.cFileName + nNameLength - 4, ".tmp"))
+			{
+				DeleteFile(szFileName);
+				continue;
+			}
+
+			if ((nNameLength <= strlen(EFS_CACHE_FILE_EXTENSION)) || 
+				lstrcmpi(findData.cFileName + nNameLength - strlen(EFS_CACHE_FILE_EXTENSION), EFS_CACHE_FILE_EXTENSION))
+				continue;
+
+			if (nNumFiles >= nMaxFiles)
+			{
+				nMaxFiles = nMaxFiles ? nMaxFiles * 2 : 32;
+				EFSCACHEDFILE *pNewFiles = (EFSCACHEDFILE *)realloc(pFiles, nMaxFiles * sizeof(EFSCACHEDFILE));
+				if (!pNewFiles)
+				{
+					bRetVal = FALSE;
+					break;
+				}
+
+				pFiles = pNewFiles;
+			}
+
+			EFSCACHEDFILE *pFile = &pFiles[nNumFiles++];
+			strcpy(pFile->szFileName, szFileName);
+			pFile->qwLastUsed = ((ULONGLONG)findData.ftLastAccessTime.dwHighDateTime << 32) | findData.ftLastAccessTime.dwLowDateTime;
+			pFile->dwSize = findData.nFileSizeLow;
+
+			qwCacheSize += findData.nFileSizeLow;
+		} while (FindNextFile(hFind, &findData));
+
+		FindClose(hFind);
+	}
+
+	// Delete the least recently used files until the cache is small enough. Files in use can't be deleted, and are skipped.
+	if (bRetVal && (qwCacheSize > qwMaxCacheSize))
+	{
+		std::sort(pFiles, pFiles + nNumFiles, 
+			[](const EFSCACHEDFILE &left, const EFSCACHEDFILE &right) { return left.qwLastUsed < right.qwLastUsed; });
+
+		for (DWORD iCurFile = 0; (iCurFile < nNumFiles) && (qwCacheSize > qwMaxCacheSize); iCurFile++)
+		{
+			if (DeleteFile(pFiles[iCurFile].szFileName))
+				qwCacheSize -= pFiles[iCurFile].dwSize;
+		}
+	}
+
+	free(pFiles);
+
+	UnlockEFSCache(hLockFile, TRUE, 0);
+
+	return bRetVal;
+}
+
 DWORD WINAPI GetNumEFSFiles(
 	IN EFSHANDLEFORREAD hEFSFile
 )
@@ -975,9 +2916,9 @@ DWORD WINAPI GetNumEFSFiles(
 	assert(hEFSFile);
 
 	// Nothing simpler than this
-	EFSFILEHEADER *pEFSHeader = (EFSFILEHEADER *)hEFSFile;
+	EFSFILEHANDLEFORREAD *pEFSFile = (EFSFILEHANDLEFORREAD *)hEFSFile;
 
-	return pEFSHeader->dwNumDirectoryEntries;
+	return pEFSFile->nNumDirectoryEntries;
 }
 
 BOOL WINAPI EnumEFSFiles(
@@ -993,16 +2934,15 @@ BOOL WINAPI EnumEFSFiles(
 	assert(lpdwComponentID);
 	assert(lpdwFileID);
 
-	// Get the EFS header
-	EFSFILEHEADER *pEFSHeader = (EFSFILEHEADER *)hEFSFile;
+	// Dereference the handle
+	EFSFILEHANDLEFORREAD *pEFSFile = (EFSFILEHANDLEFORREAD *)hEFSFile;
 
 	// Check that the index is within the bounds of the directory
-	if (dwEFSFileIndex >= pEFSHeader->dwNumDirectoryEntries)
+	if (dwEFSFileIndex >= pEFSFile->nNumDirectoryEntries)
 		return FALSE;
 
-	// Get the directory and then find the file at the specified index
-	EFSDIRECTORYENTRY *pDirectory = (EFSDIRECTORYENTRY *)((LPBYTE)pEFSHeader + pEFSHeader->dwDirectoryOffset),
-		*pDirEntry = &pDirectory[dwEFSFileIndex];
+	// Find the file at the specified index
+	const EFSDIRECTORYENTRY *pDirEntry = &pEFSFile->pDirectory[dwEFSFileIndex];
 
 	// Grab the file info
 	*lpdwComponentID = pDirEntry->dwComponentID;
@@ -1016,3 +2956,97 @@ BOOL WINAPI EnumEFSFiles(
 
 	return TRUE;
 }
+
+// The shared state of the threads of a VerifyEFSFiles call
+struct EFSVERIFYJOB
+{
+	// The EFS file being verified
+	EFSFILEHANDLEFORREAD *pEFSFile;
+	// The index of the next file to be verified. Each thread takes files from this until it runs past the end of the directory.
+	volatile LONG iNextDirEntry;
+	// The index of the first corrupt file found, or -1 if none has been found
+	volatile LONG iBadDirEntry;
+};
+
+// The maximum number of threads VerifyEFSFiles will use. Verification is limited by memory bandwidth long before this.
+#define MAX_VERIFY_THREADS 16
+
+// The thread function for VerifyEFSFiles. Also run on the calling thread.
+DWORD WINAPI VerifyEFSFilesThreadProc(IN LPVOID lpvJob)
+{
+	assert(lpvJob);
+
+	EFSVERIFYJOB *pJob = (EFSVERIFYJOB *)lpvJob;
+
+	for (;;)
+	{
+		DWORD iDirEntry = (DWORD)(InterlockedIncrement(&pJob->iNextDirEntry) - 1);
+		if (iDirEntry >= pJob->pEFSFile->nNumDirectoryEntries)
+			break;
+
+		if (!VerifyEFSFile(pJob->pEFSFile, iDirEntry))
+			InterlockedCompareExchange(&pJob->iBadDirEntry, (LONG)iDirEntry, -1);
+	}
+
+	return 0;
+}
+
+BOOL WINAPI VerifyEFSFiles(
+	IN EFSHANDLEFORREAD hEFSFile,
+	IN DWORD nMaxThreads,
+	OUT OPTIONAL LPDWORD lpdwBadFileIndex
+)
+{
+	assert(hEFSFile);
+
+	EFSFILEHANDLEFORREAD *pEFSFile = (EFSFILEHANDLEFORREAD *)hEFSFile;
+
+	EFSVERIFYJOB job;
+	job.pEFSFile = pEFSFile;
+	job.iNextDirEntry = 0;
+	job.iBadDirEntry = -1;
+
+	// Decide how many threads to use: one per processor by default, but never more than there are files
+	if (!nMaxThreads)
+	{
+		SYSTEM_INFO sysInfo;
+		GetSystemInfo(&sysInfo);
+
+		nMaxThreads = sysInfo.dwNumberOfProcessors;
+	}
+
+	DWORD nNumThreads = (std::min)((std::min)(nMaxThreads, pEFSFile->nNumDirectoryEntries), (DWORD)MAX_VERIFY_THREADS);
+
+	// Start the helper threads. The calling thread is one of the workers, so we need one fewer. If a thread can't be created, the others simply pick up its share.
+	HANDLE hThreads[MAX_VERIFY_THREADS];
+	DWORD nNumThreadsStarted = 0;
+
+	for (DWORD iCurThread = 1; iCurThread < nNumThreads; iCurThread++)
+	{
+		DWORD dwThreadID;
+		HANDLE hThread = CreateThread(NULL, 0, VerifyEFSFilesThreadProc, &job, 0, &dwThreadID);
+		if (hThread)
+			hThreads[nNumThreadsStarted++] = hThread;
+	}
+
+	VerifyEFSFilesThreadProc(&job);
+
+	// Wait for the others to finish before the job goes out of scope
+	if (nNumThreadsStarted)
+	{
+		WaitForMultipleObjects(nNumThreadsStarted, hThreads, TRUE, INFINITE);
+
+		for (DWORD iCurThread = 0; iCurThread < nNumThreadsStarted; iCurThread++)
+			CloseHandle(hThreads[iCurThread]);
+	}
+
+	if (job.iBadDirEntry == -1)
+		return TRUE;
+
+	if (lpdwBadFileIndex)
+		*lpdwBadFileIndex = (DWORD)job.iBadDirEntry;
+
+	SetLastError(ERROR_CRC);
+
+	return FALSE;
+}
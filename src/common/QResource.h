@@ -29,7 +29,7 @@ void WINAPI QResourceDestroy();
 
 /*
 	* DeleteTemporaryFiles *
-	Deletes all embedded files and resources which have been extracted using either ExtractTempResource or ExtractTempEFSFile. Useful as a one-step cleanup on program termination.
+	Deletes all embedded files and resources which have been extracted using either ExtractTempResource or ExtractTempEFSFile. Useful as a one-step cleanup on program termination. Files extracted to a cache with ExtractCachedEFSFile are released, but not deleted.
 */
 BOOL WINAPI DeleteTemporaryFiles();
 
@@ -97,12 +97,19 @@ BOOL WINAPI MapFileIntoMemoryForRead(
 
 /*
 	The Embedded File System (EFS) is a minimalistic archive format for storing the plugins and their data files in an SEMPQ. While the MPQDraft program itself uses module file resources to store the SEMPQ stub and the patcher DLL, resources were impractical for SEMPQ files, because the format is more complicated, and it's troublesome to modify resources after a module has been compiled and linked.
-	Files are stored end-to-end, uncompressed, and unencrypted. Files are identified by a component ID number (major ID) and a file ID number (minor ID); the naming reflects the creation for use in MPQDraft, where there could be multiple plugins, each with its own set of data files. In retrospect, it might have been better to use something like TAR, instead.
+	Files are stored end-to-end and unencrypted, and originally were always uncompressed. Files are identified by a component ID number (major ID) and a file ID number (minor ID); the naming reflects the creation for use in MPQDraft, where there could be multiple plugins, each with its own set of data files. In retrospect, it might have been better to use something like TAR, instead.
+	Version 2 of the format adds a CRC-32C checksum to each directory entry. Checksums are verified lazily: the first time a file is looked up or extracted, its data is checksummed, and the result is remembered in the read handle, so that a corrupted file fails cleanly rather than crashing whoever uses it. Files from version 1 EFS files have no checksums, and are never verified. VerifyEFSFiles can be used to check every file at once.
+	Files may also be stored compressed, in the LZ4 format (see QCompress.h), if they were added with EFS_ADD_COMPRESS. Compressed files are split into 64 KB blocks, so that they can be extracted without holding the whole file in memory. Checksums are of the data as it is stored, so corrupt data is caught before it ever reaches the decompressor.
 */
 
+// AddToEFSFile flags
+// Compress the file, if that makes it meaningfully smaller. Each block is compressed at both LZ4 levels, and whichever is smaller is kept; blocks that don't compress are stored as they are.
+#define EFS_ADD_COMPRESS 0x00000001
+
 /*
 	* OpenEFSFileForWrite *
 	Opens an Embedded File System (EFS) file for modifications, and returns an handle EFSHANDLEFORWRITE which can be used in calls to modify the EFS file, including CloseEFSFileForWrite, AddToEFSFile,	and DeleteFromEFSFile. The handle cannot be used in calls to LookupEFSFile or ExtractEFSFile. On failure, returns NULL; if the file does not have an EFS file embedded in it, OpenEFSFileForWrite will embed a new EFS file.
+	If the EFS file is followed by other data, such as the MPQ of a SEMPQ, that data is preserved. It is only moved if the EFS file grows past the space set aside for it, and is always kept on a 512-byte boundary so that Storm can find an MPQ there.
 
 */
 EFSHANDLEFORWRITE WINAPI OpenEFSFileForWrite(
@@ -122,7 +129,7 @@ BOOL WINAPI CloseEFSFileForWrite(
 
 /*
 	* AddToEFSFile *
-	Adds a file to the specified EFS file. The individual file will be identified by two numbers - a component ID and a file ID. Together, these numbers should be unique in an EFS file. Fails if a file with that ID already exists.
+	Adds a file to the specified EFS file. The individual file will be identified by two numbers - a component ID and a file ID. Together, these numbers should be unique in an EFS file. Fails if a file with that ID already exists. If the file's contents are identical to those of a file already in the EFS file, the data is not stored a second time; both files will refer to the same data.
 */
 BOOL WINAPI AddToEFSFile(
 	// The handle of the EFS file the new file is to be added to
@@ -135,14 +142,55 @@ BOOL WINAPI AddToEFSFile(
 	IN DWORD dwFileID,
 	// A user-defined value that is associated with the file, and may be retrieved
 	IN DWORD dwData,
-	// Flags for the add operation. For now, must be 0.
+	// Flags for the add operation (EFS_ADD_*)
 	IN DWORD dwFlags
 );
 
+/*
+	* DeleteFromEFSFile *
+	Removes a file from the specified EFS file. The space used by the file's data is not reclaimed until CompactEFSFile is called, unless it was at the end of the EFS file. Fails if the file does not exist.
+*/
+BOOL WINAPI DeleteFromEFSFile(
+	// The handle of the EFS file to delete from
+	IN EFSHANDLEFORWRITE hEFSFile,
+	// The major ID of the file
+	IN DWORD dwComponentID,
+	// The minor ID of the file
+	IN DWORD dwFileID
+);
+
+/*
+	* ReplaceInEFSFile *
+	Replaces a file in the specified EFS file with a file on disk, or adds it if there is no file with that ID. The new file takes the place of the old one in the enumeration order. If the replacement fails, the old file is left in place. As with DeleteFromEFSFile, the old file's data remains until the EFS file is compacted.
+*/
+BOOL WINAPI ReplaceInEFSFile(
+	// The handle of the EFS file
+	IN EFSHANDLEFORWRITE hEFSFile,
+	// The name of the file on disk that is to replace the file in the EFS file
+	IN LPCSTR lpszFileName,
+	// The major ID of the file
+	IN DWORD dwComponentID,
+	// The minor ID of the file
+	IN DWORD dwFileID,
+	// A user-defined value that is associated with the file, and may be retrieved
+	IN DWORD dwData,
+	// Flags for the add operation (EFS_ADD_*)
+	IN DWORD dwFlags
+);
+
+/*
+	* CompactEFSFile *
+	Reclaims the space left by deleted and replaced files, by moving the data of the remaining files down to fill the gaps. Only data following a gap is moved. The directory is written once, when the EFS file is closed; until then, the EFS file on disk is inconsistent. Anything following the EFS file stays where it is, and the space freed is left for future additions. A return value of FALSE indicates that the EFS file has probably been corrupted.
+*/
+BOOL WINAPI CompactEFSFile(
+	// The handle of the EFS file to compact
+	IN EFSHANDLEFORWRITE hEFSFile
+);
+
 /*
 	* GetEFSHandleFromMappedFile *
 	GetEFSHandleFromMappedFile creates an EFSHANDLEFORREAD handle from any EFS file which has been loaded ENTIRELY into memory, preferrably in the form of a memory-mapped file. This handle can be used with either of the EFS file reading functions. If the mapped file does not contain an EFS file, or some other failure occurs, GetEFSHandleFromMappedFile will return NULL.
-	Note that, like a resource found with LookupResource, this EFSHANDLEFORREAD does not need to be explicitely closed. However, this handle will be invalid if the mapped file is unmapped.*/
+	The handle holds a copy of the EFS directory and the verification state of each file, and must be closed with CloseEFSFileForRead. The handle will be invalid if the mapped file is unmapped, so it should be closed first.*/
 EFSHANDLEFORREAD WINAPI GetEFSHandleFromMappedFile(
 	// The mapped data containing the EFS file
 	IN const BYTE *lpbyFileData, 
@@ -150,9 +198,33 @@ EFSHANDLEFORREAD WINAPI GetEFSHandleFromMappedFile(
 	IN DWORD dwFileSize
 );
 
+/*
+	* OpenEFSFileForRead *
+	Creates an EFSHANDLEFORREAD handle for an EFS file in a file on disk, without loading the file into memory. Only the EFS header and directory are read when the handle is created; after that, each file is read (with positional reads, so that the handle may be used from several threads at once) only when it is looked up or extracted. Returns NULL if no EFS file is found.
+	The file handle must have been opened with GENERIC_READ access, and must remain open until the EFS handle has been closed with CloseEFSFileForRead.
+*/
+EFSHANDLEFORREAD WINAPI OpenEFSFileForRead(
+	// The file containing the EFS file
+	IN HANDLE hFile,
+	// The offset in the file to start looking for the EFS header at. Must be a multiple of 512. If the location of the EFS file is known to be after something large, this can save a lot of searching.
+	IN DWORD dwSearchOffset,
+	// The offset in the file to stop looking for the EFS header at, or 0 to look to the end of the file. If the EFS file is known to be before something large, such as the MPQ in an SEMPQ, this can save a lot of searching.
+	IN DWORD dwSearchLimit
+);
+
+/*
+	* CloseEFSFileForRead *
+	Frees an EFSHANDLEFORREAD obtained from GetEFSHandleFromMappedFile or OpenEFSFileForRead, along with any files LookupEFSFile had to load into memory. Pointers obtained from LookupEFSFile for uncompressed files in a mapped EFS file remain valid for as long as the underlying memory does.
+*/
+void WINAPI CloseEFSFileForRead(
+	IN EFSHANDLEFORREAD hEFSFile
+);
+
 /*
 	* LookupEFSFile *
 	Loads into memory a file in an EFS file, and returns a pointer to the file, the file's size, and the file's data attribute. The memory the file is loaded into does not need to be explicitely freed; however, the memory will become invalid if the EFS file is freed, such as by the module containing it is unloaded with FreeLibrary.
+	If the file has a checksum and has not been verified yet, it is verified first. If it does not match, LookupEFSFile fails, and GetLastError returns ERROR_CRC.
+	If the file is compressed, or the handle was obtained from OpenEFSFileForRead, the file is loaded into memory owned by the handle the first time it is looked up, and that memory is freed by CloseEFSFileForRead. ExtractEFSFile should be preferred for such files if they only need to be written to disk.
 */
 BOOL WINAPI LookupEFSFile(
 	// The handle of the EFS file, obtained previously with one of the preceding functions
@@ -169,9 +241,31 @@ BOOL WINAPI LookupEFSFile(
 	OUT OPTIONAL LPDWORD lpdwFileData
 );
 
+/*
+	* ReadEFSFile *
+	Reads part of a file inside an EFS file into a buffer, without loading or extracting the rest of it. Only the compressed blocks which overlap the requested range are decompressed, and with a handle from OpenEFSFileForRead only those blocks are read from disk, so a large file can be streamed or accessed at random through a small buffer. Like the other functions taking an EFSHANDLEFORREAD, ReadEFSFile may be called from several threads at once.
+	Only the part of the stored data a read uses is verified: each 64 KB of a file's stored data has its own checksum, and a read checks the pieces holding the bytes it returns (and, for compressed files, their entries in the block table). Files from older versions of MPQDraft don't have these, and are verified whole the first time they are read through the handle, as with LookupEFSFile. Reads that extend past the end of the file are cut short; *lpnBytesRead receives the number of bytes actually read, which is 0 if dwOffset is at or past the end of the file.
+*/
+BOOL WINAPI ReadEFSFile(
+	// The handle of the EFS file, obtained previously with one of the preceding functions
+	IN EFSHANDLEFORREAD hEFSFile,
+	// The major ID of the specified file
+	IN DWORD dwComponentID,
+	// The minor ID of the specified file
+	IN DWORD dwFileID,
+	// The offset in the specified file to start reading at
+	IN DWORD dwOffset,
+	// The buffer to read into
+	OUT LPVOID lpvBuffer,
+	// The number of bytes to read
+	IN DWORD nBytesToRead,
+	// The number of bytes that were read
+	OUT LPDWORD lpnBytesRead
+);
+
 /*
 	* ExtractEFSFile *
-	Extracts a file inside the EFS file to a specified file on disk, overwriting that file if necessary. Otherwise operates like LookupEFSFile.
+	Extracts a file inside the EFS file to a specified file on disk, overwriting that file if necessary. Otherwise operates like LookupEFSFile, including checksum verification. Compressed files are decompressed one block at a time as they are written, rather than all at once.
 */
 BOOL WINAPI ExtractEFSFile(
 	// The handle of the EFS file, obtained previously with one of the preceding functions
@@ -186,7 +280,7 @@ BOOL WINAPI ExtractEFSFile(
 
 /*
 	* ExtractTempEFSFile *
-	Extracts a file inside an EFS file to a temporary file on disk having a unique filename. The file will be automatically deleted if DeleteTemporaryFiles is called.
+	Extracts a file inside an EFS file to a temporary file on disk having a unique filename. The file will be automatically deleted if DeleteTemporaryFiles is called. If another file sharing the same data has already been extracted through the same handle, the new temporary file is a hard link to it where the file system allows, so the data is only written once. As a result, temporary files must not be modified.
 */
 BOOL WINAPI ExtractTempEFSFile(
 	// The handle to the EFS file containing the specified file
@@ -199,6 +293,35 @@ BOOL WINAPI ExtractTempEFSFile(
 	OUT LPSTR lpszOutFileName
 );
 
+/*
+	* ExtractCachedEFSFile *
+	Like ExtractTempEFSFile, but extracts the file into a persistent cache directory, where it is kept for future use. Files in the cache are named after the SHA-256 of their data, so a file already in the cache - from a previous run, or another EFS file - is used without reading the file from the EFS file at all; as anyone may write to the cache, the cached file is hashed first, and only used if it matches. Otherwise the file is verified and written to the cache. The directory is created if it does not exist. Adding a file locks only that file, so several threads and processes may add different files at once.
+	The cached file is kept open until DeleteTemporaryFiles is called, which prevents it from being deleted or modified in the meantime; DeleteTemporaryFiles does not delete cached files. Fails if the file has no SHA-256 (EFS files from old versions of MPQDraft), or the cache could not be used; ExtractTempEFSFile should then be used instead.
+*/
+BOOL WINAPI ExtractCachedEFSFile(
+	// The handle to the EFS file containing the specified file
+	IN EFSHANDLEFORREAD hEFSFile,
+	// The major ID of the specified file
+	IN DWORD dwComponentID,
+	// The minor ID of the specified file
+	IN DWORD dwFileID,
+	// The cache directory
+	IN LPCSTR lpszCacheDir,
+	// The filename of the cached file
+	OUT LPSTR lpszOutFileName
+);
+
+/*
+	* TrimEFSCache *
+	Deletes the least recently used files in an extraction cache directory until its total size is no more than the specified size. Files which are in use are not deleted, so the cache may remain larger than requested.
+*/
+BOOL WINAPI TrimEFSCache(
+	// The cache directory
+	IN LPCSTR lpszCacheDir,
+	// The maximum size of the cache, in bytes
+	IN ULONGLONG qwMaxCacheSize
+);
+
 /*
 	* GetNumEFSFiles *
 	Retrieves the number of files embedded in the specified EFS file.
@@ -227,4 +350,17 @@ BOOL WINAPI EnumEFSFiles(
 	OUT OPTIONAL LPDWORD lpdwFileSize
 );
 
+/*
+	* VerifyEFSFiles *
+	Verifies the checksums of all files in an EFS file that have not already been verified, using several threads at once. Files verified here will not be verified again by LookupEFSFile or ExtractEFSFile. Returns FALSE if any file is corrupt.
+*/
+BOOL WINAPI VerifyEFSFiles(
+	// The handle of the EFS file to verify
+	IN EFSHANDLEFORREAD hEFSFile,
+	// The maximum number of threads to use. If 0, one thread per processor will be used.
+	IN DWORD nMaxThreads,
+	// The index (as used with EnumEFSFiles) of a corrupt file, if any. If this parameter is NULL, this value will not be returned.
+	OUT OPTIONAL LPDWORD lpdwBadFileIndex
+);
+
 #endif // #ifndef QRESOURCE.H
\ No newline at end of file
@@ -117,6 +117,7 @@ typedef unsigned long DWORD;
 typedef char* LPSTR;
 typedef const char* LPCSTR;
 typedef DWORD* LPDWORD;
+typedef void* LPVOID;
 #define WINAPI
 #define IN
 #define OUT
@@ -202,6 +203,86 @@ struct IMPQDraftServer
 	virtual BOOL WINAPI GetPluginModule(DWORD dwPluginID, DWORD dwModuleID, LPSTR lpszFileName) = 0;
 };
 
+/*
+	IMPQDraftServer2
+
+	An extension of IMPQDraftServer that allows a plugin to read its modules
+	through MPQDraft, rather than opening the module files itself. This
+	allows a plugin to stream large modules, or to read only the parts of
+	them that it needs, through a buffer of its own choosing. Modules
+	embedded in a SEMPQ are read straight out of the SEMPQ, and are never
+	written to disk unless the plugin asks for their file names with
+	GetPluginModule.
+
+	Versions of MPQDraft which support this interface will call the
+	SetMPQDraftServer2 function of a plugin, if the plugin exports it, just
+	before calling IMPQDraftPlugin::InitializePlugin. The interface given
+	to SetMPQDraftServer2 is the same object as the one given to
+	InitializePlugin. Older versions of MPQDraft will never call
+	SetMPQDraftServer2, so plugins should fall back to GetPluginModule if it
+	has not been called by the time InitializePlugin is.
+*/
+struct IMPQDraftServer2 : public IMPQDraftServer
+{
+	/*
+		IMPQDraftServer2::GetPluginModuleSize
+
+		Retrieves the size of one of the plugin's modules.
+
+		Returns TRUE on success, and FALSE on failure.
+
+		Parameters:
+			dwPluginID [in] - The ID of the plugin who owns the module.
+			dwModuleID [in] - The ID of the module.
+			lpdwModuleSize [out] - Pointer to a DWORD that will receive the
+			size of the module, in bytes.
+
+		Behavior:
+			- If lpdwModuleSize is NULL, GetPluginModuleSize will fail.
+
+			- If no module identified by dwPluginID and dwModuleID can be
+			found, GetPluginModuleSize will fail.
+			- If the module exists, GetPluginModuleSize will store its size
+			in lpdwModuleSize.
+	*/
+	virtual BOOL WINAPI GetPluginModuleSize(DWORD dwPluginID, DWORD dwModuleID, LPDWORD lpdwModuleSize) = 0;
+
+	/*
+		IMPQDraftServer2::ReadPluginModule
+
+		Reads part of one of the plugin's modules into a buffer.
+
+		Returns TRUE on success, and FALSE on failure.
+
+		Parameters:
+			dwPluginID [in] - The ID of the plugin who owns the module.
+			dwModuleID [in] - The ID of the module to read from.
+			dwOffset [in] - The offset in the module to start reading at.
+			lpvBuffer [out] - Pointer to a buffer of at least nBytesToRead
+			bytes, which will receive the data.
+			nBytesToRead [in] - The number of bytes to read.
+			lpnBytesRead [out] - Pointer to a DWORD that will receive the
+			number of bytes actually read.
+
+		Behavior:
+			- If lpvBuffer is NULL and nBytesToRead is not 0, or
+			lpnBytesRead is NULL, ReadPluginModule will fail.
+
+			- If no module identified by dwPluginID and dwModuleID can be
+			found, ReadPluginModule will fail.
+			- If the module could not be read, ReadPluginModule will fail.
+
+			- If the read extends past the end of the module, only the data
+			up to the end of the module will be read, and lpnBytesRead will
+			reflect this. If dwOffset is at or past the end of the module,
+			ReadPluginModule will succeed and read nothing.
+			- ReadPluginModule may be called from any thread, and from
+			several threads at once. It does not keep any position between
+			calls.
+	*/
+	virtual BOOL WINAPI ReadPluginModule(DWORD dwPluginID, DWORD dwModuleID, DWORD dwOffset, LPVOID lpvBuffer, DWORD nBytesToRead, LPDWORD lpnBytesRead) = 0;
+};
+
 /*
 	IMPQDraftPlugin
 
@@ -441,4 +522,22 @@ struct IMPQDraftPlugin
 */
 BOOL WINAPI GetMPQDraftPlugin(IMPQDraftPlugin **lppMPQDraftPlugin);
 
+/*
+	SetMPQDraftServer2
+
+	Optionally exported by name from the plugin DLL. Called by MPQDraft
+	inside the patch target, just before IMPQDraftPlugin::InitializePlugin,
+	to give the plugin the IMPQDraftServer2 interface. Not called in
+	setup-side, or by versions of MPQDraft that don't support
+	IMPQDraftServer2.
+
+	Returns TRUE on success, and FALSE on failure. If FALSE is returned,
+	MPQDraft will abort the patch, exactly as if InitializePlugin had failed.
+
+	Parameters:
+		lpMPQDraftServer2 [in] - A pointer to the IMPQDraftServer2 interface.
+		This pointer should be saved for use in InitializePlugin and later.
+*/
+BOOL WINAPI SetMPQDraftServer2(IMPQDraftServer2 *lpMPQDraftServer2);
+
 #endif // #ifndef QDPLUGIN_H
\ No newline at end of file
@@ -102,7 +102,40 @@ typedef BOOL (WINAPI *MPQDraftPatcherPtr)(
 	IN OPTIONAL const MPQDRAFTPLUGINMODULE *lpAuxModules
 );
 
+/*
+	* MPQDraftPatcherEx *
+	Like MPQDraftPatcher, but modules may also be left inside an EFS file, rather than extracted to files on disk: modules with an empty file name are read from the EFS file in lpszEFSFileName, by their component and module IDs. Plugins can read such modules through IMPQDraftServer2 without them ever being written to disk; they are only extracted if a plugin asks for a module's file name. Plugin DLLs (modules marked as executable) left in the EFS file are loaded from memory, and only extracted if they can't be.
+	Not exported by older versions of MPQDraft, which need every module to be in a file of its own.
+*/
+typedef BOOL (WINAPI *MPQDraftPatcherExPtr)(
+	IN LPCSTR lpszApplicationName,
+	IN OUT LPSTR lpszCommandLine,
+
+	IN OPTIONAL LPSECURITY_ATTRIBUTES lpProcessAttributes,
+	IN OPTIONAL LPSECURITY_ATTRIBUTES lpThreadAttributes,
+
+	IN BOOL bInheritHandles,
+	IN DWORD dwCreationFlags,
+	IN OPTIONAL LPVOID lpszEnvironment,
+	IN OPTIONAL LPCSTR lpszCurrentDirectory,
+
+	IN LPSTARTUPINFO lpStartupInfo,
+	IN DWORD dwFlags,
+	IN LPCSTR lpszMPQDraftDir,
+	IN LPCSTR lpszTargetPath,
+	IN OPTIONAL DWORD nShuntCount,
+	IN OPTIONAL DWORD nPatchMPQs,
+	IN OPTIONAL DWORD nAuxModules,
+	IN OPTIONAL LPCSTR *lplpszMPQNames,
+	IN OPTIONAL const MPQDRAFTPLUGINMODULE *lpAuxModules,
+	// The file containing the EFS file that modules with empty file names are in, such as a SEMPQ, or NULL if all modules are in files of their own
+	IN OPTIONAL LPCSTR lpszEFSFileName
+);
+
 // Function pointer type for GetMPQDraftPlugin
 typedef BOOL (WINAPI *GetMPQDraftPluginPtr)(OUT IMPQDraftPlugin **lppMPQDraftPlugin);
 
+// Function pointer type for SetMPQDraftServer2, which plugins export optionally
+typedef BOOL (WINAPI *SetMPQDraftServer2Ptr)(IN IMPQDraftServer2 *lpMPQDraftServer2);
+
 #endif
@@ -21,5 +21,7 @@
 #define MPQD_NO_SPAWNING  0x20000
 #define MPQD_USE_D2_STORM 0x40000
 #define MPQD_DETECT_STORM 0x80000
+// Record the names of the files the patch target opens through Storm, in order, to a file next to the last patch MPQ with ".trace" added to its name. The trace can be given to "mpq relayout" to put the files in the MPQ in the order they're read.
+#define MPQD_TRACE_ACCESS 0x100000
 
 #endif
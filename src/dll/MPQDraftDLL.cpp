@@ -8,8 +8,10 @@
 
 #include <windows.h>
 #include <assert.h>
+#include <stdlib.h>
 #include <crtdbg.h>
 #include "../common/QDebug.h"
+#include "../common/QPELoader.h"
 #include "MPQDraftDLL.h"
 
 // Typedefs for the Storm function pointers we're going to use in this DLL
@@ -55,6 +57,9 @@ BOOL bMPQsLoaded = FALSE; // *Protected by g_csDataLock
 DWORD nOpenPatchMPQs = 0; // Protected by g_csDataLock
 HANDLE hOpenPatchMPQs[MAX_PATCH_MPQS]; // Protected by g_csDataLock
 
+// The file the names of the files opened are written to, if MPQD_TRACE_ACCESS is set. Open while the patch MPQs are.
+HANDLE hTraceFile = INVALID_HANDLE_VALUE; // Protected by g_csDataLock
+
 // Plugin-related variables
 CPluginServer PluginServer; // Constant
 
@@ -62,6 +67,7 @@ CPluginServer PluginServer; // Constant
 DWORD nNumPlugins = 0; // Constant
 IMPQDraftPlugin *pPlugins[MAX_MPQDRAFT_PLUGINS]; // Constant
 HMODULE hPluginModules[MAX_MPQDRAFT_PLUGINS]; // Constant
+BOOL bPluginsInMemory[MAX_MPQDRAFT_PLUGINS]; // Constant; whether each plugin's DLL was loaded from memory with LoadPEImage, rather than LoadLibrary
 
 // Function pointers and other Storm stuff - constant
 // Storm goes by a few different names. Normally Storm.dll, but it has also been observed to be StormAE.dll (asserts enabled) and StormBE.dll in some beta builds.
@@ -141,6 +147,7 @@ BOOL APIENTRY DllMain(IN HANDLE hInstDLL, IN DWORD fdwReason, IN LPVOID lpvReser
 				//_CrtSetDbgFlag(_CRTDBG_ALLOC_MEM_DF | _CRTDBG_CHECK_ALWAYS_DF | _CRTDBG_CHECK_CRT_DF | _CRTDBG_LEAK_CHECK_DF);
 
 				InitializeCriticalSection(&g_csDataLock);
+				QPELoaderInitialize();
 
 #ifdef _MSC_VER
 			}
@@ -163,6 +170,7 @@ BOOL APIENTRY DllMain(IN HANDLE hInstDLL, IN DWORD fdwReason, IN LPVOID lpvReser
 			QDebugCloseLogFile();
 
 			DeleteCriticalSection(&g_csDataLock);
+			QPELoaderDestroy();
 
 			break;
 
@@ -233,16 +241,42 @@ BOOL WINAPI PatchCloseArchive(IN HANDLE hMPQ)
 	return bRetVal;
 }
 
-// NOTE: Always redirects (Redirect SFileOpenFileEx Calls)
+// Records that a file was opened, if we're tracing. Names are written one per line, in the order the files are opened; repeats are left in, as they're cheap to remove later.
+void TraceFileAccess(IN LPCSTR lpszFileName)
+{
+	if (hTraceFile == INVALID_HANDLE_VALUE || !lpszFileName)
+		return;
+
+	EnterCriticalSection(&g_csDataLock);
+
+	if (hTraceFile != INVALID_HANDLE_VALUE)
+	{
+		DWORD dwBytesWritten;
+		WriteFile(hTraceFile, lpszFileName, (DWORD)strlen(lpszFileName), &dwBytesWritten, NULL);
+		WriteFile(hTraceFile, "\r\n", 2, &dwBytesWritten, NULL);
+	}
+
+	LeaveCriticalSection(&g_csDataLock);
+}
+
+// The archive the SFileOpenFileEx family of hooks should search. With MPQD_EXTENDED_REDIR, that's always the priority chain; otherwise the hooks are only there for tracing, and use what they're given.
+inline HANDLE GetRedirectedMPQ(IN HANDLE hMPQ)
+{
+	return (lpPatchContext->dwFlags & MPQD_EXTENDED_REDIR) ? NULL : hMPQ;
+}
+
+// NOTE: Redirects if MPQD_EXTENDED_REDIR is set (Redirect SFileOpenFileEx Calls)
 // Our SFileOpenArchiveEx hook. As most of the work in MPQDraft is handled by Storm itself (we're kind of viral that way), we don't exactly need to do much here. However, this function optionally takes a handle to an MPQ; if there is one, it will only load the file from that archive, which would bypass our patch MPQs. Thus we need to make sure it doesn't do that.
 BOOL WINAPI PatchOpenFileEx(IN OPTIONAL HANDLE hMPQ, IN LPCSTR lpFileName, IN DWORD dwSearchScope, OUT HANDLE *lphFile)
 {
 	QDebugWriteEntry("PatchOpenFileEx(0x%X, \"%s\", 0x%X, x)", hMPQ, lpFileName, dwSearchScope);
 
 	// Force it to use the priority chain
-	BOOL bRetVal = SFileOpenFileEx(NULL, lpFileName, dwSearchScope, lphFile);
+	BOOL bRetVal = SFileOpenFileEx(GetRedirectedMPQ(hMPQ), lpFileName, dwSearchScope, lphFile);
 
 	QDebugWriteEntry("PatchOpenFileEx : SFileOpenFileEx returned %d, handle at 0x%X", bRetVal, *lphFile);
+	if (bRetVal)
+		TraceFileAccess(lpFileName);
 
 	return bRetVal;
 }
@@ -252,11 +286,14 @@ BOOL WINAPI PatchLoadFileEx(IN OPTIONAL HANDLE hMPQ, IN LPCSTR lpFileName, OUT L
 {
 	QDebugWriteEntry("PatchLoadFileEx(0x%X, \"%s\", 0x%X, 0x%X, 0x%X, %d, 0x%X)", hMPQ, lpFileName, lplpFileData, lpFileSize, dwParam5, dwSearchScope, dwParam7);
 
-	BOOL bRetVal = SFileLoadFileEx(NULL, lpFileName, lplpFileData, lpFileSize, dwParam5, dwSearchScope, dwParam7);
+	BOOL bRetVal = SFileLoadFileEx(GetRedirectedMPQ(hMPQ), lpFileName, lplpFileData, lpFileSize, dwParam5, dwSearchScope, dwParam7);
 
 	QDebugWriteEntry("PatchLoadFileEx : SFileLoadFileEx returned %d", bRetVal);
 	if (bRetVal)
+	{
 		QDebugWriteEntry("PatchLoadFileEx : File loaded at 0x%X, file size %d", *lplpFileData, *lpFileSize);
+		TraceFileAccess(lpFileName);
+	}
 
 	return bRetVal;
 }
@@ -266,11 +303,14 @@ BOOL WINAPI PatchLoadFileEx2(IN OPTIONAL HANDLE hMPQ, IN LPCSTR lpFileName, OUT
 {
 	QDebugWriteEntry("PatchLoadFileEx2(0x%X, \"%s\", 0x%X, 0x%X, 0x%X, %d, 0x%X, 0x%X)", hMPQ, lpFileName, lplpFileData, lpFileSize, dwParam5, dwSearchScope, dwParam7, dwParam8);
 
-	BOOL bRetVal = SFileLoadFileEx2(NULL, lpFileName, lplpFileData, lpFileSize, dwParam5, dwSearchScope, dwParam7, dwParam8);
+	BOOL bRetVal = SFileLoadFileEx2(GetRedirectedMPQ(hMPQ), lpFileName, lplpFileData, lpFileSize, dwParam5, dwSearchScope, dwParam7, dwParam8);
 
 	QDebugWriteEntry("PatchLoadFileEx2 : SFileLoadFileEx2 returned %d", bRetVal);
 	if (bRetVal)
+	{
 		QDebugWriteEntry("PatchLoadFileEx2 : File loaded at 0x%X, file size %d", *lplpFileData, *lpFileSize);
+		TraceFileAccess(lpFileName);
+	}
 
 	return bRetVal;
 }
@@ -427,8 +467,8 @@ FARPROC WINAPI PatchGetProcAddress(IN HMODULE hModule, IN LPCSTR lpProcName)
 			if (dwOrdinal == nOpenPathAsArchiveOrd)
 				return (FARPROC)PatchOpenPathAsArchive;
 
-			// Catch the extended ones if necessary
-			if (lpPatchContext->dwFlags & MPQD_EXTENDED_REDIR)
+			// Catch the extended ones if necessary, which are also how we see files being opened for tracing
+			if (lpPatchContext->dwFlags & (MPQD_EXTENDED_REDIR | MPQD_TRACE_ACCESS))
 			{
 				if (dwOrdinal == nOpenFileExOrd)
 					return (FARPROC)PatchOpenFileEx;
@@ -454,6 +494,13 @@ FARPROC WINAPI PatchGetProcAddress(IN HMODULE hModule, IN LPCSTR lpProcName)
 			return (FARPROC)PatchGetProcAddress;
 	}
 
+	// Plugins loaded from memory aren't known to Windows, so their own exports have to be looked up here
+	for (DWORD iCurPlugin = 0; iCurPlugin < nNumPlugins; iCurPlugin++)
+	{
+		if ((hModule == hPluginModules[iCurPlugin]) && bPluginsInMemory[iCurPlugin])
+			return GetPEImageProcAddress(hModule, lpProcName);
+	}
+
 	// Answer E: none of the above
 	FARPROC pfnProc = GetProcAddress(hModule, lpProcName);
 	//QDebugWriteEntry("PatchLoadLibrary : GetProcAddress returned 0x%X", pfnProc);
@@ -488,6 +535,7 @@ extern "C" BOOL WINAPI MPQDraftInitialize(IN MPQDRAFTPATCHERDATA *pData, IN DWOR
 
 	ZeroMemory(pPlugins, MAX_MPQDRAFT_PLUGINS * sizeof(IMPQDraftPlugin));
 	ZeroMemory(hPluginModules, MAX_MPQDRAFT_PLUGINS * sizeof(HMODULE));
+	ZeroMemory(bPluginsInMemory, MAX_MPQDRAFT_PLUGINS * sizeof(BOOL));
 
 	// Map the patch context so that we can begin patching
 	lpPatchContext = OpenContextHandle(pData->hPatchContext);
@@ -525,7 +573,7 @@ extern "C" BOOL WINAPI MPQDraftInitialize(IN MPQDRAFTPATCHERDATA *pData, IN DWOR
 		// If we're supposed to load modules in this process, notify the plugin server and load the plugins
 		MPQDRAFTPLUGINMODULE *lpModules = (MPQDRAFTPLUGINMODULE *)((LPBYTE)lpPatchContext + lpPatchContext->dwModulesOffset);
 
-		PluginServer.SetModules(lpModules, lpPatchContext->nModules);
+		PluginServer.SetModules(lpModules, lpPatchContext->nModules, lpPatchContext->szEFSFileName);
 
 		bRetVal = LoadPlugins();
 		QDebugWriteEntry("MPQDraftInitialize : LoadPlugins returned %d", bRetVal);
@@ -767,8 +815,8 @@ BOOL PatchModuleFunctions(IN HMODULE hModule)
 		dwPatchCount = PatchImportEntry(hModule, "Storm.dll", (FARPROC)SFileCloseArchive, (FARPROC)PatchCloseArchive, TRUE);
 		QDebugWriteEntry("PatchModuleFunctions : PatchImportEntry returned 0x%X", dwPatchCount);
 
-		// Patch extended redirect functions if that's what the caller wants to do
-		if (lpPatchContext->dwFlags & MPQD_EXTENDED_REDIR)
+		// Patch extended redirect functions if that's what the caller wants to do. The file opening ones are also needed for tracing.
+		if (lpPatchContext->dwFlags & (MPQD_EXTENDED_REDIR | MPQD_TRACE_ACCESS))
 		{
 			dwPatchCount = PatchImportEntry(hModule, "Storm.dll", (FARPROC)SFileOpenFileEx, (FARPROC)PatchOpenFileEx, TRUE);
 			QDebugWriteEntry("PatchModuleFunctions : PatchImportEntry returned 0x%X", dwPatchCount);
@@ -777,11 +825,11 @@ BOOL PatchModuleFunctions(IN HMODULE hModule)
 				dwPatchCount = PatchImportEntry(hModule, "Storm.dll", (FARPROC)SFileLoadFileEx, (FARPROC)PatchLoadFileEx, TRUE);
 			if (SFileLoadFileEx2)
 				dwPatchCount = PatchImportEntry(hModule, "Storm.dll", (FARPROC)SFileLoadFileEx2, (FARPROC)PatchLoadFileEx2, TRUE);
-
-			if (SFileOpenPathAsArchive)
-				dwPatchCount = PatchImportEntry(hModule, "Storm.dll", (FARPROC)SFileOpenPathAsArchive, (FARPROC)PatchOpenPathAsArchive, TRUE);
 		}
 
+		if ((lpPatchContext->dwFlags & MPQD_EXTENDED_REDIR) && SFileOpenPathAsArchive)
+			dwPatchCount = PatchImportEntry(hModule, "Storm.dll", (FARPROC)SFileOpenPathAsArchive, (FARPROC)PatchOpenPathAsArchive, TRUE);
+
 		if (SFileOpenFileAsArchive)
 			dwPatchCount = PatchImportEntry(hModule, "Storm.dll", (FARPROC)SFileOpenFileAsArchive, (FARPROC)PatchOpenFileAsArchive, TRUE);
 	}
@@ -816,11 +864,78 @@ BOOL LoadPatchMPQs()
 		lpszMPQName += MPQDRAFT_MAX_PATH;
 	}
 
+	// The trace goes next to the MPQ with the highest priority, which is the one most likely to be laid out from it. Failing to create it isn't worth stopping the game for.
+	if ((lpPatchContext->dwFlags & MPQD_TRACE_ACCESS) && nOpenPatchMPQs)
+	{
+		char szTracePath[MPQDRAFT_MAX_PATH + 8];
+		wsprintf(szTracePath, "%s.trace", lpszMPQName - MPQDRAFT_MAX_PATH);
+
+		hTraceFile = CreateFile(szTracePath, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		QDebugWriteEntry("LoadPatchMPQs : CreateFile returned 0x%X for trace \"%s\"", hTraceFile, szTracePath);
+	}
+
 	bMPQsLoaded = TRUE;
 
 	return TRUE;
 }
 
+// Loads the DLL containing a plugin. A DLL the stub left in the SEMPQ is loaded straight from memory with LoadPEImage, so it never has to be written to disk. If that fails - the DLL may use thread local storage variables, which only Windows' loader can handle - it's extracted and loaded with LoadLibrary after all.
+HMODULE LoadPluginDLL(IN const MPQDRAFTPLUGINMODULE *lpModule, OUT BOOL *lpbInMemory)
+{
+	assert(lpModule);
+	assert(lpbInMemory);
+
+	*lpbInMemory = FALSE;
+
+	if (lpModule->szModuleFileName[0])
+		return LoadLibrary(lpModule->szModuleFileName);
+
+	DWORD dwModuleSize, nBytesRead;
+	HMODULE hDLLModule = NULL;
+
+	if (PluginServer.GetPluginModuleSize(lpModule->dwComponentID, lpModule->dwModuleID, &dwModuleSize))
+	{
+		LPBYTE lpbyModule = (LPBYTE)malloc(dwModuleSize ? dwModuleSize : 1);
+		if (lpbyModule)
+		{
+			if (PluginServer.ReadPluginModule(lpModule->dwComponentID, lpModule->dwModuleID, 0, lpbyModule, dwModuleSize, &nBytesRead)
+				&& (nBytesRead == dwModuleSize))
+				hDLLModule = LoadPEImage(lpbyModule, dwModuleSize);
+
+			free(lpbyModule);
+		}
+	}
+
+	QDebugWriteEntry("LoadPluginDLL : LoadPEImage returned 0x%X, last error %d", hDLLModule, hDLLModule ? 0 : GetLastError());
+
+	if (hDLLModule)
+	{
+		*lpbInMemory = TRUE;
+
+		return hDLLModule;
+	}
+
+	char szFileName[MPQDRAFT_MAX_PATH];
+	if (!PluginServer.GetPluginModule(lpModule->dwComponentID, lpModule->dwModuleID, szFileName))
+		return NULL;
+
+	return LoadLibrary(szFileName);
+}
+
+// GetProcAddress and FreeLibrary for plugin DLLs, which may have been loaded by either LoadLibrary or LoadPEImage
+FARPROC GetPluginProcAddress(IN HMODULE hDLLModule, IN BOOL bInMemory, IN LPCSTR lpszProcName)
+{
+	return bInMemory ? GetPEImageProcAddress(hDLLModule, lpszProcName) : GetProcAddress(hDLLModule, lpszProcName);
+}
+
+void FreePluginDLL(IN HMODULE hDLLModule, IN BOOL bInMemory)
+{
+	if (bInMemory)
+		FreePEImage(hDLLModule);
+	else
+		FreeLibrary(hDLLModule);
+}
+
 // Loads and initializes all plugins in the current process
 BOOL LoadPlugins()
 {
@@ -835,8 +950,9 @@ BOOL LoadPlugins()
 		if (lpModules[iCurAuxModule].bExecute)
 		{
 			// First of all, load the DLL containing the plugin
-			HMODULE hDLLModule = LoadLibrary(lpModules[iCurAuxModule].szModuleFileName);
-			QDebugWriteEntry("LoadPlugins : LoadLibrary returned 0x%X on \"%s\"", hDLLModule, lpModules[iCurAuxModule].szModuleFileName);
+			BOOL bInMemory;
+			HMODULE hDLLModule = LoadPluginDLL(&lpModules[iCurAuxModule], &bInMemory);
+			QDebugWriteEntry("LoadPlugins : LoadPluginDLL returned 0x%X on \"%s\", in memory %d", hDLLModule, lpModules[iCurAuxModule].szModuleFileName, bInMemory);
 
 			if (!hDLLModule)
 				return FALSE;
@@ -846,14 +962,14 @@ BOOL LoadPlugins()
 			QDebugWriteEntry("LoadPlugins : PatchModuleFunctions returned %d", bRetVal);
 
 			// Get the exported plugin function and get the IMPQDraftPlugin for the plugin
-			GetMPQDraftPluginPtr pGetMPQDraftPlugin = (GetMPQDraftPluginPtr)GetProcAddress(hDLLModule, "GetMPQDraftPlugin");
+			GetMPQDraftPluginPtr pGetMPQDraftPlugin = (GetMPQDraftPluginPtr)GetPluginProcAddress(hDLLModule, bInMemory, "GetMPQDraftPlugin");
 			QDebugWriteEntry("LoadPlugins : GetProcAddress returned 0x%X", pGetMPQDraftPlugin);
 
 			IMPQDraftPlugin *pPlugin;
 
 			if (!pGetMPQDraftPlugin)
 			{
-				FreeLibrary(hDLLModule);
+				FreePluginDLL(hDLLModule, bInMemory);
 				return FALSE;
 			}
 
@@ -862,22 +978,37 @@ BOOL LoadPlugins()
 
 			if (!bRetVal)
 			{
-				FreeLibrary(hDLLModule);
+				FreePluginDLL(hDLLModule, bInMemory);
 				return FALSE;
 			}
 
+			// Plugins that want to read their modules through us need the IMPQDraftServer2 interface first. It's the same object as the one InitializePlugin gets.
+			SetMPQDraftServer2Ptr pSetMPQDraftServer2 = (SetMPQDraftServer2Ptr)GetPluginProcAddress(hDLLModule, bInMemory, "SetMPQDraftServer2");
+			if (pSetMPQDraftServer2)
+			{
+				bRetVal = pSetMPQDraftServer2(&PluginServer);
+				QDebugWriteEntry("LoadPlugins : SetMPQDraftServer2 returned %d", bRetVal);
+
+				if (!bRetVal)
+				{
+					FreePluginDLL(hDLLModule, bInMemory);
+					return FALSE;
+				}
+			}
+
 			// Finally, initialize the plugin to allow it to do any patching of the host it needs to, then add it to our list of plugins
 			bRetVal = pPlugin->InitializePlugin(&PluginServer);
 			QDebugWriteEntry("LoadPlugins : InitializePlugin returned %d", bRetVal);
 
 			if (!bRetVal)
 			{
-				FreeLibrary(hDLLModule);
+				FreePluginDLL(hDLLModule, bInMemory);
 				return FALSE;
 			}
 
 			pPlugins[nNumPlugins] = pPlugin;
 			hPluginModules[nNumPlugins] = hDLLModule;
+			bPluginsInMemory[nNumPlugins] = bInMemory;
 
 			nNumPlugins++;
 		}
@@ -924,10 +1055,11 @@ BOOL UnloadPlugins()
 		pPlugins[iCurPlugin]->TerminatePlugin();
 
 		// Unload the DLL
-		FreeLibrary(hPluginModules[iCurPlugin]);
+		FreePluginDLL(hPluginModules[iCurPlugin], bPluginsInMemory[iCurPlugin]);
 
 		pPlugins[iCurPlugin] = NULL;
 		hPluginModules[iCurPlugin] = NULL;
+		bPluginsInMemory[iCurPlugin] = FALSE;
 	}
 
 	nNumPlugins = 0;
@@ -953,6 +1085,12 @@ BOOL UnloadPatchMPQs()
 
 	nOpenPatchMPQs = 0;
 
+	if (hTraceFile != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(hTraceFile);
+		hTraceFile = INVALID_HANDLE_VALUE;
+	}
+
 	bMPQsLoaded = FALSE;
 
 	return TRUE;
@@ -969,8 +1107,8 @@ void MPQDraftAbort()
 	ExitProcess(0x93);
 }
 
-// Finally, the patcher function that is the border between MPQDraft and the MPQDraftDLL, the latter performing all patching itself
-extern "C" BOOL WINAPI MPQDraftPatcher(
+// Finally, the patcher function that is the border between MPQDraft and the MPQDraftDLL, the latter performing all patching itself. See PatcherApi.h for the difference between the two versions.
+extern "C" BOOL WINAPI MPQDraftPatcherEx(
 	// These first 10 parameters are nothing other than the parameters passed to CreateProcess, and used for just that.
 	IN LPCSTR lpszApplicationName,
 	IN OUT LPSTR lpszCommandLine,
@@ -996,14 +1134,16 @@ extern "C" BOOL WINAPI MPQDraftPatcher(
 	IN OPTIONAL DWORD nAuxModules,
 
 	IN OPTIONAL LPCSTR *lplpszMPQNames,
-	IN OPTIONAL const MPQDRAFTPLUGINMODULE *lpAuxModules
+	IN OPTIONAL const MPQDRAFTPLUGINMODULE *lpAuxModules,
+
+	IN OPTIONAL LPCSTR lpszEFSFileName
 )
 {
 	// Create a new context from parameters. Let the function assert if any of the parameters are invalid (so we don't have to).
 	MPQDRAFTPATCHCONTEXT *pPatchContext;
 	HANDLE hPatchContext, hPatchMutex;
 
-	if (!CreatePatchContext(dwFlags, lpszMPQDraftDir, lpszCurrentDirectory, lpszTargetPath, nShuntCount, nPatchMPQs, nAuxModules, lplpszMPQNames, lpAuxModules, hPatchContext, &pPatchContext, hPatchMutex))
+	if (!CreatePatchContext(dwFlags, lpszMPQDraftDir, lpszCurrentDirectory, lpszTargetPath, nShuntCount, nPatchMPQs, nAuxModules, lplpszMPQNames, lpAuxModules, lpszEFSFileName, hPatchContext, &pPatchContext, hPatchMutex))
 		return FALSE;
 
 	// Now we have a context. Everything else that's part of the patching process will be done by CreateAndPatchProcess.
@@ -1030,3 +1170,35 @@ extern "C" BOOL WINAPI MPQDraftPatcher(
 
 	return TRUE;	// V
 }
+
+// The original version, for callers whose modules are all in files of their own
+extern "C" BOOL WINAPI MPQDraftPatcher(
+	IN LPCSTR lpszApplicationName,
+	IN OUT LPSTR lpszCommandLine,
+
+	IN OPTIONAL LPSECURITY_ATTRIBUTES lpProcessAttributes,
+	IN OPTIONAL LPSECURITY_ATTRIBUTES lpThreadAttributes,
+
+	IN BOOL bInheritHandles,
+	IN DWORD dwCreationFlags,
+	IN OPTIONAL LPVOID lpszEnvironment,
+	IN OPTIONAL LPCSTR lpszCurrentDirectory,
+
+	IN LPSTARTUPINFO lpStartupInfo,
+
+	IN DWORD dwFlags,
+
+	IN LPCSTR lpszMPQDraftDir,
+
+	IN LPCSTR lpszTargetPath,
+	IN OPTIONAL DWORD nShuntCount,
+
+	IN OPTIONAL DWORD nPatchMPQs,
+	IN OPTIONAL DWORD nAuxModules,
+
+	IN OPTIONAL LPCSTR *lplpszMPQNames,
+	IN OPTIONAL const MPQDRAFTPLUGINMODULE *lpAuxModules
+)
+{
+	return MPQDraftPatcherEx(lpszApplicationName, lpszCommandLine, lpProcessAttributes, lpThreadAttributes, bInheritHandles, dwCreationFlags, lpszEnvironment, lpszCurrentDirectory, lpStartupInfo, dwFlags, lpszMPQDraftDir, lpszTargetPath, nShuntCount, nPatchMPQs, nAuxModules, lplpszMPQNames, lpAuxModules, NULL);
+}
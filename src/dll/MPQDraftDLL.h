@@ -12,6 +12,7 @@
 
 #include <windows.h>
 #include "../common/QHookAPI.h"
+#include "../common/QResource.h"
 #include "../core/PatcherApi.h"
 #include "Patcher.h"
 
@@ -25,15 +26,20 @@ extern "C" BOOL WINAPI MPQDraftInitialize(IN MPQDRAFTPATCHERDATA *pData, IN DWOR
   BOOL PatchModuleFunctions(HMODULE hModule);
   BOOL LoadPatchMPQs();
   BOOL LoadPlugins();
+    HMODULE LoadPluginDLL(IN const MPQDRAFTPLUGINMODULE *lpModule, OUT BOOL *lpbInMemory);
+    FARPROC GetPluginProcAddress(IN HMODULE hDLLModule, IN BOOL bInMemory, IN LPCSTR lpszProcName);
+    void FreePluginDLL(IN HMODULE hDLLModule, IN BOOL bInMemory);
 
   BOOL MPQDraftTerminate();
   BOOL UnloadPlugins();
   BOOL UnloadPatchMPQs();
 
+void TraceFileAccess(IN LPCSTR lpszFileName);
+
 void MPQDraftAbort();
 
 // The MPQDraft plugin server which hosts any plugins loaded in this patch. See IMPQDraftServer for more info about plugins and the way they interact with the plugin server..
-class CPluginServer : public IMPQDraftServer
+class CPluginServer : public IMPQDraftServer2
 {
 private:
 	BOOL m_bReady;	// Whether we've been initialized yet
@@ -42,11 +48,38 @@ private:
 	DWORD m_nModules;
 	MPQDRAFTPLUGINMODULE *m_pModules;
 
+	// Handles to the module files, opened the first time each module is read with ReadPluginModule
+	HANDLE *m_phModuleFiles;
+
+	// The file containing the EFS file that modules with empty file names are in (the SEMPQ), or empty
+	char m_szEFSFileName[MAX_PATH + 1];
+	// The EFS file and the file it's in, opened the first time a module in it is used
+	HANDLE m_hEFSDiskFile;
+	EFSHANDLEFORREAD m_hEFSFile;
+	// The temporary files modules in the EFS file have been extracted to, for plugins that asked for their file names; NULL for those that haven't been
+	LPSTR *m_plpszExtractedFileNames;
+	// Protects opening the EFS file and extracting modules
+	CRITICAL_SECTION m_csEFSLock;
+
 public:
 	CPluginServer();
+	~CPluginServer();
 
-	// Set the modules for this process
-	BOOL SetModules(IN MPQDRAFTPLUGINMODULE *pModules, IN DWORD nModules);
+	// Set the modules for this process. Modules with empty file names are in the EFS file in lpszEFSFileName.
+	BOOL SetModules(IN MPQDRAFTPLUGINMODULE *pModules, IN DWORD nModules, IN OPTIONAL LPCSTR lpszEFSFileName);
 
 	virtual BOOL WINAPI GetPluginModule(IN DWORD dwPluginID, IN DWORD dwModuleID, OUT LPSTR lpszFileName);
+
+	virtual BOOL WINAPI GetPluginModuleSize(IN DWORD dwPluginID, IN DWORD dwModuleID, OUT LPDWORD lpdwModuleSize);
+	virtual BOOL WINAPI ReadPluginModule(IN DWORD dwPluginID, IN DWORD dwModuleID, IN DWORD dwOffset, OUT LPVOID lpvBuffer, IN DWORD nBytesToRead, OUT LPDWORD lpnBytesRead);
+
+protected:
+	// Finds the slot of a module, or returns (DWORD)-1 if there is no such module
+	DWORD FindModule(IN DWORD dwPluginID, IN DWORD dwModuleID) const;
+	// Gets the handle of a module's file, opening it if necessary
+	HANDLE GetModuleFile(IN DWORD iModule);
+	// Whether a module is in the EFS file, rather than a file of its own
+	BOOL IsModuleInEFSFile(IN DWORD iModule) const;
+	// Gets the EFS file the modules without files are in, opening it if necessary. Returns NULL on failure.
+	EFSHANDLEFORREAD GetEFSFile();
 };
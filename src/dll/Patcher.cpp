@@ -55,6 +55,8 @@ BOOL CreatePatchContext(
 	IN OPTIONAL LPCSTR *lplpszMPQNames, 
 	// The auxiliary modules to load. Modules that are flagged as executable will be loaded as plugins. Earlier ones have a lower priority.
 	IN OPTIONAL const MPQDRAFTPLUGINMODULE *lpAuxModules,
+	// The file containing the EFS file that modules with empty paths are in, or NULL
+	IN OPTIONAL LPCSTR lpszEFSFileName,
 
 	// The memory mapped file HANDLE for the patch context
 	OUT HANDLE &rhContext,
@@ -133,6 +135,12 @@ BOOL CreatePatchContext(
 			pContext->szTargetPath[MPQDRAFT_MAX_PATH - 1] = '\0';
 			pContext->nShuntCount = /*pContext->nShuntRemaining =*/ nShuntCount;
 
+			if (lpszEFSFileName)
+			{
+				strncpy(pContext->szEFSFileName, lpszEFSFileName, MPQDRAFT_MAX_PATH);
+				pContext->szEFSFileName[MPQDRAFT_MAX_PATH - 1] = '\0';
+			}
+
 			// Compute offsets for the MPQs and modules from array sizes
 			pContext->dwMPQNamesOffset = sizeof(MPQDRAFTPATCHCONTEXT);
 			pContext->dwModulesOffset = pContext->dwMPQNamesOffset
@@ -43,7 +43,8 @@ struct MPQDRAFTPATCHCONTEXT
 	DWORD dwMPQNamesOffset;	// MPQs to load, constant
 	DWORD dwModulesOffset;	// Plugin module array, constant
 
-	// Modules must have been already extracted to files on disk by the caller, so we need only to pass the paths to the modules to the patch target.
+	// Modules are usually extracted to files on disk by the caller, so we need only to pass the paths to the modules to the patch target. Modules with empty paths are instead still in the EFS file in this file (the SEMPQ), and are read from there by the plugin server.
+	char szEFSFileName[MPQDRAFT_MAX_PATH];	// Constant, empty if there is no EFS file
 };
 
 // Claims ownership of the shared patch context simply by entering the mutex
@@ -71,6 +72,8 @@ BOOL CreatePatchContext(
 	IN OPTIONAL LPCSTR *lplpszMPQNames, 
 	// The auxiliary modules to load. Modules that are flagged as executable will be loaded as plugins. Earlier ones have a lower priority.
 	IN OPTIONAL const MPQDRAFTPLUGINMODULE *lpAuxModules,
+	// The file containing the EFS file that modules with empty paths are in, or NULL
+	IN OPTIONAL LPCSTR lpszEFSFileName,
 
 	// The memory mapped file HANDLE for the patch context
 	OUT HANDLE &rhContext,
@@ -11,18 +11,61 @@
 #include "../common/QDebug.h"
 #include "MPQDraftDLL.h"
 
-// Trivial constructor and destructor
 CPluginServer::CPluginServer()
 {
 	m_bReady = FALSE;
 
 	m_nModules = 0;
 	m_pModules = NULL;
+
+	m_phModuleFiles = NULL;
+
+	m_szEFSFileName[0] = '\0';
+	m_hEFSDiskFile = INVALID_HANDLE_VALUE;
+	m_hEFSFile = NULL;
+	m_plpszExtractedFileNames = NULL;
+
+	InitializeCriticalSection(&m_csEFSLock);
+	QResourceInitialize();
 }
 
-BOOL CPluginServer::SetModules(IN MPQDRAFTPLUGINMODULE *pModules, IN DWORD nModules)
+CPluginServer::~CPluginServer()
 {
-	QDebugWriteEntry("CPluginServer(0x%X)::SetModules(0x%X, %d)", this, pModules, nModules);
+	if (m_phModuleFiles)
+	{
+		for (DWORD iCurModule = 0; iCurModule < m_nModules; iCurModule++)
+		{
+			if (m_phModuleFiles[iCurModule] != INVALID_HANDLE_VALUE)
+				CloseHandle(m_phModuleFiles[iCurModule]);
+		}
+
+		delete [] m_phModuleFiles;
+	}
+
+	if (m_plpszExtractedFileNames)
+	{
+		for (DWORD iCurModule = 0; iCurModule < m_nModules; iCurModule++)
+			delete [] m_plpszExtractedFileNames[iCurModule];
+
+		delete [] m_plpszExtractedFileNames;
+	}
+
+	// The EFS handle reads from the file, so it has to go first
+	if (m_hEFSFile)
+		CloseEFSFileForRead(m_hEFSFile);
+	if (m_hEFSDiskFile != INVALID_HANDLE_VALUE)
+		CloseHandle(m_hEFSDiskFile);
+
+	// Plugins have been unloaded by now, so the modules extracted for them can go
+	DeleteTemporaryFiles();
+	QResourceDestroy();
+
+	DeleteCriticalSection(&m_csEFSLock);
+}
+
+BOOL CPluginServer::SetModules(IN MPQDRAFTPLUGINMODULE *pModules, IN DWORD nModules, IN OPTIONAL LPCSTR lpszEFSFileName)
+{
+	QDebugWriteEntry("CPluginServer(0x%X)::SetModules(0x%X, %d, \"%s\")", this, pModules, nModules, lpszEFSFileName ? lpszEFSFileName : "");
 
 	assert(pModules);
 	assert(nModules);
@@ -31,6 +74,22 @@ BOOL CPluginServer::SetModules(IN MPQDRAFTPLUGINMODULE *pModules, IN DWORD nModu
 	m_nModules = nModules;
 	m_pModules = pModules;
 
+	// Module files are only opened if they're read through us
+	m_phModuleFiles = new HANDLE[m_nModules];
+	for (DWORD iCurModule = 0; iCurModule < m_nModules; iCurModule++)
+		m_phModuleFiles[iCurModule] = INVALID_HANDLE_VALUE;
+
+	// Likewise, modules in the EFS file are only extracted if a plugin needs them in a file
+	if (lpszEFSFileName && *lpszEFSFileName)
+	{
+		strncpy(m_szEFSFileName, lpszEFSFileName, MAX_PATH);
+		m_szEFSFileName[MAX_PATH] = '\0';
+
+		m_plpszExtractedFileNames = new LPSTR[m_nModules];
+		for (DWORD iCurModule = 0; iCurModule < m_nModules; iCurModule++)
+			m_plpszExtractedFileNames[iCurModule] = NULL;
+	}
+
 	// For debugging, list all modules present
 	for (DWORD iCurModule = 0; iCurModule < m_nModules; iCurModule++)
 		QDebugWriteEntry("CPluginServer(0x%X)::SetModules : Module slot %d has plugin ID 0x%X, module ID 0x%X, filename \"%s\"", 
@@ -41,6 +100,76 @@ BOOL CPluginServer::SetModules(IN MPQDRAFTPLUGINMODULE *pModules, IN DWORD nModu
 	return TRUE;
 }
 
+DWORD CPluginServer::FindModule(IN DWORD dwPluginID, IN DWORD dwModuleID) const
+{
+	// Linear search. This could easily be replaced with a hash table, but I didn't really envision the table of modules being so large that linear search would be significant.
+	for (DWORD iCurModule = 0; iCurModule < m_nModules; iCurModule++)
+	{
+		if ((m_pModules[iCurModule].dwComponentID == dwPluginID) &&
+			(m_pModules[iCurModule].dwModuleID == dwModuleID))
+			return iCurModule;
+	}
+
+	return (DWORD)-1;
+}
+
+HANDLE CPluginServer::GetModuleFile(IN DWORD iModule)
+{
+	assert(iModule < m_nModules);
+
+	HANDLE hModuleFile = m_phModuleFiles[iModule];
+	if (hModuleFile != INVALID_HANDLE_VALUE)
+		return hModuleFile;
+
+	// Other plugins, or the game, may have the module open as well
+	hModuleFile = CreateFile(m_pModules[iModule].szModuleFileName, GENERIC_READ, 
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+	QDebugWriteEntry("CPluginServer(0x%X)::GetModuleFile : CreateFile returned 0x%X on \"%s\"", this, hModuleFile, m_pModules[iModule].szModuleFileName);
+
+	if (hModuleFile == INVALID_HANDLE_VALUE)
+		return INVALID_HANDLE_VALUE;
+
+	// Another thread may have opened the same module at the same time. If so, use theirs.
+	HANDLE hOtherFile = InterlockedCompareExchangePointer(&m_phModuleFiles[iModule], hModuleFile, INVALID_HANDLE_VALUE);
+	if (hOtherFile != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(hModuleFile);
+
+		return hOtherFile;
+	}
+
+	return hModuleFile;
+}
+
+BOOL CPluginServer::IsModuleInEFSFile(IN DWORD iModule) const
+{
+	assert(iModule < m_nModules);
+
+	return m_plpszExtractedFileNames && !m_pModules[iModule].szModuleFileName[0];
+}
+
+EFSHANDLEFORREAD CPluginServer::GetEFSFile()
+{
+	EnterCriticalSection(&m_csEFSLock);
+
+	if (!m_hEFSFile)
+	{
+		// The stub has the SEMPQ open as well, for as long as we run
+		m_hEFSDiskFile = CreateFile(m_szEFSFileName, GENERIC_READ, 
+			FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+		if (m_hEFSDiskFile != INVALID_HANDLE_VALUE)
+			m_hEFSFile = OpenEFSFileForRead(m_hEFSDiskFile, 0, 0);
+
+		QDebugWriteEntry("CPluginServer(0x%X)::GetEFSFile : OpenEFSFileForRead returned 0x%X on \"%s\"", this, m_hEFSFile, m_szEFSFileName);
+	}
+
+	EFSHANDLEFORREAD hEFSFile = m_hEFSFile;
+
+	LeaveCriticalSection(&m_csEFSLock);
+
+	return hEFSFile;
+}
+
 // Assumes that the buffer pointed to by lpszFileName is large enough to hold the file name
 BOOL CPluginServer::GetPluginModule(IN DWORD dwPluginID, IN DWORD dwModuleID, OUT LPSTR lpszFileName)
 {
@@ -52,21 +181,132 @@ BOOL CPluginServer::GetPluginModule(IN DWORD dwPluginID, IN DWORD dwModuleID, OU
 	if (!m_bReady)
 		return FALSE;
 
-	// Linear search. This could easily be replaced with a hash table, but I didn't really envision the table of modules being so large that linear search would be significant.
-	for (DWORD iCurModule = 0; iCurModule < m_nModules; iCurModule++)
+	DWORD iModule = FindModule(dwPluginID, dwModuleID);
+	if (iModule == (DWORD)-1)
 	{
-		if ((m_pModules[iCurModule].dwComponentID == dwPluginID) &&
-			(m_pModules[iCurModule].dwModuleID == dwModuleID))
+		QDebugWriteEntry("CPluginServer(0x%X)::GetPluginModule : Module not found", this);
+
+		return FALSE;
+	}
+
+	QDebugWriteEntry("CPluginServer(0x%X)::GetPluginModule : Module found at slot %d, \"%s\"", this, iModule, m_pModules[iModule].szModuleFileName);
+
+	if (!IsModuleInEFSFile(iModule))
+	{
+		strcpy(lpszFileName, m_pModules[iModule].szModuleFileName);
+
+		return TRUE;
+	}
+
+	// The plugin wants a file, so the module has to be extracted after all. Once is enough.
+	BOOL bRetVal = FALSE;
+	EFSHANDLEFORREAD hEFSFile = GetEFSFile();
+
+	EnterCriticalSection(&m_csEFSLock);
+
+	if (!m_plpszExtractedFileNames[iModule] && hEFSFile)
+	{
+		char szTempFileName[MAX_PATH + 1];
+		if (ExtractTempEFSFile(hEFSFile, dwPluginID, dwModuleID, szTempFileName))
 		{
-			QDebugWriteEntry("CPluginServer(0x%X)::GetPluginModule : Module found at slot %d, \"%s\"", this, iCurModule, m_pModules[iCurModule].szModuleFileName);
+			m_plpszExtractedFileNames[iModule] = new char[strlen(szTempFileName) + 1];
+			strcpy(m_plpszExtractedFileNames[iModule], szTempFileName);
+		}
 
-			strcpy(lpszFileName, m_pModules[iCurModule].szModuleFileName);
+		QDebugWriteEntry("CPluginServer(0x%X)::GetPluginModule : Extracted module to \"%s\"", this, m_plpszExtractedFileNames[iModule] ? m_plpszExtractedFileNames[iModule] : "");
+	}
 
-			return TRUE;
+	if (m_plpszExtractedFileNames[iModule])
+	{
+		strcpy(lpszFileName, m_plpszExtractedFileNames[iModule]);
+		bRetVal = TRUE;
+	}
+
+	LeaveCriticalSection(&m_csEFSLock);
+
+	return bRetVal;
+}
+
+BOOL CPluginServer::GetPluginModuleSize(IN DWORD dwPluginID, IN DWORD dwModuleID, OUT LPDWORD lpdwModuleSize)
+{
+	QDebugWriteEntry("CPluginServer(0x%X)::GetPluginModuleSize(0x%X, 0x%X, 0x%X)", this, dwPluginID, dwModuleID, lpdwModuleSize);
+
+	if (!lpdwModuleSize)
+		return FALSE;
+
+	if (!m_bReady)
+		return FALSE;
+
+	DWORD iModule = FindModule(dwPluginID, dwModuleID);
+	if (iModule == (DWORD)-1)
+		return FALSE;
+
+	if (IsModuleInEFSFile(iModule))
+	{
+		EFSHANDLEFORREAD hEFSFile = GetEFSFile();
+		if (!hEFSFile)
+			return FALSE;
+
+		DWORD nNumEFSFiles = GetNumEFSFiles(hEFSFile);
+		for (DWORD iEFSFile = 0; iEFSFile < nNumEFSFiles; iEFSFile++)
+		{
+			DWORD dwComponentID, dwFileID;
+			if (EnumEFSFiles(hEFSFile, iEFSFile, &dwComponentID, &dwFileID, NULL, lpdwModuleSize) 
+				&& (dwComponentID == dwPluginID) && (dwFileID == dwModuleID))
+				return TRUE;
 		}
+
+		return FALSE;
+	}
+
+	HANDLE hModuleFile = GetModuleFile(iModule);
+	if (hModuleFile == INVALID_HANDLE_VALUE)
+		return FALSE;
+
+	DWORD dwModuleSize = GetFileSize(hModuleFile, NULL);
+	if (dwModuleSize == INVALID_FILE_SIZE)
+		return FALSE;
+
+	*lpdwModuleSize = dwModuleSize;
+
+	return TRUE;
+}
+
+BOOL CPluginServer::ReadPluginModule(IN DWORD dwPluginID, IN DWORD dwModuleID, IN DWORD dwOffset, OUT LPVOID lpvBuffer, IN DWORD nBytesToRead, OUT LPDWORD lpnBytesRead)
+{
+	// Not logged, as plugins streaming a module may call this a great many times
+
+	if ((!lpvBuffer && nBytesToRead) || !lpnBytesRead)
+		return FALSE;
+
+	*lpnBytesRead = 0;
+
+	if (!m_bReady)
+		return FALSE;
+
+	DWORD iModule = FindModule(dwPluginID, dwModuleID);
+	if (iModule == (DWORD)-1)
+		return FALSE;
+
+	// Modules still in the EFS file are read straight out of it, decompressing only the blocks the read touches
+	if (IsModuleInEFSFile(iModule))
+	{
+		EFSHANDLEFORREAD hEFSFile = GetEFSFile();
+
+		return hEFSFile && ReadEFSFile(hEFSFile, dwPluginID, dwModuleID, dwOffset, lpvBuffer, nBytesToRead, lpnBytesRead);
 	}
 
-	QDebugWriteEntry("CPluginServer(0x%X)::GetPluginModule : Module not found", this);
+	HANDLE hModuleFile = GetModuleFile(iModule);
+	if (hModuleFile == INVALID_HANDLE_VALUE)
+		return FALSE;
 
-	return FALSE;
+	// Read from the specified position without touching the file pointer, so that several threads can read at once. Reading at or past the end of the file succeeds with nothing read.
+	OVERLAPPED overlapped;
+	ZeroMemory(&overlapped, sizeof(OVERLAPPED));
+	overlapped.Offset = dwOffset;
+
+	if (!ReadFile(hModuleFile, lpvBuffer, nBytesToRead, lpnBytesRead, &overlapped))
+		return (GetLastError() == ERROR_HANDLE_EOF);
+
+	return TRUE;
 }
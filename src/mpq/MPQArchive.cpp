@@ -0,0 +1,854 @@
+/*
+	The contents of this file are subject to the Common Development and Distribution License Version 1.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at http://www.sun.com/cddl/cddl.html.
+
+	Software distributed under the License is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for the specific language governing rights and limitations under the License.
+
+	The Initial Developer of the Original Code is Justin Olbrantz. The Original Code Copyright (C) 2007 Justin Olbrantz. All Rights Reserved.
+*/
+
+#include "MPQArchive.h"
+#include "MPQCompress.h"
+#include "MPQCrypt.h"
+#include "MPQFile.h"
+#include <string.h>
+#include <new>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+struct MPQARCHIVE
+{
+	// The memory mapped file
+	const uint8_t *lpbyFileData;
+	uint64_t qwFileSize;
+#ifdef _WIN32
+	HANDLE hFile;
+	HANDLE hMapping;
+#endif
+
+	// The archive within the file, from the header to the end of the file
+	const uint8_t *lpbyArchive;
+	uint64_t qwDataSize;
+
+	MPQHEADER header;
+
+	// The decrypted tables
+	MPQHASHENTRY *lpHashTable;
+	MPQBLOCKENTRY *lpBlockTable;
+	// The high 16 bits of each block's position, or NULL if the archive has no high block table
+	const uint16_t *lpwHiBlockTable;
+
+	// The decoded HET and BET tables, which are only set up if they can be used
+	bool bHETTable;
+	MPQHETTABLE hetTable;
+	uint8_t *lpbyHETNameHashes;
+	uint32_t *lpiHETBETEntries;
+	uint64_t *lpqwBETNameHashes;
+	uint32_t *lpiBlockHashEntryStarts;
+	uint32_t *lpiBlockHashEntries;
+
+	MPQARCHIVEINFO info;
+};
+
+static const char *s_lpszErrorStrings[NUM_MPQ_ERRORS] = {
+	"The operation completed successfully.",
+	"The file could not be opened.",
+	"There is not enough memory to open the archive.",
+	"The file is not an MPQ archive.",
+	"The MPQ header is invalid.",
+	"The hash table size is not a power of 2.",
+	"The hash table extends past the end of the file.",
+	"The block table extends past the end of the file.",
+	"The high block table extends past the end of the file.",
+	"The archive uses compressed tables, which are not supported.",
+	"The file is not in the archive.",
+	"The file is corrupt.",
+	"The file is compressed with an unsupported method.",
+	"The file is encrypted, and its name is not known.",
+	"The file's name is needed to place it in the hash table, and is not known.",
+	"An option is invalid.",
+	"The archive could not be written.",
+	"The archive would be larger than 4 GB."
+};
+
+static const char *s_lpszWarningStrings[NUM_MPQ_WARNINGS] = {
+	"The archive uses a newer MPQ format than the games support; only the original header fields will be used.",
+	"The archive is truncated.",
+	"The hash table is full, which makes looking up missing files slow.",
+	"Some hash table entries refer to blocks that do not exist.",
+	"Some files have invalid flags or sizes.",
+	"Some files extend past the end of the archive.",
+	"The HET or BET table is invalid or does not match the hash and block tables; as the games only read the hash and block tables, it is ignored."
+};
+
+// Maps the entire file for reading. Returns MPQ_ERROR_NOT_MPQ for empty files, which can't be mapped.
+static MPQERROR MapArchiveFile(const char *lpszFileName, MPQARCHIVE &archive)
+{
+#ifdef _WIN32
+	archive.hFile = CreateFileA(lpszFileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+	if (archive.hFile == INVALID_HANDLE_VALUE)
+		return MPQ_ERROR_OPEN_FAILED;
+
+	LARGE_INTEGER liFileSize;
+	if (!GetFileSizeEx(archive.hFile, &liFileSize))
+		return MPQ_ERROR_OPEN_FAILED;
+
+	archive.qwFileSize = (uint64_t)liFileSize.QuadPart;
+	if (!archive.qwFileSize)
+		return MPQ_ERROR_NOT_MPQ;
+	if (archive.qwFileSize > (SIZE_T)-1)
+		return MPQ_ERROR_OPEN_FAILED;
+
+	archive.hMapping = CreateFileMapping(archive.hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!archive.hMapping)
+		return MPQ_ERROR_OPEN_FAILED;
+
+	archive.lpbyFileData = (const uint8_t *)MapViewOfFile(archive.hMapping, FILE_MAP_READ, 0, 0, 0);
+	if (!archive.lpbyFileData)
+		return MPQ_ERROR_OPEN_FAILED;
+#else
+	int hFile = open(lpszFileName, O_RDONLY);
+	if (hFile == -1)
+		return MPQ_ERROR_OPEN_FAILED;
+
+	struct stat fileStat;
+	if (fstat(hFile, &fileStat) != 0 || !S_ISREG(fileStat.st_mode))
+	{
+		close(hFile);
+		return MPQ_ERROR_OPEN_FAILED;
+	}
+
+	archive.qwFileSize = (uint64_t)fileStat.st_size;
+	if (!archive.qwFileSize)
+	{
+		close(hFile);
+		return MPQ_ERROR_NOT_MPQ;
+	}
+	if (archive.qwFileSize > (size_t)-1)
+	{
+		close(hFile);
+		return MPQ_ERROR_OPEN_FAILED;
+	}
+
+	// The mapping stays valid after the file is closed
+	void *lpvMapping = mmap(NULL, (size_t)archive.qwFileSize, PROT_READ, MAP_PRIVATE, hFile, 0);
+	close(hFile);
+
+	if (lpvMapping == MAP_FAILED)
+		return MPQ_ERROR_OPEN_FAILED;
+
+	archive.lpbyFileData = (const uint8_t *)lpvMapping;
+#endif
+
+	return MPQ_ERROR_SUCCESS;
+}
+
+static void UnmapArchiveFile(MPQARCHIVE &archive)
+{
+#ifdef _WIN32
+	if (archive.lpbyFileData)
+		UnmapViewOfFile(archive.lpbyFileData);
+	if (archive.hMapping)
+		CloseHandle(archive.hMapping);
+	if (archive.hFile != INVALID_HANDLE_VALUE)
+		CloseHandle(archive.hFile);
+#else
+	if (archive.lpbyFileData)
+		munmap((void *)archive.lpbyFileData, (size_t)archive.qwFileSize);
+#endif
+}
+
+static inline uint32_t ReadDword(const uint8_t *lpbyData)
+{
+	uint32_t dwValue;
+	memcpy(&dwValue, lpbyData, sizeof(dwValue));
+
+	return dwValue;
+}
+
+/*
+	Reads and checks an MPQ header. The header is read as far as its format version goes; if the header is too small for its format version, or the version is unknown, only the original fields are read, as that's all the original Storm reads anyway. Fields beyond what was read are left 0.
+*/
+static MPQERROR ReadHeader(const uint8_t *lpbyArchive, uint64_t qwDataSize, MPQHEADER &header, uint32_t &cbHeaderSize, uint32_t &grfWarnings)
+{
+	static const uint32_t s_cbHeaderSizes[] = { MPQ_HEADER_SIZE_V1, MPQ_HEADER_SIZE_V2, MPQ_HEADER_SIZE_V3, MPQ_HEADER_SIZE_V4 };
+
+	if (qwDataSize < MPQ_HEADER_SIZE_V1)
+		return MPQ_ERROR_BAD_HEADER;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(&header, lpbyArchive, MPQ_HEADER_SIZE_V1);
+
+	cbHeaderSize = MPQ_HEADER_SIZE_V1;
+	if (header.wFormatVersion != MPQ_FORMAT_VERSION_1)
+	{
+		grfWarnings |= MPQ_WARNING_NEWER_FORMAT;
+
+		if (header.wFormatVersion <= MPQ_FORMAT_VERSION_4)
+		{
+			uint32_t cbVersionHeaderSize = s_cbHeaderSizes[header.wFormatVersion];
+			if (header.dwHeaderSize >= cbVersionHeaderSize && qwDataSize >= cbVersionHeaderSize)
+			{
+				memcpy(&header, lpbyArchive, cbVersionHeaderSize);
+				cbHeaderSize = cbVersionHeaderSize;
+			}
+		}
+	}
+
+	if (header.wSectorSizeShift > MPQ_MAX_SECTOR_SIZE_SHIFT)
+		return MPQ_ERROR_BAD_HEADER;
+
+	// Storm finds files with the hash modulo the table size, which it computes with a mask
+	if (!header.nHashTableEntries || (header.nHashTableEntries & (header.nHashTableEntries - 1)))
+		return MPQ_ERROR_BAD_HASH_TABLE;
+
+	return MPQ_ERROR_SUCCESS;
+}
+
+/*
+	Finds the MPQ header the way Storm does: by checking every MPQ_HEADER_ALIGNMENT bytes from the start of the file for the signature. A user data header found this way is followed to the header it points to. A signature with an invalid header is skipped, as the signature may just be part of whatever the archive is embedded in; if there's no valid header, the error for the first invalid one is returned.
+*/
+static MPQERROR FindHeader(MPQARCHIVE &archive)
+{
+	MPQERROR firstError = MPQ_ERROR_NOT_MPQ;
+
+	for (uint64_t qwOffset = 0; qwOffset + MPQ_HEADER_SIZE_V1 <= archive.qwFileSize; qwOffset += MPQ_HEADER_ALIGNMENT)
+	{
+		uint32_t dwSignature = ReadDword(archive.lpbyFileData + qwOffset);
+		uint64_t qwHeaderOffset = qwOffset, qwUserDataOffset = MPQ_NO_USER_DATA;
+
+		if (dwSignature == MPQ_USERDATA_SIGNATURE)
+		{
+			MPQUSERDATA userData;
+			memcpy(&userData, archive.lpbyFileData + qwOffset, sizeof(userData));
+
+			qwHeaderOffset = qwOffset + userData.dwHeaderOffset;
+			if (!userData.dwHeaderOffset || qwHeaderOffset + MPQ_HEADER_SIZE_V1 > archive.qwFileSize
+				|| ReadDword(archive.lpbyFileData + qwHeaderOffset) != MPQ_HEADER_SIGNATURE)
+				continue;
+
+			qwUserDataOffset = qwOffset;
+		}
+		else if (dwSignature != MPQ_HEADER_SIGNATURE)
+			continue;
+
+		const uint8_t *lpbyArchive = archive.lpbyFileData + qwHeaderOffset;
+		uint64_t qwDataSize = archive.qwFileSize - qwHeaderOffset;
+		uint32_t cbHeaderSize, grfWarnings = 0;
+
+		MPQERROR error = ReadHeader(lpbyArchive, qwDataSize, archive.header, cbHeaderSize, grfWarnings);
+		if (error != MPQ_ERROR_SUCCESS)
+		{
+			if (firstError == MPQ_ERROR_NOT_MPQ)
+				firstError = error;
+
+			continue;
+		}
+
+		archive.lpbyArchive = lpbyArchive;
+		archive.qwDataSize = qwDataSize;
+
+		archive.info.qwArchiveOffset = qwHeaderOffset;
+		archive.info.qwUserDataOffset = qwUserDataOffset;
+		archive.info.cbHeaderSize = cbHeaderSize;
+		archive.info.grfWarnings |= grfWarnings;
+
+		return MPQ_ERROR_SUCCESS;
+	}
+
+	return firstError;
+}
+
+// Copies a table out of the archive and decrypts it
+static void *LoadTable(const MPQARCHIVE &archive, uint64_t qwOffset, size_t cbTable, uint32_t dwKey)
+{
+	// Allocate at least one byte, so that an empty table isn't mistaken for an allocation failure
+	uint8_t *lpbyTable = new (std::nothrow) uint8_t[cbTable ? cbTable : 1];
+	if (!lpbyTable)
+		return NULL;
+
+	memcpy(lpbyTable, archive.lpbyArchive + qwOffset, cbTable);
+	MPQDecryptBlock(lpbyTable, cbTable, dwKey);
+
+	return lpbyTable;
+}
+
+// Checks that the tables are within the file, and loads them
+static MPQERROR LoadTables(MPQARCHIVE &archive)
+{
+	const MPQHEADER &header = archive.header;
+	MPQARCHIVEINFO &info = archive.info;
+
+	uint64_t qwHashTableOffset = header.dwHashTableOffset | ((uint64_t)header.wHashTableOffsetHigh << 32),
+		qwBlockTableOffset = header.dwBlockTableOffset | ((uint64_t)header.wBlockTableOffsetHigh << 32);
+	uint64_t cbHashTable = (uint64_t)header.nHashTableEntries * sizeof(MPQHASHENTRY),
+		cbBlockTable = (uint64_t)header.nBlockTableEntries * sizeof(MPQBLOCKENTRY),
+		cbHiBlockTable = (uint64_t)header.nBlockTableEntries * sizeof(uint16_t);
+
+	// Format version 4 tables may be compressed, in which case their stored size is less than their real size
+	if ((header.qwHashTableSize && header.qwHashTableSize < cbHashTable)
+		|| (header.qwBlockTableSize && header.qwBlockTableSize < cbBlockTable)
+		|| (header.qwHiBlockTableSize && header.qwHiBlockTableSize < cbHiBlockTable))
+		return MPQ_ERROR_UNSUPPORTED;
+
+	if (qwHashTableOffset > archive.qwDataSize || cbHashTable > archive.qwDataSize - qwHashTableOffset)
+		return MPQ_ERROR_HASH_TABLE_BOUNDS;
+	if (qwBlockTableOffset > archive.qwDataSize || cbBlockTable > archive.qwDataSize - qwBlockTableOffset)
+		return MPQ_ERROR_BLOCK_TABLE_BOUNDS;
+	if (header.qwHiBlockTableOffset && (header.qwHiBlockTableOffset > archive.qwDataSize
+		|| cbHiBlockTable > archive.qwDataSize - header.qwHiBlockTableOffset))
+		return MPQ_ERROR_HI_BLOCK_TABLE_BOUNDS;
+
+	archive.lpHashTable = (MPQHASHENTRY *)LoadTable(archive, qwHashTableOffset, (size_t)cbHashTable, MPQ_HASH_TABLE_KEY);
+	archive.lpBlockTable = (MPQBLOCKENTRY *)LoadTable(archive, qwBlockTableOffset, (size_t)cbBlockTable, MPQ_BLOCK_TABLE_KEY);
+	if (!archive.lpHashTable || !archive.lpBlockTable)
+		return MPQ_ERROR_NO_MEMORY;
+
+	// The high block table isn't encrypted, so it can be used in place
+	if (header.qwHiBlockTableOffset)
+		archive.lpwHiBlockTable = (const uint16_t *)(archive.lpbyArchive + header.qwHiBlockTableOffset);
+
+	info.nHashTableEntries = header.nHashTableEntries;
+	info.nBlockTableEntries = header.nBlockTableEntries;
+	info.bHiBlockTable = (archive.lpwHiBlockTable != NULL);
+	info.bHETTable = (header.qwHETTableOffset != 0);
+	info.bBETTable = (header.qwBETTableOffset != 0);
+
+	// Everything the archive is known to contain must come before its end
+	uint64_t qwTablesEnd = qwHashTableOffset + cbHashTable;
+	if (qwBlockTableOffset + cbBlockTable > qwTablesEnd)
+		qwTablesEnd = qwBlockTableOffset + cbBlockTable;
+	if (header.qwHiBlockTableOffset && header.qwHiBlockTableOffset + cbHiBlockTable > qwTablesEnd)
+		qwTablesEnd = header.qwHiBlockTableOffset + cbHiBlockTable;
+
+	// The original Storm ignores the archive size, and many old archives have it wrong, so only later formats are held to it
+	uint64_t qwHeaderArchiveSize = info.cbHeaderSize >= MPQ_HEADER_SIZE_V3 ? header.qwArchiveSize : header.dwArchiveSize;
+	if (qwHeaderArchiveSize > archive.qwDataSize && info.cbHeaderSize >= MPQ_HEADER_SIZE_V2)
+		info.grfWarnings |= MPQ_WARNING_TRUNCATED;
+
+	if (qwHeaderArchiveSize >= qwTablesEnd && qwHeaderArchiveSize <= archive.qwDataSize)
+		info.qwArchiveSize = qwHeaderArchiveSize;
+	else
+		info.qwArchiveSize = archive.qwDataSize;
+
+	return MPQ_ERROR_SUCCESS;
+}
+
+// Goes through the tables, counting files and looking for anything that would cause trouble reading them
+static MPQERROR CheckTables(MPQARCHIVE &archive)
+{
+	MPQARCHIVEINFO &info = archive.info;
+
+	bool *lpbBlockUsed = new (std::nothrow) bool[info.nBlockTableEntries ? info.nBlockTableEntries : 1];
+	if (!lpbBlockUsed)
+		return MPQ_ERROR_NO_MEMORY;
+
+	memset(lpbBlockUsed, 0, info.nBlockTableEntries * sizeof(bool));
+
+	for (uint32_t iHashEntry = 0; iHashEntry < info.nHashTableEntries; iHashEntry++)
+	{
+		uint32_t iBlock = archive.lpHashTable[iHashEntry].dwBlockIndex;
+
+		if (iBlock == MPQ_HASH_ENTRY_EMPTY)
+			info.nEmptyHashEntries++;
+		else if (iBlock == MPQ_HASH_ENTRY_DELETED)
+			info.nDeletedHashEntries++;
+		else if (iBlock >= info.nBlockTableEntries)
+			info.grfWarnings |= MPQ_WARNING_BAD_BLOCK_INDEX;
+		else
+		{
+			info.nFiles++;
+			lpbBlockUsed[iBlock] = true;
+		}
+	}
+
+	if (!info.nEmptyHashEntries)
+		info.grfWarnings |= MPQ_WARNING_HASH_TABLE_FULL;
+
+	for (uint32_t iBlock = 0; iBlock < info.nBlockTableEntries; iBlock++)
+	{
+		if (!lpbBlockUsed[iBlock])
+		{
+			info.nUnusedBlocks++;
+			continue;
+		}
+
+		const MPQBLOCKENTRY &block = archive.lpBlockTable[iBlock];
+
+		if (!(block.grfFlags & MPQ_FILE_EXISTS) || (block.grfFlags & ~MPQ_FILE_VALID_FLAGS))
+			info.grfWarnings |= MPQ_WARNING_BAD_BLOCK;
+		// Uncompressed files are stored as they are, so they can't be smaller than the file
+		else if (!(block.grfFlags & (MPQ_FILE_IMPLODE | MPQ_FILE_COMPRESS)) && block.cbCompressedSize < block.cbFileSize)
+			info.grfWarnings |= MPQ_WARNING_BAD_BLOCK;
+
+		uint64_t qwFilePos = MPQGetBlockFilePos(&archive, iBlock);
+		if (qwFilePos > archive.qwDataSize || block.cbCompressedSize > archive.qwDataSize - qwFilePos)
+			info.grfWarnings |= MPQ_WARNING_FILE_BOUNDS;
+	}
+
+	delete [] lpbBlockUsed;
+
+	return MPQ_ERROR_SUCCESS;
+}
+
+/*
+	Copies a HET or BET table out of the archive, decrypts it, and decompresses it if it's compressed. Gets the table after the extended table header. Returns MPQ_ERROR_BAD_FILE if the table is invalid.
+*/
+static MPQERROR LoadExtTable(const MPQARCHIVE &archive, uint64_t qwOffset, uint64_t qwStoredSize, uint32_t dwSignature, uint32_t dwKey,
+	uint8_t **lplpbyTable, uint32_t *lpcbTable)
+{
+	if (qwOffset > archive.qwDataSize || archive.qwDataSize - qwOffset < sizeof(MPQEXTTABLEHEADER))
+		return MPQ_ERROR_BAD_FILE;
+
+	MPQEXTTABLEHEADER extHeader;
+	memcpy(&extHeader, archive.lpbyArchive + qwOffset, sizeof(extHeader));
+
+	// Only format version 4 records the stored size; before that, tables are never compressed
+	if (!qwStoredSize)
+		qwStoredSize = sizeof(extHeader) + (uint64_t)extHeader.cbDataSize;
+
+	if (extHeader.dwSignature != dwSignature || qwStoredSize < sizeof(extHeader) || qwStoredSize > archive.qwDataSize - qwOffset)
+		return MPQ_ERROR_BAD_FILE;
+
+	uint64_t cbStored = qwStoredSize - sizeof(extHeader);
+	if (cbStored > extHeader.cbDataSize)
+		cbStored = extHeader.cbDataSize;
+
+	uint8_t *lpbyTable = (uint8_t *)LoadTable(archive, qwOffset + sizeof(extHeader), (size_t)cbStored, dwKey);
+	if (!lpbyTable)
+		return MPQ_ERROR_NO_MEMORY;
+
+	if (cbStored < extHeader.cbDataSize)
+	{
+		uint8_t *lpbyDecompressed = new (std::nothrow) uint8_t[extHeader.cbDataSize];
+		if (!lpbyDecompressed)
+		{
+			delete [] lpbyTable;
+			return MPQ_ERROR_NO_MEMORY;
+		}
+
+		MPQERROR error = MPQDecompressSector(lpbyDecompressed, extHeader.cbDataSize, lpbyTable, (uint32_t)cbStored, MPQ_FILE_COMPRESS);
+		delete [] lpbyTable;
+
+		if (error != MPQ_ERROR_SUCCESS)
+		{
+			delete [] lpbyDecompressed;
+			return error == MPQ_ERROR_NO_MEMORY ? error : MPQ_ERROR_BAD_FILE;
+		}
+
+		lpbyTable = lpbyDecompressed;
+	}
+
+	*lplpbyTable = lpbyTable;
+	*lpcbTable = extHeader.cbDataSize;
+
+	return MPQ_ERROR_SUCCESS;
+}
+
+// Reads a value of up to 64 bits from a bit array, least significant bit first
+static uint64_t ReadBits(const uint8_t *lpbyBits, uint64_t iBit, uint32_t nBits)
+{
+	uint64_t qwValue = 0;
+
+	for (uint32_t nBitsRead = 0; nBitsRead < nBits; )
+	{
+		uint64_t iCurBit = iBit + nBitsRead;
+		uint32_t iShift = (uint32_t)(iCurBit % 8), nBitsInByte = 8 - iShift;
+		if (nBitsInByte > nBits - nBitsRead)
+			nBitsInByte = nBits - nBitsRead;
+
+		uint64_t qwBits = (lpbyBits[iCurBit / 8] >> iShift) & ((1U << nBitsInByte) - 1);
+		qwValue |= qwBits << nBitsRead;
+		nBitsRead += nBitsInByte;
+	}
+
+	return qwValue;
+}
+
+// Checks that nValues values, nBitsApart bits apart, of nBits bits each, fit in a bit array of cbArray bytes
+static bool BitArrayFits(uint64_t nValues, uint32_t nBitsApart, uint32_t nBits, uint64_t cbArray)
+{
+	if (!nValues)
+		return true;
+
+	return nBits <= nBitsApart && (nValues - 1) * nBitsApart + nBits <= cbArray * 8;
+}
+
+/*
+	Decodes the HET table, and checks that its BET indices are within the BET table. Returns MPQ_ERROR_BAD_FILE if it's invalid.
+*/
+static MPQERROR DecodeHETTable(MPQARCHIVE &archive, const uint8_t *lpbyTable, uint32_t cbTable, uint32_t nBETEntries)
+{
+	MPQHETHEADER hetHeader;
+	if (cbTable < sizeof(hetHeader))
+		return MPQ_ERROR_BAD_FILE;
+
+	memcpy(&hetHeader, lpbyTable, sizeof(hetHeader));
+
+	// A name hash has at least the 8 bits stored in the HET table
+	if (!hetHeader.nTotalEntries || hetHeader.nNameHashBits < 8 || hetHeader.nNameHashBits > 64
+		|| hetHeader.nIndexBits > 32 || hetHeader.nIndexBitsTotal > 64)
+		return MPQ_ERROR_BAD_FILE;
+
+	const uint8_t *lpbyNameHashes = lpbyTable + sizeof(hetHeader),
+		*lpbyIndices = lpbyNameHashes + hetHeader.nTotalEntries;
+	if ((uint64_t)hetHeader.nTotalEntries + hetHeader.cbIndexTableSize > cbTable - sizeof(hetHeader)
+		|| !BitArrayFits(hetHeader.nTotalEntries, hetHeader.nIndexBitsTotal, hetHeader.nIndexBits, hetHeader.cbIndexTableSize))
+		return MPQ_ERROR_BAD_FILE;
+
+	archive.lpbyHETNameHashes = new (std::nothrow) uint8_t[hetHeader.nTotalEntries];
+	archive.lpiHETBETEntries = new (std::nothrow) uint32_t[hetHeader.nTotalEntries];
+	if (!archive.lpbyHETNameHashes || !archive.lpiHETBETEntries)
+		return MPQ_ERROR_NO_MEMORY;
+
+	memcpy(archive.lpbyHETNameHashes, lpbyNameHashes, hetHeader.nTotalEntries);
+
+	for (uint32_t iEntry = 0; iEntry < hetHeader.nTotalEntries; iEntry++)
+	{
+		uint32_t iBETEntry = (uint32_t)ReadBits(lpbyIndices, (uint64_t)iEntry * hetHeader.nIndexBitsTotal, hetHeader.nIndexBits);
+
+		uint8_t byNameHash = lpbyNameHashes[iEntry];
+		if (byNameHash != MPQ_HET_ENTRY_FREE && byNameHash != MPQ_HET_ENTRY_DELETED && iBETEntry >= nBETEntries)
+			return MPQ_ERROR_BAD_FILE;
+
+		archive.lpiHETBETEntries[iEntry] = iBETEntry;
+	}
+
+	archive.hetTable.nEntries = hetHeader.nTotalEntries;
+	archive.hetTable.nNameHashBits = hetHeader.nNameHashBits;
+
+	return MPQ_ERROR_SUCCESS;
+}
+
+/*
+	Decodes the BET table's name hashes, and checks that its entries are the same as the block table's. Returns MPQ_ERROR_BAD_FILE if the table is invalid or doesn't match.
+*/
+static MPQERROR DecodeBETTable(MPQARCHIVE &archive, const uint8_t *lpbyTable, uint32_t cbTable, uint32_t nNameHashBits)
+{
+	MPQBETHEADER betHeader;
+	if (cbTable < sizeof(betHeader))
+		return MPQ_ERROR_BAD_FILE;
+
+	memcpy(&betHeader, lpbyTable, sizeof(betHeader));
+
+	if (betHeader.nEntries != archive.info.nBlockTableEntries || betHeader.nNameHashBits != nNameHashBits - 8)
+		return MPQ_ERROR_BAD_FILE;
+
+	// Each field must be within an entry, and no larger than the block table's field
+	if (betHeader.nFilePosBits > 64 || betHeader.nFileSizeBits > 32 || betHeader.nCompressedSizeBits > 32
+		|| betHeader.nFlagIndexBits > 32 || betHeader.nNameHashBitsTotal > 64
+		|| (uint64_t)betHeader.iFilePosBit + betHeader.nFilePosBits > betHeader.nEntryBits
+		|| (uint64_t)betHeader.iFileSizeBit + betHeader.nFileSizeBits > betHeader.nEntryBits
+		|| (uint64_t)betHeader.iCompressedSizeBit + betHeader.nCompressedSizeBits > betHeader.nEntryBits
+		|| (uint64_t)betHeader.iFlagIndexBit + betHeader.nFlagIndexBits > betHeader.nEntryBits)
+		return MPQ_ERROR_BAD_FILE;
+
+	uint64_t cbFlags = (uint64_t)betHeader.nFlags * sizeof(uint32_t),
+		cbEntries = ((uint64_t)betHeader.nEntries * betHeader.nEntryBits + 7) / 8;
+	if (cbFlags + cbEntries + betHeader.cbNameHashTableSize > cbTable - sizeof(betHeader)
+		|| !BitArrayFits(betHeader.nEntries, betHeader.nNameHashBitsTotal, betHeader.nNameHashBits, betHeader.cbNameHashTableSize))
+		return MPQ_ERROR_BAD_FILE;
+
+	const uint8_t *lpbyFlags = lpbyTable + sizeof(betHeader),
+		*lpbyEntries = lpbyFlags + cbFlags,
+		*lpbyNameHashes = lpbyEntries + cbEntries;
+
+	archive.lpqwBETNameHashes = new (std::nothrow) uint64_t[betHeader.nEntries ? betHeader.nEntries : 1];
+	if (!archive.lpqwBETNameHashes)
+		return MPQ_ERROR_NO_MEMORY;
+
+	for (uint32_t iEntry = 0; iEntry < betHeader.nEntries; iEntry++)
+	{
+		const MPQBLOCKENTRY &block = archive.lpBlockTable[iEntry];
+		uint64_t iEntryBit = (uint64_t)iEntry * betHeader.nEntryBits;
+
+		uint32_t iFlags = (uint32_t)ReadBits(lpbyEntries, iEntryBit + betHeader.iFlagIndexBit, betHeader.nFlagIndexBits);
+		if (iFlags >= betHeader.nFlags)
+			return MPQ_ERROR_BAD_FILE;
+
+		if (ReadBits(lpbyEntries, iEntryBit + betHeader.iFilePosBit, betHeader.nFilePosBits) != MPQGetBlockFilePos(&archive, iEntry)
+			|| ReadBits(lpbyEntries, iEntryBit + betHeader.iFileSizeBit, betHeader.nFileSizeBits) != block.cbFileSize
+			|| ReadBits(lpbyEntries, iEntryBit + betHeader.iCompressedSizeBit, betHeader.nCompressedSizeBits) != block.cbCompressedSize
+			|| ReadDword(lpbyFlags + iFlags * sizeof(uint32_t)) != block.grfFlags)
+			return MPQ_ERROR_BAD_FILE;
+
+		archive.lpqwBETNameHashes[iEntry] = ReadBits(lpbyNameHashes, (uint64_t)iEntry * betHeader.nNameHashBitsTotal, betHeader.nNameHashBits);
+	}
+
+	return MPQ_ERROR_SUCCESS;
+}
+
+// Indexes the hash table entries by block, so that a file found through the HET table can be given its hash table entry
+static MPQERROR IndexBlockHashEntries(MPQARCHIVE &archive)
+{
+	const MPQARCHIVEINFO &info = archive.info;
+
+	archive.lpiBlockHashEntryStarts = new (std::nothrow) uint32_t[info.nBlockTableEntries + 1];
+	archive.lpiBlockHashEntries = new (std::nothrow) uint32_t[info.nFiles ? info.nFiles : 1];
+	if (!archive.lpiBlockHashEntryStarts || !archive.lpiBlockHashEntries)
+		return MPQ_ERROR_NO_MEMORY;
+
+	// Count the entries of each block, then turn the counts into starts, and fill each block's entries in from its start
+	memset(archive.lpiBlockHashEntryStarts, 0, (info.nBlockTableEntries + 1) * sizeof(uint32_t));
+	for (uint32_t iHashEntry = 0; iHashEntry < info.nHashTableEntries; iHashEntry++)
+	{
+		uint32_t iBlock = archive.lpHashTable[iHashEntry].dwBlockIndex;
+		if (iBlock < info.nBlockTableEntries)
+			archive.lpiBlockHashEntryStarts[iBlock + 1]++;
+	}
+
+	for (uint32_t iBlock = 0; iBlock < info.nBlockTableEntries; iBlock++)
+		archive.lpiBlockHashEntryStarts[iBlock + 1] += archive.lpiBlockHashEntryStarts[iBlock];
+
+	for (uint32_t iHashEntry = 0; iHashEntry < info.nHashTableEntries; iHashEntry++)
+	{
+		uint32_t iBlock = archive.lpHashTable[iHashEntry].dwBlockIndex;
+		if (iBlock < info.nBlockTableEntries)
+			archive.lpiBlockHashEntries[archive.lpiBlockHashEntryStarts[iBlock]++] = iHashEntry;
+	}
+
+	// Filling the entries in moved each start to the next block's
+	for (uint32_t iBlock = info.nBlockTableEntries; iBlock; iBlock--)
+		archive.lpiBlockHashEntryStarts[iBlock] = archive.lpiBlockHashEntryStarts[iBlock - 1];
+	archive.lpiBlockHashEntryStarts[0] = 0;
+
+	return MPQ_ERROR_SUCCESS;
+}
+
+// Checks that the HET table finds the files every archive may have where the hash table does, which catches tables written with a different name hash
+static bool CheckHETLookups(MPQARCHIVE &archive)
+{
+	static const char *s_lpszSpecialFiles[] = { MPQ_LISTFILE_NAME, "(attributes)", "(signature)" };
+
+	for (size_t iFile = 0; iFile < sizeof(s_lpszSpecialFiles) / sizeof(s_lpszSpecialFiles[0]); iFile++)
+	{
+		MPQNAMEHASHES hashes;
+		MPQHashName(s_lpszSpecialFiles[iFile], &hashes);
+
+		uint32_t iHashEntry, iHETHashEntry;
+		MPQERROR error = MPQFindFileByHash(&archive, hashes.dwIndexHash, hashes.dwNameHashA, hashes.dwNameHashB, MPQ_LOCALE_NEUTRAL, &iHashEntry),
+			hetError = MPQFindFileByHETHash(&archive, MPQHashNameHET(s_lpszSpecialFiles[iFile]), MPQ_LOCALE_NEUTRAL, &iHETHashEntry);
+
+		if (error != hetError || (error == MPQ_ERROR_SUCCESS && iHashEntry != iHETHashEntry))
+			return false;
+	}
+
+	return true;
+}
+
+/*
+	Loads the HET and BET tables, if the archive has both, and checks them against the hash and block tables. Storm only reads the hash and block tables, so tables that don't match them are ignored with a warning rather than failing the archive.
+*/
+static MPQERROR LoadHETTables(MPQARCHIVE &archive)
+{
+	const MPQHEADER &header = archive.header;
+	if (!header.qwHETTableOffset || !header.qwBETTableOffset)
+		return MPQ_ERROR_SUCCESS;
+
+	uint8_t *lpbyHETTable = NULL, *lpbyBETTable = NULL;
+	uint32_t cbHETTable, cbBETTable;
+
+	MPQERROR error = LoadExtTable(archive, header.qwHETTableOffset, header.qwHETTableSize, MPQ_HET_TABLE_SIGNATURE, MPQ_HASH_TABLE_KEY, &lpbyHETTable, &cbHETTable);
+	if (error == MPQ_ERROR_SUCCESS)
+		error = LoadExtTable(archive, header.qwBETTableOffset, header.qwBETTableSize, MPQ_BET_TABLE_SIGNATURE, MPQ_BLOCK_TABLE_KEY, &lpbyBETTable, &cbBETTable);
+	if (error == MPQ_ERROR_SUCCESS)
+		error = DecodeHETTable(archive, lpbyHETTable, cbHETTable, archive.info.nBlockTableEntries);
+	if (error == MPQ_ERROR_SUCCESS)
+		error = DecodeBETTable(archive, lpbyBETTable, cbBETTable, archive.hetTable.nNameHashBits);
+	if (error == MPQ_ERROR_SUCCESS)
+		error = IndexBlockHashEntries(archive);
+
+	delete [] lpbyHETTable;
+	delete [] lpbyBETTable;
+
+	if (error == MPQ_ERROR_NO_MEMORY)
+		return error;
+
+	if (error == MPQ_ERROR_SUCCESS)
+	{
+		MPQHETTABLE &hetTable = archive.hetTable;
+		hetTable.lpbyNameHashes = archive.lpbyHETNameHashes;
+		hetTable.lpiBETEntries = archive.lpiHETBETEntries;
+		hetTable.lpqwBETNameHashes = archive.lpqwBETNameHashes;
+		hetTable.lpiBlockHashEntryStarts = archive.lpiBlockHashEntryStarts;
+		hetTable.lpiBlockHashEntries = archive.lpiBlockHashEntries;
+
+		// The check looks files up through MPQGetHETTable, so the tables are made usable while they're checked
+		archive.bHETTable = true;
+		archive.bHETTable = CheckHETLookups(archive);
+	}
+
+	if (!archive.bHETTable)
+		archive.info.grfWarnings |= MPQ_WARNING_BAD_HET_TABLE;
+
+	return MPQ_ERROR_SUCCESS;
+}
+
+MPQERROR MPQOpenArchive(const char *lpszFileName, HMPQARCHIVE *lphArchive)
+{
+	if (!lpszFileName || !lphArchive)
+		return MPQ_ERROR_OPEN_FAILED;
+
+	*lphArchive = NULL;
+
+	MPQARCHIVE *lpArchive = new (std::nothrow) MPQARCHIVE;
+	if (!lpArchive)
+		return MPQ_ERROR_NO_MEMORY;
+
+	memset(lpArchive, 0, sizeof(*lpArchive));
+#ifdef _WIN32
+	lpArchive->hFile = INVALID_HANDLE_VALUE;
+#endif
+
+	MPQERROR error = MapArchiveFile(lpszFileName, *lpArchive);
+	if (error == MPQ_ERROR_SUCCESS)
+	{
+		lpArchive->info.qwFileSize = lpArchive->qwFileSize;
+		error = FindHeader(*lpArchive);
+	}
+	if (error == MPQ_ERROR_SUCCESS)
+		error = LoadTables(*lpArchive);
+	if (error == MPQ_ERROR_SUCCESS)
+		error = CheckTables(*lpArchive);
+	if (error == MPQ_ERROR_SUCCESS)
+		error = LoadHETTables(*lpArchive);
+
+	if (error != MPQ_ERROR_SUCCESS)
+	{
+		MPQCloseArchive(lpArchive);
+		return error;
+	}
+
+	MPQARCHIVEINFO &info = lpArchive->info;
+	info.wFormatVersion = lpArchive->header.wFormatVersion;
+	info.cbSectorSize = MPQ_BASE_SECTOR_SIZE << lpArchive->header.wSectorSizeShift;
+
+	// Every file needs a hash table entry. Without a high block table, file positions are 32-bit; the high block table adds 16 bits.
+	info.nMaxFiles = info.nHashTableEntries;
+	info.qwMaxArchiveSize = info.cbHeaderSize >= MPQ_HEADER_SIZE_V2 ? (1ULL << 48) : (1ULL << 32);
+
+	*lphArchive = lpArchive;
+
+	return MPQ_ERROR_SUCCESS;
+}
+
+void MPQCloseArchive(HMPQARCHIVE hArchive)
+{
+	if (!hArchive)
+		return;
+
+	delete [] (uint8_t *)hArchive->lpHashTable;
+	delete [] (uint8_t *)hArchive->lpBlockTable;
+
+	delete [] hArchive->lpbyHETNameHashes;
+	delete [] hArchive->lpiHETBETEntries;
+	delete [] hArchive->lpqwBETNameHashes;
+	delete [] hArchive->lpiBlockHashEntryStarts;
+	delete [] hArchive->lpiBlockHashEntries;
+
+	UnmapArchiveFile(*hArchive);
+
+	delete hArchive;
+}
+
+MPQERROR MPQValidateArchive(const char *lpszFileName, MPQARCHIVEINFO *lpArchiveInfo)
+{
+	HMPQARCHIVE hArchive;
+	MPQERROR error = MPQOpenArchive(lpszFileName, &hArchive);
+	if (error != MPQ_ERROR_SUCCESS)
+		return error;
+
+	if (lpArchiveInfo)
+		*lpArchiveInfo = *MPQGetArchiveInfo(hArchive);
+
+	MPQCloseArchive(hArchive);
+
+	return MPQ_ERROR_SUCCESS;
+}
+
+const MPQARCHIVEINFO *MPQGetArchiveInfo(HMPQARCHIVE hArchive)
+{
+	return &hArchive->info;
+}
+
+const MPQHEADER *MPQGetArchiveHeader(HMPQARCHIVE hArchive)
+{
+	return &hArchive->header;
+}
+
+const MPQHASHENTRY *MPQGetHashTable(HMPQARCHIVE hArchive, uint32_t *lpnEntries)
+{
+	if (lpnEntries)
+		*lpnEntries = hArchive->info.nHashTableEntries;
+
+	return hArchive->lpHashTable;
+}
+
+const MPQBLOCKENTRY *MPQGetBlockTable(HMPQARCHIVE hArchive, uint32_t *lpnEntries)
+{
+	if (lpnEntries)
+		*lpnEntries = hArchive->info.nBlockTableEntries;
+
+	return hArchive->lpBlockTable;
+}
+
+const MPQHETTABLE *MPQGetHETTable(HMPQARCHIVE hArchive)
+{
+	return hArchive->bHETTable ? &hArchive->hetTable : NULL;
+}
+
+uint64_t MPQGetBlockFilePos(HMPQARCHIVE hArchive, uint32_t iBlock)
+{
+	uint64_t qwFilePos = hArchive->lpBlockTable[iBlock].dwFilePos;
+
+	if (hArchive->lpwHiBlockTable)
+	{
+		uint16_t wFilePosHigh;
+		memcpy(&wFilePosHigh, hArchive->lpwHiBlockTable + iBlock, sizeof(wFilePosHigh));
+
+		qwFilePos |= (uint64_t)wFilePosHigh << 32;
+	}
+
+	return qwFilePos;
+}
+
+const uint8_t *MPQGetArchiveData(HMPQARCHIVE hArchive, uint64_t *lpqwDataSize)
+{
+	if (lpqwDataSize)
+		*lpqwDataSize = hArchive->qwDataSize;
+
+	return hArchive->lpbyArchive;
+}
+
+const uint8_t *MPQGetFileData(HMPQARCHIVE hArchive, uint64_t *lpqwFileSize)
+{
+	if (lpqwFileSize)
+		*lpqwFileSize = hArchive->qwFileSize;
+
+	return hArchive->lpbyFileData;
+}
+
+const char *MPQGetErrorString(MPQERROR error)
+{
+	if ((unsigned)error >= NUM_MPQ_ERRORS)
+		return "Unknown error.";
+
+	return s_lpszErrorStrings[error];
+}
+
+const char *MPQGetWarningString(uint32_t dwWarning)
+{
+	for (unsigned iWarning = 0; iWarning < NUM_MPQ_WARNINGS; iWarning++)
+	{
+		if (dwWarning == (1U << iWarning))
+			return s_lpszWarningStrings[iWarning];
+	}
+
+	return NULL;
+}
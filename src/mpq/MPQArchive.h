@@ -0,0 +1,253 @@
+/*
+	The contents of this file are subject to the Common Development and Distribution License Version 1.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at http://www.sun.com/cddl/cddl.html.
+
+	Software distributed under the License is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for the specific language governing rights and limitations under the License.
+
+	The Initial Developer of the Original Code is Justin Olbrantz. The Original Code Copyright (C) 2007 Justin Olbrantz. All Rights Reserved.
+*/
+
+// Prevent this header from being included multiple times
+#ifndef MPQARCHIVE_H
+#define MPQARCHIVE_H
+
+#include <stdint.h>
+#include "MPQFormat.h"
+
+/*
+	MPQArchive reads the structure of MPQ archives without Storm, so that archives can be checked before they're given to a game. An archive is memory mapped, its header is found the same way Storm finds it, and its hash and block tables are decrypted and checked. Nothing is read but the header and the tables, so opening an archive takes about as long as decrypting its tables, no matter how large the archive is.
+	Problems which would stop Storm from opening the archive at all are errors, and cause MPQOpenArchive to fail. Problems which would only affect some of the files in the archive are warnings, which are reported in the archive information.
+	The library is portable, and doesn't depend on windows.h; errors are returned rather than set with SetLastError. All offsets are 64-bit, but archives must fit in the address space to be mapped.
+*/
+
+// The handle to an open archive
+typedef struct MPQARCHIVE *HMPQARCHIVE;
+
+enum MPQERROR
+{
+	MPQ_ERROR_SUCCESS = 0,
+	MPQ_ERROR_OPEN_FAILED,	// The file couldn't be opened or memory mapped
+	MPQ_ERROR_NO_MEMORY,
+	MPQ_ERROR_NOT_MPQ,	// There is no MPQ header in the file
+	MPQ_ERROR_BAD_HEADER,	// There is an MPQ header, but it's invalid
+	MPQ_ERROR_BAD_HASH_TABLE,	// The hash table's size is not a power of 2
+	MPQ_ERROR_HASH_TABLE_BOUNDS,	// The hash table extends past the end of the file
+	MPQ_ERROR_BLOCK_TABLE_BOUNDS,	// The block table extends past the end of the file
+	MPQ_ERROR_HI_BLOCK_TABLE_BOUNDS,	// The high block table extends past the end of the file
+	MPQ_ERROR_UNSUPPORTED,	// The archive uses features this library doesn't support (compressed tables)
+	MPQ_ERROR_FILE_NOT_FOUND,	// The file is not in the archive
+	MPQ_ERROR_BAD_FILE,	// The file's data is corrupt
+	MPQ_ERROR_UNSUPPORTED_COMPRESSION,	// The file is compressed with a method this library doesn't support
+	MPQ_ERROR_UNKNOWN_KEY,	// The file is encrypted, and its name, which the key is derived from, is unknown
+	MPQ_ERROR_UNKNOWN_NAME,	// The file's name is needed to place it in a new hash table, and is unknown
+	MPQ_ERROR_INVALID_OPTION,	// An option given to the function is invalid
+	MPQ_ERROR_WRITE_FAILED,	// The output file couldn't be created or written
+	MPQ_ERROR_TOO_LARGE,	// The archive would be larger than the original format can hold
+
+	NUM_MPQ_ERRORS
+};
+
+// Warnings (MPQARCHIVEINFO::grfWarnings)
+#define MPQ_WARNING_NEWER_FORMAT 0x00000001	// The archive uses a format version the games MPQDraft patches don't understand. They will only read the original header fields.
+#define MPQ_WARNING_TRUNCATED 0x00000002	// The header gives an archive size larger than the file
+#define MPQ_WARNING_HASH_TABLE_FULL 0x00000004	// The hash table has no empty entries, so looking up a file which isn't there searches the whole table
+#define MPQ_WARNING_BAD_BLOCK_INDEX 0x00000008	// Some hash table entries refer to blocks past the end of the block table
+#define MPQ_WARNING_BAD_BLOCK 0x00000010	// Some files have invalid flags or sizes
+#define MPQ_WARNING_FILE_BOUNDS 0x00000020	// Some files' data extends past the end of the file
+#define MPQ_WARNING_BAD_HET_TABLE 0x00000040	// The HET or BET table is invalid or doesn't match the hash and block tables, and is ignored
+
+#define NUM_MPQ_WARNINGS 7
+
+// Returned as MPQARCHIVEINFO::qwUserDataOffset if there is no user data header
+#define MPQ_NO_USER_DATA 0xFFFFFFFFFFFFFFFFULL
+
+// The information about an archive gathered while opening it
+struct MPQARCHIVEINFO
+{
+	// The size of the file containing the archive
+	uint64_t qwFileSize;
+	// The offset of the MPQ header in the file
+	uint64_t qwArchiveOffset;
+	// The offset of the user data header in the file, or MPQ_NO_USER_DATA
+	uint64_t qwUserDataOffset;
+	// The size of the archive, from the header to the end of the file or the end of the archive, whichever comes first
+	uint64_t qwArchiveSize;
+
+	// The format version, as stored in the header (MPQ_FORMAT_VERSION_*), and the header size actually used
+	uint16_t wFormatVersion;
+	uint32_t cbHeaderSize;
+	// The size of file sectors
+	uint32_t cbSectorSize;
+
+	uint32_t nHashTableEntries;
+	uint32_t nBlockTableEntries;
+	// Whether the archive has the tables introduced by later format versions. Whether the HET and BET tables can be used is given by MPQGetHETTable.
+	bool bHiBlockTable;
+	bool bHETTable;
+	bool bBETTable;
+
+	// The number of hash table entries referring to files, deleted files, and never used
+	uint32_t nFiles;
+	uint32_t nDeletedHashEntries;
+	uint32_t nEmptyHashEntries;
+	// The number of block table entries no hash table entry refers to
+	uint32_t nUnusedBlocks;
+
+	// The limits of the archive as it is: the number of files it can hold, and the largest size it can grow to without changing format
+	uint32_t nMaxFiles;
+	uint64_t qwMaxArchiveSize;
+
+	// Problems found with the archive (MPQ_WARNING_*)
+	uint32_t grfWarnings;
+};
+
+/*
+	The HET and BET tables of an archive, decoded. They're only used if they describe the same files as the hash and block tables, which Storm uses: the BET table must be the same as the block table, entry for entry, and the HET table must find the files every archive has names for where the hash table does.
+*/
+struct MPQHETTABLE
+{
+	// The HET table: the top 8 bits of the name hash in each entry (or MPQ_HET_ENTRY_FREE or MPQ_HET_ENTRY_DELETED), and the BET entry each refers to
+	uint32_t nEntries;
+	uint32_t nNameHashBits;
+	const uint8_t *lpbyNameHashes;
+	const uint32_t *lpiBETEntries;
+
+	// The rest of the name hash of each BET entry, below the top 8 bits. BET entries are the same as blocks.
+	const uint64_t *lpqwBETNameHashes;
+
+	// The hash table entries referring to each block, for finding the entry of a file found through the HET table: lpiBlockHashEntries[lpiBlockHashEntryStarts[iBlock]] up to lpiBlockHashEntries[lpiBlockHashEntryStarts[iBlock + 1]].
+	const uint32_t *lpiBlockHashEntryStarts;
+	const uint32_t *lpiBlockHashEntries;
+};
+
+/*
+	* MPQOpenArchive *
+	Opens an archive, finds its header, and reads and checks its tables. The archive must not be changed while it is open.
+*/
+MPQERROR MPQOpenArchive(
+	// The file containing the archive
+	const char *lpszFileName,
+	// The handle to the archive
+	HMPQARCHIVE *lphArchive
+);
+
+/*
+	* MPQCloseArchive *
+	Closes an archive opened with MPQOpenArchive. All pointers obtained from the archive become invalid.
+*/
+void MPQCloseArchive(
+	// The archive to close
+	HMPQARCHIVE hArchive
+);
+
+/*
+	* MPQValidateArchive *
+	Opens an archive, gets its information, and closes it again.
+*/
+MPQERROR MPQValidateArchive(
+	// The file containing the archive
+	const char *lpszFileName,
+	// The information about the archive. May be NULL.
+	MPQARCHIVEINFO *lpArchiveInfo
+);
+
+/*
+	* MPQGetArchiveInfo *
+	Gets the information about an open archive.
+*/
+const MPQARCHIVEINFO *MPQGetArchiveInfo(
+	// The archive
+	HMPQARCHIVE hArchive
+);
+
+/*
+	* MPQGetArchiveHeader *
+	Gets the header of an open archive. Fields not used by the archive's format version, or beyond the end of its header, are 0.
+*/
+const MPQHEADER *MPQGetArchiveHeader(
+	// The archive
+	HMPQARCHIVE hArchive
+);
+
+/*
+	* MPQGetHashTable *
+	Gets the decrypted hash table of an open archive.
+*/
+const MPQHASHENTRY *MPQGetHashTable(
+	// The archive
+	HMPQARCHIVE hArchive,
+	// The number of entries in the table. May be NULL.
+	uint32_t *lpnEntries
+);
+
+/*
+	* MPQGetBlockTable *
+	Gets the decrypted block table of an open archive. The file positions in the block table are only the low 32 bits; use MPQGetBlockFilePos to get the full position.
+*/
+const MPQBLOCKENTRY *MPQGetBlockTable(
+	// The archive
+	HMPQARCHIVE hArchive,
+	// The number of entries in the table. May be NULL.
+	uint32_t *lpnEntries
+);
+
+/*
+	* MPQGetHETTable *
+	Gets the decoded HET and BET tables of an open archive, or NULL if it has none, or they can't be used.
+*/
+const MPQHETTABLE *MPQGetHETTable(
+	// The archive
+	HMPQARCHIVE hArchive
+);
+
+/*
+	* MPQGetBlockFilePos *
+	Gets the full position of a block's data, relative to the archive, including the high 16 bits if the archive has a high block table.
+*/
+uint64_t MPQGetBlockFilePos(
+	// The archive
+	HMPQARCHIVE hArchive,
+	// The index of the block
+	uint32_t iBlock
+);
+
+/*
+	* MPQGetArchiveData *
+	Gets a pointer to the memory mapped archive, starting at its header. Offsets in the archive's tables are relative to this pointer.
+*/
+const uint8_t *MPQGetArchiveData(
+	// The archive
+	HMPQARCHIVE hArchive,
+	// The number of bytes which may be read from the pointer. This is everything to the end of the file, which may be more than the archive. May be NULL.
+	uint64_t *lpqwDataSize
+);
+
+/*
+	* MPQGetFileData *
+	Gets a pointer to the whole memory mapped file containing an archive, including anything before the archive. The archive starts MPQARCHIVEINFO::qwArchiveOffset bytes in.
+*/
+const uint8_t *MPQGetFileData(
+	// The archive
+	HMPQARCHIVE hArchive,
+	// The size of the file. May be NULL.
+	uint64_t *lpqwFileSize
+);
+
+/*
+	* MPQGetErrorString *
+	Gets a description of an error, suitable for showing to the user.
+*/
+const char *MPQGetErrorString(
+	// The error
+	MPQERROR error
+);
+
+/*
+	* MPQGetWarningString *
+	Gets a description of a single warning, suitable for showing to the user. Returns NULL if dwWarning is not a single known warning.
+*/
+const char *MPQGetWarningString(
+	// The warning (one MPQ_WARNING_* value)
+	uint32_t dwWarning
+);
+
+#endif // #ifndef MPQARCHIVE_H
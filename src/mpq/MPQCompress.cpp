@@ -0,0 +1,958 @@
+/*
+	The contents of this file are subject to the Common Development and Distribution License Version 1.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at http://www.sun.com/cddl/cddl.html.
+
+	Software distributed under the License is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for the specific language governing rights and limitations under the License.
+
+	The Initial Developer of the Original Code is Justin Olbrantz. The Original Code Copyright (C) 2007 Justin Olbrantz. All Rights Reserved.
+*/
+
+#include "MPQCompress.h"
+#include <string.h>
+#include <new>
+
+// Both formats are read a bit at a time from the least significant bit of each byte
+struct BITREADER
+{
+	const uint8_t *lpbyInput;
+	uint32_t cbInput;
+	uint32_t iNextByte;
+
+	uint32_t dwBitBuffer;
+	uint32_t nBitsBuffered;
+
+	// Set if a read went past the end of the input. Reads past the end return 0 bits, so decoding can carry on until the caller checks this.
+	bool bOverrun;
+};
+
+static void InitBitReader(BITREADER &bits, const void *lpvInput, uint32_t cbInput)
+{
+	bits.lpbyInput = (const uint8_t *)lpvInput;
+	bits.cbInput = cbInput;
+	bits.iNextByte = 0;
+	bits.dwBitBuffer = 0;
+	bits.nBitsBuffered = 0;
+	bits.bOverrun = false;
+}
+
+// Reads up to 24 bits
+static inline uint32_t GetBits(BITREADER &bits, uint32_t nBits)
+{
+	while (bits.nBitsBuffered < nBits)
+	{
+		if (bits.iNextByte < bits.cbInput)
+			bits.dwBitBuffer |= (uint32_t)bits.lpbyInput[bits.iNextByte++] << bits.nBitsBuffered;
+		else
+			bits.bOverrun = true;
+
+		bits.nBitsBuffered += 8;
+	}
+
+	uint32_t dwValue = bits.dwBitBuffer & ((1U << nBits) - 1);
+	bits.dwBitBuffer >>= nBits;
+	bits.nBitsBuffered -= nBits;
+
+	return dwValue;
+}
+
+// Discards the bits remaining in the current byte
+static inline void AlignToByte(BITREADER &bits)
+{
+	bits.dwBitBuffer = 0;
+	bits.nBitsBuffered = 0;
+}
+
+// Compressed data is written the same way
+struct BITWRITER
+{
+	uint8_t *lpbyOutput;
+	uint32_t cbOutput;
+	uint32_t iNextByte;
+
+	uint32_t dwBitBuffer;
+	uint32_t nBitsBuffered;
+
+	// Set if a write went past the end of the output. Writes past the end are dropped, so encoding can carry on until the caller checks this.
+	bool bOverrun;
+};
+
+static void InitBitWriter(BITWRITER &bits, void *lpvOutput, uint32_t cbOutput)
+{
+	bits.lpbyOutput = (uint8_t *)lpvOutput;
+	bits.cbOutput = cbOutput;
+	bits.iNextByte = 0;
+	bits.dwBitBuffer = 0;
+	bits.nBitsBuffered = 0;
+	bits.bOverrun = false;
+}
+
+// Writes up to 24 bits
+static inline void PutBits(BITWRITER &bits, uint32_t dwValue, uint32_t nBits)
+{
+	bits.dwBitBuffer |= dwValue << bits.nBitsBuffered;
+	bits.nBitsBuffered += nBits;
+
+	while (bits.nBitsBuffered >= 8)
+	{
+		if (bits.iNextByte < bits.cbOutput)
+			bits.lpbyOutput[bits.iNextByte++] = (uint8_t)bits.dwBitBuffer;
+		else
+			bits.bOverrun = true;
+
+		bits.dwBitBuffer >>= 8;
+		bits.nBitsBuffered -= 8;
+	}
+}
+
+// Fills the rest of the current byte with 0 bits
+static inline void FlushBits(BITWRITER &bits)
+{
+	if (bits.nBitsBuffered)
+		PutBits(bits, 0, 8 - bits.nBitsBuffered);
+}
+
+#define MAX_CODE_BITS 15
+#define MAX_SYMBOLS 288
+
+/*
+	A canonical Huffman code, stored as the number of codes of each length and the symbols in order of their codes. This is slower to decode than a lookup table, but the tables are rebuilt for every deflate block, and sectors are small, so building quickly matters as much as decoding quickly.
+*/
+struct HUFFMANCODE
+{
+	uint16_t nCodesOfLength[MAX_CODE_BITS + 1];
+	uint16_t wSymbols[MAX_SYMBOLS];
+};
+
+// Builds a code from the length of each symbol's code. Returns 0 if the code is complete, a positive number if it's incomplete, and a negative number if it's oversubscribed.
+static int BuildHuffmanCode(HUFFMANCODE &code, const uint8_t *lpbyLengths, uint32_t nSymbols)
+{
+	memset(code.nCodesOfLength, 0, sizeof(code.nCodesOfLength));
+	for (uint32_t iSymbol = 0; iSymbol < nSymbols; iSymbol++)
+		code.nCodesOfLength[lpbyLengths[iSymbol]]++;
+
+	// No codes at all is complete, but decoding will fail
+	if (code.nCodesOfLength[0] == nSymbols)
+		return 0;
+
+	int nCodesLeft = 1;
+	for (uint32_t nLength = 1; nLength <= MAX_CODE_BITS; nLength++)
+	{
+		nCodesLeft <<= 1;
+		nCodesLeft -= code.nCodesOfLength[nLength];
+		if (nCodesLeft < 0)
+			return nCodesLeft;
+	}
+
+	uint16_t iFirstOfLength[MAX_CODE_BITS + 1];
+	iFirstOfLength[1] = 0;
+	for (uint32_t nLength = 1; nLength < MAX_CODE_BITS; nLength++)
+		iFirstOfLength[nLength + 1] = iFirstOfLength[nLength] + code.nCodesOfLength[nLength];
+
+	for (uint32_t iSymbol = 0; iSymbol < nSymbols; iSymbol++)
+	{
+		if (lpbyLengths[iSymbol])
+			code.wSymbols[iFirstOfLength[lpbyLengths[iSymbol]]++] = (uint16_t)iSymbol;
+	}
+
+	return nCodesLeft;
+}
+
+// Decodes a symbol. PKWare stores its codes with every bit inverted. Returns -1 if no code matches.
+template <bool bInvertBits>
+static inline int DecodeSymbol(BITREADER &bits, const HUFFMANCODE &code)
+{
+	int nCode = 0, nFirst = 0, iSymbol = 0;
+
+	for (uint32_t nLength = 1; nLength <= MAX_CODE_BITS; nLength++)
+	{
+		nCode |= GetBits(bits, 1) ^ (bInvertBits ? 1 : 0);
+
+		int nCodes = code.nCodesOfLength[nLength];
+		if (nCode - nFirst < nCodes)
+			return code.wSymbols[iSymbol + nCode - nFirst];
+
+		iSymbol += nCodes;
+		nFirst = (nFirst + nCodes) << 1;
+		nCode <<= 1;
+	}
+
+	return -1;
+}
+
+// The code of each symbol, for writing. The bits of each code are in the order they're read, so a code can be written with a single PutBits.
+struct HUFFMANENCODER
+{
+	uint16_t wCodes[MAX_SYMBOLS];
+	uint8_t byLengths[MAX_SYMBOLS];
+};
+
+// Builds the codes BuildHuffmanCode decodes from the same lengths
+template <bool bInvertBits>
+static void BuildHuffmanEncoder(HUFFMANENCODER &encoder, const uint8_t *lpbyLengths, uint32_t nSymbols)
+{
+	uint16_t nCodesOfLength[MAX_CODE_BITS + 1] = { 0 };
+	for (uint32_t iSymbol = 0; iSymbol < nSymbols; iSymbol++)
+		nCodesOfLength[lpbyLengths[iSymbol]]++;
+	nCodesOfLength[0] = 0;
+
+	// Codes of each length follow on from the last code of the length before, in the order of their symbols
+	uint32_t dwNextCode[MAX_CODE_BITS + 1], dwCode = 0;
+	for (uint32_t nLength = 1; nLength <= MAX_CODE_BITS; nLength++)
+	{
+		dwCode = (dwCode + nCodesOfLength[nLength - 1]) << 1;
+		dwNextCode[nLength] = dwCode;
+	}
+
+	for (uint32_t iSymbol = 0; iSymbol < nSymbols; iSymbol++)
+	{
+		uint32_t nLength = lpbyLengths[iSymbol];
+		encoder.byLengths[iSymbol] = (uint8_t)nLength;
+		encoder.wCodes[iSymbol] = 0;
+		if (!nLength)
+			continue;
+
+		// Codes are read from their most significant bit
+		dwCode = dwNextCode[nLength]++ ^ (bInvertBits ? (1U << nLength) - 1 : 0);
+		for (uint32_t iBit = 0; iBit < nLength; iBit++)
+			encoder.wCodes[iSymbol] |= ((dwCode >> (nLength - 1 - iBit)) & 1) << iBit;
+	}
+}
+
+static inline void PutSymbol(BITWRITER &bits, const HUFFMANENCODER &encoder, uint32_t iSymbol)
+{
+	PutBits(bits, encoder.wCodes[iSymbol], encoder.byLengths[iSymbol]);
+}
+
+/*
+	Finds earlier copies of the data at each position, for both compressors. Positions are kept in chains of those that start with the same 3 bytes, most recent first, and only so many of each chain are looked at, so that data with many repeats doesn't take too long.
+*/
+#define MATCH_HASH_BITS 15
+#define MAX_MATCH_CHAIN 128
+#define MIN_MATCH_LENGTH 3
+#define NO_MATCH_POSITION 0xFFFFFFFF
+
+struct MATCHFINDER
+{
+	const uint8_t *lpbyInput;
+	uint32_t cbInput;
+	// How far back a copy may come from
+	uint32_t cbWindow;
+
+	// The most recent position with each hash, and the position before each position with the same hash
+	uint32_t *lpdwHeadPositions;
+	uint32_t *lpdwPreviousPositions;
+};
+
+// Returns false if there isn't enough memory
+static bool InitMatchFinder(MATCHFINDER &finder, const void *lpvInput, uint32_t cbInput, uint32_t cbWindow)
+{
+	finder.lpbyInput = (const uint8_t *)lpvInput;
+	finder.cbInput = cbInput;
+	finder.cbWindow = cbWindow;
+	finder.lpdwHeadPositions = new (std::nothrow) uint32_t[1 << MATCH_HASH_BITS];
+	finder.lpdwPreviousPositions = new (std::nothrow) uint32_t[cbInput ? cbInput : 1];
+
+	if (!finder.lpdwHeadPositions || !finder.lpdwPreviousPositions)
+		return false;
+
+	for (uint32_t iHash = 0; iHash < (1 << MATCH_HASH_BITS); iHash++)
+		finder.lpdwHeadPositions[iHash] = NO_MATCH_POSITION;
+
+	return true;
+}
+
+static void FreeMatchFinder(MATCHFINDER &finder)
+{
+	delete [] finder.lpdwHeadPositions;
+	delete [] finder.lpdwPreviousPositions;
+}
+
+static inline uint32_t HashMatchPosition(const uint8_t *lpbyData)
+{
+	return (((uint32_t)lpbyData[0] | ((uint32_t)lpbyData[1] << 8) | ((uint32_t)lpbyData[2] << 16)) * 2654435761U) >> (32 - MATCH_HASH_BITS);
+}
+
+// Adds a position to the chains. Every position has to be added, in order.
+static inline void AddMatchPosition(MATCHFINDER &finder, uint32_t iPos)
+{
+	if (iPos + MIN_MATCH_LENGTH > finder.cbInput)
+		return;
+
+	uint32_t dwHash = HashMatchPosition(finder.lpbyInput + iPos);
+	finder.lpdwPreviousPositions[iPos] = finder.lpdwHeadPositions[dwHash];
+	finder.lpdwHeadPositions[dwHash] = iPos;
+}
+
+// Finds the longest copy of the data at a position, up to nMaxLength bytes, among the positions added before it. Returns its length, or 0 if there's none of at least MIN_MATCH_LENGTH bytes.
+static uint32_t FindMatch(const MATCHFINDER &finder, uint32_t iPos, uint32_t nMaxLength, uint32_t &nDistance)
+{
+	if (nMaxLength > finder.cbInput - iPos)
+		nMaxLength = finder.cbInput - iPos;
+	if (nMaxLength < MIN_MATCH_LENGTH)
+		return 0;
+
+	const uint8_t *lpbyCurrent = finder.lpbyInput + iPos;
+	uint32_t nBestLength = 0;
+	uint32_t iCandidate = finder.lpdwHeadPositions[HashMatchPosition(lpbyCurrent)];
+
+	for (uint32_t nChain = MAX_MATCH_CHAIN; iCandidate != NO_MATCH_POSITION && iPos - iCandidate <= finder.cbWindow && nChain; nChain--)
+	{
+		const uint8_t *lpbyCandidate = finder.lpbyInput + iCandidate;
+
+		// A candidate can only be longer than the best so far if it matches at the end of it
+		if (lpbyCandidate[nBestLength] == lpbyCurrent[nBestLength])
+		{
+			uint32_t nLength = 0;
+			while (nLength < nMaxLength && lpbyCandidate[nLength] == lpbyCurrent[nLength])
+				nLength++;
+
+			if (nLength > nBestLength)
+			{
+				nBestLength = nLength;
+				nDistance = iPos - iCandidate;
+				if (nLength == nMaxLength)
+					break;
+			}
+		}
+
+		iCandidate = finder.lpdwPreviousPositions[iCandidate];
+	}
+
+	return nBestLength >= MIN_MATCH_LENGTH ? nBestLength : 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// PKWare Data Compression Library
+
+/*
+	The DCL uses fixed Huffman codes, given here as runs of code lengths: the low 4 bits of each byte are a code length, and the high 4 bits are the number of symbols with that length, minus 1.
+*/
+static const uint8_t s_byPKLiteralLengths[] = {
+	11, 124, 8, 7, 28, 7, 188, 13, 76, 4, 10, 8, 12, 10, 12, 10, 8, 23, 8,
+	9, 7, 6, 7, 8, 7, 6, 55, 8, 23, 24, 12, 11, 7, 9, 11, 12, 6, 7, 22, 5,
+	7, 24, 6, 11, 9, 6, 7, 22, 7, 11, 38, 7, 9, 8, 25, 11, 8, 11, 9, 12,
+	8, 12, 5, 38, 5, 38, 5, 11, 7, 5, 6, 21, 6, 10, 53, 8, 7, 24, 10, 27,
+	44, 253, 253, 253, 252, 252, 252, 13, 12, 45, 12, 45, 12, 61, 12, 45,
+	44, 173
+};
+static const uint8_t s_byPKLengthLengths[] = { 2, 35, 36, 53, 38, 23 };
+static const uint8_t s_byPKDistanceLengths[] = { 2, 20, 53, 230, 247, 151, 248 };
+
+// The copy length for each length symbol is the base plus that many extra bits
+static const uint16_t s_wPKLengthBase[16] = { 3, 2, 4, 5, 6, 7, 8, 9, 10, 12, 16, 24, 40, 72, 136, 264 };
+static const uint8_t s_byPKLengthExtraBits[16] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 2, 3, 4, 5, 6, 7, 8 };
+
+// The length which marks the end of the data
+#define PK_END_OF_DATA 519
+
+// The size of the dictionary MPQImplode uses: distances have this many low bits stored directly, and 6 high bits coded
+#define PK_DICTIONARY_BITS 6
+
+// Expands runs of code lengths, and returns the number of symbols
+static uint32_t ExpandPKLengths(uint8_t *lpbyLengths, const uint8_t *lpbyRuns, uint32_t nRuns)
+{
+	uint32_t nSymbols = 0;
+
+	for (uint32_t iRun = 0; iRun < nRuns; iRun++)
+	{
+		for (uint32_t nRepeat = (lpbyRuns[iRun] >> 4) + 1; nRepeat; nRepeat--)
+			lpbyLengths[nSymbols++] = lpbyRuns[iRun] & 0xF;
+	}
+
+	return nSymbols;
+}
+
+static void BuildPKCode(HUFFMANCODE &code, const uint8_t *lpbyRuns, uint32_t nRuns)
+{
+	uint8_t byLengths[256];
+	uint32_t nSymbols = ExpandPKLengths(byLengths, lpbyRuns, nRuns);
+
+	BuildHuffmanCode(code, byLengths, nSymbols);
+}
+
+static void BuildPKEncoder(HUFFMANENCODER &encoder, const uint8_t *lpbyRuns, uint32_t nRuns)
+{
+	uint8_t byLengths[256];
+	uint32_t nSymbols = ExpandPKLengths(byLengths, lpbyRuns, nRuns);
+
+	BuildHuffmanEncoder<true>(encoder, byLengths, nSymbols);
+}
+
+struct PKCODES
+{
+	HUFFMANCODE literalCode, lengthCode, distanceCode;
+
+	PKCODES()
+	{
+		BuildPKCode(literalCode, s_byPKLiteralLengths, sizeof(s_byPKLiteralLengths));
+		BuildPKCode(lengthCode, s_byPKLengthLengths, sizeof(s_byPKLengthLengths));
+		BuildPKCode(distanceCode, s_byPKDistanceLengths, sizeof(s_byPKDistanceLengths));
+	}
+};
+
+bool MPQExplode(void *lpvOutput, uint32_t *lpcbOutput, const void *lpvInput, uint32_t cbInput)
+{
+	// Built once, on first use
+	static const PKCODES pkCodes;
+
+	uint8_t *lpbyOutput = (uint8_t *)lpvOutput;
+	uint32_t cbOutput = *lpcbOutput, iOutput = 0;
+
+	BITREADER bits;
+	InitBitReader(bits, lpvInput, cbInput);
+
+	// The header says whether literals are Huffman coded, and how many low bits of distances are stored directly
+	uint32_t bCodedLiterals = GetBits(bits, 8), nDictionaryBits = GetBits(bits, 8);
+	if (bCodedLiterals > 1 || nDictionaryBits < 4 || nDictionaryBits > 6)
+		return false;
+
+	while (!bits.bOverrun)
+	{
+		if (GetBits(bits, 1))
+		{
+			int iLengthSymbol = DecodeSymbol<true>(bits, pkCodes.lengthCode);
+			if (iLengthSymbol < 0)
+				return false;
+
+			uint32_t nLength = s_wPKLengthBase[iLengthSymbol] + GetBits(bits, s_byPKLengthExtraBits[iLengthSymbol]);
+			if (nLength == PK_END_OF_DATA)
+			{
+				*lpcbOutput = iOutput;
+				return !bits.bOverrun;
+			}
+
+			// Copies of 2 bytes can only go back a short way, so they store fewer low bits
+			uint32_t nLowBits = nLength == 2 ? 2 : nDictionaryBits;
+			int iDistanceSymbol = DecodeSymbol<true>(bits, pkCodes.distanceCode);
+			if (iDistanceSymbol < 0)
+				return false;
+
+			uint32_t nDistance = (((uint32_t)iDistanceSymbol << nLowBits) | GetBits(bits, nLowBits)) + 1;
+			if (nDistance > iOutput || nLength > cbOutput - iOutput)
+				return false;
+
+			// The copy may overlap what it's writing, which repeats the data, so it has to go byte by byte
+			for (; nLength; nLength--, iOutput++)
+				lpbyOutput[iOutput] = lpbyOutput[iOutput - nDistance];
+		}
+		else
+		{
+			int iLiteral = bCodedLiterals ? DecodeSymbol<true>(bits, pkCodes.literalCode) : (int)GetBits(bits, 8);
+			if (iLiteral < 0 || iOutput == cbOutput)
+				return false;
+
+			lpbyOutput[iOutput++] = (uint8_t)iLiteral;
+		}
+	}
+
+	return false;
+}
+
+// Literals are written uncoded, so only lengths and distances need codes
+struct PKENCODERS
+{
+	HUFFMANENCODER lengthEncoder, distanceEncoder;
+	// The length symbol for each copy length
+	uint8_t byLengthSymbols[PK_END_OF_DATA + 1];
+
+	PKENCODERS()
+	{
+		BuildPKEncoder(lengthEncoder, s_byPKLengthLengths, sizeof(s_byPKLengthLengths));
+		BuildPKEncoder(distanceEncoder, s_byPKDistanceLengths, sizeof(s_byPKDistanceLengths));
+
+		for (uint32_t iSymbol = 0; iSymbol < 16; iSymbol++)
+		{
+			for (uint32_t iExtra = 0; iExtra < (1U << s_byPKLengthExtraBits[iSymbol]); iExtra++)
+				byLengthSymbols[s_wPKLengthBase[iSymbol] + iExtra] = (uint8_t)iSymbol;
+		}
+	}
+};
+
+static inline void PutPKLength(BITWRITER &bits, const PKENCODERS &pkEncoders, uint32_t nLength)
+{
+	uint32_t iSymbol = pkEncoders.byLengthSymbols[nLength];
+
+	PutSymbol(bits, pkEncoders.lengthEncoder, iSymbol);
+	PutBits(bits, nLength - s_wPKLengthBase[iSymbol], s_byPKLengthExtraBits[iSymbol]);
+}
+
+bool MPQImplode(void *lpvOutput, uint32_t *lpcbOutput, const void *lpvInput, uint32_t cbInput)
+{
+	// Built once, on first use
+	static const PKENCODERS pkEncoders;
+
+	const uint8_t *lpbyInput = (const uint8_t *)lpvInput;
+
+	BITWRITER bits;
+	InitBitWriter(bits, lpvOutput, *lpcbOutput);
+
+	PutBits(bits, 0, 8);
+	PutBits(bits, PK_DICTIONARY_BITS, 8);
+
+	// Copies of 2 bytes, which can only come from the last 256 bytes, aren't looked for
+	MATCHFINDER finder;
+	if (!InitMatchFinder(finder, lpvInput, cbInput, 64 << PK_DICTIONARY_BITS))
+	{
+		FreeMatchFinder(finder);
+		return false;
+	}
+
+	for (uint32_t iInput = 0; iInput < cbInput && !bits.bOverrun; )
+	{
+		uint32_t nDistance;
+		uint32_t nLength = FindMatch(finder, iInput, PK_END_OF_DATA - 1, nDistance);
+
+		if (nLength)
+		{
+			PutBits(bits, 1, 1);
+			PutPKLength(bits, pkEncoders, nLength);
+			PutSymbol(bits, pkEncoders.distanceEncoder, (nDistance - 1) >> PK_DICTIONARY_BITS);
+			PutBits(bits, (nDistance - 1) & ((1 << PK_DICTIONARY_BITS) - 1), PK_DICTIONARY_BITS);
+		}
+		else
+		{
+			nLength = 1;
+			PutBits(bits, 0, 1);
+			PutBits(bits, lpbyInput[iInput], 8);
+		}
+
+		for (; nLength; nLength--)
+			AddMatchPosition(finder, iInput++);
+	}
+
+	FreeMatchFinder(finder);
+
+	PutBits(bits, 1, 1);
+	PutPKLength(bits, pkEncoders, PK_END_OF_DATA);
+	FlushBits(bits);
+
+	if (bits.bOverrun)
+		return false;
+
+	*lpcbOutput = bits.iNextByte;
+
+	return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// zlib
+
+static const uint16_t s_wDeflateLengthBase[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t s_byDeflateLengthExtraBits[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t s_wDeflateDistanceBase[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t s_byDeflateDistanceExtraBits[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+// The order code length code lengths are stored in dynamic blocks
+static const uint8_t s_byCodeLengthOrder[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+#define DEFLATE_END_OF_BLOCK 256
+
+// Decodes the compressed data of a block, with the given codes
+static bool InflateCodes(BITREADER &bits, const HUFFMANCODE &lengthCode, const HUFFMANCODE &distanceCode, uint8_t *lpbyOutput, uint32_t cbOutput, uint32_t &iOutput)
+{
+	while (!bits.bOverrun)
+	{
+		int iSymbol = DecodeSymbol<false>(bits, lengthCode);
+		if (iSymbol < 0)
+			return false;
+
+		if (iSymbol < DEFLATE_END_OF_BLOCK)
+		{
+			if (iOutput == cbOutput)
+				return false;
+
+			lpbyOutput[iOutput++] = (uint8_t)iSymbol;
+			continue;
+		}
+
+		if (iSymbol == DEFLATE_END_OF_BLOCK)
+			return true;
+
+		iSymbol -= DEFLATE_END_OF_BLOCK + 1;
+		if (iSymbol >= 29)
+			return false;
+
+		uint32_t nLength = s_wDeflateLengthBase[iSymbol] + GetBits(bits, s_byDeflateLengthExtraBits[iSymbol]);
+
+		iSymbol = DecodeSymbol<false>(bits, distanceCode);
+		if (iSymbol < 0 || iSymbol >= 30)
+			return false;
+
+		uint32_t nDistance = s_wDeflateDistanceBase[iSymbol] + GetBits(bits, s_byDeflateDistanceExtraBits[iSymbol]);
+		if (nDistance > iOutput || nLength > cbOutput - iOutput)
+			return false;
+
+		for (; nLength; nLength--, iOutput++)
+			lpbyOutput[iOutput] = lpbyOutput[iOutput - nDistance];
+	}
+
+	return false;
+}
+
+static bool InflateStoredBlock(BITREADER &bits, uint8_t *lpbyOutput, uint32_t cbOutput, uint32_t &iOutput)
+{
+	AlignToByte(bits);
+
+	uint32_t nLength = GetBits(bits, 16), nLengthComplement = GetBits(bits, 16);
+	if (bits.bOverrun || nLength != (~nLengthComplement & 0xFFFF))
+		return false;
+	if (nLength > bits.cbInput - bits.iNextByte || nLength > cbOutput - iOutput)
+		return false;
+
+	memcpy(lpbyOutput + iOutput, bits.lpbyInput + bits.iNextByte, nLength);
+	bits.iNextByte += nLength;
+	iOutput += nLength;
+
+	return true;
+}
+
+static bool InflateFixedBlock(BITREADER &bits, uint8_t *lpbyOutput, uint32_t cbOutput, uint32_t &iOutput)
+{
+	struct FIXEDCODES
+	{
+		HUFFMANCODE lengthCode, distanceCode;
+
+		FIXEDCODES()
+		{
+			uint8_t byLengths[MAX_SYMBOLS];
+
+			memset(byLengths, 8, 144);
+			memset(byLengths + 144, 9, 256 - 144);
+			memset(byLengths + 256, 7, 280 - 256);
+			memset(byLengths + 280, 8, MAX_SYMBOLS - 280);
+			BuildHuffmanCode(lengthCode, byLengths, MAX_SYMBOLS);
+
+			memset(byLengths, 5, 30);
+			BuildHuffmanCode(distanceCode, byLengths, 30);
+		}
+	};
+	static const FIXEDCODES fixedCodes;
+
+	return InflateCodes(bits, fixedCodes.lengthCode, fixedCodes.distanceCode, lpbyOutput, cbOutput, iOutput);
+}
+
+static bool InflateDynamicBlock(BITREADER &bits, uint8_t *lpbyOutput, uint32_t cbOutput, uint32_t &iOutput)
+{
+	uint32_t nLengthCodes = GetBits(bits, 5) + 257, nDistanceCodes = GetBits(bits, 5) + 1, nCodeLengthCodes = GetBits(bits, 4) + 4;
+	if (nLengthCodes > 286 || nDistanceCodes > 30)
+		return false;
+
+	// First comes the code the code lengths are compressed with
+	uint8_t byLengths[MAX_SYMBOLS + 30];
+	memset(byLengths, 0, 19);
+	for (uint32_t iCode = 0; iCode < nCodeLengthCodes; iCode++)
+		byLengths[s_byCodeLengthOrder[iCode]] = (uint8_t)GetBits(bits, 3);
+
+	HUFFMANCODE lengthCode, distanceCode;
+	if (BuildHuffmanCode(lengthCode, byLengths, 19) != 0)
+		return false;
+
+	// Then the code lengths of both codes, in one run
+	uint32_t nLengths = nLengthCodes + nDistanceCodes;
+	for (uint32_t iLength = 0; iLength < nLengths; )
+	{
+		int iSymbol = DecodeSymbol<false>(bits, lengthCode);
+		if (iSymbol < 0 || bits.bOverrun)
+			return false;
+
+		if (iSymbol < 16)
+		{
+			byLengths[iLength++] = (uint8_t)iSymbol;
+			continue;
+		}
+
+		uint8_t byRepeatLength = 0;
+		uint32_t nRepeat;
+		if (iSymbol == 16)
+		{
+			if (!iLength)
+				return false;
+
+			byRepeatLength = byLengths[iLength - 1];
+			nRepeat = 3 + GetBits(bits, 2);
+		}
+		else if (iSymbol == 17)
+			nRepeat = 3 + GetBits(bits, 3);
+		else
+			nRepeat = 11 + GetBits(bits, 7);
+
+		if (nRepeat > nLengths - iLength)
+			return false;
+
+		memset(byLengths + iLength, byRepeatLength, nRepeat);
+		iLength += nRepeat;
+	}
+
+	// A block without an end code can't end
+	if (!byLengths[DEFLATE_END_OF_BLOCK])
+		return false;
+
+	// Incomplete codes are only allowed if they have a single code, as zlib writes for blocks with only one distance
+	int nCodesLeft = BuildHuffmanCode(lengthCode, byLengths, nLengthCodes);
+	if (nCodesLeft < 0 || (nCodesLeft > 0 && nLengthCodes - lengthCode.nCodesOfLength[0] != 1))
+		return false;
+
+	nCodesLeft = BuildHuffmanCode(distanceCode, byLengths + nLengthCodes, nDistanceCodes);
+	if (nCodesLeft < 0 || (nCodesLeft > 0 && nDistanceCodes - distanceCode.nCodesOfLength[0] != 1))
+		return false;
+
+	return InflateCodes(bits, lengthCode, distanceCode, lpbyOutput, cbOutput, iOutput);
+}
+
+// The fixed codes, for writing
+struct FIXEDENCODERS
+{
+	HUFFMANENCODER lengthEncoder, distanceEncoder;
+	// The length symbol for each copy length, less 257
+	uint8_t byLengthSymbols[259];
+
+	FIXEDENCODERS()
+	{
+		uint8_t byLengths[MAX_SYMBOLS];
+
+		memset(byLengths, 8, 144);
+		memset(byLengths + 144, 9, 256 - 144);
+		memset(byLengths + 256, 7, 280 - 256);
+		memset(byLengths + 280, 8, MAX_SYMBOLS - 280);
+		BuildHuffmanEncoder<false>(lengthEncoder, byLengths, MAX_SYMBOLS);
+
+		memset(byLengths, 5, 30);
+		BuildHuffmanEncoder<false>(distanceEncoder, byLengths, 30);
+
+		// 258 has a symbol of its own, though 227 with 5 extra bits could also say it
+		for (uint32_t iSymbol = 0; iSymbol < 29; iSymbol++)
+		{
+			for (uint32_t iExtra = 0; iExtra < (1U << s_byDeflateLengthExtraBits[iSymbol]) && s_wDeflateLengthBase[iSymbol] + iExtra <= 258; iExtra++)
+				byLengthSymbols[s_wDeflateLengthBase[iSymbol] + iExtra] = (uint8_t)iSymbol;
+		}
+	}
+};
+
+#define DEFLATE_MAX_MATCH_LENGTH 258
+#define DEFLATE_WINDOW_SIZE 32768
+
+uint32_t MPQAdler32(uint32_t dwAdler, const void *lpvData, uint32_t cbData)
+{
+	const uint8_t *lpbyData = (const uint8_t *)lpvData;
+	uint32_t dwLow = dwAdler & 0xFFFF, dwHigh = dwAdler >> 16;
+
+	while (cbData)
+	{
+		// The most bytes that can be added up before the sums might overflow
+		uint32_t cbChunk = cbData < 5552 ? cbData : 5552;
+		cbData -= cbChunk;
+
+		for (; cbChunk; cbChunk--)
+		{
+			dwLow += *lpbyData++;
+			dwHigh += dwLow;
+		}
+
+		dwLow %= 65521;
+		dwHigh %= 65521;
+	}
+
+	return (dwHigh << 16) | dwLow;
+}
+
+bool MPQDeflate(void *lpvOutput, uint32_t *lpcbOutput, const void *lpvInput, uint32_t cbInput)
+{
+	// Built once, on first use
+	static const FIXEDENCODERS fixedEncoders;
+
+	const uint8_t *lpbyInput = (const uint8_t *)lpvInput;
+
+	BITWRITER bits;
+	InitBitWriter(bits, lpvOutput, *lpcbOutput);
+
+	// The zlib header: deflate with a 32 KB window, default compression
+	PutBits(bits, 0x78, 8);
+	PutBits(bits, 0x9C, 8);
+
+	// A single block, with the fixed codes
+	PutBits(bits, 1, 1);
+	PutBits(bits, 1, 2);
+
+	MATCHFINDER finder;
+	if (!InitMatchFinder(finder, lpvInput, cbInput, DEFLATE_WINDOW_SIZE))
+	{
+		FreeMatchFinder(finder);
+		return false;
+	}
+
+	for (uint32_t iInput = 0; iInput < cbInput && !bits.bOverrun; )
+	{
+		uint32_t nDistance;
+		uint32_t nLength = FindMatch(finder, iInput, DEFLATE_MAX_MATCH_LENGTH, nDistance);
+
+		if (nLength)
+		{
+			uint32_t iSymbol = fixedEncoders.byLengthSymbols[nLength];
+			PutSymbol(bits, fixedEncoders.lengthEncoder, DEFLATE_END_OF_BLOCK + 1 + iSymbol);
+			PutBits(bits, nLength - s_wDeflateLengthBase[iSymbol], s_byDeflateLengthExtraBits[iSymbol]);
+
+			iSymbol = 29;
+			while (s_wDeflateDistanceBase[iSymbol] > nDistance)
+				iSymbol--;
+			PutSymbol(bits, fixedEncoders.distanceEncoder, iSymbol);
+			PutBits(bits, nDistance - s_wDeflateDistanceBase[iSymbol], s_byDeflateDistanceExtraBits[iSymbol]);
+		}
+		else
+		{
+			nLength = 1;
+			PutSymbol(bits, fixedEncoders.lengthEncoder, lpbyInput[iInput]);
+		}
+
+		for (; nLength; nLength--)
+			AddMatchPosition(finder, iInput++);
+	}
+
+	FreeMatchFinder(finder);
+
+	PutSymbol(bits, fixedEncoders.lengthEncoder, DEFLATE_END_OF_BLOCK);
+	FlushBits(bits);
+
+	// The checksum is stored most significant byte first
+	uint32_t dwChecksum = MPQAdler32(1, lpbyInput, cbInput);
+	for (int iShift = 24; iShift >= 0; iShift -= 8)
+		PutBits(bits, (dwChecksum >> iShift) & 0xFF, 8);
+
+	if (bits.bOverrun)
+		return false;
+
+	*lpcbOutput = bits.iNextByte;
+
+	return true;
+}
+
+bool MPQInflate(void *lpvOutput, uint32_t *lpcbOutput, const void *lpvInput, uint32_t cbInput)
+{
+	const uint8_t *lpbyInput = (const uint8_t *)lpvInput;
+
+	// The zlib header: deflate, with no preset dictionary
+	if (cbInput < 2 || (lpbyInput[0] & 0xF) != 8 || ((lpbyInput[0] << 8) | lpbyInput[1]) % 31 || (lpbyInput[1] & 0x20))
+		return false;
+
+	BITREADER bits;
+	InitBitReader(bits, lpbyInput + 2, cbInput - 2);
+
+	uint8_t *lpbyOutput = (uint8_t *)lpvOutput;
+	uint32_t cbOutput = *lpcbOutput, iOutput = 0;
+
+	bool bLastBlock;
+	do
+	{
+		bLastBlock = GetBits(bits, 1) != 0;
+
+		bool bSuccess;
+		switch (GetBits(bits, 2))
+		{
+		case 0:
+			bSuccess = InflateStoredBlock(bits, lpbyOutput, cbOutput, iOutput);
+			break;
+		case 1:
+			bSuccess = InflateFixedBlock(bits, lpbyOutput, cbOutput, iOutput);
+			break;
+		case 2:
+			bSuccess = InflateDynamicBlock(bits, lpbyOutput, cbOutput, iOutput);
+			break;
+		default:
+			bSuccess = false;
+		}
+
+		if (!bSuccess || bits.bOverrun)
+			return false;
+	} while (!bLastBlock);
+
+	*lpcbOutput = iOutput;
+
+	return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+bool MPQCompressSector(void *lpvOutput, uint32_t *lpcbOutput, const void *lpvInput, uint32_t cbInput, uint32_t grfFileFlags, uint32_t dwCompression)
+{
+	uint8_t *lpbyOutput = (uint8_t *)lpvOutput;
+
+	// The compressed sector has to be smaller than the sector, or it would be taken to be stored as it is
+	if (cbInput < 3)
+		return false;
+
+	uint32_t cbOutput = cbInput - 1;
+	bool bSuccess;
+
+	if (grfFileFlags & MPQ_FILE_IMPLODE)
+		bSuccess = MPQImplode(lpbyOutput, &cbOutput, lpvInput, cbInput);
+	else
+	{
+		lpbyOutput[0] = (uint8_t)dwCompression;
+		cbOutput--;
+
+		switch (dwCompression)
+		{
+		case MPQ_COMPRESSION_ZLIB:
+			bSuccess = MPQDeflate(lpbyOutput + 1, &cbOutput, lpvInput, cbInput);
+			break;
+		case MPQ_COMPRESSION_PKWARE:
+			bSuccess = MPQImplode(lpbyOutput + 1, &cbOutput, lpvInput, cbInput);
+			break;
+		default:
+			bSuccess = false;
+		}
+
+		cbOutput++;
+	}
+
+	if (!bSuccess)
+		return false;
+
+	*lpcbOutput = cbOutput;
+
+	return true;
+}
+
+MPQERROR MPQDecompressSector(void *lpvOutput, uint32_t cbOutput, const void *lpvInput, uint32_t cbInput, uint32_t grfFileFlags)
+{
+	uint32_t cbDecompressed = cbOutput;
+	bool bSuccess;
+
+	if (grfFileFlags & MPQ_FILE_IMPLODE)
+		bSuccess = MPQExplode(lpvOutput, &cbDecompressed, lpvInput, cbInput);
+	else
+	{
+		if (!cbInput)
+			return MPQ_ERROR_BAD_FILE;
+
+		const uint8_t *lpbyInput = (const uint8_t *)lpvInput;
+
+		// Storm can apply several methods, one after the other, but only does for audio
+		switch (lpbyInput[0])
+		{
+		case MPQ_COMPRESSION_ZLIB:
+			bSuccess = MPQInflate(lpvOutput, &cbDecompressed, lpbyInput + 1, cbInput - 1);
+			break;
+		case MPQ_COMPRESSION_PKWARE:
+			bSuccess = MPQExplode(lpvOutput, &cbDecompressed, lpbyInput + 1, cbInput - 1);
+			break;
+		default:
+			return MPQ_ERROR_UNSUPPORTED_COMPRESSION;
+		}
+	}
+
+	if (!bSuccess || cbDecompressed != cbOutput)
+		return MPQ_ERROR_BAD_FILE;
+
+	return MPQ_ERROR_SUCCESS;
+}
@@ -0,0 +1,141 @@
+/*
+	The contents of this file are subject to the Common Development and Distribution License Version 1.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at http://www.sun.com/cddl/cddl.html.
+
+	Software distributed under the License is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for the specific language governing rights and limitations under the License.
+
+	The Initial Developer of the Original Code is Justin Olbrantz. The Original Code Copyright (C) 2007 Justin Olbrantz. All Rights Reserved.
+*/
+
+// Prevent this header from being included multiple times
+#ifndef MPQCOMPRESS_H
+#define MPQCOMPRESS_H
+
+#include <stdint.h>
+#include "MPQArchive.h"
+
+/*
+	Compression and decompression of MPQ file sectors. Files with MPQ_FILE_IMPLODE are compressed with the PKWare Data Compression Library; files with MPQ_FILE_COMPRESS begin each sector with a byte saying which compression methods were applied. Only the methods used for ordinary data by the games MPQDraft patches are supported: PKWare DCL and zlib. The audio methods (Huffman and ADPCM), bzip2 and LZMA are not.
+	A sector is only compressed if that made it smaller; a sector whose stored size equals its real size is stored as it is, and is not passed to these functions.
+	The compressors are simple ones, meant for rewriting files whose sectors have to change: they find matches greedily, and zlib data is written with deflate's fixed codes. Their output is somewhat larger than that of the tools that built the archive, but any version of Storm that supports the method can read it.
+*/
+
+// Compression methods (the first byte of sectors of MPQ_FILE_COMPRESS files)
+#define MPQ_COMPRESSION_HUFFMAN 0x01
+#define MPQ_COMPRESSION_ZLIB 0x02
+#define MPQ_COMPRESSION_PKWARE 0x08
+#define MPQ_COMPRESSION_BZIP2 0x10
+#define MPQ_COMPRESSION_SPARSE 0x20
+#define MPQ_COMPRESSION_ADPCM_MONO 0x40
+#define MPQ_COMPRESSION_ADPCM_STEREO 0x80
+#define MPQ_COMPRESSION_LZMA 0x12
+
+/*
+	* MPQExplode *
+	Decompresses data compressed with the PKWare Data Compression Library. Returns false if the data is corrupt or doesn't fit in the output buffer.
+*/
+bool MPQExplode(
+	// The buffer to receive the decompressed data
+	void *lpvOutput,
+	// In: the size of the buffer. Out: the size of the decompressed data.
+	uint32_t *lpcbOutput,
+	// The compressed data
+	const void *lpvInput,
+	// The size of the compressed data
+	uint32_t cbInput
+);
+
+/*
+	* MPQInflate *
+	Decompresses zlib data (a deflate stream with a zlib header). The trailing checksum is not checked, as MPQs have their own. Returns false if the data is corrupt or doesn't fit in the output buffer.
+*/
+bool MPQInflate(
+	// The buffer to receive the decompressed data
+	void *lpvOutput,
+	// In: the size of the buffer. Out: the size of the decompressed data.
+	uint32_t *lpcbOutput,
+	// The compressed data
+	const void *lpvInput,
+	// The size of the compressed data
+	uint32_t cbInput
+);
+
+/*
+	* MPQImplode *
+	Compresses data with the PKWare Data Compression Library format, with uncoded literals and a 4 KB dictionary. Returns false if the compressed data doesn't fit in the output buffer, or there isn't enough memory.
+*/
+bool MPQImplode(
+	// The buffer to receive the compressed data
+	void *lpvOutput,
+	// In: the size of the buffer. Out: the size of the compressed data.
+	uint32_t *lpcbOutput,
+	// The data to compress
+	const void *lpvInput,
+	// The size of the data to compress
+	uint32_t cbInput
+);
+
+/*
+	* MPQDeflate *
+	Compresses data as zlib data. Returns false if the compressed data doesn't fit in the output buffer, or there isn't enough memory.
+*/
+bool MPQDeflate(
+	// The buffer to receive the compressed data
+	void *lpvOutput,
+	// In: the size of the buffer. Out: the size of the compressed data.
+	uint32_t *lpcbOutput,
+	// The data to compress
+	const void *lpvInput,
+	// The size of the data to compress
+	uint32_t cbInput
+);
+
+/*
+	* MPQCompressSector *
+	Compresses one sector of a file. Returns false if that wouldn't make it smaller, in which case the sector should be stored as it is.
+*/
+bool MPQCompressSector(
+	// The buffer to receive the compressed sector, which must be at least cbInput bytes
+	void *lpvOutput,
+	// Receives the size of the compressed sector
+	uint32_t *lpcbOutput,
+	// The sector to compress
+	const void *lpvInput,
+	// The size of the sector
+	uint32_t cbInput,
+	// The flags of the file the sector belongs to (MPQ_FILE_*)
+	uint32_t grfFileFlags,
+	// For MPQ_FILE_COMPRESS files, the method to use: MPQ_COMPRESSION_PKWARE or MPQ_COMPRESSION_ZLIB
+	uint32_t dwCompression
+);
+
+/*
+	* MPQAdler32 *
+	Continues an Adler-32 checksum over more data. zlib data's checksum starts at 1; the sector checksums of MPQ_FILE_SECTOR_CRC files start at 0.
+*/
+uint32_t MPQAdler32(
+	// The checksum of the data before this, or the starting value
+	uint32_t dwAdler,
+	// The data to add
+	const void *lpvData,
+	// The size of the data
+	uint32_t cbData
+);
+
+/*
+	* MPQDecompressSector *
+	Decompresses one sector of a compressed file, which must decompress to exactly the expected size.
+*/
+MPQERROR MPQDecompressSector(
+	// The buffer to receive the decompressed sector
+	void *lpvOutput,
+	// The size of the sector once decompressed
+	uint32_t cbOutput,
+	// The compressed sector, decrypted
+	const void *lpvInput,
+	// The size of the compressed sector
+	uint32_t cbInput,
+	// The flags of the file the sector belongs to (MPQ_FILE_*)
+	uint32_t grfFileFlags
+);
+
+#endif // #ifndef MPQCOMPRESS_H
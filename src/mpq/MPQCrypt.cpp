@@ -0,0 +1,220 @@
+/*
+	The contents of this file are subject to the Common Development and Distribution License Version 1.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at http://www.sun.com/cddl/cddl.html.
+
+	Software distributed under the License is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for the specific language governing rights and limitations under the License.
+
+	The Initial Developer of the Original Code is Justin Olbrantz. The Original Code Copyright (C) 2007 Justin Olbrantz. All Rights Reserved.
+*/
+
+#include "MPQCrypt.h"
+#include <string.h>
+
+// The table is 5 sections of 0x100 values: one for each hash type, and one for encryption
+#define CRYPT_TABLE_SIZE 0x500
+#define CRYPT_TABLE_ENCRYPT_OFFSET 0x400
+
+struct CRYPTTABLE
+{
+	uint32_t dwValues[CRYPT_TABLE_SIZE];
+
+	// Storm uppercases with its own table, which only affects ASCII letters, and treats both slashes as backslashes. Looking characters up avoids branches which mispredict on every other character of a typical name, and is several times faster.
+	uint8_t byNormalizedChars[0x100];
+
+	CRYPTTABLE()
+	{
+		for (uint32_t iChar = 0; iChar < 0x100; iChar++)
+			byNormalizedChars[iChar] = (uint8_t)iChar;
+
+		for (uint32_t iChar = 'a'; iChar <= 'z'; iChar++)
+			byNormalizedChars[iChar] = (uint8_t)(iChar - ('a' - 'A'));
+		byNormalizedChars['/'] = '\\';
+
+		uint32_t dwSeed = 0x00100001;
+
+		for (uint32_t iCurIndex = 0; iCurIndex < 0x100; iCurIndex++)
+		{
+			for (uint32_t iCurSection = 0; iCurSection < 5; iCurSection++)
+			{
+				dwSeed = (dwSeed * 125 + 3) % 0x2AAAAB;
+				uint32_t dwHigh = (dwSeed & 0xFFFF) << 16;
+
+				dwSeed = (dwSeed * 125 + 3) % 0x2AAAAB;
+				uint32_t dwLow = dwSeed & 0xFFFF;
+
+				dwValues[iCurSection * 0x100 + iCurIndex] = dwHigh | dwLow;
+			}
+		}
+	}
+};
+
+// Built on first use. The compiler makes sure that happens only once, even if several threads get here at the same time.
+static const CRYPTTABLE &GetCryptTable()
+{
+	static const CRYPTTABLE cryptTable;
+
+	return cryptTable;
+}
+
+// One step of the hash, for one character
+static inline void HashChar(const uint32_t *lpdwHashTable, uint32_t dwChar, uint32_t &dwSeed1, uint32_t &dwSeed2)
+{
+	dwSeed1 = lpdwHashTable[dwChar] ^ (dwSeed1 + dwSeed2);
+	dwSeed2 = dwChar + dwSeed1 + dwSeed2 + (dwSeed2 << 5) + 3;
+}
+
+uint32_t MPQHashString(const char *lpszString, uint32_t dwHashType)
+{
+	const CRYPTTABLE &cryptTable = GetCryptTable();
+	const uint32_t *lpdwHashTable = cryptTable.dwValues + (dwHashType << 8);
+
+	uint32_t dwSeed1 = 0x7FED7FED, dwSeed2 = 0xEEEEEEEE;
+
+	for (const unsigned char *lpbyChar = (const unsigned char *)lpszString; *lpbyChar; lpbyChar++)
+		HashChar(lpdwHashTable, cryptTable.byNormalizedChars[*lpbyChar], dwSeed1, dwSeed2);
+
+	return dwSeed1;
+}
+
+void MPQHashName(const char *lpszName, MPQNAMEHASHES *lpHashes)
+{
+	const CRYPTTABLE &cryptTable = GetCryptTable();
+	const uint32_t *lpdwIndexTable = cryptTable.dwValues + (MPQ_HASH_TABLE_INDEX << 8);
+	const uint32_t *lpdwNameATable = cryptTable.dwValues + (MPQ_HASH_NAME_A << 8);
+	const uint32_t *lpdwNameBTable = cryptTable.dwValues + (MPQ_HASH_NAME_B << 8);
+
+	// The three hashes don't depend on each other, so the processor can work on them at the same time. Their state is kept in separate variables rather than an array, so that it stays in registers.
+	uint32_t dwIndexSeed1 = 0x7FED7FED, dwIndexSeed2 = 0xEEEEEEEE;
+	uint32_t dwNameASeed1 = 0x7FED7FED, dwNameASeed2 = 0xEEEEEEEE;
+	uint32_t dwNameBSeed1 = 0x7FED7FED, dwNameBSeed2 = 0xEEEEEEEE;
+
+	for (const unsigned char *lpbyChar = (const unsigned char *)lpszName; *lpbyChar; lpbyChar++)
+	{
+		uint32_t dwChar = cryptTable.byNormalizedChars[*lpbyChar];
+
+		HashChar(lpdwIndexTable, dwChar, dwIndexSeed1, dwIndexSeed2);
+		HashChar(lpdwNameATable, dwChar, dwNameASeed1, dwNameASeed2);
+		HashChar(lpdwNameBTable, dwChar, dwNameBSeed1, dwNameBSeed2);
+	}
+
+	lpHashes->dwIndexHash = dwIndexSeed1;
+	lpHashes->dwNameHashA = dwNameASeed1;
+	lpHashes->dwNameHashB = dwNameBSeed1;
+}
+
+static inline uint32_t Rotate(uint32_t dwValue, int nBits)
+{
+	return (dwValue << nBits) | (dwValue >> (32 - nBits));
+}
+
+// Reads up to 4 bytes as a little-endian value, as lookup3 does for the end of the data
+static inline uint32_t ReadPartialDword(const uint8_t *lpbyData, uint32_t cbData)
+{
+	uint32_t dwValue = 0;
+	for (uint32_t iByte = 0; iByte < cbData && iByte < 4; iByte++)
+		dwValue |= (uint32_t)lpbyData[iByte] << (iByte * 8);
+
+	return dwValue;
+}
+
+uint64_t MPQHashNameHET(const char *lpszName)
+{
+	uint32_t cbName = (uint32_t)strlen(lpszName);
+
+	// hashlittle2, with 1 and 2 as the initial values
+	uint32_t dwA, dwB, dwC;
+	dwA = dwB = dwC = 0xDEADBEEF + cbName + 2;
+	dwC += 1;
+
+	// The name is normalized 12 bytes at a time, as it's hashed
+	uint8_t byChunk[12];
+	uint32_t cbLeft = cbName;
+	const unsigned char *lpbyChar = (const unsigned char *)lpszName;
+
+	while (cbLeft)
+	{
+		uint32_t cbChunk = cbLeft < sizeof(byChunk) ? cbLeft : sizeof(byChunk);
+		for (uint32_t iByte = 0; iByte < cbChunk; iByte++, lpbyChar++)
+		{
+			unsigned char chCur = *lpbyChar;
+			if (chCur >= 'A' && chCur <= 'Z')
+				chCur += 'a' - 'A';
+			else if (chCur == '/')
+				chCur = '\\';
+
+			byChunk[iByte] = chCur;
+		}
+
+		cbLeft -= cbChunk;
+
+		dwA += ReadPartialDword(byChunk, cbChunk);
+		dwB += cbChunk > 4 ? ReadPartialDword(byChunk + 4, cbChunk - 4) : 0;
+		dwC += cbChunk > 8 ? ReadPartialDword(byChunk + 8, cbChunk - 8) : 0;
+
+		// The last block, which may be partial, gets the final mix rather than the usual one
+		if (!cbLeft)
+		{
+			dwC ^= dwB; dwC -= Rotate(dwB, 14);
+			dwA ^= dwC; dwA -= Rotate(dwC, 11);
+			dwB ^= dwA; dwB -= Rotate(dwA, 25);
+			dwC ^= dwB; dwC -= Rotate(dwB, 16);
+			dwA ^= dwC; dwA -= Rotate(dwC, 4);
+			dwB ^= dwA; dwB -= Rotate(dwA, 14);
+			dwC ^= dwB; dwC -= Rotate(dwB, 24);
+			break;
+		}
+
+		dwA -= dwC; dwA ^= Rotate(dwC, 4); dwC += dwB;
+		dwB -= dwA; dwB ^= Rotate(dwA, 6); dwA += dwC;
+		dwC -= dwB; dwC ^= Rotate(dwB, 8); dwB += dwA;
+		dwA -= dwC; dwA ^= Rotate(dwC, 16); dwC += dwB;
+		dwB -= dwA; dwB ^= Rotate(dwA, 19); dwA += dwC;
+		dwC -= dwB; dwC ^= Rotate(dwB, 4); dwB += dwA;
+	}
+
+	return ((uint64_t)dwB << 32) | dwC;
+}
+
+void MPQEncryptBlock(void *lpvData, size_t cbData, uint32_t dwKey)
+{
+	const uint32_t *lpdwCryptTable = GetCryptTable().dwValues;
+
+	uint8_t *lpbyData = (uint8_t *)lpvData;
+	uint32_t dwSeed = 0xEEEEEEEE;
+
+	// Go through memcpy, as the data may not be aligned
+	for (size_t nWordsLeft = cbData / sizeof(uint32_t); nWordsLeft; nWordsLeft--, lpbyData += sizeof(uint32_t))
+	{
+		uint32_t dwValue;
+		memcpy(&dwValue, lpbyData, sizeof(dwValue));
+
+		dwSeed += lpdwCryptTable[CRYPT_TABLE_ENCRYPT_OFFSET + (dwKey & 0xFF)];
+		uint32_t dwEncrypted = dwValue ^ (dwKey + dwSeed);
+
+		dwKey = ((~dwKey << 21) + 0x11111111) | (dwKey >> 11);
+		dwSeed = dwValue + dwSeed + (dwSeed << 5) + 3;
+
+		memcpy(lpbyData, &dwEncrypted, sizeof(dwEncrypted));
+	}
+}
+
+void MPQDecryptBlock(void *lpvData, size_t cbData, uint32_t dwKey)
+{
+	const uint32_t *lpdwCryptTable = GetCryptTable().dwValues;
+
+	uint8_t *lpbyData = (uint8_t *)lpvData;
+	uint32_t dwSeed = 0xEEEEEEEE;
+
+	for (size_t nWordsLeft = cbData / sizeof(uint32_t); nWordsLeft; nWordsLeft--, lpbyData += sizeof(uint32_t))
+	{
+		uint32_t dwValue;
+		memcpy(&dwValue, lpbyData, sizeof(dwValue));
+
+		dwSeed += lpdwCryptTable[CRYPT_TABLE_ENCRYPT_OFFSET + (dwKey & 0xFF)];
+		dwValue ^= dwKey + dwSeed;
+
+		dwKey = ((~dwKey << 21) + 0x11111111) | (dwKey >> 11);
+		dwSeed = dwValue + dwSeed + (dwSeed << 5) + 3;
+
+		memcpy(lpbyData, &dwValue, sizeof(dwValue));
+	}
+}
@@ -0,0 +1,95 @@
+/*
+	The contents of this file are subject to the Common Development and Distribution License Version 1.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at http://www.sun.com/cddl/cddl.html.
+
+	Software distributed under the License is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for the specific language governing rights and limitations under the License.
+
+	The Initial Developer of the Original Code is Justin Olbrantz. The Original Code Copyright (C) 2007 Justin Olbrantz. All Rights Reserved.
+*/
+
+// Prevent this header from being included multiple times
+#ifndef MPQCRYPT_H
+#define MPQCRYPT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+	The hashing and encryption used by MPQs. Both are driven by the same table of 0x500 pseudo-random values, which is built the first time it's needed.
+*/
+
+// Hash types for MPQHashString
+#define MPQ_HASH_TABLE_INDEX 0	// The position of a file in the hash table
+#define MPQ_HASH_NAME_A 1	// The two hashes stored in the hash table to identify a file
+#define MPQ_HASH_NAME_B 2
+#define MPQ_HASH_FILE_KEY 3	// The encryption key of a file, or of the tables
+
+// The encryption keys of the hash and block tables; MPQHashString("(hash table)", MPQ_HASH_FILE_KEY) and MPQHashString("(block table)", MPQ_HASH_FILE_KEY)
+#define MPQ_HASH_TABLE_KEY 0xC3AF3770
+#define MPQ_BLOCK_TABLE_KEY 0xEC83B3A3
+
+// The three hashes of a name which locate a file in the hash table
+struct MPQNAMEHASHES
+{
+	uint32_t dwIndexHash;	// MPQ_HASH_TABLE_INDEX
+	uint32_t dwNameHashA;	// MPQ_HASH_NAME_A
+	uint32_t dwNameHashB;	// MPQ_HASH_NAME_B
+};
+
+/*
+	* MPQHashString *
+	Hashes a file name. The hash is case-insensitive, and treats '/' the same as '\', as Storm does.
+*/
+uint32_t MPQHashString(
+	// The string to hash
+	const char *lpszString,
+	// The type of hash (MPQ_HASH_*)
+	uint32_t dwHashType
+);
+
+/*
+	* MPQHashName *
+	Computes the three hashes that locate a file in the hash table, with the same results as MPQHashString. The hashes are computed side by side in one pass over the name, which is half again as fast as computing them one at a time; use this when hashing lists of names.
+*/
+void MPQHashName(
+	// The name to hash
+	const char *lpszName,
+	// The hashes of the name
+	MPQNAMEHASHES *lpHashes
+);
+
+/*
+	* MPQHashNameHET *
+	Computes the 64-bit hash that locates a file in the HET table of later format versions: Bob Jenkins' lookup3 hash (hashlittle2) of the name, lowercased, with '/' treated as '\'. The HET table uses only its low MPQHETHEADER::nNameHashBits bits.
+*/
+uint64_t MPQHashNameHET(
+	// The name to hash
+	const char *lpszName
+);
+
+/*
+	* MPQEncryptBlock *
+	Encrypts data in place. Only whole 32-bit words are encrypted; if the size is not a multiple of 4, the last few bytes are left as they are, as in Storm.
+*/
+void MPQEncryptBlock(
+	// The data to encrypt
+	void *lpvData,
+	// The size of the data, in bytes
+	size_t cbData,
+	// The encryption key
+	uint32_t dwKey
+);
+
+/*
+	* MPQDecryptBlock *
+	Decrypts data encrypted by MPQEncryptBlock, in place.
+*/
+void MPQDecryptBlock(
+	// The data to decrypt
+	void *lpvData,
+	// The size of the data, in bytes
+	size_t cbData,
+	// The encryption key
+	uint32_t dwKey
+);
+
+#endif // #ifndef MPQCRYPT_H
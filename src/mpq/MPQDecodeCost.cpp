@@ -0,0 +1,66 @@
+/*
+	The contents of this file are subject to the Common Development and Distribution License Version 1.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at http://www.sun.com/cddl/cddl.html.
+
+	Software distributed under the License is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for the specific language governing rights and limitations under the License.
+
+	The Initial Developer of the Original Code is Justin Olbrantz. The Original Code Copyright (C) 2007 Justin Olbrantz. All Rights Reserved.
+*/
+
+#include "MPQDecodeCost.h"
+#include "MPQFile.h"
+#include "MPQParallel.h"
+#include <string.h>
+#include <chrono>
+#include <new>
+
+// Each file is read until this much time has passed, or it has been read MAX_MEASURE_READS times
+#define MIN_MEASURE_SECONDS 0.002
+#define MAX_MEASURE_READS 1000
+
+static void MeasureFile(HMPQOVERLAY hOverlay, uint32_t iFile, MPQDECODECOST &cost)
+{
+	const MPQOVERLAYFILE &file = MPQGetOverlayFiles(hOverlay, NULL)[iFile];
+	const MPQOVERLAYINSTANCE &instance = MPQGetOverlayInstances(hOverlay)[file.iFirstInstance];
+	HMPQARCHIVE hArchive = MPQGetOverlayArchives(hOverlay)[instance.iArchive].hArchive;
+	const MPQBLOCKENTRY &block = MPQGetBlockTable(hArchive, NULL)[instance.iBlock];
+
+	memset(&cost, 0, sizeof(cost));
+	cost.cbFileSize = block.cbFileSize;
+	cost.cbCompressedSize = block.cbCompressedSize;
+
+	cost.error = MPQGetFileCompression(hArchive, instance.iBlock, file.lpszName, &cost.grfCompression);
+	if (cost.error != MPQ_ERROR_SUCCESS)
+		return;
+
+	uint8_t *lpbyBuffer = new (std::nothrow) uint8_t[block.cbFileSize ? block.cbFileSize : 1];
+	if (!lpbyBuffer)
+	{
+		cost.error = MPQ_ERROR_NO_MEMORY;
+		return;
+	}
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	double fElapsed = 0;
+	uint32_t nReads = 0;
+
+	do
+	{
+		cost.error = MPQReadFile(hArchive, instance.iBlock, file.lpszName, lpbyBuffer);
+		nReads++;
+
+		fElapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	} while (cost.error == MPQ_ERROR_SUCCESS && fElapsed < MIN_MEASURE_SECONDS && nReads < MAX_MEASURE_READS);
+
+	if (cost.error == MPQ_ERROR_SUCCESS)
+		cost.fSeconds = fElapsed / nReads;
+
+	delete [] lpbyBuffer;
+}
+
+void MPQMeasureDecoding(HMPQOVERLAY hOverlay, uint32_t nThreads, MPQDECODECOST *lpCosts)
+{
+	uint32_t nFiles;
+	MPQGetOverlayFiles(hOverlay, &nFiles);
+
+	MPQParallelFor(nFiles, nThreads, [&](uint32_t iFile) { MeasureFile(hOverlay, iFile, lpCosts[iFile]); });
+}
@@ -0,0 +1,49 @@
+/*
+	The contents of this file are subject to the Common Development and Distribution License Version 1.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at http://www.sun.com/cddl/cddl.html.
+
+	Software distributed under the License is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for the specific language governing rights and limitations under the License.
+
+	The Initial Developer of the Original Code is Justin Olbrantz. The Original Code Copyright (C) 2007 Justin Olbrantz. All Rights Reserved.
+*/
+
+// Prevent this header from being included multiple times
+#ifndef MPQDECODECOST_H
+#define MPQDECODECOST_H
+
+#include <stdint.h>
+#include "MPQOverlay.h"
+
+/*
+	MPQDecodeCost measures how long it takes to read each file of an overlay, as the game reads it: decrypted and decompressed, every time it's loaded. The copy of each file which is read is measured, on several threads at once.
+	Times are measured on this machine with this library's decompressors, rather than Storm's, so they're only good for comparing files and compression methods with each other.
+*/
+
+// The cost of reading one file
+struct MPQDECODECOST
+{
+	// The compression methods the file uses (MPQ_COMPRESSION_*), or 0 if it isn't compressed
+	uint32_t grfCompression;
+	uint32_t cbFileSize;
+	uint32_t cbCompressedSize;
+
+	// The time it takes to read the file once, in seconds
+	double fSeconds;
+
+	// Whether the file could be read. Files which can't, such as encrypted files whose names aren't known, have no time.
+	MPQERROR error;
+};
+
+/*
+	* MPQMeasureDecoding *
+	Measures the cost of reading each file of an overlay. Each file is read repeatedly, so that the time of small files can be measured.
+*/
+void MPQMeasureDecoding(
+	// The overlay, with any names known added
+	HMPQOVERLAY hOverlay,
+	// The number of threads to use, or 0 for one for each processor
+	uint32_t nThreads,
+	// Receives the cost of each file, in the order of MPQGetOverlayFiles
+	MPQDECODECOST *lpCosts
+);
+
+#endif // #ifndef MPQDECODECOST_H
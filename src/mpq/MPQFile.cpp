@@ -0,0 +1,446 @@
+/*
+	The contents of this file are subject to the Common Development and Distribution License Version 1.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at http://www.sun.com/cddl/cddl.html.
+
+	Software distributed under the License is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for the specific language governing rights and limitations under the License.
+
+	The Initial Developer of the Original Code is Justin Olbrantz. The Original Code Copyright (C) 2007 Justin Olbrantz. All Rights Reserved.
+*/
+
+#include "MPQFile.h"
+#include "MPQCrypt.h"
+#include "MPQCompress.h"
+#include <string.h>
+#include <new>
+
+MPQERROR MPQFindFileByHash(HMPQARCHIVE hArchive, uint32_t dwIndexHash, uint32_t dwNameHashA, uint32_t dwNameHashB, uint16_t wLocale, uint32_t *lpiHashEntry)
+{
+	uint32_t nHashEntries;
+	const MPQHASHENTRY *lpHashTable = MPQGetHashTable(hArchive, &nHashEntries);
+
+	uint32_t nMask = nHashEntries - 1, iStartEntry = dwIndexHash & nMask, iNeutralEntry = MPQ_HASH_ENTRY_EMPTY;
+
+	// Search from where the file would be placed until an entry that has never been used, which ends every chain
+	for (uint32_t iProbe = 0; iProbe < nHashEntries; iProbe++)
+	{
+		uint32_t iHashEntry = (iStartEntry + iProbe) & nMask;
+		const MPQHASHENTRY &hashEntry = lpHashTable[iHashEntry];
+
+		if (hashEntry.dwBlockIndex == MPQ_HASH_ENTRY_EMPTY)
+			break;
+		if (hashEntry.dwBlockIndex == MPQ_HASH_ENTRY_DELETED
+			|| hashEntry.dwNameHashA != dwNameHashA || hashEntry.dwNameHashB != dwNameHashB)
+			continue;
+
+		if (hashEntry.wLocale == wLocale)
+		{
+			*lpiHashEntry = iHashEntry;
+			return MPQ_ERROR_SUCCESS;
+		}
+
+		if (hashEntry.wLocale == MPQ_LOCALE_NEUTRAL && iNeutralEntry == MPQ_HASH_ENTRY_EMPTY)
+			iNeutralEntry = iHashEntry;
+	}
+
+	if (iNeutralEntry == MPQ_HASH_ENTRY_EMPTY)
+		return MPQ_ERROR_FILE_NOT_FOUND;
+
+	*lpiHashEntry = iNeutralEntry;
+
+	return MPQ_ERROR_SUCCESS;
+}
+
+MPQERROR MPQFindFileByHETHash(HMPQARCHIVE hArchive, uint64_t qwNameHash, uint16_t wLocale, uint32_t *lpiHashEntry)
+{
+	const MPQHETTABLE &hetTable = *MPQGetHETTable(hArchive);
+	const MPQHASHENTRY *lpHashTable = MPQGetHashTable(hArchive, NULL);
+
+	// The hash is cut down to the table's size, with the top bit set so that no file's top 8 bits are MPQ_HET_ENTRY_FREE
+	uint32_t nRestBits = hetTable.nNameHashBits - 8;
+	uint64_t qwAndMask = hetTable.nNameHashBits == 64 ? ~0ULL : (1ULL << hetTable.nNameHashBits) - 1;
+	qwNameHash = (qwNameHash & qwAndMask) | (1ULL << (hetTable.nNameHashBits - 1));
+
+	uint8_t byNameHash = (uint8_t)(qwNameHash >> nRestBits);
+	uint64_t qwRestHash = qwNameHash & ((1ULL << nRestBits) - 1);
+
+	uint32_t iEntry = (uint32_t)(qwNameHash % hetTable.nEntries), iNeutralEntry = MPQ_HASH_ENTRY_EMPTY;
+
+	// Search from where the file would be placed until an entry that has never been used, as in the hash table
+	for (uint32_t iProbe = 0; iProbe < hetTable.nEntries; iProbe++, iEntry = (iEntry + 1 < hetTable.nEntries ? iEntry + 1 : 0))
+	{
+		uint8_t byEntryHash = hetTable.lpbyNameHashes[iEntry];
+		if (byEntryHash == MPQ_HET_ENTRY_FREE)
+			break;
+		if (byEntryHash != byNameHash)
+			continue;
+
+		uint32_t iBlock = hetTable.lpiBETEntries[iEntry];
+		if (hetTable.lpqwBETNameHashes[iBlock] != qwRestHash)
+			continue;
+
+		// The block may have an entry for each locale
+		for (uint32_t iBlockEntry = hetTable.lpiBlockHashEntryStarts[iBlock]; iBlockEntry < hetTable.lpiBlockHashEntryStarts[iBlock + 1]; iBlockEntry++)
+		{
+			uint32_t iHashEntry = hetTable.lpiBlockHashEntries[iBlockEntry];
+			uint16_t wEntryLocale = lpHashTable[iHashEntry].wLocale;
+
+			if (wEntryLocale == wLocale)
+			{
+				*lpiHashEntry = iHashEntry;
+				return MPQ_ERROR_SUCCESS;
+			}
+
+			if (wEntryLocale == MPQ_LOCALE_NEUTRAL && iNeutralEntry == MPQ_HASH_ENTRY_EMPTY)
+				iNeutralEntry = iHashEntry;
+		}
+	}
+
+	if (iNeutralEntry == MPQ_HASH_ENTRY_EMPTY)
+		return MPQ_ERROR_FILE_NOT_FOUND;
+
+	*lpiHashEntry = iNeutralEntry;
+
+	return MPQ_ERROR_SUCCESS;
+}
+
+MPQERROR MPQFindFile(HMPQARCHIVE hArchive, const char *lpszFileName, uint16_t wLocale, uint32_t *lpiHashEntry)
+{
+	if (MPQGetHETTable(hArchive))
+		return MPQFindFileByHETHash(hArchive, MPQHashNameHET(lpszFileName), wLocale, lpiHashEntry);
+
+	MPQNAMEHASHES hashes;
+	MPQHashName(lpszFileName, &hashes);
+
+	return MPQFindFileByHash(hArchive, hashes.dwIndexHash, hashes.dwNameHashA, hashes.dwNameHashB, wLocale, lpiHashEntry);
+}
+
+uint32_t MPQGetFileKey(const char *lpszFileName, uint64_t qwFilePos, uint32_t cbFileSize, uint32_t grfFlags)
+{
+	// Only the file name itself is used, not its path
+	const char *lpszBaseName = lpszFileName;
+	for (const char *lpszChar = lpszFileName; *lpszChar; lpszChar++)
+	{
+		if (*lpszChar == '\\' || *lpszChar == '/')
+			lpszBaseName = lpszChar + 1;
+	}
+
+	uint32_t dwKey = MPQHashString(lpszBaseName, MPQ_HASH_FILE_KEY);
+	if (grfFlags & MPQ_FILE_FIX_KEY)
+		dwKey = (dwKey + (uint32_t)qwFilePos) ^ cbFileSize;
+
+	return dwKey;
+}
+
+/*
+	Reads one sector, or a single unit file, into the output. The sector is compressed only if it's smaller than its real size. lpbyScratch must be large enough to hold the compressed sector.
+*/
+static MPQERROR ReadSector(const uint8_t *lpbySector, uint32_t cbSector, uint8_t *lpbyOutput, uint32_t cbOutput,
+	uint32_t grfFlags, uint32_t dwKey, uint8_t *lpbyScratch)
+{
+	if (cbSector == cbOutput)
+	{
+		memcpy(lpbyOutput, lpbySector, cbSector);
+		if (grfFlags & MPQ_FILE_ENCRYPTED)
+			MPQDecryptBlock(lpbyOutput, cbSector, dwKey);
+
+		return MPQ_ERROR_SUCCESS;
+	}
+
+	if (cbSector > cbOutput || !(grfFlags & (MPQ_FILE_IMPLODE | MPQ_FILE_COMPRESS)))
+		return MPQ_ERROR_BAD_FILE;
+
+	if (grfFlags & MPQ_FILE_ENCRYPTED)
+	{
+		memcpy(lpbyScratch, lpbySector, cbSector);
+		MPQDecryptBlock(lpbyScratch, cbSector, dwKey);
+		lpbySector = lpbyScratch;
+	}
+
+	return MPQDecompressSector(lpbyOutput, cbOutput, lpbySector, cbSector, grfFlags);
+}
+
+/*
+	Gets where each sector of a file starts, relative to the file's data, with one more entry than there are sectors, for the end of the last sector. lpdwSectorOffsets must have room for nSectors + 1 entries.
+*/
+static MPQERROR GetSectorOffsets(const MPQBLOCKENTRY &block, const uint8_t *lpbyFileData, uint32_t cbSectorSize, uint32_t nSectors,
+	uint32_t dwKey, uint32_t *lpdwSectorOffsets)
+{
+	bool bCompressed = (block.grfFlags & (MPQ_FILE_IMPLODE | MPQ_FILE_COMPRESS)) != 0;
+
+	// Compressed sectors are located by a table of offsets before them
+	if (bCompressed && !(block.grfFlags & MPQ_FILE_SINGLE_UNIT))
+	{
+		uint64_t cbOffsetTable = ((uint64_t)nSectors + 1) * sizeof(uint32_t);
+		if (cbOffsetTable > block.cbCompressedSize)
+			return MPQ_ERROR_BAD_FILE;
+
+		memcpy(lpdwSectorOffsets, lpbyFileData, (size_t)cbOffsetTable);
+		if (block.grfFlags & MPQ_FILE_ENCRYPTED)
+			MPQDecryptBlock(lpdwSectorOffsets, (size_t)cbOffsetTable, dwKey - 1);
+
+		return MPQ_ERROR_SUCCESS;
+	}
+
+	// Single unit files have no offset table, and uncompressed sectors are all full size
+	for (uint32_t iSector = 0; iSector < nSectors; iSector++)
+		lpdwSectorOffsets[iSector] = iSector * cbSectorSize;
+	lpdwSectorOffsets[nSectors] = bCompressed ? block.cbCompressedSize : block.cbFileSize;
+
+	return MPQ_ERROR_SUCCESS;
+}
+
+MPQERROR MPQReadFile(HMPQARCHIVE hArchive, uint32_t iBlock, const char *lpszFileName, void *lpvBuffer)
+{
+	uint32_t nBlocks;
+	const MPQBLOCKENTRY *lpBlockTable = MPQGetBlockTable(hArchive, &nBlocks);
+	if (iBlock >= nBlocks || !(lpBlockTable[iBlock].grfFlags & MPQ_FILE_EXISTS))
+		return MPQ_ERROR_FILE_NOT_FOUND;
+
+	const MPQBLOCKENTRY &block = lpBlockTable[iBlock];
+	if (!MPQIsFileSizePossible(hArchive, iBlock))
+		return MPQ_ERROR_BAD_FILE;
+
+	uint64_t qwDataSize, qwFilePos = MPQGetBlockFilePos(hArchive, iBlock);
+	const uint8_t *lpbyArchive = MPQGetArchiveData(hArchive, &qwDataSize);
+	if (qwFilePos > qwDataSize || block.cbCompressedSize > qwDataSize - qwFilePos)
+		return MPQ_ERROR_BAD_FILE;
+
+	const uint8_t *lpbyFileData = lpbyArchive + qwFilePos;
+	uint8_t *lpbyOutput = (uint8_t *)lpvBuffer;
+
+	uint32_t dwKey = 0;
+	if (block.grfFlags & MPQ_FILE_ENCRYPTED)
+	{
+		if (!lpszFileName)
+			return MPQ_ERROR_UNKNOWN_KEY;
+
+		dwKey = MPQGetFileKey(lpszFileName, qwFilePos, block.cbFileSize, block.grfFlags);
+	}
+
+	if (!block.cbFileSize)
+		return MPQ_ERROR_SUCCESS;
+
+	bool bCompressed = (block.grfFlags & (MPQ_FILE_IMPLODE | MPQ_FILE_COMPRESS)) != 0;
+
+	// Single unit files are one sector the size of the file
+	uint32_t cbSectorSize = (block.grfFlags & MPQ_FILE_SINGLE_UNIT) ? block.cbFileSize : MPQGetArchiveInfo(hArchive)->cbSectorSize;
+	uint32_t nSectors = (uint32_t)(((uint64_t)block.cbFileSize + cbSectorSize - 1) / cbSectorSize);
+
+	uint32_t *lpdwSectorOffsets = new (std::nothrow) uint32_t[nSectors + 1];
+	uint8_t *lpbyScratch = bCompressed ? new (std::nothrow) uint8_t[cbSectorSize] : NULL;
+	if (!lpdwSectorOffsets || (bCompressed && !lpbyScratch))
+	{
+		delete [] lpdwSectorOffsets;
+		delete [] lpbyScratch;
+
+		return MPQ_ERROR_NO_MEMORY;
+	}
+
+	MPQERROR error = GetSectorOffsets(block, lpbyFileData, cbSectorSize, nSectors, dwKey, lpdwSectorOffsets);
+
+	for (uint32_t iSector = 0; iSector < nSectors && error == MPQ_ERROR_SUCCESS; iSector++)
+	{
+		uint32_t dwSectorStart = lpdwSectorOffsets[iSector], dwSectorEnd = lpdwSectorOffsets[iSector + 1];
+		if (dwSectorStart > dwSectorEnd || dwSectorEnd > block.cbCompressedSize)
+		{
+			error = MPQ_ERROR_BAD_FILE;
+			break;
+		}
+
+		uint32_t dwOutputOffset = iSector * cbSectorSize;
+		uint32_t cbOutput = block.cbFileSize - dwOutputOffset < cbSectorSize ? block.cbFileSize - dwOutputOffset : cbSectorSize;
+
+		error = ReadSector(lpbyFileData + dwSectorStart, dwSectorEnd - dwSectorStart, lpbyOutput + dwOutputOffset, cbOutput,
+			block.grfFlags, dwKey + iSector, lpbyScratch);
+	}
+
+	delete [] lpdwSectorOffsets;
+	delete [] lpbyScratch;
+
+	return error;
+}
+
+// The most any supported compression method can expand data by. Deflate's limit is a 258 byte match coded in 2 bits; the PKWare Data Compression Library needs at least 22 bits for its longest, 518 byte, match.
+#define MAX_COMPRESSION_RATIO 1032
+
+bool MPQIsFileSizePossible(HMPQARCHIVE hArchive, uint32_t iBlock)
+{
+	uint32_t nBlocks;
+	const MPQBLOCKENTRY *lpBlockTable = MPQGetBlockTable(hArchive, &nBlocks);
+	if (iBlock >= nBlocks)
+		return false;
+
+	const MPQBLOCKENTRY &block = lpBlockTable[iBlock];
+	if (!block.cbFileSize)
+		return true;
+
+	// Sectors which aren't compressed are stored as they are
+	if (!(block.grfFlags & (MPQ_FILE_IMPLODE | MPQ_FILE_COMPRESS)))
+		return block.cbFileSize <= block.cbCompressedSize;
+
+	uint64_t cbSectorData = block.cbCompressedSize;
+	if (!(block.grfFlags & MPQ_FILE_SINGLE_UNIT))
+	{
+		uint32_t cbSectorSize = MPQGetArchiveInfo(hArchive)->cbSectorSize;
+		uint64_t nSectors = ((uint64_t)block.cbFileSize + cbSectorSize - 1) / cbSectorSize;
+		uint64_t cbOffsetTable = (nSectors + 1) * sizeof(uint32_t);
+		if (cbOffsetTable > cbSectorData)
+			return false;
+
+		cbSectorData -= cbOffsetTable;
+	}
+
+	return block.cbFileSize <= cbSectorData * MAX_COMPRESSION_RATIO;
+}
+
+MPQERROR MPQReadFileSectors(HMPQARCHIVE hArchive, uint32_t iBlock, const char *lpszFileName, MPQSECTORCALLBACK pfnSector, void *lpvContext)
+{
+	uint32_t nBlocks;
+	const MPQBLOCKENTRY *lpBlockTable = MPQGetBlockTable(hArchive, &nBlocks);
+	if (iBlock >= nBlocks || !(lpBlockTable[iBlock].grfFlags & MPQ_FILE_EXISTS))
+		return MPQ_ERROR_FILE_NOT_FOUND;
+
+	const MPQBLOCKENTRY &block = lpBlockTable[iBlock];
+	if (!MPQIsFileSizePossible(hArchive, iBlock))
+		return MPQ_ERROR_BAD_FILE;
+
+	uint64_t qwDataSize, qwFilePos = MPQGetBlockFilePos(hArchive, iBlock);
+	const uint8_t *lpbyArchive = MPQGetArchiveData(hArchive, &qwDataSize);
+	if (qwFilePos > qwDataSize || block.cbCompressedSize > qwDataSize - qwFilePos)
+		return MPQ_ERROR_BAD_FILE;
+
+	const uint8_t *lpbyFileData = lpbyArchive + qwFilePos;
+
+	uint32_t dwKey = 0;
+	if (block.grfFlags & MPQ_FILE_ENCRYPTED)
+	{
+		if (!lpszFileName)
+			return MPQ_ERROR_UNKNOWN_KEY;
+
+		dwKey = MPQGetFileKey(lpszFileName, qwFilePos, block.cbFileSize, block.grfFlags);
+	}
+
+	if (!block.cbFileSize)
+		return MPQ_ERROR_SUCCESS;
+
+	bool bCompressed = (block.grfFlags & (MPQ_FILE_IMPLODE | MPQ_FILE_COMPRESS)) != 0;
+
+	uint32_t cbSectorSize = (block.grfFlags & MPQ_FILE_SINGLE_UNIT) ? block.cbFileSize : MPQGetArchiveInfo(hArchive)->cbSectorSize;
+	uint32_t nSectors = (uint32_t)(((uint64_t)block.cbFileSize + cbSectorSize - 1) / cbSectorSize);
+
+	// Files smaller than a sector need only a buffer their size
+	uint32_t cbBuffer = block.cbFileSize < cbSectorSize ? block.cbFileSize : cbSectorSize;
+
+	uint32_t *lpdwSectorOffsets = new (std::nothrow) uint32_t[nSectors + 1];
+	uint8_t *lpbySector = new (std::nothrow) uint8_t[cbBuffer];
+	uint8_t *lpbyScratch = bCompressed ? new (std::nothrow) uint8_t[cbBuffer] : NULL;
+	if (!lpdwSectorOffsets || !lpbySector || (bCompressed && !lpbyScratch))
+	{
+		delete [] lpdwSectorOffsets;
+		delete [] lpbySector;
+		delete [] lpbyScratch;
+
+		return MPQ_ERROR_NO_MEMORY;
+	}
+
+	MPQERROR error = GetSectorOffsets(block, lpbyFileData, cbSectorSize, nSectors, dwKey, lpdwSectorOffsets);
+
+	for (uint32_t iSector = 0; iSector < nSectors && error == MPQ_ERROR_SUCCESS; iSector++)
+	{
+		uint32_t dwSectorStart = lpdwSectorOffsets[iSector], dwSectorEnd = lpdwSectorOffsets[iSector + 1];
+		if (dwSectorStart > dwSectorEnd || dwSectorEnd > block.cbCompressedSize)
+		{
+			error = MPQ_ERROR_BAD_FILE;
+			break;
+		}
+
+		uint32_t dwOutputOffset = iSector * cbSectorSize;
+		uint32_t cbOutput = block.cbFileSize - dwOutputOffset < cbSectorSize ? block.cbFileSize - dwOutputOffset : cbSectorSize;
+
+		error = ReadSector(lpbyFileData + dwSectorStart, dwSectorEnd - dwSectorStart, lpbySector, cbOutput,
+			block.grfFlags, dwKey + iSector, lpbyScratch);
+
+		if (error == MPQ_ERROR_SUCCESS)
+			pfnSector(lpvContext, lpbySector, cbOutput);
+	}
+
+	delete [] lpdwSectorOffsets;
+	delete [] lpbySector;
+	delete [] lpbyScratch;
+
+	return error;
+}
+
+MPQERROR MPQGetFileCompression(HMPQARCHIVE hArchive, uint32_t iBlock, const char *lpszFileName, uint32_t *lpgrfCompression)
+{
+	*lpgrfCompression = 0;
+
+	uint32_t nBlocks;
+	const MPQBLOCKENTRY *lpBlockTable = MPQGetBlockTable(hArchive, &nBlocks);
+	if (iBlock >= nBlocks || !(lpBlockTable[iBlock].grfFlags & MPQ_FILE_EXISTS))
+		return MPQ_ERROR_FILE_NOT_FOUND;
+
+	const MPQBLOCKENTRY &block = lpBlockTable[iBlock];
+
+	// Imploded files are all PKWare DCL, with no byte saying so
+	if (block.grfFlags & MPQ_FILE_IMPLODE)
+	{
+		*lpgrfCompression = MPQ_COMPRESSION_PKWARE;
+		return MPQ_ERROR_SUCCESS;
+	}
+
+	if (!(block.grfFlags & MPQ_FILE_COMPRESS) || !block.cbFileSize)
+		return MPQ_ERROR_SUCCESS;
+
+	uint64_t qwDataSize, qwFilePos = MPQGetBlockFilePos(hArchive, iBlock);
+	const uint8_t *lpbyArchive = MPQGetArchiveData(hArchive, &qwDataSize);
+	if (qwFilePos > qwDataSize || block.cbCompressedSize > qwDataSize - qwFilePos)
+		return MPQ_ERROR_BAD_FILE;
+
+	const uint8_t *lpbyFileData = lpbyArchive + qwFilePos;
+
+	uint32_t dwKey = 0;
+	if (block.grfFlags & MPQ_FILE_ENCRYPTED)
+	{
+		if (!lpszFileName)
+			return MPQ_ERROR_UNKNOWN_KEY;
+
+		dwKey = MPQGetFileKey(lpszFileName, qwFilePos, block.cbFileSize, block.grfFlags);
+	}
+
+	uint32_t cbSectorSize = (block.grfFlags & MPQ_FILE_SINGLE_UNIT) ? block.cbFileSize : MPQGetArchiveInfo(hArchive)->cbSectorSize;
+	uint32_t nSectors = (uint32_t)(((uint64_t)block.cbFileSize + cbSectorSize - 1) / cbSectorSize);
+
+	uint32_t *lpdwSectorOffsets = new (std::nothrow) uint32_t[nSectors + 1];
+	if (!lpdwSectorOffsets)
+		return MPQ_ERROR_NO_MEMORY;
+
+	MPQERROR error = GetSectorOffsets(block, lpbyFileData, cbSectorSize, nSectors, dwKey, lpdwSectorOffsets);
+
+	for (uint32_t iSector = 0; iSector < nSectors && error == MPQ_ERROR_SUCCESS; iSector++)
+	{
+		uint32_t dwSectorStart = lpdwSectorOffsets[iSector], dwSectorEnd = lpdwSectorOffsets[iSector + 1];
+		uint32_t cbOutput = block.cbFileSize - iSector * cbSectorSize < cbSectorSize ? block.cbFileSize - iSector * cbSectorSize : cbSectorSize;
+		if (dwSectorStart > dwSectorEnd || dwSectorEnd > block.cbCompressedSize)
+		{
+			error = MPQ_ERROR_BAD_FILE;
+			break;
+		}
+
+		// Sectors which didn't get smaller are stored as they are, without the byte
+		uint32_t cbSector = dwSectorEnd - dwSectorStart;
+		if (!cbSector || cbSector >= cbOutput)
+			continue;
+
+		// Only whole dwords are encrypted, so the byte is only encrypted if there's a dword for it to be in
+		uint8_t bySector[sizeof(uint32_t)];
+		memcpy(bySector, lpbyFileData + dwSectorStart, cbSector < sizeof(bySector) ? cbSector : sizeof(bySector));
+		if ((block.grfFlags & MPQ_FILE_ENCRYPTED) && cbSector >= sizeof(bySector))
+			MPQDecryptBlock(bySector, sizeof(bySector), dwKey + iSector);
+
+		*lpgrfCompression |= bySector[0];
+	}
+
+	delete [] lpdwSectorOffsets;
+
+	return error;
+}
@@ -0,0 +1,158 @@
+/*
+	The contents of this file are subject to the Common Development and Distribution License Version 1.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at http://www.sun.com/cddl/cddl.html.
+
+	Software distributed under the License is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for the specific language governing rights and limitations under the License.
+
+	The Initial Developer of the Original Code is Justin Olbrantz. The Original Code Copyright (C) 2007 Justin Olbrantz. All Rights Reserved.
+*/
+
+// Prevent this header from being included multiple times
+#ifndef MPQFILE_H
+#define MPQFILE_H
+
+#include <stdint.h>
+#include "MPQArchive.h"
+
+/*
+	Finding and reading files in archives opened with MPQOpenArchive. Files are found the same way Storm finds them, and may be looked up by name or by the hashes of their names, which is all an archive stores.
+*/
+
+// The locale of files which aren't specific to any language
+#define MPQ_LOCALE_NEUTRAL 0
+
+// The name of the file listing the names of the files in an archive
+#define MPQ_LISTFILE_NAME "(listfile)"
+
+/*
+	* MPQFindFileByHash *
+	Finds a file in the hash table, given the hashes of its name. A file with the requested locale is preferred; failing that, the neutral version of the file is found, as Storm does.
+*/
+MPQERROR MPQFindFileByHash(
+	// The archive
+	HMPQARCHIVE hArchive,
+	// The hashes of the file's name (MPQ_HASH_TABLE_INDEX, MPQ_HASH_NAME_A and MPQ_HASH_NAME_B)
+	uint32_t dwIndexHash,
+	uint32_t dwNameHashA,
+	uint32_t dwNameHashB,
+	// The locale of the file
+	uint16_t wLocale,
+	// The index of the file's hash table entry
+	uint32_t *lpiHashEntry
+);
+
+/*
+	* MPQFindFileByHETHash *
+	Finds a file through the HET table, given the HET hash of its name (MPQHashNameHET), and gets its hash table entry, with the same preference for locales as MPQFindFileByHash. The archive must have usable HET and BET tables (MPQGetHETTable).
+*/
+MPQERROR MPQFindFileByHETHash(
+	// The archive
+	HMPQARCHIVE hArchive,
+	// The HET hash of the file's name
+	uint64_t qwNameHash,
+	// The locale of the file
+	uint16_t wLocale,
+	// The index of the file's hash table entry
+	uint32_t *lpiHashEntry
+);
+
+/*
+	* MPQFindFile *
+	Finds a file in the hash table, given its name. Files in archives with usable HET and BET tables are found through those, which is faster, and finds the same hash table entry.
+*/
+MPQERROR MPQFindFile(
+	// The archive
+	HMPQARCHIVE hArchive,
+	// The name of the file
+	const char *lpszFileName,
+	// The locale of the file
+	uint16_t wLocale,
+	// The index of the file's hash table entry
+	uint32_t *lpiHashEntry
+);
+
+/*
+	* MPQGetFileKey *
+	Computes the encryption key of a file, which is derived from the file's name, without its path, and, for MPQ_FILE_FIX_KEY files, its position and size.
+*/
+uint32_t MPQGetFileKey(
+	// The name of the file
+	const char *lpszFileName,
+	// The position of the file's data in the archive (MPQGetBlockFilePos)
+	uint64_t qwFilePos,
+	// The size of the file, and its flags
+	uint32_t cbFileSize,
+	uint32_t grfFlags
+);
+
+/*
+	* MPQReadFile *
+	Reads, decrypts and decompresses an entire file into a buffer of the file's size (MPQBLOCKENTRY::cbFileSize).
+*/
+MPQERROR MPQReadFile(
+	// The archive
+	HMPQARCHIVE hArchive,
+	// The index of the file's block
+	uint32_t iBlock,
+	// The name of the file, used to get its key if it's encrypted. May be NULL if the file is known not to be encrypted.
+	const char *lpszFileName,
+	// The buffer to receive the file
+	void *lpvBuffer
+);
+
+/*
+	* MPQIsFileSizePossible *
+	Checks that a file's size (MPQBLOCKENTRY::cbFileSize) could be right, given how much is stored for it and how many sectors that makes: the offset table of a compressed file must fit in what's stored, what's left can't decompress to more than the best ratio of any supported compression method, and a file which isn't compressed can't be larger than what's stored. Use this before allocating a buffer of the file's size, which a corrupt or malicious block table could make anything up to 4 GB. Returns false if the block doesn't exist.
+*/
+bool MPQIsFileSizePossible(
+	// The archive
+	HMPQARCHIVE hArchive,
+	// The index of the file's block
+	uint32_t iBlock
+);
+
+/*
+	* MPQSECTORCALLBACK *
+	The type of the function MPQReadFileSectors calls with each sector of a file, in order.
+*/
+typedef void (*MPQSECTORCALLBACK)(
+	// The context passed to MPQReadFileSectors
+	void *lpvContext,
+	// The sector, decrypted and decompressed. Only valid until the function returns.
+	const void *lpvSector,
+	// The size of the sector: the archive's sector size, except for the last sector, which may be smaller, and the only sector of a single unit file, which is the size of the file
+	uint32_t cbSector
+);
+
+/*
+	* MPQReadFileSectors *
+	Reads, decrypts and decompresses a file a sector at a time, passing each sector to pfnSector, so that the file can be processed without a buffer for all of it. The sectors passed before an error was found are not taken back; the callback must be prepared for reading to stop early. Fails with MPQ_ERROR_BAD_FILE, before reading anything, if MPQIsFileSizePossible fails.
+*/
+MPQERROR MPQReadFileSectors(
+	// The archive
+	HMPQARCHIVE hArchive,
+	// The index of the file's block
+	uint32_t iBlock,
+	// The name of the file, used to get its key if it's encrypted. May be NULL if the file is known not to be encrypted.
+	const char *lpszFileName,
+	// The function to call with each sector
+	MPQSECTORCALLBACK pfnSector,
+	// Passed to pfnSector
+	void *lpvContext
+);
+
+/*
+	* MPQGetFileCompression *
+	Gets the compression methods used by a file: the MPQ_COMPRESSION_* flags of all its compressed sectors combined. Imploded files give MPQ_COMPRESSION_PKWARE, and files which aren't compressed give 0.
+*/
+MPQERROR MPQGetFileCompression(
+	// The archive
+	HMPQARCHIVE hArchive,
+	// The index of the file's block
+	uint32_t iBlock,
+	// The name of the file, used to get its key if it's encrypted. May be NULL if the file is known not to be encrypted.
+	const char *lpszFileName,
+	// The compression methods (MPQ_COMPRESSION_*)
+	uint32_t *lpgrfCompression
+);
+
+#endif // #ifndef MPQFILE_H
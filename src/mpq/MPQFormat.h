@@ -0,0 +1,194 @@
+/*
+	The contents of this file are subject to the Common Development and Distribution License Version 1.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at http://www.sun.com/cddl/cddl.html.
+
+	Software distributed under the License is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for the specific language governing rights and limitations under the License.
+
+	The Initial Developer of the Original Code is Justin Olbrantz. The Original Code Copyright (C) 2007 Justin Olbrantz. All Rights Reserved.
+*/
+
+// Prevent this header from being included multiple times
+#ifndef MPQFORMAT_H
+#define MPQFORMAT_H
+
+#include <stdint.h>
+
+/*
+	The on-disk structures of MPQ archives. These are shared by everything that reads or writes MPQs directly, rather than through Storm. The MPQ library doesn't include windows.h, so that it can be built anywhere; all structures use fixed-size types, and all values are little-endian.
+	An MPQ consists of a header, the file data, a hash table and a block table. The header may be preceded by anything, as long as it begins on a 512 byte boundary; this is how SEMPQs work. It may also be preceded by a user data header, which gives the offset of the real header. The hash table maps file names to entries in the block table, which give the position, size and flags of each file's data. Both tables are encrypted. All offsets in the header and tables are relative to the start of the header.
+*/
+
+// The signatures of the MPQ header ("MPQ\x1A") and user data header ("MPQ\x1B")
+#define MPQ_HEADER_SIGNATURE 0x1A51504D
+#define MPQ_USERDATA_SIGNATURE 0x1B51504D
+
+// The header is always on a boundary of this many bytes
+#define MPQ_HEADER_ALIGNMENT 512
+
+// MPQ format versions (MPQHEADER::wFormatVersion). Storm in the games MPQDraft patches only reads the original format; the later ones were introduced by World of Warcraft and StarCraft II.
+#define MPQ_FORMAT_VERSION_1 0	// The original format; 32-bit offsets
+#define MPQ_FORMAT_VERSION_2 1	// Adds the high block table, for archives over 4 GB
+#define MPQ_FORMAT_VERSION_3 2	// Adds the HET and BET tables, and a 64-bit archive size
+#define MPQ_FORMAT_VERSION_4 3	// Adds compressed table sizes and MD5s
+
+// The size of the header in each format version
+#define MPQ_HEADER_SIZE_V1 0x20
+#define MPQ_HEADER_SIZE_V2 0x2C
+#define MPQ_HEADER_SIZE_V3 0x44
+#define MPQ_HEADER_SIZE_V4 0xD0
+
+// The sector size is 512 << wSectorSizeShift
+#define MPQ_BASE_SECTOR_SIZE 512
+// Storm computes the sector size in 32 bits, so anything larger than this overflows
+#define MPQ_MAX_SECTOR_SIZE_SHIFT 22
+
+#pragma pack(push, 1)
+
+// Precedes the MPQ header in some archives, to leave room for data belonging to whatever the archive is embedded in
+struct MPQUSERDATA
+{
+	uint32_t dwSignature;	// MPQ_USERDATA_SIGNATURE
+	uint32_t cbUserDataSize;	// The size of the user data
+	uint32_t dwHeaderOffset;	// The offset of the MPQ header, relative to this structure
+	uint32_t cbUserDataHeader;	// The size of the user data header which follows this structure
+};
+
+struct MPQHEADER
+{
+	uint32_t dwSignature;	// MPQ_HEADER_SIGNATURE
+	uint32_t dwHeaderSize;	// The size of the header. Ignored by the original Storm, which always assumes MPQ_HEADER_SIZE_V1.
+	uint32_t dwArchiveSize;	// The size of the archive. Unreliable; the original Storm ignores it, and many archives have it wrong.
+	uint16_t wFormatVersion;	// MPQ_FORMAT_VERSION_*
+	uint16_t wSectorSizeShift;	// The size of the sectors files are divided into is MPQ_BASE_SECTOR_SIZE << wSectorSizeShift
+
+	uint32_t dwHashTableOffset;
+	uint32_t dwBlockTableOffset;
+	uint32_t nHashTableEntries;	// Must be a power of 2
+	uint32_t nBlockTableEntries;
+
+	// MPQ_FORMAT_VERSION_2 and later
+	uint64_t qwHiBlockTableOffset;	// An array of the high 16 bits of each block's file position, or 0 if there is none
+	uint16_t wHashTableOffsetHigh;
+	uint16_t wBlockTableOffsetHigh;
+
+	// MPQ_FORMAT_VERSION_3 and later
+	uint64_t qwArchiveSize;
+	uint64_t qwBETTableOffset;
+	uint64_t qwHETTableOffset;
+
+	// MPQ_FORMAT_VERSION_4 and later. The sizes of the tables as stored, which are smaller than the tables if they are compressed.
+	uint64_t qwHashTableSize;
+	uint64_t qwBlockTableSize;
+	uint64_t qwHiBlockTableSize;
+	uint64_t qwHETTableSize;
+	uint64_t qwBETTableSize;
+	uint32_t cbRawChunkSize;
+	uint8_t byBlockTableMD5[16];
+	uint8_t byHashTableMD5[16];
+	uint8_t byHiBlockTableMD5[16];
+	uint8_t byBETTableMD5[16];
+	uint8_t byHETTableMD5[16];
+	uint8_t byHeaderMD5[16];
+};
+
+// An entry in the hash table. Files are placed in the hash table at HashString(name, MPQ_HASH_TABLE_INDEX), or the next free entry after it, wrapping around at the end of the table.
+struct MPQHASHENTRY
+{
+	uint32_t dwNameHashA;	// HashString(name, MPQ_HASH_NAME_A)
+	uint32_t dwNameHashB;	// HashString(name, MPQ_HASH_NAME_B)
+	uint16_t wLocale;	// The Windows LANGID of the file, or 0 for neutral
+	uint16_t wPlatform;	// Always 0
+	uint32_t dwBlockIndex;	// The index of the file's block table entry, or one of the following values
+};
+
+// Special values of MPQHASHENTRY::dwBlockIndex
+#define MPQ_HASH_ENTRY_EMPTY 0xFFFFFFFF	// The entry has never been used; a search for a file stops here
+#define MPQ_HASH_ENTRY_DELETED 0xFFFFFFFE	// The file was deleted; a search for a file continues past this
+
+struct MPQBLOCKENTRY
+{
+	uint32_t dwFilePos;	// The offset of the file's data. In MPQ_FORMAT_VERSION_2 and later, the high 16 bits are in the high block table.
+	uint32_t cbCompressedSize;	// The size of the file's data in the archive
+	uint32_t cbFileSize;	// The size of the file once extracted
+	uint32_t grfFlags;	// MPQ_FILE_*
+};
+
+// Precedes the HET and BET tables. Everything after it is encrypted, and, in MPQ_FORMAT_VERSION_4, compressed if the table's stored size is less than cbDataSize plus this header.
+struct MPQEXTTABLEHEADER
+{
+	uint32_t dwSignature;	// MPQ_HET_TABLE_SIGNATURE or MPQ_BET_TABLE_SIGNATURE
+	uint32_t dwVersion;	// Always 1
+	uint32_t cbDataSize;	// The size of the table after this header, once decrypted and decompressed
+};
+
+/*
+	The HET table is a hash table of 8-bit name hashes, which map names to BET table entries. A file is placed at its 64-bit name hash (MPQHashNameHET, masked to nNameHashBits with the top bit set) modulo nTotalEntries, or the next free entry after it, wrapping around. Each entry is the top 8 bits of the masked name hash, or MPQ_HET_ENTRY_FREE.
+	Follows the extended table header, and is followed by the name hashes (uint8_t[nTotalEntries]) and the BET indices: a bit array of nTotalEntries values, each nIndexBitsTotal bits apart, of which the low nIndexBits bits are used.
+*/
+struct MPQHETHEADER
+{
+	uint32_t cbTableSize;	// The size of the table, including the extended table header
+	uint32_t nUsedEntries;
+	uint32_t nTotalEntries;
+	uint32_t nNameHashBits;	// The size of the name hashes, of which the top 8 are stored here and the rest in the BET table. Usually 64.
+	uint32_t nIndexBitsTotal;
+	uint32_t nIndexBitsExtra;
+	uint32_t nIndexBits;
+	uint32_t cbIndexTableSize;	// The size of the BET indices, in bytes
+};
+
+/*
+	The BET table is a block table, with each entry packed into as few bits as its fields need. In archives that also have a block table, its entries are the same as the block table's, in the same order.
+	Follows the extended table header, and is followed by the flags (uint32_t[nFlags], which entries give an index into), the entries (a bit array of nEntries entries of nEntryBits bits), and the rest of each file's name hash (a bit array of nEntries values, each nNameHashBitsTotal bits apart, of which the low nNameHashBits are used).
+*/
+struct MPQBETHEADER
+{
+	uint32_t cbTableSize;	// The size of the table, including the extended table header
+	uint32_t nEntries;
+	uint32_t dwUnknown08;	// Always 0x10
+	uint32_t nEntryBits;
+
+	// Where each field is in an entry, and how many bits it has
+	uint32_t iFilePosBit;
+	uint32_t iFileSizeBit;
+	uint32_t iCompressedSizeBit;
+	uint32_t iFlagIndexBit;
+	uint32_t iUnknownBit;
+	uint32_t nFilePosBits;
+	uint32_t nFileSizeBits;
+	uint32_t nCompressedSizeBits;
+	uint32_t nFlagIndexBits;
+	uint32_t nUnknownBits;
+
+	uint32_t nNameHashBitsTotal;
+	uint32_t nNameHashBitsExtra;
+	uint32_t nNameHashBits;
+	uint32_t cbNameHashTableSize;	// The size of the name hashes, in bytes
+	uint32_t nFlags;
+};
+
+#pragma pack(pop)
+
+// The signatures of the HET ("HET\x1A") and BET ("BET\x1A") tables
+#define MPQ_HET_TABLE_SIGNATURE 0x1A544548
+#define MPQ_BET_TABLE_SIGNATURE 0x1A544542
+
+// Special values of HET table entries
+#define MPQ_HET_ENTRY_FREE 0x00	// The entry has never been used; a search for a file stops here
+#define MPQ_HET_ENTRY_DELETED 0x80	// The file was deleted
+
+// Block flags (MPQBLOCKENTRY::grfFlags)
+#define MPQ_FILE_IMPLODE 0x00000100	// Compressed with PKWare Data Compression Library
+#define MPQ_FILE_COMPRESS 0x00000200	// Each sector is compressed, with the first byte of the sector giving the compression method
+#define MPQ_FILE_ENCRYPTED 0x00010000
+#define MPQ_FILE_FIX_KEY 0x00020000	// The encryption key is adjusted by the file's position and size
+#define MPQ_FILE_PATCH_FILE 0x00100000
+#define MPQ_FILE_SINGLE_UNIT 0x01000000	// The file is stored as a single unit, rather than in sectors
+#define MPQ_FILE_DELETE_MARKER 0x02000000
+#define MPQ_FILE_SECTOR_CRC 0x04000000	// Each sector has an Adler-32 checksum
+#define MPQ_FILE_EXISTS 0x80000000
+
+// All the flags that mean anything
+#define MPQ_FILE_VALID_FLAGS (MPQ_FILE_IMPLODE | MPQ_FILE_COMPRESS | MPQ_FILE_ENCRYPTED | MPQ_FILE_FIX_KEY \
+	| MPQ_FILE_PATCH_FILE | MPQ_FILE_SINGLE_UNIT | MPQ_FILE_DELETE_MARKER | MPQ_FILE_SECTOR_CRC | MPQ_FILE_EXISTS)
+
+#endif // #ifndef MPQFORMAT_H
@@ -0,0 +1,908 @@
+/*
+	The contents of this file are subject to the Common Development and Distribution License Version 1.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at http://www.sun.com/cddl/cddl.html.
+
+	Software distributed under the License is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for the specific language governing rights and limitations under the License.
+
+	The Initial Developer of the Original Code is Justin Olbrantz. The Original Code Copyright (C) 2007 Justin Olbrantz. All Rights Reserved.
+*/
+
+#include "MPQMerge.h"
+#include "MPQCompress.h"
+#include "MPQCrypt.h"
+#include "MPQFile.h"
+#include "MPQParallel.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// The smallest hash table to create, so that small archives have room to have files added by other tools
+#define MIN_HASH_TABLE_SIZE 16
+
+// The sector size when there are no archives to take one from; the one the games use
+#define DEFAULT_SECTOR_SIZE_SHIFT 3
+
+// The largest file position and archive size the original format can hold
+#define MAX_ARCHIVE_SIZE 0xFFFFFFFFULL
+
+// Files which describe the archive they're in, and would be wrong in the merged archive
+static const char *const s_lpszDroppedFiles[] = { "(attributes)", "(signature)" };
+
+enum COPYMETHOD
+{
+	COPY_VERBATIM,
+	COPY_REKEYED,
+	COPY_RECOMPRESSED,
+	// Stored uncompressed because MPQMERGEOPTIONS::lpFileLoads asked for it
+	COPY_EXPANDED
+};
+
+// A file going into the merged archive
+struct MERGEFILE
+{
+	// The index of the file in the overlay, or 0xFFFFFFFF for the new list file
+	uint32_t iFile;
+	// The copy of the file which is read, and where its data is
+	uint32_t iArchive;
+	uint32_t iBlock;
+	uint64_t qwSourcePos;
+
+	// The hash of the name which gives the file's position in the hash table. If the name isn't known, only the low bits of it are known, from the file's position in its original hash table; nIndexHashEntries is the size of that table, or 0 if the whole hash is known.
+	uint32_t dwIndexHash;
+	uint32_t nIndexHashEntries;
+
+	// The position of the file's name in the order given, or 0xFFFFFFFF if it's not there
+	uint32_t iOrder;
+	// Whether the file is loaded often enough to store uncompressed
+	bool bHot;
+
+	bool operator<(const MERGEFILE &file) const
+	{ return iArchive != file.iArchive ? iArchive < file.iArchive : qwSourcePos < file.qwSourcePos; }
+};
+
+// The output file and where the next data goes in it. The header is at the start of the file, so positions in the file and the archive are the same.
+struct MERGEWRITER
+{
+	FILE *lpFile;
+	uint64_t qwPos;
+	uint32_t cbSectorSize;
+};
+
+static MPQERROR WriteData(MERGEWRITER &writer, const void *lpvData, uint64_t cbData)
+{
+	if (writer.qwPos + cbData > MAX_ARCHIVE_SIZE)
+		return MPQ_ERROR_TOO_LARGE;
+
+	if (cbData && fwrite(lpvData, 1, (size_t)cbData, writer.lpFile) != cbData)
+		return MPQ_ERROR_WRITE_FAILED;
+
+	writer.qwPos += cbData;
+
+	return MPQ_ERROR_SUCCESS;
+}
+
+/*
+	Works out which entry a file without a name would start from in a hash table of any size up to the size of the one it's in. That's the entry it's in, unless a collision pushed it along; it can only be sure it wasn't if the entry before it has never been used, as then there was nothing for it to collide with.
+*/
+static bool GetUnnamedIndexHash(HMPQARCHIVE hArchive, uint32_t iHashEntry, uint32_t &dwIndexHash, uint32_t &nIndexHashEntries)
+{
+	uint32_t nHashEntries;
+	const MPQHASHENTRY *lpHashTable = MPQGetHashTable(hArchive, &nHashEntries);
+
+	if (nHashEntries > 1 && lpHashTable[(iHashEntry - 1) & (nHashEntries - 1)].dwBlockIndex != MPQ_HASH_ENTRY_EMPTY)
+		return false;
+
+	dwIndexHash = iHashEntry;
+	nIndexHashEntries = nHashEntries;
+
+	return true;
+}
+
+/*
+	A compressed file divided into the merged archive's sectors and compressed again: its sector offset table followed by its sectors, not yet encrypted, as the key depends on where it's written. Files are compressed before any are written, so that it can be done on several threads.
+*/
+struct RECOMPRESSEDFILE
+{
+	uint8_t *lpbyData;
+	uint32_t cbData;
+	MPQERROR error;
+};
+
+// Whether a file's sectors have to be compressed again for the merged archive
+static bool NeedsRecompressing(HMPQARCHIVE hArchive, const MPQBLOCKENTRY &block, uint32_t cbSectorSize)
+{
+	return (block.grfFlags & MPQ_FILE_EXISTS) && (block.grfFlags & (MPQ_FILE_IMPLODE | MPQ_FILE_COMPRESS))
+		&& !(block.grfFlags & MPQ_FILE_SINGLE_UNIT) && block.cbFileSize && MPQGetArchiveInfo(hArchive)->cbSectorSize != cbSectorSize;
+}
+
+static MPQERROR RecompressFile(HMPQARCHIVE hArchive, uint32_t iBlock, const char *lpszFileName, uint32_t cbSectorSize, RECOMPRESSEDFILE &recompressedFile)
+{
+	const MPQBLOCKENTRY &block = MPQGetBlockTable(hArchive, NULL)[iBlock];
+
+	// Files keep the method they were compressed with, so that every game that could read them still can. Files with no sectors that were worth compressing are tried with PKWare, which every version of Storm has.
+	uint32_t grfCompression;
+	MPQERROR error = MPQGetFileCompression(hArchive, iBlock, lpszFileName, &grfCompression);
+	if (error != MPQ_ERROR_SUCCESS)
+		return error;
+
+	uint32_t dwCompression = (grfCompression & MPQ_COMPRESSION_ZLIB) ? MPQ_COMPRESSION_ZLIB : MPQ_COMPRESSION_PKWARE;
+
+	uint8_t *lpbyFileData = new (std::nothrow) uint8_t[block.cbFileSize];
+	if (!lpbyFileData)
+		return MPQ_ERROR_NO_MEMORY;
+
+	error = MPQReadFile(hArchive, iBlock, lpszFileName, lpbyFileData);
+	if (error != MPQ_ERROR_SUCCESS)
+	{
+		delete [] lpbyFileData;
+		return error;
+	}
+
+	// Sectors are never stored larger than they are
+	uint32_t nSectors = (uint32_t)(((uint64_t)block.cbFileSize + cbSectorSize - 1) / cbSectorSize);
+	uint64_t cbMaxData = (uint64_t)(nSectors + 1) * sizeof(uint32_t) + block.cbFileSize;
+	if (cbMaxData > MAX_ARCHIVE_SIZE)
+	{
+		delete [] lpbyFileData;
+		return MPQ_ERROR_TOO_LARGE;
+	}
+
+	recompressedFile.lpbyData = new (std::nothrow) uint8_t[(size_t)cbMaxData];
+	if (!recompressedFile.lpbyData)
+	{
+		delete [] lpbyFileData;
+		return MPQ_ERROR_NO_MEMORY;
+	}
+
+	uint32_t *lpdwOffsets = (uint32_t *)recompressedFile.lpbyData;
+	uint32_t dwOffset = (nSectors + 1) * sizeof(uint32_t);
+
+	for (uint32_t iSector = 0; iSector < nSectors; iSector++)
+	{
+		uint32_t dwSectorStart = iSector * cbSectorSize;
+		uint32_t cbSector = block.cbFileSize - dwSectorStart < cbSectorSize ? block.cbFileSize - dwSectorStart : cbSectorSize;
+
+		uint32_t cbStored;
+		if (!MPQCompressSector(recompressedFile.lpbyData + dwOffset, &cbStored, lpbyFileData + dwSectorStart, cbSector, block.grfFlags, dwCompression))
+		{
+			memcpy(recompressedFile.lpbyData + dwOffset, lpbyFileData + dwSectorStart, cbSector);
+			cbStored = cbSector;
+		}
+
+		lpdwOffsets[iSector] = dwOffset;
+		dwOffset += cbStored;
+	}
+
+	lpdwOffsets[nSectors] = dwOffset;
+	recompressedFile.cbData = dwOffset;
+
+	delete [] lpbyFileData;
+
+	return MPQ_ERROR_SUCCESS;
+}
+
+// Writes a file compressed again by RecompressFile, encrypted with the key for its new position if it was encrypted
+static MPQERROR WriteRecompressedFile(MERGEWRITER &writer, RECOMPRESSEDFILE &recompressedFile, const char *lpszFileName, MPQBLOCKENTRY &newBlock)
+{
+	if (recompressedFile.error != MPQ_ERROR_SUCCESS)
+		return recompressedFile.error;
+
+	newBlock.grfFlags &= ~MPQ_FILE_SECTOR_CRC;
+	newBlock.cbCompressedSize = recompressedFile.cbData;
+
+	if (newBlock.grfFlags & MPQ_FILE_ENCRYPTED)
+	{
+		uint32_t dwKey = MPQGetFileKey(lpszFileName, newBlock.dwFilePos, newBlock.cbFileSize, newBlock.grfFlags);
+		uint32_t *lpdwOffsets = (uint32_t *)recompressedFile.lpbyData;
+		uint32_t nSectors = (uint32_t)(((uint64_t)newBlock.cbFileSize + writer.cbSectorSize - 1) / writer.cbSectorSize);
+
+		// The sectors first, as encrypting the offset table loses where they are
+		for (uint32_t iSector = 0; iSector < nSectors; iSector++)
+			MPQEncryptBlock(recompressedFile.lpbyData + lpdwOffsets[iSector], lpdwOffsets[iSector + 1] - lpdwOffsets[iSector], dwKey + iSector);
+
+		MPQEncryptBlock(lpdwOffsets, (nSectors + 1) * sizeof(uint32_t), dwKey - 1);
+	}
+
+	MPQERROR error = WriteData(writer, recompressedFile.lpbyData, recompressedFile.cbData);
+
+	// It's no longer needed, and all the files compressed again may not fit in memory twice
+	delete [] recompressedFile.lpbyData;
+	recompressedFile.lpbyData = NULL;
+
+	return error;
+}
+
+// Writes the file as one sector, or in sectors of the merged archive's size, encrypted with the key for its new position if it was encrypted
+static MPQERROR WriteUncompressedFile(MERGEWRITER &writer, uint8_t *lpbyData, const char *lpszFileName, MPQBLOCKENTRY &newBlock)
+{
+	if (newBlock.grfFlags & MPQ_FILE_ENCRYPTED)
+	{
+		uint32_t dwKey = MPQGetFileKey(lpszFileName, newBlock.dwFilePos, newBlock.cbFileSize, newBlock.grfFlags);
+		uint32_t cbSectorSize = (newBlock.grfFlags & MPQ_FILE_SINGLE_UNIT) ? newBlock.cbFileSize : writer.cbSectorSize;
+
+		for (uint32_t dwOffset = 0, iSector = 0; dwOffset < newBlock.cbFileSize; dwOffset += cbSectorSize, iSector++)
+		{
+			uint32_t cbSector = newBlock.cbFileSize - dwOffset < cbSectorSize ? newBlock.cbFileSize - dwOffset : cbSectorSize;
+			MPQEncryptBlock(lpbyData + dwOffset, cbSector, dwKey + iSector);
+		}
+	}
+
+	newBlock.cbCompressedSize = newBlock.cbFileSize;
+
+	return WriteData(writer, lpbyData, newBlock.cbFileSize);
+}
+
+/*
+	Copies a compressed file's sectors to its new position, decrypting them with the old key and encrypting them with the new one. The sectors themselves are not touched. Sector checksums are dropped, as they're optional, and rewriting the offset table is simpler without them.
+*/
+static MPQERROR RekeyCompressedFile(MERGEWRITER &writer, const uint8_t *lpbyFileData, const MPQBLOCKENTRY &block, uint32_t cbSectorSize,
+	uint32_t dwOldKey, const char *lpszFileName, MPQBLOCKENTRY &newBlock)
+{
+	uint32_t nSectors = (uint32_t)(((uint64_t)block.cbFileSize + cbSectorSize - 1) / cbSectorSize);
+	uint32_t nOldOffsets = nSectors + ((block.grfFlags & MPQ_FILE_SECTOR_CRC) ? 2 : 1);
+	if ((uint64_t)nOldOffsets * sizeof(uint32_t) > block.cbCompressedSize)
+		return MPQ_ERROR_BAD_FILE;
+
+	uint32_t *lpdwOldOffsets = new (std::nothrow) uint32_t[nOldOffsets];
+	uint32_t *lpdwNewOffsets = new (std::nothrow) uint32_t[nSectors + 1];
+	uint8_t *lpbySector = new (std::nothrow) uint8_t[cbSectorSize];
+	if (!lpdwOldOffsets || !lpdwNewOffsets || !lpbySector)
+	{
+		delete [] lpdwOldOffsets;
+		delete [] lpdwNewOffsets;
+		delete [] lpbySector;
+
+		return MPQ_ERROR_NO_MEMORY;
+	}
+
+	memcpy(lpdwOldOffsets, lpbyFileData, nOldOffsets * sizeof(uint32_t));
+	MPQDecryptBlock(lpdwOldOffsets, nOldOffsets * sizeof(uint32_t), dwOldKey - 1);
+
+	// The sectors go straight after the new offset table, in order
+	MPQERROR error = MPQ_ERROR_SUCCESS;
+	lpdwNewOffsets[0] = (nSectors + 1) * sizeof(uint32_t);
+	for (uint32_t iSector = 0; iSector < nSectors; iSector++)
+	{
+		uint32_t dwSectorStart = lpdwOldOffsets[iSector], dwSectorEnd = lpdwOldOffsets[iSector + 1];
+		if (dwSectorStart > dwSectorEnd || dwSectorEnd > block.cbCompressedSize || dwSectorEnd - dwSectorStart > cbSectorSize)
+		{
+			error = MPQ_ERROR_BAD_FILE;
+			break;
+		}
+
+		lpdwNewOffsets[iSector + 1] = lpdwNewOffsets[iSector] + (dwSectorEnd - dwSectorStart);
+	}
+
+	uint32_t dwNewKey = MPQGetFileKey(lpszFileName, newBlock.dwFilePos, newBlock.cbFileSize, newBlock.grfFlags);
+
+	if (error == MPQ_ERROR_SUCCESS)
+	{
+		newBlock.grfFlags &= ~MPQ_FILE_SECTOR_CRC;
+		newBlock.cbCompressedSize = lpdwNewOffsets[nSectors];
+
+		MPQEncryptBlock(lpdwNewOffsets, (nSectors + 1) * sizeof(uint32_t), dwNewKey - 1);
+		error = WriteData(writer, lpdwNewOffsets, (nSectors + 1) * sizeof(uint32_t));
+	}
+
+	for (uint32_t iSector = 0; iSector < nSectors && error == MPQ_ERROR_SUCCESS; iSector++)
+	{
+		uint32_t cbSector = lpdwOldOffsets[iSector + 1] - lpdwOldOffsets[iSector];
+
+		memcpy(lpbySector, lpbyFileData + lpdwOldOffsets[iSector], cbSector);
+		MPQDecryptBlock(lpbySector, cbSector, dwOldKey + iSector);
+		MPQEncryptBlock(lpbySector, cbSector, dwNewKey + iSector);
+
+		error = WriteData(writer, lpbySector, cbSector);
+	}
+
+	delete [] lpdwOldOffsets;
+	delete [] lpdwNewOffsets;
+	delete [] lpbySector;
+
+	return error;
+}
+
+/*
+	Copies a file's data to the end of the merged archive, and fills in its new block. The data is copied as it is unless the key or the sector size changes, or bExpand asks for a compressed file to be stored uncompressed. Compressed files whose sector size changes have already been compressed again, into recompressedFile.
+*/
+static MPQERROR CopyMergeFile(MERGEWRITER &writer, HMPQARCHIVE hArchive, uint32_t iBlock, const char *lpszFileName, bool bExpand, RECOMPRESSEDFILE &recompressedFile,
+	MPQBLOCKENTRY &newBlock, COPYMETHOD &method)
+{
+	const MPQBLOCKENTRY &block = MPQGetBlockTable(hArchive, NULL)[iBlock];
+
+	newBlock = block;
+	newBlock.dwFilePos = (uint32_t)writer.qwPos;
+	method = COPY_VERBATIM;
+
+	// Blocks which aren't files have no data worth keeping, but still hide the file in lower priority archives
+	if (!(block.grfFlags & MPQ_FILE_EXISTS))
+	{
+		newBlock.cbCompressedSize = 0;
+		return MPQ_ERROR_SUCCESS;
+	}
+
+	uint64_t qwDataSize, qwFilePos = MPQGetBlockFilePos(hArchive, iBlock);
+	const uint8_t *lpbyArchive = MPQGetArchiveData(hArchive, &qwDataSize);
+	if (qwFilePos > qwDataSize || block.cbCompressedSize > qwDataSize - qwFilePos)
+		return MPQ_ERROR_BAD_FILE;
+
+	const uint8_t *lpbyFileData = lpbyArchive + qwFilePos;
+
+	bool bEncrypted = (block.grfFlags & MPQ_FILE_ENCRYPTED) != 0;
+	bool bCompressed = (block.grfFlags & (MPQ_FILE_IMPLODE | MPQ_FILE_COMPRESS)) != 0;
+	bool bSectored = !(block.grfFlags & MPQ_FILE_SINGLE_UNIT) && block.cbFileSize;
+	uint32_t cbSectorSize = MPQGetArchiveInfo(hArchive)->cbSectorSize;
+
+	// The sector size only matters to files with an offset table or a key for each sector
+	bool bResector = bSectored && (bCompressed || bEncrypted) && cbSectorSize != writer.cbSectorSize;
+	bool bRekey = bEncrypted && (block.grfFlags & MPQ_FILE_FIX_KEY) && (uint32_t)qwFilePos != newBlock.dwFilePos;
+	bExpand = bExpand && bCompressed;
+
+	if (!bResector && !bRekey && !bExpand)
+		return WriteData(writer, lpbyFileData, block.cbCompressedSize);
+
+	if (bEncrypted && !lpszFileName)
+		return MPQ_ERROR_UNKNOWN_KEY;
+
+	if (bResector && bCompressed && !bExpand)
+	{
+		method = COPY_RECOMPRESSED;
+		return WriteRecompressedFile(writer, recompressedFile, lpszFileName, newBlock);
+	}
+
+	uint32_t dwOldKey = bEncrypted ? MPQGetFileKey(lpszFileName, qwFilePos, block.cbFileSize, block.grfFlags) : 0;
+
+	if (!bResector && !bExpand && bCompressed && bSectored)
+	{
+		method = COPY_REKEYED;
+		return RekeyCompressedFile(writer, lpbyFileData, block, cbSectorSize, dwOldKey, lpszFileName, newBlock);
+	}
+
+	if (!bResector && !bExpand && bCompressed)
+	{
+		// A compressed single unit file is encrypted as one block
+		uint8_t *lpbyData = new (std::nothrow) uint8_t[block.cbCompressedSize ? block.cbCompressedSize : 1];
+		if (!lpbyData)
+			return MPQ_ERROR_NO_MEMORY;
+
+		memcpy(lpbyData, lpbyFileData, block.cbCompressedSize);
+		MPQDecryptBlock(lpbyData, block.cbCompressedSize, dwOldKey);
+		MPQEncryptBlock(lpbyData, block.cbCompressedSize, MPQGetFileKey(lpszFileName, newBlock.dwFilePos, newBlock.cbFileSize, newBlock.grfFlags));
+
+		MPQERROR error = WriteData(writer, lpbyData, block.cbCompressedSize);
+		method = COPY_REKEYED;
+
+		delete [] lpbyData;
+
+		return error;
+	}
+
+	// Everything else is stored uncompressed, which can be done in sectors of any size: files to be expanded, and uncompressed files being encrypted again
+	uint8_t *lpbyData = new (std::nothrow) uint8_t[block.cbFileSize ? block.cbFileSize : 1];
+	if (!lpbyData)
+		return MPQ_ERROR_NO_MEMORY;
+
+	MPQERROR error = MPQReadFile(hArchive, iBlock, lpszFileName, lpbyData);
+	if (error == MPQ_ERROR_SUCCESS)
+	{
+		if (bCompressed)
+		{
+			newBlock.grfFlags &= ~(MPQ_FILE_IMPLODE | MPQ_FILE_COMPRESS | MPQ_FILE_SECTOR_CRC);
+			method = COPY_EXPANDED;
+		}
+		else
+			method = COPY_REKEYED;
+
+		error = WriteUncompressedFile(writer, lpbyData, lpszFileName, newBlock);
+	}
+
+	delete [] lpbyData;
+
+	return error;
+}
+
+// Puts the files named in the order given first, in that order, and returns how many there were
+static uint32_t OrderFiles(HMPQOVERLAY hOverlay, std::vector<MERGEFILE> &mergeFiles, const char *const *lplpszNames, uint32_t nNames)
+{
+	// Files are matched by both name hashes, so the order applies to all locales of a file
+	std::unordered_map<uint64_t, uint32_t> namePositions;
+	for (uint32_t iName = 0; iName < nNames; iName++)
+	{
+		MPQNAMEHASHES hashes;
+		MPQHashName(lplpszNames[iName], &hashes);
+
+		namePositions.insert(std::make_pair(((uint64_t)hashes.dwNameHashA << 32) | hashes.dwNameHashB, iName));
+	}
+
+	const MPQOVERLAYFILE *lpFiles = MPQGetOverlayFiles(hOverlay, NULL);
+	uint32_t nOrderedFiles = 0;
+
+	for (MERGEFILE &mergeFile : mergeFiles)
+	{
+		const MPQOVERLAYFILE &file = lpFiles[mergeFile.iFile];
+		std::unordered_map<uint64_t, uint32_t>::const_iterator itPosition = namePositions.find(((uint64_t)file.dwNameHashA << 32) | file.dwNameHashB);
+
+		if (itPosition != namePositions.end())
+		{
+			mergeFile.iOrder = itPosition->second;
+			nOrderedFiles++;
+		}
+	}
+
+	// Files not in the order keep the order they're already in
+	std::stable_sort(mergeFiles.begin(), mergeFiles.end(),
+		[](const MERGEFILE &file1, const MERGEFILE &file2) { return file1.iOrder < file2.iOrder; });
+
+	return nOrderedFiles;
+}
+
+/*
+	Chooses the files to store uncompressed, from how many times each is loaded. The decompression a file saves is its size, or the time it takes to read if that's known, for each time it's loaded; the cost is the difference between its size and its compressed size. Files are taken in order of the decompression saved for each byte of cost until the budget is used up, skipping any which don't fit.
+*/
+static void ChooseHotFiles(HMPQOVERLAY hOverlay, std::vector<MERGEFILE> &mergeFiles, const MPQMERGEOPTIONS &options, MPQMERGERESULT &result)
+{
+	std::unordered_map<uint64_t, uint64_t> nameLoads;
+	for (uint32_t iName = 0; iName < options.nFileLoads; iName++)
+	{
+		MPQNAMEHASHES hashes;
+		MPQHashName(options.lpFileLoads[iName].lpszName, &hashes);
+
+		nameLoads[((uint64_t)hashes.dwNameHashA << 32) | hashes.dwNameHashB] += options.lpFileLoads[iName].nLoads;
+	}
+
+	const MPQOVERLAYFILE *lpFiles = MPQGetOverlayFiles(hOverlay, NULL);
+	const MPQOVERLAYARCHIVE *lpArchives = MPQGetOverlayArchives(hOverlay);
+
+	// The decompression each file would save, and what it would cost
+	struct HOTFILE
+	{
+		uint32_t iMergeFile;
+		// Bytes, or seconds if read times are known
+		double fSaved;
+		uint64_t cbCost;
+	};
+
+	std::vector<HOTFILE> hotFiles;
+	for (uint32_t iMergeFile = 0; iMergeFile < mergeFiles.size(); iMergeFile++)
+	{
+		const MERGEFILE &mergeFile = mergeFiles[iMergeFile];
+		const MPQOVERLAYFILE &file = lpFiles[mergeFile.iFile];
+
+		uint64_t nLoads = 1;
+		if (options.lpFileLoads)
+		{
+			std::unordered_map<uint64_t, uint64_t>::const_iterator itLoads = nameLoads.find(((uint64_t)file.dwNameHashA << 32) | file.dwNameHashB);
+			nLoads = itLoads != nameLoads.end() ? itLoads->second : 0;
+		}
+
+		if (options.lpfReadSeconds && options.lpfReadSeconds[mergeFile.iFile] > 0)
+			result.fReadSeconds += nLoads * options.lpfReadSeconds[mergeFile.iFile];
+
+		if (!nLoads || (options.lpfReadSeconds && options.lpfReadSeconds[mergeFile.iFile] < 0))
+			continue;
+
+		const MPQBLOCKENTRY &block = MPQGetBlockTable(lpArchives[mergeFile.iArchive].hArchive, NULL)[mergeFile.iBlock];
+		if (!(block.grfFlags & MPQ_FILE_EXISTS) || !(block.grfFlags & (MPQ_FILE_IMPLODE | MPQ_FILE_COMPRESS)) || !block.cbFileSize
+			|| (options.cbMaxHotFileSize && block.cbFileSize > options.cbMaxHotFileSize)
+			|| ((block.grfFlags & MPQ_FILE_ENCRYPTED) && !file.lpszName))
+			continue;
+
+		HOTFILE hotFile;
+		hotFile.iMergeFile = iMergeFile;
+		hotFile.fSaved = (double)nLoads * (options.lpfReadSeconds ? options.lpfReadSeconds[mergeFile.iFile] : block.cbFileSize);
+		if (hotFile.fSaved <= 0)
+			continue;
+		hotFile.cbCost = block.cbFileSize > block.cbCompressedSize ? block.cbFileSize - block.cbCompressedSize : 0;
+
+		hotFiles.push_back(hotFile);
+	}
+
+	// Files that cost nothing come first
+	std::sort(hotFiles.begin(), hotFiles.end(), [](const HOTFILE &file1, const HOTFILE &file2)
+		{ return file1.fSaved * file2.cbCost > file2.fSaved * file1.cbCost; });
+
+	for (const HOTFILE &hotFile : hotFiles)
+	{
+		if (options.lpfReadSeconds && options.fReadSecondsBudget && result.fReadSeconds - result.fSavedReadSeconds <= options.fReadSecondsBudget)
+			break;
+
+		if (result.cbHotFileGrowth + hotFile.cbCost > options.cbHotFileBudget)
+			continue;
+
+		mergeFiles[hotFile.iMergeFile].bHot = true;
+		result.cbHotFileGrowth += hotFile.cbCost;
+		result.nHotFiles++;
+		if (options.lpfReadSeconds)
+			result.fSavedReadSeconds += hotFile.fSaved;
+	}
+}
+
+// Chooses the sector size most of the data whose layout depends on it already uses, so that as little as possible has to be compressed again
+static uint32_t ChooseSectorSize(HMPQOVERLAY hOverlay, const std::vector<MERGEFILE> &mergeFiles)
+{
+	const MPQOVERLAYARCHIVE *lpArchives = MPQGetOverlayArchives(hOverlay);
+	uint32_t nArchives = MPQGetOverlayInfo(hOverlay)->nArchives;
+
+	if (!nArchives)
+		return MPQ_BASE_SECTOR_SIZE << DEFAULT_SECTOR_SIZE_SHIFT;
+
+	std::vector<std::pair<uint32_t, uint64_t> > sectorSizeBytes;
+	for (const MERGEFILE &mergeFile : mergeFiles)
+	{
+		if (mergeFile.iFile == 0xFFFFFFFF)
+			continue;
+
+		HMPQARCHIVE hArchive = lpArchives[mergeFile.iArchive].hArchive;
+		const MPQBLOCKENTRY &block = MPQGetBlockTable(hArchive, NULL)[mergeFile.iBlock];
+		if ((block.grfFlags & MPQ_FILE_SINGLE_UNIT) || !(block.grfFlags & (MPQ_FILE_IMPLODE | MPQ_FILE_COMPRESS | MPQ_FILE_ENCRYPTED)))
+			continue;
+
+		uint32_t cbSectorSize = MPQGetArchiveInfo(hArchive)->cbSectorSize;
+
+		size_t iSectorSize = 0;
+		while (iSectorSize < sectorSizeBytes.size() && sectorSizeBytes[iSectorSize].first != cbSectorSize)
+			iSectorSize++;
+		if (iSectorSize == sectorSizeBytes.size())
+			sectorSizeBytes.push_back(std::make_pair(cbSectorSize, (uint64_t)0));
+
+		sectorSizeBytes[iSectorSize].second += block.cbCompressedSize;
+	}
+
+	// Without any such files, use the sector size of the archive with the highest priority
+	uint32_t cbBestSectorSize = MPQGetArchiveInfo(lpArchives[nArchives - 1].hArchive)->cbSectorSize;
+	uint64_t cbBestBytes = 0;
+	for (const std::pair<uint32_t, uint64_t> &sectorSize : sectorSizeBytes)
+	{
+		if (sectorSize.second > cbBestBytes)
+		{
+			cbBestSectorSize = sectorSize.first;
+			cbBestBytes = sectorSize.second;
+		}
+	}
+
+	return cbBestSectorSize;
+}
+
+// Builds the new list file from the names of the files being merged
+static std::string BuildListFile(HMPQOVERLAY hOverlay, const std::vector<MERGEFILE> &mergeFiles)
+{
+	const MPQOVERLAYFILE *lpFiles = MPQGetOverlayFiles(hOverlay, NULL);
+
+	std::vector<std::string> names;
+	for (const MERGEFILE &mergeFile : mergeFiles)
+	{
+		if (mergeFile.iFile != 0xFFFFFFFF && lpFiles[mergeFile.iFile].lpszName)
+			names.push_back(lpFiles[mergeFile.iFile].lpszName);
+	}
+
+	// Files in several locales have the same name
+	std::sort(names.begin(), names.end());
+	names.erase(std::unique(names.begin(), names.end()), names.end());
+
+	std::string listFile;
+	for (const std::string &name : names)
+		listFile += name + "\r\n";
+
+	return listFile;
+}
+
+// Writes the hash table, block table and header, once all the files are written
+static MPQERROR WriteTables(MERGEWRITER &writer, const std::vector<MERGEFILE> &mergeFiles, const std::vector<MPQHASHENTRY> &mergeHashEntries,
+	std::vector<MPQBLOCKENTRY> &blockTable, uint32_t nHashTableEntries)
+{
+	std::vector<MPQHASHENTRY> hashTable(nHashTableEntries);
+	memset(&hashTable[0], 0xFF, nHashTableEntries * sizeof(MPQHASHENTRY));
+
+	for (uint32_t iMergeFile = 0; iMergeFile < mergeFiles.size(); iMergeFile++)
+	{
+		uint32_t iHashEntry = mergeFiles[iMergeFile].dwIndexHash & (nHashTableEntries - 1);
+		while (hashTable[iHashEntry].dwBlockIndex != MPQ_HASH_ENTRY_EMPTY)
+			iHashEntry = (iHashEntry + 1) & (nHashTableEntries - 1);
+
+		hashTable[iHashEntry] = mergeHashEntries[iMergeFile];
+		hashTable[iHashEntry].dwBlockIndex = iMergeFile;
+	}
+
+	MPQHEADER header;
+	memset(&header, 0, sizeof(header));
+
+	header.dwSignature = MPQ_HEADER_SIGNATURE;
+	header.dwHeaderSize = MPQ_HEADER_SIZE_V1;
+	header.wFormatVersion = MPQ_FORMAT_VERSION_1;
+	while (((uint32_t)MPQ_BASE_SECTOR_SIZE << header.wSectorSizeShift) < writer.cbSectorSize)
+		header.wSectorSizeShift++;
+	header.nHashTableEntries = nHashTableEntries;
+	header.nBlockTableEntries = (uint32_t)blockTable.size();
+
+	MPQEncryptBlock(&hashTable[0], hashTable.size() * sizeof(MPQHASHENTRY), MPQ_HASH_TABLE_KEY);
+
+	header.dwHashTableOffset = (uint32_t)writer.qwPos;
+	MPQERROR error = WriteData(writer, &hashTable[0], hashTable.size() * sizeof(MPQHASHENTRY));
+	if (error != MPQ_ERROR_SUCCESS)
+		return error;
+
+	if (!blockTable.empty())
+		MPQEncryptBlock(&blockTable[0], blockTable.size() * sizeof(MPQBLOCKENTRY), MPQ_BLOCK_TABLE_KEY);
+
+	header.dwBlockTableOffset = (uint32_t)writer.qwPos;
+	error = WriteData(writer, blockTable.empty() ? NULL : &blockTable[0], blockTable.size() * sizeof(MPQBLOCKENTRY));
+	if (error != MPQ_ERROR_SUCCESS)
+		return error;
+
+	header.dwArchiveSize = (uint32_t)writer.qwPos;
+
+	if (fseek(writer.lpFile, 0, SEEK_SET) || fwrite(&header, 1, MPQ_HEADER_SIZE_V1, writer.lpFile) != MPQ_HEADER_SIZE_V1)
+		return MPQ_ERROR_WRITE_FAILED;
+
+	return MPQ_ERROR_SUCCESS;
+}
+
+MPQERROR MPQMergeArchives(HMPQOVERLAY hOverlay, const char *lpszOutputFileName, const MPQMERGEOPTIONS *lpOptions, MPQMERGERESULT *lpResult)
+{
+	MPQMERGERESULT result;
+	memset(&result, 0, sizeof(result));
+	result.iFailedFile = 0xFFFFFFFF;
+
+	if (lpResult)
+		*lpResult = result;
+
+	uint32_t nFiles;
+	const MPQOVERLAYFILE *lpFiles = MPQGetOverlayFiles(hOverlay, &nFiles);
+	const MPQOVERLAYINSTANCE *lpInstances = MPQGetOverlayInstances(hOverlay);
+	const MPQOVERLAYARCHIVE *lpArchives = MPQGetOverlayArchives(hOverlay);
+
+	MPQNAMEHASHES listFileHashes, droppedFileHashes[sizeof(s_lpszDroppedFiles) / sizeof(s_lpszDroppedFiles[0])];
+	MPQHashName(MPQ_LISTFILE_NAME, &listFileHashes);
+	for (uint32_t iDroppedFile = 0; iDroppedFile < sizeof(s_lpszDroppedFiles) / sizeof(s_lpszDroppedFiles[0]); iDroppedFile++)
+		MPQHashName(s_lpszDroppedFiles[iDroppedFile], &droppedFileHashes[iDroppedFile]);
+
+	// Take the copy of each file which is read, and work out where it goes in the hash table. The smallest hash table the name of an unnamed file is known for limits the size of the new one.
+	std::vector<MERGEFILE> mergeFiles;
+	uint32_t nMaxHashTableEntries = 0x80000000, iLimitingFile = 0xFFFFFFFF;
+
+	for (uint32_t iFile = 0; iFile < nFiles; iFile++)
+	{
+		const MPQOVERLAYFILE &file = lpFiles[iFile];
+
+		bool bDropped = false;
+		for (const MPQNAMEHASHES &droppedFile : droppedFileHashes)
+		{
+			if (file.dwNameHashA == droppedFile.dwNameHashA && file.dwNameHashB == droppedFile.dwNameHashB)
+				bDropped = true;
+		}
+
+		if (bDropped)
+		{
+			result.nDroppedFiles++;
+			continue;
+		}
+
+		// The list file is replaced by one listing everything. Files hidden by a locale neutral copy in a higher archive are never read, and would be read instead of it if they were in the same archive.
+		if ((file.dwNameHashA == listFileHashes.dwNameHashA && file.dwNameHashB == listFileHashes.dwNameHashB) || file.bHidden)
+			continue;
+
+		const MPQOVERLAYINSTANCE &instance = lpInstances[file.iFirstInstance];
+
+		MERGEFILE mergeFile;
+		mergeFile.iFile = iFile;
+		mergeFile.iArchive = instance.iArchive;
+		mergeFile.iBlock = instance.iBlock;
+		mergeFile.qwSourcePos = MPQGetBlockFilePos(lpArchives[instance.iArchive].hArchive, instance.iBlock);
+		mergeFile.iOrder = 0xFFFFFFFF;
+		mergeFile.bHot = false;
+
+		if (file.lpszName)
+		{
+			mergeFile.dwIndexHash = MPQHashString(file.lpszName, MPQ_HASH_TABLE_INDEX);
+			mergeFile.nIndexHashEntries = 0;
+		}
+		else
+		{
+			// Any copy of the file will do; the one in the largest hash table allows the largest new one
+			bool bIndexHashKnown = false;
+			for (uint32_t iInstance = file.iFirstInstance; iInstance < file.iFirstInstance + file.nInstances; iInstance++)
+			{
+				uint32_t dwIndexHash, nIndexHashEntries;
+				if (GetUnnamedIndexHash(lpArchives[lpInstances[iInstance].iArchive].hArchive, lpInstances[iInstance].iHashEntry, dwIndexHash, nIndexHashEntries)
+					&& (!bIndexHashKnown || nIndexHashEntries > mergeFile.nIndexHashEntries))
+				{
+					mergeFile.dwIndexHash = dwIndexHash;
+					mergeFile.nIndexHashEntries = nIndexHashEntries;
+					bIndexHashKnown = true;
+				}
+			}
+
+			if (!bIndexHashKnown)
+			{
+				result.iFailedFile = iFile;
+				if (lpResult)
+					*lpResult = result;
+
+				return MPQ_ERROR_UNKNOWN_NAME;
+			}
+
+			if (mergeFile.nIndexHashEntries < nMaxHashTableEntries)
+			{
+				nMaxHashTableEntries = mergeFile.nIndexHashEntries;
+				iLimitingFile = iFile;
+			}
+		}
+
+		mergeFiles.push_back(mergeFile);
+	}
+
+	// Read the archives from start to end, rather than jumping around, unless there's an order to follow
+	std::sort(mergeFiles.begin(), mergeFiles.end());
+
+	if (lpOptions && lpOptions->lplpszFileOrder)
+		result.nOrderedFiles = OrderFiles(hOverlay, mergeFiles, lpOptions->lplpszFileOrder, lpOptions->nFileOrderNames);
+
+	if (lpOptions && (lpOptions->lpFileLoads || lpOptions->lpfReadSeconds))
+		ChooseHotFiles(hOverlay, mergeFiles, *lpOptions, result);
+
+	std::string listFile = BuildListFile(hOverlay, mergeFiles);
+	if (!listFile.empty())
+	{
+		MERGEFILE mergeFile;
+		memset(&mergeFile, 0, sizeof(mergeFile));
+
+		mergeFile.iFile = 0xFFFFFFFF;
+		mergeFile.dwIndexHash = listFileHashes.dwIndexHash;
+		mergeFile.iOrder = 0xFFFFFFFF;
+
+		mergeFiles.push_back(mergeFile);
+	}
+
+	result.nFiles = (uint32_t)mergeFiles.size();
+
+	// Leave a quarter of the hash table empty, so that searches for files stop quickly
+	uint32_t nHashTableEntries = lpOptions ? lpOptions->nHashTableEntries : 0;
+	if (!nHashTableEntries)
+	{
+		nHashTableEntries = MIN_HASH_TABLE_SIZE;
+		while (nHashTableEntries < 0x80000000 && nHashTableEntries - nHashTableEntries / 4 < result.nFiles)
+			nHashTableEntries *= 2;
+
+		// A fuller table is better than none, as long as there's an empty entry left
+		if (nHashTableEntries > nMaxHashTableEntries && nMaxHashTableEntries > result.nFiles)
+			nHashTableEntries = nMaxHashTableEntries;
+	}
+	else if ((nHashTableEntries & (nHashTableEntries - 1)) || nHashTableEntries <= result.nFiles)
+		return MPQ_ERROR_INVALID_OPTION;
+
+	if (nHashTableEntries > nMaxHashTableEntries || nHashTableEntries <= result.nFiles)
+	{
+		result.iFailedFile = iLimitingFile;
+		if (lpResult)
+			*lpResult = result;
+
+		return MPQ_ERROR_UNKNOWN_NAME;
+	}
+
+	uint32_t cbSectorSize = lpOptions ? lpOptions->cbSectorSize : 0;
+	if (!cbSectorSize)
+		cbSectorSize = ChooseSectorSize(hOverlay, mergeFiles);
+	else if ((cbSectorSize & (cbSectorSize - 1)) || cbSectorSize < MPQ_BASE_SECTOR_SIZE || cbSectorSize > ((uint32_t)MPQ_BASE_SECTOR_SIZE << MPQ_MAX_SECTOR_SIZE_SHIFT))
+		return MPQ_ERROR_INVALID_OPTION;
+
+	result.cbSectorSize = cbSectorSize;
+	result.nHashTableEntries = nHashTableEntries;
+
+	// Write to a temporary file, so that a failure doesn't destroy an archive that was already there
+	std::string tempFileName = std::string(lpszOutputFileName) + ".tmp";
+
+	MERGEWRITER writer;
+	writer.lpFile = fopen(tempFileName.c_str(), "wb");
+	writer.qwPos = 0;
+	writer.cbSectorSize = cbSectorSize;
+
+	if (!writer.lpFile)
+		return MPQ_ERROR_WRITE_FAILED;
+
+	// Leave room for the header, which is written last
+	static const uint8_t s_byBlankHeader[MPQ_HEADER_SIZE_V1] = { 0 };
+	MPQERROR error = WriteData(writer, s_byBlankHeader, sizeof(s_byBlankHeader));
+
+	// Compressing is most of the work of merging files whose sectors change, so it's done for all of them at once, on several threads
+	std::vector<RECOMPRESSEDFILE> recompressedFiles(mergeFiles.size());
+	std::vector<uint32_t> recompressMergeFiles;
+	for (uint32_t iMergeFile = 0; iMergeFile < mergeFiles.size(); iMergeFile++)
+	{
+		const MERGEFILE &mergeFile = mergeFiles[iMergeFile];
+
+		recompressedFiles[iMergeFile].lpbyData = NULL;
+		recompressedFiles[iMergeFile].cbData = 0;
+		recompressedFiles[iMergeFile].error = MPQ_ERROR_SUCCESS;
+
+		if (mergeFile.iFile != 0xFFFFFFFF && !mergeFile.bHot
+			&& NeedsRecompressing(lpArchives[mergeFile.iArchive].hArchive, MPQGetBlockTable(lpArchives[mergeFile.iArchive].hArchive, NULL)[mergeFile.iBlock], cbSectorSize))
+			recompressMergeFiles.push_back(iMergeFile);
+	}
+
+	MPQParallelFor((uint32_t)recompressMergeFiles.size(), lpOptions ? lpOptions->nThreads : 0, [&](uint32_t iRecompressFile)
+	{
+		const MERGEFILE &mergeFile = mergeFiles[recompressMergeFiles[iRecompressFile]];
+		RECOMPRESSEDFILE &recompressedFile = recompressedFiles[recompressMergeFiles[iRecompressFile]];
+
+		recompressedFile.error = RecompressFile(lpArchives[mergeFile.iArchive].hArchive, mergeFile.iBlock, lpFiles[mergeFile.iFile].lpszName, cbSectorSize, recompressedFile);
+	});
+
+	std::vector<MPQHASHENTRY> mergeHashEntries;
+	std::vector<MPQBLOCKENTRY> blockTable;
+
+	for (uint32_t iMergeFile = 0; iMergeFile < mergeFiles.size() && error == MPQ_ERROR_SUCCESS; iMergeFile++)
+	{
+		const MERGEFILE &mergeFile = mergeFiles[iMergeFile];
+
+		MPQHASHENTRY hashEntry;
+		MPQBLOCKENTRY newBlock;
+		memset(&hashEntry, 0, sizeof(hashEntry));
+
+		if (mergeFile.iFile == 0xFFFFFFFF)
+		{
+			hashEntry.dwNameHashA = listFileHashes.dwNameHashA;
+			hashEntry.dwNameHashB = listFileHashes.dwNameHashB;
+			hashEntry.wLocale = MPQ_LOCALE_NEUTRAL;
+
+			newBlock.dwFilePos = (uint32_t)writer.qwPos;
+			newBlock.cbCompressedSize = newBlock.cbFileSize = (uint32_t)listFile.size();
+			newBlock.grfFlags = MPQ_FILE_EXISTS;
+
+			error = WriteData(writer, listFile.data(), listFile.size());
+		}
+		else
+		{
+			const MPQOVERLAYFILE &file = lpFiles[mergeFile.iFile];
+
+			hashEntry.dwNameHashA = file.dwNameHashA;
+			hashEntry.dwNameHashB = file.dwNameHashB;
+			hashEntry.wLocale = file.wLocale;
+
+			COPYMETHOD method;
+			error = CopyMergeFile(writer, lpArchives[mergeFile.iArchive].hArchive, mergeFile.iBlock, file.lpszName, mergeFile.bHot, recompressedFiles[iMergeFile], newBlock, method);
+
+			if (error != MPQ_ERROR_SUCCESS)
+				result.iFailedFile = mergeFile.iFile;
+			else if (method == COPY_VERBATIM)
+				result.nCopiedFiles++;
+			else if (method == COPY_REKEYED)
+				result.nRekeyedFiles++;
+			else if (method == COPY_RECOMPRESSED)
+				result.nRecompressedFiles++;
+		}
+
+		mergeHashEntries.push_back(hashEntry);
+		blockTable.push_back(newBlock);
+	}
+
+	// Files after one that failed were never written
+	for (RECOMPRESSEDFILE &recompressedFile : recompressedFiles)
+		delete [] recompressedFile.lpbyData;
+
+	if (error == MPQ_ERROR_SUCCESS)
+		error = WriteTables(writer, mergeFiles, mergeHashEntries, blockTable, nHashTableEntries);
+
+	result.cbArchiveSize = writer.qwPos;
+
+	if (fclose(writer.lpFile) && error == MPQ_ERROR_SUCCESS)
+		error = MPQ_ERROR_WRITE_FAILED;
+
+	// rename won't replace an existing file everywhere
+	if (error == MPQ_ERROR_SUCCESS)
+	{
+		remove(lpszOutputFileName);
+		if (rename(tempFileName.c_str(), lpszOutputFileName))
+			error = MPQ_ERROR_WRITE_FAILED;
+	}
+
+	if (error != MPQ_ERROR_SUCCESS)
+		remove(tempFileName.c_str());
+
+	if (lpResult)
+		*lpResult = result;
+
+	return error;
+}
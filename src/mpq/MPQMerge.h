@@ -0,0 +1,101 @@
+/*
+	The contents of this file are subject to the Common Development and Distribution License Version 1.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at http://www.sun.com/cddl/cddl.html.
+
+	Software distributed under the License is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for the specific language governing rights and limitations under the License.
+
+	The Initial Developer of the Original Code is Justin Olbrantz. The Original Code Copyright (C) 2007 Justin Olbrantz. All Rights Reserved.
+*/
+
+// Prevent this header from being included multiple times
+#ifndef MPQMERGE_H
+#define MPQMERGE_H
+
+#include <stdint.h>
+#include "MPQOverlay.h"
+
+/*
+	MPQMerge collapses a list of patch MPQs into a single archive which gives the game the same files: for each file, the copy the game would read from the list. Loading one archive instead of several saves Storm a hash table search in each archive for every file it looks up, and gets around the limit on the number of patch MPQs.
+	File data is copied as it is wherever possible, without decompressing it. Encrypted files whose key depends on their position (MPQ_FILE_FIX_KEY) are decrypted and encrypted again for their new position, which requires their names. Compressed files from archives with a different sector size than the merged archive can't be copied as they are; they are decompressed and compressed again in the new sector size, with the method they used before, which is the slowest part of merging and is done on several threads. This library's compressors aren't as thorough as the tools that build archives, so such files come out somewhat larger.
+	Files can also be laid out in the order the game reads them, and files the game loads often can be stored uncompressed, which needs only decompression.
+	Files are placed in the new hash table by the hash of their name. Where the name isn't known, the hash is worked out from where the file is in its original hash table, which is only possible if it wasn't moved by a collision, and the new hash table is no larger than the original.
+	The merged archive is in the original format, which is the only one the games MPQDraft patches can read. (listfile) is rebuilt from the names known; (attributes) and (signature) are left out, as they would no longer match.
+*/
+
+// How many times the game loads a file, for MPQMERGEOPTIONS::lpFileLoads
+struct MPQFILELOADS
+{
+	const char *lpszName;
+	uint32_t nLoads;
+	// How much of the file each load reads, from its start, or 0 for all of it. Only used to choose a sector size (MPQEstimateSectorSizes).
+	uint32_t cbLoadSize;
+};
+
+// Options for MPQMergeArchives
+struct MPQMERGEOPTIONS
+{
+	// The sector size of the merged archive, or 0 to use the one most of the data already has
+	uint32_t cbSectorSize;
+	// The number of threads to compress files on, when the sector size changes, or 0 for one for each processor
+	uint32_t nThreads;
+	// The size of the merged archive's hash table, or 0 to choose one which leaves room to spare
+	uint32_t nHashTableEntries;
+
+	// Names of files to put first, in the order given, such as a trace of the files a game opens (MPQD_TRACE_ACCESS). Reading files in the order they're laid out turns a game's loading into one mostly sequential read. Names given more than once are placed where they first appear, and names of files that aren't in the archives are ignored. The other files follow in the order they were in. May be NULL.
+	const char *const *lplpszFileOrder;
+	uint32_t nFileOrderNames;
+
+	// How many times the game loads each file, such as a profile of a game session. Compressed files which are loaded often are stored uncompressed, so that Storm doesn't decompress them every time: those which save the most decompression for each byte they add to the archive, until they add cbHotFileBudget bytes. Files larger than cbMaxHotFileSize (if not 0), and encrypted files whose names aren't known, are left as they are. Names given more than once have their loads added up. May be NULL.
+	const MPQFILELOADS *lpFileLoads;
+	uint32_t nFileLoads;
+	uint64_t cbHotFileBudget;
+	uint32_t cbMaxHotFileSize;
+
+	// How long each file takes to read, in the order of MPQGetOverlayFiles, such as measured by MPQMeasureDecoding, or negative if it couldn't be measured. If given, files are weighed by the time it takes to read them rather than their size, and if lpFileLoads is NULL, every file is taken to be loaded once. May be NULL.
+	const double *lpfReadSeconds;
+	// If not 0, no more files are stored uncompressed once reading the files loaded takes no more than this many seconds. Only used with lpfReadSeconds.
+	double fReadSecondsBudget;
+};
+
+// The result of MPQMergeArchives
+struct MPQMERGERESULT
+{
+	uint32_t nFiles;
+	// Files copied as they were, encrypted again for their new position, and compressed again because of a different sector size
+	uint32_t nCopiedFiles;
+	uint32_t nRekeyedFiles;
+	uint32_t nRecompressedFiles;
+	// Files which couldn't be carried over: (attributes) and (signature)
+	uint32_t nDroppedFiles;
+	// Files placed in the order given by MPQMERGEOPTIONS::lplpszFileOrder
+	uint32_t nOrderedFiles;
+	// Files stored uncompressed because of MPQMERGEOPTIONS::lpFileLoads, and the bytes that added to the archive
+	uint32_t nHotFiles;
+	uint64_t cbHotFileGrowth;
+	// With MPQMERGEOPTIONS::lpfReadSeconds, the time it takes to read the files loaded, and the time saved by not decompressing the files stored uncompressed
+	double fReadSeconds;
+	double fSavedReadSeconds;
+
+	uint32_t cbSectorSize;
+	uint32_t nHashTableEntries;
+	uint64_t cbArchiveSize;
+
+	// If merging failed because of a file, the index of the file in MPQGetOverlayFiles; otherwise 0xFFFFFFFF
+	uint32_t iFailedFile;
+};
+
+/*
+	* MPQMergeArchives *
+	Writes an archive containing the files of an overlay which the game would read. The output must not be one of the overlay's archives.
+*/
+MPQERROR MPQMergeArchives(
+	// The archives to merge, with any names known added
+	HMPQOVERLAY hOverlay,
+	// The file to write the merged archive to. It's written to a temporary file next to it first, and replaced only if merging succeeds.
+	const char *lpszOutputFileName,
+	// Options. May be NULL for the defaults.
+	const MPQMERGEOPTIONS *lpOptions,
+	// The result. May be NULL.
+	MPQMERGERESULT *lpResult
+);
+
+#endif // #ifndef MPQMERGE_H
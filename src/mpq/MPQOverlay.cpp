@@ -0,0 +1,296 @@
+/*
+	The contents of this file are subject to the Common Development and Distribution License Version 1.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at http://www.sun.com/cddl/cddl.html.
+
+	Software distributed under the License is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for the specific language governing rights and limitations under the License.
+
+	The Initial Developer of the Original Code is Justin Olbrantz. The Original Code Copyright (C) 2007 Justin Olbrantz. All Rights Reserved.
+*/
+
+#include "MPQOverlay.h"
+#include "MPQCrypt.h"
+#include "MPQFile.h"
+#include <string.h>
+#include <deque>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// List files larger than this are assumed to be corrupt, rather than allocating whatever the block table says
+#define MAX_LISTFILE_SIZE 0x4000000
+
+// Identifies a file across archives: both name hashes and the locale
+struct OVERLAYFILEKEY
+{
+	uint64_t qwNameHashes;
+	uint16_t wLocale;
+
+	bool operator==(const OVERLAYFILEKEY &key) const
+	{ return qwNameHashes == key.qwNameHashes && wLocale == key.wLocale; }
+};
+
+struct OVERLAYFILEKEYHASH
+{
+	// The name hashes are already well distributed
+	size_t operator()(const OVERLAYFILEKEY &key) const
+	{ return (size_t)(key.qwNameHashes ^ (key.qwNameHashes >> 32) ^ ((uint64_t)key.wLocale << 16)); }
+};
+
+static inline uint64_t CombineNameHashes(uint32_t dwNameHashA, uint32_t dwNameHashB)
+{
+	return ((uint64_t)dwNameHashA << 32) | dwNameHashB;
+}
+
+struct MPQOVERLAY
+{
+	MPQOVERLAYINFO info;
+
+	std::vector<MPQOVERLAYARCHIVE> archives;
+	std::vector<MPQOVERLAYFILE> files;
+	std::vector<MPQOVERLAYINSTANCE> instances;
+
+	// The files with each name, in all locales, for matching up names
+	std::unordered_map<uint64_t, std::vector<uint32_t> > filesByName;
+	// The names given to files. A deque, so that adding names doesn't move the ones already given out.
+	std::deque<std::string> names;
+};
+
+// Goes through the archives from the highest priority to the lowest, and collects the copies of each file
+static void IndexFiles(MPQOVERLAY &overlay)
+{
+	std::unordered_map<OVERLAYFILEKEY, uint32_t, OVERLAYFILEKEYHASH> fileIndices;
+	std::vector<std::vector<MPQOVERLAYINSTANCE> > fileInstances;
+
+	for (uint32_t iArchive = (uint32_t)overlay.archives.size(); iArchive-- > 0; )
+	{
+		MPQOVERLAYARCHIVE &archive = overlay.archives[iArchive];
+
+		uint32_t nHashEntries, nBlocks;
+		const MPQHASHENTRY *lpHashTable = MPQGetHashTable(archive.hArchive, &nHashEntries);
+		const MPQBLOCKENTRY *lpBlockTable = MPQGetBlockTable(archive.hArchive, &nBlocks);
+
+		for (uint32_t iHashEntry = 0; iHashEntry < nHashEntries; iHashEntry++)
+		{
+			const MPQHASHENTRY &hashEntry = lpHashTable[iHashEntry];
+
+			// This also skips empty and deleted entries
+			if (hashEntry.dwBlockIndex >= nBlocks)
+				continue;
+
+			OVERLAYFILEKEY key = { CombineNameHashes(hashEntry.dwNameHashA, hashEntry.dwNameHashB), hashEntry.wLocale };
+			std::pair<std::unordered_map<OVERLAYFILEKEY, uint32_t, OVERLAYFILEKEYHASH>::iterator, bool> insertResult
+				= fileIndices.insert(std::make_pair(key, (uint32_t)overlay.files.size()));
+
+			if (insertResult.second)
+			{
+				MPQOVERLAYFILE file;
+				memset(&file, 0, sizeof(file));
+
+				file.dwNameHashA = hashEntry.dwNameHashA;
+				file.dwNameHashB = hashEntry.dwNameHashB;
+				file.wLocale = hashEntry.wLocale;
+
+				overlay.filesByName[key.qwNameHashes].push_back((uint32_t)overlay.files.size());
+				overlay.files.push_back(file);
+				fileInstances.push_back(std::vector<MPQOVERLAYINSTANCE>());
+			}
+
+			MPQOVERLAYINSTANCE instance = { iArchive, iHashEntry, hashEntry.dwBlockIndex, lpBlockTable[hashEntry.dwBlockIndex].cbCompressedSize };
+			fileInstances[insertResult.first->second].push_back(instance);
+
+			archive.nFiles++;
+		}
+	}
+
+	// Lay the copies of each file out one after the other, and add up what's wasted
+	MPQOVERLAYINFO &info = overlay.info;
+	for (uint32_t iFile = 0; iFile < overlay.files.size(); iFile++)
+	{
+		MPQOVERLAYFILE &file = overlay.files[iFile];
+		const std::vector<MPQOVERLAYINSTANCE> &instances = fileInstances[iFile];
+
+		file.iFirstInstance = (uint32_t)overlay.instances.size();
+		file.nInstances = (uint32_t)instances.size();
+		overlay.instances.insert(overlay.instances.end(), instances.begin(), instances.end());
+
+		// A locale-specific file is hidden if the locale neutral copy of its name is read from a higher priority archive than it is
+		if (file.wLocale != MPQ_LOCALE_NEUTRAL)
+		{
+			for (uint32_t iNameFile : overlay.filesByName[CombineNameHashes(file.dwNameHashA, file.dwNameHashB)])
+			{
+				if (overlay.files[iNameFile].wLocale == MPQ_LOCALE_NEUTRAL && fileInstances[iNameFile][0].iArchive > instances[0].iArchive)
+					file.bHidden = true;
+			}
+		}
+
+		if (file.bHidden)
+			info.nHiddenFiles++;
+		else
+			overlay.archives[instances[0].iArchive].nWinningFiles++;
+
+		for (uint32_t iInstance = file.bHidden ? 0 : 1; iInstance < instances.size(); iInstance++)
+		{
+			MPQOVERLAYARCHIVE &archive = overlay.archives[instances[iInstance].iArchive];
+
+			archive.nShadowedFiles++;
+			archive.cbShadowedBytes += instances[iInstance].cbCompressedSize;
+			file.cbShadowedBytes += instances[iInstance].cbCompressedSize;
+		}
+
+		if (file.nInstances > 1 || file.bHidden)
+		{
+			info.nShadowedFiles++;
+			info.cbShadowedBytes += file.cbShadowedBytes;
+		}
+	}
+
+	info.nFiles = (uint32_t)overlay.files.size();
+}
+
+// Adds the names in an archive's list file. Archives without one, or with one that can't be read, are skipped.
+static void ReadListFile(MPQOVERLAY &overlay, HMPQARCHIVE hArchive)
+{
+	uint32_t iHashEntry, nBlocks;
+	if (MPQFindFile(hArchive, MPQ_LISTFILE_NAME, MPQ_LOCALE_NEUTRAL, &iHashEntry) != MPQ_ERROR_SUCCESS)
+		return;
+
+	uint32_t iBlock = MPQGetHashTable(hArchive, NULL)[iHashEntry].dwBlockIndex;
+	const MPQBLOCKENTRY *lpBlockTable = MPQGetBlockTable(hArchive, &nBlocks);
+	if (iBlock >= nBlocks || lpBlockTable[iBlock].cbFileSize > MAX_LISTFILE_SIZE)
+		return;
+
+	uint32_t cbListFile = lpBlockTable[iBlock].cbFileSize;
+	char *lpszListFile = new (std::nothrow) char[cbListFile ? cbListFile : 1];
+	if (!lpszListFile)
+		return;
+
+	if (MPQReadFile(hArchive, iBlock, MPQ_LISTFILE_NAME, lpszListFile) == MPQ_ERROR_SUCCESS)
+		MPQAddOverlayNames(&overlay, lpszListFile, cbListFile);
+
+	delete [] lpszListFile;
+}
+
+MPQERROR MPQCreateOverlay(const char *const *lplpszArchives, uint32_t nArchives, uint32_t grfFlags, HMPQOVERLAY *lphOverlay, uint32_t *lpiFailedArchive)
+{
+	*lphOverlay = NULL;
+
+	MPQOVERLAY *lpOverlay = new (std::nothrow) MPQOVERLAY;
+	if (!lpOverlay)
+		return MPQ_ERROR_NO_MEMORY;
+
+	memset(&lpOverlay->info, 0, sizeof(lpOverlay->info));
+	lpOverlay->info.nArchives = nArchives;
+
+	for (uint32_t iArchive = 0; iArchive < nArchives; iArchive++)
+	{
+		MPQOVERLAYARCHIVE archive;
+		memset(&archive, 0, sizeof(archive));
+
+		MPQERROR error = MPQOpenArchive(lplpszArchives[iArchive], &archive.hArchive);
+		if (error != MPQ_ERROR_SUCCESS)
+		{
+			if (lpiFailedArchive)
+				*lpiFailedArchive = iArchive;
+
+			MPQCloseOverlay(lpOverlay);
+			return error;
+		}
+
+		lpOverlay->archives.push_back(archive);
+	}
+
+	IndexFiles(*lpOverlay);
+
+	// The names of the files archives keep information about themselves in are always known
+	static const char s_szSpecialNames[] = MPQ_LISTFILE_NAME "\n(attributes)\n(signature)";
+	MPQAddOverlayNames(lpOverlay, s_szSpecialNames, sizeof(s_szSpecialNames) - 1);
+
+	if (grfFlags & MPQ_OVERLAY_READ_LISTFILES)
+	{
+		for (uint32_t iArchive = 0; iArchive < nArchives; iArchive++)
+			ReadListFile(*lpOverlay, lpOverlay->archives[iArchive].hArchive);
+	}
+
+	*lphOverlay = lpOverlay;
+
+	return MPQ_ERROR_SUCCESS;
+}
+
+void MPQCloseOverlay(HMPQOVERLAY hOverlay)
+{
+	if (!hOverlay)
+		return;
+
+	for (uint32_t iArchive = 0; iArchive < hOverlay->archives.size(); iArchive++)
+		MPQCloseArchive(hOverlay->archives[iArchive].hArchive);
+
+	delete hOverlay;
+}
+
+void MPQAddOverlayNames(HMPQOVERLAY hOverlay, const char *lpszNames, size_t cbNames)
+{
+	std::string name;
+
+	for (size_t iChar = 0; iChar <= cbNames; iChar++)
+	{
+		// Collect a name up to the next separator, or the end
+		char chCur = iChar < cbNames ? lpszNames[iChar] : '\n';
+		if (chCur != '\r' && chCur != '\n' && chCur != ';' && chCur != '\0')
+		{
+			name += chCur;
+			continue;
+		}
+
+		// Ignore spaces around names, which are left by hand editing
+		size_t iStart = name.find_first_not_of(" \t"), iEnd = name.find_last_not_of(" \t");
+		if (iStart == std::string::npos)
+		{
+			name.clear();
+			continue;
+		}
+
+		name = name.substr(iStart, iEnd - iStart + 1);
+
+		MPQNAMEHASHES hashes;
+		MPQHashName(name.c_str(), &hashes);
+
+		uint64_t qwNameHashes = CombineNameHashes(hashes.dwNameHashA, hashes.dwNameHashB);
+		std::unordered_map<uint64_t, std::vector<uint32_t> >::const_iterator itFiles = hOverlay->filesByName.find(qwNameHashes);
+
+		if (itFiles != hOverlay->filesByName.end() && !hOverlay->files[itFiles->second[0]].lpszName)
+		{
+			hOverlay->names.push_back(name);
+
+			for (uint32_t iFile : itFiles->second)
+			{
+				hOverlay->files[iFile].lpszName = hOverlay->names.back().c_str();
+				hOverlay->info.nNamedFiles++;
+			}
+		}
+
+		name.clear();
+	}
+}
+
+const MPQOVERLAYINFO *MPQGetOverlayInfo(HMPQOVERLAY hOverlay)
+{
+	return &hOverlay->info;
+}
+
+const MPQOVERLAYARCHIVE *MPQGetOverlayArchives(HMPQOVERLAY hOverlay)
+{
+	return hOverlay->archives.empty() ? NULL : &hOverlay->archives[0];
+}
+
+const MPQOVERLAYFILE *MPQGetOverlayFiles(HMPQOVERLAY hOverlay, uint32_t *lpnFiles)
+{
+	if (lpnFiles)
+		*lpnFiles = (uint32_t)hOverlay->files.size();
+
+	return hOverlay->files.empty() ? NULL : &hOverlay->files[0];
+}
+
+const MPQOVERLAYINSTANCE *MPQGetOverlayInstances(HMPQOVERLAY hOverlay)
+{
+	return hOverlay->instances.empty() ? NULL : &hOverlay->instances[0];
+}
@@ -0,0 +1,163 @@
+/*
+	The contents of this file are subject to the Common Development and Distribution License Version 1.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at http://www.sun.com/cddl/cddl.html.
+
+	Software distributed under the License is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for the specific language governing rights and limitations under the License.
+
+	The Initial Developer of the Original Code is Justin Olbrantz. The Original Code Copyright (C) 2007 Justin Olbrantz. All Rights Reserved.
+*/
+
+// Prevent this header from being included multiple times
+#ifndef MPQOVERLAY_H
+#define MPQOVERLAY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "MPQArchive.h"
+
+/*
+	MPQOverlay works out which of a list of patch MPQs each file is read from. The patcher opens the MPQs in the order given, each with a higher priority than the one before, so when several of them contain the same file, the game gets it from the last one in the list; the copies in the others are never read.
+	Archives don't store file names, only hashes of them, so files are identified by their two name hashes and their locale. That's enough to tell which copies are the same file without knowing any names. Names for reporting are taken from the (listfile) in each archive, and from any lists of names added with MPQAddOverlayNames.
+	Files are distinct for each locale, but locales don't simply override each other the way archives do. Storm looks a file up one archive at a time, from the highest priority down, and in each it takes the copy for the game's locale if there is one, and the locale neutral copy if not. So a locale neutral copy of a name hides the copies for every other locale in all lower priority archives, and those are never read (see MPQOVERLAYFILE::bHidden).
+*/
+
+// The handle to an overlay
+typedef struct MPQOVERLAY *HMPQOVERLAY;
+
+// Flags for MPQCreateOverlay
+#define MPQ_OVERLAY_READ_LISTFILES 0x1	// Read names from the (listfile) in each archive. Unreadable list files are skipped.
+
+// One copy of a file, in one of the archives
+struct MPQOVERLAYINSTANCE
+{
+	uint32_t iArchive;	// The index of the archive in the list given to MPQCreateOverlay
+	uint32_t iHashEntry;
+	uint32_t iBlock;
+	uint32_t cbCompressedSize;	// The size of the copy in the archive
+};
+
+// A file in one or more of the archives
+struct MPQOVERLAYFILE
+{
+	uint32_t dwNameHashA;
+	uint32_t dwNameHashB;
+	uint16_t wLocale;
+
+	// The name of the file, or NULL if it isn't known
+	const char *lpszName;
+
+	// The copies of the file in MPQGetOverlayInstances, starting with the one that is read and going down in priority
+	uint32_t iFirstInstance;
+	uint32_t nInstances;
+
+	// Whether the file is never read at all, because an archive of higher priority than any it's in has a locale neutral copy of the name, which Storm finds first in any locale. Only locale-specific files can be hidden. All their copies count as never read.
+	bool bHidden;
+
+	// The total size of the copies which are never read
+	uint64_t cbShadowedBytes;
+};
+
+// The statistics of one archive in an overlay
+struct MPQOVERLAYARCHIVE
+{
+	HMPQARCHIVE hArchive;
+
+	uint32_t nFiles;
+	// Files which are read from this archive
+	uint32_t nWinningFiles;
+	// Files which are never read from this archive, because a later archive has them, and the size of them
+	uint32_t nShadowedFiles;
+	uint64_t cbShadowedBytes;
+};
+
+// The totals for an overlay
+struct MPQOVERLAYINFO
+{
+	uint32_t nArchives;
+	// Different files in all the archives, and how many of those have names
+	uint32_t nFiles;
+	uint32_t nNamedFiles;
+	// Files in more than one archive or hidden, and the size of the copies which are never read
+	uint32_t nShadowedFiles;
+	uint64_t cbShadowedBytes;
+	// Locale-specific files hidden by locale neutral ones (see MPQOVERLAYFILE::bHidden)
+	uint32_t nHiddenFiles;
+};
+
+/*
+	* MPQCreateOverlay *
+	Opens a list of archives and works out which archive each file is read from. The archives stay open until the overlay is closed.
+*/
+MPQERROR MPQCreateOverlay(
+	// The archives, in the order they're given to the patcher: lowest priority first
+	const char *const *lplpszArchives,
+	// The number of archives
+	uint32_t nArchives,
+	// MPQ_OVERLAY_*
+	uint32_t grfFlags,
+	// The handle to the overlay
+	HMPQOVERLAY *lphOverlay,
+	// If an archive couldn't be opened, receives its index. May be NULL.
+	uint32_t *lpiFailedArchive
+);
+
+/*
+	* MPQCloseOverlay *
+	Closes an overlay and its archives.
+*/
+void MPQCloseOverlay(
+	// The overlay
+	HMPQOVERLAY hOverlay
+);
+
+/*
+	* MPQAddOverlayNames *
+	Adds names to identify the overlay's files with. Names that don't match any file are ignored.
+*/
+void MPQAddOverlayNames(
+	// The overlay
+	HMPQOVERLAY hOverlay,
+	// The names, separated by line breaks or semicolons, as in a (listfile)
+	const char *lpszNames,
+	// The length of the names, in bytes
+	size_t cbNames
+);
+
+/*
+	* MPQGetOverlayInfo *
+	Gets the totals for an overlay.
+*/
+const MPQOVERLAYINFO *MPQGetOverlayInfo(
+	// The overlay
+	HMPQOVERLAY hOverlay
+);
+
+/*
+	* MPQGetOverlayArchives *
+	Gets the statistics of each archive, in the order given to MPQCreateOverlay.
+*/
+const MPQOVERLAYARCHIVE *MPQGetOverlayArchives(
+	// The overlay
+	HMPQOVERLAY hOverlay
+);
+
+/*
+	* MPQGetOverlayFiles *
+	Gets the files in an overlay. Files are in the order they were found, from the highest priority archive to the lowest.
+*/
+const MPQOVERLAYFILE *MPQGetOverlayFiles(
+	// The overlay
+	HMPQOVERLAY hOverlay,
+	// The number of files. May be NULL.
+	uint32_t *lpnFiles
+);
+
+/*
+	* MPQGetOverlayInstances *
+	Gets the copies of the files in an overlay, which MPQOVERLAYFILE::iFirstInstance refers to.
+*/
+const MPQOVERLAYINSTANCE *MPQGetOverlayInstances(
+	// The overlay
+	HMPQOVERLAY hOverlay
+);
+
+#endif // #ifndef MPQOVERLAY_H
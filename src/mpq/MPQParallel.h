@@ -0,0 +1,70 @@
+/*
+	The contents of this file are subject to the Common Development and Distribution License Version 1.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at http://www.sun.com/cddl/cddl.html.
+
+	Software distributed under the License is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for the specific language governing rights and limitations under the License.
+
+	The Initial Developer of the Original Code is Justin Olbrantz. The Original Code Copyright (C) 2007 Justin Olbrantz. All Rights Reserved.
+*/
+
+// Prevent this header from being included multiple times
+#ifndef MPQPARALLEL_H
+#define MPQPARALLEL_H
+
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+/*
+	A simple work pool for the MPQ library's own use, for work which is done separately for each file. Archives are memory mapped and read only, so threads can read files from them at the same time without locking.
+*/
+
+/*
+	* MPQGetThreadCount *
+	Gets the number of threads to use: the number asked for, or one for each processor if 0.
+*/
+inline uint32_t MPQGetThreadCount(uint32_t nThreads)
+{
+	if (!nThreads)
+		nThreads = std::thread::hardware_concurrency();
+
+	return nThreads ? nThreads : 1;
+}
+
+/*
+	* MPQParallelFor *
+	Calls a function once for each item, on up to nThreads threads (0 for one for each processor), and returns when all have been done. Items are handed out in order as threads become free, so items which take longer don't hold the others up. The function is called as func(iItem), and must not throw.
+*/
+template <typename FUNC>
+void MPQParallelFor(
+	// The number of items
+	uint32_t nItems,
+	// The number of threads to use, or 0
+	uint32_t nThreads,
+	// The function to call for each item
+	FUNC func
+)
+{
+	nThreads = MPQGetThreadCount(nThreads);
+	if (nThreads > nItems)
+		nThreads = nItems;
+
+	std::atomic<uint32_t> iNextItem(0);
+	auto work = [&]()
+	{
+		for (uint32_t iItem = iNextItem++; iItem < nItems; iItem = iNextItem++)
+			func(iItem);
+	};
+
+	// The calling thread is one of the threads
+	std::vector<std::thread> threads;
+	for (uint32_t iThread = 1; iThread < nThreads; iThread++)
+		threads.push_back(std::thread(work));
+
+	work();
+
+	for (std::thread &thread : threads)
+		thread.join();
+}
+
+#endif // #ifndef MPQPARALLEL_H
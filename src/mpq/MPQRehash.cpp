@@ -0,0 +1,442 @@
+/*
+	The contents of this file are subject to the Common Development and Distribution License Version 1.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at http://www.sun.com/cddl/cddl.html.
+
+	Software distributed under the License is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for the specific language governing rights and limitations under the License.
+
+	The Initial Developer of the Original Code is Justin Olbrantz. The Original Code Copyright (C) 2007 Justin Olbrantz. All Rights Reserved.
+*/
+
+#include "MPQRehash.h"
+#include "MPQCrypt.h"
+#include "MPQFile.h"
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#endif
+
+// The smallest hash table to create, so that small archives have room to have files added by other tools
+#define MIN_HASH_TABLE_SIZE 16
+
+// With a quarter of the table used, nearly all searches end within two entries
+#define DEFAULT_MAX_LOAD_PERCENT 25
+
+// Lookups are timed by going through all the names until this much time has passed
+#define MIN_MEASURE_LOOKUP_SECONDS 0.01
+
+// Added to names to look up files that aren't there
+#define MISSING_NAME_SUFFIX ".missing"
+
+// The largest table position and archive size the original format can hold
+#define MAX_ARCHIVE_SIZE 0xFFFFFFFFULL
+
+// Gets the name of the file in each entry of an archive's hash table, or NULL where it isn't known
+static void GetHashEntryNames(HMPQOVERLAY hOverlay, uint32_t iArchive, std::vector<const char *> &names)
+{
+	uint32_t nHashEntries, nFiles;
+	MPQGetHashTable(MPQGetOverlayArchives(hOverlay)[iArchive].hArchive, &nHashEntries);
+	names.assign(nHashEntries, NULL);
+
+	const MPQOVERLAYFILE *lpFiles = MPQGetOverlayFiles(hOverlay, &nFiles);
+	const MPQOVERLAYINSTANCE *lpInstances = MPQGetOverlayInstances(hOverlay);
+
+	for (uint32_t iFile = 0; iFile < nFiles; iFile++)
+	{
+		const MPQOVERLAYFILE &file = lpFiles[iFile];
+		if (!file.lpszName)
+			continue;
+
+		for (uint32_t iInstance = file.iFirstInstance; iInstance < file.iFirstInstance + file.nInstances; iInstance++)
+		{
+			if (lpInstances[iInstance].iArchive == iArchive)
+				names[lpInstances[iInstance].iHashEntry] = file.lpszName;
+		}
+	}
+}
+
+/*
+	Works out the hash of the name of the file in an entry, which gives the entry searches for it start at. Without the name, only the low bits of it are known, from the entry the file is in, and only if a collision didn't push it along; it can only be sure one didn't if the entry before it has never been used. nIndexHashEntries receives the size of the table the low bits are known for, or 0 if the whole hash is known.
+*/
+static bool GetIndexHash(const MPQHASHENTRY *lpHashTable, uint32_t nHashEntries, uint32_t iHashEntry, const char *lpszName,
+	uint32_t &dwIndexHash, uint32_t &nIndexHashEntries)
+{
+	if (lpszName)
+	{
+		MPQNAMEHASHES hashes;
+		MPQHashName(lpszName, &hashes);
+
+		dwIndexHash = hashes.dwIndexHash;
+		nIndexHashEntries = 0;
+
+		return true;
+	}
+
+	if (nHashEntries > 1 && lpHashTable[(iHashEntry - 1) & (nHashEntries - 1)].dwBlockIndex != MPQ_HASH_ENTRY_EMPTY)
+		return false;
+
+	dwIndexHash = iHashEntry;
+	nIndexHashEntries = nHashEntries;
+
+	return true;
+}
+
+static inline void CountProbes(uint32_t nProbes, uint32_t *lpnHistogram, uint64_t &nTotalProbes, uint32_t &nMaxProbes)
+{
+	lpnHistogram[nProbes < MPQ_PROBE_HISTOGRAM_SIZE ? nProbes - 1 : MPQ_PROBE_HISTOGRAM_SIZE - 1]++;
+	nTotalProbes += nProbes;
+	if (nProbes > nMaxProbes)
+		nMaxProbes = nProbes;
+}
+
+void MPQGetHashTableStats(HMPQOVERLAY hOverlay, uint32_t iArchive, MPQHASHSTATS *lpStats)
+{
+	memset(lpStats, 0, sizeof(*lpStats));
+
+	HMPQARCHIVE hArchive = MPQGetOverlayArchives(hOverlay)[iArchive].hArchive;
+	uint32_t nHashEntries, nBlocks;
+	const MPQHASHENTRY *lpHashTable = MPQGetHashTable(hArchive, &nHashEntries);
+	MPQGetBlockTable(hArchive, &nBlocks);
+
+	std::vector<const char *> names;
+	GetHashEntryNames(hOverlay, iArchive, names);
+
+	lpStats->nHashTableEntries = nHashEntries;
+
+	for (uint32_t iHashEntry = 0; iHashEntry < nHashEntries; iHashEntry++)
+	{
+		const MPQHASHENTRY &hashEntry = lpHashTable[iHashEntry];
+
+		if (hashEntry.dwBlockIndex == MPQ_HASH_ENTRY_DELETED)
+			lpStats->nDeletedEntries++;
+
+		// This also skips empty and deleted entries
+		if (hashEntry.dwBlockIndex >= nBlocks)
+			continue;
+
+		lpStats->nFiles++;
+
+		uint32_t dwIndexHash, nIndexHashEntries;
+		if (!GetIndexHash(lpHashTable, nHashEntries, iHashEntry, names[iHashEntry], dwIndexHash, nIndexHashEntries))
+			continue;
+
+		lpStats->nMeasuredFiles++;
+		CountProbes(((iHashEntry - dwIndexHash) & (nHashEntries - 1)) + 1, lpStats->anHitProbes, lpStats->nTotalHitProbes, lpStats->nMaxHitProbes);
+	}
+
+	// A search for a file that isn't there ends at the first entry that has never been used, or after going through the whole table if there isn't one
+	uint32_t iEmptyEntry = 0;
+	while (iEmptyEntry < nHashEntries && lpHashTable[iEmptyEntry].dwBlockIndex != MPQ_HASH_ENTRY_EMPTY)
+		iEmptyEntry++;
+
+	if (iEmptyEntry == nHashEntries)
+	{
+		for (uint32_t iHashEntry = 0; iHashEntry < nHashEntries; iHashEntry++)
+			CountProbes(nHashEntries, lpStats->anMissProbes, lpStats->nTotalMissProbes, lpStats->nMaxMissProbes);
+
+		return;
+	}
+
+	// Going backwards from an unused entry, each search is one entry longer than the one starting after it
+	uint32_t nProbes = 0;
+	for (uint32_t iStep = 0; iStep < nHashEntries; iStep++)
+	{
+		uint32_t iHashEntry = (iEmptyEntry - iStep) & (nHashEntries - 1);
+
+		nProbes = lpHashTable[iHashEntry].dwBlockIndex == MPQ_HASH_ENTRY_EMPTY ? 1 : nProbes + 1;
+		CountProbes(nProbes, lpStats->anMissProbes, lpStats->nTotalMissProbes, lpStats->nMaxMissProbes);
+	}
+}
+
+// Times looking each of the names up, through the hash table or the HET table, and gets the average time of one lookup
+static double TimeLookups(HMPQARCHIVE hArchive, const std::vector<std::string> &names, bool bHETTable)
+{
+	if (names.empty())
+		return 0;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	double fElapsed = 0;
+	uint64_t nLookups = 0;
+	uint32_t nFound = 0;
+
+	do
+	{
+		for (size_t iName = 0; iName < names.size(); iName++)
+		{
+			uint32_t iHashEntry;
+			MPQERROR error;
+
+			if (bHETTable)
+				error = MPQFindFileByHETHash(hArchive, MPQHashNameHET(names[iName].c_str()), MPQ_LOCALE_NEUTRAL, &iHashEntry);
+			else
+			{
+				MPQNAMEHASHES hashes;
+				MPQHashName(names[iName].c_str(), &hashes);
+
+				error = MPQFindFileByHash(hArchive, hashes.dwIndexHash, hashes.dwNameHashA, hashes.dwNameHashB, MPQ_LOCALE_NEUTRAL, &iHashEntry);
+			}
+
+			if (error == MPQ_ERROR_SUCCESS)
+				nFound++;
+		}
+
+		nLookups += names.size();
+		fElapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	} while (fElapsed < MIN_MEASURE_LOOKUP_SECONDS);
+
+	// Keep the lookups from being optimized away
+	volatile uint32_t nTotalFound = nFound;
+	(void)nTotalFound;
+
+	return fElapsed / nLookups;
+}
+
+void MPQMeasureLookups(HMPQOVERLAY hOverlay, uint32_t iArchive, MPQLOOKUPTIMES *lpTimes)
+{
+	memset(lpTimes, 0, sizeof(*lpTimes));
+
+	HMPQARCHIVE hArchive = MPQGetOverlayArchives(hOverlay)[iArchive].hArchive;
+
+	std::vector<const char *> entryNames;
+	GetHashEntryNames(hOverlay, iArchive, entryNames);
+
+	std::vector<std::string> names, missingNames;
+	for (size_t iHashEntry = 0; iHashEntry < entryNames.size(); iHashEntry++)
+	{
+		if (!entryNames[iHashEntry])
+			continue;
+
+		names.push_back(entryNames[iHashEntry]);
+		missingNames.push_back(names.back() + MISSING_NAME_SUFFIX);
+	}
+
+	lpTimes->nNames = (uint32_t)names.size();
+
+	lpTimes->fHashTableHitSeconds = TimeLookups(hArchive, names, false);
+	lpTimes->fHashTableMissSeconds = TimeLookups(hArchive, missingNames, false);
+
+	if (MPQGetHETTable(hArchive))
+	{
+		lpTimes->fHETTableHitSeconds = TimeLookups(hArchive, names, true);
+		lpTimes->fHETTableMissSeconds = TimeLookups(hArchive, missingNames, true);
+	}
+}
+
+static inline bool RangesOverlap(uint64_t qwStart1, uint64_t cbSize1, uint64_t qwStart2, uint64_t cbSize2)
+{
+	return cbSize1 && cbSize2 && qwStart1 < qwStart2 + cbSize2 && qwStart2 < qwStart1 + cbSize1;
+}
+
+static bool WriteBytes(FILE *lpFile, const void *lpvData, uint64_t cbData)
+{
+	return !cbData || fwrite(lpvData, 1, (size_t)cbData, lpFile) == cbData;
+}
+
+// fseek takes a long, which is only 32 bits on Windows, and archives can be further into the file than that
+static bool SeekFile(FILE *lpFile, uint64_t qwFilePos)
+{
+#ifdef _WIN32
+	return !_fseeki64(lpFile, (int64_t)qwFilePos, SEEK_SET);
+#else
+	if ((uint64_t)(off_t)qwFilePos != qwFilePos || (off_t)qwFilePos < 0)
+		return false;
+
+	return !fseeko(lpFile, (off_t)qwFilePos, SEEK_SET);
+#endif
+}
+
+MPQERROR MPQRehashArchive(HMPQOVERLAY hOverlay, uint32_t iArchive, const char *lpszOutputFileName, const MPQREHASHOPTIONS *lpOptions, MPQREHASHRESULT *lpResult)
+{
+	MPQREHASHRESULT result;
+	memset(&result, 0, sizeof(result));
+	result.iFailedHashEntry = 0xFFFFFFFF;
+
+	if (lpResult)
+		*lpResult = result;
+
+	HMPQARCHIVE hArchive = MPQGetOverlayArchives(hOverlay)[iArchive].hArchive;
+	const MPQARCHIVEINFO *lpInfo = MPQGetArchiveInfo(hArchive);
+	const MPQHEADER *lpHeader = MPQGetArchiveHeader(hArchive);
+
+	if (lpInfo->bHETTable || lpInfo->bBETTable || lpInfo->cbHeaderSize >= MPQ_HEADER_SIZE_V4)
+		return MPQ_ERROR_UNSUPPORTED;
+
+	uint32_t nHashEntries, nBlocks;
+	const MPQHASHENTRY *lpHashTable = MPQGetHashTable(hArchive, &nHashEntries);
+	const MPQBLOCKENTRY *lpBlockTable = MPQGetBlockTable(hArchive, &nBlocks);
+
+	std::vector<const char *> names;
+	GetHashEntryNames(hOverlay, iArchive, names);
+
+	// Keep the entries referring to files, and work out where each one's search starts. The smallest table an unnamed file's hash is known for limits the size of the new one.
+	std::vector<MPQHASHENTRY> fileEntries;
+	std::vector<uint32_t> indexHashes;
+	uint32_t nMaxHashTableEntries = 0x80000000, iLimitingEntry = 0xFFFFFFFF;
+
+	for (uint32_t iHashEntry = 0; iHashEntry < nHashEntries; iHashEntry++)
+	{
+		const MPQHASHENTRY &hashEntry = lpHashTable[iHashEntry];
+
+		if (hashEntry.dwBlockIndex == MPQ_HASH_ENTRY_EMPTY)
+			continue;
+
+		if (hashEntry.dwBlockIndex >= nBlocks)
+		{
+			result.nDroppedEntries++;
+			continue;
+		}
+
+		uint32_t dwIndexHash, nIndexHashEntries;
+		if (!GetIndexHash(lpHashTable, nHashEntries, iHashEntry, names[iHashEntry], dwIndexHash, nIndexHashEntries))
+		{
+			result.iFailedHashEntry = iHashEntry;
+			if (lpResult)
+				*lpResult = result;
+
+			return MPQ_ERROR_UNKNOWN_NAME;
+		}
+
+		if (nIndexHashEntries && nIndexHashEntries < nMaxHashTableEntries)
+		{
+			nMaxHashTableEntries = nIndexHashEntries;
+			iLimitingEntry = iHashEntry;
+		}
+
+		fileEntries.push_back(hashEntry);
+		indexHashes.push_back(dwIndexHash);
+	}
+
+	result.nFiles = (uint32_t)fileEntries.size();
+
+	uint32_t nMaxLoadPercent = lpOptions && lpOptions->nMaxLoadPercent ? lpOptions->nMaxLoadPercent : DEFAULT_MAX_LOAD_PERCENT;
+	if (nMaxLoadPercent > 100)
+		return MPQ_ERROR_INVALID_OPTION;
+
+	uint32_t nNewHashEntries = lpOptions ? lpOptions->nHashTableEntries : 0;
+	if (!nNewHashEntries)
+	{
+		nNewHashEntries = MIN_HASH_TABLE_SIZE;
+		while (nNewHashEntries < 0x80000000 && (uint64_t)result.nFiles * 100 > (uint64_t)nNewHashEntries * nMaxLoadPercent)
+			nNewHashEntries *= 2;
+
+		// A fuller table is better than none, as long as there's an empty entry left
+		if (nNewHashEntries > nMaxHashTableEntries && nMaxHashTableEntries > result.nFiles)
+			nNewHashEntries = nMaxHashTableEntries;
+	}
+	else if ((nNewHashEntries & (nNewHashEntries - 1)) || nNewHashEntries <= result.nFiles)
+		return MPQ_ERROR_INVALID_OPTION;
+
+	if (nNewHashEntries > nMaxHashTableEntries || nNewHashEntries <= result.nFiles)
+	{
+		result.iFailedHashEntry = iLimitingEntry;
+		if (lpResult)
+			*lpResult = result;
+
+		return MPQ_ERROR_UNKNOWN_NAME;
+	}
+
+	result.nHashTableEntries = nNewHashEntries;
+
+	std::vector<MPQHASHENTRY> newHashTable(nNewHashEntries);
+	memset(&newHashTable[0], 0xFF, nNewHashEntries * sizeof(MPQHASHENTRY));
+
+	for (uint32_t iFileEntry = 0; iFileEntry < fileEntries.size(); iFileEntry++)
+	{
+		uint32_t iHashEntry = indexHashes[iFileEntry] & (nNewHashEntries - 1);
+		while (newHashTable[iHashEntry].dwBlockIndex != MPQ_HASH_ENTRY_EMPTY)
+			iHashEntry = (iHashEntry + 1) & (nNewHashEntries - 1);
+
+		newHashTable[iHashEntry] = fileEntries[iFileEntry];
+	}
+
+	MPQEncryptBlock(&newHashTable[0], newHashTable.size() * sizeof(MPQHASHENTRY), MPQ_HASH_TABLE_KEY);
+
+	// Everything else the archive uses, which the new table mustn't be written over. Positions are relative to the archive.
+	uint64_t qwFileSize;
+	const uint8_t *lpbyFileData = MPQGetFileData(hArchive, &qwFileSize);
+	uint64_t qwDataSize = qwFileSize - lpInfo->qwArchiveOffset;
+
+	uint64_t qwOldTablePos = lpHeader->dwHashTableOffset | ((uint64_t)lpHeader->wHashTableOffsetHigh << 32);
+	uint64_t cbOldTable = (uint64_t)nHashEntries * sizeof(MPQHASHENTRY), cbNewTable = (uint64_t)nNewHashEntries * sizeof(MPQHASHENTRY);
+
+	std::vector<std::pair<uint64_t, uint64_t> > usedRanges;
+	usedRanges.push_back(std::make_pair((uint64_t)0, (uint64_t)lpInfo->cbHeaderSize));
+	usedRanges.push_back(std::make_pair(lpHeader->dwBlockTableOffset | ((uint64_t)lpHeader->wBlockTableOffsetHigh << 32), (uint64_t)nBlocks * sizeof(MPQBLOCKENTRY)));
+	if (lpInfo->bHiBlockTable)
+		usedRanges.push_back(std::make_pair(lpHeader->qwHiBlockTableOffset, (uint64_t)nBlocks * sizeof(uint16_t)));
+	for (uint32_t iBlock = 0; iBlock < nBlocks; iBlock++)
+		usedRanges.push_back(std::make_pair(MPQGetBlockFilePos(hArchive, iBlock), (uint64_t)lpBlockTable[iBlock].cbCompressedSize));
+
+	uint64_t qwArchiveEnd = qwOldTablePos + cbOldTable;
+	bool bFitsInPlace = cbNewTable <= cbOldTable;
+
+	for (const std::pair<uint64_t, uint64_t> &range : usedRanges)
+	{
+		if (range.first + range.second > qwArchiveEnd)
+			qwArchiveEnd = range.first + range.second;
+		if (RangesOverlap(qwOldTablePos, cbNewTable, range.first, range.second))
+			bFitsInPlace = false;
+	}
+
+	// Anything past the end of the file is missing anyway
+	if (qwArchiveEnd > qwDataSize)
+		qwArchiveEnd = qwDataSize;
+
+	// Write the new table over the old one if it fits without overwriting anything else, or after everything else if not, moving anything after the archive along
+	uint64_t qwNewTablePos = bFitsInPlace ? qwOldTablePos : qwArchiveEnd;
+	if (qwNewTablePos + cbNewTable > MAX_ARCHIVE_SIZE)
+		return MPQ_ERROR_TOO_LARGE;
+
+	result.bTableAppended = !bFitsInPlace;
+
+	MPQHEADER header = *lpHeader;
+	header.dwHashTableOffset = (uint32_t)qwNewTablePos;
+	header.wHashTableOffsetHigh = 0;
+	header.nHashTableEntries = nNewHashEntries;
+	if (!bFitsInPlace)
+	{
+		header.dwArchiveSize = (uint32_t)(qwNewTablePos + cbNewTable);
+		header.qwArchiveSize = qwNewTablePos + cbNewTable;
+	}
+
+	// Write to a temporary file, so that a failure doesn't destroy an archive that was already there
+	std::string tempFileName = std::string(lpszOutputFileName) + ".tmp";
+
+	FILE *lpFile = fopen(tempFileName.c_str(), "wb");
+	if (!lpFile)
+		return MPQ_ERROR_WRITE_FAILED;
+
+	uint64_t qwTableFilePos = lpInfo->qwArchiveOffset + qwNewTablePos;
+	uint64_t qwRestFilePos = qwTableFilePos + (bFitsInPlace ? cbNewTable : 0);
+
+	MPQERROR error = MPQ_ERROR_SUCCESS;
+	if (!WriteBytes(lpFile, lpbyFileData, qwTableFilePos)
+		|| !WriteBytes(lpFile, &newHashTable[0], cbNewTable)
+		|| !WriteBytes(lpFile, lpbyFileData + qwRestFilePos, qwFileSize - qwRestFilePos)
+		|| !SeekFile(lpFile, lpInfo->qwArchiveOffset)
+		|| !WriteBytes(lpFile, &header, lpInfo->cbHeaderSize))
+		error = MPQ_ERROR_WRITE_FAILED;
+
+	if (fclose(lpFile) && error == MPQ_ERROR_SUCCESS)
+		error = MPQ_ERROR_WRITE_FAILED;
+
+	// rename won't replace an existing file everywhere
+	if (error == MPQ_ERROR_SUCCESS)
+	{
+		remove(lpszOutputFileName);
+		if (rename(tempFileName.c_str(), lpszOutputFileName))
+			error = MPQ_ERROR_WRITE_FAILED;
+	}
+
+	if (error != MPQ_ERROR_SUCCESS)
+		remove(tempFileName.c_str());
+
+	if (lpResult)
+		*lpResult = result;
+
+	return error;
+}
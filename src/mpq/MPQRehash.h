@@ -0,0 +1,124 @@
+/*
+	The contents of this file are subject to the Common Development and Distribution License Version 1.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at http://www.sun.com/cddl/cddl.html.
+
+	Software distributed under the License is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for the specific language governing rights and limitations under the License.
+
+	The Initial Developer of the Original Code is Justin Olbrantz. The Original Code Copyright (C) 2007 Justin Olbrantz. All Rights Reserved.
+*/
+
+// Prevent this header from being included multiple times
+#ifndef MPQREHASH_H
+#define MPQREHASH_H
+
+#include <stdint.h>
+#include "MPQOverlay.h"
+
+/*
+	MPQRehash measures how long Storm's searches of an archive's hash table are, and rebuilds the hash table with more room when they're long.
+	Storm looks a file up by starting at the entry given by the hash of its name, and going through the entries after it until it finds the file or an entry that has never been used. Every archive loaded with a higher priority is searched before the game's own archives, so every file the game loads is a search that fails in each patch MPQ that doesn't have it. In a table that's nearly full, both kinds of search go through long runs of entries; with a quarter of the table used, nearly all searches end at the first or second entry.
+	Rebuilding the hash table doesn't move any file data, so encrypted files don't need their names. Files are placed in the new table by the hash of their name; where the name isn't known, the hash is worked out from where the file is in the old table, as MPQMerge does, which only allows a table no larger than the old one.
+*/
+
+// Searches which look at this many entries or more are counted in the last element of the histograms
+#define MPQ_PROBE_HISTOGRAM_SIZE 8
+
+// The length of the searches of a hash table. Lengths are in entries looked at; a search that finds what it's looking for in the first entry has a length of 1.
+struct MPQHASHSTATS
+{
+	uint32_t nHashTableEntries;
+	uint32_t nFiles;
+	uint32_t nDeletedEntries;
+
+	// Searches for files that are there. Only files where it's known which entry the search starts at are counted: those with names, and those with an entry before them that has never been used.
+	uint32_t nMeasuredFiles;
+	uint64_t nTotalHitProbes;
+	uint32_t nMaxHitProbes;
+	uint32_t anHitProbes[MPQ_PROBE_HISTOGRAM_SIZE];
+
+	// Searches for files that aren't there, starting at each entry of the table in turn
+	uint64_t nTotalMissProbes;
+	uint32_t nMaxMissProbes;
+	uint32_t anMissProbes[MPQ_PROBE_HISTOGRAM_SIZE];
+};
+
+// How long looking files up in an archive takes, through the hash table and through the HET table (MPQMeasureLookups)
+struct MPQLOOKUPTIMES
+{
+	// The number of named files looked up. Files that aren't there are looked up by the same names with something added.
+	uint32_t nNames;
+
+	// The average time of one lookup, in seconds, including hashing the name, of a file that's there and of one that isn't
+	double fHashTableHitSeconds;
+	double fHashTableMissSeconds;
+	// The same through the HET table, or 0 if the archive has no usable HET table
+	double fHETTableHitSeconds;
+	double fHETTableMissSeconds;
+};
+
+// Options for MPQRehashArchive
+struct MPQREHASHOPTIONS
+{
+	// The size of the new hash table, or 0 to choose the smallest one that is no fuller than nMaxLoadPercent
+	uint32_t nHashTableEntries;
+	// How much of the new hash table may be used, in percent, or 0 for 25%
+	uint32_t nMaxLoadPercent;
+};
+
+// The result of MPQRehashArchive
+struct MPQREHASHRESULT
+{
+	uint32_t nFiles;
+	// Entries which were dropped: deleted files, and entries referring to blocks that don't exist
+	uint32_t nDroppedEntries;
+	uint32_t nHashTableEntries;
+	// Whether the new hash table was added at the end of the archive, rather than written over the old one
+	bool bTableAppended;
+
+	// If rehashing failed because of a file, the index of its entry in the old hash table; otherwise 0xFFFFFFFF
+	uint32_t iFailedHashEntry;
+};
+
+/*
+	* MPQGetHashTableStats *
+	Measures the searches of one of the archives in an overlay.
+*/
+void MPQGetHashTableStats(
+	// The overlay, with any names known added
+	HMPQOVERLAY hOverlay,
+	// The index of the archive in the overlay
+	uint32_t iArchive,
+	// The statistics
+	MPQHASHSTATS *lpStats
+);
+
+/*
+	* MPQMeasureLookups *
+	Times looking up the named files of one of the archives in an overlay, and the same names changed so that they aren't there, through the hash table and, if the archive has them, the HET and BET tables.
+*/
+void MPQMeasureLookups(
+	// The overlay, with any names known added
+	HMPQOVERLAY hOverlay,
+	// The index of the archive in the overlay
+	uint32_t iArchive,
+	// The times
+	MPQLOOKUPTIMES *lpTimes
+);
+
+/*
+	* MPQRehashArchive *
+	Writes a copy of one of the archives in an overlay with a new hash table. Everything else in the file is copied as it is, including anything before the archive. The output must not be the archive itself. Archives with HET and BET tables or a version 4 header are not supported, as those would have to be rebuilt too.
+*/
+MPQERROR MPQRehashArchive(
+	// The overlay, with any names known added
+	HMPQOVERLAY hOverlay,
+	// The index of the archive in the overlay
+	uint32_t iArchive,
+	// The file to write the new archive to. It's written to a temporary file next to it first, and replaced only if rehashing succeeds.
+	const char *lpszOutputFileName,
+	// Options. May be NULL for the defaults.
+	const MPQREHASHOPTIONS *lpOptions,
+	// The result. May be NULL.
+	MPQREHASHRESULT *lpResult
+);
+
+#endif // #ifndef MPQREHASH_H
@@ -0,0 +1,121 @@
+/*
+	The contents of this file are subject to the Common Development and Distribution License Version 1.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at http://www.sun.com/cddl/cddl.html.
+
+	Software distributed under the License is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for the specific language governing rights and limitations under the License.
+
+	The Initial Developer of the Original Code is Justin Olbrantz. The Original Code Copyright (C) 2007 Justin Olbrantz. All Rights Reserved.
+*/
+
+#include "MPQSectorSize.h"
+#include "MPQCrypt.h"
+#include <string.h>
+#include <unordered_map>
+
+// Rough figures for when the costs aren't given: a read of data the system already has cached, through Storm, and zlib decompressing at 100 MB/s
+#define DEFAULT_SECONDS_PER_READ 0.00001
+#define DEFAULT_SECONDS_PER_BYTE 0.00000001
+
+// The loads of a file, from the profile
+struct SECTORFILELOADS
+{
+	uint64_t nLoads;
+	// The most any load reads, or 0xFFFFFFFF for all of the file
+	uint32_t cbLoadSize;
+};
+
+uint32_t MPQEstimateSectorSizes(HMPQOVERLAY hOverlay, const MPQSECTORSIZEOPTIONS *lpOptions, MPQSECTORSIZECOST lpCosts[MPQ_MAX_SECTOR_SIZE_SHIFT + 1])
+{
+	MPQSECTORSIZEOPTIONS options;
+	memset(&options, 0, sizeof(options));
+	if (lpOptions)
+		options = *lpOptions;
+
+	if (!options.cbMaxSectorSize)
+		options.cbMaxSectorSize = MPQ_DEFAULT_MAX_SECTOR_SIZE;
+	if (options.fSecondsPerRead <= 0)
+		options.fSecondsPerRead = DEFAULT_SECONDS_PER_READ;
+	if (options.fSecondsPerByte <= 0)
+		options.fSecondsPerByte = DEFAULT_SECONDS_PER_BYTE;
+
+	// Files are matched by both name hashes, so the loads apply to all locales of a file. Names given more than once have their loads added up.
+	std::unordered_map<uint64_t, SECTORFILELOADS> nameLoads;
+	for (uint32_t iName = 0; iName < options.nFileLoads; iName++)
+	{
+		const MPQFILELOADS &fileLoads = options.lpFileLoads[iName];
+
+		MPQNAMEHASHES hashes;
+		MPQHashName(fileLoads.lpszName, &hashes);
+
+		SECTORFILELOADS &loads = nameLoads.insert(std::make_pair(((uint64_t)hashes.dwNameHashA << 32) | hashes.dwNameHashB, SECTORFILELOADS())).first->second;
+		uint32_t cbLoadSize = fileLoads.cbLoadSize ? fileLoads.cbLoadSize : 0xFFFFFFFF;
+
+		loads.cbLoadSize = loads.nLoads && loads.cbLoadSize > cbLoadSize ? loads.cbLoadSize : cbLoadSize;
+		loads.nLoads += fileLoads.nLoads;
+	}
+
+	for (uint32_t iShift = 0; iShift <= MPQ_MAX_SECTOR_SIZE_SHIFT; iShift++)
+	{
+		memset(&lpCosts[iShift], 0, sizeof(lpCosts[iShift]));
+		lpCosts[iShift].cbSectorSize = (uint32_t)MPQ_BASE_SECTOR_SIZE << iShift;
+	}
+
+	uint32_t nFiles;
+	const MPQOVERLAYFILE *lpFiles = MPQGetOverlayFiles(hOverlay, &nFiles);
+	const MPQOVERLAYINSTANCE *lpInstances = MPQGetOverlayInstances(hOverlay);
+	const MPQOVERLAYARCHIVE *lpArchives = MPQGetOverlayArchives(hOverlay);
+
+	for (uint32_t iFile = 0; iFile < nFiles; iFile++)
+	{
+		const MPQOVERLAYFILE &file = lpFiles[iFile];
+		const MPQOVERLAYINSTANCE &instance = lpInstances[file.iFirstInstance];
+		const MPQBLOCKENTRY &block = MPQGetBlockTable(lpArchives[instance.iArchive].hArchive, NULL)[instance.iBlock];
+
+		if (file.bHidden || !(block.grfFlags & MPQ_FILE_EXISTS) || !block.cbFileSize)
+			continue;
+
+		SECTORFILELOADS loads = { 1, 0xFFFFFFFF };
+		if (options.lpFileLoads)
+		{
+			std::unordered_map<uint64_t, SECTORFILELOADS>::const_iterator itLoads = nameLoads.find(((uint64_t)file.dwNameHashA << 32) | file.dwNameHashB);
+			loads.nLoads = itLoads != nameLoads.end() ? itLoads->second.nLoads : 0;
+			loads.cbLoadSize = itLoads != nameLoads.end() ? itLoads->second.cbLoadSize : 0;
+		}
+
+		uint32_t cbRead = loads.cbLoadSize < block.cbFileSize ? loads.cbLoadSize : block.cbFileSize;
+		bool bCompressed = (block.grfFlags & (MPQ_FILE_IMPLODE | MPQ_FILE_COMPRESS)) != 0;
+
+		for (uint32_t iShift = 0; iShift <= MPQ_MAX_SECTOR_SIZE_SHIFT; iShift++)
+		{
+			MPQSECTORSIZECOST &cost = lpCosts[iShift];
+
+			// Other files are read in one go, decompressed whole if they're compressed
+			if (!bCompressed || (block.grfFlags & MPQ_FILE_SINGLE_UNIT))
+			{
+				cost.nReads += loads.nLoads;
+				cost.cbDecompressed += bCompressed ? loads.nLoads * block.cbFileSize : 0;
+				continue;
+			}
+
+			uint64_t nSectors = ((uint64_t)block.cbFileSize + cost.cbSectorSize - 1) / cost.cbSectorSize;
+			uint64_t nSectorsRead = ((uint64_t)cbRead + cost.cbSectorSize - 1) / cost.cbSectorSize;
+			uint64_t cbDecompressed = nSectorsRead * cost.cbSectorSize < block.cbFileSize ? nSectorsRead * cost.cbSectorSize : block.cbFileSize;
+
+			cost.nReads += loads.nLoads * (1 + nSectorsRead);
+			cost.cbDecompressed += loads.nLoads * cbDecompressed;
+			cost.cbOffsetTables += (nSectors + 1) * sizeof(uint32_t);
+		}
+	}
+
+	uint32_t iBestShift = 0;
+	for (uint32_t iShift = 0; iShift <= MPQ_MAX_SECTOR_SIZE_SHIFT; iShift++)
+	{
+		MPQSECTORSIZECOST &cost = lpCosts[iShift];
+		cost.fSeconds = cost.nReads * options.fSecondsPerRead + cost.cbDecompressed * options.fSecondsPerByte;
+
+		// The smallest of equal sizes, as it has the least to decompress when a file is read in part
+		if (cost.cbSectorSize <= options.cbMaxSectorSize && cost.fSeconds < lpCosts[iBestShift].fSeconds)
+			iBestShift = iShift;
+	}
+
+	return iBestShift;
+}
@@ -0,0 +1,70 @@
+/*
+	The contents of this file are subject to the Common Development and Distribution License Version 1.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at http://www.sun.com/cddl/cddl.html.
+
+	Software distributed under the License is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for the specific language governing rights and limitations under the License.
+
+	The Initial Developer of the Original Code is Justin Olbrantz. The Original Code Copyright (C) 2007 Justin Olbrantz. All Rights Reserved.
+*/
+
+
+// Prevent this header from being included multiple times
+#ifndef MPQSECTORSIZE_H
+#define MPQSECTORSIZE_H
+
+#include <stdint.h>
+#include "MPQFormat.h"
+#include "MPQMerge.h"
+#include "MPQOverlay.h"
+
+/*
+	MPQSectorSize estimates how an archive's sector size affects the game's loading, to choose the sector size to merge it with (MPQMERGEOPTIONS::cbSectorSize).
+	Storm reads a compressed file a sector at a time: first the file's sector offset table, then each sector the game's read touches, decompressing the whole sector. Small sectors make many reads and large offset tables for files that are loaded whole; large sectors decompress data that isn't needed when only the start of a file is read. Files that aren't compressed, and single unit files, are read the same way whatever the sector size.
+	Each load is taken to read the file from its start, all of it unless the profile says how much (MPQFILELOADS::cbLoadSize). The time is estimated as a cost for each read and for each byte decompressed.
+*/
+
+// Sector sizes larger than this aren't chosen unless asked for, as Storm allocates a buffer of the sector size for each file it opens
+#define MPQ_DEFAULT_MAX_SECTOR_SIZE 0x10000
+
+// Options for MPQEstimateSectorSizes
+struct MPQSECTORSIZEOPTIONS
+{
+	// How many times the game loads each file, and how much of it. May be NULL for every file loaded once, whole.
+	const MPQFILELOADS *lpFileLoads;
+	uint32_t nFileLoads;
+
+	// The largest sector size to choose, or 0 for MPQ_DEFAULT_MAX_SECTOR_SIZE
+	uint32_t cbMaxSectorSize;
+
+	// The time each read takes, and the time decompressing each byte takes, such as measured by MPQMeasureDecoding, in seconds; or 0 for rough figures for a machine of today
+	double fSecondsPerRead;
+	double fSecondsPerByte;
+};
+
+// The estimated cost of loading the files with one sector size
+struct MPQSECTORSIZECOST
+{
+	uint32_t cbSectorSize;
+
+	// The reads Storm makes, including reading offset tables, and the bytes it decompresses, for all the loads
+	uint64_t nReads;
+	uint64_t cbDecompressed;
+	double fSeconds;
+
+	// The size of the sector offset tables of all the files in the archive, loaded or not
+	uint64_t cbOffsetTables;
+};
+
+/*
+	* MPQEstimateSectorSizes *
+	Estimates the cost of loading the files of an overlay, as they would be merged, with each sector size. Returns the shift (MPQHEADER::wSectorSizeShift) of the sector size with the lowest time, up to the largest allowed.
+*/
+uint32_t MPQEstimateSectorSizes(
+	// The overlay
+	HMPQOVERLAY hOverlay,
+	// Options. May be NULL for the defaults.
+	const MPQSECTORSIZEOPTIONS *lpOptions,
+	// Receives the cost of each sector size, indexed by its shift
+	MPQSECTORSIZECOST lpCosts[MPQ_MAX_SECTOR_SIZE_SHIFT + 1]
+);
+
+#endif // #ifndef MPQSECTORSIZE_H
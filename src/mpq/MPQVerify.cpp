@@ -0,0 +1,824 @@
+/*
+	The contents of this file are subject to the Common Development and Distribution License Version 1.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at http://www.sun.com/cddl/cddl.html.
+
+	Software distributed under the License is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for the specific language governing rights and limitations under the License.
+
+	The Initial Developer of the Original Code is Justin Olbrantz. The Original Code Copyright (C) 2007 Justin Olbrantz. All Rights Reserved.
+*/
+
+#include "MPQVerify.h"
+#include "MPQCompress.h"
+#include "MPQCrypt.h"
+#include "MPQFile.h"
+#include "MPQParallel.h"
+#include <string.h>
+#include <algorithm>
+#include <deque>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// List files and (attributes) larger than this are assumed to be corrupt, rather than allocating whatever the block table says
+#define MAX_SPECIAL_FILE_SIZE 0x4000000
+
+#define ATTRIBUTES_NAME "(attributes)"
+
+// The header of (attributes), which is followed by an array for each attribute present, each with an entry for each block
+#define ATTRIBUTES_VERSION 100
+
+#define ATTRIBUTES_CRC32 0x00000001	// uint32_t CRC32 of each file
+#define ATTRIBUTES_FILETIME 0x00000002	// uint64_t FILETIME of each file
+#define ATTRIBUTES_MD5 0x00000004	// uint8_t[16] MD5 of each file
+#define ATTRIBUTES_PATCH_BIT 0x00000008	// A bit for each file, set if it's a patch file
+
+#define MD5_SIZE 16
+
+// Sector checksums that mean the sector has none
+#define SECTOR_CRC_NONE_0 0
+#define SECTOR_CRC_NONE_1 0xFFFFFFFF
+
+static const char *s_lpszArchiveCheckStrings[NUM_MPQ_VERIFY_ARCHIVE_CHECKS] = {
+	"The header does not match its MD5.",
+	"Some tables do not match their MD5s.",
+	"Some files' data overlaps other files' data.",
+	"(attributes) is unreadable or does not match the block table."
+};
+
+static const char *s_lpszFileCheckStrings[NUM_MPQ_VERIFY_FILE_CHECKS] = {
+	"Some sectors do not match their checksums.",
+	"The file does not match its CRC32 in (attributes).",
+	"The file does not match its MD5 in (attributes)."
+};
+
+// The standard CRC32, as used by zlib and (attributes)
+struct CRC32TABLE
+{
+	uint32_t dwValues[0x100];
+
+	CRC32TABLE()
+	{
+		for (uint32_t iByte = 0; iByte < 0x100; iByte++)
+		{
+			uint32_t dwValue = iByte;
+			for (int iBit = 0; iBit < 8; iBit++)
+				dwValue = (dwValue & 1) ? (dwValue >> 1) ^ 0xEDB88320 : dwValue >> 1;
+
+			dwValues[iByte] = dwValue;
+		}
+	}
+};
+
+// Built on first use. The compiler makes sure that happens only once, even if several threads get here at the same time. Large data may be checksummed in pieces by passing the return value of the previous call as dwCRC; the first call should pass 0.
+static uint32_t CRC32(uint32_t dwCRC, const uint8_t *lpbyData, uint32_t cbData)
+{
+	static const CRC32TABLE crcTable;
+
+	dwCRC = ~dwCRC;
+	for (; cbData; cbData--)
+		dwCRC = crcTable.dwValues[(dwCRC ^ *lpbyData++) & 0xFF] ^ (dwCRC >> 8);
+
+	return ~dwCRC;
+}
+
+// The MD5 of data, as in RFC 1321. Tables are hashed in one call, from memory; files are hashed a sector at a time, as they're read.
+static const uint32_t s_dwMD5Constants[64] = {
+	0xD76AA478, 0xE8C7B756, 0x242070DB, 0xC1BDCEEE, 0xF57C0FAF, 0x4787C62A, 0xA8304613, 0xFD469501,
+	0x698098D8, 0x8B44F7AF, 0xFFFF5BB1, 0x895CD7BE, 0x6B901122, 0xFD987193, 0xA679438E, 0x49B40821,
+	0xF61E2562, 0xC040B340, 0x265E5A51, 0xE9B6C7AA, 0xD62F105D, 0x02441453, 0xD8A1E681, 0xE7D3FBC8,
+	0x21E1CDE6, 0xC33707D6, 0xF4D50D87, 0x455A14ED, 0xA9E3E905, 0xFCEFA3F8, 0x676F02D9, 0x8D2A4C8A,
+	0xFFFA3942, 0x8771F681, 0x6D9D6122, 0xFDE5380C, 0xA4BEEA44, 0x4BDECFA9, 0xF6BB4B60, 0xBEBFBC70,
+	0x289B7EC6, 0xEAA127FA, 0xD4EF3085, 0x04881D05, 0xD9D4D039, 0xE6DB99E5, 0x1FA27CF8, 0xC4AC5665,
+	0xF4292244, 0x432AFF97, 0xAB9423A7, 0xFC93A039, 0x655B59C3, 0x8F0CCC92, 0xFFEFF47D, 0x85845DD1,
+	0x6FA87E4F, 0xFE2CE6E0, 0xA3014314, 0x4E0811A1, 0xF7537E82, 0xBD3AF235, 0x2AD7D2BB, 0xEB86D391
+};
+
+static const uint8_t s_byMD5Shifts[64] = {
+	7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+	5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+	4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+	6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+};
+
+static void MD5Block(uint32_t *lpdwState, const uint8_t *lpbyBlock)
+{
+	uint32_t dwWords[16];
+	for (int iWord = 0; iWord < 16; iWord++)
+	{
+		const uint8_t *lpbyWord = lpbyBlock + iWord * 4;
+		dwWords[iWord] = lpbyWord[0] | (lpbyWord[1] << 8) | (lpbyWord[2] << 16) | ((uint32_t)lpbyWord[3] << 24);
+	}
+
+	uint32_t dwA = lpdwState[0], dwB = lpdwState[1], dwC = lpdwState[2], dwD = lpdwState[3];
+
+	for (int iStep = 0; iStep < 64; iStep++)
+	{
+		uint32_t dwF, iWord;
+		switch (iStep / 16)
+		{
+		case 0:
+			dwF = (dwB & dwC) | (~dwB & dwD);
+			iWord = iStep;
+			break;
+		case 1:
+			dwF = (dwD & dwB) | (~dwD & dwC);
+			iWord = (5 * iStep + 1) % 16;
+			break;
+		case 2:
+			dwF = dwB ^ dwC ^ dwD;
+			iWord = (3 * iStep + 5) % 16;
+			break;
+		default:
+			dwF = dwC ^ (dwB | ~dwD);
+			iWord = (7 * iStep) % 16;
+			break;
+		}
+
+		dwF += dwA + s_dwMD5Constants[iStep] + dwWords[iWord];
+		dwA = dwD;
+		dwD = dwC;
+		dwC = dwB;
+		dwB += (dwF << s_byMD5Shifts[iStep]) | (dwF >> (32 - s_byMD5Shifts[iStep]));
+	}
+
+	lpdwState[0] += dwA;
+	lpdwState[1] += dwB;
+	lpdwState[2] += dwC;
+	lpdwState[3] += dwD;
+}
+
+struct MD5CONTEXT
+{
+	uint32_t dwState[4];
+	uint64_t cbData;	// The number of bytes hashed so far
+	uint8_t byBlock[64];	// Data not yet hashed, until there's a full block of it
+};
+
+static void MD5Init(MD5CONTEXT &context)
+{
+	context.dwState[0] = 0x67452301;
+	context.dwState[1] = 0xEFCDAB89;
+	context.dwState[2] = 0x98BADCFE;
+	context.dwState[3] = 0x10325476;
+	context.cbData = 0;
+}
+
+static void MD5Update(MD5CONTEXT &context, const uint8_t *lpbyData, uint64_t cbData)
+{
+	uint32_t cbBlockUsed = (uint32_t)(context.cbData % sizeof(context.byBlock));
+	context.cbData += cbData;
+
+	// Finish the partial block left from last time, if any
+	if (cbBlockUsed)
+	{
+		uint32_t cbCopy = (uint32_t)(cbData < sizeof(context.byBlock) - cbBlockUsed ? cbData : sizeof(context.byBlock) - cbBlockUsed);
+		memcpy(context.byBlock + cbBlockUsed, lpbyData, cbCopy);
+		lpbyData += cbCopy;
+		cbData -= cbCopy;
+
+		if (cbBlockUsed + cbCopy < sizeof(context.byBlock))
+			return;
+
+		MD5Block(context.dwState, context.byBlock);
+	}
+
+	for (; cbData >= sizeof(context.byBlock); cbData -= sizeof(context.byBlock), lpbyData += sizeof(context.byBlock))
+		MD5Block(context.dwState, lpbyData);
+
+	memcpy(context.byBlock, lpbyData, (size_t)cbData);
+}
+
+static void MD5Final(MD5CONTEXT &context, uint8_t *lpbyMD5)
+{
+	// A 1 bit, 0s up to 8 bytes short of a block boundary, and the size in bits
+	uint8_t byPadding[72];
+	uint32_t cbBlockUsed = (uint32_t)(context.cbData % sizeof(context.byBlock));
+	uint32_t cbPadding = (cbBlockUsed < 56 ? 56 : 120) - cbBlockUsed;
+
+	memset(byPadding, 0, sizeof(byPadding));
+	byPadding[0] = 0x80;
+
+	uint64_t qwBits = context.cbData * 8;
+	for (int iByte = 0; iByte < 8; iByte++)
+		byPadding[cbPadding + iByte] = (uint8_t)(qwBits >> (iByte * 8));
+
+	MD5Update(context, byPadding, cbPadding + 8);
+
+	for (int iByte = 0; iByte < MD5_SIZE; iByte++)
+		lpbyMD5[iByte] = (uint8_t)(context.dwState[iByte / 4] >> ((iByte % 4) * 8));
+}
+
+static void MD5(const uint8_t *lpbyData, uint64_t cbData, uint8_t *lpbyMD5)
+{
+	MD5CONTEXT context;
+
+	MD5Init(context);
+	MD5Update(context, lpbyData, cbData);
+	MD5Final(context, lpbyMD5);
+}
+
+// Tools which don't compute a checksum leave it 0
+static bool IsZeroMD5(const uint8_t *lpbyMD5)
+{
+	for (int iByte = 0; iByte < MD5_SIZE; iByte++)
+	{
+		if (lpbyMD5[iByte])
+			return false;
+	}
+
+	return true;
+}
+
+static inline uint64_t CombineNameHashes(uint32_t dwNameHashA, uint32_t dwNameHashB)
+{
+	return ((uint64_t)dwNameHashA << 32) | dwNameHashB;
+}
+
+// The state kept for each archive while verifying
+struct VERIFYARCHIVE
+{
+	HMPQARCHIVE hArchive;
+
+	// The hash table entries referring to files with each name, in all locales, for matching up names
+	std::unordered_map<uint64_t, std::vector<uint32_t> > hashEntriesByName;
+
+	// The contents of (attributes), if it's usable, and where its checksums are. The arrays are not aligned.
+	std::vector<uint8_t> attributes;
+	uint32_t nAttributeEntries;
+	const uint8_t *lpbyCRC32s;
+	const uint8_t *lpbyMD5s;
+};
+
+struct MPQVERIFY
+{
+	std::vector<MPQVERIFYARCHIVE> results;
+	std::vector<MPQVERIFYFILE> files;
+
+	std::vector<VERIFYARCHIVE> archives;
+
+	// The names given to files. A deque, so that adding names doesn't move the ones already given out.
+	std::deque<std::string> names;
+};
+
+// Gives names to the files in an archive, from a list of names separated as in a list file
+static void AddNames(MPQVERIFY &verify, uint32_t iArchive, const char *lpszNames, size_t cbNames)
+{
+	VERIFYARCHIVE &archive = verify.archives[iArchive];
+	const MPQVERIFYARCHIVE &result = verify.results[iArchive];
+	const MPQHASHENTRY *lpHashTable = MPQGetHashTable(archive.hArchive, NULL);
+
+	std::string name;
+
+	for (size_t iChar = 0; iChar <= cbNames; iChar++)
+	{
+		// Collect a name up to the next separator, or the end
+		char chCur = iChar < cbNames ? lpszNames[iChar] : '\n';
+		if (chCur != '\r' && chCur != '\n' && chCur != ';' && chCur != '\0')
+		{
+			name += chCur;
+			continue;
+		}
+
+		// Ignore spaces around names, which are left by hand editing
+		size_t iStart = name.find_first_not_of(" \t"), iEnd = name.find_last_not_of(" \t");
+		if (iStart == std::string::npos)
+		{
+			name.clear();
+			continue;
+		}
+
+		name = name.substr(iStart, iEnd - iStart + 1);
+
+		MPQNAMEHASHES hashes;
+		MPQHashName(name.c_str(), &hashes);
+
+		std::unordered_map<uint64_t, std::vector<uint32_t> >::const_iterator itHashEntries =
+			archive.hashEntriesByName.find(CombineNameHashes(hashes.dwNameHashA, hashes.dwNameHashB));
+
+		if (itHashEntries != archive.hashEntriesByName.end())
+		{
+			const char *lpszName = NULL;
+
+			for (uint32_t iHashEntry : itHashEntries->second)
+			{
+				// Files are in block order, so the file for a block can be found directly
+				uint32_t iBlock = lpHashTable[iHashEntry].dwBlockIndex;
+				MPQVERIFYFILE *lpFile = std::lower_bound(&verify.files[result.iFirstFile], &verify.files[result.iFirstFile] + result.nFiles, iBlock,
+					[](const MPQVERIFYFILE &file, uint32_t iBlock) { return file.iBlock < iBlock; });
+
+				if (lpFile->lpszName)
+					continue;
+
+				if (!lpszName)
+				{
+					verify.names.push_back(name);
+					lpszName = verify.names.back().c_str();
+				}
+
+				lpFile->lpszName = lpszName;
+			}
+		}
+
+		name.clear();
+	}
+}
+
+// Reads a special file, such as the list file, which may be missing. Returns false if it's missing or can't be read.
+static bool ReadSpecialFile(HMPQARCHIVE hArchive, const char *lpszName, std::vector<uint8_t> &contents)
+{
+	uint32_t iHashEntry, nBlocks;
+	if (MPQFindFile(hArchive, lpszName, MPQ_LOCALE_NEUTRAL, &iHashEntry) != MPQ_ERROR_SUCCESS)
+		return false;
+
+	uint32_t iBlock = MPQGetHashTable(hArchive, NULL)[iHashEntry].dwBlockIndex;
+	const MPQBLOCKENTRY *lpBlockTable = MPQGetBlockTable(hArchive, &nBlocks);
+	if (iBlock >= nBlocks || lpBlockTable[iBlock].cbFileSize > MAX_SPECIAL_FILE_SIZE || !MPQIsFileSizePossible(hArchive, iBlock))
+		return false;
+
+	contents.resize(lpBlockTable[iBlock].cbFileSize);
+
+	return MPQReadFile(hArchive, iBlock, lpszName, contents.data()) == MPQ_ERROR_SUCCESS;
+}
+
+// Finds the checksums in (attributes). It may have an entry for every block, or for all but the last, which some tools leave out for (attributes) itself.
+static void ReadAttributes(VERIFYARCHIVE &archive, MPQVERIFYARCHIVE &result)
+{
+	uint32_t iHashEntry;
+	if (MPQFindFile(archive.hArchive, ATTRIBUTES_NAME, MPQ_LOCALE_NEUTRAL, &iHashEntry) != MPQ_ERROR_SUCCESS)
+		return;
+
+	result.grfChecked |= MPQ_VERIFY_ATTRIBUTES;
+
+	uint32_t dwVersion, grfAttributes;
+	if (!ReadSpecialFile(archive.hArchive, ATTRIBUTES_NAME, archive.attributes) || archive.attributes.size() < sizeof(dwVersion) + sizeof(grfAttributes))
+	{
+		result.grfProblems |= MPQ_VERIFY_ATTRIBUTES;
+		return;
+	}
+
+	memcpy(&dwVersion, &archive.attributes[0], sizeof(dwVersion));
+	memcpy(&grfAttributes, &archive.attributes[sizeof(dwVersion)], sizeof(grfAttributes));
+	if (dwVersion != ATTRIBUTES_VERSION)
+	{
+		result.grfProblems |= MPQ_VERIFY_ATTRIBUTES;
+		return;
+	}
+
+	uint64_t cbEntry = ((grfAttributes & ATTRIBUTES_CRC32) ? sizeof(uint32_t) : 0) + ((grfAttributes & ATTRIBUTES_FILETIME) ? sizeof(uint64_t) : 0)
+		+ ((grfAttributes & ATTRIBUTES_MD5) ? MD5_SIZE : 0);
+	uint64_t cbHeader = sizeof(dwVersion) + sizeof(grfAttributes);
+
+	uint32_t nBlocks = result.info.nBlockTableEntries;
+	const uint32_t nEntryCounts[2] = { nBlocks, nBlocks ? nBlocks - 1 : 0 };
+
+	for (uint32_t nEntries : nEntryCounts)
+	{
+		uint64_t cbPatchBits = (grfAttributes & ATTRIBUTES_PATCH_BIT) ? (nEntries + 7) / 8 : 0;
+		if (cbHeader + cbEntry * nEntries + cbPatchBits != archive.attributes.size())
+			continue;
+
+		const uint8_t *lpbyArray = &archive.attributes[(size_t)cbHeader];
+		archive.nAttributeEntries = nEntries;
+
+		if (grfAttributes & ATTRIBUTES_CRC32)
+		{
+			archive.lpbyCRC32s = lpbyArray;
+			lpbyArray += (size_t)nEntries * sizeof(uint32_t);
+		}
+		if (grfAttributes & ATTRIBUTES_FILETIME)
+			lpbyArray += (size_t)nEntries * sizeof(uint64_t);
+		if (grfAttributes & ATTRIBUTES_MD5)
+			archive.lpbyMD5s = lpbyArray;
+
+		return;
+	}
+
+	result.grfProblems |= MPQ_VERIFY_ATTRIBUTES;
+}
+
+// Checks the MD5s format version 4 keeps of the header and each table, as they are stored
+static void CheckTableMD5s(HMPQARCHIVE hArchive, MPQVERIFYARCHIVE &result)
+{
+	const MPQHEADER &header = *MPQGetArchiveHeader(hArchive);
+	if (header.wFormatVersion < MPQ_FORMAT_VERSION_4 || result.info.cbHeaderSize < MPQ_HEADER_SIZE_V4)
+		return;
+
+	uint64_t qwDataSize;
+	const uint8_t *lpbyArchive = MPQGetArchiveData(hArchive, &qwDataSize);
+	uint8_t byMD5[MD5_SIZE];
+
+	// The header's MD5 covers everything before it
+	if (!IsZeroMD5(header.byHeaderMD5))
+	{
+		result.grfChecked |= MPQ_VERIFY_HEADER_MD5;
+
+		MD5(lpbyArchive, MPQ_HEADER_SIZE_V4 - MD5_SIZE, byMD5);
+		if (memcmp(byMD5, header.byHeaderMD5, MD5_SIZE))
+			result.grfProblems |= MPQ_VERIFY_HEADER_MD5;
+	}
+
+	const struct
+	{
+		uint64_t qwOffset;
+		uint64_t qwSize;
+		const uint8_t *lpbyMD5;
+	} tables[] = {
+		{ ((uint64_t)header.wHashTableOffsetHigh << 32) | header.dwHashTableOffset, header.qwHashTableSize, header.byHashTableMD5 },
+		{ ((uint64_t)header.wBlockTableOffsetHigh << 32) | header.dwBlockTableOffset, header.qwBlockTableSize, header.byBlockTableMD5 },
+		{ header.qwHiBlockTableOffset, header.qwHiBlockTableSize, header.byHiBlockTableMD5 },
+		{ header.qwHETTableOffset, header.qwHETTableSize, header.byHETTableMD5 },
+		{ header.qwBETTableOffset, header.qwBETTableSize, header.byBETTableMD5 }
+	};
+
+	for (const auto &table : tables)
+	{
+		if (!table.qwSize || IsZeroMD5(table.lpbyMD5))
+			continue;
+
+		result.grfChecked |= MPQ_VERIFY_TABLE_MD5;
+
+		if (table.qwOffset > qwDataSize || table.qwSize > qwDataSize - table.qwOffset)
+		{
+			result.grfProblems |= MPQ_VERIFY_TABLE_MD5;
+			continue;
+		}
+
+		MD5(lpbyArchive + table.qwOffset, table.qwSize, byMD5);
+		if (memcmp(byMD5, table.lpbyMD5, MD5_SIZE))
+			result.grfProblems |= MPQ_VERIFY_TABLE_MD5;
+	}
+}
+
+// Checks for files whose data partly overlaps other files'. Blocks with exactly the same data are allowed; some tools store identical files once.
+static void CheckFileOverlap(HMPQARCHIVE hArchive, MPQVERIFYARCHIVE &result)
+{
+	uint32_t nBlocks;
+	const MPQBLOCKENTRY *lpBlockTable = MPQGetBlockTable(hArchive, &nBlocks);
+
+	std::vector<std::pair<uint64_t, uint64_t> > extents;
+	for (uint32_t iBlock = 0; iBlock < nBlocks; iBlock++)
+	{
+		const MPQBLOCKENTRY &block = lpBlockTable[iBlock];
+		if ((block.grfFlags & MPQ_FILE_EXISTS) && block.cbCompressedSize)
+		{
+			uint64_t qwFilePos = MPQGetBlockFilePos(hArchive, iBlock);
+			extents.push_back(std::make_pair(qwFilePos, qwFilePos + block.cbCompressedSize));
+		}
+	}
+
+	std::sort(extents.begin(), extents.end());
+
+	result.grfChecked |= MPQ_VERIFY_FILE_OVERLAP;
+
+	// The block reaching furthest so far
+	std::pair<uint64_t, uint64_t> furthest(0, 0);
+	for (const std::pair<uint64_t, uint64_t> &extent : extents)
+	{
+		if (extent.first < furthest.second && extent != furthest)
+		{
+			result.grfProblems |= MPQ_VERIFY_FILE_OVERLAP;
+			return;
+		}
+
+		if (extent.second > furthest.second)
+			furthest = extent;
+	}
+}
+
+// Checks the Adler-32 of each sector, as stored, after decryption. Files are left unchecked if their checksums can't be found; reading the file then finds whatever is wrong with it.
+static void CheckSectorChecksums(HMPQARCHIVE hArchive, MPQVERIFYFILE &file)
+{
+	const MPQBLOCKENTRY &block = MPQGetBlockTable(hArchive, NULL)[file.iBlock];
+
+	// Only files with sector offset tables have room for the checksums
+	if (!(block.grfFlags & MPQ_FILE_SECTOR_CRC) || !(block.grfFlags & (MPQ_FILE_IMPLODE | MPQ_FILE_COMPRESS))
+		|| (block.grfFlags & MPQ_FILE_SINGLE_UNIT) || !block.cbFileSize)
+		return;
+
+	bool bEncrypted = (block.grfFlags & MPQ_FILE_ENCRYPTED) != 0;
+	if (bEncrypted && !file.lpszName)
+		return;
+
+	uint64_t qwDataSize, qwFilePos = MPQGetBlockFilePos(hArchive, file.iBlock);
+	const uint8_t *lpbyArchive = MPQGetArchiveData(hArchive, &qwDataSize);
+	if (qwFilePos > qwDataSize || block.cbCompressedSize > qwDataSize - qwFilePos)
+		return;
+
+	const uint8_t *lpbyFileData = lpbyArchive + qwFilePos;
+	uint32_t dwKey = bEncrypted ? MPQGetFileKey(file.lpszName, qwFilePos, block.cbFileSize, block.grfFlags) : 0;
+
+	uint32_t cbSectorSize = MPQGetArchiveInfo(hArchive)->cbSectorSize;
+	uint32_t nSectors = (uint32_t)(((uint64_t)block.cbFileSize + cbSectorSize - 1) / cbSectorSize);
+
+	// The offset table has an extra entry, giving the end of the checksums, which follow the last sector
+	uint64_t cbOffsetTable = ((uint64_t)nSectors + 2) * sizeof(uint32_t);
+	if (cbOffsetTable > block.cbCompressedSize)
+		return;
+
+	uint32_t *lpdwSectorOffsets = new (std::nothrow) uint32_t[nSectors + 2];
+	uint32_t *lpdwChecksums = new (std::nothrow) uint32_t[nSectors];
+	uint8_t *lpbySector = new (std::nothrow) uint8_t[cbSectorSize];
+
+	if (lpdwSectorOffsets && lpdwChecksums && lpbySector)
+	{
+		memcpy(lpdwSectorOffsets, lpbyFileData, (size_t)cbOffsetTable);
+		if (bEncrypted)
+			MPQDecryptBlock(lpdwSectorOffsets, (size_t)cbOffsetTable, dwKey - 1);
+
+		uint32_t dwChecksumsStart = lpdwSectorOffsets[nSectors], dwChecksumsEnd = lpdwSectorOffsets[nSectors + 1];
+		uint32_t cbChecksums = nSectors * sizeof(uint32_t);
+
+		// Storm ignores checksums it can't make sense of, as does this. They aren't encrypted, and are compressed if that made them smaller.
+		if (dwChecksumsStart <= dwChecksumsEnd && dwChecksumsEnd <= block.cbCompressedSize
+			&& dwChecksumsEnd - dwChecksumsStart >= sizeof(uint32_t) && dwChecksumsEnd - dwChecksumsStart <= cbSectorSize)
+		{
+			uint32_t cbStored = dwChecksumsEnd - dwChecksumsStart;
+			file.grfChecked |= MPQ_VERIFY_SECTOR_CRC;
+
+			if (cbStored == cbChecksums)
+				memcpy(lpdwChecksums, lpbyFileData + dwChecksumsStart, cbChecksums);
+			else if (MPQDecompressSector(lpdwChecksums, cbChecksums, lpbyFileData + dwChecksumsStart, cbStored, MPQ_FILE_COMPRESS) != MPQ_ERROR_SUCCESS)
+				file.grfProblems |= MPQ_VERIFY_SECTOR_CRC;
+
+			for (uint32_t iSector = 0; iSector < nSectors && !(file.grfProblems & MPQ_VERIFY_SECTOR_CRC); iSector++)
+			{
+				uint32_t dwSectorStart = lpdwSectorOffsets[iSector], dwSectorEnd = lpdwSectorOffsets[iSector + 1];
+				if (dwSectorStart > dwSectorEnd || dwSectorEnd > block.cbCompressedSize || dwSectorEnd - dwSectorStart > cbSectorSize)
+					break;
+
+				uint32_t dwExpected = lpdwChecksums[iSector];
+				if (dwExpected == SECTOR_CRC_NONE_0 || dwExpected == SECTOR_CRC_NONE_1)
+					continue;
+
+				const uint8_t *lpbyStored = lpbyFileData + dwSectorStart;
+				uint32_t cbSector = dwSectorEnd - dwSectorStart;
+
+				if (bEncrypted)
+				{
+					memcpy(lpbySector, lpbyStored, cbSector);
+					MPQDecryptBlock(lpbySector, cbSector, dwKey + iSector);
+					lpbyStored = lpbySector;
+				}
+
+				if (MPQAdler32(0, lpbyStored, cbSector) != dwExpected)
+					file.grfProblems |= MPQ_VERIFY_SECTOR_CRC;
+			}
+		}
+	}
+
+	delete [] lpdwSectorOffsets;
+	delete [] lpdwChecksums;
+	delete [] lpbySector;
+}
+
+// The checksums of a file, computed a sector at a time as it's read
+struct FILECHECKSUMS
+{
+	bool bCRC32;
+	uint32_t dwCRC32;
+
+	bool bMD5;
+	MD5CONTEXT md5;
+};
+
+static void ChecksumSector(void *lpvContext, const void *lpvSector, uint32_t cbSector)
+{
+	FILECHECKSUMS &checksums = *(FILECHECKSUMS *)lpvContext;
+
+	if (checksums.bCRC32)
+		checksums.dwCRC32 = CRC32(checksums.dwCRC32, (const uint8_t *)lpvSector, cbSector);
+	if (checksums.bMD5)
+		MD5Update(checksums.md5, (const uint8_t *)lpvSector, cbSector);
+}
+
+static void VerifyFile(const VERIFYARCHIVE &archive, MPQVERIFYFILE &file)
+{
+	CheckSectorChecksums(archive.hArchive, file);
+
+	// A file is read even if it has no checksums in (attributes), as reading it is the only way to find whether it decompresses
+	uint32_t dwExpectedCRC = 0;
+	const uint8_t *lpbyExpectedMD5 = NULL;
+	if (file.iBlock < archive.nAttributeEntries)
+	{
+		if (archive.lpbyCRC32s)
+			memcpy(&dwExpectedCRC, archive.lpbyCRC32s + file.iBlock * sizeof(uint32_t), sizeof(dwExpectedCRC));
+		if (archive.lpbyMD5s && !IsZeroMD5(archive.lpbyMD5s + file.iBlock * MD5_SIZE))
+			lpbyExpectedMD5 = archive.lpbyMD5s + file.iBlock * MD5_SIZE;
+	}
+
+	FILECHECKSUMS checksums;
+	checksums.bCRC32 = dwExpectedCRC != 0;
+	checksums.dwCRC32 = 0;
+	checksums.bMD5 = lpbyExpectedMD5 != NULL;
+	MD5Init(checksums.md5);
+
+	// This rejects sizes the stored data can't account for before anything is allocated, and needs no more than a sector of memory
+	file.error = MPQReadFileSectors(archive.hArchive, file.iBlock, file.lpszName, ChecksumSector, &checksums);
+	if (file.error != MPQ_ERROR_SUCCESS)
+		return;
+
+	if (checksums.bCRC32)
+	{
+		file.grfChecked |= MPQ_VERIFY_FILE_CRC32;
+		if (checksums.dwCRC32 != dwExpectedCRC)
+			file.grfProblems |= MPQ_VERIFY_FILE_CRC32;
+	}
+
+	if (checksums.bMD5)
+	{
+		uint8_t byMD5[MD5_SIZE];
+		MD5Final(checksums.md5, byMD5);
+
+		file.grfChecked |= MPQ_VERIFY_FILE_MD5;
+		if (memcmp(byMD5, lpbyExpectedMD5, MD5_SIZE))
+			file.grfProblems |= MPQ_VERIFY_FILE_MD5;
+	}
+}
+
+// Adds a file for each block a hash table entry refers to, and indexes the hash table entries by name
+static void IndexFiles(MPQVERIFY &verify, uint32_t iArchive)
+{
+	VERIFYARCHIVE &archive = verify.archives[iArchive];
+	MPQVERIFYARCHIVE &result = verify.results[iArchive];
+
+	uint32_t nHashEntries, nBlocks;
+	const MPQHASHENTRY *lpHashTable = MPQGetHashTable(archive.hArchive, &nHashEntries);
+	MPQGetBlockTable(archive.hArchive, &nBlocks);
+
+	std::vector<uint32_t> firstHashEntries(nBlocks, MPQ_HASH_ENTRY_EMPTY);
+	for (uint32_t iHashEntry = 0; iHashEntry < nHashEntries; iHashEntry++)
+	{
+		const MPQHASHENTRY &hashEntry = lpHashTable[iHashEntry];
+
+		// This also skips empty and deleted entries
+		if (hashEntry.dwBlockIndex >= nBlocks)
+			continue;
+
+		if (firstHashEntries[hashEntry.dwBlockIndex] == MPQ_HASH_ENTRY_EMPTY)
+			firstHashEntries[hashEntry.dwBlockIndex] = iHashEntry;
+
+		archive.hashEntriesByName[CombineNameHashes(hashEntry.dwNameHashA, hashEntry.dwNameHashB)].push_back(iHashEntry);
+	}
+
+	result.iFirstFile = (uint32_t)verify.files.size();
+
+	for (uint32_t iBlock = 0; iBlock < nBlocks; iBlock++)
+	{
+		if (firstHashEntries[iBlock] == MPQ_HASH_ENTRY_EMPTY)
+			continue;
+
+		MPQVERIFYFILE file;
+		memset(&file, 0, sizeof(file));
+		file.iArchive = iArchive;
+		file.iBlock = iBlock;
+		file.iHashEntry = firstHashEntries[iBlock];
+
+		verify.files.push_back(file);
+	}
+
+	result.nFiles = (uint32_t)verify.files.size() - result.iFirstFile;
+}
+
+MPQERROR MPQVerifyArchives(const char *const *lplpszArchives, uint32_t nArchives, const char *lpszNames, size_t cbNames, uint32_t nThreads, HMPQVERIFY *lphVerify)
+{
+	*lphVerify = NULL;
+
+	MPQVERIFY *lpVerify = new (std::nothrow) MPQVERIFY;
+	if (!lpVerify)
+		return MPQ_ERROR_NO_MEMORY;
+
+	try
+	{
+		lpVerify->results.resize(nArchives);
+		lpVerify->archives.resize(nArchives);
+
+		for (uint32_t iArchive = 0; iArchive < nArchives; iArchive++)
+		{
+			MPQVERIFYARCHIVE &result = lpVerify->results[iArchive];
+			VERIFYARCHIVE &archive = lpVerify->archives[iArchive];
+
+			memset(&result, 0, sizeof(result));
+			archive.hArchive = NULL;
+			archive.nAttributeEntries = 0;
+			archive.lpbyCRC32s = NULL;
+			archive.lpbyMD5s = NULL;
+
+			result.iFirstFile = (uint32_t)lpVerify->files.size();
+
+			result.error = MPQOpenArchive(lplpszArchives[iArchive], &archive.hArchive);
+			if (result.error != MPQ_ERROR_SUCCESS)
+			{
+				archive.hArchive = NULL;
+				continue;
+			}
+
+			result.info = *MPQGetArchiveInfo(archive.hArchive);
+
+			IndexFiles(*lpVerify, iArchive);
+		}
+
+		// Names can only be given out once all the files are in place
+		for (uint32_t iArchive = 0; iArchive < nArchives; iArchive++)
+		{
+			VERIFYARCHIVE &archive = lpVerify->archives[iArchive];
+			MPQVERIFYARCHIVE &result = lpVerify->results[iArchive];
+			if (!archive.hArchive)
+				continue;
+
+			static const char s_szSpecialNames[] = MPQ_LISTFILE_NAME "\n" ATTRIBUTES_NAME "\n(signature)";
+			AddNames(*lpVerify, iArchive, s_szSpecialNames, sizeof(s_szSpecialNames) - 1);
+
+			std::vector<uint8_t> listFile;
+			if (ReadSpecialFile(archive.hArchive, MPQ_LISTFILE_NAME, listFile))
+				AddNames(*lpVerify, iArchive, (const char *)listFile.data(), listFile.size());
+
+			if (lpszNames)
+				AddNames(*lpVerify, iArchive, lpszNames, cbNames);
+
+			ReadAttributes(archive, result);
+			CheckTableMD5s(archive.hArchive, result);
+			CheckFileOverlap(archive.hArchive, result);
+		}
+	}
+	catch (const std::bad_alloc &)
+	{
+		MPQCloseVerify(lpVerify);
+		return MPQ_ERROR_NO_MEMORY;
+	}
+
+	// The largest files are started first, so that one isn't left running alone at the end
+	std::vector<uint32_t> order(lpVerify->files.size());
+	for (uint32_t iFile = 0; iFile < order.size(); iFile++)
+		order[iFile] = iFile;
+
+	std::vector<uint32_t> sizes(lpVerify->files.size());
+	for (uint32_t iFile = 0; iFile < sizes.size(); iFile++)
+	{
+		const MPQVERIFYFILE &file = lpVerify->files[iFile];
+		sizes[iFile] = MPQGetBlockTable(lpVerify->archives[file.iArchive].hArchive, NULL)[file.iBlock].cbCompressedSize;
+	}
+
+	std::stable_sort(order.begin(), order.end(), [&](uint32_t iFile1, uint32_t iFile2) { return sizes[iFile1] > sizes[iFile2]; });
+
+	MPQParallelFor((uint32_t)order.size(), nThreads, [&](uint32_t iItem)
+	{
+		MPQVERIFYFILE &file = lpVerify->files[order[iItem]];
+		VerifyFile(lpVerify->archives[file.iArchive], file);
+	});
+
+	for (const MPQVERIFYFILE &file : lpVerify->files)
+	{
+		MPQVERIFYARCHIVE &result = lpVerify->results[file.iArchive];
+
+		if (file.grfProblems || (file.error != MPQ_ERROR_SUCCESS && file.error != MPQ_ERROR_UNKNOWN_KEY && file.error != MPQ_ERROR_UNSUPPORTED_COMPRESSION))
+			result.nBadFiles++;
+		else if (file.error != MPQ_ERROR_SUCCESS)
+			result.nUncheckedFiles++;
+	}
+
+	*lphVerify = lpVerify;
+
+	return MPQ_ERROR_SUCCESS;
+}
+
+void MPQCloseVerify(HMPQVERIFY hVerify)
+{
+	if (!hVerify)
+		return;
+
+	for (VERIFYARCHIVE &archive : hVerify->archives)
+	{
+		if (archive.hArchive)
+			MPQCloseArchive(archive.hArchive);
+	}
+
+	delete hVerify;
+}
+
+const MPQVERIFYARCHIVE *MPQGetVerifyArchives(HMPQVERIFY hVerify)
+{
+	return hVerify->results.empty() ? NULL : &hVerify->results[0];
+}
+
+const MPQVERIFYFILE *MPQGetVerifyFiles(HMPQVERIFY hVerify, uint32_t *lpnFiles)
+{
+	if (lpnFiles)
+		*lpnFiles = (uint32_t)hVerify->files.size();
+
+	return hVerify->files.empty() ? NULL : &hVerify->files[0];
+}
+
+const char *MPQGetVerifyCheckString(uint32_t dwCheck, bool bArchiveCheck)
+{
+	const char **lplpszStrings = bArchiveCheck ? s_lpszArchiveCheckStrings : s_lpszFileCheckStrings;
+	unsigned nChecks = bArchiveCheck ? NUM_MPQ_VERIFY_ARCHIVE_CHECKS : NUM_MPQ_VERIFY_FILE_CHECKS;
+
+	for (unsigned iCheck = 0; iCheck < nChecks; iCheck++)
+	{
+		if (dwCheck == (1U << iCheck))
+			return lplpszStrings[iCheck];
+	}
+
+	return NULL;
+}
@@ -0,0 +1,142 @@
+/*
+	The contents of this file are subject to the Common Development and Distribution License Version 1.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at http://www.sun.com/cddl/cddl.html.
+
+	Software distributed under the License is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for the specific language governing rights and limitations under the License.
+
+	The Initial Developer of the Original Code is Justin Olbrantz. The Original Code Copyright (C) 2007 Justin Olbrantz. All Rights Reserved.
+*/
+
+// Prevent this header from being included multiple times
+#ifndef MPQVERIFY_H
+#define MPQVERIFY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "MPQArchive.h"
+
+/*
+	MPQVerify checks the integrity of a set of archives, such as all the patch MPQs of a mod, in one pass. Every file in every archive is read in full, and checked against whatever checksums the archive keeps: the Adler-32 of each sector for MPQ_FILE_SECTOR_CRC files, and the CRC32 and MD5 of each file in (attributes). The tables are checked against the MD5s in the header of format version 4 archives, and for files whose data overlaps.
+	The files of all the archives are checked together, largest first, on several threads, so that one large archive doesn't leave the other threads idle. An archive which can't be opened is reported, and the others are still checked.
+	(signature) is not checked, as that needs Blizzard's public keys; it is read like any other file.
+*/
+
+// The handle to a verification
+typedef struct MPQVERIFY *HMPQVERIFY;
+
+// Checks made on an archive as a whole, and problems found by them (MPQVERIFYARCHIVE::grfChecked and grfProblems)
+#define MPQ_VERIFY_HEADER_MD5 0x00000001	// The MD5 of the header
+#define MPQ_VERIFY_TABLE_MD5 0x00000002	// The MD5s of the tables
+#define MPQ_VERIFY_FILE_OVERLAP 0x00000004	// Files' data partly overlapping other files'
+#define MPQ_VERIFY_ATTRIBUTES 0x00000008	// Whether (attributes) can be read and has the right size for the block table
+
+#define NUM_MPQ_VERIFY_ARCHIVE_CHECKS 4
+
+// Checks made on a file, and problems found by them (MPQVERIFYFILE::grfChecked and grfProblems)
+#define MPQ_VERIFY_SECTOR_CRC 0x00000001	// The Adler-32 of each sector
+#define MPQ_VERIFY_FILE_CRC32 0x00000002	// The CRC32 in (attributes)
+#define MPQ_VERIFY_FILE_MD5 0x00000004	// The MD5 in (attributes)
+
+#define NUM_MPQ_VERIFY_FILE_CHECKS 3
+
+// The results for one archive
+struct MPQVERIFYARCHIVE
+{
+	// Why the archive couldn't be opened, or MPQ_ERROR_SUCCESS. If it couldn't, nothing else is filled in.
+	MPQERROR error;
+	// The information gathered while opening the archive, including its warnings
+	MPQARCHIVEINFO info;
+
+	// The checks made on the archive as a whole (MPQ_VERIFY_*), and those which failed
+	uint32_t grfChecked;
+	uint32_t grfProblems;
+
+	// The archive's files, MPQGetVerifyFiles()[iFirstFile] on. Each block that a hash table entry refers to is one file.
+	uint32_t iFirstFile;
+	uint32_t nFiles;
+
+	// The number of files which are corrupt: which failed a check or couldn't be read
+	uint32_t nBadFiles;
+	// The number of files which couldn't be read for reasons that don't mean they're corrupt: unknown keys or unsupported compression methods
+	uint32_t nUncheckedFiles;
+};
+
+// The results for one file
+struct MPQVERIFYFILE
+{
+	// The archive the file is in
+	uint32_t iArchive;
+	// The file's block, and the first hash table entry referring to it
+	uint32_t iBlock;
+	uint32_t iHashEntry;
+
+	// The file's name, or NULL if it isn't known
+	const char *lpszName;
+
+	// Why the file couldn't be read, or MPQ_ERROR_SUCCESS. MPQ_ERROR_UNKNOWN_KEY and MPQ_ERROR_UNSUPPORTED_COMPRESSION mean the file couldn't be checked; its sector checksums are still checked if it has them.
+	MPQERROR error;
+
+	// The checks made on the file (MPQ_VERIFY_*), and those which failed
+	uint32_t grfChecked;
+	uint32_t grfProblems;
+};
+
+/*
+	* MPQVerifyArchives *
+	Opens and checks a set of archives. Fails only if there isn't enough memory; problems with the archives are in the results.
+*/
+MPQERROR MPQVerifyArchives(
+	// The files containing the archives
+	const char *const *lplpszArchives,
+	// The number of archives
+	uint32_t nArchives,
+	// Names of files, in addition to those in the archives' list files, separated by line breaks or semicolons, as in a list file. May be NULL.
+	const char *lpszNames,
+	// The size of the names, in bytes
+	size_t cbNames,
+	// The number of threads to use, or 0 for one for each processor
+	uint32_t nThreads,
+	// The handle to the results
+	HMPQVERIFY *lphVerify
+);
+
+/*
+	* MPQCloseVerify *
+	Frees the results of MPQVerifyArchives. All pointers obtained from them become invalid.
+*/
+void MPQCloseVerify(
+	// The results to free
+	HMPQVERIFY hVerify
+);
+
+/*
+	* MPQGetVerifyArchives *
+	Gets the results for each archive, in the order given to MPQVerifyArchives.
+*/
+const MPQVERIFYARCHIVE *MPQGetVerifyArchives(
+	// The results
+	HMPQVERIFY hVerify
+);
+
+/*
+	* MPQGetVerifyFiles *
+	Gets the results for each file of all the archives, in the order of the archives, and by block within each archive.
+*/
+const MPQVERIFYFILE *MPQGetVerifyFiles(
+	// The results
+	HMPQVERIFY hVerify,
+	// The number of files. May be NULL.
+	uint32_t *lpnFiles
+);
+
+/*
+	* MPQGetVerifyCheckString *
+	Gets a description of a single archive or file check, suitable for showing to the user. Returns NULL if dwCheck is not a single known check.
+*/
+const char *MPQGetVerifyCheckString(
+	// The check (one MPQ_VERIFY_* value)
+	uint32_t dwCheck,
+	// Whether the check is an archive check, rather than a file check
+	bool bArchiveCheck
+);
+
+#endif // #ifndef MPQVERIFY_H
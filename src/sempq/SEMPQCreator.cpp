@@ -14,17 +14,21 @@
 #ifdef _WIN32
 #include "SEMPQData.h"
 #include "../core/PatcherFlags.h"
+#include "../common/QChecksum.h"
 #include "../common/QResource.h"
+#include "../mpq/MPQArchive.h"
 #include "../app/resource_ids.h"
 #include <windows.h>
 #include <stdio.h>
 #include <shlwapi.h>
+#include <algorithm>
 
 /////////////////////////////////////////////////////////////////////////////
 // Forward declarations
 /////////////////////////////////////////////////////////////////////////////
 
 static STUBDATA* CreateStubDataFromParams(const SEMPQCreationParams& params, std::string& errorMessage);
+static bool GetPatcherDLL(LPCVOID* lplpvDLL, DWORD* lpdwDLLSize, LPBYTE lpbyHash);
 
 /////////////////////////////////////////////////////////////////////////////
 // SEMPQCreator implementation
@@ -63,6 +67,18 @@ bool SEMPQCreator::createSEMPQ(
 		return false;
 	}
 
+	// Make sure the game will be able to open the MPQ, before spending time on the SEMPQ
+	MPQERROR mpqError = MPQValidateArchive(params.mpqPath.c_str(), NULL);
+	if (mpqError != MPQ_ERROR_SUCCESS)
+	{
+		errorMessage = "The MPQ file is invalid: " + params.mpqPath + "\n" + MPQGetErrorString(mpqError);
+		return false;
+	}
+
+	// Step 0: Make sure a thin SEMPQ will be able to run here
+	if (params.thinSEMPQ && !installSharedRuntime(errorMessage))
+		return false;
+
 	// Step 1: Write stub to SEMPQ
 	if (!writeStubToSEMPQ(params, progressCallback, cancellationCheck, errorMessage))
 		return false;
@@ -82,6 +98,13 @@ bool SEMPQCreator::createSEMPQ(
 	if (!writeMPQToSEMPQ(params, progressCallback, cancellationCheck, errorMessage))
 		return false;
 
+	// Step 4: Read the plugins back, so that a bad disk or a bug is caught here
+	// rather than by the players
+	if (progressCallback)
+		progressCallback(VERIFY_INITIAL_PROGRESS, "Verifying Plugins...\n");
+	if (!verifySEMPQPlugins(params.outputPath, 0, errorMessage))
+		return false;
+
 	// Success!
 	if (progressCallback)
 		progressCallback(WRITE_FINISHED, "SEMPQ created successfully!");
@@ -207,16 +230,19 @@ bool SEMPQCreator::writePluginsToSEMPQ(
 
 	// First, extract the MPQDraft patcher DLL to a temporary file.
 	// This DLL is REQUIRED for the SEMPQ to function - the stub executable
-	// loads it to perform the actual patching.
+	// loads it to perform the actual patching. Thin SEMPQs get it from the
+	// shared runtime instead.
 	char szPatcherDLLPath[MAX_PATH + 1];
-	if (!ExtractTempResource(NULL, MAKEINTRESOURCE(IDR_PATCHERDLL), "DLL", szPatcherDLLPath))
+	if (!params.thinSEMPQ
+		&& !ExtractTempResource(NULL, MAKEINTRESOURCE(IDR_PATCHERDLL), "DLL", szPatcherDLLPath))
 	{
 		errorMessage = "Unable to extract patcher DLL from resources";
 		return false;
 	}
 
 	// Open the EFS file for writing. We always need to create the EFS file
-	// because the patcher DLL must be embedded even if there are no user plugins.
+	// because the patcher DLL must be embedded even if there are no user
+	// plugins, and the stub expects to find one even in thin SEMPQs.
 	EFSHANDLEFORWRITE hEFSFile = OpenEFSFileForWrite(params.outputPath.c_str(), 0);
 	if (!hEFSFile)
 	{
@@ -226,14 +252,16 @@ bool SEMPQCreator::writePluginsToSEMPQ(
 
 	bool bRetVal = false, bCancel = false;
 
+	// Modules are compressed where it helps, which shrinks the SEMPQ and what the
+	// stub has to read from disk on every launch.
 	// First, add the MPQDraft patcher DLL with the required component/module IDs.
 	// The stub executable looks for this specific DLL by these IDs.
 	// Note: bExecute (dwData) must be FALSE - the patcher DLL is not a plugin,
 	// it's loaded directly by the stub to perform patching.
-	if (!AddToEFSFile(hEFSFile, szPatcherDLLPath,
+	if (!params.thinSEMPQ && !AddToEFSFile(hEFSFile, szPatcherDLLPath,
 		MPQDRAFT_COMPONENT,
 		MPQDRAFTDLL_MODULE,
-		FALSE, 0))  // bExecute=FALSE - not a plugin
+		FALSE, EFS_ADD_COMPRESS))  // bExecute=FALSE - not a plugin
 	{
 		errorMessage = "Unable to write patcher DLL to EFS file";
 		CloseEFSFileForWrite(hEFSFile);
@@ -250,7 +278,7 @@ bool SEMPQCreator::writePluginsToSEMPQ(
 		if (!AddToEFSFile(hEFSFile, module.szModuleFileName,
 			module.dwComponentID,
 			module.dwModuleID,
-			module.bExecute, 0))
+			module.bExecute, EFS_ADD_COMPRESS))
 			break;
 
 		// Update the progress bar
@@ -406,7 +434,7 @@ bool SEMPQCreator::writeMPQToSEMPQ(
 	delete [] lpbyReadBuffer;
 
 	if (bRetVal && progressCallback)
-		progressCallback(WRITE_FINISHED, "Writing MPQ Data...\n");
+		progressCallback(WRITE_MPQ_INITIAL_PROGRESS + WRITE_MPQ_PROGRESS_SIZE, "Writing MPQ Data...\n");
 
 	CloseHandle(hMPQ);
 	CloseHandle(hSEMPQ);
@@ -414,6 +442,200 @@ bool SEMPQCreator::writeMPQToSEMPQ(
 	return bRetVal;
 }
 
+bool SEMPQCreator::verifySEMPQPlugins(
+	const std::string& sempqPath,
+	uint64_t mpqOffset,
+	std::string& errorMessage)
+{
+	HANDLE hSEMPQ = CreateFile(sempqPath.c_str(), GENERIC_READ,
+		FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+	if (hSEMPQ == INVALID_HANDLE_VALUE)
+	{
+		errorMessage = "Unable to open file: " + sempqPath;
+		return false;
+	}
+
+	// Only an executable can be an SEMPQ; anything else, such as a plain MPQ,
+	// isn't worth searching for plugins
+	char szSignature[2];
+	DWORD dwBytesRead;
+	if (!ReadFile(hSEMPQ, szSignature, sizeof(szSignature), &dwBytesRead, NULL)
+		|| (dwBytesRead != sizeof(szSignature)) || memcmp(szSignature, "MZ", 2))
+	{
+		CloseHandle(hSEMPQ);
+		return true;
+	}
+
+	// The EFS file goes between the stub and the MPQ, so there's no need to
+	// search the MPQ, which is most of the file. An MPQ past 4 GB leaves the
+	// search unlimited, as the EFS code can't address that far anyway.
+	DWORD dwSearchLimit = (mpqOffset <= 0xFFFFFFFF) ? (DWORD)mpqOffset : 0;
+
+	// A file without an EFS file has no plugins to be corrupt
+	EFSHANDLEFORREAD hEFSFile = OpenEFSFileForRead(hSEMPQ, 0, dwSearchLimit);
+	if (!hEFSFile)
+	{
+		CloseHandle(hSEMPQ);
+		return true;
+	}
+
+	DWORD dwBadFileIndex;
+	bool bRetVal = VerifyEFSFiles(hEFSFile, 0, &dwBadFileIndex) != FALSE;
+	if (!bRetVal)
+	{
+		DWORD dwComponentID = 0, dwFileID = 0;
+		EnumEFSFiles(hEFSFile, dwBadFileIndex, &dwComponentID, &dwFileID, NULL, NULL);
+
+		char szIDs[32];
+		sprintf(szIDs, "%08X/%08X", dwComponentID, dwFileID);
+		errorMessage = std::string("Plugin module ") + szIDs + " is corrupt in " + sempqPath;
+	}
+
+	CloseEFSFileForRead(hEFSFile);
+	CloseHandle(hSEMPQ);
+
+	return bRetVal;
+}
+
+bool SEMPQCreator::updateSEMPQPlugins(
+	const std::string& sempqPath,
+	const std::vector<MPQDRAFTPLUGINMODULE>& pluginModules,
+	const std::vector<uint32_t>& removeComponentIDs,
+	ProgressCallback progressCallback,
+	CancellationCheck cancellationCheck,
+	std::string& errorMessage)
+{
+	if (progressCallback)
+		progressCallback(0, "Reading Plugins...\n");
+
+	// Find out what's in the SEMPQ now. The write handle can't enumerate.
+	HANDLE hSEMPQ = CreateFile(sempqPath.c_str(), GENERIC_READ,
+		FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+	if (hSEMPQ == INVALID_HANDLE_VALUE)
+	{
+		errorMessage = "Unable to open file: " + sempqPath;
+		return false;
+	}
+
+	EFSHANDLEFORREAD hEFSFileForRead = OpenEFSFileForRead(hSEMPQ, 0, 0);
+	if (!hEFSFileForRead)
+	{
+		errorMessage = "Not a SEMPQ: " + sempqPath;
+		CloseHandle(hSEMPQ);
+		return false;
+	}
+
+	std::vector<std::pair<DWORD, DWORD>> existingModules;
+	DWORD nEFSFiles = GetNumEFSFiles(hEFSFileForRead);
+	for (DWORD iEFSFile = 0; iEFSFile < nEFSFiles; iEFSFile++)
+	{
+		DWORD dwComponentID, dwFileID;
+		if (EnumEFSFiles(hEFSFileForRead, iEFSFile, &dwComponentID, &dwFileID, NULL, NULL))
+			existingModules.push_back(std::make_pair(dwComponentID, dwFileID));
+	}
+
+	CloseEFSFileForRead(hEFSFileForRead);
+	CloseHandle(hSEMPQ);
+
+	// Work out which modules go: those of removed plugins, and those replaced
+	// plugins no longer have. The patcher DLL is never touched.
+	std::vector<std::pair<DWORD, DWORD>> deleteModules;
+	for (size_t iModule = 0; iModule < existingModules.size(); iModule++)
+	{
+		DWORD dwComponentID = existingModules[iModule].first, dwFileID = existingModules[iModule].second;
+		if (dwComponentID == MPQDRAFT_COMPONENT)
+			continue;
+
+		bool bRemoved = std::find(removeComponentIDs.begin(), removeComponentIDs.end(), dwComponentID) != removeComponentIDs.end(),
+			bReplaced = false, bKept = false;
+		for (size_t iNewModule = 0; iNewModule < pluginModules.size(); iNewModule++)
+		{
+			if (pluginModules[iNewModule].dwComponentID != dwComponentID)
+				continue;
+
+			bReplaced = true;
+			if (pluginModules[iNewModule].dwModuleID == dwFileID)
+				bKept = true;
+		}
+
+		if (bRemoved || (bReplaced && !bKept))
+			deleteModules.push_back(existingModules[iModule]);
+	}
+
+	EFSHANDLEFORWRITE hEFSFile = OpenEFSFileForWrite(sempqPath.c_str(), 0);
+	if (!hEFSFile)
+	{
+		errorMessage = "Unable to open EFS file for writing";
+		return false;
+	}
+
+	bool bSuccess = true;
+	for (size_t iModule = 0; bSuccess && iModule < deleteModules.size(); iModule++)
+	{
+		if (!DeleteFromEFSFile(hEFSFile, deleteModules[iModule].first, deleteModules[iModule].second))
+		{
+			errorMessage = "Unable to remove plugins from file: " + sempqPath;
+			bSuccess = false;
+		}
+	}
+
+	// Replacing keeps each module's place in the EFS file, and so the order
+	// the stub loads the plugins in
+	bool bCancel = false;
+	for (size_t iModule = 0; bSuccess && iModule < pluginModules.size(); iModule++)
+	{
+		const MPQDRAFTPLUGINMODULE& module = pluginModules[iModule];
+		if (!ReplaceInEFSFile(hEFSFile, module.szModuleFileName,
+			module.dwComponentID,
+			module.dwModuleID,
+			module.bExecute, EFS_ADD_COMPRESS))
+		{
+			errorMessage = "Unable to write plugins to file: " + sempqPath;
+			bSuccess = false;
+			break;
+		}
+
+		int progress = (int)((float)(iModule + 1) * 90.0f / (float)pluginModules.size());
+		if (progressCallback)
+			progressCallback(progress, "Writing Plugins...\n");
+
+		if (cancellationCheck && cancellationCheck())
+		{
+			// The modules written so far are complete, so stopping here leaves a
+			// working SEMPQ with some of the plugins updated
+			errorMessage = "Operation cancelled by user";
+			bCancel = true;
+			break;
+		}
+	}
+
+	// Give the space of the old modules back to the EFS file, so that the
+	// SEMPQ doesn't grow every time a plugin is updated
+	if (bSuccess && !bCancel && !CompactEFSFile(hEFSFile))
+	{
+		errorMessage = "Unable to compact the plugins in file: " + sempqPath;
+		bSuccess = false;
+	}
+
+	if (!CloseEFSFileForWrite(hEFSFile) && bSuccess)
+	{
+		errorMessage = "Unable to write to file: " + sempqPath;
+		bSuccess = false;
+	}
+
+	if (!bSuccess || bCancel)
+		return false;
+
+	if (progressCallback)
+		progressCallback(VERIFY_INITIAL_PROGRESS, "Verifying Plugins...\n");
+	if (!verifySEMPQPlugins(sempqPath, 0, errorMessage))
+		return false;
+
+	if (progressCallback)
+		progressCallback(WRITE_FINISHED, "SEMPQ updated successfully!");
+	return true;
+}
+
 // Helper: Create STUBDATA structure from parameters
 static STUBDATA* CreateStubDataFromParams(const SEMPQCreationParams& params, std::string& errorMessage)
 {
@@ -499,6 +721,17 @@ static STUBDATA* CreateStubDataFromParams(const SEMPQCreationParams& params, std
 		return nullptr;
 	}
 
+	// The stub uses the shared runtime in place of the embedded patcher DLL
+	// if it has this exact DLL, so record which DLL this is
+	LPCVOID lpvPatcherDLL;
+	DWORD dwPatcherDLLSize;
+	BYTE byPatcherDLLHash[PATCHER_DLL_HASH_SIZE];
+	if (!GetPatcherDLL(&lpvPatcherDLL, &dwPatcherDLLSize, byPatcherDLLHash))
+	{
+		errorMessage = "Unable to load patcher DLL from resources";
+		return nullptr;
+	}
+
 	// Allocate space for all the data
 	STUBDATA* pDataSEMPQ = (STUBDATA*)new BYTE[nStubSize];
 	if (!pDataSEMPQ)
@@ -514,6 +747,10 @@ static STUBDATA* CreateStubDataFromParams(const SEMPQCreationParams& params, std
 	strncpy(pDataSEMPQ->szCustomName, params.sempqName.c_str(), sizeof(pDataSEMPQ->szCustomName) - 1);
 	pDataSEMPQ->szCustomName[sizeof(pDataSEMPQ->szCustomName) - 1] = '\0';
 
+	pDataSEMPQ->grfStubFlags = params.thinSEMPQ ? SEMPQ_THIN : 0;
+	pDataSEMPQ->dwPatcherDLLSize = dwPatcherDLLSize;
+	memcpy(pDataSEMPQ->byPatcherDLLHash, byPatcherDLLHash, sizeof(byPatcherDLLHash));
+
 	// Set up the string pointers for the patch target
 	PATCHTARGETEX& patchTarget = pDataSEMPQ->patchTarget;
 
@@ -557,6 +794,175 @@ static STUBDATA* CreateStubDataFromParams(const SEMPQCreationParams& params, std
 	return pDataSEMPQ;
 }
 
+// Helper: Get the patcher DLL embedded in MPQDraft, and its SHA-256
+static bool GetPatcherDLL(LPCVOID* lplpvDLL, DWORD* lpdwDLLSize, LPBYTE lpbyHash)
+{
+	if (!LookupResource(NULL, MAKEINTRESOURCE(IDR_PATCHERDLL), "DLL", lplpvDLL, lpdwDLLSize))
+		return false;
+
+	QChecksumSHA256(*lplpvDLL, *lpdwDLLSize, lpbyHash);
+
+	return true;
+}
+
+// Helper: Check whether a file holds exactly the given data
+static bool FileMatchesData(const char* lpszFileName, LPCVOID lpvData, DWORD dwDataSize)
+{
+	HANDLE hFile = CreateFile(lpszFileName, GENERIC_READ, FILE_SHARE_READ,
+		NULL, OPEN_EXISTING, 0, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	bool bRetVal = false;
+	DWORD dwFileSizeHigh, dwFileSize = GetFileSize(hFile, &dwFileSizeHigh);
+	if (dwFileSize == dwDataSize && !dwFileSizeHigh)
+	{
+		LPBYTE lpbyFileData = new BYTE[dwFileSize];
+		DWORD dwBytesRead;
+
+		bRetVal = ReadFile(hFile, lpbyFileData, dwFileSize, &dwBytesRead, NULL)
+			&& (dwBytesRead == dwFileSize)
+			&& !memcmp(lpbyFileData, lpvData, dwFileSize);
+
+		delete [] lpbyFileData;
+	}
+
+	CloseHandle(hFile);
+
+	return bRetVal;
+}
+
+bool SEMPQCreator::installSharedRuntime(std::string& errorMessage)
+{
+	LPCVOID lpvPatcherDLL;
+	DWORD dwPatcherDLLSize;
+	BYTE byPatcherDLLHash[PATCHER_DLL_HASH_SIZE];
+	if (!GetPatcherDLL(&lpvPatcherDLL, &dwPatcherDLLSize, byPatcherDLLHash))
+	{
+		errorMessage = "Unable to load patcher DLL from resources";
+		return false;
+	}
+
+	// Use the runtime directory already registered for this user, if any;
+	// otherwise create one in the user's local application data
+	char szRuntimeDir[MAX_PATH + 1] = {0};
+	bool bRegistered = false;
+
+	HKEY hKey;
+	if (RegOpenKeyEx(HKEY_CURRENT_USER, SHARED_RUNTIME_KEY, 0, KEY_READ, &hKey) == ERROR_SUCCESS)
+	{
+		char szValue[MAX_PATH + 1];
+		DWORD dwValueType, dwValueSize = MAX_PATH;
+		if (RegQueryValueEx(hKey, SHARED_RUNTIME_DIR_VALUE, NULL, &dwValueType, (LPBYTE)szValue, &dwValueSize) == ERROR_SUCCESS
+			&& ((dwValueType == REG_SZ) || (dwValueType == REG_EXPAND_SZ)) && dwValueSize)
+		{
+			szValue[dwValueSize < MAX_PATH ? dwValueSize : MAX_PATH] = '\0';
+
+			if (dwValueType == REG_EXPAND_SZ)
+			{
+				DWORD nLength = ExpandEnvironmentStrings(szValue, szRuntimeDir, MAX_PATH + 1);
+				if (!nLength || nLength > MAX_PATH + 1)
+					szRuntimeDir[0] = '\0';
+			}
+			else
+				strcpy(szRuntimeDir, szValue);
+
+			bRegistered = (szRuntimeDir[0] != '\0');
+		}
+
+		RegCloseKey(hKey);
+	}
+
+	if (!bRegistered)
+	{
+		DWORD nLength = GetEnvironmentVariable("LOCALAPPDATA", szRuntimeDir, MAX_PATH + 1);
+		if (!nLength || nLength > MAX_PATH)
+			nLength = GetEnvironmentVariable("APPDATA", szRuntimeDir, MAX_PATH + 1);
+		if (!nLength || nLength > MAX_PATH || !PathAppend(szRuntimeDir, "MPQDraft"))
+		{
+			errorMessage = "Unable to find a directory for the shared MPQDraft runtime";
+			return false;
+		}
+
+		CreateDirectory(szRuntimeDir, NULL);
+		if (!PathAppend(szRuntimeDir, "Runtime"))
+		{
+			errorMessage = "Unable to find a directory for the shared MPQDraft runtime";
+			return false;
+		}
+	}
+
+	if (!CreateDirectory(szRuntimeDir, NULL) && GetLastError() != ERROR_ALREADY_EXISTS)
+	{
+		errorMessage = std::string("Unable to create directory: ") + szRuntimeDir;
+		return false;
+	}
+
+	// Install the DLL, unless this version is already there. It's written
+	// to a temporary file first, so that a stub never sees it half written.
+	char szHash[QCHECKSUM_SHA256_STRING_SIZE], szDLLName[MAX_PATH + 1], szDLLPath[MAX_PATH + 1];
+	QChecksumFormatSHA256(byPatcherDLLHash, szHash);
+	sprintf(szDLLName, SHARED_RUNTIME_DLL_FORMAT, szHash);
+
+	strcpy(szDLLPath, szRuntimeDir);
+	if (!PathAppend(szDLLPath, szDLLName))
+	{
+		errorMessage = std::string("Path too long: ") + szRuntimeDir;
+		return false;
+	}
+
+	if (!FileMatchesData(szDLLPath, lpvPatcherDLL, dwPatcherDLLSize))
+	{
+		char szTempPath[MAX_PATH + 1];
+		if (!GetTempFileName(szRuntimeDir, "MQD", 0, szTempPath))
+		{
+			errorMessage = std::string("Unable to write to directory: ") + szRuntimeDir;
+			return false;
+		}
+
+		HANDLE hDLLFile = CreateFile(szTempPath, GENERIC_WRITE, 0,
+			NULL, CREATE_ALWAYS, 0, NULL);
+		DWORD dwBytesWritten = 0;
+		bool bWritten = (hDLLFile != INVALID_HANDLE_VALUE)
+			&& WriteFile(hDLLFile, lpvPatcherDLL, dwPatcherDLLSize, &dwBytesWritten, NULL)
+			&& (dwBytesWritten == dwPatcherDLLSize);
+
+		if (hDLLFile != INVALID_HANDLE_VALUE)
+			CloseHandle(hDLLFile);
+
+		if (!bWritten || !MoveFileEx(szTempPath, szDLLPath, MOVEFILE_REPLACE_EXISTING))
+		{
+			DeleteFile(szTempPath);
+
+			errorMessage = std::string("Unable to install the shared MPQDraft runtime: ") + szDLLPath;
+			return false;
+		}
+	}
+
+	// Finally, tell the stubs where to find it
+	if (!bRegistered)
+	{
+		if (RegCreateKeyEx(HKEY_CURRENT_USER, SHARED_RUNTIME_KEY, 0, NULL, 0,
+			KEY_SET_VALUE, NULL, &hKey, NULL) != ERROR_SUCCESS)
+		{
+			errorMessage = "Unable to register the shared MPQDraft runtime";
+			return false;
+		}
+
+		LONG nError = RegSetValueEx(hKey, SHARED_RUNTIME_DIR_VALUE, 0, REG_SZ,
+			(const BYTE*)szRuntimeDir, (DWORD)strlen(szRuntimeDir) + 1);
+		RegCloseKey(hKey);
+
+		if (nError != ERROR_SUCCESS)
+		{
+			errorMessage = "Unable to register the shared MPQDraft runtime";
+			return false;
+		}
+	}
+
+	return true;
+}
+
 /////////////////////////////////////////////////////////////////////////////
 // Icon file structures (for reading .ico files)
 /////////////////////////////////////////////////////////////////////////////
@@ -829,4 +1235,39 @@ bool SEMPQCreator::writeIconToSEMPQ(
 	return false;
 }
 
+bool SEMPQCreator::verifySEMPQPlugins(
+	const std::string& sempqPath,
+	uint64_t mpqOffset,
+	std::string& errorMessage)
+{
+    (void)sempqPath;         // Suppress unused parameter warning
+    (void)mpqOffset;         // Suppress unused parameter warning
+	errorMessage = "SEMPQ verification is only supported on Windows";
+	return false;
+}
+
+bool SEMPQCreator::updateSEMPQPlugins(
+	const std::string& sempqPath,
+	const std::vector<MPQDRAFTPLUGINMODULE>& pluginModules,
+	const std::vector<uint32_t>& removeComponentIDs,
+	ProgressCallback progressCallback,
+	CancellationCheck cancellationCheck,
+	std::string& errorMessage)
+{
+    (void)sempqPath;          // Suppress unused parameter warning
+    (void)pluginModules;      // Suppress unused parameter warning
+    (void)removeComponentIDs; // Suppress unused parameter warning
+    (void)progressCallback;   // Suppress unused parameter warning
+    (void)cancellationCheck;  // Suppress unused parameter warning
+	errorMessage = "SEMPQ creation is only supported on Windows";
+	return false;
+}
+
+bool SEMPQCreator::installSharedRuntime(
+	std::string& errorMessage)
+{
+	errorMessage = "The shared MPQDraft runtime is only supported on Windows";
+	return false;
+}
+
 #endif // _WIN32
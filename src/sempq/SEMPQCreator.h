@@ -56,6 +56,12 @@ struct SEMPQCreationParams
 
 	// Plugins (with full metadata including component/module IDs)
 	std::vector<MPQDRAFTPLUGINMODULE> pluginModules;
+
+	// If true, the patcher DLL is not embedded; the SEMPQ uses the shared
+	// MPQDraft runtime installed on the machine instead. The runtime is
+	// installed on this machine when the SEMPQ is created; players install
+	// it by running the same version of MPQDraft (see installSharedRuntime).
+	bool thinSEMPQ = false;
 };
 
 /////////////////////////////////////////////////////////////////////////////
@@ -70,7 +76,8 @@ public:
 	static constexpr int WRITE_PLUGINS_INITIAL_PROGRESS = 5;
 	static constexpr int WRITE_PLUGINS_PROGRESS_SIZE = 15;
 	static constexpr int WRITE_MPQ_INITIAL_PROGRESS = 20;
-	static constexpr int WRITE_MPQ_PROGRESS_SIZE = 80;
+	static constexpr int WRITE_MPQ_PROGRESS_SIZE = 79;
+	static constexpr int VERIFY_INITIAL_PROGRESS = 99;
 	static constexpr int WRITE_FINISHED = 100;
 
 	// Main entry point: Create a complete SEMPQ file
@@ -84,6 +91,37 @@ public:
 		std::string& errorMessage
 	);
 
+	// Check the checksums of the plugins embedded in an existing SEMPQ, on several threads
+	// Only executables are searched, and only up to mpqOffset, where the MPQ starts (0 to search the whole file)
+	// Returns true if they are all intact, or the file has no embedded plugins
+	bool verifySEMPQPlugins(
+		const std::string& sempqPath,
+		uint64_t mpqOffset,
+		std::string& errorMessage
+	);
+
+	// Replace or add plugin modules in an existing SEMPQ, and remove the plugins
+	// with the given component IDs, without rewriting the stub or the MPQ.
+	// Modules a replaced plugin no longer has are removed along with it.
+	// Returns true on success; on failure, the SEMPQ may have been damaged
+	bool updateSEMPQPlugins(
+		const std::string& sempqPath,
+		const std::vector<MPQDRAFTPLUGINMODULE>& pluginModules,
+		const std::vector<uint32_t>& removeComponentIDs,
+		ProgressCallback progressCallback,
+		CancellationCheck cancellationCheck,
+		std::string& errorMessage
+	);
+
+	// Install the patcher DLL as the shared runtime on this machine, for
+	// thin SEMPQs to use, and register it for the current user. Does
+	// nothing if this version is already installed. Done when a thin SEMPQ
+	// is created, when the GUI starts, and by the install-runtime command,
+	// so that players can run thin SEMPQs without creating any
+	static bool installSharedRuntime(
+		std::string& errorMessage
+	);
+
 private:
 	// Step 1: Write executable code (0% - 5%)
 	bool writeStubToSEMPQ(
@@ -101,7 +139,7 @@ private:
 		std::string& errorMessage
 	);
 
-	// Step 3: Write MPQ data (20% - 100%)
+	// Step 3: Write MPQ data (20% - 99%)
 	bool writeMPQToSEMPQ(
 		const SEMPQCreationParams& params,
 		ProgressCallback progressCallback,
@@ -109,6 +147,8 @@ private:
 		std::string& errorMessage
 	);
 
+	// Step 4 (verifySEMPQPlugins) reads the plugins back to make sure they were written intact (99% - 100%)
+
 	// Optional: Write custom icon to SEMPQ (called after writeStubToSEMPQ if iconPath is set)
 	bool writeIconToSEMPQ(
 		const SEMPQCreationParams& params,
@@ -18,6 +18,7 @@ typedef int BOOL;
 typedef const char* LPCSTR;
 typedef char* LPSTR;
 typedef unsigned long DWORD;
+typedef unsigned char BYTE;
 #define TRUE 1
 #define FALSE 0
 #endif
@@ -28,6 +29,18 @@ typedef unsigned long DWORD;
 #define STUBDATASIZE 0x400
 #define STUBDATA_KEY 0xD7DCA2D6 // STUBDATA in MPQ hash
 
+// Rather than extracting its own copy of the patcher DLL on every launch, an SEMPQ may use a copy installed on the machine, which all SEMPQs share: the shared runtime. The directory of the shared runtime is given by this registry value, under either HKEY_CURRENT_USER or HKEY_LOCAL_MACHINE. Each version of the patcher DLL in the directory is named after its SHA-256, so that any number of versions may be installed side by side, and an SEMPQ can find the exact version it was created with without searching. The stub checks the SHA-256 of the file before loading it, so a DLL planted under the right name is rejected.
+// The shared runtime is installed by MPQDraft itself: when a thin SEMPQ is created, each time the GUI starts, and by the install-runtime command, so that players need only have run the same version of MPQDraft once.
+#define SHARED_RUNTIME_KEY "Software\\Team MoPaQ\\MPQDraft\\Runtime"
+#define SHARED_RUNTIME_DIR_VALUE "Directory"
+#define SHARED_RUNTIME_DLL_FORMAT "MPQDraftDLL-%s.dll"	// %s is the SHA-256 as 64 hex digits
+
+// The size of the hash the patcher DLL is identified by (SHA-256)
+#define PATCHER_DLL_HASH_SIZE 32
+
+// STUBDATA flags
+#define SEMPQ_THIN 0x1	// The patcher DLL is not embedded in the SEMPQ, and the shared runtime must be used
+
 // The description of the patch target which is stored in an SEMPQ's STUBDATA structure. Note that all pointers are relative offsets from the start of the PATCHTARGETEX when stored in the SEMPQ, and adjusted when loaded into memory. For the exact meaning of fields, see MPQStub.cpp.
 struct PATCHTARGETEX
 {
@@ -68,6 +81,12 @@ struct STUBDATA
 	// The name of the SEMPQ. Used in error messages and things.
 	char szCustomName[32];
 
+	DWORD grfStubFlags;	// SEMPQ_* flags
+
+	// The size and SHA-256 of the patcher DLL the SEMPQ was created with. The shared runtime is only used if it has a DLL which matches both. If the size is 0, the shared runtime is never used.
+	DWORD dwPatcherDLLSize;
+	BYTE byPatcherDLLHash[PATCHER_DLL_HASH_SIZE];
+
 	PATCHTARGETEX patchTarget;
 
 	// The actual strings used in PATCHTARGETEX will reside here
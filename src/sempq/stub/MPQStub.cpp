@@ -9,12 +9,192 @@
 #include <windows.h>
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <shlwapi.h>
+#include <algorithm>
+#include <QChecksum.h>
 #include <QResource.h>
 #include "resource.h"
 #include "../SEMPQData.h"
 #include "../../core/PatcherApi.h"
 
+// Launch profiling. When enabled, either by setting this environment variable or by running the SEMPQ with this switch, the time taken by each phase of the launch is measured, and a one line report is appended to a file as the stub exits. Setting the environment variable to "0" doesn't enable it. If it's set to anything other than "0" or "1", it's the name of the file; otherwise the file is "MPQStub profile.log" in the temporary directory.
+#define PROFILE_ENV_VAR "MPQDRAFT_STUB_PROFILE"
+#define PROFILE_SWITCH "/profile"
+#define PROFILE_FILE_NAME "MPQStub profile.log"
+
+// The phases of the launch, in the order they happen
+enum STUBPHASE
+{
+	PHASE_STARTUP,			// From process creation to WinMain, i.e. the Windows loader and the C runtime
+	PHASE_STUB_DATA,		// FindStubData
+	PHASE_LOCATE_TARGET,	// LocatePatchTarget, including its registry lookups
+	PHASE_SHARED_RUNTIME,	// FindSharedRuntime
+	PHASE_FIND_EFS,			// FindEFSFile
+	PHASE_UNPACK,			// UnpackAuxFiles
+	PHASE_LOAD_PATCHER,		// Loading the patcher DLL
+	PHASE_PATCH,			// MPQDraftPatcher, which doesn't return until the game exits
+	PHASE_CLEANUP,			// Deleting temporary files and shutting down
+
+	NUM_STUB_PHASES
+};
+
+// The names of the phases in the report
+static const LPCSTR lpszStubPhaseNames[NUM_STUB_PHASES] = 
+	{ "startup", "stubdata", "target", "runtime", "efs", "unpack", "dllload", "patcher", "cleanup" };
+
+struct STUBPROFILE
+{
+	BOOL bEnabled;
+
+	// The performance counter frequency, and its value when the current phase started
+	LARGE_INTEGER liFrequency;
+	LARGE_INTEGER liPhaseStart;
+
+	// The time each phase took, in milliseconds, or a negative number if the phase was never reached
+	double dPhaseTimes[NUM_STUB_PHASES];
+
+	char szReportPath[MAX_PATH + 1];
+};
+
+static STUBPROFILE StubProfile;
+
+// Returns whether one of the arguments on a command line is the switch, as a whole. Arguments are separated by spaces and tabs, and quotes keep them together, so that a path containing the switch, such as "C:\\Games\\my/profile mod.exe", doesn't count.
+BOOL HasCommandLineSwitch(IN LPCSTR lpszCommandLine, IN LPCSTR lpszSwitch)
+{
+	if (!lpszCommandLine)
+		return FALSE;
+
+	char szArgument[MAX_PATH + 1];
+	LPCSTR lpszCurChar = lpszCommandLine;
+	while (*lpszCurChar)
+	{
+		while ((*lpszCurChar == ' ') || (*lpszCurChar == '\t'))
+			lpszCurChar++;
+		if (!*lpszCurChar)
+			break;
+
+		// Copy the argument without its quotes. Arguments too long to be the switch are cut short, which is all right, as they can't match anyway.
+		BOOL bInQuotes = FALSE;
+		DWORD nArgumentLen = 0;
+		for (; *lpszCurChar && (bInQuotes || ((*lpszCurChar != ' ') && (*lpszCurChar != '\t'))); lpszCurChar++)
+		{
+			if (*lpszCurChar == '"')
+				bInQuotes = !bInQuotes;
+			else if (nArgumentLen < MAX_PATH)
+				szArgument[nArgumentLen++] = *lpszCurChar;
+		}
+		szArgument[nArgumentLen] = '\0';
+
+		if (!lstrcmpi(szArgument, lpszSwitch))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+// Turns on profiling if it was asked for, and records how long it took the process to get this far
+void StartStubProfile(IN LPCSTR lpszCommandLine)
+{
+	char szEnvValue[MAX_PATH + 1];
+	DWORD dwEnvLen = GetEnvironmentVariable(PROFILE_ENV_VAR, szEnvValue, sizeof(szEnvValue));
+	BOOL bEnvSet = dwEnvLen && (dwEnvLen < sizeof(szEnvValue)) && strcmp(szEnvValue, "0");
+
+	if (!bEnvSet && !HasCommandLineSwitch(lpszCommandLine, PROFILE_SWITCH))
+		return;
+
+	if (bEnvSet && strcmp(szEnvValue, "1"))
+		strcpy(StubProfile.szReportPath, szEnvValue);
+	else
+	{
+		GetTempPath(MAX_PATH - (DWORD)strlen(PROFILE_FILE_NAME), StubProfile.szReportPath);
+		PathAppend(StubProfile.szReportPath, PROFILE_FILE_NAME);
+	}
+
+	if (!QueryPerformanceFrequency(&StubProfile.liFrequency))
+		return;
+
+	for (DWORD iCurPhase = 0; iCurPhase < NUM_STUB_PHASES; iCurPhase++)
+		StubProfile.dPhaseTimes[iCurPhase] = -1.0;
+
+	// The time before WinMain can only be had from the process creation time, which is in 100 ns units
+	FILETIME ftCreation, ftExit, ftKernel, ftUser, ftNow;
+	if (GetProcessTimes(GetCurrentProcess(), &ftCreation, &ftExit, &ftKernel, &ftUser))
+	{
+		GetSystemTimeAsFileTime(&ftNow);
+
+		ULARGE_INTEGER uliCreation, uliNow;
+		uliCreation.LowPart = ftCreation.dwLowDateTime;
+		uliCreation.HighPart = ftCreation.dwHighDateTime;
+		uliNow.LowPart = ftNow.dwLowDateTime;
+		uliNow.HighPart = ftNow.dwHighDateTime;
+
+		if (uliNow.QuadPart >= uliCreation.QuadPart)
+			StubProfile.dPhaseTimes[PHASE_STARTUP] = (double)(uliNow.QuadPart - uliCreation.QuadPart) / 10000.0;
+	}
+
+	QueryPerformanceCounter(&StubProfile.liPhaseStart);
+	StubProfile.bEnabled = TRUE;
+}
+
+// Records the time taken by a phase, which is everything since the end of the last one
+void EndStubPhase(IN STUBPHASE phase)
+{
+	if (!StubProfile.bEnabled)
+		return;
+
+	LARGE_INTEGER liNow;
+	QueryPerformanceCounter(&liNow);
+
+	StubProfile.dPhaseTimes[phase] = (double)(liNow.QuadPart - StubProfile.liPhaseStart.QuadPart) * 1000.0 
+		/ (double)StubProfile.liFrequency.QuadPart;
+	StubProfile.liPhaseStart = liNow;
+}
+
+// Appends the report to the report file. The report is a single line, giving the time, the outcome, the time of each phase in milliseconds, the time until the game was started ("launch"), and the SEMPQ's path. Phases that weren't reached are shown as "-".
+void WriteStubProfile(IN LPCSTR lpszOutcome)
+{
+	if (!StubProfile.bEnabled)
+		return;
+
+	SYSTEMTIME stNow;
+	GetLocalTime(&stNow);
+
+	char szReport[1024 + MAX_PATH];
+	int nLength = sprintf(szReport, "%04u-%02u-%02u %02u:%02u:%02u %s", 
+		stNow.wYear, stNow.wMonth, stNow.wDay, stNow.wHour, stNow.wMinute, stNow.wSecond, lpszOutcome);
+
+	// Everything before the patcher is what the user waits through before the game starts
+	double dLaunchTime = 0.0;
+	for (DWORD iCurPhase = 0; iCurPhase < NUM_STUB_PHASES; iCurPhase++)
+	{
+		if (StubProfile.dPhaseTimes[iCurPhase] < 0.0)
+			nLength += sprintf(szReport + nLength, " %s=-", lpszStubPhaseNames[iCurPhase]);
+		else
+		{
+			nLength += sprintf(szReport + nLength, " %s=%.2f", lpszStubPhaseNames[iCurPhase], StubProfile.dPhaseTimes[iCurPhase]);
+
+			if (iCurPhase < PHASE_PATCH)
+				dLaunchTime += StubProfile.dPhaseTimes[iCurPhase];
+		}
+	}
+
+	char szSEMPQPath[MAX_PATH + 1] = "";
+	GetModuleFileName(NULL, szSEMPQPath, MAX_PATH);
+
+	nLength += sprintf(szReport + nLength, " launch=%.2f \"%s\"\r\n", dLaunchTime, szSEMPQPath);
+
+	// Append, so that a series of launches can be compared
+	HANDLE hReportFile = CreateFile(StubProfile.szReportPath, FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_ALWAYS, 0, NULL);
+	if (hReportFile == INVALID_HANDLE_VALUE)
+		return;
+
+	DWORD dwBytesWritten;
+	WriteFile(hReportFile, szReport, nLength, &dwBytesWritten, NULL);
+
+	CloseHandle(hReportFile);
+}
+
 // Get the stub data in fully usable in-memory form
 BOOL FindStubData(OUT STUBDATA *lpStubData, OUT LPDWORD lpdwDataSize)
 {
@@ -45,12 +225,169 @@ BOOL FindStubData(OUT STUBDATA *lpStubData, OUT LPDWORD lpdwDataSize)
 	return TRUE;
 }
 
-// Locates the actual patch target path and spawn path based on the info in the PATCHTARGETEX
-BOOL LocatePatchTarget(IN PATCHTARGETEX &patchTarget, OUT LPSTR lpszSpawnPath, OUT LPSTR lpszTargetPath)
+// The patch target cache. Finding a patch target through the registry takes several registry lookups and file system checks, which can be slow with roaming profiles or network drives, so the paths found are saved in a file in the user's temporary directory, named after a checksum of the PATCHTARGETEX. The next launch of any SEMPQ for the same target uses the saved paths without checking anything; checking them would cost as much as searching. If the target can't be launched from them, it's searched for again, and the cache updated (see WinMain).
+// Targets which don't use the registry aren't cached, as finding them is no more work than checking the cache.
+#define TARGET_CACHE_FILE_FORMAT "MPQDraft target %08X.cache"
+#define TARGET_CACHE_SIGNATURE 0x4354514D // MQTC
+#define TARGET_CACHE_VERSION 3
+
+// The contents of a patch target cache file
+struct TARGETCACHEFILE
+{
+	DWORD dwSignature;	// TARGET_CACHE_SIGNATURE
+	DWORD dwVersion;	// TARGET_CACHE_VERSION
+
+	// The checksum of the PATCHTARGETEX, which is also in the file name. Checked in case of collisions between file names.
+	DWORD dwTargetChecksum;
+
+	char szSpawnPath[MAX_PATH + 1];
+	char szTargetPath[MAX_PATH + 1];
+
+	// The checksum of all of the above, to detect partially written files
+	DWORD dwChecksum;
+};
+
+// Adds a string to a checksum, including the terminating null. NULL strings are distinct from all non-NULL strings, including empty ones.
+static DWORD ChecksumTargetString(IN DWORD dwChecksum, IN LPCSTR lpszString)
+{
+	if (!lpszString)
+	{
+		BYTE byNullMarker = 0xFF;
+		return QChecksumCRC32C(dwChecksum, &byNullMarker, sizeof(byNullMarker));
+	}
+
+	return QChecksumCRC32C(dwChecksum, lpszString, (DWORD)strlen(lpszString) + 1);
+}
+
+// Computes the checksum of the parts of a PATCHTARGETEX which determine where the patch target is found
+static DWORD ChecksumPatchTarget(IN const PATCHTARGETEX &patchTarget)
+{
+	DWORD dwChecksum = QCHECKSUM_CRC32C_INIT;
+
+	dwChecksum = QChecksumCRC32C(dwChecksum, &patchTarget.bUseRegistry, sizeof(patchTarget.bUseRegistry));
+	dwChecksum = QChecksumCRC32C(dwChecksum, &patchTarget.bValueIsFileName, sizeof(patchTarget.bValueIsFileName));
+
+	dwChecksum = ChecksumTargetString(dwChecksum, patchTarget.lpszRegistryKey);
+	dwChecksum = ChecksumTargetString(dwChecksum, patchTarget.lpszRegistryValue);
+	dwChecksum = ChecksumTargetString(dwChecksum, patchTarget.lpszTargetFileName);
+	dwChecksum = ChecksumTargetString(dwChecksum, patchTarget.lpszSpawnFileName);
+
+	return dwChecksum;
+}
+
+// Gets the path of the cache file for a patch target
+static BOOL GetTargetCachePath(IN DWORD dwTargetChecksum, OUT LPSTR lpszCachePath)
+{
+	char szFileName[MAX_PATH + 1];
+	sprintf(szFileName, TARGET_CACHE_FILE_FORMAT, dwTargetChecksum);
+
+	DWORD nLength = GetTempPath(MAX_PATH + 1, lpszCachePath);
+	if (!nLength || nLength + strlen(szFileName) >= MAX_PATH)
+		return FALSE;
+
+	return PathAppend(lpszCachePath, szFileName);
+}
+
+// Looks up a patch target in the cache. Fails only if it isn't there, or the cache file is damaged.
+static BOOL LookupCachedPatchTarget(IN DWORD dwTargetChecksum, OUT LPSTR lpszSpawnPath, OUT LPSTR lpszTargetPath)
+{
+	char szCachePath[MAX_PATH + 1];
+	if (!GetTargetCachePath(dwTargetChecksum, szCachePath))
+		return FALSE;
+
+	HANDLE hCacheFile = CreateFile(szCachePath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+	if (hCacheFile == INVALID_HANDLE_VALUE)
+		return FALSE;
+
+	TARGETCACHEFILE cacheFile;
+	DWORD dwBytesRead;
+	BOOL bRetVal = ReadFile(hCacheFile, &cacheFile, sizeof(cacheFile), &dwBytesRead, NULL) 
+		&& dwBytesRead == sizeof(cacheFile);
+
+	CloseHandle(hCacheFile);
+
+	if (!bRetVal 
+		|| cacheFile.dwSignature != TARGET_CACHE_SIGNATURE 
+		|| cacheFile.dwVersion != TARGET_CACHE_VERSION 
+		|| cacheFile.dwTargetChecksum != dwTargetChecksum 
+		|| cacheFile.dwChecksum != QChecksumCRC32C(QCHECKSUM_CRC32C_INIT, &cacheFile, offsetof(TARGETCACHEFILE, dwChecksum)))
+		return FALSE;
+
+	// Make sure the paths are terminated before using them
+	cacheFile.szSpawnPath[MAX_PATH] = '\0';
+	cacheFile.szTargetPath[MAX_PATH] = '\0';
+
+	strcpy(lpszSpawnPath, cacheFile.szSpawnPath);
+	strcpy(lpszTargetPath, cacheFile.szTargetPath);
+
+	return TRUE;
+}
+
+// Saves the paths found for a patch target in the cache. Failure is not an error; the target will simply be searched for again next time.
+static void CachePatchTarget(IN DWORD dwTargetChecksum, IN LPCSTR lpszSpawnPath, IN LPCSTR lpszTargetPath)
+{
+	TARGETCACHEFILE cacheFile;
+	ZeroMemory(&cacheFile, sizeof(cacheFile));
+
+	cacheFile.dwSignature = TARGET_CACHE_SIGNATURE;
+	cacheFile.dwVersion = TARGET_CACHE_VERSION;
+	cacheFile.dwTargetChecksum = dwTargetChecksum;
+
+	strcpy(cacheFile.szSpawnPath, lpszSpawnPath);
+	strcpy(cacheFile.szTargetPath, lpszTargetPath);
+
+	cacheFile.dwChecksum = QChecksumCRC32C(QCHECKSUM_CRC32C_INIT, &cacheFile, offsetof(TARGETCACHEFILE, dwChecksum));
+
+	char szCachePath[MAX_PATH + 1];
+	if (!GetTargetCachePath(dwTargetChecksum, szCachePath))
+		return;
+
+	HANDLE hCacheFile = CreateFile(szCachePath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 0, NULL);
+	if (hCacheFile == INVALID_HANDLE_VALUE)
+		return;
+
+	DWORD dwBytesWritten;
+	WriteFile(hCacheFile, &cacheFile, sizeof(cacheFile), &dwBytesWritten, NULL);
+
+	CloseHandle(hCacheFile);
+}
+
+// Removes a patch target from the cache, when it can no longer be found
+static void UncachePatchTarget(IN DWORD dwTargetChecksum)
+{
+	char szCachePath[MAX_PATH + 1];
+	if (GetTargetCachePath(dwTargetChecksum, szCachePath))
+		DeleteFile(szCachePath);
+}
+
+// Locates the actual patch target path and spawn path based on the info in the PATCHTARGETEX. If bUseCache is set, the paths may come from the patch target cache without being checked; lpbFromCache (which may be NULL) receives whether they did, so that the caller can search again with bUseCache clear if the target can't be launched from them.
+BOOL LocatePatchTarget(IN PATCHTARGETEX &patchTarget, OUT LPSTR lpszSpawnPath, OUT LPSTR lpszTargetPath, IN BOOL bUseCache, OUT BOOL *lpbFromCache)
 {
 	char szSpawnPath[MAX_PATH + 1];
 	char szTargetPath[MAX_PATH + 1];
 
+	if (lpbFromCache)
+		*lpbFromCache = FALSE;
+
+	// If this target has been found before, there's no need to search
+	DWORD dwTargetChecksum = 0;
+	if (patchTarget.bUseRegistry)
+	{
+		dwTargetChecksum = ChecksumPatchTarget(patchTarget);
+
+		if (bUseCache && LookupCachedPatchTarget(dwTargetChecksum, szSpawnPath, szTargetPath))
+		{
+			if (lpszSpawnPath)
+				strcpy(lpszSpawnPath, szSpawnPath);
+			if (lpszTargetPath)
+				strcpy(lpszTargetPath, szTargetPath);
+			if (lpbFromCache)
+				*lpbFromCache = TRUE;
+
+			return TRUE;
+		}
+	}
+
 	// First off, see if it uses the registry or drive paths
 	if (patchTarget.bUseRegistry)
 	{
@@ -90,7 +427,10 @@ BOOL LocatePatchTarget(IN PATCHTARGETEX &patchTarget, OUT LPSTR lpszSpawnPath, O
 		}
 
 		if (!bFoundRegKey)
+		{
+			UncachePatchTarget(dwTargetChecksum);
 			return FALSE;
+		}
 
 		// Okay, we found the registry key. Now let's find the file we're looking for
 		strcpy(szSpawnPath, szValue);
@@ -127,7 +467,14 @@ BOOL LocatePatchTarget(IN PATCHTARGETEX &patchTarget, OUT LPSTR lpszSpawnPath, O
 
 	// Verify the paths are correct
 	if (!PathFileExists(szTargetPath) || !PathFileExists(szSpawnPath))
+	{
+		if (patchTarget.bUseRegistry)
+			UncachePatchTarget(dwTargetChecksum);
 		return FALSE;
+	}
+
+	if (patchTarget.bUseRegistry)
+		CachePatchTarget(dwTargetChecksum, szSpawnPath, szTargetPath);
 
 	// Return whatever information is requested
 	if (lpszSpawnPath)
@@ -138,6 +485,184 @@ BOOL LocatePatchTarget(IN PATCHTARGETEX &patchTarget, OUT LPSTR lpszSpawnPath, O
 	return TRUE;
 }
 
+// The extraction cache settings, which are kept with the rest of MPQDraft's settings. The cache is off unless a directory has been set.
+#define EXTRACTION_CACHE_KEY "Software\\Team MoPaQ\\MPQDraft\\ExtractionCache"
+#define EXTRACTION_CACHE_DIR_VALUE "Directory"
+#define EXTRACTION_CACHE_SIZE_VALUE "MaxSizeMB"
+#define DEFAULT_EXTRACTION_CACHE_SIZE_MB 256
+
+// Gets the directory and maximum size of the extraction cache, if the user has enabled it. Returns FALSE if the cache is disabled.
+BOOL GetExtractionCacheSettings(OUT LPSTR lpszCacheDir, OUT ULONGLONG *lpqwMaxCacheSize)
+{
+	assert(lpszCacheDir);
+	assert(lpqwMaxCacheSize);
+
+	HKEY hKey;
+	if (RegOpenKeyEx(HKEY_CURRENT_USER, EXTRACTION_CACHE_KEY, 0, KEY_READ, &hKey) != ERROR_SUCCESS)
+		return FALSE;
+
+	// The directory may contain environment variables, e.g. %LOCALAPPDATA%
+	char szValue[MAX_PATH + 1];
+	DWORD dwValueType, dwValueSize = MAX_PATH;
+	BOOL bEnabled = (RegQueryValueEx(hKey, EXTRACTION_CACHE_DIR_VALUE, NULL, &dwValueType, (LPBYTE)szValue, &dwValueSize) == ERROR_SUCCESS)
+		&& ((dwValueType == REG_SZ) || (dwValueType == REG_EXPAND_SZ)) && dwValueSize;
+
+	if (bEnabled)
+	{
+		szValue[(std::min)(dwValueSize, (DWORD)MAX_PATH)] = '\0';
+
+		if (dwValueType == REG_EXPAND_SZ)
+		{
+			DWORD nLength = ExpandEnvironmentStrings(szValue, lpszCacheDir, MAX_PATH + 1);
+			bEnabled = nLength && (nLength <= MAX_PATH + 1);
+		}
+		else
+			strcpy(lpszCacheDir, szValue);
+
+		bEnabled = bEnabled && (lpszCacheDir[0] != '\0');
+	}
+
+	// The size may be stored as a number or as a string, depending on what wrote it
+	char szSize[16];
+	DWORD dwSizeMB = DEFAULT_EXTRACTION_CACHE_SIZE_MB;
+
+	dwValueSize = sizeof(szSize) - 1;
+	if (RegQueryValueEx(hKey, EXTRACTION_CACHE_SIZE_VALUE, NULL, &dwValueType, (LPBYTE)szSize, &dwValueSize) == ERROR_SUCCESS)
+	{
+		if ((dwValueType == REG_DWORD) && (dwValueSize == sizeof(DWORD)))
+			dwSizeMB = *(LPDWORD)szSize;
+		else if (dwValueType == REG_SZ)
+		{
+			szSize[dwValueSize] = '\0';
+			dwSizeMB = (DWORD)atoi(szSize);
+		}
+	}
+
+	RegCloseKey(hKey);
+
+	*lpqwMaxCacheSize = (ULONGLONG)dwSizeMB << 20;
+
+	return bEnabled;
+}
+
+// The size of the blocks the shared runtime DLL is read in to check it
+#define SHARED_RUNTIME_READ_SIZE 0x10000
+
+// Gets the shared runtime directory registered under one root key. Returns FALSE if there is none.
+BOOL GetSharedRuntimeDir(IN HKEY hRootKey, OUT LPSTR lpszRuntimeDir)
+{
+	assert(lpszRuntimeDir);
+
+	HKEY hKey;
+	if (RegOpenKeyEx(hRootKey, SHARED_RUNTIME_KEY, 0, KEY_READ, &hKey) != ERROR_SUCCESS)
+		return FALSE;
+
+	char szValue[MAX_PATH + 1];
+	DWORD dwValueType, dwValueSize = MAX_PATH;
+	BOOL bRetVal = (RegQueryValueEx(hKey, SHARED_RUNTIME_DIR_VALUE, NULL, &dwValueType, (LPBYTE)szValue, &dwValueSize) == ERROR_SUCCESS)
+		&& ((dwValueType == REG_SZ) || (dwValueType == REG_EXPAND_SZ)) && dwValueSize;
+
+	RegCloseKey(hKey);
+
+	if (!bRetVal)
+		return FALSE;
+
+	szValue[(std::min)(dwValueSize, (DWORD)MAX_PATH)] = '\0';
+
+	if (dwValueType == REG_EXPAND_SZ)
+	{
+		DWORD nLength = ExpandEnvironmentStrings(szValue, lpszRuntimeDir, MAX_PATH + 1);
+		if (!nLength || (nLength > MAX_PATH + 1))
+			return FALSE;
+	}
+	else
+		strcpy(lpszRuntimeDir, szValue);
+
+	return lpszRuntimeDir[0] != '\0';
+}
+
+// Opens the shared runtime's copy of the patcher DLL in a directory, and checks that it's exactly the DLL the SEMPQ was created with. The file is opened without write sharing, so that it can't be changed between being checked and being loaded.
+BOOL OpenSharedRuntimeDLL(IN const STUBDATA &stubData, IN LPCSTR lpszRuntimeDir, OUT LPSTR lpszDLLFileName, OUT HANDLE *lphDLLFile)
+{
+	assert(lpszRuntimeDir);
+	assert(lpszDLLFileName);
+	assert(lphDLLFile);
+
+	char szHash[QCHECKSUM_SHA256_STRING_SIZE], szDLLName[MAX_PATH + 1];
+	QChecksumFormatSHA256(stubData.byPatcherDLLHash, szHash);
+	sprintf(szDLLName, SHARED_RUNTIME_DLL_FORMAT, szHash);
+
+	if (strlen(lpszRuntimeDir) + strlen(szDLLName) + 1 >= MAX_PATH)
+		return FALSE;
+
+	strcpy(lpszDLLFileName, lpszRuntimeDir);
+	PathAppend(lpszDLLFileName, szDLLName);
+
+	HANDLE hDLLFile = CreateFile(lpszDLLFileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hDLLFile == INVALID_HANDLE_VALUE)
+		return FALSE;
+
+	DWORD dwFileSizeHigh, dwFileSize = GetFileSize(hDLLFile, &dwFileSizeHigh);
+	BOOL bRetVal = (dwFileSize == stubData.dwPatcherDLLSize) && !dwFileSizeHigh;
+
+	LPBYTE lpbyReadBuffer = bRetVal ? new BYTE[SHARED_RUNTIME_READ_SIZE] : NULL;
+	if (lpbyReadBuffer)
+	{
+		QCHECKSUMSHA256 hashContext;
+		QChecksumSHA256Init(&hashContext);
+
+		DWORD dwRemaining = dwFileSize;
+		while (dwRemaining)
+		{
+			DWORD dwBlockSize = (std::min)(dwRemaining, (DWORD)SHARED_RUNTIME_READ_SIZE), dwBytesRead;
+			if (!ReadFile(hDLLFile, lpbyReadBuffer, dwBlockSize, &dwBytesRead, NULL) || (dwBytesRead != dwBlockSize))
+				break;
+
+			QChecksumSHA256Update(&hashContext, lpbyReadBuffer, dwBlockSize);
+			dwRemaining -= dwBlockSize;
+		}
+
+		BYTE byHash[QCHECKSUM_SHA256_SIZE];
+		QChecksumSHA256Final(&hashContext, byHash);
+
+		bRetVal = !dwRemaining && !memcmp(byHash, stubData.byPatcherDLLHash, sizeof(byHash));
+
+		delete [] lpbyReadBuffer;
+	}
+	else
+		bRetVal = FALSE;
+
+	if (!bRetVal)
+	{
+		CloseHandle(hDLLFile);
+		return FALSE;
+	}
+
+	*lphDLLFile = hDLLFile;
+
+	return TRUE;
+}
+
+// Finds the shared runtime's copy of the patcher DLL the SEMPQ was created with, if it's installed, first for the current user, then for the machine. On success, the DLL file is left open; the handle should be closed once the DLL has been loaded.
+BOOL FindSharedRuntime(IN const STUBDATA &stubData, OUT LPSTR lpszDLLFileName, OUT HANDLE *lphDLLFile)
+{
+	assert(lpszDLLFileName);
+	assert(lphDLLFile);
+
+	// SEMPQs from old versions of MPQDraft don't say which DLL they need
+	if (!stubData.dwPatcherDLLSize)
+		return FALSE;
+
+	char szRuntimeDir[MAX_PATH + 1];
+
+	if (GetSharedRuntimeDir(HKEY_CURRENT_USER, szRuntimeDir) 
+		&& OpenSharedRuntimeDLL(stubData, szRuntimeDir, lpszDLLFileName, lphDLLFile))
+		return TRUE;
+
+	return GetSharedRuntimeDir(HKEY_LOCAL_MACHINE, szRuntimeDir) 
+		&& OpenSharedRuntimeDLL(stubData, szRuntimeDir, lpszDLLFileName, lphDLLFile);
+}
+
 DWORD GetNumAuxFiles(IN EFSHANDLEFORREAD hEFSFile)
 {
 	assert(hEFSFile);
@@ -145,81 +670,222 @@ DWORD GetNumAuxFiles(IN EFSHANDLEFORREAD hEFSFile)
 	return GetNumEFSFiles(hEFSFile);
 }
 
-// The patcher DLL expects all modules to already exist in files on the hard drive. While this may seem wasteful, there is reason to it; while plugins may not require this for all of their modules, Windows will definitely require at least the DLLs to be loaded to be extracted, so we might as well just do it all now.
-BOOL UnpackAuxFiles(IN EFSHANDLEFORREAD hEFSFile, IN MPQDRAFTPLUGINMODULE *pAuxModules, IN DWORD dwNumAuxFiles, OUT LPSTR lpszDLLFileName)
+// The maximum number of threads UnpackAuxFiles will use. Extraction is mostly waiting on the disk (and the virus scanner), so a few more threads than processors can still help, but not many.
+#define MAX_UNPACK_THREADS 8
+
+// The work shared by the UnpackAuxFiles threads
+struct UNPACKJOB
+{
+	EFSHANDLEFORREAD hEFSFile;
+	MPQDRAFTPLUGINMODULE *pAuxModules;
+	DWORD nNumAuxFiles;
+
+	// The extraction cache, if it's enabled
+	BOOL bUseCache;
+	LPCSTR lpszCacheDir;
+
+	// The shared runtime's patcher DLL, used in place of the embedded one, or NULL
+	LPCSTR lpszSharedDLLFileName;
+
+	// Whether to leave the plugins' modules in the EFS file, for the patcher DLL to read from there
+	BOOL bLeaveModules;
+
+	// The index of the next module to extract. Each thread claims modules by incrementing this.
+	volatile LONG iNextModule;
+	// Set if any module could not be extracted, so that the others can stop early
+	volatile LONG bFailed;
+};
+
+// Extracts modules until there are none left. Run on the helper threads and the calling thread of UnpackAuxFiles.
+DWORD WINAPI UnpackAuxFilesThreadProc(IN LPVOID lpvJob)
+{
+	assert(lpvJob);
+
+	UNPACKJOB *pJob = (UNPACKJOB *)lpvJob;
+
+	while (!pJob->bFailed)
+	{
+		DWORD iCurModule = (DWORD)InterlockedIncrement(&pJob->iNextModule) - 1;
+		if (iCurModule >= pJob->nNumAuxFiles)
+			break;
+
+		DWORD dwComponentID, dwFileID, dwFileData;
+		char szFileName[MAX_PATH + 1];
+
+		if (!EnumEFSFiles(pJob->hEFSFile, iCurModule, &dwComponentID, &dwFileID, &dwFileData, NULL))
+		{
+			InterlockedExchange(&pJob->bFailed, TRUE);
+			break;
+		}
+
+		BOOL bPatcherDLL = (dwComponentID == MPQDRAFT_COMPONENT) && (dwFileID == MPQDRAFTDLL_MODULE);
+
+		// Extract the module, unless it's the patcher DLL and we're using the shared runtime's instead, or it's a plugin's module the patcher DLL can read from the EFS file itself
+		if (pJob->lpszSharedDLLFileName && bPatcherDLL)
+			strcpy(szFileName, pJob->lpszSharedDLLFileName);
+		else if (pJob->bLeaveModules && !bPatcherDLL)
+			szFileName[0] = '\0';
+		else if (!(pJob->bUseCache && ExtractCachedEFSFile(pJob->hEFSFile, dwComponentID, dwFileID, pJob->lpszCacheDir, szFileName))
+			&& !ExtractTempEFSFile(pJob->hEFSFile, dwComponentID, dwFileID, szFileName))
+		{
+			InterlockedExchange(&pJob->bFailed, TRUE);
+			break;
+		}
+
+		// Pass the module info back to the caller. Each thread fills in only the modules it extracted, so the array stays in EFS order.
+		MPQDRAFTPLUGINMODULE *pModule = &pJob->pAuxModules[iCurModule];
+
+		pModule->dwComponentID = dwComponentID;
+		pModule->dwModuleID = dwFileID;
+		strcpy(pModule->szModuleFileName, szFileName);
+		pModule->bExecute = (dwFileData != 0) ? TRUE : FALSE;
+	}
+
+	return 0;
+}
+
+// Windows requires the patcher DLL to exist in a file on the hard drive, as it's loaded here and injected into the game by name, so it's always extracted. If bLeaveModules is set, the plugins' modules are left in the EFS file, with empty file names, for MPQDraftPatcherEx to read from there: plugin DLLs are loaded straight from memory, and other modules read through IMPQDraftServer2. The patcher DLL extracts a module itself only if it has to.
+// If the user has enabled the extraction cache, modules are extracted there instead, and kept for the next launch; this saves both the extraction and the virus scan of the new files. Anything that can't be cached is extracted to a temporary file as usual.
+// Modules are extracted on several threads at once, so that the time this takes depends on the largest module, rather than on all of them together.
+// If the shared runtime is being used, the embedded patcher DLL, if there is one, is not extracted, and the shared runtime's DLL is returned in its place.
+BOOL UnpackAuxFiles(IN EFSHANDLEFORREAD hEFSFile, IN MPQDRAFTPLUGINMODULE *pAuxModules, IN DWORD dwNumAuxFiles, IN OPTIONAL LPCSTR lpszSharedDLLFileName, IN BOOL bLeaveModules, OUT LPSTR lpszDLLFileName)
 {
 	assert(hEFSFile);
 	assert(pAuxModules);
 	assert(lpszDLLFileName);
 
-	BOOL bFoundDLL = FALSE;
+	char szCacheDir[MAX_PATH + 1];
+	ULONGLONG qwMaxCacheSize;
 
-	for (DWORD iCurModule = 0; iCurModule < dwNumAuxFiles; iCurModule++)
+	UNPACKJOB job;
+	job.hEFSFile = hEFSFile;
+	job.pAuxModules = pAuxModules;
+	job.nNumAuxFiles = dwNumAuxFiles;
+	job.bUseCache = GetExtractionCacheSettings(szCacheDir, &qwMaxCacheSize);
+	job.lpszCacheDir = szCacheDir;
+	job.lpszSharedDLLFileName = lpszSharedDLLFileName;
+	job.bLeaveModules = bLeaveModules;
+	job.iNextModule = 0;
+	job.bFailed = FALSE;
+
+	// One thread per processor, but no more than there are modules
+	SYSTEM_INFO sysInfo;
+	GetSystemInfo(&sysInfo);
+
+	DWORD nNumThreads = (std::min)((std::min)((DWORD)sysInfo.dwNumberOfProcessors, dwNumAuxFiles), (DWORD)MAX_UNPACK_THREADS);
+
+	// Start the helper threads. The calling thread is one of the workers, so we need one fewer. If a thread can't be created, the others simply pick up its share.
+	HANDLE hThreads[MAX_UNPACK_THREADS];
+	DWORD nNumThreadsStarted = 0;
+
+	for (DWORD iCurThread = 1; iCurThread < nNumThreads; iCurThread++)
 	{
-		DWORD dwComponentID, dwFileID, dwFileData;
-		char szFileName[MAX_PATH + 1];
+		DWORD dwThreadID;
+		HANDLE hThread = CreateThread(NULL, 0, UnpackAuxFilesThreadProc, &job, 0, &dwThreadID);
+		if (hThread)
+			hThreads[nNumThreadsStarted++] = hThread;
+	}
 
-		// Extract the module
-		if (!EnumEFSFiles(hEFSFile, iCurModule, &dwComponentID, &dwFileID, &dwFileData, NULL)
-			|| !ExtractTempEFSFile(hEFSFile, dwComponentID, dwFileID, szFileName))
-			return FALSE;
+	UnpackAuxFilesThreadProc(&job);
+
+	// Wait for the others to finish before the job goes out of scope
+	if (nNumThreadsStarted)
+	{
+		WaitForMultipleObjects(nNumThreadsStarted, hThreads, TRUE, INFINITE);
 
-		// Pass the module info back to the caller
-		pAuxModules[iCurModule].dwComponentID = dwComponentID;
-		pAuxModules[iCurModule].dwModuleID = dwFileID;
-		strcpy(pAuxModules[iCurModule].szModuleFileName, szFileName);
-		pAuxModules[iCurModule].bExecute = (dwFileData != 0) ? TRUE : FALSE;
+		for (DWORD iCurThread = 0; iCurThread < nNumThreadsStarted; iCurThread++)
+			CloseHandle(hThreads[iCurThread]);
+	}
 
-		// Check if it's the MPQDraft DLL
-		if ((dwComponentID == MPQDRAFT_COMPONENT) &&
-			(dwFileID == MPQDRAFTDLL_MODULE))
+	// Make room for next time. Our own files are in use, so they won't be deleted.
+	if (job.bUseCache)
+		TrimEFSCache(szCacheDir, qwMaxCacheSize);
+
+	if (job.bFailed)
+		return FALSE;
+
+	if (lpszSharedDLLFileName)
+	{
+		strcpy(lpszDLLFileName, lpszSharedDLLFileName);
+
+		return TRUE;
+	}
+
+	// Find the MPQDraft DLL
+	for (DWORD iCurModule = 0; iCurModule < dwNumAuxFiles; iCurModule++)
+	{
+		if ((pAuxModules[iCurModule].dwComponentID == MPQDRAFT_COMPONENT) &&
+			(pAuxModules[iCurModule].dwModuleID == MPQDRAFTDLL_MODULE))
 		{
-			strcpy(lpszDLLFileName, szFileName);
+			strcpy(lpszDLLFileName, pAuxModules[iCurModule].szModuleFileName);
 
-			bFoundDLL = TRUE;
+			return TRUE;
 		}
 	}
 
-	if (bFoundDLL)
-		return TRUE;
-	else
-		return FALSE;
+	return FALSE;
 }
 
-// Get the EFS file in the SEMPQ
-BOOL FindEFSFile(IN LPCSTR lpSEMPQPath, OUT LPVOID *lplpvSEMPQMapping, OUT EFSHANDLEFORREAD &hEFSFile)
+// Extracts the modules UnpackAuxFiles left in the EFS file, for a patcher DLL too old to read them from there
+BOOL ExtractLeftModules(IN EFSHANDLEFORREAD hEFSFile, IN MPQDRAFTPLUGINMODULE *pAuxModules, IN DWORD dwNumAuxFiles)
 {
-	assert(lpSEMPQPath);
+	assert(hEFSFile);
+	assert(pAuxModules);
 
-	// Open the SEMPQ. We can't pull it directly out of memory for various reasons.
-	HANDLE hSEMPQ = CreateFile(lpSEMPQPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
-	if (hSEMPQ == INVALID_HANDLE_VALUE)
-		return FALSE;
+	for (DWORD iCurModule = 0; iCurModule < dwNumAuxFiles; iCurModule++)
+	{
+		MPQDRAFTPLUGINMODULE *pModule = &pAuxModules[iCurModule];
+		if (!pModule->szModuleFileName[0] 
+			&& !ExtractTempEFSFile(hEFSFile, pModule->dwComponentID, pModule->dwModuleID, pModule->szModuleFileName))
+			return FALSE;
+	}
 
-	// Map the SEMPQ into memory (yes, it is kinda strange to have two copies in memory)
-	DWORD dwSEMPQSize = GetFileSize(hSEMPQ, NULL);
-	HANDLE hSEMPQMapping = CreateFileMapping(hSEMPQ, NULL, PAGE_READONLY, 0, 0, NULL);
+	return TRUE;
+}
 
-	CloseHandle(hSEMPQ);
-	if (hSEMPQMapping == INVALID_HANDLE_VALUE)
-		return FALSE;
+// Gets the size of the stub executable itself on disk, which is where the data appended to it begins. The EFS file is the first thing appended to the stub, so this is where to start looking for it, rather than searching the whole stub.
+DWORD GetStubImageSize()
+{
+	// The headers of the stub are in memory at its base address
+	PIMAGE_DOS_HEADER pDosHeader = (PIMAGE_DOS_HEADER)GetModuleHandle(NULL);
+	PIMAGE_NT_HEADERS pNTHeader = (PIMAGE_NT_HEADERS)
+		((LPBYTE)pDosHeader + pDosHeader->e_lfanew);
+	PIMAGE_SECTION_HEADER pSections = IMAGE_FIRST_SECTION(pNTHeader);
+
+	// The image ends where the last section's raw data does
+	DWORD dwImageSize = pNTHeader->OptionalHeader.SizeOfHeaders;
+	for (WORD iCurSection = 0; iCurSection < pNTHeader->FileHeader.NumberOfSections; iCurSection++)
+	{
+		if (pSections[iCurSection].SizeOfRawData)
+			dwImageSize = (std::max)(dwImageSize, 
+				pSections[iCurSection].PointerToRawData + pSections[iCurSection].SizeOfRawData);
+	}
 
-	LPVOID lpvSEMPQMapping = MapViewOfFile(hSEMPQMapping, FILE_MAP_READ, 0, 0, 0);
+	// OpenEFSFileForRead requires the search to start on a 512 byte boundary, and the EFS header will be on one
+	return dwImageSize & ~(DWORD)511;
+}
 
-	CloseHandle(hSEMPQMapping);
-	if (!lpvSEMPQMapping)
+// Get the EFS file in the SEMPQ. The EFS file is read from the SEMPQ as needed, rather than mapping the whole thing, which could be gigabytes of MPQ we have no interest in.
+BOOL FindEFSFile(IN LPCSTR lpSEMPQPath, OUT HANDLE *lphSEMPQ, OUT EFSHANDLEFORREAD &hEFSFile)
+{
+	assert(lpSEMPQPath);
+	assert(lphSEMPQ);
+
+	// Open the SEMPQ. We can't pull it directly out of memory for various reasons.
+	HANDLE hSEMPQ = CreateFile(lpSEMPQPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+	if (hSEMPQ == INVALID_HANDLE_VALUE)
 		return FALSE;
 
-	// Finally, find the EFS file
-	hEFSFile = GetEFSHandleFromMappedFile((LPBYTE)lpvSEMPQMapping, dwSEMPQSize);
+	// Find the EFS file, starting at the end of the stub. The SEMPQ has to stay open for as long as the EFS handle is in use.
+	hEFSFile = OpenEFSFileForRead(hSEMPQ, GetStubImageSize(), 0);
 	if (hEFSFile)
 	{
-		*lplpvSEMPQMapping = lpvSEMPQMapping;
+		*lphSEMPQ = hSEMPQ;
 		return TRUE;
 	}
 	else
 	{
-		UnmapViewOfFile(lpvSEMPQMapping);
+		CloseHandle(hSEMPQ);
 		return FALSE;
 	}
 }
@@ -229,6 +895,8 @@ int APIENTRY WinMain(HINSTANCE hInstance,
                      LPSTR     lpCmdLine,
                      int       nCmdShow)
 {
+	StartStubProfile(lpCmdLine);
+
 	QResourceInitialize();
 
 	// First of all, fish the stub data out
@@ -236,8 +904,13 @@ int APIENTRY WinMain(HINSTANCE hInstance,
 	STUBDATA *lpStubData = (STUBDATA *)&stubDataBuffer;
 	DWORD dwStubDataSize;
 
-	if (!FindStubData(lpStubData, &dwStubDataSize))
+	BOOL bFoundStubData = FindStubData(lpStubData, &dwStubDataSize);
+	EndStubPhase(PHASE_STUB_DATA);
+
+	if (!bFoundStubData)
 	{
+		WriteStubProfile("corrupt");
+
 		MessageBox(NULL, "Unable to perform the patch. This SEMPQ is corrupted.", 
 			"Self-Executing MPQ", MB_OK | MB_ICONSTOP);
 
@@ -259,8 +932,14 @@ int APIENTRY WinMain(HINSTANCE hInstance,
 	PathRemoveFileSpec(szCurrentDir);
 
 	// Find the patch target and its paths
-	if (!LocatePatchTarget(lpStubData->patchTarget, szSpawnPath, szTargetPath))
+	BOOL bTargetFromCache;
+	BOOL bFoundTarget = LocatePatchTarget(lpStubData->patchTarget, szSpawnPath, szTargetPath, TRUE, &bTargetFromCache);
+	EndStubPhase(PHASE_LOCATE_TARGET);
+
+	if (!bFoundTarget)
 	{
+		WriteStubProfile("notarget");
+
 		sprintf(szMessage, "Unable to locate the target to patch.");
 		MessageBox(NULL, szMessage, lpStubData->szCustomName, MB_OK | MB_ICONSTOP);
 
@@ -275,20 +954,43 @@ int APIENTRY WinMain(HINSTANCE hInstance,
 
 	sprintf(szCommandLine, "\"%s\" %s", szTargetPath, lpStubData->patchTarget.lpszArguments);
 
+	// Use the shared runtime's patcher DLL if it's installed, which saves extracting our own copy. Thin SEMPQs don't have their own copy, and can't do without it.
+	char szSharedDLLPath[MAX_PATH + 1];
+	HANDLE hSharedDLL = INVALID_HANDLE_VALUE;
+	BOOL bUseSharedRuntime = FindSharedRuntime(*lpStubData, szSharedDLLPath, &hSharedDLL);
+	EndStubPhase(PHASE_SHARED_RUNTIME);
+
+	if (!bUseSharedRuntime && (lpStubData->grfStubFlags & SEMPQ_THIN))
+	{
+		WriteStubProfile("noruntime");
+
+		MessageBox(NULL, "Unable to perform the patch. This SEMPQ requires the same version of MPQDraft it was created with to be installed. Run that version of MPQDraft once, or run \"MPQDraft install-runtime\", and try again.", 
+			lpStubData->szCustomName, MB_OK | MB_ICONSTOP);
+
+		return 1;
+	}
+
 	BOOL bCorrupted = TRUE;
 
 	// Find the EFS file
-	LPVOID lpvSEMPQMapping = NULL;
+	HANDLE hSEMPQ = INVALID_HANDLE_VALUE;
 	EFSHANDLEFORREAD hEFSFile = NULL;
-	if (FindEFSFile(szMPQPath, &lpvSEMPQMapping, hEFSFile))
+	BOOL bFoundEFSFile = FindEFSFile(szMPQPath, &hSEMPQ, hEFSFile);
+	EndStubPhase(PHASE_FIND_EFS);
+
+	if (bFoundEFSFile)
 	{
 		// Get the number of modules, allocate the array for them
 		DWORD nNumAuxFiles = GetNumEFSFiles(hEFSFile);
 		MPQDRAFTPLUGINMODULE *pAuxModules = NULL;
-		if (nNumAuxFiles && (pAuxModules = new MPQDRAFTPLUGINMODULE[nNumAuxFiles]))
+		if ((nNumAuxFiles || bUseSharedRuntime) && (pAuxModules = new MPQDRAFTPLUGINMODULE[nNumAuxFiles]))
 		{
 			// Unpack the modules
-			if (UnpackAuxFiles(hEFSFile, pAuxModules, nNumAuxFiles, szDLLPath))
+			BOOL bUnpacked = UnpackAuxFiles(hEFSFile, pAuxModules, nNumAuxFiles, 
+				bUseSharedRuntime ? szSharedDLLPath : NULL, TRUE, szDLLPath);
+			EndStubPhase(PHASE_UNPACK);
+
+			if (bUnpacked)
 			{
 				// Finally, do the patch
 				STARTUPINFO si;
@@ -296,28 +998,83 @@ int APIENTRY WinMain(HINSTANCE hInstance,
 
 				HMODULE hDLL = LoadLibrary(szDLLPath);
 				MPQDraftPatcherPtr MPQDraftPatcher = (MPQDraftPatcherPtr)GetProcAddress(hDLL, "MPQDraftPatcher");
-
-				if (!MPQDraftPatcher(szSpawnPath, szCommandLine, NULL, 
-					NULL, FALSE, 0, NULL, szCurrentDir, &si, 
-					lpStubData->patchTarget.grfFlags, szCurrentDir, 
-					szTargetPath,lpStubData->patchTarget.nShuntCount, 1, 
-					nNumAuxFiles, &lpszMPQNames, pAuxModules))
-					MessageBox(NULL, "The patch was unsuccessful.", lpStubData->szCustomName, MB_OK | MB_ICONEXCLAMATION);
-
-				bCorrupted = FALSE;
+				MPQDraftPatcherExPtr MPQDraftPatcherEx = (MPQDraftPatcherExPtr)GetProcAddress(hDLL, "MPQDraftPatcherEx");
+
+				// A patcher DLL that can't read modules from the SEMPQ needs them all in files
+				if (!MPQDraftPatcherEx)
+					bUnpacked = ExtractLeftModules(hEFSFile, pAuxModules, nNumAuxFiles);
+				EndStubPhase(PHASE_LOAD_PATCHER);
+
+				// Now that the DLL is loaded, it can't be changed anyway
+				if (hSharedDLL != INVALID_HANDLE_VALUE)
+				{
+					CloseHandle(hSharedDLL);
+					hSharedDLL = INVALID_HANDLE_VALUE;
+				}
+
+				if (bUnpacked)
+				{
+					// The modules left in the SEMPQ are read from it by the patcher DLL, which opens it again by name
+					BOOL bPatched;
+					for (;;)
+					{
+						if (MPQDraftPatcherEx)
+							bPatched = MPQDraftPatcherEx(szSpawnPath, szCommandLine, NULL, 
+								NULL, FALSE, 0, NULL, szCurrentDir, &si, 
+								lpStubData->patchTarget.grfFlags, szCurrentDir, 
+								szTargetPath,lpStubData->patchTarget.nShuntCount, 1, 
+								nNumAuxFiles, &lpszMPQNames, pAuxModules, szMPQPath);
+						else
+							bPatched = MPQDraftPatcher(szSpawnPath, szCommandLine, NULL, 
+								NULL, FALSE, 0, NULL, szCurrentDir, &si, 
+								lpStubData->patchTarget.grfFlags, szCurrentDir, 
+								szTargetPath,lpStubData->patchTarget.nShuntCount, 1, 
+								nNumAuxFiles, &lpszMPQNames, pAuxModules);
+
+						// Cached paths aren't checked, so the game may have moved since they were saved. Search for it once, and try again if it's now somewhere else.
+						if (bPatched || !bTargetFromCache)
+							break;
+
+						bTargetFromCache = FALSE;
+
+						char szOldSpawnPath[MAX_PATH + 1], szOldTargetPath[MAX_PATH + 1];
+						strcpy(szOldSpawnPath, szSpawnPath);
+						strcpy(szOldTargetPath, szTargetPath);
+
+						if (!LocatePatchTarget(lpStubData->patchTarget, szSpawnPath, szTargetPath, FALSE, NULL) 
+							|| (!lstrcmpi(szSpawnPath, szOldSpawnPath) && !lstrcmpi(szTargetPath, szOldTargetPath)))
+							break;
+
+						sprintf(szCommandLine, "\"%s\" %s", szTargetPath, lpStubData->patchTarget.lpszArguments);
+					}
+					EndStubPhase(PHASE_PATCH);
+
+					if (!bPatched)
+						MessageBox(NULL, "The patch was unsuccessful.", lpStubData->szCustomName, MB_OK | MB_ICONEXCLAMATION);
+
+					bCorrupted = FALSE;
+				}
 			}
 
 			delete [] pAuxModules;
 		}
 
-		UnmapViewOfFile(lpvSEMPQMapping);
+		// The EFS handle reads from the SEMPQ, so it has to go first
+		CloseEFSFileForRead(hEFSFile);
+		CloseHandle(hSEMPQ);
 	}
 
+	if (hSharedDLL != INVALID_HANDLE_VALUE)
+		CloseHandle(hSharedDLL);
+
 	// We're all done with the patch, now we need to clean up after ourselves. Nobody (especially not me) likes it when you forget to remove your temp files from their computer.
 	DeleteTemporaryFiles();
 
 	QResourceDestroy();
 
+	EndStubPhase(PHASE_CLEANUP);
+	WriteStubProfile(bCorrupted ? "corrupt" : "ok");
+
 	if (bCorrupted)
 	{
 		MessageBox(NULL, "Unable to perform the patch. This SEMPQ is corrupted.", 
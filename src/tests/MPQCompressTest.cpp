@@ -0,0 +1,234 @@
+/*
+	The contents of this file are subject to the Common Development and Distribution License Version 1.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at http://www.sun.com/cddl/cddl.html.
+
+	Software distributed under the License is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for the specific language governing rights and limitations under the License.
+
+	The Initial Developer of the Original Code is Justin Olbrantz. The Original Code Copyright (C) 2007 Justin Olbrantz. All Rights Reserved.
+*/
+
+// Tests that what MPQImplode, MPQDeflate and MPQCompressSector write is read back unchanged by MPQExplode, MPQInflate and MPQDecompressSector: for data too short to have copies, for data that is almost all copies, for data with no copies at all, and for copies from as far back as each format allows.
+
+#include "MPQArchive.h"
+#include "MPQCompress.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+static int nFailures = 0;
+
+#define CHECK(expr) \
+	do { if (!(expr)) { fprintf(stderr, "%s(%d): check failed: %s\n", __FILE__, __LINE__, #expr); nFailures++; } } while (0)
+
+// How far back a copy may come from in each format, as the compressors write them
+#define TEST_PK_WINDOW_SIZE 4096
+#define TEST_DEFLATE_WINDOW_SIZE 32768
+
+// The size of the sectors of most archives
+#define TEST_SECTOR_SIZE 4096
+
+typedef bool (*COMPRESSFUNCTION)(void *lpvOutput, uint32_t *lpcbOutput, const void *lpvInput, uint32_t cbInput);
+
+// A small deterministic generator, so that the data is the same on every machine and every run
+static uint32_t dwRandomState = 0x12345678;
+
+static uint8_t NextRandomByte()
+{
+	dwRandomState = dwRandomState * 1103515245 + 12345;
+
+	return (uint8_t)(dwRandomState >> 16);
+}
+
+static std::vector<uint8_t> MakeRandomData(uint32_t cbData)
+{
+	std::vector<uint8_t> data(cbData);
+	for (uint32_t iByte = 0; iByte < cbData; iByte++)
+		data[iByte] = NextRandomByte();
+
+	return data;
+}
+
+// Compresses the data with plenty of room, decompresses it into a buffer of exactly its size, and checks that it came back the same. Returns the compressed size, or 0 if either step failed.
+static uint32_t CheckRoundTrip(COMPRESSFUNCTION lpfnCompress, COMPRESSFUNCTION lpfnDecompress, const std::vector<uint8_t> &data)
+{
+	uint32_t cbData = (uint32_t)data.size();
+
+	// Every byte stored as a literal takes at most 9 bits in both formats, plus the headers and the end of the data
+	std::vector<uint8_t> compressed(cbData * 2 + 64);
+	uint32_t cbCompressed = (uint32_t)compressed.size();
+	bool bCompressed = lpfnCompress(&compressed[0], &cbCompressed, data.data(), cbData);
+	CHECK(bCompressed);
+	if (!bCompressed)
+		return 0;
+
+	CHECK(cbCompressed <= compressed.size());
+
+	// One byte more than needed, so that a write past the end of the data shows up
+	std::vector<uint8_t> decompressed(cbData + 1, 0xCC);
+	uint32_t cbDecompressed = cbData;
+	bool bDecompressed = lpfnDecompress(&decompressed[0], &cbDecompressed, &compressed[0], cbCompressed);
+	CHECK(bDecompressed);
+	if (!bDecompressed)
+		return 0;
+
+	CHECK(cbDecompressed == cbData);
+	CHECK(!cbData || !memcmp(decompressed.data(), data.data(), cbData));
+	CHECK(decompressed[cbData] == 0xCC);
+
+	// Data cut short must be noticed, rather than read past the end. MPQInflate doesn't check zlib's trailing checksum, so that may be cut off. Long data is cut at a sample of places, as decompressing it at every one would take a long time.
+	uint32_t cbChecked = (lpfnDecompress == MPQInflate) ? cbCompressed - 4 : cbCompressed;
+	uint32_t cbStep = cbChecked / 256 + 1;
+	for (uint32_t cbTruncated = 0; cbTruncated < cbChecked; cbTruncated += (cbChecked - cbTruncated > 64) ? cbStep : 1)
+	{
+		std::vector<uint8_t> truncated(compressed.begin(), compressed.begin() + cbTruncated);
+		cbDecompressed = cbData;
+		CHECK(!lpfnDecompress(&decompressed[0], &cbDecompressed, truncated.data(), cbTruncated));
+	}
+
+	// The data must not fit in a buffer any smaller
+	if (cbData)
+	{
+		cbDecompressed = cbData - 1;
+		CHECK(!lpfnDecompress(&decompressed[0], &cbDecompressed, &compressed[0], cbCompressed));
+	}
+
+	return cbCompressed;
+}
+
+static void CheckBothRoundTrips(const std::vector<uint8_t> &data)
+{
+	CheckRoundTrip(MPQImplode, MPQExplode, data);
+	CheckRoundTrip(MPQDeflate, MPQInflate, data);
+}
+
+// Checks that a sector compressed for each kind of file is read back unchanged, or that compressing it fails if it doesn't get smaller
+static void CheckSectorRoundTrips(const std::vector<uint8_t> &sector, bool bCompressible)
+{
+	static const struct
+	{
+		uint32_t grfFileFlags;
+		uint32_t dwCompression;
+	} methods[] = {
+		{ MPQ_FILE_IMPLODE, 0 },
+		{ MPQ_FILE_COMPRESS, MPQ_COMPRESSION_PKWARE },
+		{ MPQ_FILE_COMPRESS, MPQ_COMPRESSION_ZLIB },
+	};
+
+	uint32_t cbSector = (uint32_t)sector.size();
+	for (size_t iMethod = 0; iMethod < sizeof(methods) / sizeof(methods[0]); iMethod++)
+	{
+		std::vector<uint8_t> compressed(cbSector ? cbSector : 1);
+		uint32_t cbCompressed = 0;
+		bool bCompressed = MPQCompressSector(&compressed[0], &cbCompressed, sector.data(), cbSector, methods[iMethod].grfFileFlags, methods[iMethod].dwCompression);
+		CHECK(bCompressed == bCompressible);
+		if (!bCompressed)
+			continue;
+
+		// A sector stored with its full size would be taken to be stored as it is
+		CHECK(cbCompressed < cbSector);
+
+		std::vector<uint8_t> decompressed(cbSector);
+		CHECK(MPQDecompressSector(&decompressed[0], cbSector, &compressed[0], cbCompressed, methods[iMethod].grfFileFlags) == MPQ_ERROR_SUCCESS);
+		CHECK(decompressed == sector);
+	}
+}
+
+static void TestShortData()
+{
+	for (uint32_t cbData = 0; cbData <= 3; cbData++)
+	{
+		std::vector<uint8_t> data(cbData, 'a');
+		CheckBothRoundTrips(data);
+		CheckBothRoundTrips(MakeRandomData(cbData));
+
+		// Nothing this short gets smaller
+		CheckSectorRoundTrips(data, false);
+	}
+}
+
+static void TestRepetitiveData()
+{
+	// A single byte repeated, which is copied from 1 byte back, over and over
+	std::vector<uint8_t> sameByte(TEST_SECTOR_SIZE * 16, 'a');
+	uint32_t cbImploded = CheckRoundTrip(MPQImplode, MPQExplode, sameByte);
+	uint32_t cbDeflated = CheckRoundTrip(MPQDeflate, MPQInflate, sameByte);
+	CHECK(cbImploded && cbImploded < sameByte.size() / 50);
+	CHECK(cbDeflated && cbDeflated < sameByte.size() / 50);
+
+	// A short pattern repeated, with a change every so often
+	std::vector<uint8_t> pattern(TEST_SECTOR_SIZE * 16);
+	for (uint32_t iByte = 0; iByte < pattern.size(); iByte++)
+		pattern[iByte] = (iByte % 1000 == 999) ? NextRandomByte() : "MPQDraft"[iByte % 8];
+
+	cbImploded = CheckRoundTrip(MPQImplode, MPQExplode, pattern);
+	cbDeflated = CheckRoundTrip(MPQDeflate, MPQInflate, pattern);
+	CHECK(cbImploded && cbImploded < pattern.size() / 10);
+	CHECK(cbDeflated && cbDeflated < pattern.size() / 10);
+
+	CheckSectorRoundTrips(std::vector<uint8_t>(sameByte.begin(), sameByte.begin() + TEST_SECTOR_SIZE), true);
+	CheckSectorRoundTrips(std::vector<uint8_t>(pattern.begin(), pattern.begin() + TEST_SECTOR_SIZE), true);
+}
+
+static void TestIncompressibleData()
+{
+	std::vector<uint8_t> data = MakeRandomData(TEST_SECTOR_SIZE);
+	CheckBothRoundTrips(data);
+	CheckSectorRoundTrips(data, false);
+
+	// With no more room than the data itself, neither compressor can make it fit
+	std::vector<uint8_t> compressed(data.size());
+	uint32_t cbCompressed = (uint32_t)compressed.size();
+	CHECK(!MPQImplode(&compressed[0], &cbCompressed, data.data(), (uint32_t)data.size()));
+	cbCompressed = (uint32_t)compressed.size();
+	CHECK(!MPQDeflate(&compressed[0], &cbCompressed, data.data(), (uint32_t)data.size()));
+}
+
+// Repeats a block of random data a given distance after it, with random data between, and returns the compressed size
+static uint32_t CheckCopyAtDistance(COMPRESSFUNCTION lpfnCompress, COMPRESSFUNCTION lpfnDecompress, uint32_t nDistance)
+{
+	const uint32_t cbBlock = 64;
+
+	dwRandomState = 0x12345678;
+	std::vector<uint8_t> data = MakeRandomData(nDistance + cbBlock);
+	memcpy(&data[nDistance], &data[0], cbBlock);
+
+	return CheckRoundTrip(lpfnCompress, lpfnDecompress, data);
+}
+
+static void TestWindowLimits()
+{
+	// A copy from exactly as far back as the window reaches must be used and read back correctly; one from a byte further can't be used, and the block has to be stored as literals, which are larger
+	uint32_t cbAtLimit = CheckCopyAtDistance(MPQImplode, MPQExplode, TEST_PK_WINDOW_SIZE);
+	uint32_t cbPastLimit = CheckCopyAtDistance(MPQImplode, MPQExplode, TEST_PK_WINDOW_SIZE + 1);
+	CHECK(cbAtLimit && cbPastLimit && cbAtLimit < cbPastLimit);
+
+	cbAtLimit = CheckCopyAtDistance(MPQDeflate, MPQInflate, TEST_DEFLATE_WINDOW_SIZE);
+	cbPastLimit = CheckCopyAtDistance(MPQDeflate, MPQInflate, TEST_DEFLATE_WINDOW_SIZE + 1);
+	CHECK(cbAtLimit && cbPastLimit && cbAtLimit < cbPastLimit);
+
+	// The longest copies each format can hold, which are several times the window here
+	std::vector<uint8_t> longRuns(TEST_DEFLATE_WINDOW_SIZE * 4);
+	for (uint32_t iByte = 0; iByte < longRuns.size(); iByte++)
+		longRuns[iByte] = (uint8_t)(iByte / 5000);
+
+	CheckBothRoundTrips(longRuns);
+}
+
+int main()
+{
+	TestShortData();
+	TestRepetitiveData();
+	TestIncompressibleData();
+	TestWindowLimits();
+
+	if (nFailures)
+	{
+		fprintf(stderr, "%d checks failed\n", nFailures);
+
+		return 1;
+	}
+
+	printf("All checks passed\n");
+
+	return 0;
+}
@@ -0,0 +1,259 @@
+/*
+	The contents of this file are subject to the Common Development and Distribution License Version 1.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at http://www.sun.com/cddl/cddl.html.
+
+	Software distributed under the License is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for the specific language governing rights and limitations under the License.
+
+	The Initial Developer of the Original Code is Justin Olbrantz. The Original Code Copyright (C) 2007 Justin Olbrantz. All Rights Reserved.
+*/
+
+// Tests of the HET and BET tables: MPQHashNameHET against a plain reimplementation of lookup3, and MPQFindFileByHETHash against MPQFindFileByHash on archives built with both kinds of tables, which must find the same hash table entry for every name and locale. Archives with HET and BET tables that don't match their hash and block tables must have them ignored.
+
+#include "MPQArchive.h"
+#include "MPQCrypt.h"
+#include "MPQFile.h"
+#include "MPQTestArchive.h"
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+static int nFailures = 0;
+
+#define CHECK(expr) \
+	do { if (!(expr)) { fprintf(stderr, "%s(%d): check failed: %s\n", __FILE__, __LINE__, #expr); nFailures++; } } while (0)
+
+// The archive is written here, in the directory the test is run in
+#define TEST_ARCHIVE_NAME "MPQHETTest.mpq"
+
+// The locales each name is looked up in: neutral, one the archive has a file in, and one it doesn't
+static const uint16_t awTestLocales[] = { MPQ_LOCALE_NEUTRAL, 0x407, 0x409 };
+
+#define ROTATE(x, k) (((x) << (k)) | ((x) >> (32 - (k))))
+
+// Bob Jenkins' hashlittle2, a byte at a time, as in his reference lookup3.c, so that a mistake in the word-at-a-time version in MPQCrypt can't hide
+static void ReferenceHashLittle2(const void *lpvKey, size_t cbKey, uint32_t *lpdwC, uint32_t *lpdwB)
+{
+	uint32_t a, b, c;
+	a = b = c = 0xDEADBEEF + (uint32_t)cbKey + *lpdwC;
+	c += *lpdwB;
+
+	const uint8_t *k = (const uint8_t *)lpvKey;
+	for (; cbKey > 12; cbKey -= 12, k += 12)
+	{
+		a += k[0] + ((uint32_t)k[1] << 8) + ((uint32_t)k[2] << 16) + ((uint32_t)k[3] << 24);
+		b += k[4] + ((uint32_t)k[5] << 8) + ((uint32_t)k[6] << 16) + ((uint32_t)k[7] << 24);
+		c += k[8] + ((uint32_t)k[9] << 8) + ((uint32_t)k[10] << 16) + ((uint32_t)k[11] << 24);
+
+		a -= c; a ^= ROTATE(c, 4); c += b;
+		b -= a; b ^= ROTATE(a, 6); a += c;
+		c -= b; c ^= ROTATE(b, 8); b += a;
+		a -= c; a ^= ROTATE(c, 16); c += b;
+		b -= a; b ^= ROTATE(a, 19); a += c;
+		c -= b; c ^= ROTATE(b, 4); b += a;
+	}
+
+	if (!cbKey)
+	{
+		*lpdwC = c;
+		*lpdwB = b;
+
+		return;
+	}
+
+	for (size_t iByte = 0; iByte < cbKey; iByte++)
+	{
+		uint32_t dwByte = (uint32_t)k[iByte] << ((iByte % 4) * 8);
+		if (iByte < 4)
+			a += dwByte;
+		else if (iByte < 8)
+			b += dwByte;
+		else
+			c += dwByte;
+	}
+
+	c ^= b; c -= ROTATE(b, 14);
+	a ^= c; a -= ROTATE(c, 11);
+	b ^= a; b -= ROTATE(a, 25);
+	c ^= b; c -= ROTATE(b, 16);
+	a ^= c; a -= ROTATE(c, 4);
+	b ^= a; b -= ROTATE(a, 14);
+	c ^= b; c -= ROTATE(b, 24);
+
+	*lpdwC = c;
+	*lpdwB = b;
+}
+
+static uint64_t ReferenceHashNameHET(const char *lpszName)
+{
+	std::string name(lpszName);
+	for (size_t iChar = 0; iChar < name.size(); iChar++)
+	{
+		name[iChar] = (char)tolower((unsigned char)name[iChar]);
+		if (name[iChar] == '/')
+			name[iChar] = '\\';
+	}
+
+	uint32_t dwC = 2, dwB = 1;
+	ReferenceHashLittle2(name.data(), name.size(), &dwC, &dwB);
+
+	return ((uint64_t)dwB << 32) | dwC;
+}
+
+static void TestHashNameHET()
+{
+	// The reference itself, against the values given in lookup3.c
+	uint32_t dwC = 0, dwB = 0;
+	ReferenceHashLittle2("", 0, &dwC, &dwB);
+	CHECK(dwC == 0xDEADBEEF && dwB == 0xDEADBEEF);
+
+	dwC = 0, dwB = 0xDEADBEEF;
+	ReferenceHashLittle2("", 0, &dwC, &dwB);
+	CHECK(dwC == 0xBD5B7DDE && dwB == 0xDEADBEEF);
+
+	dwC = 0, dwB = 0;
+	ReferenceHashLittle2("Four score and seven years ago", 30, &dwC, &dwB);
+	CHECK(dwC == 0x17770551 && dwB == 0xCE7226E6);
+
+	dwC = 0, dwB = 1;
+	ReferenceHashLittle2("Four score and seven years ago", 30, &dwC, &dwB);
+	CHECK(dwC == 0xE3607CAE && dwB == 0xBD371DE4);
+
+	dwC = 1, dwB = 0;
+	ReferenceHashLittle2("Four score and seven years ago", 30, &dwC, &dwB);
+	CHECK(dwC == 0xCD628161 && dwB == 0x6CBEA4B3);
+
+	// Names of every length around the 12 byte blocks lookup3 works in
+	static const char *const lpszNames[] = { "", "a", "(listfile)", "units\\Terran/Marine.GRP", "123456789012", "1234567890123", "123456789012345678901234", "Four score and seven years ago" };
+	for (size_t iName = 0; iName < sizeof(lpszNames) / sizeof(lpszNames[0]); iName++)
+		CHECK(MPQHashNameHET(lpszNames[iName]) == ReferenceHashNameHET(lpszNames[iName]));
+
+	// Case and slashes must not matter
+	CHECK(MPQHashNameHET("unit/terran/marine.grp") == MPQHashNameHET("UNIT\\TERRAN\\MARINE.GRP"));
+}
+
+static std::vector<TESTFILE> MakeTestFiles()
+{
+	std::vector<TESTFILE> files;
+	for (int iFile = 0; iFile < 200; iFile++)
+		files.push_back({ "dir\\file" + std::to_string(iFile) + ".txt", "data " + std::to_string(iFile), MPQ_LOCALE_NEUTRAL });
+
+	files.push_back({ MPQ_LISTFILE_NAME, "dir\\file0.txt\r\n", MPQ_LOCALE_NEUTRAL });
+
+	// The same name in two locales, to check that the HET table lookup prefers locales the same way
+	files.push_back({ "locale.txt", "neutral", MPQ_LOCALE_NEUTRAL });
+	files.push_back({ "locale.txt", "german", 0x407 });
+
+	return files;
+}
+
+// Looks a name up both ways, which must give the same result
+static void CheckHETLookup(HMPQARCHIVE hArchive, const char *lpszName, uint16_t wLocale)
+{
+	MPQNAMEHASHES hashes;
+	MPQHashName(lpszName, &hashes);
+
+	uint32_t iHashEntry = 0xFFFFFFFF, iHETHashEntry = 0xFFFFFFFF;
+	MPQERROR error = MPQFindFileByHash(hArchive, hashes.dwIndexHash, hashes.dwNameHashA, hashes.dwNameHashB, wLocale, &iHashEntry);
+	MPQERROR hetError = MPQFindFileByHETHash(hArchive, MPQHashNameHET(lpszName), wLocale, &iHETHashEntry);
+
+	CHECK(hetError == error);
+	if (error == MPQ_ERROR_SUCCESS && hetError == MPQ_ERROR_SUCCESS)
+		CHECK(iHETHashEntry == iHashEntry);
+}
+
+static void TestHETLookups(const std::vector<TESTFILE> &files)
+{
+	CHECK(WriteTestArchive(TEST_ARCHIVE_NAME, BuildTestArchive(files, 512, TEST_HET_GOOD)));
+
+	HMPQARCHIVE hArchive;
+	MPQERROR error = MPQOpenArchive(TEST_ARCHIVE_NAME, &hArchive);
+	CHECK(error == MPQ_ERROR_SUCCESS);
+	if (error != MPQ_ERROR_SUCCESS)
+		return;
+
+	const MPQARCHIVEINFO *lpInfo = MPQGetArchiveInfo(hArchive);
+	CHECK(lpInfo->bHETTable && lpInfo->bBETTable);
+	CHECK(!(lpInfo->grfWarnings & MPQ_WARNING_BAD_HET_TABLE));
+	CHECK(MPQGetHETTable(hArchive) != NULL);
+
+	if (MPQGetHETTable(hArchive))
+	{
+		for (size_t iFile = 0; iFile < files.size(); iFile++)
+		{
+			for (size_t iLocale = 0; iLocale < sizeof(awTestLocales) / sizeof(awTestLocales[0]); iLocale++)
+			{
+				CheckHETLookup(hArchive, files[iFile].name.c_str(), awTestLocales[iLocale]);
+
+				// The name of a file that isn't there, which is never found either way
+				std::string missingName = files[iFile].name + ".missing";
+				CheckHETLookup(hArchive, missingName.c_str(), awTestLocales[iLocale]);
+
+				uint32_t iHashEntry;
+				CHECK(MPQFindFileByHETHash(hArchive, MPQHashNameHET(missingName.c_str()), awTestLocales[iLocale], &iHashEntry) == MPQ_ERROR_FILE_NOT_FOUND);
+			}
+		}
+
+		// The locale preference must pick the right one of the two versions
+		uint32_t nHashEntries;
+		const MPQHASHENTRY *lpHashTable = MPQGetHashTable(hArchive, &nHashEntries);
+		uint32_t iHashEntry;
+
+		CHECK(MPQFindFileByHETHash(hArchive, MPQHashNameHET("LOCALE.TXT"), 0x407, &iHashEntry) == MPQ_ERROR_SUCCESS);
+		CHECK(iHashEntry < nHashEntries && lpHashTable[iHashEntry].wLocale == 0x407);
+
+		CHECK(MPQFindFileByHETHash(hArchive, MPQHashNameHET("locale.txt"), 0x409, &iHashEntry) == MPQ_ERROR_SUCCESS);
+		CHECK(iHashEntry < nHashEntries && lpHashTable[iHashEntry].wLocale == MPQ_LOCALE_NEUTRAL);
+	}
+
+	MPQCloseArchive(hArchive);
+}
+
+// Archives without HET and BET tables, or with ones that disagree with the hash and block tables, must have none that can be used, and files must still be found through the hash table
+static void TestUnusableHETTable(const std::vector<TESTFILE> &files, TESTHETTABLE hetTable)
+{
+	CHECK(WriteTestArchive(TEST_ARCHIVE_NAME, BuildTestArchive(files, 512, hetTable)));
+
+	HMPQARCHIVE hArchive;
+	MPQERROR error = MPQOpenArchive(TEST_ARCHIVE_NAME, &hArchive);
+	CHECK(error == MPQ_ERROR_SUCCESS);
+	if (error != MPQ_ERROR_SUCCESS)
+		return;
+
+	bool bBad = hetTable != TEST_HET_NONE;
+	CHECK(MPQGetHETTable(hArchive) == NULL);
+	CHECK(!!(MPQGetArchiveInfo(hArchive)->grfWarnings & MPQ_WARNING_BAD_HET_TABLE) == bBad);
+
+	for (size_t iFile = 0; iFile < files.size(); iFile++)
+	{
+		uint32_t iHashEntry;
+		CHECK(MPQFindFile(hArchive, files[iFile].name.c_str(), files[iFile].wLocale, &iHashEntry) == MPQ_ERROR_SUCCESS);
+	}
+
+	MPQCloseArchive(hArchive);
+}
+
+int main()
+{
+	TestHashNameHET();
+
+	std::vector<TESTFILE> files = MakeTestFiles();
+	TestHETLookups(files);
+	TestUnusableHETTable(files, TEST_HET_NONE);
+	TestUnusableHETTable(files, TEST_HET_BAD_FILE_SIZE);
+	TestUnusableHETTable(files, TEST_HET_BAD_NAME_HASH);
+
+	remove(TEST_ARCHIVE_NAME);
+
+	if (nFailures)
+	{
+		fprintf(stderr, "%d checks failed\n", nFailures);
+
+		return 1;
+	}
+
+	printf("All checks passed\n");
+
+	return 0;
+}
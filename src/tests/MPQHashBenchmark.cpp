@@ -0,0 +1,249 @@
+/*
+	The contents of this file are subject to the Common Development and Distribution License Version 1.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at http://www.sun.com/cddl/cddl.html.
+
+	Software distributed under the License is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for the specific language governing rights and limitations under the License.
+
+	The Initial Developer of the Original Code is Justin Olbrantz. The Original Code Copyright (C) 2007 Justin Olbrantz. All Rights Reserved.
+*/
+
+// Checks that MPQHashName, which computes the three hash table hashes in one pass, gives the same results as MPQHashString and as a plain reimplementation of Storm's hash, then times MPQHashName against three calls to MPQHashString.
+// Usage: MPQHashBenchmark [--verify] [number of names] [number of runs]. With --verify, only the checks are done, so that it can run as a test. The names are generated from a fixed seed, so every run hashes the same ones.
+
+#include "MPQCrypt.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+static int nFailures = 0;
+
+#define CHECK(expr) \
+	do { if (!(expr)) { fprintf(stderr, "%s(%d): check failed: %s\n", __FILE__, __LINE__, #expr); nFailures++; } } while (0)
+
+#define DEFAULT_NUM_NAMES 200000
+#define DEFAULT_NUM_RUNS 5
+
+// A small deterministic generator, so that the names are the same on every machine and every run
+static uint32_t dwRandomState = 0x12345678;
+
+static uint32_t NextRandom()
+{
+	dwRandomState = dwRandomState * 1103515245 + 12345;
+
+	return dwRandomState >> 8;
+}
+
+// Storm's hash, written out the long way, with its own table and case conversion, so that a mistake shared by MPQHashString and MPQHashName can't hide
+static uint32_t dwReferenceTable[0x500];
+
+static void BuildReferenceTable()
+{
+	uint32_t dwSeed = 0x00100001;
+
+	for (uint32_t iIndex = 0; iIndex < 0x100; iIndex++)
+	{
+		for (uint32_t iSection = 0; iSection < 5; iSection++)
+		{
+			dwSeed = (dwSeed * 125 + 3) % 0x2AAAAB;
+			uint32_t dwHigh = (dwSeed & 0xFFFF) << 16;
+
+			dwSeed = (dwSeed * 125 + 3) % 0x2AAAAB;
+			uint32_t dwLow = dwSeed & 0xFFFF;
+
+			dwReferenceTable[iSection * 0x100 + iIndex] = dwHigh | dwLow;
+		}
+	}
+}
+
+static uint32_t ReferenceHash(const char *lpszName, uint32_t dwHashType)
+{
+	uint32_t dwSeed1 = 0x7FED7FED, dwSeed2 = 0xEEEEEEEE;
+
+	for (const unsigned char *lpbyChar = (const unsigned char *)lpszName; *lpbyChar; lpbyChar++)
+	{
+		uint32_t dwChar = *lpbyChar;
+		if (dwChar >= 'a' && dwChar <= 'z')
+			dwChar -= 'a' - 'A';
+		else if (dwChar == '/')
+			dwChar = '\\';
+
+		dwSeed1 = dwReferenceTable[(dwHashType << 8) + dwChar] ^ (dwSeed1 + dwSeed2);
+		dwSeed2 = dwChar + dwSeed1 + dwSeed2 + (dwSeed2 << 5) + 3;
+	}
+
+	return dwSeed1;
+}
+
+// Checks one name against both the reference and MPQHashString
+static void CheckName(const char *lpszName)
+{
+	MPQNAMEHASHES hashes;
+	MPQHashName(lpszName, &hashes);
+
+	uint32_t dwIndexHash = ReferenceHash(lpszName, MPQ_HASH_TABLE_INDEX);
+	uint32_t dwNameHashA = ReferenceHash(lpszName, MPQ_HASH_NAME_A);
+	uint32_t dwNameHashB = ReferenceHash(lpszName, MPQ_HASH_NAME_B);
+
+	CHECK(MPQHashString(lpszName, MPQ_HASH_TABLE_INDEX) == dwIndexHash);
+	CHECK(MPQHashString(lpszName, MPQ_HASH_NAME_A) == dwNameHashA);
+	CHECK(MPQHashString(lpszName, MPQ_HASH_NAME_B) == dwNameHashB);
+
+	CHECK(hashes.dwIndexHash == dwIndexHash);
+	CHECK(hashes.dwNameHashA == dwNameHashA);
+	CHECK(hashes.dwNameHashB == dwNameHashB);
+}
+
+// Makes a name like those in game MPQs: a few directories and a file name, in mixed case, with either slash
+static std::string MakeTypicalName()
+{
+	static const char *const lpszWords[] = { "unit", "terran", "Protoss", "zerg", "SOUND", "rez", "glue", "Campaign", "marine", "wav", "grp", "Tileset", "font" };
+	static const char *const lpszExtensions[] = { ".grp", ".wav", ".smk", ".pcx", ".tbl", ".dat", ".lo?" };
+	const uint32_t nWords = sizeof(lpszWords) / sizeof(lpszWords[0]);
+	const uint32_t nExtensions = sizeof(lpszExtensions) / sizeof(lpszExtensions[0]);
+
+	std::string name;
+	for (uint32_t nDirectories = NextRandom() % 4; nDirectories; nDirectories--)
+	{
+		name += lpszWords[NextRandom() % nWords];
+		name += (NextRandom() % 4) ? '\\' : '/';
+	}
+
+	name += lpszWords[NextRandom() % nWords];
+	name += std::to_string(NextRandom() % 1000);
+	name += lpszExtensions[NextRandom() % nExtensions];
+
+	return name;
+}
+
+// Makes a name of any bytes but 0, of any length up to 300, to cover the characters and lengths typical names don't
+static std::string MakeArbitraryName()
+{
+	std::string name(NextRandom() % 301, ' ');
+	for (size_t iChar = 0; iChar < name.size(); iChar++)
+		name[iChar] = (char)(NextRandom() % 255 + 1);
+
+	return name;
+}
+
+static void Verify()
+{
+	BuildReferenceTable();
+
+	// The table encryption keys are hashes of fixed names
+	CHECK(MPQHashString("(hash table)", MPQ_HASH_FILE_KEY) == MPQ_HASH_TABLE_KEY);
+	CHECK(MPQHashString("(block table)", MPQ_HASH_FILE_KEY) == MPQ_BLOCK_TABLE_KEY);
+	CHECK(ReferenceHash("(hash table)", MPQ_HASH_FILE_KEY) == MPQ_HASH_TABLE_KEY);
+
+	// Every single character, and the empty name
+	CheckName("");
+	for (uint32_t iChar = 1; iChar < 0x100; iChar++)
+	{
+		char szName[2] = { (char)iChar, '\0' };
+		CheckName(szName);
+	}
+
+	// Case and slashes must not matter
+	MPQNAMEHASHES lowerHashes, upperHashes;
+	MPQHashName("unit/terran/marine.grp", &lowerHashes);
+	MPQHashName("UNIT\\TERRAN\\MARINE.GRP", &upperHashes);
+	CHECK(memcmp(&lowerHashes, &upperHashes, sizeof(lowerHashes)) == 0);
+
+	for (int iName = 0; iName < 20000; iName++)
+	{
+		CheckName(MakeTypicalName().c_str());
+		CheckName(MakeArbitraryName().c_str());
+	}
+}
+
+// Times one way of hashing all the names, taking the fastest of several runs, as the slower ones were interrupted. Returns nanoseconds per name.
+template<typename HASHFUNC> static double TimeHashing(const std::vector<std::string> &names, int nRuns, HASHFUNC hashFunc, uint32_t &dwSink)
+{
+	double fBestSeconds = 0;
+
+	for (int iRun = 0; iRun < nRuns; iRun++)
+	{
+		auto startTime = std::chrono::steady_clock::now();
+
+		for (size_t iName = 0; iName < names.size(); iName++)
+			dwSink += hashFunc(names[iName].c_str());
+
+		double fSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+		if (!iRun || fSeconds < fBestSeconds)
+			fBestSeconds = fSeconds;
+	}
+
+	return fBestSeconds * 1e9 / names.size();
+}
+
+static void Benchmark(size_t nNames, int nRuns)
+{
+	std::vector<std::string> names;
+	names.reserve(nNames);
+
+	size_t cbNames = 0;
+	for (size_t iName = 0; iName < nNames; iName++)
+	{
+		names.push_back(MakeTypicalName());
+		cbNames += names.back().size();
+	}
+
+	// The results are added up and printed, so that the compiler can't leave out the hashing
+	uint32_t dwSink = 0;
+
+	double fStringNs = TimeHashing(names, nRuns, [](const char *lpszName) {
+		return MPQHashString(lpszName, MPQ_HASH_TABLE_INDEX)
+			+ MPQHashString(lpszName, MPQ_HASH_NAME_A)
+			+ MPQHashString(lpszName, MPQ_HASH_NAME_B);
+	}, dwSink);
+
+	double fNameNs = TimeHashing(names, nRuns, [](const char *lpszName) {
+		MPQNAMEHASHES hashes;
+		MPQHashName(lpszName, &hashes);
+
+		return hashes.dwIndexHash + hashes.dwNameHashA + hashes.dwNameHashB;
+	}, dwSink);
+
+	printf("%u names, %.1f characters on average, best of %d runs\n", (unsigned)nNames, (double)cbNames / nNames, nRuns);
+	printf("  MPQHashString x 3: %8.1f ns per name\n", fStringNs);
+	printf("  MPQHashName:       %8.1f ns per name (%.2fx)\n", fNameNs, fStringNs / fNameNs);
+	printf("  (checksum %08X)\n", dwSink);
+}
+
+int main(int argc, char *argv[])
+{
+	bool bVerifyOnly = false;
+	int iArg = 1;
+	if (iArg < argc && !strcmp(argv[iArg], "--verify"))
+	{
+		bVerifyOnly = true;
+		iArg++;
+	}
+
+	size_t nNames = (iArg < argc) ? strtoul(argv[iArg++], NULL, 10) : DEFAULT_NUM_NAMES;
+	int nRuns = (iArg < argc) ? atoi(argv[iArg++]) : DEFAULT_NUM_RUNS;
+	if (!nNames || nRuns <= 0)
+	{
+		fprintf(stderr, "Usage: %s [--verify] [number of names] [number of runs]\n", argv[0]);
+
+		return 2;
+	}
+
+	Verify();
+
+	if (nFailures)
+	{
+		fprintf(stderr, "%d checks failed\n", nFailures);
+
+		return 1;
+	}
+
+	printf("All checks passed\n");
+
+	if (!bVerifyOnly)
+		Benchmark(nNames, nRuns);
+
+	return 0;
+}
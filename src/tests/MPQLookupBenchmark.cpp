@@ -0,0 +1,189 @@
+/*
+	The contents of this file are subject to the Common Development and Distribution License Version 1.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at http://www.sun.com/cddl/cddl.html.
+
+	Software distributed under the License is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for the specific language governing rights and limitations under the License.
+
+	The Initial Developer of the Original Code is Justin Olbrantz. The Original Code Copyright (C) 2007 Justin Olbrantz. All Rights Reserved.
+*/
+
+// Times looking files up through the hash table and through the HET table with MPQMeasureLookups, on an archive built with both, with the smallest hash table that holds the files and with one 4 times larger, as the hash table gets slower as it fills up.
+// Usage: MPQLookupBenchmark [--verify] [number of files] [number of runs]. With --verify, only the checks are done, so that it can run as a test. The archive is built from names generated from a fixed seed, so every run measures the same archive.
+
+#include "MPQArchive.h"
+#include "MPQOverlay.h"
+#include "MPQRehash.h"
+#include "MPQTestArchive.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+static int nFailures = 0;
+
+#define CHECK(expr) \
+	do { if (!(expr)) { fprintf(stderr, "%s(%d): check failed: %s\n", __FILE__, __LINE__, #expr); nFailures++; } } while (0)
+
+#define DEFAULT_NUM_FILES 20000
+#define DEFAULT_NUM_RUNS 5
+
+// The archive is written here, in the directory the benchmark is run in
+#define BENCHMARK_ARCHIVE_NAME "MPQLookupBenchmark.mpq"
+
+// A small deterministic generator, so that the names are the same on every machine and every run
+static uint32_t dwRandomState = 0x12345678;
+
+static uint32_t NextRandom()
+{
+	dwRandomState = dwRandomState * 1103515245 + 12345;
+
+	return dwRandomState >> 8;
+}
+
+// Makes a name like those in game MPQs. The number at the end keeps them from repeating.
+static std::string MakeTypicalName(uint32_t iName)
+{
+	static const char *const lpszWords[] = { "unit", "terran", "Protoss", "zerg", "SOUND", "rez", "glue", "Campaign", "marine", "wav", "grp", "Tileset", "font" };
+	static const char *const lpszExtensions[] = { ".grp", ".wav", ".smk", ".pcx", ".tbl", ".dat" };
+	const uint32_t nWords = sizeof(lpszWords) / sizeof(lpszWords[0]);
+	const uint32_t nExtensions = sizeof(lpszExtensions) / sizeof(lpszExtensions[0]);
+
+	std::string name;
+	for (uint32_t nDirectories = NextRandom() % 4; nDirectories; nDirectories--)
+	{
+		name += lpszWords[NextRandom() % nWords];
+		name += '\\';
+	}
+
+	name += lpszWords[NextRandom() % nWords];
+	name += std::to_string(iName);
+	name += lpszExtensions[NextRandom() % nExtensions];
+
+	return name;
+}
+
+// Builds the archive, measures it nRuns times, and keeps the fastest of each time, as the slower ones were interrupted
+static bool MeasureArchive(const std::vector<TESTFILE> &files, const std::string &names, uint32_t nHashTableEntries, int nRuns, MPQLOOKUPTIMES &times)
+{
+	memset(&times, 0, sizeof(times));
+
+	if (!WriteTestArchive(BENCHMARK_ARCHIVE_NAME, BuildTestArchive(files, nHashTableEntries, TEST_HET_GOOD)))
+	{
+		fprintf(stderr, "Unable to write %s\n", BENCHMARK_ARCHIVE_NAME);
+
+		return false;
+	}
+
+	const char *lpszArchiveName = BENCHMARK_ARCHIVE_NAME;
+	HMPQOVERLAY hOverlay;
+	MPQERROR error = MPQCreateOverlay(&lpszArchiveName, 1, 0, &hOverlay, NULL);
+	if (error != MPQ_ERROR_SUCCESS)
+	{
+		fprintf(stderr, "Unable to open %s: %s\n", BENCHMARK_ARCHIVE_NAME, MPQGetErrorString(error));
+
+		return false;
+	}
+
+	MPQAddOverlayNames(hOverlay, names.data(), names.size());
+
+	HMPQARCHIVE hArchive = MPQGetOverlayArchives(hOverlay)[0].hArchive;
+	bool bHETTable = MPQGetHETTable(hArchive) != NULL;
+	CHECK(bHETTable);
+
+	for (int iRun = 0; iRun < nRuns; iRun++)
+	{
+		MPQLOOKUPTIMES runTimes;
+		MPQMeasureLookups(hOverlay, 0, &runTimes);
+
+		CHECK(runTimes.nNames == files.size());
+		CHECK(runTimes.fHashTableHitSeconds > 0 && runTimes.fHashTableMissSeconds > 0);
+		CHECK(bHETTable == (runTimes.fHETTableHitSeconds > 0 && runTimes.fHETTableMissSeconds > 0));
+
+		if (!iRun)
+			times = runTimes;
+		else
+		{
+			times.fHashTableHitSeconds = std::min(times.fHashTableHitSeconds, runTimes.fHashTableHitSeconds);
+			times.fHashTableMissSeconds = std::min(times.fHashTableMissSeconds, runTimes.fHashTableMissSeconds);
+			times.fHETTableHitSeconds = std::min(times.fHETTableHitSeconds, runTimes.fHETTableHitSeconds);
+			times.fHETTableMissSeconds = std::min(times.fHETTableMissSeconds, runTimes.fHETTableMissSeconds);
+		}
+	}
+
+	MPQCloseOverlay(hOverlay);
+
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	bool bVerifyOnly = false;
+	int iArg = 1;
+	if (iArg < argc && !strcmp(argv[iArg], "--verify"))
+	{
+		bVerifyOnly = true;
+		iArg++;
+	}
+
+	uint32_t nFiles = (iArg < argc) ? (uint32_t)strtoul(argv[iArg++], NULL, 10) : DEFAULT_NUM_FILES;
+	int nRuns = (iArg < argc) ? atoi(argv[iArg++]) : DEFAULT_NUM_RUNS;
+	if (!nFiles || nFiles > 0x1000000 || nRuns <= 0)
+	{
+		fprintf(stderr, "Usage: %s [--verify] [number of files] [number of runs]\n", argv[0]);
+
+		return 2;
+	}
+
+	// Verifying only needs each measurement made once
+	if (bVerifyOnly)
+		nRuns = 1;
+
+	std::vector<TESTFILE> files;
+	std::string names;
+	for (uint32_t iFile = 0; iFile < nFiles; iFile++)
+	{
+		files.push_back({ MakeTypicalName(iFile), std::string(1, (char)iFile), 0 });
+		names += files.back().name + "\r\n";
+	}
+
+	// The smallest hash table with room for the files, which may be all but full, and one 4 times that
+	uint32_t nFullHashTableEntries = 1;
+	while (nFullHashTableEntries <= nFiles)
+		nFullHashTableEntries *= 2;
+
+	const uint32_t anHashTableEntries[] = { nFullHashTableEntries, nFullHashTableEntries * 4 };
+
+	printf("%u files, best of %d runs\n", nFiles, nRuns);
+
+	for (size_t iSize = 0; iSize < sizeof(anHashTableEntries) / sizeof(anHashTableEntries[0]); iSize++)
+	{
+		MPQLOOKUPTIMES times;
+		if (!MeasureArchive(files, names, anHashTableEntries[iSize], nRuns, times))
+		{
+			nFailures++;
+			break;
+		}
+
+		if (!bVerifyOnly)
+		{
+			printf("  %u hash table entries (%u%% full):\n", anHashTableEntries[iSize], (unsigned)((uint64_t)nFiles * 100 / anHashTableEntries[iSize]));
+			printf("    Hash table: %8.1f ns per hit, %8.1f ns per miss\n", times.fHashTableHitSeconds * 1e9, times.fHashTableMissSeconds * 1e9);
+			printf("    HET table:  %8.1f ns per hit, %8.1f ns per miss\n", times.fHETTableHitSeconds * 1e9, times.fHETTableMissSeconds * 1e9);
+		}
+	}
+
+	remove(BENCHMARK_ARCHIVE_NAME);
+
+	if (nFailures)
+	{
+		fprintf(stderr, "%d checks failed\n", nFailures);
+
+		return 1;
+	}
+
+	printf("All checks passed\n");
+
+	return 0;
+}
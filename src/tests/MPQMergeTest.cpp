@@ -0,0 +1,160 @@
+/*
+	The contents of this file are subject to the Common Development and Distribution License Version 1.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at http://www.sun.com/cddl/cddl.html.
+
+	Software distributed under the License is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for the specific language governing rights and limitations under the License.
+
+	The Initial Developer of the Original Code is Justin Olbrantz. The Original Code Copyright (C) 2007 Justin Olbrantz. All Rights Reserved.
+*/
+
+// Tests that merging archives with files in several locales gives the same file Storm would read from the archives themselves, for every name and locale: Storm takes the first archive with either the locale's copy or the neutral copy of a name, so a neutral copy hides the other locales' copies in every archive below it.
+
+#include "MPQArchive.h"
+#include "MPQFile.h"
+#include "MPQMerge.h"
+#include "MPQOverlay.h"
+#include "MPQTestArchive.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+static int nFailures = 0;
+
+#define CHECK(expr) \
+	do { if (!(expr)) { fprintf(stderr, "%s(%d): check failed: %s\n", __FILE__, __LINE__, #expr); nFailures++; } } while (0)
+
+// The archives are written here, in the directory the test is run in. The first has the lowest priority.
+#define TEST_LOW_ARCHIVE_NAME "MPQMergeTestLow.mpq"
+#define TEST_HIGH_ARCHIVE_NAME "MPQMergeTestHigh.mpq"
+#define TEST_MERGED_ARCHIVE_NAME "MPQMergeTest.mpq"
+
+#define TEST_LOCALE_GERMAN 0x407
+#define TEST_LOCALE_ENGLISH 0x409
+
+// The locales each name is looked up in: neutral, the two the archives have files in, and one they don't
+static const uint16_t awTestLocales[] = { MPQ_LOCALE_NEUTRAL, TEST_LOCALE_GERMAN, TEST_LOCALE_ENGLISH, 0x40C };
+
+static const char *const lpszTestNames[] = { "hidden.txt", "localized.txt", "same archive.txt", "plain.txt", "no neutral.txt" };
+
+// Reads the file Storm would read for a name and locale from a list of archives, highest priority last, or returns false if there is none
+static bool ReadAsStorm(const std::vector<HMPQARCHIVE> &archives, const char *lpszName, uint16_t wLocale, std::string &data)
+{
+	for (size_t iArchive = archives.size(); iArchive-- > 0; )
+	{
+		// MPQFindFile falls back to the neutral copy within the archive, as Storm does
+		uint32_t iHashEntry, nBlocks;
+		if (MPQFindFile(archives[iArchive], lpszName, wLocale, &iHashEntry) != MPQ_ERROR_SUCCESS)
+			continue;
+
+		uint32_t iBlock = MPQGetHashTable(archives[iArchive], NULL)[iHashEntry].dwBlockIndex;
+		const MPQBLOCKENTRY *lpBlockTable = MPQGetBlockTable(archives[iArchive], &nBlocks);
+		if (iBlock >= nBlocks)
+			return false;
+
+		data.assign(lpBlockTable[iBlock].cbFileSize, '\0');
+
+		return MPQReadFile(archives[iArchive], iBlock, lpszName, &data[0]) == MPQ_ERROR_SUCCESS;
+	}
+
+	return false;
+}
+
+int main()
+{
+	std::vector<TESTFILE> lowFiles = {
+		{ "hidden.txt", "low, German", TEST_LOCALE_GERMAN },
+		{ "localized.txt", "low, neutral", MPQ_LOCALE_NEUTRAL },
+		{ "same archive.txt", "low, neutral", MPQ_LOCALE_NEUTRAL },
+		{ "same archive.txt", "low, German", TEST_LOCALE_GERMAN },
+		{ "plain.txt", "low, neutral", MPQ_LOCALE_NEUTRAL },
+		{ "no neutral.txt", "low, English", TEST_LOCALE_ENGLISH },
+	};
+	std::vector<TESTFILE> highFiles = {
+		{ "hidden.txt", "high, neutral", MPQ_LOCALE_NEUTRAL },
+		{ "localized.txt", "high, German", TEST_LOCALE_GERMAN },
+		{ "plain.txt", "high, neutral", MPQ_LOCALE_NEUTRAL },
+		{ "no neutral.txt", "high, German", TEST_LOCALE_GERMAN },
+	};
+
+	CHECK(WriteTestArchive(TEST_LOW_ARCHIVE_NAME, BuildTestArchive(lowFiles, 16, TEST_HET_NONE)));
+	CHECK(WriteTestArchive(TEST_HIGH_ARCHIVE_NAME, BuildTestArchive(highFiles, 16, TEST_HET_NONE)));
+
+	const char *lpszArchiveNames[] = { TEST_LOW_ARCHIVE_NAME, TEST_HIGH_ARCHIVE_NAME };
+	HMPQOVERLAY hOverlay;
+	CHECK(MPQCreateOverlay(lpszArchiveNames, 2, 0, &hOverlay, NULL) == MPQ_ERROR_SUCCESS);
+	if (nFailures)
+		return 1;
+
+	std::string names;
+	for (const char *lpszName : lpszTestNames)
+		names += std::string(lpszName) + "\n";
+	MPQAddOverlayNames(hOverlay, names.data(), names.size());
+
+	// Only the German copy of hidden.txt is hidden
+	uint32_t nFiles;
+	const MPQOVERLAYFILE *lpFiles = MPQGetOverlayFiles(hOverlay, &nFiles);
+	CHECK(MPQGetOverlayInfo(hOverlay)->nHiddenFiles == 1);
+	for (uint32_t iFile = 0; iFile < nFiles; iFile++)
+	{
+		bool bShouldBeHidden = lpFiles[iFile].lpszName && !strcmp(lpFiles[iFile].lpszName, "hidden.txt") && lpFiles[iFile].wLocale == TEST_LOCALE_GERMAN;
+		CHECK(lpFiles[iFile].bHidden == bShouldBeHidden);
+	}
+
+	MPQMERGEOPTIONS options;
+	memset(&options, 0, sizeof(options));
+	MPQMERGERESULT result;
+	CHECK(MPQMergeArchives(hOverlay, TEST_MERGED_ARCHIVE_NAME, &options, &result) == MPQ_ERROR_SUCCESS);
+
+	// The overlay's archives are the source archives, highest priority last
+	std::vector<HMPQARCHIVE> sourceArchives;
+	for (uint32_t iArchive = 0; iArchive < 2; iArchive++)
+		sourceArchives.push_back(MPQGetOverlayArchives(hOverlay)[iArchive].hArchive);
+
+	HMPQARCHIVE hMerged;
+	CHECK(MPQOpenArchive(TEST_MERGED_ARCHIVE_NAME, &hMerged) == MPQ_ERROR_SUCCESS);
+	if (!nFailures)
+	{
+		std::vector<HMPQARCHIVE> mergedArchives(1, hMerged);
+
+		for (const char *lpszName : lpszTestNames)
+		{
+			for (uint16_t wLocale : awTestLocales)
+			{
+				std::string sourceData, mergedData;
+				bool bInSource = ReadAsStorm(sourceArchives, lpszName, wLocale, sourceData),
+					bInMerged = ReadAsStorm(mergedArchives, lpszName, wLocale, mergedData);
+
+				CHECK(bInSource == bInMerged);
+				CHECK(sourceData == mergedData);
+				if (bInSource != bInMerged || sourceData != mergedData)
+					fprintf(stderr, "  %s, locale %04X: \"%s\" from the archives, \"%s\" merged\n", lpszName, wLocale, sourceData.c_str(), mergedData.c_str());
+			}
+		}
+
+		// The cases the test is for
+		std::string data;
+		CHECK(ReadAsStorm(mergedArchives, "hidden.txt", TEST_LOCALE_GERMAN, data) && data == "high, neutral");
+		CHECK(ReadAsStorm(mergedArchives, "localized.txt", TEST_LOCALE_ENGLISH, data) && data == "low, neutral");
+		CHECK(ReadAsStorm(mergedArchives, "same archive.txt", TEST_LOCALE_GERMAN, data) && data == "low, German");
+
+		MPQCloseArchive(hMerged);
+	}
+
+	MPQCloseOverlay(hOverlay);
+
+	remove(TEST_LOW_ARCHIVE_NAME);
+	remove(TEST_HIGH_ARCHIVE_NAME);
+	remove(TEST_MERGED_ARCHIVE_NAME);
+
+	if (nFailures)
+	{
+		fprintf(stderr, "%d checks failed\n", nFailures);
+
+		return 1;
+	}
+
+	printf("All checks passed\n");
+
+	return 0;
+}
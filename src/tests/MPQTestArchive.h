@@ -0,0 +1,297 @@
+/*
+	The contents of this file are subject to the Common Development and Distribution License Version 1.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at http://www.sun.com/cddl/cddl.html.
+
+	Software distributed under the License is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for the specific language governing rights and limitations under the License.
+
+	The Initial Developer of the Original Code is Justin Olbrantz. The Original Code Copyright (C) 2007 Justin Olbrantz. All Rights Reserved.
+*/
+
+// Builds small MPQs in memory for the tests and benchmarks of the MPQ library, so that they don't depend on archives from the games. Files are stored as they are, without compression or encryption. Archives may be given HET and BET tables, which may be deliberately damaged, to test that they're checked against the hash and block tables.
+
+// Prevent this header from being included multiple times
+#ifndef MPQTESTARCHIVE_H
+#define MPQTESTARCHIVE_H
+
+#include "MPQCrypt.h"
+#include "MPQFormat.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// A file to put in a test archive
+struct TESTFILE
+{
+	std::string name;
+	std::string data;
+	uint16_t wLocale;
+};
+
+// The HET and BET tables to give a test archive
+enum TESTHETTABLE
+{
+	TEST_HET_NONE,	// A version 1 archive, with only the hash and block tables
+	TEST_HET_GOOD,	// A version 3 archive, with HET and BET tables matching the hash and block tables
+	TEST_HET_BAD_FILE_SIZE,	// As TEST_HET_GOOD, but one BET entry has a different file size than its block
+	TEST_HET_BAD_NAME_HASH	// As TEST_HET_GOOD, but the HET hashes are of the wrong names
+};
+
+// Packs values into a bit array, least significant bit first, as the HET and BET tables are stored
+class TestBitWriter
+{
+public:
+	std::vector<uint8_t> bytes;
+
+	void Write(uint64_t iBit, uint32_t nBits, uint64_t qwValue)
+	{
+		for (uint32_t iValueBit = 0; iValueBit < nBits; iValueBit++, iBit++)
+		{
+			if (bytes.size() <= iBit / 8)
+				bytes.resize((size_t)(iBit / 8 + 1));
+
+			if ((qwValue >> iValueBit) & 1)
+				bytes[(size_t)(iBit / 8)] |= (uint8_t)(1 << (iBit % 8));
+		}
+	}
+
+	void Pad(uint64_t nBits)
+	{
+		bytes.resize((size_t)((nBits + 7) / 8));
+	}
+};
+
+static inline void AppendBytes(std::vector<uint8_t> &archive, const void *lpvData, size_t cbData)
+{
+	archive.insert(archive.end(), (const uint8_t *)lpvData, (const uint8_t *)lpvData + cbData);
+}
+
+// Appends an HET or BET table: the extended table header, followed by the table, encrypted
+static void AppendExtTable(std::vector<uint8_t> &archive, uint32_t dwSignature, std::vector<uint8_t> table, uint32_t dwKey)
+{
+	MPQEXTTABLEHEADER header;
+	header.dwSignature = dwSignature;
+	header.dwVersion = 1;
+	header.cbDataSize = (uint32_t)table.size();
+
+	MPQEncryptBlock(table.data(), table.size(), dwKey);
+
+	AppendBytes(archive, &header, sizeof(header));
+	AppendBytes(archive, table.data(), table.size());
+}
+
+// The HET hash of a file as stored in the tables, which always have 64-bit name hashes. The top bit is always set, so that no used entry has a name byte of 0.
+static inline uint64_t GetTestHETHash(const TESTFILE &file, TESTHETTABLE hetTable)
+{
+	uint64_t qwNameHash = MPQHashNameHET(file.name.c_str()) | 0x8000000000000000ULL;
+	if (hetTable == TEST_HET_BAD_NAME_HASH)
+		qwNameHash ^= 0x100;
+
+	return qwNameHash;
+}
+
+static void AppendHETTable(std::vector<uint8_t> &archive, const std::vector<TESTFILE> &files, TESTHETTABLE hetTable)
+{
+	uint32_t nFiles = (uint32_t)files.size();
+	uint32_t nTotalEntries = nFiles * 2 + 1;
+	uint32_t nIndexBits = 1;
+	while ((1U << nIndexBits) < nFiles)
+		nIndexBits++;
+
+	// The top byte of each name hash, at the entry the hash gives or the next free one after it, and the BET index of the file in the same entry
+	std::vector<uint8_t> nameBytes(nTotalEntries, 0);
+	TestBitWriter indices;
+
+	for (uint32_t iFile = 0; iFile < nFiles; iFile++)
+	{
+		uint64_t qwNameHash = GetTestHETHash(files[iFile], hetTable);
+
+		uint32_t iEntry = (uint32_t)(qwNameHash % nTotalEntries);
+		while (nameBytes[iEntry])
+			iEntry = (iEntry + 1) % nTotalEntries;
+
+		nameBytes[iEntry] = (uint8_t)(qwNameHash >> 56);
+		indices.Write((uint64_t)iEntry * nIndexBits, nIndexBits, iFile);
+	}
+
+	indices.Pad((uint64_t)nTotalEntries * nIndexBits);
+
+	MPQHETHEADER header;
+	header.cbTableSize = (uint32_t)(sizeof(MPQEXTTABLEHEADER) + sizeof(header) + nameBytes.size() + indices.bytes.size());
+	header.nUsedEntries = nFiles;
+	header.nTotalEntries = nTotalEntries;
+	header.nNameHashBits = 64;
+	header.nIndexBitsTotal = nIndexBits;
+	header.nIndexBitsExtra = 0;
+	header.nIndexBits = nIndexBits;
+	header.cbIndexTableSize = (uint32_t)indices.bytes.size();
+
+	std::vector<uint8_t> table;
+	AppendBytes(table, &header, sizeof(header));
+	AppendBytes(table, nameBytes.data(), nameBytes.size());
+	AppendBytes(table, indices.bytes.data(), indices.bytes.size());
+
+	AppendExtTable(archive, MPQ_HET_TABLE_SIGNATURE, table, MPQ_HASH_TABLE_KEY);
+}
+
+static void AppendBETTable(std::vector<uint8_t> &archive, const std::vector<TESTFILE> &files, const std::vector<MPQBLOCKENTRY> &blocks, TESTHETTABLE hetTable)
+{
+	// Every field gets a whole number of bytes, to keep the entries easy to read in a hex dump
+	const uint32_t nEntryBits = 32 + 32 + 32 + 8;
+	const uint32_t nNameHashBits = 56;
+	uint32_t nFiles = (uint32_t)files.size();
+
+	std::vector<uint32_t> flags;
+	TestBitWriter entries, nameHashes;
+
+	for (uint32_t iFile = 0; iFile < nFiles; iFile++)
+	{
+		const MPQBLOCKENTRY &block = blocks[iFile];
+
+		uint32_t iFlags = 0;
+		while (iFlags < flags.size() && flags[iFlags] != block.grfFlags)
+			iFlags++;
+		if (iFlags == flags.size())
+			flags.push_back(block.grfFlags);
+
+		uint32_t cbFileSize = block.cbFileSize;
+		if (hetTable == TEST_HET_BAD_FILE_SIZE && iFile == nFiles / 2)
+			cbFileSize++;
+
+		uint64_t iEntryBit = (uint64_t)iFile * nEntryBits;
+		entries.Write(iEntryBit, 32, block.dwFilePos);
+		entries.Write(iEntryBit + 32, 32, cbFileSize);
+		entries.Write(iEntryBit + 64, 32, block.cbCompressedSize);
+		entries.Write(iEntryBit + 96, 8, iFlags);
+
+		nameHashes.Write((uint64_t)iFile * nNameHashBits, nNameHashBits, GetTestHETHash(files[iFile], hetTable));
+	}
+
+	entries.Pad((uint64_t)nFiles * nEntryBits);
+	nameHashes.Pad((uint64_t)nFiles * nNameHashBits);
+
+	MPQBETHEADER header;
+	memset(&header, 0, sizeof(header));
+	header.nEntries = nFiles;
+	header.dwUnknown08 = 0x10;
+	header.nEntryBits = nEntryBits;
+	header.iFilePosBit = 0;
+	header.iFileSizeBit = 32;
+	header.iCompressedSizeBit = 64;
+	header.iFlagIndexBit = 96;
+	header.iUnknownBit = nEntryBits;
+	header.nFilePosBits = 32;
+	header.nFileSizeBits = 32;
+	header.nCompressedSizeBits = 32;
+	header.nFlagIndexBits = 8;
+	header.nNameHashBitsTotal = nNameHashBits;
+	header.nNameHashBits = nNameHashBits;
+	header.cbNameHashTableSize = (uint32_t)nameHashes.bytes.size();
+	header.nFlags = (uint32_t)flags.size();
+	header.cbTableSize = (uint32_t)(sizeof(MPQEXTTABLEHEADER) + sizeof(header) + flags.size() * sizeof(uint32_t) + entries.bytes.size() + nameHashes.bytes.size());
+
+	std::vector<uint8_t> table;
+	AppendBytes(table, &header, sizeof(header));
+	AppendBytes(table, flags.data(), flags.size() * sizeof(uint32_t));
+	AppendBytes(table, entries.bytes.data(), entries.bytes.size());
+	AppendBytes(table, nameHashes.bytes.data(), nameHashes.bytes.size());
+
+	AppendExtTable(archive, MPQ_BET_TABLE_SIGNATURE, table, MPQ_BLOCK_TABLE_KEY);
+}
+
+/*
+	* BuildTestArchive *
+	Builds an archive containing the files, in the order given, which is also the order of their blocks. Files with the same name must have different locales.
+*/
+static std::vector<uint8_t> BuildTestArchive(
+	// The files
+	const std::vector<TESTFILE> &files,
+	// The size of the hash table. Must be a power of 2 larger than the number of files.
+	uint32_t nHashTableEntries,
+	// The HET and BET tables to add
+	TESTHETTABLE hetTable
+)
+{
+	uint32_t cbHeaderSize = (hetTable == TEST_HET_NONE) ? MPQ_HEADER_SIZE_V1 : MPQ_HEADER_SIZE_V3;
+	std::vector<uint8_t> archive(cbHeaderSize, 0);
+
+	std::vector<MPQHASHENTRY> hashTable(nHashTableEntries);
+	memset(hashTable.data(), 0xFF, nHashTableEntries * sizeof(MPQHASHENTRY));
+	std::vector<MPQBLOCKENTRY> blocks;
+
+	for (uint32_t iFile = 0; iFile < files.size(); iFile++)
+	{
+		const TESTFILE &file = files[iFile];
+
+		MPQBLOCKENTRY block;
+		block.dwFilePos = (uint32_t)archive.size();
+		block.cbCompressedSize = (uint32_t)file.data.size();
+		block.cbFileSize = (uint32_t)file.data.size();
+		block.grfFlags = MPQ_FILE_EXISTS;
+		blocks.push_back(block);
+
+		AppendBytes(archive, file.data.data(), file.data.size());
+
+		MPQNAMEHASHES hashes;
+		MPQHashName(file.name.c_str(), &hashes);
+
+		uint32_t iHashEntry = hashes.dwIndexHash & (nHashTableEntries - 1);
+		while (hashTable[iHashEntry].dwBlockIndex != MPQ_HASH_ENTRY_EMPTY)
+			iHashEntry = (iHashEntry + 1) & (nHashTableEntries - 1);
+
+		MPQHASHENTRY &hashEntry = hashTable[iHashEntry];
+		hashEntry.dwNameHashA = hashes.dwNameHashA;
+		hashEntry.dwNameHashB = hashes.dwNameHashB;
+		hashEntry.wLocale = file.wLocale;
+		hashEntry.wPlatform = 0;
+		hashEntry.dwBlockIndex = iFile;
+	}
+
+	MPQHEADER header;
+	memset(&header, 0, sizeof(header));
+	header.dwSignature = MPQ_HEADER_SIGNATURE;
+	header.dwHeaderSize = cbHeaderSize;
+	header.wFormatVersion = (hetTable == TEST_HET_NONE) ? MPQ_FORMAT_VERSION_1 : MPQ_FORMAT_VERSION_3;
+	header.wSectorSizeShift = 3;
+
+	header.dwHashTableOffset = (uint32_t)archive.size();
+	header.nHashTableEntries = nHashTableEntries;
+	MPQEncryptBlock(hashTable.data(), nHashTableEntries * sizeof(MPQHASHENTRY), MPQ_HASH_TABLE_KEY);
+	AppendBytes(archive, hashTable.data(), nHashTableEntries * sizeof(MPQHASHENTRY));
+
+	header.dwBlockTableOffset = (uint32_t)archive.size();
+	header.nBlockTableEntries = (uint32_t)blocks.size();
+	std::vector<MPQBLOCKENTRY> encryptedBlocks = blocks;
+	MPQEncryptBlock(encryptedBlocks.data(), encryptedBlocks.size() * sizeof(MPQBLOCKENTRY), MPQ_BLOCK_TABLE_KEY);
+	AppendBytes(archive, encryptedBlocks.data(), encryptedBlocks.size() * sizeof(MPQBLOCKENTRY));
+
+	if (hetTable != TEST_HET_NONE)
+	{
+		header.qwHETTableOffset = archive.size();
+		AppendHETTable(archive, files, hetTable);
+
+		header.qwBETTableOffset = archive.size();
+		AppendBETTable(archive, files, blocks, hetTable);
+
+		header.qwArchiveSize = archive.size();
+	}
+
+	header.dwArchiveSize = (uint32_t)archive.size();
+	memcpy(archive.data(), &header, cbHeaderSize);
+
+	return archive;
+}
+
+// Writes a test archive to a file, as the MPQ library only opens archives from files
+static bool WriteTestArchive(const char *lpszFileName, const std::vector<uint8_t> &archive)
+{
+	FILE *lpFile = fopen(lpszFileName, "wb");
+	if (!lpFile)
+		return false;
+
+	bool bWritten = fwrite(archive.data(), 1, archive.size(), lpFile) == archive.size();
+
+	return fclose(lpFile) == 0 && bWritten;
+}
+
+#endif // #ifndef MPQTESTARCHIVE_H
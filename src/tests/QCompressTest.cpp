@@ -0,0 +1,243 @@
+/*
+	The contents of this file are subject to the Common Development and Distribution License Version 1.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at http://www.sun.com/cddl/cddl.html.
+
+	Software distributed under the License is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for the specific language governing rights and limitations under the License.
+
+	The Initial Developer of the Original Code is Justin Olbrantz. The Original Code Copyright (C) 2007 Justin Olbrantz. All Rights Reserved.
+*/
+
+// Tests that what QCompressLZ4 writes at each level is read back unchanged by QDecompressLZ4, and that QDecompressLZ4 rejects data that is cut short, damaged, or of the wrong size without writing outside its buffer, as the EFS relies on both when it unpacks compressed plugins.
+
+#include "QCompress.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+static int nFailures = 0;
+
+#define CHECK(expr) \
+	do { if (!(expr)) { fprintf(stderr, "%s(%d): check failed: %s\n", __FILE__, __LINE__, #expr); nFailures++; } } while (0)
+
+// The farthest back a match can refer to
+#define TEST_MAX_DISTANCE 65535
+
+// The EFS compresses files in blocks of this size
+#define TEST_BLOCK_SIZE 65536
+
+// Written after the end of each output buffer, so that a write past the end shows up
+#define GUARD_BYTE 0xCC
+
+static const DWORD adwLevels[] = { QCOMPRESS_LEVEL_FAST, QCOMPRESS_LEVEL_HIGH };
+
+// A small deterministic generator, so that the data is the same on every machine and every run
+static uint32_t dwRandomState = 0x12345678;
+
+static uint8_t NextRandomByte()
+{
+	dwRandomState = dwRandomState * 1103515245 + 12345;
+
+	return (uint8_t)(dwRandomState >> 16);
+}
+
+static std::vector<uint8_t> MakeRandomData(uint32_t cbData)
+{
+	std::vector<uint8_t> data(cbData);
+	for (uint32_t iByte = 0; iByte < cbData; iByte++)
+		data[iByte] = NextRandomByte();
+
+	return data;
+}
+
+// Decompresses into a buffer of nOutputSize bytes, checking that nothing was written past it. Returns whether QDecompressLZ4 succeeded.
+static bool Decompress(const std::vector<uint8_t> &compressed, DWORD nOutputSize, std::vector<uint8_t> &decompressed)
+{
+	decompressed.assign(nOutputSize + 1, GUARD_BYTE);
+	BOOL bSuccess = QDecompressLZ4(compressed.data(), (DWORD)compressed.size(), &decompressed[0], nOutputSize);
+	CHECK(decompressed[nOutputSize] == GUARD_BYTE);
+	decompressed.resize(nOutputSize);
+
+	return bSuccess != FALSE;
+}
+
+// Compresses the data at a level, checks that it decompresses to the same data and only to exactly its size, and that it can't be decompressed when cut short. Returns the compressed size, or 0 if either step failed.
+static DWORD CheckRoundTrip(const std::vector<uint8_t> &data, DWORD dwLevel)
+{
+	DWORD nDataSize = (DWORD)data.size();
+
+	std::vector<uint8_t> compressed(QCOMPRESS_BOUND(nDataSize) + 1, GUARD_BYTE);
+	DWORD nCompressedSize = QCompressLZ4(data.data(), nDataSize, &compressed[0], QCOMPRESS_BOUND(nDataSize), dwLevel);
+	CHECK(nCompressedSize);
+	CHECK(compressed[QCOMPRESS_BOUND(nDataSize)] == GUARD_BYTE);
+	if (!nCompressedSize)
+		return 0;
+
+	compressed.resize(nCompressedSize);
+
+	std::vector<uint8_t> decompressed;
+	bool bDecompressed = Decompress(compressed, nDataSize, decompressed);
+	CHECK(bDecompressed);
+	CHECK(decompressed == data);
+	if (!bDecompressed)
+		return 0;
+
+	// The data must decompress to exactly the size it was
+	if (nDataSize)
+		CHECK(!Decompress(compressed, nDataSize - 1, decompressed));
+	CHECK(!Decompress(compressed, nDataSize + 1, decompressed));
+
+	// Cutting anything off the end must be noticed. Long data is cut at a sample of places, as decompressing it at every one would take a long time.
+	DWORD nStep = nCompressedSize / 256 + 1;
+	for (DWORD nTruncatedSize = 0; nTruncatedSize < nCompressedSize; nTruncatedSize += (nCompressedSize - nTruncatedSize > 64) ? nStep : 1)
+	{
+		std::vector<uint8_t> truncated(compressed.begin(), compressed.begin() + nTruncatedSize);
+		CHECK(!Decompress(truncated, nDataSize, decompressed));
+	}
+
+	return nCompressedSize;
+}
+
+static void TestShortData()
+{
+	// Up to and past the size below which blocks are written as literals only
+	for (DWORD nDataSize = 0; nDataSize <= 32; nDataSize++)
+	{
+		for (size_t iLevel = 0; iLevel < sizeof(adwLevels) / sizeof(adwLevels[0]); iLevel++)
+		{
+			CheckRoundTrip(std::vector<uint8_t>(nDataSize, 'a'), adwLevels[iLevel]);
+			CheckRoundTrip(MakeRandomData(nDataSize), adwLevels[iLevel]);
+		}
+	}
+}
+
+static void TestRepetitiveData()
+{
+	// A single byte repeated, which is a match overlapping itself
+	std::vector<uint8_t> sameByte(TEST_BLOCK_SIZE, 'a');
+
+	// A short pattern repeated, with a change every so often
+	std::vector<uint8_t> pattern(TEST_BLOCK_SIZE);
+	for (uint32_t iByte = 0; iByte < pattern.size(); iByte++)
+		pattern[iByte] = (iByte % 1000 == 999) ? NextRandomByte() : "MPQDraft"[iByte % 8];
+
+	for (size_t iLevel = 0; iLevel < sizeof(adwLevels) / sizeof(adwLevels[0]); iLevel++)
+	{
+		DWORD nCompressedSize = CheckRoundTrip(sameByte, adwLevels[iLevel]);
+		CHECK(nCompressedSize && nCompressedSize < sameByte.size() / 100);
+
+		nCompressedSize = CheckRoundTrip(pattern, adwLevels[iLevel]);
+		CHECK(nCompressedSize && nCompressedSize < pattern.size() / 10);
+	}
+}
+
+static void TestIncompressibleData()
+{
+	std::vector<uint8_t> data = MakeRandomData(TEST_BLOCK_SIZE);
+
+	for (size_t iLevel = 0; iLevel < sizeof(adwLevels) / sizeof(adwLevels[0]); iLevel++)
+	{
+		// QCOMPRESS_BOUND must be enough even when nothing can be matched
+		DWORD nCompressedSize = CheckRoundTrip(data, adwLevels[iLevel]);
+		CHECK(nCompressedSize > data.size() && nCompressedSize <= QCOMPRESS_BOUND(data.size()));
+
+		// Without room for that, compression fails rather than writing past the end
+		std::vector<uint8_t> compressed(data.size() + 1, GUARD_BYTE);
+		CHECK(!QCompressLZ4(data.data(), (DWORD)data.size(), &compressed[0], (DWORD)data.size(), adwLevels[iLevel]));
+		CHECK(compressed[data.size()] == GUARD_BYTE);
+	}
+}
+
+// Repeats a block of random data a given distance after it, with random data between, and returns the compressed size
+static DWORD CheckMatchAtDistance(DWORD nDistance, DWORD dwLevel)
+{
+	const DWORD nBlockSize = 64;
+
+	dwRandomState = 0x12345678;
+	std::vector<uint8_t> data = MakeRandomData(nDistance + nBlockSize * 2);
+	memcpy(&data[nDistance], &data[0], nBlockSize);
+
+	return CheckRoundTrip(data, dwLevel);
+}
+
+static void TestWindowLimit()
+{
+	// A match from as far back as an offset can reach must be used and read back correctly; one from a byte further can't be used, and the block has to be stored as literals, which are larger
+	for (size_t iLevel = 0; iLevel < sizeof(adwLevels) / sizeof(adwLevels[0]); iLevel++)
+	{
+		DWORD nAtLimitSize = CheckMatchAtDistance(TEST_MAX_DISTANCE, adwLevels[iLevel]);
+		DWORD nPastLimitSize = CheckMatchAtDistance(TEST_MAX_DISTANCE + 1, adwLevels[iLevel]);
+		CHECK(nAtLimitSize && nPastLimitSize && nAtLimitSize < nPastLimitSize);
+	}
+}
+
+// A block written by hand as other LZ4 compressors would write it, so that the format is checked against the standard, and not just against QCompressLZ4
+static void TestStandardBlock()
+{
+	static const uint8_t abyBlock[] = {
+		0x35, 'a', 'b', 'c', 0x03, 0x00,		// 3 literals, then 9 bytes from 3 back
+		0x50, 'h', 'e', 'l', 'l', 'o'			// The last 5 literals
+	};
+	static const char szExpected[] = "abcabcabcabchello";
+
+	std::vector<uint8_t> block(abyBlock, abyBlock + sizeof(abyBlock)), decompressed;
+	CHECK(Decompress(block, sizeof(szExpected) - 1, decompressed));
+	CHECK(!memcmp(decompressed.data(), szExpected, sizeof(szExpected) - 1));
+}
+
+static void TestCorruptData()
+{
+	std::vector<uint8_t> decompressed;
+
+	// A match from before the start of the data, and one with an offset of 0
+	static const uint8_t abyBeforeStart[] = { 0x10, 'a', 0x02, 0x00, 0x50, 'h', 'e', 'l', 'l', 'o' };
+	static const uint8_t abyZeroOffset[] = { 0x10, 'a', 0x00, 0x00, 0x50, 'h', 'e', 'l', 'l', 'o' };
+	CHECK(!Decompress(std::vector<uint8_t>(abyBeforeStart, abyBeforeStart + sizeof(abyBeforeStart)), 10, decompressed));
+	CHECK(!Decompress(std::vector<uint8_t>(abyZeroOffset, abyZeroOffset + sizeof(abyZeroOffset)), 10, decompressed));
+
+	// A literal length far longer than the data, which must not wrap around
+	std::vector<uint8_t> longLength(1, 0xF0);
+	longLength.insert(longLength.end(), 0x1010102, 0xFF);
+	longLength.push_back(0);
+	CHECK(!Decompress(longLength, TEST_BLOCK_SIZE, decompressed));
+
+	// Damage each byte of some compressed data in turn. The result may still happen to be valid data, but it must never be written outside the buffer, which Decompress checks.
+	std::vector<uint8_t> data(TEST_BLOCK_SIZE / 16);
+	for (uint32_t iByte = 0; iByte < data.size(); iByte++)
+		data[iByte] = (iByte % 300 < 200) ? "MPQDraft"[iByte % 8] : NextRandomByte();
+
+	std::vector<uint8_t> compressed(QCOMPRESS_BOUND(data.size()));
+	compressed.resize(QCompressLZ4(data.data(), (DWORD)data.size(), &compressed[0], (DWORD)compressed.size(), QCOMPRESS_LEVEL_HIGH));
+	CHECK(!compressed.empty());
+
+	for (size_t iByte = 0; iByte < compressed.size(); iByte++)
+	{
+		static const uint8_t abyDamage[] = { 0x01, 0x80, 0xFF };
+		for (size_t iDamage = 0; iDamage < sizeof(abyDamage); iDamage++)
+		{
+			std::vector<uint8_t> damaged = compressed;
+			damaged[iByte] ^= abyDamage[iDamage];
+			Decompress(damaged, (DWORD)data.size(), decompressed);
+		}
+	}
+}
+
+int main()
+{
+	TestShortData();
+	TestRepetitiveData();
+	TestIncompressibleData();
+	TestWindowLimit();
+	TestStandardBlock();
+	TestCorruptData();
+
+	if (nFailures)
+	{
+		fprintf(stderr, "%d checks failed\n", nFailures);
+
+		return 1;
+	}
+
+	printf("All checks passed\n");
+
+	return 0;
+}
@@ -0,0 +1,135 @@
+/*
+	The contents of this file are subject to the Common Development and Distribution License Version 1.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at http://www.sun.com/cddl/cddl.html.
+
+	Software distributed under the License is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for the specific language governing rights and limitations under the License.
+
+	The Initial Developer of the Original Code is Justin Olbrantz. The Original Code Copyright (C) 2007 Justin Olbrantz. All Rights Reserved.
+*/
+
+// Times the steps of loading a DLL from memory that don't need Windows - reading the headers, laying the image out, relocating it, and looking up exports - on the test images of both bitnesses (see QPETestImage.h).
+// Usage: QPEImageBenchmark [--verify] [number of calls] [number of runs]. With --verify, each step is only done once and its result checked, so that it can run as a test.
+
+#include "QPEImage.h"
+#include "QPETestImage.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+static int nFailures = 0;
+
+#define CHECK(expr) \
+	do { if (!(expr)) { fprintf(stderr, "%s(%d): check failed: %s\n", __FILE__, __LINE__, #expr); nFailures++; } } while (0)
+
+#define DEFAULT_NUM_CALLS 200000
+#define DEFAULT_NUM_RUNS 5
+
+// Calls one step nCalls times per run, checking that every call succeeds, and takes the fastest of the runs, as the slower ones were interrupted. Returns nanoseconds per call.
+template<typename STEPFUNC> static double TimeStep(uint32_t nCalls, int nRuns, STEPFUNC stepFunc)
+{
+	double fBestSeconds = 0;
+	uint32_t nFailedCalls = 0;
+
+	for (int iRun = 0; iRun < nRuns; iRun++)
+	{
+		auto startTime = std::chrono::steady_clock::now();
+
+		for (uint32_t iCall = 0; iCall < nCalls; iCall++)
+			nFailedCalls += (stepFunc(iCall) != PE_ERROR_SUCCESS);
+
+		double fSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+		if (!iRun || fSeconds < fBestSeconds)
+			fBestSeconds = fSeconds;
+	}
+
+	CHECK(!nFailedCalls);
+
+	return fBestSeconds * 1e9 / nCalls;
+}
+
+template<typename OPTIONALHEADER> static void BenchmarkImage(bool b64Bit, uint32_t nCalls, int nRuns, bool bVerifyOnly)
+{
+	std::vector<uint8_t> file = BuildTestImage<OPTIONALHEADER>(b64Bit);
+	std::vector<uint8_t> image(TEST_IMAGE_SIZE);
+	const uint8_t *lpbyFile = &file[0];
+	uint8_t *lpbyImage = &image[0];
+	uint32_t cbFile = (uint32_t)file.size();
+
+	PEIMAGEINFO imageInfo;
+	double fHeadersNs = TimeStep(nCalls, nRuns, [&](uint32_t) {
+		return GetPEImageInfo(lpbyFile, cbFile, &imageInfo);
+	});
+	CHECK(imageInfo.cbImage == TEST_IMAGE_SIZE);
+
+	double fMapNs = TimeStep(nCalls, nRuns, [&](uint32_t) {
+		return MapPEImage(lpbyFile, cbFile, lpbyImage, TEST_IMAGE_SIZE);
+	});
+	CHECK(image[TEST_TEXT_RVA] == 0x90);
+
+	// Moving back and forth between two bases, so that every call has a relocation to apply. A 32-bit image can't go above 4 GB.
+	uint64_t qwNewBase = b64Bit ? 0x7FF612340000ULL : 0x00350000ULL;
+	double fRelocateNs = TimeStep(nCalls, nRuns, [&](uint32_t iCall) {
+		return RelocatePEImage(lpbyImage, TEST_IMAGE_SIZE, (iCall & 1) ? TEST_IMAGE_BASE : qwNewBase);
+	});
+	CHECK(GetPEImageInfo(lpbyImage, TEST_IMAGE_SIZE, &imageInfo) == PE_ERROR_SUCCESS);
+	CHECK(imageInfo.qwImageBase == ((nCalls & 1) ? qwNewBase : TEST_IMAGE_BASE));
+
+	// Alternately by name and by ordinal
+	uint32_t dwFunctionRVA = 0;
+	double fExportNs = TimeStep(nCalls, nRuns, [&](uint32_t iCall) {
+		return (iCall & 1) ? FindPEExport(lpbyImage, TEST_IMAGE_SIZE, NULL, TEST_EXPORT_ORDINAL_BASE, &dwFunctionRVA, NULL)
+			: FindPEExport(lpbyImage, TEST_IMAGE_SIZE, "Alpha", 0, &dwFunctionRVA, NULL);
+	});
+	CHECK(dwFunctionRVA == TEST_TEXT_RVA + 0x20);
+
+	if (!bVerifyOnly)
+	{
+		printf("  %s image:\n", b64Bit ? "64-bit" : "32-bit");
+		printf("    GetPEImageInfo:  %8.1f ns per call\n", fHeadersNs);
+		printf("    MapPEImage:      %8.1f ns per call\n", fMapNs);
+		printf("    RelocatePEImage: %8.1f ns per call\n", fRelocateNs);
+		printf("    FindPEExport:    %8.1f ns per call\n", fExportNs);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	bool bVerifyOnly = false;
+	int iArg = 1;
+	if (iArg < argc && !strcmp(argv[iArg], "--verify"))
+	{
+		bVerifyOnly = true;
+		iArg++;
+	}
+
+	uint32_t nCalls = (iArg < argc) ? (uint32_t)strtoul(argv[iArg++], NULL, 10) : DEFAULT_NUM_CALLS;
+	int nRuns = (iArg < argc) ? atoi(argv[iArg++]) : DEFAULT_NUM_RUNS;
+	if (!nCalls || nRuns <= 0)
+	{
+		fprintf(stderr, "Usage: %s [--verify] [number of calls] [number of runs]\n", argv[0]);
+
+		return 2;
+	}
+
+	// Verifying only needs each step done once
+	if (bVerifyOnly)
+		nCalls = nRuns = 1;
+	else
+		printf("%u calls, best of %d runs\n", nCalls, nRuns);
+
+	BenchmarkImage<PEOPTIONALHEADER32>(false, nCalls, nRuns, bVerifyOnly);
+	BenchmarkImage<PEOPTIONALHEADER64>(true, nCalls, nRuns, bVerifyOnly);
+
+	if (nFailures)
+	{
+		fprintf(stderr, "%d checks failed\n", nFailures);
+
+		return 1;
+	}
+
+	printf("All checks passed\n");
+
+	return 0;
+}
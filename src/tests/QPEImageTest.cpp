@@ -0,0 +1,254 @@
+/*
+	The contents of this file are subject to the Common Development and Distribution License Version 1.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at http://www.sun.com/cddl/cddl.html.
+
+	Software distributed under the License is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for the specific language governing rights and limitations under the License.
+
+	The Initial Developer of the Original Code is Justin Olbrantz. The Original Code Copyright (C) 2007 Justin Olbrantz. All Rights Reserved.
+*/
+
+// Tests QPEImage against synthetic DLL images of both bitnesses (see QPETestImage.h), and against corrupted copies of them
+
+#include "QPEImage.h"
+#include "QPETestImage.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+static int nFailures = 0;
+
+#define CHECK(expr) \
+	do { if (!(expr)) { fprintf(stderr, "%s(%d): check failed: %s\n", __FILE__, __LINE__, #expr); nFailures++; } } while (0)
+
+static uint64_t ReadPointer(const std::vector<uint8_t> &image, uint32_t dwRVA, bool b64Bit)
+{
+	if (b64Bit)
+	{
+		uint64_t qwValue;
+		memcpy(&qwValue, &image[dwRVA], sizeof(qwValue));
+
+		return qwValue;
+	}
+
+	uint32_t dwValue;
+	memcpy(&dwValue, &image[dwRVA], sizeof(dwValue));
+
+	return dwValue;
+}
+
+// Records the imports BindPEImports asks for, and makes up an address for each
+struct RESOLVERLOG
+{
+	std::vector<std::string> imports;
+	bool bFail;
+};
+
+static bool TestResolver(void *lpvContext, const char *lpszModuleName, const char *lpszFunctionName, uint16_t wOrdinal, uint64_t *lpqwAddress)
+{
+	RESOLVERLOG *pLog = (RESOLVERLOG *)lpvContext;
+	if (pLog->bFail)
+		return false;
+
+	char szImport[256];
+	if (lpszFunctionName)
+		snprintf(szImport, sizeof(szImport), "%s!%s@%u", lpszModuleName, lpszFunctionName, wOrdinal);
+	else
+		snprintf(szImport, sizeof(szImport), "%s!#%u", lpszModuleName, wOrdinal);
+
+	pLog->imports.push_back(szImport);
+	*lpqwAddress = 0x70000000 + (pLog->imports.size() * 0x10);
+
+	return true;
+}
+
+template<typename OPTIONALHEADER> static void TestImage(bool b64Bit)
+{
+	std::vector<uint8_t> file = BuildTestImage<OPTIONALHEADER>(b64Bit);
+
+	// The headers
+	PEIMAGEINFO imageInfo;
+	CHECK(GetPEImageInfo(&file[0], (uint32_t)file.size(), &imageInfo) == PE_ERROR_SUCCESS);
+	CHECK(imageInfo.b64Bit == b64Bit);
+	CHECK(imageInfo.wMachine == (b64Bit ? PE_MACHINE_AMD64 : PE_MACHINE_I386));
+	CHECK(imageInfo.wCharacteristics & PE_FILE_DLL);
+	CHECK(imageInfo.qwImageBase == TEST_IMAGE_BASE);
+	CHECK(imageInfo.cbImage == TEST_IMAGE_SIZE);
+	CHECK(imageInfo.cbHeaders == TEST_HEADERS_SIZE);
+	CHECK(imageInfo.dwEntryPointRVA == TEST_TEXT_RVA);
+	CHECK(imageInfo.cbSectionAlignment == TEST_SECTION_ALIGNMENT);
+	CHECK(imageInfo.nSections == 3);
+	CHECK(imageInfo.bRelocatable);
+	CHECK(imageInfo.dataDirectories[PE_DIRECTORY_EXPORT].dwRVA == TEST_EXPORT_RVA);
+
+	PESECTIONHEADER section;
+	CHECK(GetPESection(&file[0], (uint32_t)file.size(), 1, &section) == PE_ERROR_SUCCESS);
+	CHECK(!strcmp(section.szName, ".data") && (section.dwRVA == TEST_DATA_RVA));
+	CHECK(GetPESection(&file[0], (uint32_t)file.size(), 3, &section) == PE_ERROR_NOT_FOUND);
+
+	// Laying it out
+	std::vector<uint8_t> image(TEST_IMAGE_SIZE, 0xEE);
+	CHECK(MapPEImage(&file[0], (uint32_t)file.size(), &image[0], TEST_IMAGE_SIZE - 1) == PE_ERROR_BUFFER_TOO_SMALL);
+	CHECK(MapPEImage(&file[0], (uint32_t)file.size(), &image[0], TEST_IMAGE_SIZE) == PE_ERROR_SUCCESS);
+
+	CHECK(!memcmp(&image[0], &file[0], TEST_HEADERS_SIZE));
+	CHECK(image[TEST_TEXT_RVA] == 0x90);
+	CHECK(image[TEST_TEXT_RVA + 0x0F] == 0x9F);
+	CHECK(image[TEST_HIDDEN_RVA] == 0);
+	CHECK(image[TEST_TEXT_RVA - 1] == 0);
+	CHECK(!memcmp(&image[TEST_EXPORT_RVA], &file[DataOffset(TEST_EXPORT_RVA)], TEST_EXPORT_SIZE));
+	CHECK(image[TEST_DATA_RVA + TEST_DATA_VIRTUAL_SIZE - 1] == 0);
+	CHECK(ReadPointer(image, TEST_POINTER_RVA, b64Bit) == TEST_IMAGE_BASE + TEST_POINTER_TARGET_RVA);
+
+	// Relocating it, and relocating it back. A 32-bit image can't go above 4 GB.
+	uint64_t qwNewBase = b64Bit ? 0x7FF612340000ULL : 0x00350000ULL;
+	CHECK(RelocatePEImage(&image[0], TEST_IMAGE_SIZE, TEST_IMAGE_BASE) == PE_ERROR_SUCCESS);
+	CHECK(ReadPointer(image, TEST_POINTER_RVA, b64Bit) == TEST_IMAGE_BASE + TEST_POINTER_TARGET_RVA);
+	CHECK(RelocatePEImage(&image[0], TEST_IMAGE_SIZE, qwNewBase) == PE_ERROR_SUCCESS);
+	CHECK(ReadPointer(image, TEST_POINTER_RVA, b64Bit) == qwNewBase + TEST_POINTER_TARGET_RVA);
+	CHECK(GetPEImageInfo(&image[0], TEST_IMAGE_SIZE, &imageInfo) == PE_ERROR_SUCCESS);
+	CHECK(imageInfo.qwImageBase == qwNewBase);
+	CHECK(RelocatePEImage(&image[0], TEST_IMAGE_SIZE, TEST_IMAGE_BASE) == PE_ERROR_SUCCESS);
+	CHECK(ReadPointer(image, TEST_POINTER_RVA, b64Bit) == TEST_IMAGE_BASE + TEST_POINTER_TARGET_RVA);
+	if (!b64Bit)
+		CHECK(RelocatePEImage(&image[0], TEST_IMAGE_SIZE, 0x100000000ULL) == PE_ERROR_NOT_RELOCATABLE);
+
+	// Binding the imports
+	RESOLVERLOG log;
+	log.bFail = false;
+	CHECK(BindPEImports(&image[0], TEST_IMAGE_SIZE, TestResolver, &log) == PE_ERROR_SUCCESS);
+	CHECK(log.imports.size() == 2);
+	CHECK((log.imports.size() > 0) && (log.imports[0] == "KERNEL32.dll!Sleep@291"));
+	CHECK((log.imports.size() > 1) && (log.imports[1] == "KERNEL32.dll!#7"));
+
+	uint32_t cbThunk = b64Bit ? sizeof(uint64_t) : sizeof(uint32_t);
+	CHECK(ReadPointer(image, TEST_IAT_RVA, b64Bit) == 0x70000010);
+	CHECK(ReadPointer(image, TEST_IAT_RVA + cbThunk, b64Bit) == 0x70000020);
+	CHECK(ReadPointer(image, TEST_LOOKUP_RVA, b64Bit) == TEST_FUNCTION_NAME_RVA);
+
+	log.bFail = true;
+	CHECK(BindPEImports(&image[0], TEST_IMAGE_SIZE, TestResolver, &log) == PE_ERROR_RESOLVER_FAILED);
+
+	// Exports, by name and ordinal
+	uint32_t dwFunctionRVA;
+	const char *lpszForwarder;
+	CHECK(FindPEExport(&image[0], TEST_IMAGE_SIZE, "Alpha", 0, &dwFunctionRVA, &lpszForwarder) == PE_ERROR_SUCCESS);
+	CHECK((dwFunctionRVA == TEST_TEXT_RVA + 0x20) && !lpszForwarder);
+	CHECK(FindPEExport(&image[0], TEST_IMAGE_SIZE, NULL, TEST_EXPORT_ORDINAL_BASE, &dwFunctionRVA, NULL) == PE_ERROR_SUCCESS);
+	CHECK(dwFunctionRVA == TEST_TEXT_RVA + 0x20);
+	CHECK(FindPEExport(&image[0], TEST_IMAGE_SIZE, NULL, TEST_EXPORT_ORDINAL_BASE + 1, &dwFunctionRVA, NULL) == PE_ERROR_NOT_FOUND);
+	CHECK(FindPEExport(&image[0], TEST_IMAGE_SIZE, NULL, TEST_EXPORT_ORDINAL_BASE + 3, &dwFunctionRVA, NULL) == PE_ERROR_NOT_FOUND);
+	CHECK(FindPEExport(&image[0], TEST_IMAGE_SIZE, NULL, TEST_EXPORT_ORDINAL_BASE - 1, &dwFunctionRVA, NULL) == PE_ERROR_NOT_FOUND);
+	CHECK(FindPEExport(&image[0], TEST_IMAGE_SIZE, "Beta", 0, &dwFunctionRVA, NULL) == PE_ERROR_NOT_FOUND);
+	CHECK(FindPEExport(&image[0], TEST_IMAGE_SIZE, "Forward", 0, &dwFunctionRVA, &lpszForwarder) == PE_ERROR_SUCCESS);
+	CHECK(!dwFunctionRVA && lpszForwarder && !strcmp(lpszForwarder, "NTDLL.RtlForwarded"));
+	CHECK(FindPEExport(&image[0], TEST_IMAGE_SIZE, "Forward", 0, &dwFunctionRVA, NULL) == PE_ERROR_NOT_FOUND);
+
+	// An image without relocations can only stay where it is
+	std::vector<uint8_t> stripped = file;
+	uint32_t dwCharacteristicsOffset = TEST_NEW_HEADER_OFFSET + sizeof(uint32_t) + offsetof(PEFILEHEADER, wCharacteristics);
+	PutValue<uint16_t>(stripped, dwCharacteristicsOffset, PE_FILE_DLL | PE_FILE_RELOCS_STRIPPED);
+
+	std::vector<uint8_t> strippedImage(TEST_IMAGE_SIZE);
+	CHECK(MapPEImage(&stripped[0], (uint32_t)stripped.size(), &strippedImage[0], TEST_IMAGE_SIZE) == PE_ERROR_SUCCESS);
+	CHECK(RelocatePEImage(&strippedImage[0], TEST_IMAGE_SIZE, TEST_IMAGE_BASE) == PE_ERROR_SUCCESS);
+	CHECK(RelocatePEImage(&strippedImage[0], TEST_IMAGE_SIZE, qwNewBase) == PE_ERROR_NOT_RELOCATABLE);
+
+	// Relocation types for other processors are refused
+	std::vector<uint8_t> foreign = file;
+	PutValue<uint16_t>(foreign, TEST_RELOC_RAW + sizeof(PEBASERELOCATION), (uint16_t)((5 << 12) | (TEST_POINTER_RVA - TEST_TEXT_RVA)));
+
+	std::vector<uint8_t> foreignImage(TEST_IMAGE_SIZE);
+	CHECK(MapPEImage(&foreign[0], (uint32_t)foreign.size(), &foreignImage[0], TEST_IMAGE_SIZE) == PE_ERROR_SUCCESS);
+	CHECK(RelocatePEImage(&foreignImage[0], TEST_IMAGE_SIZE, qwNewBase) == PE_ERROR_UNSUPPORTED);
+}
+
+// Runs every function on a damaged image. Nothing may crash or read outside the image, whatever it returns; the sanitizers catch it if anything does.
+static void ExerciseDamagedImage(const std::vector<uint8_t> &file, uint32_t cbFile)
+{
+	// Copied so that the sanitizers can see reads past the end
+	std::vector<uint8_t> damaged(file.begin(), file.begin() + cbFile);
+	const uint8_t *lpbyFile = cbFile ? &damaged[0] : NULL;
+	if (!lpbyFile)
+		return;
+
+	PEIMAGEINFO imageInfo;
+	if (GetPEImageInfo(lpbyFile, cbFile, &imageInfo) != PE_ERROR_SUCCESS)
+		return;
+
+	// Keep damaged sizes from allocating too much
+	if (imageInfo.cbImage > 0x100000)
+		return;
+
+	std::vector<uint8_t> image(imageInfo.cbImage ? imageInfo.cbImage : 1);
+	if (MapPEImage(lpbyFile, cbFile, &image[0], imageInfo.cbImage) != PE_ERROR_SUCCESS)
+		return;
+
+	RESOLVERLOG log;
+	log.bFail = false;
+
+	uint32_t dwFunctionRVA;
+	const char *lpszForwarder;
+
+	RelocatePEImage(&image[0], imageInfo.cbImage, imageInfo.qwImageBase + 0x10000);
+	BindPEImports(&image[0], imageInfo.cbImage, TestResolver, &log);
+	FindPEExport(&image[0], imageInfo.cbImage, "Alpha", 0, &dwFunctionRVA, &lpszForwarder);
+	FindPEExport(&image[0], imageInfo.cbImage, "Forward", 0, &dwFunctionRVA, &lpszForwarder);
+	FindPEExport(&image[0], imageInfo.cbImage, NULL, TEST_EXPORT_ORDINAL_BASE, &dwFunctionRVA, &lpszForwarder);
+}
+
+template<typename OPTIONALHEADER> static void TestDamagedImages(bool b64Bit)
+{
+	std::vector<uint8_t> file = BuildTestImage<OPTIONALHEADER>(b64Bit);
+
+	// Truncated anywhere in the headers, the image must be refused
+	for (uint32_t cbFile = 0; cbFile < TEST_HEADERS_SIZE; cbFile++)
+	{
+		PEIMAGEINFO imageInfo;
+		std::vector<uint8_t> truncated(file.begin(), file.begin() + cbFile);
+		CHECK(!cbFile || (GetPEImageInfo(&truncated[0], cbFile, &imageInfo) == PE_ERROR_BAD_FORMAT));
+	}
+
+	for (uint32_t cbFile = TEST_HEADERS_SIZE; cbFile <= file.size(); cbFile++)
+		ExerciseDamagedImage(file, cbFile);
+
+	// Every byte of the headers and tables set to values likely to break something
+	static const uint8_t byValues[] = { 0x00, 0x01, 0x7F, 0x80, 0xFF };
+	std::vector<uint32_t> offsets;
+	for (uint32_t dwOffset = 0; dwOffset < TEST_HEADERS_SIZE; dwOffset++)
+		offsets.push_back(dwOffset);
+	for (uint32_t dwOffset = DataOffset(TEST_DATA_RVA); dwOffset < DataOffset(TEST_DATA_RVA) + TEST_FILE_ALIGNMENT; dwOffset++)
+		offsets.push_back(dwOffset);
+	for (uint32_t dwOffset = TEST_RELOC_RAW; dwOffset < TEST_RELOC_RAW + 0x10; dwOffset++)
+		offsets.push_back(dwOffset);
+
+	for (uint32_t dwOffset : offsets)
+	{
+		for (uint8_t byValue : byValues)
+		{
+			std::vector<uint8_t> damaged = file;
+			damaged[dwOffset] = byValue;
+
+			ExerciseDamagedImage(damaged, (uint32_t)damaged.size());
+		}
+	}
+}
+
+int main()
+{
+	TestImage<PEOPTIONALHEADER32>(false);
+	TestImage<PEOPTIONALHEADER64>(true);
+	TestDamagedImages<PEOPTIONALHEADER32>(false);
+	TestDamagedImages<PEOPTIONALHEADER64>(true);
+
+	if (nFailures)
+	{
+		fprintf(stderr, "%d checks failed\n", nFailures);
+
+		return 1;
+	}
+
+	printf("All checks passed\n");
+
+	return 0;
+}
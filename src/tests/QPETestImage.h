@@ -0,0 +1,220 @@
+/*
+	The contents of this file are subject to the Common Development and Distribution License Version 1.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at http://www.sun.com/cddl/cddl.html.
+
+	Software distributed under the License is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for the specific language governing rights and limitations under the License.
+
+	The Initial Developer of the Original Code is Justin Olbrantz. The Original Code Copyright (C) 2007 Justin Olbrantz. All Rights Reserved.
+*/
+
+// Builds the synthetic DLL images the tests and benchmarks of QPEImage use, byte by byte, so that they don't depend on DLLs from any compiler. Each image has three sections, one imported module, exports by name, by ordinal and forwarded, and one relocation.
+
+// Prevent this header from being included multiple times
+#ifndef QPETESTIMAGE_H
+#define QPETESTIMAGE_H
+
+#include "QPEImage.h"
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+// The layout of the test image. The sections are aligned differently in the file and the image, so that MapPEImage has to move them.
+#define TEST_FILE_ALIGNMENT 0x200
+#define TEST_SECTION_ALIGNMENT 0x1000
+#define TEST_HEADERS_SIZE 0x400
+#define TEST_IMAGE_SIZE 0x4000
+#define TEST_FILE_SIZE 0xA00
+#define TEST_NEW_HEADER_OFFSET 0x80
+
+// .text: code, and an absolute pointer to .data that has to be relocated. Data past the virtual size is in the file, but must not be loaded.
+#define TEST_TEXT_RVA 0x1000
+#define TEST_TEXT_RAW 0x400
+#define TEST_TEXT_VIRTUAL_SIZE 0x180
+#define TEST_POINTER_RVA 0x1010
+#define TEST_POINTER_TARGET_RVA 0x2000
+#define TEST_HIDDEN_RVA 0x1190
+
+// .data: the import and export tables. The section is larger in the image than in the file, so the end of it is zero filled.
+#define TEST_DATA_RVA 0x2000
+#define TEST_DATA_RAW 0x600
+#define TEST_DATA_VIRTUAL_SIZE 0x800
+#define TEST_IMPORT_RVA 0x2000
+#define TEST_LOOKUP_RVA 0x2040
+#define TEST_IAT_RVA 0x2080
+#define TEST_MODULE_NAME_RVA 0x20C0
+#define TEST_FUNCTION_NAME_RVA 0x20D0
+#define TEST_IMPORT_ORDINAL 7
+#define TEST_EXPORT_RVA 0x2100
+#define TEST_EXPORT_SIZE 0x100
+#define TEST_EXPORT_ORDINAL_BASE 5
+#define TEST_FORWARDER_RVA 0x21C0
+
+// .reloc: one block, relocating the pointer in .text
+#define TEST_RELOC_RVA 0x3000
+#define TEST_RELOC_RAW 0x800
+
+#define TEST_IMAGE_BASE 0x10000000ULL
+
+static inline void Put(std::vector<uint8_t> &image, uint32_t dwOffset, const void *lpvData, size_t cbData)
+{
+	memcpy(&image[dwOffset], lpvData, cbData);
+}
+
+template<typename T> static inline void PutValue(std::vector<uint8_t> &image, uint32_t dwOffset, T value)
+{
+	Put(image, dwOffset, &value, sizeof(T));
+}
+
+static inline void PutString(std::vector<uint8_t> &image, uint32_t dwOffset, const char *lpszString)
+{
+	Put(image, dwOffset, lpszString, strlen(lpszString) + 1);
+}
+
+// Converts an RVA in .data to its offset in the file
+static inline uint32_t DataOffset(uint32_t dwRVA)
+{
+	return dwRVA - TEST_DATA_RVA + TEST_DATA_RAW;
+}
+
+static void PutSection(std::vector<uint8_t> &image, uint32_t dwOffset, const char *lpszName, uint32_t cbVirtualSize, uint32_t dwRVA, uint32_t cbRawData, uint32_t dwRawDataOffset, uint32_t dwCharacteristics)
+{
+	PESECTIONHEADER section;
+	memset(&section, 0, sizeof(section));
+
+	strncpy(section.szName, lpszName, sizeof(section.szName));
+	section.cbVirtualSize = cbVirtualSize;
+	section.dwRVA = dwRVA;
+	section.cbRawData = cbRawData;
+	section.dwRawDataOffset = dwRawDataOffset;
+	section.dwCharacteristics = dwCharacteristics;
+
+	Put(image, dwOffset, &section, sizeof(section));
+}
+
+// Builds the test DLL, as a file. OPTIONALHEADER decides the bitness.
+template<typename OPTIONALHEADER> static std::vector<uint8_t> BuildTestImage(bool b64Bit)
+{
+	std::vector<uint8_t> image(TEST_FILE_SIZE, 0);
+
+	PEDOSHEADER dosHeader;
+	memset(&dosHeader, 0, sizeof(dosHeader));
+	dosHeader.wMagic = PE_DOS_SIGNATURE;
+	dosHeader.lNewHeaderOffset = TEST_NEW_HEADER_OFFSET;
+	Put(image, 0, &dosHeader, sizeof(dosHeader));
+
+	PutValue<uint32_t>(image, TEST_NEW_HEADER_OFFSET, PE_NT_SIGNATURE);
+
+	PEFILEHEADER fileHeader;
+	memset(&fileHeader, 0, sizeof(fileHeader));
+	fileHeader.wMachine = b64Bit ? PE_MACHINE_AMD64 : PE_MACHINE_I386;
+	fileHeader.nSections = 3;
+	fileHeader.cbOptionalHeader = sizeof(OPTIONALHEADER);
+	fileHeader.wCharacteristics = PE_FILE_EXECUTABLE_IMAGE | PE_FILE_DLL;
+
+	uint32_t dwFileHeaderOffset = TEST_NEW_HEADER_OFFSET + sizeof(uint32_t);
+	Put(image, dwFileHeaderOffset, &fileHeader, sizeof(fileHeader));
+
+	OPTIONALHEADER optionalHeader;
+	memset(&optionalHeader, 0, sizeof(optionalHeader));
+	optionalHeader.wMagic = b64Bit ? PE_OPTIONAL_HEADER64_MAGIC : PE_OPTIONAL_HEADER32_MAGIC;
+	optionalHeader.dwEntryPointRVA = TEST_TEXT_RVA;
+	optionalHeader.cbSectionAlignment = TEST_SECTION_ALIGNMENT;
+	optionalHeader.cbFileAlignment = TEST_FILE_ALIGNMENT;
+	optionalHeader.cbImage = TEST_IMAGE_SIZE;
+	optionalHeader.cbHeaders = TEST_HEADERS_SIZE;
+	optionalHeader.nDataDirectories = PE_NUM_DIRECTORIES;
+	optionalHeader.dataDirectories[PE_DIRECTORY_IMPORT].dwRVA = TEST_IMPORT_RVA;
+	optionalHeader.dataDirectories[PE_DIRECTORY_IMPORT].cbSize = 2 * sizeof(PEIMPORTDESCRIPTOR);
+	optionalHeader.dataDirectories[PE_DIRECTORY_EXPORT].dwRVA = TEST_EXPORT_RVA;
+	optionalHeader.dataDirectories[PE_DIRECTORY_EXPORT].cbSize = TEST_EXPORT_SIZE;
+	optionalHeader.dataDirectories[PE_DIRECTORY_BASERELOC].dwRVA = TEST_RELOC_RVA;
+	optionalHeader.dataDirectories[PE_DIRECTORY_BASERELOC].cbSize = sizeof(PEBASERELOCATION) + 2 * sizeof(uint16_t);
+
+	uint32_t dwOptionalHeaderOffset = dwFileHeaderOffset + sizeof(PEFILEHEADER);
+	Put(image, dwOptionalHeaderOffset, &optionalHeader, sizeof(optionalHeader));
+
+	// The image base is the only field whose size differs, and the template can't name it
+	if (b64Bit)
+		PutValue<uint64_t>(image, dwOptionalHeaderOffset + 24, TEST_IMAGE_BASE);
+	else
+		PutValue<uint32_t>(image, dwOptionalHeaderOffset + 28, (uint32_t)TEST_IMAGE_BASE);
+
+	uint32_t dwSectionsOffset = dwOptionalHeaderOffset + sizeof(OPTIONALHEADER);
+	PutSection(image, dwSectionsOffset, ".text", TEST_TEXT_VIRTUAL_SIZE, TEST_TEXT_RVA, TEST_FILE_ALIGNMENT, TEST_TEXT_RAW, PE_SCN_MEM_EXECUTE | PE_SCN_MEM_READ);
+	PutSection(image, dwSectionsOffset + sizeof(PESECTIONHEADER), ".data", TEST_DATA_VIRTUAL_SIZE, TEST_DATA_RVA, TEST_FILE_ALIGNMENT, TEST_DATA_RAW, PE_SCN_MEM_READ | PE_SCN_MEM_WRITE);
+	PutSection(image, dwSectionsOffset + 2 * sizeof(PESECTIONHEADER), ".reloc", 0x0C, TEST_RELOC_RVA, TEST_FILE_ALIGNMENT, TEST_RELOC_RAW, PE_SCN_MEM_READ);
+
+	// .text: a recognizable byte pattern, the pointer, and a marker past the virtual size
+	for (uint32_t iByte = 0; iByte < 0x10; iByte++)
+		image[TEST_TEXT_RAW + iByte] = (uint8_t)(0x90 + iByte);
+
+	uint32_t dwPointerOffset = TEST_POINTER_RVA - TEST_TEXT_RVA + TEST_TEXT_RAW;
+	if (b64Bit)
+		PutValue<uint64_t>(image, dwPointerOffset, TEST_IMAGE_BASE + TEST_POINTER_TARGET_RVA);
+	else
+		PutValue<uint32_t>(image, dwPointerOffset, (uint32_t)(TEST_IMAGE_BASE + TEST_POINTER_TARGET_RVA));
+
+	image[TEST_HIDDEN_RVA - TEST_TEXT_RVA + TEST_TEXT_RAW] = 0xCC;
+
+	// .data: imports. One module, with one function imported by name and one by ordinal.
+	PEIMPORTDESCRIPTOR descriptor;
+	memset(&descriptor, 0, sizeof(descriptor));
+	descriptor.dwLookupTableRVA = TEST_LOOKUP_RVA;
+	descriptor.dwNameRVA = TEST_MODULE_NAME_RVA;
+	descriptor.dwAddressTableRVA = TEST_IAT_RVA;
+	Put(image, DataOffset(TEST_IMPORT_RVA), &descriptor, sizeof(descriptor));
+
+	uint32_t cbThunk = b64Bit ? sizeof(uint64_t) : sizeof(uint32_t);
+	for (uint32_t dwTableRVA : { (uint32_t)TEST_LOOKUP_RVA, (uint32_t)TEST_IAT_RVA })
+	{
+		if (b64Bit)
+		{
+			PutValue<uint64_t>(image, DataOffset(dwTableRVA), TEST_FUNCTION_NAME_RVA);
+			PutValue<uint64_t>(image, DataOffset(dwTableRVA + cbThunk), PE_ORDINAL_FLAG64 | TEST_IMPORT_ORDINAL);
+		}
+		else
+		{
+			PutValue<uint32_t>(image, DataOffset(dwTableRVA), TEST_FUNCTION_NAME_RVA);
+			PutValue<uint32_t>(image, DataOffset(dwTableRVA + cbThunk), PE_ORDINAL_FLAG32 | TEST_IMPORT_ORDINAL);
+		}
+	}
+
+	PutString(image, DataOffset(TEST_MODULE_NAME_RVA), "KERNEL32.dll");
+	PutValue<uint16_t>(image, DataOffset(TEST_FUNCTION_NAME_RVA), 0x123);
+	PutString(image, DataOffset(TEST_FUNCTION_NAME_RVA + sizeof(uint16_t)), "Sleep");
+
+	// .data: exports. Ordinal 5 is Alpha, 6 is unused, and 7 is Forward, which is forwarded to another module.
+	PEEXPORTDIRECTORY exportDir;
+	memset(&exportDir, 0, sizeof(exportDir));
+	exportDir.dwOrdinalBase = TEST_EXPORT_ORDINAL_BASE;
+	exportDir.nFunctions = 3;
+	exportDir.nNames = 2;
+	exportDir.dwFunctionsRVA = 0x2140;
+	exportDir.dwNamesRVA = 0x2150;
+	exportDir.dwNameOrdinalsRVA = 0x2160;
+	Put(image, DataOffset(TEST_EXPORT_RVA), &exportDir, sizeof(exportDir));
+
+	PutValue<uint32_t>(image, DataOffset(0x2140), TEST_TEXT_RVA + 0x20);
+	PutValue<uint32_t>(image, DataOffset(0x2144), 0);
+	PutValue<uint32_t>(image, DataOffset(0x2148), TEST_FORWARDER_RVA);
+	PutValue<uint32_t>(image, DataOffset(0x2150), 0x2180);
+	PutValue<uint32_t>(image, DataOffset(0x2154), 0x2190);
+	PutValue<uint16_t>(image, DataOffset(0x2160), 0);
+	PutValue<uint16_t>(image, DataOffset(0x2162), 2);
+	PutString(image, DataOffset(0x2180), "Alpha");
+	PutString(image, DataOffset(0x2190), "Forward");
+	PutString(image, DataOffset(TEST_FORWARDER_RVA), "NTDLL.RtlForwarded");
+
+	// .reloc: the pointer, and a padding entry
+	PEBASERELOCATION block;
+	block.dwPageRVA = TEST_TEXT_RVA;
+	block.cbBlock = sizeof(PEBASERELOCATION) + 2 * sizeof(uint16_t);
+	Put(image, TEST_RELOC_RAW, &block, sizeof(block));
+
+	uint16_t wRelocType = b64Bit ? PE_REL_BASED_DIR64 : PE_REL_BASED_HIGHLOW;
+	PutValue<uint16_t>(image, TEST_RELOC_RAW + sizeof(PEBASERELOCATION), (uint16_t)((wRelocType << 12) | (TEST_POINTER_RVA - TEST_TEXT_RVA)));
+	PutValue<uint16_t>(image, TEST_RELOC_RAW + sizeof(PEBASERELOCATION) + sizeof(uint16_t), PE_REL_BASED_ABSOLUTE << 12);
+
+	return image;
+}
+
+#endif // #ifndef QPETESTIMAGE_H